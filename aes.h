@@ -3,8 +3,9 @@
   * \brief This describes functions exported by aes.c.
   *
   * To use these functions, take an encryption key and use aesExpandKey() to
-  * expand it. Then use the expanded key in aesEncrypt() or aesDecrypt(),
-  * which turn a 16 byte plaintext into a 16 byte ciphertext (or vice versa).
+  * expand it. Then use the expanded key in aesEncrypt(), which turns a 16
+  * byte plaintext into a 16 byte ciphertext. For decryption, expand the key
+  * using aesExpandKeyDecrypt() instead, then use aesDecrypt().
   *
   * This file is licensed as described by the file LICENCE.
   */
@@ -19,7 +20,12 @@
 
 extern void xor16Bytes(uint8_t *r, uint8_t *op1);
 extern void aesExpandKey(uint8_t *expanded_key, uint8_t *key);
+extern void aesExpandKeyDecrypt(uint8_t *expanded_key, uint8_t *key);
+#if defined(AES_TTABLE) && !defined(PLATFORM_SPECIFIC_AES)
+extern RAM_FUNCTION void aesEncrypt(uint8_t *out, uint8_t *in, uint8_t *expanded_key);
+#else
 extern void aesEncrypt(uint8_t *out, uint8_t *in, uint8_t *expanded_key);
+#endif // #if defined(AES_TTABLE) && !defined(PLATFORM_SPECIFIC_AES)
 extern void aesDecrypt(uint8_t *out, uint8_t *in, uint8_t *expanded_key);
 
 #endif // #ifndef AES_H_INCLUDED
@@ -7,9 +7,25 @@
   * the storage space is not much (only 1024 bytes on the ATmega328), but it's
   * enough to fit a couple of wallets.
   *
+  * Programming one byte of EEPROM takes about 3.4 ms, so writes are not done
+  * straight away. Instead, nonVolatileWrite() puts them into a small
+  * write-back buffer in RAM, and the EE_READY interrupt programs the buffered
+  * bytes one by one in the background, while the CPU gets on with something
+  * else. Bytes whose value wouldn't change are skipped, since they don't need
+  * to be programmed at all. nonVolatileFlush() waits until the buffer has
+  * been completely written.
+  *
+  * The buffer is divided into lines of #LINE_SIZE bytes, each covering an
+  * aligned range of EEPROM addresses. Each line has a mask of which bytes
+  * are dirty (haven't been programmed yet); a line with no dirty bytes is
+  * free. Since programmed bytes are never kept in the buffer, a read only has
+  * to look at the buffer for dirty bytes.
+  *
   * This file is licensed as described by the file LICENCE.
   */
 
+#include <avr/io.h>
+#include <avr/interrupt.h>
 #include <avr/eeprom.h>
 
 #include "../common.h"
@@ -18,6 +34,151 @@
 /** Size of EEPROM, in number of bytes. */
 #define EEPROM_SIZE		1024
 
+/** Number of bytes in each line of the write-back buffer. This matches the
+  * block size of encryptedNonVolatileWrite(), which does most of the
+  * writing.
+  * \warning This must be a power of 2 and no more than 16, since the dirty
+  *          mask for each line is 16 bits.
+  */
+#define LINE_SIZE		16
+
+#ifndef EEPROM_WRITE_BUFFER_LINES
+/** Number of lines in the write-back buffer. RAM on the ATmega328 is very
+  * tight, so this is kept small. Writes which don't fit just wait for a line
+  * to be freed up. */
+#define EEPROM_WRITE_BUFFER_LINES	2
+#endif // #ifndef EEPROM_WRITE_BUFFER_LINES
+
+/** Contents of each line of the write-back buffer. Only the bytes whose bit
+  * is set in #line_dirty are meaningful. */
+static uint8_t line_data[EEPROM_WRITE_BUFFER_LINES][LINE_SIZE];
+/** EEPROM address of the first byte of each line. This is only meaningful
+  * if the line's entry in #line_dirty is non-zero. */
+static uint16_t line_address[EEPROM_WRITE_BUFFER_LINES];
+/** For each line, bit i is set if byte i of the line still needs to be
+  * programmed. The EE_READY interrupt clears bits as it programs bytes. */
+static volatile uint16_t line_dirty[EEPROM_WRITE_BUFFER_LINES];
+
+/** Enable the EE_READY interrupt, which will keep firing until the
+  * write-back buffer is empty. */
+static void startProgramming(void)
+{
+	cli();
+	EECR = (uint8_t)(EECR | _BV(EERIE));
+	sei();
+}
+
+/** Interrupt service routine which is called whenever the EEPROM is ready
+  * to be programmed (and #EERIE is set). This programs the next dirty byte
+  * in the write-back buffer, skipping any bytes which are already equal to
+  * what is in EEPROM. Once there is nothing left to program, the interrupt
+  * disables itself.
+  */
+ISR(EE_READY_vect)
+{
+	uint8_t i;
+	uint8_t j;
+	uint16_t dirty;
+	uint16_t address;
+
+	for (i = 0; i < EEPROM_WRITE_BUFFER_LINES; i++)
+	{
+		dirty = line_dirty[i];
+		for (j = 0; dirty != 0; j++, dirty >>= 1)
+		{
+			if ((dirty & 1) != 0)
+			{
+				line_dirty[i] = (uint16_t)(line_dirty[i] & ~(1 << j));
+				address = (uint16_t)(line_address[i] + j);
+				EEAR = address;
+				EECR = (uint8_t)(EECR | _BV(EERE)); // read current contents
+				if (EEDR != line_data[i][j])
+				{
+					EEDR = line_data[i][j];
+					// Erase and write in one operation. EEPE must be set
+					// within 4 cycles of EEMPE; interrupts are disabled
+					// here, so nothing can get in between.
+					EECR = (uint8_t)((EECR & ~(_BV(EEPM1) | _BV(EEPM0))) | _BV(EEMPE));
+					EECR = (uint8_t)(EECR | _BV(EEPE));
+					return;
+				}
+			}
+		}
+	}
+	// Nothing left to program.
+	EECR = (uint8_t)(EECR & ~_BV(EERIE));
+}
+
+/** Check whether everything in the write-back buffer has been programmed.
+  * \return true if the write-back buffer is empty, false if it isn't.
+  */
+static bool isWriteBufferEmpty(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < EEPROM_WRITE_BUFFER_LINES; i++)
+	{
+		if (line_dirty[i] != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Put one byte into the write-back buffer. If the byte's line isn't in the
+  * buffer and there are no free lines, this will wait until a line is freed
+  * up.
+  * \param one_byte The byte to write.
+  * \param address The EEPROM address to write it to.
+  */
+static void bufferOneByte(uint8_t one_byte, uint16_t address)
+{
+	uint8_t i;
+	uint8_t offset;
+	uint16_t base;
+
+	base = (uint16_t)(address & ~(LINE_SIZE - 1));
+	offset = (uint8_t)(address & (LINE_SIZE - 1));
+	while (true)
+	{
+		// The line search and update need to be atomic, otherwise the
+		// EE_READY interrupt could free up a line just after it was found.
+		cli();
+		for (i = 0; i < EEPROM_WRITE_BUFFER_LINES; i++)
+		{
+			if ((line_dirty[i] != 0) && (line_address[i] == base))
+			{
+				break;
+			}
+		}
+		if (i == EEPROM_WRITE_BUFFER_LINES)
+		{
+			// Not in buffer; look for a free line.
+			for (i = 0; i < EEPROM_WRITE_BUFFER_LINES; i++)
+			{
+				if (line_dirty[i] == 0)
+				{
+					line_address[i] = base;
+					break;
+				}
+			}
+		}
+		if (i < EEPROM_WRITE_BUFFER_LINES)
+		{
+			line_data[i][offset] = one_byte;
+			line_dirty[i] = (uint16_t)(line_dirty[i] | (1 << offset));
+			EECR = (uint8_t)(EECR | _BV(EERIE));
+			sei();
+			return;
+		}
+		sei();
+		// No free lines. Make sure the EE_READY interrupt is draining the
+		// buffer, then try again.
+		startProgramming();
+	}
+}
+
 /** Write to non-volatile storage.
   * \param data A pointer to the data to be written.
   * \param address Byte offset specifying where in non-volatile storage to
@@ -29,16 +190,17 @@
   */
 NonVolatileReturn nonVolatileWrite(uint8_t *data, uint32_t address, uint32_t length)
 {
+	uint16_t i;
+
 	if ((address > EEPROM_SIZE) || (length > EEPROM_SIZE)
 		|| ((address + length) > EEPROM_SIZE))
 	{
 		return NV_INVALID_ADDRESS;
 	}
-	eeprom_busy_wait();
-	// The (void *)(int) is there because pointers on AVR are 16 bit, so
-	// just doing (void *) would result in a "cast to pointer from integer
-	// of different size" warning.
-	eeprom_write_block(data, (void *)(int)address, (size_t)length);
+	for (i = 0; i < (uint16_t)length; i++)
+	{
+		bufferOneByte(data[i], (uint16_t)(address + i));
+	}
 	return NV_NO_ERROR;
 }
 
@@ -51,16 +213,50 @@ NonVolatileReturn nonVolatileWrite(uint8_t *data, uint32_t address, uint32_t len
   */
 NonVolatileReturn nonVolatileRead(uint8_t *data, uint32_t address, uint32_t length)
 {
+	uint8_t i;
+	uint8_t j;
+	uint16_t dirty;
+	uint16_t line_end;
+
 	if ((address > EEPROM_SIZE) || (length > EEPROM_SIZE)
 		|| ((address + (uint32_t)length) > EEPROM_SIZE))
 	{
 		return NV_INVALID_ADDRESS;
 	}
+	// The EE_READY interrupt uses EEAR and EEDR, so it must not run while
+	// eeprom_read_block() is using them.
+	cli();
+	EECR = (uint8_t)(EECR & ~_BV(EERIE));
+	sei();
 	eeprom_busy_wait();
 	// The (void *)(int) is there because pointers on AVR are 16 bit, so
 	// just doing (void *) would result in a "cast to pointer from integer
 	// of different size" warning.
 	eeprom_read_block(data, (void *)(int)address, (size_t)length);
+	// Anything still in the write-back buffer is newer than what's in
+	// EEPROM. No interrupt can change the buffer now.
+	for (i = 0; i < EEPROM_WRITE_BUFFER_LINES; i++)
+	{
+		dirty = line_dirty[i];
+		line_end = (uint16_t)(line_address[i] + LINE_SIZE);
+		if ((dirty == 0) || (line_end <= address) || (line_address[i] >= (address + length)))
+		{
+			continue;
+		}
+		for (j = 0; j < LINE_SIZE; j++)
+		{
+			if (((dirty & (1 << j)) != 0)
+				&& ((line_address[i] + j) >= address)
+				&& ((line_address[i] + j) < (address + length)))
+			{
+				data[line_address[i] + j - address] = line_data[i][j];
+			}
+		}
+	}
+	if (!isWriteBufferEmpty())
+	{
+		startProgramming();
+	}
 	return NV_NO_ERROR;
 }
 
@@ -69,8 +265,15 @@ NonVolatileReturn nonVolatileRead(uint8_t *data, uint32_t address, uint32_t leng
   */
 NonVolatileReturn nonVolatileFlush(void)
 {
-	// Nothing to do; writes are never buffered.
+	if (!isWriteBufferEmpty())
+	{
+		startProgramming();
+		while (!isWriteBufferEmpty())
+		{
+			// do nothing
+		}
+	}
+	// Wait for the last byte to finish programming.
+	eeprom_busy_wait();
 	return NV_NO_ERROR;
 }
-
-
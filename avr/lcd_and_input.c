@@ -216,20 +216,20 @@ static uint8_t accept_debounce;
 /** Debounce counter for cancel button. */
 static uint8_t cancel_debounce;
 
-/** Storage for the text of transaction output amounts. */
-static char list_amount[MAX_OUTPUTS][TEXT_AMOUNT_LENGTH];
-/** Storage for the text of transaction output addresses. */
-static char list_address[MAX_OUTPUTS][TEXT_ADDRESS_LENGTH];
-/** Index into #list_amount and #list_address which specifies where the next
-  * output amount/address will be copied into. */
+/** Storage for transaction outputs. These are kept in binary form and only
+  * converted to text when they are displayed. */
+static OutputDescriptor list_outputs[MAX_OUTPUTS];
+/** Index into #list_outputs which specifies where the next output will be
+  * copied into. */
 static uint8_t list_index;
 /** Whether the transaction fee has been set. If
   * the transaction fee still hasn't been set after parsing, then the
   * transaction is free. */
 static bool transaction_fee_set;
-/** Storage for transaction fee amount. This is only valid
-  * if #transaction_fee_set is true. */
-static char transaction_fee_amount[TEXT_AMOUNT_LENGTH];
+/** Storage for transaction fee amount, in the same binary form as
+  * OutputDescriptor#amount. This is only valid if #transaction_fee_set is
+  * true. */
+static uint8_t transaction_fee_amount[8];
 
 /** This does the scrolling and checks the state of the buttons. */
 ISR(TIMER0_COMPA_vect)
@@ -424,28 +424,17 @@ static void writeString(char *str, bool is_progmem)
 
 /** Notify the user interface that the transaction parser has seen a new
   * Bitcoin amount/address pair.
-  * \param text_amount The output amount, as a null-terminated text string
-  *                    such as "0.01".
-  * \param text_address The output address, as a null-terminated text string
-  *                     such as "1RaTTuSEN7jJUDiW1EGogHwtek7g9BiEn".
+  * \param output The output amount and address, in binary form.
   * \return false if no error occurred, true if there was not enough space to
   *         store the amount/address pair.
   */
-bool newOutputSeen(char *text_amount, char *text_address)
+bool newOutputSeen(OutputDescriptor *output)
 {
-	char *amount_dest;
-	char *address_dest;
-
 	if (list_index >= MAX_OUTPUTS)
 	{
 		return true; // not enough space to store the amount/address pair
 	}
-	amount_dest = list_amount[list_index];
-	address_dest = list_address[list_index];
-	strncpy(amount_dest, text_amount, TEXT_AMOUNT_LENGTH);
-	strncpy(address_dest, text_address, TEXT_ADDRESS_LENGTH);
-	amount_dest[TEXT_AMOUNT_LENGTH - 1] = '\0';
-	address_dest[TEXT_ADDRESS_LENGTH - 1] = '\0';
+	memcpy(&(list_outputs[list_index]), output, sizeof(OutputDescriptor));
 	list_index++;
 	return false; // success
 }
@@ -453,13 +442,12 @@ bool newOutputSeen(char *text_amount, char *text_address)
 /** Notify the user interface that the transaction parser has seen the
   * transaction fee. If there is no transaction fee, the transaction parser
   * will not call this.
-  * \param text_amount The transaction fee, as a null-terminated text string
-  *                    such as "0.01".
+  * \param amount The transaction fee, as a 64 bit, unsigned, little-endian
+  *               integer with the amount in 10 ^ -8 BTC.
   */
-void setTransactionFee(char *text_amount)
+void setTransactionFee(uint8_t *amount)
 {
-	strncpy(transaction_fee_amount, text_amount, TEXT_AMOUNT_LENGTH);
-	transaction_fee_amount[TEXT_AMOUNT_LENGTH - 1] = '\0';
+	memcpy(transaction_fee_amount, amount, sizeof(transaction_fee_amount));
 	transaction_fee_set = true;
 }
 
@@ -575,6 +563,8 @@ bool userDenied(AskUserCommand command)
 {
 	uint8_t i;
 	bool r; // what will be returned
+	char text_amount[TEXT_AMOUNT_LENGTH];
+	char text_address[TEXT_ADDRESS_LENGTH];
 
 	clearLcd();
 
@@ -601,14 +591,15 @@ bool userDenied(AskUserCommand command)
 	{
 		for (i = 0; i < list_index; i++)
 		{
+			outputToText(text_amount, text_address, &(list_outputs[i]));
 			clearLcd();
 			waitForNoButtonPress();
 			gotoStartOfLine(0);
 			writeString(str_sign_part0, true);
-			writeString(list_amount[i], false);
+			writeString(text_amount, false);
 			writeString(str_sign_part1, true);
 			gotoStartOfLine(1);
-			writeString(list_address[i], false);
+			writeString(text_address, false);
 			r = waitForButtonPress();
 			if (r)
 			{
@@ -625,7 +616,8 @@ bool userDenied(AskUserCommand command)
 			gotoStartOfLine(0);
 			writeString(str_fee_part0, true);
 			gotoStartOfLine(1);
-			writeString(transaction_fee_amount, false);
+			amountToText(text_amount, transaction_fee_amount);
+			writeString(text_amount, false);
 			writeString(str_fee_part1, true);
 			r = waitForButtonPress();
 		}
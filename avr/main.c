@@ -50,6 +50,9 @@ int main(void)
 	initAdc();
 	initLcdAndInput();
 
+	// If a format was interrupted (eg. by a loss of power), finish it
+	// before doing anything else.
+	finishInterruptedSanitisation();
 	do
 	{
 		processPacket();
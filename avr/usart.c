@@ -209,6 +209,77 @@ static uint8_t usartReceive(void)
 	return r;
 }
 
+/** Queue up to a number of bytes for transmission through USART0. If the
+  * transmit buffer is full, this will block until it isn't, but it won't
+  * wait for more space than is needed to queue one byte.
+  * \param data The bytes to send.
+  * \param length The maximum number of bytes to queue. This must be
+  *               non-zero.
+  * \return The number of bytes that were queued. This will be between 1
+  *         and length inclusive.
+  */
+static uint16_t usartSendBytes(const uint8_t *data, uint32_t length)
+{
+	uint16_t count;
+
+	while (tx_buffer_full)
+	{
+		// do nothing
+	}
+	cli();
+	count = 0;
+	while ((count < length) && !tx_buffer_full)
+	{
+		tx_buffer[tx_buffer_end] = data[count];
+		tx_buffer_end++;
+		tx_buffer_end = (uint8_t)(tx_buffer_end & TX_BUFFER_MASK);
+		if (tx_buffer_start == tx_buffer_end)
+		{
+			tx_buffer_full = true;
+		}
+		count++;
+	}
+	// The UDRE interrupt will fire straight away if UDR0 is empty, so there
+	// is no need to special-case an idle transmitter like usartSend() does.
+	UCSR0B |= _BV(UDRIE0);
+	sei();
+	return count;
+}
+
+/** Receive up to a number of bytes through USART0. If there isn't a byte
+  * in the receive buffer, this will block until there is, but it won't wait
+  * for more bytes than are currently in the receive buffer.
+  * \param data The received bytes will be written here. This must have
+  *             space for length bytes.
+  * \param length The maximum number of bytes to receive. This must be
+  *               non-zero.
+  * \return The number of bytes that were received. This will be between 1
+  *         and length inclusive.
+  */
+static uint16_t usartReceiveBytes(uint8_t *data, uint32_t length)
+{
+	uint16_t count;
+
+	// The check in the loop doesn't need to be atomic, because the worst
+	// that can happen is that the loop spins one extra time.
+	while ((rx_buffer_start == rx_buffer_end) && !rx_buffer_full)
+	{
+		// do nothing
+	}
+	cli();
+	count = 0;
+	while ((count < length) && ((rx_buffer_start != rx_buffer_end) || rx_buffer_full))
+	{
+		data[count] = rx_buffer[rx_buffer_start];
+		rx_buffer_start++;
+		rx_buffer_start = (uint8_t)(rx_buffer_start & RX_BUFFER_MASK);
+		rx_buffer_full = false;
+		count++;
+	}
+	sei();
+	return count;
+}
+
 /** This is called if a stream read or write error occurs. It never returns.
   * \warning Only call this if the error is unrecoverable. It halts the CPU.
   */
@@ -223,6 +294,34 @@ static void streamReadOrWriteError(void)
 	}
 }
 
+/** Account for bytes taken out of the receive buffer, sending an
+  * acknowledgement to the other side if it has sent as much as it is
+  * allowed to. This also checks for receive buffer overruns.
+  * \param count The number of bytes taken out of the receive buffer.
+  */
+static void receiveAcknowledge(uint32_t count)
+{
+	rx_acknowledge -= count;
+	if (rx_acknowledge == 0)
+	{
+		// Send acknowledgement to other side.
+		uint8_t buffer[4];
+		uint8_t i;
+
+		rx_acknowledge = RX_BUFFER_SIZE;
+		writeU32LittleEndian(buffer, rx_acknowledge);
+		usartSend(0xff);
+		for (i = 0; i < 4; i++)
+		{
+			usartSend(buffer[i]);
+		}
+	}
+	if (rx_buffer_overrun)
+	{
+		streamReadOrWriteError();
+	}
+}
+
 /** Grab one byte from the communication stream. There is no way for this
   * function to indicate a read error. This is intentional; it
   * makes program flow simpler (no need to put checks everywhere). As a
@@ -250,26 +349,7 @@ uint8_t streamGetOneByte(void)
 {
 	uint8_t one_byte;
 
-	one_byte = usartReceive();
-	rx_acknowledge--;
-	if (rx_acknowledge == 0)
-	{
-		// Send acknowledgement to other side.
-		uint8_t buffer[4];
-		uint8_t i;
-
-		rx_acknowledge = RX_BUFFER_SIZE;
-		writeU32LittleEndian(buffer, rx_acknowledge);
-		usartSend(0xff);
-		for (i = 0; i < 4; i++)
-		{
-			usartSend(buffer[i]);
-		}
-	}
-	if (rx_buffer_overrun)
-	{
-		streamReadOrWriteError();
-	}
+	streamGetBytes(&one_byte, 1);
 	return one_byte;
 }
 
@@ -285,23 +365,111 @@ uint8_t streamGetOneByte(void)
   */
 void streamPutOneByte(uint8_t one_byte)
 {
-	usartSend(one_byte);
-	tx_acknowledge--;
-	if (tx_acknowledge == 0)
+	streamPutBytes(&one_byte, 1);
+}
+
+/** Grab a number of bytes from the communication stream. Bytes are moved
+  * out of the receive buffer in chunks, stopping only when the receive
+  * buffer runs dry or when an acknowledgement needs to be sent.
+  * See streamGetOneByte() for why this can't indicate read errors.
+  * \param buffer The received bytes will be written here. This must have
+  *               space for length bytes.
+  * \param length The number of bytes to receive.
+  */
+void streamGetBytes(uint8_t *buffer, uint32_t length)
+{
+	uint16_t count;
+
+	while (length > 0)
 	{
-		// Need to wait for acknowledgement from other side.
-		uint8_t buffer[4];
-		uint8_t i;
+		count = usartReceiveBytes(buffer, MIN(length, rx_acknowledge));
+		buffer += count;
+		length -= count;
+		receiveAcknowledge(count);
+	}
+}
 
-		do
-		{
-			// do nothing
-		} while (usartReceive() != 0xff);
-		for (i = 0; i < 4; i++)
+/** Borrow bytes straight out of the receive buffer, without copying them.
+  * See streamBorrowBytes() in hwinterface.h for more details.
+  * \param length The number of contiguous bytes available at the returned
+  *               address will be written here. This will be at least 1.
+  * \return A pointer to the borrowed bytes.
+  */
+const uint8_t *streamBorrowBytes(uint32_t *length)
+{
+	uint16_t count;
+
+	// The check in the loop doesn't need to be atomic, because the worst
+	// that can happen is that the loop spins one extra time.
+	while ((rx_buffer_start == rx_buffer_end) && !rx_buffer_full)
+	{
+		// do nothing
+	}
+	cli();
+	if (rx_buffer_full || (rx_buffer_end < rx_buffer_start))
+	{
+		// The bytes wrap around the end of the buffer; only the ones up to
+		// the end are contiguous.
+		count = (uint16_t)(RX_BUFFER_SIZE - rx_buffer_start);
+	}
+	else
+	{
+		count = (uint16_t)(rx_buffer_end - rx_buffer_start);
+	}
+	sei();
+	*length = MIN(count, rx_acknowledge);
+	return (const uint8_t *)&(rx_buffer[rx_buffer_start]);
+}
+
+/** Remove bytes previously borrowed by streamBorrowBytes() from the receive
+  * buffer.
+  * \param length The number of bytes to remove.
+  */
+void streamReleaseBytes(uint32_t length)
+{
+	if (length > 0)
+	{
+		cli();
+		rx_buffer_start = (uint8_t)((rx_buffer_start + length) & RX_BUFFER_MASK);
+		rx_buffer_full = false;
+		sei();
+		receiveAcknowledge(length);
+	}
+}
+
+/** Send a number of bytes to the communication stream. Bytes are moved
+  * into the transmit buffer in chunks, stopping only when the transmit
+  * buffer fills up or when an acknowledgement needs to be waited for.
+  * See streamGetOneByte() for why this can't indicate write errors.
+  * \param buffer The bytes to send.
+  * \param length The number of bytes to send.
+  */
+void streamPutBytes(const uint8_t *buffer, uint32_t length)
+{
+	uint16_t count;
+
+	while (length > 0)
+	{
+		count = usartSendBytes(buffer, MIN(length, tx_acknowledge));
+		buffer += count;
+		length -= count;
+		tx_acknowledge -= count;
+		if (tx_acknowledge == 0)
 		{
-			buffer[i] = usartReceive();
+			// Need to wait for acknowledgement from other side.
+			uint8_t ack_buffer[4];
+			uint8_t i;
+
+			do
+			{
+				// do nothing
+			} while (usartReceive() != 0xff);
+			for (i = 0; i < 4; i++)
+			{
+				ack_buffer[i] = usartReceive();
+			}
+			tx_acknowledge = readU32LittleEndian(ack_buffer);
 		}
-		tx_acknowledge = readU32LittleEndian(buffer);
 	}
 }
 
@@ -361,6 +529,9 @@ void sanitiseRam(void)
 	// was called as a result of a "unload wallet" packet, since the host
 	// isn't supposed to send anything until it receives a response from
 	// here.
+	// The EEPROM write-back buffer lives in RAM, so anything still in it
+	// must be programmed before it is cleared.
+	nonVolatileFlush();
 
 	saved_rx_acknowledge = rx_acknowledge;
 	saved_tx_acknowledge = tx_acknowledge;
@@ -0,0 +1,37 @@
+/** \file background.h
+  *
+  * \brief Describes the macro used to mark points where long operations can
+  *        let background tasks run.
+  *
+  * Background tasks are only compiled in if BACKGROUND_TASKS is defined. If
+  * it isn't, BACKGROUND_YIELD() expands to nothing. When background tasks
+  * are enabled, each BACKGROUND_YIELD() calls backgroundYield() (see
+  * hwinterface.h), which gives every one of the platform's background tasks
+  * a chance to do a small piece of work. This lets things like entropy
+  * collection progress during long operations such as key derivation, point
+  * multiplication and non-volatile storage sanitisation.
+  *
+  * Yield points must be somewhere where the amount of work done so far
+  * doesn't depend on any secret, so that they don't introduce a timing side
+  * channel.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifndef BACKGROUND_H_INCLUDED
+#define BACKGROUND_H_INCLUDED
+
+#ifdef BACKGROUND_TASKS
+
+#include "hwinterface.h"
+
+/** Let background tasks run for a bit. */
+#define BACKGROUND_YIELD()	backgroundYield()
+
+#else
+
+#define BACKGROUND_YIELD()
+
+#endif // #ifdef BACKGROUND_TASKS
+
+#endif // #ifndef BACKGROUND_H_INCLUDED
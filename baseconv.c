@@ -24,15 +24,19 @@
 #include "bignum256.h"
 #include "sha256.h"
 
-/** Shift list for bigDivide() to have it do division by 58. */
-static const uint8_t base58_shift_list[16] PROGMEM = {
-0x00, 0x1d, 0x80, 0x0e, 0x40, 0x07, 0xa0, 0x03,
-0xd0, 0x01, 0xe8, 0x00, 0x74, 0x00, 0x3a, 0x00};
-
-/** Shift list for bigDivide() to have it do division by 10. */
-static const uint8_t base10_shift_list[16] PROGMEM = {
-0x00, 0x05, 0x80, 0x02, 0x40, 0x01, 0xa0, 0x00,
-0x50, 0x00, 0x28, 0x00, 0x14, 0x00, 0x0a, 0x00};
+/** Number of base 58 digits which divideLimbs() extracts at a time, in
+  * hashToAddr(). */
+#define BASE58_DIGITS_PER_DIVISION	5
+/** 58 ^ #BASE58_DIGITS_PER_DIVISION. This is the largest power of 58 which
+  * fits in 32 bits. */
+#define BASE58_DIVISOR				656356768UL
+/** Number of 32 bit limbs used to hold the 25 byte payload (version +
+  * hash + checksum) in hashToAddr(). */
+#define ADDRESS_LIMBS				7
+
+/** 10 ^ (number of decimal places in an amount). amountToText() divides
+  * by this, so that each division yields 8 decimal digits. */
+#define BASE10_DIVISOR				100000000UL
 
 /** Characters for the base 10 representation of numbers. */
 static const char base10_char_list[10] PROGMEM = {
@@ -47,50 +51,29 @@ static const char base58_char_list[58] PROGMEM = {
 'h', 'i', 'j', 'k', 'm', 'n', 'o', 'p', 'q', 'r',
 's', 't', 'u', 'v', 'w', 'x', 'y', 'z'};
 
-/** Do a multi-precision division of op1 by an 8 bit unsigned integer n,
-  * placing the quotient in r and the remainder in op1.
-  * \param r The quotient will be placed here. This should be an array with
-  *          space for size bytes.
-  * \param op1 As an input, this is the dividend, a multi-precision number.
-  *            But on output, this will be be remainder. This should be an
-  *            array with space for size + 1 bytes.
-  * \param temp A temporary work area. Its contents will be overwritten with
-  *             junk. This should be an array with space for size + 1 bytes.
-  * \param size The size of the division, in number of bytes.
-  * \param shift_list Specifies the divisor (the 8 bit unsigned integer n).
-  *                   This is actually an array of 8 little-endian 16 bit
-  *                   unsigned integers which are:
-  *                   n << 7, n << 6, n << 5, ..., n << 0.
-  * \warning r, op1 and temp cannot alias each other.
-  * \warning For platforms that use the PROGMEM attribute, the shift_list
-  *          array must have that attribute.
+/** Do a multi-precision division of op1 by a 32 bit unsigned integer,
+  * placing the quotient in op1.
+  * The number of operations does not depend on the value of op1.
+  * \param op1 As an input, this is the dividend, an array of little-endian
+  *            32 bit limbs. On output, this will be the quotient.
+  * \param num_limbs The number of limbs in op1.
+  * \param divisor The divisor. This must not be 0.
+  * \return The remainder.
   */
-static void bigDivide(uint8_t *r, uint8_t *op1, uint8_t *temp, uint8_t size, const uint8_t *shift_list)
+static uint32_t divideLimbs(uint32_t *op1, const uint8_t num_limbs, const uint32_t divisor)
 {
+	uint64_t partial;
+	uint32_t remainder;
 	uint8_t i;
-	uint8_t j;
-	uint8_t one_bit;
-
-	memset(temp, 0, (uint16_t)(size + 1));
-	memset(r, 0, size);
-	op1[size] = 0;
 
-	for (i = (uint8_t)(size - 1); i < size; i--)
+	remainder = 0;
+	for (i = (uint8_t)(num_limbs - 1); i < num_limbs; i--)
 	{
-		one_bit = 0x80;
-		for (j = 0; j < 8; j++)
-		{
-			temp[i] = LOOKUP_BYTE(shift_list[j * 2]);
-			temp[i + 1] = LOOKUP_BYTE(shift_list[j * 2 + 1]);
-			if (bigCompareVariableSize(temp, op1, (uint8_t)(size + 1)) != BIGCMP_GREATER)
-			{
-				bigSubtractVariableSizeNoModulo(op1, op1, temp, (uint8_t)(size + 1));
-				r[i] |= one_bit;
-			}
-			one_bit >>= 1;
-		}
-		temp[i + 1] = 0;
+		partial = ((uint64_t)remainder << 32) | op1[i];
+		op1[i] = (uint32_t)(partial / divisor);
+		remainder = (uint32_t)(partial % divisor);
 	}
+	return remainder;
 }
 
 /** Convert a transaction amount (which is in 10 ^ -8 BTC) to a human-readable
@@ -102,26 +85,32 @@ static void bigDivide(uint8_t *r, uint8_t *op1, uint8_t *temp, uint8_t size, con
   */
 void amountToText(char *out, uint8_t *in)
 {
-	uint8_t op1[9];
-	uint8_t temp[9];
-	uint8_t r[8];
+	uint32_t limbs[2];
+	uint32_t remainder;
 	uint8_t i;
 	uint8_t j;
 	uint8_t index;
 
-	memcpy(r, in, 8);
+	limbs[0] = readU32LittleEndian(in);
+	limbs[1] = readU32LittleEndian(&(in[4]));
 
 	// Write amount into a string like: "000000000000.00000000".
+	// Each division by 10 ^ 8 yields 8 digits, which are then extracted using
+	// single-precision arithmetic.
+	remainder = 0;
 	index = 20;
 	for (i = 0; i < 20; i++)
 	{
-		memcpy(op1, r, 8);
-		bigDivide(r, op1, temp, 8, base10_shift_list);
+		if ((i % 8) == 0)
+		{
+			remainder = divideLimbs(limbs, 2, BASE10_DIVISOR);
+		}
 		if (i == 8)
 		{
 			out[index--] = '.';
 		}
-		out[index--] = LOOKUP_BYTE(base10_char_list[op1[0]]);
+		out[index--] = LOOKUP_BYTE(base10_char_list[remainder % 10]);
+		remainder /= 10;
 	}
 	out[21] = '\0';
 
@@ -169,9 +158,9 @@ void amountToText(char *out, uint8_t *in)
   */
 void hashToAddr(char *out, uint8_t *in, uint8_t address_version)
 {
-	uint8_t r[25];
-	uint8_t op1[26];
-	uint8_t temp[26];
+	uint8_t r[ADDRESS_LIMBS * 4];
+	uint32_t limbs[ADDRESS_LIMBS];
+	uint32_t remainder;
 	uint8_t index;
 	uint8_t i;
 	uint8_t j;
@@ -204,13 +193,23 @@ void hashToAddr(char *out, uint8_t *in, uint8_t address_version)
 		}
 	}
 
-	// Convert to base 58.
+	// Convert to base 58. Rather than extracting one digit at a time,
+	// divide by the largest power of 58 that fits in 32 bits, then split
+	// the remainder into digits using single-precision arithmetic.
+	memset(&(r[25]), 0, sizeof(r) - 25);
+	for (i = 0; i < ADDRESS_LIMBS; i++)
+	{
+		limbs[i] = readU32LittleEndian(&(r[i * 4]));
+	}
 	index = 34;
-	for (i = 0; i < 35; i++)
+	for (i = 0; i < (35 / BASE58_DIGITS_PER_DIVISION); i++)
 	{
-		memcpy(op1, r, 25);
-		bigDivide(r, op1, temp, 25, base58_shift_list);
-		out[index--] = LOOKUP_BYTE(base58_char_list[op1[0]]);
+		remainder = divideLimbs(limbs, ADDRESS_LIMBS, BASE58_DIVISOR);
+		for (j = 0; j < BASE58_DIGITS_PER_DIVISION; j++)
+		{
+			out[index--] = LOOKUP_BYTE(base58_char_list[remainder % 58]);
+			remainder /= 58;
+		}
 	}
 	out[35] = '\0';
 
@@ -242,6 +241,22 @@ void hashToAddr(char *out, uint8_t *in, uint8_t address_version)
 	}
 }
 
+/** Convert a transaction output to human-readable amount and address text.
+  * \param text_amount The amount will be written here, as a null-terminated
+  *                    string. This should point to a buffer with space for
+  *                    at least #TEXT_AMOUNT_LENGTH characters.
+  * \param text_address The address will be written here, as a
+  *                     null-terminated string. This should point to a buffer
+  *                     with space for at least #TEXT_ADDRESS_LENGTH
+  *                     characters.
+  * \param output The transaction output to convert.
+  */
+void outputToText(char *text_amount, char *text_address, OutputDescriptor *output)
+{
+	amountToText(text_amount, output->amount);
+	hashToAddr(text_address, output->hash, output->address_version);
+}
+
 #ifdef TEST_BASECONV
 
 /** Stores one test case for amountToText(). */
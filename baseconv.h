@@ -34,8 +34,25 @@
   * address. This includes the terminating null. */
 #define TEXT_ADDRESS_LENGTH	36
 
+/** Compact, binary description of a transaction output. The transaction
+  * parser passes these to the user interface, which only converts them to
+  * text (see outputToText()) when they are about to be displayed. */
+typedef struct OutputDescriptorStruct
+{
+	/** The output amount, as a 64 bit, unsigned, little-endian integer with
+	  * the amount in 10 ^ -8 BTC. */
+	uint8_t amount[8];
+	/** The 160 bit (public key or script) hash that the output pays to, in
+	  * big-endian format. */
+	uint8_t hash[20];
+	/** The address version, which determines the type of address. This
+	  * should be #ADDRESS_VERSION_PUBKEY or #ADDRESS_VERSION_P2SH. */
+	uint8_t address_version;
+} OutputDescriptor;
+
 extern void amountToText(char *out, uint8_t *in);
 extern void hashToAddr(char *out, uint8_t *in, uint8_t address_version);
+extern void outputToText(char *text_amount, char *text_address, OutputDescriptor *output);
 
 #endif // #ifndef BASECONV_H_INCLUDED
 
@@ -0,0 +1,868 @@
+/** \file bench.c
+  *
+  * \brief Host-side micro-benchmarks for the performance-critical parts of
+  *        the wallet firmware.
+  *
+  * This is built by "make bench", which compiles every source file with
+  * optimisation (and without assertions) and with -DTEST -DTEST_BENCH,
+  * so that the test implementations of the hardware interface functions
+  * are available. Each benchmark repeats an operation until it has run for
+  * at least a minimum amount of time, then reports the average time taken
+  * per operation, the average number of CPU cycles per operation (if a
+  * cycle counter is available) and, for operations which process a
+  * message, the throughput in bytes per second.
+  *
+  * Results are printed in human-readable form and are also written, in
+  * comma-separated values format, to a file, so that they can be compared
+  * between builds in order to track speedups and regressions.
+  *
+  * The transaction parser is also benchmarked over a sweep of generated
+  * transactions (see generateTestTransaction()), with the number of inputs
+  * and outputs ranging up to the limits the parser accepts, so that the
+  * fixed and per-byte costs of parsing and hashing can be separated. The
+  * multi-input signing workflow is benchmarked end to end, by feeding
+  * SignTransactionMultiple packets through processPacket().
+  *
+  * Finally, the operations which are supposed to run in data-independent
+  * time (bigMultiply(), bigInvert(), pointMultiply() and ecdsaSign()) are
+  * checked for timing leakage, in the style of dudect: each is timed many
+  * times with an input drawn randomly from one of two classes (a fixed,
+  * low Hamming weight input and uniformly random inputs), and Welch's
+  * t-test is used to see whether the two classes take measurably
+  * different amounts of time. The test is repeated with the slowest
+  * measurements cropped off at several percentiles, since interrupts and
+  * other noise only ever make measurements longer. A |t| greater
+  * than #LEAKAGE_T_THRESHOLD means that there is probably a data-dependent
+  * timing difference. This doesn't prove the absence of leakage, but it
+  * catches the kind of mistake (an early exit, a table lookup indexed by a
+  * secret, a skipped addition) that an optimisation could reintroduce.
+  *
+  * The usage is "benchmark [results_file [minimum_time_in_ms]]". The
+  * default results file is "bench_results.csv" and the default minimum
+  * time is 250 ms.
+  *
+  * If TEST_BENCH is not defined, this file will appear as an empty
+  * translation unit to the compiler.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifdef TEST_BENCH
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+#include "common.h"
+#include "bignum256.h"
+#include "ecdsa.h"
+#include "sha256.h"
+#include "hmac_sha512.h"
+#include "pbkdf2.h"
+#include "aes.h"
+#include "endian.h"
+#include "transaction.h"
+#include "stream_comm.h"
+#include "hwinterface.h"
+#include "wallet.h"
+#include "prandom.h"
+#include "test_helpers.h"
+
+/** Default name of the file that results are written to. */
+#define DEFAULT_RESULTS_FILE	"bench_results.csv"
+/** Default minimum time (in milliseconds) that each benchmark runs for. */
+#define DEFAULT_MIN_TIME_MS		250
+/** Number of outputs in the transactions used by the end to end signing
+  * benchmarks. */
+#define SIGN_NUM_OUTPUTS		2
+/** Space (in bytes) reserved for the packet header, SignTransactionMultiple
+  * fields and trailing ButtonAck packet of each signing request. */
+#define SIGN_PACKET_OVERHEAD	64
+
+/** Number of measurements taken by runLeakageTest() between checks of the
+  * elapsed time. The first batch is also used to choose the cropping
+  * thresholds. */
+#define LEAKAGE_BATCH_SIZE		256
+/** Each timing leakage test runs for this many times the minimum benchmark
+  * time, since small timing differences need many measurements to show
+  * up. */
+#define LEAKAGE_TIME_FACTOR		8
+/** Number of t-tests run on each set of measurements: one on every
+  * measurement, and one for each entry in #leakage_crop_percentiles. */
+#define LEAKAGE_NUM_TESTS		6
+/** A |t| above this is considered evidence of timing leakage. This is the
+  * threshold which dudect uses. */
+#define LEAKAGE_T_THRESHOLD		4.5
+
+/** A known good transaction, copied from the unit tests in transaction.c.
+  * It consists of one input transaction followed by the main transaction,
+  * which is what parseTransaction() expects. */
+static const uint8_t test_transaction[] = {
+// The first (and only) input transaction.
+// This isn't part of the intercepted transaction; it was obtained from
+// blockexplorer.com.
+0x01, // is_ref = 1 (input)
+0x01, 0x00, 0x00, 0x00, // output number to examine
+0x01, 0x00, 0x00, 0x00, // version
+0x01, // number of inputs
+0xdf, 0x08, 0xf9, 0xa3, 0x7c, 0x6d, 0x71, 0x3c, // previous output
+0x6a, 0x99, 0x2e, 0x88, 0x29, 0x8e, 0x0b, 0x4c,
+0x8f, 0xb5, 0xf9, 0x0e, 0x11, 0xf0, 0x2c, 0xa7,
+0x36, 0x72, 0xeb, 0x58, 0xb3, 0x04, 0xef, 0xc0,
+0x01, 0x00, 0x00, 0x00, // number in previous output
+0x8a, // script length
+0x47, // 71 bytes of data follows
+0x30, 0x44, 0x02, 0x20, 0x1b, 0xf4, 0xef, 0x3c, 0x34, 0x96, 0x02, 0x9b, 0x1a,
+0xb1, 0xc8, 0x49, 0xbf, 0x18, 0x55, 0xcc, 0x16, 0xbc, 0x52, 0x6d, 0xcc, 0x20,
+0xfb, 0x7c, 0x0a, 0x1d, 0x48, 0xd6, 0xe9, 0xbd, 0xd7, 0xb1, 0x02, 0x20, 0x53,
+0xb1, 0xa3, 0xaa, 0xbf, 0xd3, 0x87, 0x84, 0xdc, 0xf3, 0x10, 0xe5, 0xd2, 0x09,
+0xa4, 0xba, 0xb0, 0x01, 0x62, 0xe5, 0xbc, 0x09, 0x75, 0x9d, 0x4f, 0x74, 0x2c,
+0xb4, 0x6b, 0x32, 0x37, 0x2c, 0x01,
+0x41, // 65 bytes of data follows
+0x04, 0x05, 0x4d, 0xb5, 0xe0, 0x8e, 0x2a, 0x33, 0x89, 0x2c, 0xf3, 0x4b, 0x7e,
+0xbc, 0x18, 0x3b, 0xa5, 0xf5, 0x54, 0xc6, 0x9d, 0x6d, 0x21, 0x65, 0x60, 0x89,
+0xf5, 0x5e, 0x2d, 0x0f, 0x3a, 0x68, 0x08, 0x23, 0x83, 0x19, 0xcd, 0x89, 0xba,
+0xda, 0x09, 0x9b, 0xc6, 0xef, 0x3f, 0xdc, 0x80, 0xd8, 0x7a, 0xb2, 0xbf, 0x2b,
+0x37, 0x18, 0xdd, 0x4a, 0x4e, 0x36, 0x09, 0x60, 0x28, 0x6e, 0x2e, 0x77, 0x57,
+0xFF, 0xFF, 0xFF, 0xFF, // sequence
+0x02, // number of outputs
+0xc0, 0xa4, 0x70, 0x57, 0x00, 0x00, 0x00, 0x00, // 14.67 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 1Q6W8HTPdwccCkLRMLJpYkGvweKhpsKKjE
+0xfd, 0x55, 0x49, 0x20, 0x22, 0xa0, 0x3f, 0xf7, 0x7a, 0x9d,
+0xe0, 0x0d, 0xa2, 0x18, 0x08, 0x0c, 0xa9, 0x51, 0xde, 0xef,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x40, 0x54, 0x92, 0x3d, 0x00, 0x00, 0x00, 0x00, // 10.33 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 16E7VhudyU3iXNddNazG8sChjQwfWcrHNw
+0x39, 0x53, 0x75, 0x46, 0x88, 0x84, 0x3d, 0xe5, 0x50, 0x0b,
+0x79, 0x91, 0x33, 0x7f, 0x96, 0xf5, 0x41, 0x71, 0x48, 0xa1,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x00, 0x00, 0x00, 0x00, // locktime
+// The main (spending) transaction.
+0x00, // is_ref = 0 (main)
+0x01, 0x00, 0x00, 0x00, // version
+0x01, // number of inputs
+0xee, 0xce, 0xae, 0x86, 0xf5, 0x70, 0x4d, 0x76, // previous output
+0xb8, 0x54, 0x5e, 0x6d, 0xcf, 0x21, 0xf1, 0x75,
+0x35, 0x7f, 0x83, 0xbd, 0xa4, 0x96, 0x43, 0x83,
+0xd6, 0xdd, 0x7e, 0x41, 0x68, 0x1b, 0x5e, 0x1a,
+0x01, 0x00, 0x00, 0x00, // number in previous output
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+0xde, 0xad, 0xbe, 0xef, 0xc0, 0xff, 0xee, 0xee, 0x00, 0x00,
+0xde, 0xad, 0xbe, 0xef, 0xc0, 0xff, 0xee, 0xee, 0x00, 0x00,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0xFF, 0xFF, 0xFF, 0xFF, // sequence
+0x02, // number of outputs
+0x00, 0x46, 0xc3, 0x23, 0x00, 0x00, 0x00, 0x00, // 6 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 11MXTrefsj1ZS3Q5e9D6DxGzZKHWALyo9
+0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99,
+0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x11, 0x22, 0x33,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x87, 0xd6, 0x12, 0x00, 0x00, 0x00, 0x00, 0x00, // 0.01234567 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 16eCeyy63xi5yde9VrX4XCcRrCKZwtUZK
+0x01, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99,
+0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x11, 0x22, 0x33,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x00, 0x00, 0x00, 0x00, // locktime
+0x01, 0x00, 0x00, 0x00 // hashtype
+};
+
+/** Minimum time (in nanoseconds) that each benchmark runs for. */
+static double min_time_ns;
+/** File that machine-readable results are written to. */
+static FILE *results_file;
+
+/** First operand for big number and elliptic curve benchmarks. */
+static uint8_t op1[32];
+/** Second operand for big number and elliptic curve benchmarks. */
+static uint8_t op2[32];
+/** Result of big number and elliptic curve benchmarks. */
+static uint8_t result[32];
+/** Second result of elliptic curve benchmarks. */
+static uint8_t result2[32];
+/** Point used by elliptic curve benchmarks. */
+static PointAffine point;
+/** First operands for batched big number benchmarks. */
+static uint8_t batch_op1[ECDSA_MAX_BATCH_SIZE * 32];
+/** Second operands for batched big number benchmarks. */
+static uint8_t batch_op2[ECDSA_MAX_BATCH_SIZE * 32];
+/** Results of batched big number benchmarks. */
+static uint8_t batch_result[ECDSA_MAX_BATCH_SIZE * 32];
+/** Points used by batched elliptic curve benchmarks. */
+static PointAffine batch_points[ECDSA_MAX_BATCH_SIZE];
+/** Message used by hash and cipher benchmarks. */
+static uint8_t message[128];
+/** Output of hash and cipher benchmarks. */
+static uint8_t digest[64];
+/** Hash state used by hash benchmarks. */
+static HashState hs;
+/** Expanded key for AES benchmarks. */
+static uint8_t expanded_key[EXPANDED_KEY_SIZE];
+
+/** Percentiles (of the first #LEAKAGE_BATCH_SIZE measurements) above which
+  * measurements are discarded, for each cropped t-test in
+  * runLeakageTest(). */
+static const double leakage_crop_percentiles[LEAKAGE_NUM_TESTS - 1] = {50.0, 75.0, 90.0, 95.0, 99.0};
+
+/** Running statistics for Welch's t-test. Index 0 is for the fixed input
+  * class and index 1 is for the random input class. The mean and sum of
+  * squared differences from the mean are updated using Welford's
+  * method. */
+typedef struct LeakageStatsStruct
+{
+	/** Number of measurements in each class. */
+	double n[2];
+	/** Mean of each class. */
+	double mean[2];
+	/** Sum of squared differences from the mean, for each class. */
+	double m2[2];
+} LeakageStats;
+
+/** Numbers of inputs to sweep over in the transaction parser benchmarks. */
+static const uint32_t sweep_inputs[] = {1, 10, 100, 1000, MAX_INPUTS};
+/** Numbers of outputs to sweep over in the transaction parser benchmarks. */
+static const uint32_t sweep_outputs[] = {1, 10, 100, MAX_OUTPUTS};
+/** Numbers of inputs to sign in the end to end signing benchmarks. */
+static const uint32_t sign_inputs[] = {1, 3, 10, 30};
+/** Transaction used by the current parser or signing benchmark, as
+  * returned by generateTestTransaction(). */
+static uint8_t *generated_transaction;
+/** Length (in bytes) of #generated_transaction. */
+static uint32_t generated_length;
+/** Request packets (followed by a ButtonAck packet) which sign every input
+  * of #generated_transaction, concatenated together. */
+static uint8_t *sign_packets;
+/** Offset within #sign_packets of each request. */
+static uint32_t *sign_packet_offsets;
+/** Number of requests in #sign_packets. */
+static uint32_t num_sign_packets;
+/** Address handle of the address whose private key signs every input. */
+static AddressHandle sign_address_handle;
+
+/** Get the current time.
+  * \return The current time, in nanoseconds, relative to some arbitrary
+  *         starting point.
+  */
+static double getTimeNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1.0e9 + (double)ts.tv_nsec;
+}
+
+/** Read the CPU cycle counter.
+  * \return The current value of the cycle counter, or 0 if there is no
+  *         cycle counter available on this host.
+  */
+static uint64_t readCycleCounter(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/** Repeat an operation until it has run for at least #min_time_ns, then
+  * report the results. The number of repetitions is doubled until the
+  * minimum time is reached, so that the overhead of reading the clock is
+  * negligible.
+  * \param name Name of the benchmark, as it will appear in the results.
+  * \param op The operation to benchmark.
+  * \param bytes_per_op Number of message bytes processed by each
+  *                     operation, or 0 if throughput is meaningless for
+  *                     this operation.
+  */
+static void runBenchmark(const char *name, void (*op)(void), uint32_t bytes_per_op)
+{
+	uint32_t iterations;
+	uint32_t i;
+	double start;
+	double elapsed;
+	uint64_t start_cycles;
+	uint64_t cycles;
+	double ns_per_op;
+	double cycles_per_op;
+	double bytes_per_second;
+
+	op(); // warm up caches
+	iterations = 1;
+	while (true)
+	{
+		start = getTimeNs();
+		start_cycles = readCycleCounter();
+		for (i = 0; i < iterations; i++)
+		{
+			op();
+		}
+		cycles = readCycleCounter() - start_cycles;
+		elapsed = getTimeNs() - start;
+		if ((elapsed >= min_time_ns) || (iterations >= 0x80000000))
+		{
+			break;
+		}
+		iterations <<= 1;
+	}
+
+	ns_per_op = elapsed / (double)iterations;
+	cycles_per_op = (double)cycles / (double)iterations;
+	if (bytes_per_op != 0)
+	{
+		bytes_per_second = (double)bytes_per_op * 1.0e9 / ns_per_op;
+	}
+	else
+	{
+		bytes_per_second = 0.0;
+	}
+	printf("%-20s %10u ops %14.1f ns/op %14.1f cycles/op", name, iterations, ns_per_op, cycles_per_op);
+	if (bytes_per_op != 0)
+	{
+		printf(" %12.3f MB/s %8.2f ns/byte", bytes_per_second / 1.0e6, ns_per_op / (double)bytes_per_op);
+	}
+	printf("\n");
+	fprintf(results_file, "%s,%u,%u,%.1f,%.1f,%.0f\n", name, iterations, bytes_per_op, ns_per_op, cycles_per_op, bytes_per_second);
+	fflush(results_file);
+}
+
+/** Read a timestamp for runLeakageTest(). This uses the cycle counter if
+  * there is one, since it has much better resolution than the clock.
+  * \return The current time, in cycles or nanoseconds.
+  */
+static double readTimestamp(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	return (double)readCycleCounter();
+#else
+	return getTimeNs();
+#endif
+}
+
+/** Add one measurement to a set of t-test statistics.
+  * \param stats The statistics to update.
+  * \param input_class The class of the input (0 = fixed, 1 = random).
+  * \param x The measurement.
+  */
+static void leakageStatsUpdate(LeakageStats *stats, unsigned int input_class, double x)
+{
+	double delta;
+
+	stats->n[input_class] += 1.0;
+	delta = x - stats->mean[input_class];
+	stats->mean[input_class] += delta / stats->n[input_class];
+	stats->m2[input_class] += delta * (x - stats->mean[input_class]);
+}
+
+/** Calculate Welch's t statistic from a set of t-test statistics.
+  * \param stats The statistics to use.
+  * \return The t statistic, or 0 if there aren't enough measurements.
+  */
+static double leakageStatsT(const LeakageStats *stats)
+{
+	double v0;
+	double v1;
+
+	if ((stats->n[0] < 2.0) || (stats->n[1] < 2.0))
+	{
+		return 0.0;
+	}
+	v0 = stats->m2[0] / (stats->n[0] - 1.0);
+	v1 = stats->m2[1] / (stats->n[1] - 1.0);
+	if ((v0 + v1) == 0.0)
+	{
+		return 0.0;
+	}
+	return (stats->mean[0] - stats->mean[1]) / sqrt((v0 / stats->n[0]) + (v1 / stats->n[1]));
+}
+
+/** Comparison function for qsort(), for sorting measurements in ascending
+  * order. */
+static int compareDoubles(const void *a, const void *b)
+{
+	double x;
+	double y;
+
+	x = *(const double *)a;
+	y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/** Time an operation with inputs from two classes, for at
+  * least #LEAKAGE_TIME_FACTOR times #min_time_ns, and report the largest |t|
+  * from Welch's t-test (see the comments at the top of this file).
+  * \param name Name of the operation, as it will appear in the results.
+  * \param op The operation to test. It is passed a 32 byte input.
+  */
+static void runLeakageTest(const char *name, void (*op)(const uint8_t *))
+{
+	uint8_t inputs[LEAKAGE_BATCH_SIZE][32];
+	uint8_t fixed_input[32];
+	unsigned int classes[LEAKAGE_BATCH_SIZE];
+	double measurements[LEAKAGE_BATCH_SIZE];
+	double sorted[LEAKAGE_BATCH_SIZE];
+	double crop_thresholds[LEAKAGE_NUM_TESTS];
+	LeakageStats stats[LEAKAGE_NUM_TESTS];
+	double start_ns;
+	double start;
+	double t;
+	double max_t;
+	uint32_t total;
+	unsigned int i;
+	unsigned int j;
+	bool first_batch;
+
+	// The fixed class is a low Hamming weight input (the number 1), since
+	// that is the kind of input most likely to hit a shortcut.
+	memset(fixed_input, 0, sizeof(fixed_input));
+	fixed_input[0] = 1;
+	memset(stats, 0, sizeof(stats));
+	total = 0;
+	first_batch = true;
+	op(fixed_input); // warm up caches
+	start_ns = getTimeNs();
+	do
+	{
+		// Generate inputs before timing anything, so that the cost of
+		// generating random inputs isn't measured.
+		for (i = 0; i < LEAKAGE_BATCH_SIZE; i++)
+		{
+			classes[i] = (unsigned int)rand() & 1;
+			if (classes[i] == 0)
+			{
+				memcpy(inputs[i], fixed_input, sizeof(fixed_input));
+			}
+			else
+			{
+				fillWithRandom(inputs[i], sizeof(inputs[i]));
+				// Make sure the input is less than the group order.
+				inputs[i][31] &= 0x7f;
+			}
+		}
+		for (i = 0; i < LEAKAGE_BATCH_SIZE; i++)
+		{
+			start = readTimestamp();
+			op(inputs[i]);
+			measurements[i] = readTimestamp() - start;
+		}
+		if (first_batch)
+		{
+			memcpy(sorted, measurements, sizeof(sorted));
+			qsort(sorted, LEAKAGE_BATCH_SIZE, sizeof(double), compareDoubles);
+			crop_thresholds[0] = sorted[LEAKAGE_BATCH_SIZE - 1] * 1.0e6; // effectively no cropping
+			for (j = 1; j < LEAKAGE_NUM_TESTS; j++)
+			{
+				crop_thresholds[j] = sorted[(unsigned int)(leakage_crop_percentiles[j - 1] * (LEAKAGE_BATCH_SIZE - 1) / 100.0)];
+			}
+			first_batch = false;
+		}
+		for (i = 0; i < LEAKAGE_BATCH_SIZE; i++)
+		{
+			for (j = 0; j < LEAKAGE_NUM_TESTS; j++)
+			{
+				if (measurements[i] <= crop_thresholds[j])
+				{
+					leakageStatsUpdate(&(stats[j]), classes[i], measurements[i]);
+				}
+			}
+		}
+		total += LEAKAGE_BATCH_SIZE;
+	} while ((getTimeNs() - start_ns) < (min_time_ns * LEAKAGE_TIME_FACTOR));
+
+	max_t = 0.0;
+	for (j = 0; j < LEAKAGE_NUM_TESTS; j++)
+	{
+		t = fabs(leakageStatsT(&(stats[j])));
+		if (t > max_t)
+		{
+			max_t = t;
+		}
+	}
+	printf("%-20s %10u measurements, max |t| = %8.2f", name, total, max_t);
+	if (max_t > LEAKAGE_T_THRESHOLD)
+	{
+		printf("  <-- probable timing leakage");
+	}
+	printf("\n");
+}
+
+/** Benchmark operation for bigMultiply(). */
+static void benchBigMultiply(void)
+{
+	bigMultiply(result, op1, op2);
+}
+
+/** Benchmark operation for bigMultiplyModN(). */
+static void benchBigMultiplyModN(void)
+{
+	bigMultiplyModN(result, op1, op2);
+}
+
+/** Benchmark operation for bigMultiplyModNBatch(), with a full batch. */
+static void benchBigMultiplyModNBatch(void)
+{
+	bigMultiplyModNBatch(batch_result, batch_op1, batch_op2, ECDSA_MAX_BATCH_SIZE);
+}
+
+/** Benchmark operation for ecdsaMultiplyGBatch() (i.e. batch public key
+  * derivation), with a full batch. */
+static void benchEcdsaMultiplyGBatch(void)
+{
+	ecdsaMultiplyGBatch(batch_points, batch_op1, ECDSA_MAX_BATCH_SIZE);
+}
+
+/** Benchmark operation for pointMultiply(). */
+static void benchPointMultiply(void)
+{
+	setToG(&point);
+	pointMultiply(&point, op1);
+}
+
+#ifndef ECDSA_NO_COZ_LADDER
+/** Benchmark operation for pointMultiplyLadder(). */
+static void benchPointMultiplyLadder(void)
+{
+	setToG(&point);
+	pointMultiplyLadder(&point, op1);
+}
+#endif // #ifndef ECDSA_NO_COZ_LADDER
+
+/** Benchmark operation for ecdsaSign(). */
+static void benchEcdsaSign(void)
+{
+	ecdsaSign(result, result2, op2, op1);
+}
+
+/** Timing leakage operation for bigMultiply().
+  * \param input The secret-dependent operand.
+  */
+static void leakBigMultiply(const uint8_t *input)
+{
+	bigMultiply(result, (BigNum256)input, op2);
+}
+
+/** Timing leakage operation for bigInvert().
+  * \param input The number to invert.
+  */
+static void leakBigInvert(const uint8_t *input)
+{
+	bigInvert(result, (BigNum256)input);
+}
+
+/** Timing leakage operation for pointMultiply().
+  * \param input The scalar (a private key, in practice).
+  */
+static void leakPointMultiply(const uint8_t *input)
+{
+	setToG(&point);
+	pointMultiply(&point, (BigNum256)input);
+}
+
+/** Timing leakage operation for ecdsaSign().
+  * \param input The private key.
+  */
+static void leakEcdsaSign(const uint8_t *input)
+{
+	ecdsaSign(result, result2, op2, (BigNum256)input);
+}
+
+/** Benchmark operation for SHA-256 compression, which processes one
+  * 64 byte block per call. */
+static void benchSha256Block(void)
+{
+	sha256WriteBytes(&hs, message, 64);
+}
+
+/** Benchmark operation for hmacSha512(). */
+static void benchHmacSha512(void)
+{
+	hmacSha512(digest, op1, sizeof(op1), message, sizeof(message));
+}
+
+/** Benchmark operation for pbkdf2(). */
+static void benchPbkdf2(void)
+{
+	pbkdf2(digest, message, 16, op1, sizeof(op1), getPBKDF2Iterations());
+}
+
+/** Benchmark operation for aesEncrypt(). */
+static void benchAesEncrypt(void)
+{
+	aesEncrypt(digest, message, expanded_key);
+}
+
+/** Benchmark operation for parseTransaction(). */
+static void benchParseTransaction(void)
+{
+	setTestInputStream(test_transaction, sizeof(test_transaction));
+	clearOutputsSeen();
+	if (parseTransaction(result, result2, sizeof(test_transaction)) != TRANSACTION_NO_ERROR)
+	{
+		printf("ERROR: parseTransaction() failed\n");
+		exit(1);
+	}
+}
+
+/** Benchmark operation for parseTransaction(), using the transaction in
+  * #generated_transaction. */
+static void benchParseGenerated(void)
+{
+	setTestInputStream(generated_transaction, generated_length);
+	clearOutputsSeen();
+	if (parseTransaction(result, result2, generated_length) != TRANSACTION_NO_ERROR)
+	{
+		printf("ERROR: parseTransaction() failed on generated transaction\n");
+		exit(1);
+	}
+}
+
+/** Run the transaction parser benchmark for every combination of
+  * #sweep_inputs and #sweep_outputs. */
+static void sweepParseTransaction(void)
+{
+	char name[32];
+	unsigned int i;
+	unsigned int j;
+
+	for (i = 0; i < (sizeof(sweep_inputs) / sizeof(sweep_inputs[0])); i++)
+	{
+		for (j = 0; j < (sizeof(sweep_outputs) / sizeof(sweep_outputs[0])); j++)
+		{
+			generated_transaction = generateTestTransaction(&generated_length, sweep_inputs[i], sweep_outputs[j]);
+			sprintf(name, "parse %ux%u", sweep_inputs[i], sweep_outputs[j]);
+			runBenchmark(name, benchParseGenerated, generated_length);
+			free(generated_transaction);
+		}
+	}
+}
+
+/** Write a protocol buffer varint.
+  * \param out The encoded varint will be written here. There must be space
+  *            for at least 5 bytes.
+  * \param value The value to encode.
+  * \return The number of bytes written.
+  */
+static uint32_t writeVarint(uint8_t *out, uint32_t value)
+{
+	uint32_t length;
+
+	length = 0;
+	while (value >= 0x80)
+	{
+		out[length++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	out[length++] = (uint8_t)value;
+	return length;
+}
+
+/** Write a SignTransactionMultiple request packet, followed by a ButtonAck
+  * packet (which is only read if the transaction hasn't been approved yet).
+  * \param out The packets will be written here. There must be space for
+  *            #generated_length + #SIGN_PACKET_OVERHEAD bytes.
+  * \param first_input The index of the first input to sign.
+  * \param count The number of inputs to sign. This must be between 1 and
+  *              #MAX_SIGN_INPUTS inclusive.
+  * \return The number of bytes written.
+  */
+static uint32_t writeSignPacket(uint8_t *out, uint32_t first_input, uint32_t count)
+{
+	uint32_t ptr;
+	uint32_t i;
+
+	ptr = 8; // header is filled in below
+	for (i = 0; i < count; i++)
+	{
+		out[ptr++] = 0x08; // input_index
+		ptr += writeVarint(&(out[ptr]), first_input + i);
+		out[ptr++] = 0x10; // address_handle
+		ptr += writeVarint(&(out[ptr]), sign_address_handle);
+	}
+	out[ptr++] = 0x1a; // transaction_data
+	ptr += writeVarint(&(out[ptr]), generated_length);
+	memcpy(&(out[ptr]), generated_transaction, generated_length);
+	ptr += generated_length;
+	out[0] = 0x23;
+	out[1] = 0x23;
+	out[2] = 0x00;
+	out[3] = PACKET_TYPE_SIGN_TRANSACTION_MULTIPLE;
+	writeU32BigEndian(&(out[4]), ptr - 8);
+	memset(&(out[ptr]), 0, 8);
+	out[ptr] = 0x23;
+	out[ptr + 1] = 0x23;
+	out[ptr + 3] = PACKET_TYPE_BUTTON_ACK;
+	ptr += 8;
+	return ptr;
+}
+
+/** Benchmark operation for the multi-input signing workflow, which sends
+  * every request in #sign_packets to processPacket(). Since the
+  * transaction is approved the first time it is seen, this measures the
+  * steady state cost of parsing, hashing and signing, excluding the wait
+  * for the user. */
+static void benchSignMultiple(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < num_sign_packets; i++)
+	{
+		setTestInputStream(&(sign_packets[sign_packet_offsets[i]]), sign_packet_offsets[i + 1] - sign_packet_offsets[i]);
+		processPacket();
+	}
+}
+
+/** Run the end to end signing benchmark for every entry in #sign_inputs.
+  * Each input is signed exactly once, using as few
+  * SignTransactionMultiple requests as possible. */
+static void sweepSignMultiple(void)
+{
+	char name[32];
+	uint8_t wallet_name[NAME_LENGTH];
+	uint8_t address[20];
+	PointAffine public_key;
+	uint32_t num_inputs;
+	uint32_t ptr;
+	unsigned int i;
+	uint32_t j;
+
+	// Create a wallet with one address, which the private key for every
+	// signature will come from.
+	initWalletTest();
+	initialiseDefaultEntropyPool();
+	if (sanitiseEverything() != WALLET_NO_ERROR)
+	{
+		printf("ERROR: could not format storage\n");
+		exit(1);
+	}
+	memset(wallet_name, ' ', sizeof(wallet_name));
+	if (newWallet(0, wallet_name, false, NULL, false, NULL, 0) != WALLET_NO_ERROR)
+	{
+		printf("ERROR: could not create wallet %d\n", walletGetLastError());
+		exit(1);
+	}
+	sign_address_handle = makeNewAddress(address, &public_key);
+	if (sign_address_handle == BAD_ADDRESS_HANDLE)
+	{
+		printf("ERROR: could not create address\n");
+		exit(1);
+	}
+
+	for (i = 0; i < (sizeof(sign_inputs) / sizeof(sign_inputs[0])); i++)
+	{
+		num_inputs = sign_inputs[i];
+		generated_transaction = generateTestTransaction(&generated_length, num_inputs, SIGN_NUM_OUTPUTS);
+		num_sign_packets = (num_inputs + MAX_SIGN_INPUTS - 1) / MAX_SIGN_INPUTS;
+		sign_packets = malloc(num_sign_packets * (generated_length + SIGN_PACKET_OVERHEAD));
+		sign_packet_offsets = malloc((num_sign_packets + 1) * sizeof(uint32_t));
+		ptr = 0;
+		for (j = 0; j < num_sign_packets; j++)
+		{
+			sign_packet_offsets[j] = ptr;
+			ptr += writeSignPacket(&(sign_packets[ptr]), j * MAX_SIGN_INPUTS, MIN(MAX_SIGN_INPUTS, num_inputs - j * MAX_SIGN_INPUTS));
+		}
+		sign_packet_offsets[num_sign_packets] = ptr;
+		sprintf(name, "signMultiple %u", num_inputs);
+		runBenchmark(name, benchSignMultiple, ptr);
+		free(sign_packet_offsets);
+		free(sign_packets);
+		free(generated_transaction);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *results_file_name;
+	unsigned int i;
+
+	results_file_name = DEFAULT_RESULTS_FILE;
+	min_time_ns = DEFAULT_MIN_TIME_MS * 1.0e6;
+	if (argc > 1)
+	{
+		results_file_name = argv[1];
+	}
+	if (argc > 2)
+	{
+		min_time_ns = atof(argv[2]) * 1.0e6;
+	}
+	results_file = fopen(results_file_name, "w");
+	if (results_file == NULL)
+	{
+		printf("Could not open \"%s\" for writing\n", results_file_name);
+		exit(1);
+	}
+	fprintf(results_file, "name,iterations,bytes_per_op,ns_per_op,cycles_per_op,bytes_per_second\n");
+
+	srand(42);
+	fillWithRandom(op1, sizeof(op1));
+	fillWithRandom(op2, sizeof(op2));
+	fillWithRandom(message, sizeof(message));
+	// Make sure operands are less than the group order, so that they are
+	// valid field elements, private keys and hashes.
+	op1[31] &= 0x7f;
+	op2[31] &= 0x7f;
+	for (i = 0; i < ECDSA_MAX_BATCH_SIZE; i++)
+	{
+		memcpy(&(batch_op1[i * 32]), op1, 32);
+		memcpy(&(batch_op2[i * 32]), op2, 32);
+		batch_op1[i * 32] = (uint8_t)(batch_op1[i * 32] + i);
+	}
+
+	setFieldToN();
+	runBenchmark("bigMultiply", benchBigMultiply, 0);
+	runBenchmark("bigMultiplyModN", benchBigMultiplyModN, 0);
+	runBenchmark("bigMultiplyModNBatch", benchBigMultiplyModNBatch, 0);
+	runBenchmark("ecdsaMultiplyGBatch", benchEcdsaMultiplyGBatch, 0);
+	runBenchmark("pointMultiply", benchPointMultiply, 0);
+#ifndef ECDSA_NO_COZ_LADDER
+	runBenchmark("pointMultiplyLadder", benchPointMultiplyLadder, 0);
+#endif // #ifndef ECDSA_NO_COZ_LADDER
+	runBenchmark("ecdsaSign", benchEcdsaSign, 0);
+	sha256Begin(&hs);
+	runBenchmark("sha256Block", benchSha256Block, 64);
+	runBenchmark("hmacSha512", benchHmacSha512, sizeof(message));
+	runBenchmark("pbkdf2", benchPbkdf2, 0);
+	aesExpandKey(expanded_key, op1);
+	runBenchmark("aesEncrypt", benchAesEncrypt, 16);
+	runBenchmark("parseTransaction", benchParseTransaction, sizeof(test_transaction));
+	sweepParseTransaction();
+	sweepSignMultiple();
+
+	printf("Timing leakage tests (dudect-style, threshold |t| = %.1f):\n", LEAKAGE_T_THRESHOLD);
+	setFieldToN();
+	runLeakageTest("bigMultiply", leakBigMultiply);
+	runLeakageTest("bigInvert", leakBigInvert);
+	runLeakageTest("pointMultiply", leakPointMultiply);
+	runLeakageTest("ecdsaSign", leakEcdsaSign);
+
+	fclose(results_file);
+	printf("Results written to \"%s\"\n", results_file_name);
+	exit(0);
+}
+
+#endif // #ifdef TEST_BENCH
@@ -23,11 +23,31 @@
   * bytes (such functions will use the typedef #BigNum256), but some functions
   * accept variable-sized arrays.
   *
-  * To use most of the exported functions here, you must call bigSetField()
-  * first to set field parameters. If you don't do this, you'll get a
-  * segfault! Functions which do not operate under a prime finite field (eg.
-  * bigSubtractVariableSizeNoModulo() and bigCompare()) do not need
-  * bigSetField() to be called first.
+  * On platforms with a native 32 bit multiplier, define BIGNUM_32BIT_LIMBS
+  * to make the comparison, addition, subtraction and multiplication
+  * primitives operate on 32 bit limbs instead of bytes. The interface and the
+  * in-memory representation of numbers stay the same; numbers are merely
+  * loaded and stored a limb at a time.
+  *
+  * On hosts with vector units (eg. x86-64 with AVX2, or ARM64 with NEON),
+  * define BIGNUM_SIMD_BATCH to make bigMultiplyModPBatch() and
+  * bigMultiplyModNBatch() do #BIGNUM_BATCH_LANES independent multiplications
+  * at once, one in each vector lane. This uses GCC vector extensions, so the
+  * compiler picks the instructions (add -mavx2 to get 4 lanes per
+  * instruction on x86-64). Without BIGNUM_SIMD_BATCH, those functions just
+  * call bigMultiplyModP() or bigMultiplyModN() for each element, which is
+  * what embedded builds should do.
+  *
+  * Functions which operate under a generic prime finite field come in two
+  * versions. The ones with names ending in "InField" (eg. bigAddInField())
+  * are passed the field parameters (a #BigNumField) explicitly, and don't
+  * touch any global state, so they can be used from many threads at once.
+  * The others (eg. bigAdd()) operate under the current field, which is
+  * set by bigSetField(); to use them, you must call bigSetField() first,
+  * otherwise you'll get a segfault! Functions which do not operate under a
+  * prime finite field (eg. bigSubtractVariableSizeNoModulo() and
+  * bigCompare()) and functions which always operate under the same field
+  * (eg. bigMultiplyModP()) need neither.
   *
   * This file is licensed as described by the file LICENCE.
   */
@@ -40,23 +60,107 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <gmp.h>
-#include "endian.h"
 #include "test_helpers.h"
 #endif // #ifdef TEST_BIGNUM256
 
 #include "common.h"
 #include "bignum256.h"
 
-/** The prime modulus to operate under.
-  * \warning This must be greater than 2 ^ 255.
-  * \warning The least significant byte of this must be >= 2, otherwise
-  *          bigInvert() will not work correctly.
+/** The prime number used to define the prime finite field for secp256k1.
+  * This is what bigMultiplyModP() and bigSquareModP() always operate under,
+  * regardless of what was passed to bigSetField(). */
+static const BigNum256Storage secp256k1_field_p = {
+0x2f, 0xfc, 0xff, 0xff, 0xfe, 0xff, 0xff, 0xff,
+0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+/** #secp256k1_field_p is 2 ^ 256 - 2 ^ 32 - 977. This is 977, as a 2 byte
+  * multi-precision number. */
+static const uint8_t secp256k1_field_977[2] = {0xd1, 0x03};
+
+/** The order of the secp256k1 base point. This is what bigMultiplyModN(),
+  * bigSquareModN() and bigInvertModN() always operate under, regardless of
+  * what was passed to bigSetField(). */
+static const BigNum256Storage secp256k1_field_n = {
+0x41, 0x41, 0x36, 0xd0, 0x8c, 0x5e, 0xd2, 0xbf,
+0x3b, 0xa0, 0x48, 0xaf, 0xe6, 0xdc, 0xae, 0xba,
+0xfe, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+/** #secp256k1_field_n is 2 ^ 256 - 2 ^ 128 - c. This is c, as a 16 byte
+  * multi-precision number. */
+static const uint8_t secp256k1_field_n_c[16] = {
+0xbf, 0xbe, 0xc9, 0x2f, 0x73, 0xa1, 0x2d, 0x40,
+0xc4, 0x5f, 0xb7, 0x50, 0x19, 0x23, 0x51, 0x45};
+
+/** The current prime finite field, as set by bigSetField(). The functions
+  * without "InField" in their names operate under this. */
+static BigNumField current_field;
+
+#ifdef BIGNUM_32BIT_LIMBS
+
+/** For a multi-precision number of size bytes, get the index of the first
+  * byte which doesn't belong to a whole 32 bit limb. Those bytes are
+  * processed one at a time. */
+#define BYTE_TAIL_START(size)	((uint8_t)((size) & 0xfc))
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+/** On little-endian targets, a limb at a word-aligned address can be read
+  * or written with a single word access. See #WORD_ALIGNED. */
+#define LIMB_WORD_ACCESS
+#endif
+
+/** Read a 32 bit limb from a little-endian byte array. This is endian
+  * independent and does not care about alignment, but it is faster if in
+  * is word-aligned. The check for that only depends on the address, not on
+  * the data.
+  * \param in Byte array to read 4 bytes from.
+  * \return The limb.
   */
-static BigNum256 n;
-/** The 2s complement of #n, with most significant zero bytes removed. */
-static uint8_t *complement_n;
-/** The size of #complement_n, in number of bytes. */
-static uint8_t size_complement_n;
+static uint32_t readLimb(const uint8_t *in)
+{
+#ifdef LIMB_WORD_ACCESS
+	uint32_t limb;
+
+	if ((((uintptr_t)in) & 3) == 0)
+	{
+		memcpy(&limb, __builtin_assume_aligned(in, 4), 4);
+		return limb;
+	}
+#endif // #ifdef LIMB_WORD_ACCESS
+	return ((uint32_t)in[0])
+		| ((uint32_t)in[1] << 8)
+		| ((uint32_t)in[2] << 16)
+		| ((uint32_t)in[3] << 24);
+}
+
+/** Write a 32 bit limb into a little-endian byte array.
+  * \param out Byte array to write 4 bytes into.
+  * \param in The limb to write.
+  */
+static void writeLimb(uint8_t *out, uint32_t in)
+{
+#ifdef LIMB_WORD_ACCESS
+	if ((((uintptr_t)out) & 3) == 0)
+	{
+		memcpy(__builtin_assume_aligned(out, 4), &in, 4);
+		return;
+	}
+#endif // #ifdef LIMB_WORD_ACCESS
+	out[0] = (uint8_t)in;
+	out[1] = (uint8_t)(in >> 8);
+	out[2] = (uint8_t)(in >> 16);
+	out[3] = (uint8_t)(in >> 24);
+}
+
+#else
+
+/** Without 32 bit limbs, every byte of a multi-precision number is processed
+  * one at a time. */
+#define BYTE_TAIL_START(size)	((uint8_t)0)
+
+#endif // #ifdef BIGNUM_32BIT_LIMBS
 
 /** Compare two multi-precision numbers of arbitrary size.
   * \param op1 One of the numbers to compare.
@@ -71,10 +175,17 @@ uint8_t bigCompareVariableSize(uint8_t *op1, uint8_t *op2, uint8_t size)
 	uint8_t i;
 	uint8_t r;
 	uint8_t cmp;
+#ifdef BIGNUM_32BIT_LIMBS
+	uint32_t limb1;
+	uint32_t limb2;
+#endif // #ifdef BIGNUM_32BIT_LIMBS
 
 	r = BIGCMP_EQUAL;
-	for (i = (uint8_t)(size - 1); i < size; i--)
+	// Any bytes which don't belong to a whole limb are the most significant
+	// ones, so they must be compared first.
+	for (i = size; i > BYTE_TAIL_START(size); )
 	{
+		i--;
 		// The following code is a branch free way of doing:
 		// if (r == BIGCMP_EQUAL)
 		// {
@@ -98,6 +209,22 @@ uint8_t bigCompareVariableSize(uint8_t *op1, uint8_t *op2, uint8_t size)
 		cmp = (uint8_t)((((uint16_t)((int)op1[i] - (int)op2[i])) >> 8) & BIGCMP_LESS);
 		r = (uint8_t)(((((uint16_t)(-(int)r)) >> 8) & (r ^ cmp)) ^ cmp);
 	}
+#ifdef BIGNUM_32BIT_LIMBS
+	// Same as above, except that a limb is compared at a time. The most
+	// significant byte of a 64 bit difference is 0xff if the subtraction
+	// borrowed, just like the most significant byte of the 16 bit difference
+	// above.
+	while (i != 0)
+	{
+		i = (uint8_t)(i - 4);
+		limb1 = readLimb(&(op1[i]));
+		limb2 = readLimb(&(op2[i]));
+		cmp = (uint8_t)(((uint8_t)(((uint64_t)limb2 - (uint64_t)limb1) >> 56)) & BIGCMP_GREATER);
+		r = (uint8_t)(((((uint16_t)(-(int)r)) >> 8) & (r ^ cmp)) ^ cmp);
+		cmp = (uint8_t)(((uint8_t)(((uint64_t)limb1 - (uint64_t)limb2) >> 56)) & BIGCMP_LESS);
+		r = (uint8_t)(((((uint16_t)(-(int)r)) >> 8) & (r ^ cmp)) ^ cmp);
+	}
+#endif // #ifdef BIGNUM_32BIT_LIMBS
 	return r;
 }
 
@@ -174,19 +301,20 @@ void swapEndian256(BigNum256 buffer)
 	}
 }
 
-/** Set prime finite field parameters. The arrays passed as parameters to
-  * this function will never be written to, hence the const modifiers.
-  * \param in_n See #n.
-  * \param in_complement_n See #complement_n.
-  * \param in_size_complement_n See #size_complement_n.
+/** Set the current prime finite field parameters. The arrays passed as
+  * parameters to this function will never be written to, hence the const
+  * modifiers.
+  * \param in_n See BigNumFieldStruct#n.
+  * \param in_complement_n See BigNumFieldStruct#complement_n.
+  * \param in_size_complement_n See BigNumFieldStruct#size_complement_n.
   * \warning There are some restrictions on what the parameters can be.
-  *          See #n, #complement_n and #size_complement_n for more details.
+  *          See #BigNumField for more details.
   */
 void bigSetField(const uint8_t *in_n, const uint8_t *in_complement_n, const uint8_t in_size_complement_n)
 {
-	n = (BigNum256)in_n;
-	complement_n = (uint8_t *)in_complement_n;
-	size_complement_n = (uint8_t)in_size_complement_n;
+	current_field.n = (BigNum256)in_n;
+	current_field.complement_n = (uint8_t *)in_complement_n;
+	current_field.size_complement_n = (uint8_t)in_size_complement_n;
 }
 
 /** Add (r = op1 + op2) two multi-precision numbers of arbitrary size,
@@ -203,9 +331,21 @@ uint8_t bigAddVariableSizeNoModulo(uint8_t *r, uint8_t *op1, uint8_t *op2, uint8
 	uint16_t partial;
 	uint8_t carry;
 	uint8_t i;
+#ifdef BIGNUM_32BIT_LIMBS
+	uint64_t partial64;
+#endif // #ifdef BIGNUM_32BIT_LIMBS
 
 	carry = 0;
-	for (i = 0; i < op_size; i++)
+	i = 0;
+#ifdef BIGNUM_32BIT_LIMBS
+	for (; i < BYTE_TAIL_START(op_size); i = (uint8_t)(i + 4))
+	{
+		partial64 = (uint64_t)readLimb(&(op1[i])) + (uint64_t)readLimb(&(op2[i])) + (uint64_t)carry;
+		writeLimb(&(r[i]), (uint32_t)partial64);
+		carry = (uint8_t)(partial64 >> 32);
+	}
+#endif // #ifdef BIGNUM_32BIT_LIMBS
+	for (; i < op_size; i++)
 	{
 		partial = (uint16_t)((uint16_t)op1[i] + (uint16_t)op2[i] + (uint16_t)carry);
 		r[i] = (uint8_t)partial;
@@ -228,9 +368,21 @@ uint8_t bigSubtractVariableSizeNoModulo(uint8_t *r, uint8_t *op1, uint8_t *op2,
 	uint16_t partial;
 	uint8_t borrow;
 	uint8_t i;
+#ifdef BIGNUM_32BIT_LIMBS
+	uint64_t partial64;
+#endif // #ifdef BIGNUM_32BIT_LIMBS
 
 	borrow = 0;
-	for (i = 0; i < op_size; i++)
+	i = 0;
+#ifdef BIGNUM_32BIT_LIMBS
+	for (; i < BYTE_TAIL_START(op_size); i = (uint8_t)(i + 4))
+	{
+		partial64 = (uint64_t)readLimb(&(op1[i])) - (uint64_t)readLimb(&(op2[i])) - (uint64_t)borrow;
+		writeLimb(&(r[i]), (uint32_t)partial64);
+		borrow = (uint8_t)((uint8_t)(partial64 >> 32) & 1);
+	}
+#endif // #ifdef BIGNUM_32BIT_LIMBS
+	for (; i < op_size; i++)
 	{
 		partial = (uint16_t)((uint16_t)op1[i] - (uint16_t)op2[i] - (uint16_t)borrow);
 		r[i] = (uint8_t)partial;
@@ -252,19 +404,23 @@ uint8_t bigSubtractNoModulo(BigNum256 r, BigNum256 op1, BigNum256 op2)
 	return bigSubtractVariableSizeNoModulo(r, op1, op2, 32);
 }
 
-/** Compute op1 modulo #n, where op1 is a 32 byte multi-precision number.
+/** Compute op1 modulo n, where op1 is a 32 byte multi-precision number
+  * and n is the modulus of the specified prime finite field.
   * The "modulo" part makes it sound like this function does division
-  * somewhere, but since #n is also a 32 byte multi-precision number, all
-  * this function actually does is subtract #n off op1 if op1 is >= #n.
+  * somewhere, but since n is also a 32 byte multi-precision number, all
+  * this function actually does is subtract n off op1 if op1 is >= n.
   * \param r The 32 byte result will be written into here.
   * \param op1 The 32 byte operand to apply the modulo to. This may alias r.
+  * \param field The prime finite field to operate under.
   */
-void bigModulo(BigNum256 r, BigNum256 op1)
+void bigModuloInField(BigNum256 r, BigNum256 op1, const BigNumField *field)
 {
 	uint8_t cmp;
 	uint8_t *lookup[2];
-	uint8_t zero[32];
+	BigNum256Storage zero;
+	BigNum256 n;
 
+	n = field->n;
 	bigSetZero(zero);
 	// The following 2 lines do: cmp = "bigCompare(op1, n) == BIGCMP_LESS ? 1 : 0".
 	cmp = (uint8_t)(bigCompare(op1, n) ^ BIGCMP_LESS);
@@ -274,20 +430,33 @@ void bigModulo(BigNum256 r, BigNum256 op1)
 	bigSubtractNoModulo(r, op1, lookup[cmp]);
 }
 
-/** Add (r = (op1 + op2) modulo #n) two 32 byte multi-precision numbers under
-  * the current prime finite field.
+/** Compute op1 modulo n under the current prime finite field. This is the
+  * same as bigModuloInField(), but uses the field set by bigSetField().
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The 32 byte operand to apply the modulo to. This may alias r.
+  */
+void bigModulo(BigNum256 r, BigNum256 op1)
+{
+	bigModuloInField(r, op1, &current_field);
+}
+
+/** Add (r = (op1 + op2) modulo n) two 32 byte multi-precision numbers under
+  * the specified prime finite field.
   * \param r The 32 byte result will be written into here.
   * \param op1 The first 32 byte operand to add. This may alias r.
   * \param op2 The second 32 byte operand to add. This may alias r or op1.
-  * \warning op1 and op2 must both be < #n.
+  * \param field The prime finite field to operate under.
+  * \warning op1 and op2 must both be < n.
   */
-void bigAdd(BigNum256 r, BigNum256 op1, BigNum256 op2)
+void bigAddInField(BigNum256 r, BigNum256 op1, BigNum256 op2, const BigNumField *field)
 {
 	uint8_t too_big;
 	uint8_t cmp;
 	uint8_t *lookup[2];
-	uint8_t zero[32];
+	BigNum256Storage zero;
+	BigNum256 n;
 
+	n = field->n;
 	bigSetZero(zero);
 #ifdef TEST
 	assert(bigCompare(op1, n) == BIGCMP_LESS);
@@ -302,20 +471,36 @@ void bigAdd(BigNum256 r, BigNum256 op1, BigNum256 op2)
 	bigSubtractNoModulo(r, r, lookup[too_big]);
 }
 
-/** Subtract (r = (op1 - op2) modulo #n) two 32 byte multi-precision numbers
-  * under the current prime finite field.
+/** Add (r = (op1 + op2) modulo n) two 32 byte multi-precision numbers under
+  * the current prime finite field. This is the same as bigAddInField(), but
+  * uses the field set by bigSetField().
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The first 32 byte operand to add. This may alias r.
+  * \param op2 The second 32 byte operand to add. This may alias r or op1.
+  * \warning op1 and op2 must both be < n.
+  */
+void bigAdd(BigNum256 r, BigNum256 op1, BigNum256 op2)
+{
+	bigAddInField(r, op1, op2, &current_field);
+}
+
+/** Subtract (r = (op1 - op2) modulo n) two 32 byte multi-precision numbers
+  * under the specified prime finite field.
   * \param r The 32 byte result will be written into here.
   * \param op1 The 32 byte operand to subtract from. This may alias r.
   * \param op2 The 32 byte operand to sutract off op1. This may alias r or
   *            op1.
-  * \warning op1 and op2 must both be < #n.
+  * \param field The prime finite field to operate under.
+  * \warning op1 and op2 must both be < n.
   */
-void bigSubtract(BigNum256 r, BigNum256 op1, BigNum256 op2)
+void bigSubtractInField(BigNum256 r, BigNum256 op1, BigNum256 op2, const BigNumField *field)
 {
 	uint8_t *lookup[2];
 	uint8_t too_small;
-	uint8_t zero[32];
+	BigNum256Storage zero;
+	BigNum256 n;
 
+	n = field->n;
 	bigSetZero(zero);
 #ifdef TEST
 	assert(bigCompare(op1, n) == BIGCMP_LESS);
@@ -327,6 +512,20 @@ void bigSubtract(BigNum256 r, BigNum256 op1, BigNum256 op2)
 	bigAddVariableSizeNoModulo(r, r, lookup[too_small], 32);
 }
 
+/** Subtract (r = (op1 - op2) modulo n) two 32 byte multi-precision numbers
+  * under the current prime finite field. This is the same as
+  * bigSubtractInField(), but uses the field set by bigSetField().
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The 32 byte operand to subtract from. This may alias r.
+  * \param op2 The 32 byte operand to sutract off op1. This may alias r or
+  *            op1.
+  * \warning op1 and op2 must both be < n.
+  */
+void bigSubtract(BigNum256 r, BigNum256 op1, BigNum256 op2)
+{
+	bigSubtractInField(r, op1, op2, &current_field);
+}
+
 /** Divide a 32 byte multi-precision number by 2, truncating if necessary.
   * \param r The 32 byte result will be written into here.
   * \param op1 The 32 byte operand to divide by 2. This may alias r.
@@ -349,6 +548,90 @@ void bigShiftRightNoModulo(BigNum256 r, const BigNum256 op1)
 
 #ifndef PLATFORM_SPECIFIC_BIGMULTIPLY
 
+#ifdef BIGNUM_32BIT_LIMBS
+
+/** Multiplies (r = op1 x op2) two multi-precision numbers of arbitrary size,
+  * ignoring the current prime finite field. In other words, this does
+  * multi-precision binary multiplication.
+  * This is the 32 bit limb version; see the byte-oriented version below for
+  * a description of the algorithm.
+  * \param r The result will be written into here. The size of the result (in
+  *          number of bytes) will be op1_size + op2_size.
+  * \param op1 The first operand to multiply. This cannot alias r.
+  * \param op1_size The size, in number of bytes, of op1. This must be <= 32.
+  * \param op2 The second operand to multiply. This cannot alias r, but it can
+  *            alias op1.
+  * \param op2_size The size, in number of bytes, of op2. This must be <= 32.
+  * \warning Some multipliers terminate early if an operand is small. On such
+  *          platforms, this function won't have data-independent timing.
+  */
+void bigMultiplyVariableSizeNoModulo(uint8_t *r, uint8_t *op1, uint8_t op1_size, uint8_t *op2, uint8_t op2_size)
+{
+	uint32_t limbs_op1[8];
+	uint32_t limbs_op2[8];
+	uint32_t limbs_r[16];
+	uint32_t cached_op1;
+	uint32_t carry;
+	uint64_t partial;
+	uint8_t num_limbs_op1;
+	uint8_t num_limbs_op2;
+	uint8_t i;
+	uint8_t j;
+
+#ifdef TEST
+	assert(op1_size <= 32);
+	assert(op2_size <= 32);
+#endif // #ifdef TEST
+	// Operands are zero-padded up to a whole number of limbs. The padding
+	// doesn't change the value of the product, so the most significant limbs
+	// of limbs_r which don't fit into r will be zero.
+	memset(limbs_op1, 0, sizeof(limbs_op1));
+	memset(limbs_op2, 0, sizeof(limbs_op2));
+	for (i = 0; i < BYTE_TAIL_START(op1_size); i = (uint8_t)(i + 4))
+	{
+		limbs_op1[i >> 2] = readLimb(&(op1[i]));
+	}
+	for (; i < op1_size; i++)
+	{
+		limbs_op1[i >> 2] |= (uint32_t)op1[i] << ((i & 3) << 3);
+	}
+	for (i = 0; i < BYTE_TAIL_START(op2_size); i = (uint8_t)(i + 4))
+	{
+		limbs_op2[i >> 2] = readLimb(&(op2[i]));
+	}
+	for (; i < op2_size; i++)
+	{
+		limbs_op2[i >> 2] |= (uint32_t)op2[i] << ((i & 3) << 3);
+	}
+	num_limbs_op1 = (uint8_t)((op1_size + 3) >> 2);
+	num_limbs_op2 = (uint8_t)((op2_size + 3) >> 2);
+	memset(limbs_r, 0, sizeof(limbs_r));
+	for (i = 0; i < num_limbs_op1; i++)
+	{
+		cached_op1 = limbs_op1[i];
+		carry = 0;
+		for (j = 0; j < num_limbs_op2; j++)
+		{
+			// This can't overflow, since
+			// (2 ^ 32 - 1) ^ 2 + 2 * (2 ^ 32 - 1) = 2 ^ 64 - 1.
+			partial = (uint64_t)cached_op1 * (uint64_t)limbs_op2[j] + (uint64_t)limbs_r[i + j] + (uint64_t)carry;
+			limbs_r[i + j] = (uint32_t)partial;
+			carry = (uint32_t)(partial >> 32);
+		}
+		limbs_r[i + num_limbs_op2] = carry;
+	}
+	for (i = 0; i < BYTE_TAIL_START(op1_size + op2_size); i = (uint8_t)(i + 4))
+	{
+		writeLimb(&(r[i]), limbs_r[i >> 2]);
+	}
+	for (; i < (uint8_t)(op1_size + op2_size); i++)
+	{
+		r[i] = (uint8_t)(limbs_r[i >> 2] >> ((i & 3) << 3));
+	}
+}
+
+#else
+
 /** Multiplies (r = op1 x op2) two multi-precision numbers of arbitrary size,
   * ignoring the current prime finite field. In other words, this does
   * multi-precision binary multiplication.
@@ -404,64 +687,820 @@ void bigMultiplyVariableSizeNoModulo(uint8_t *r, uint8_t *op1, uint8_t op1_size,
 	}
 }
 
+#endif // #ifdef BIGNUM_32BIT_LIMBS
+
 #endif // #ifndef PLATFORM_SPECIFIC_BIGMULTIPLY
 
-/** Multiplies (r = (op1 x op2) modulo #n) two 32 byte multi-precision
-  * numbers under the current prime finite field.
+#if defined(PLATFORM_SPECIFIC_BIGSQUARE)
+
+// bigSquareNoModulo() is provided by platform-specific assembly; it is
+// declared in bignum256.h.
+
+#elif defined(PLATFORM_SPECIFIC_BIGMULTIPLY)
+
+/** Squares (r = op1 x op1) a 32 byte multi-precision number, ignoring the
+  * current prime finite field. When there is a platform-specific multiplier,
+  * it is probably faster than a squaring routine written in C, so this
+  * just calls bigMultiplyVariableSizeNoModulo().
+  * \param r The 64 byte result will be written into here.
+  * \param op1 The 32 byte operand to square. This cannot alias r.
+  */
+static void bigSquareNoModulo(uint8_t *r, BigNum256 op1)
+{
+	bigMultiplyVariableSizeNoModulo(r, op1, 32, op1, 32);
+}
+
+#else
+
+#ifdef BIGNUM_32BIT_LIMBS
+
+/** Squares (r = op1 x op1) a 32 byte multi-precision number, ignoring the
+  * current prime finite field.
+  * This is the 32 bit limb version; see the byte-oriented version below for
+  * a description of the algorithm.
+  * \param r The 64 byte result will be written into here.
+  * \param op1 The 32 byte operand to square. This cannot alias r.
+  */
+static void bigSquareNoModulo(uint8_t *r, BigNum256 op1)
+{
+	uint32_t limbs_op1[8];
+	uint32_t limbs_r[16];
+	uint32_t cached_op1;
+	uint32_t carry;
+	uint32_t top_bit;
+	uint64_t partial;
+	uint8_t i;
+	uint8_t j;
+
+	for (i = 0; i < 8; i++)
+	{
+		limbs_op1[i] = readLimb(&(op1[i << 2]));
+	}
+	memset(limbs_r, 0, sizeof(limbs_r));
+	// Off-diagonal products.
+	for (i = 0; i < 7; i++)
+	{
+		cached_op1 = limbs_op1[i];
+		carry = 0;
+		for (j = (uint8_t)(i + 1); j < 8; j++)
+		{
+			partial = (uint64_t)cached_op1 * (uint64_t)limbs_op1[j] + (uint64_t)limbs_r[i + j] + (uint64_t)carry;
+			limbs_r[i + j] = (uint32_t)partial;
+			carry = (uint32_t)(partial >> 32);
+		}
+		limbs_r[i + 8] = carry;
+	}
+	// Double them.
+	carry = 0;
+	for (i = 0; i < 16; i++)
+	{
+		top_bit = limbs_r[i] >> 31;
+		limbs_r[i] = (limbs_r[i] << 1) | carry;
+		carry = top_bit;
+	}
+	// Add the diagonal squares.
+	carry = 0;
+	for (i = 0; i < 8; i++)
+	{
+		partial = (uint64_t)limbs_op1[i] * (uint64_t)limbs_op1[i] + (uint64_t)limbs_r[2 * i] + (uint64_t)carry;
+		limbs_r[2 * i] = (uint32_t)partial;
+		partial = (partial >> 32) + (uint64_t)limbs_r[2 * i + 1];
+		limbs_r[2 * i + 1] = (uint32_t)partial;
+		carry = (uint32_t)(partial >> 32);
+	}
+	for (i = 0; i < 16; i++)
+	{
+		writeLimb(&(r[i << 2]), limbs_r[i]);
+	}
+}
+
+#else
+
+/** Squares (r = op1 x op1) a 32 byte multi-precision number, ignoring the
+  * current prime finite field.
+  * In the schoolbook product of op1 with itself, every off-diagonal
+  * partial product op1[i] x op1[j] (i != j) appears twice. So this
+  * calculates each off-diagonal partial product only once, doubles the sum
+  * of them, then adds in the diagonal partial products op1[i] x op1[i].
+  * That is almost half as many multiplies as
+  * bigMultiplyVariableSizeNoModulo() would do.
+  * \param r The 64 byte result will be written into here.
+  * \param op1 The 32 byte operand to square. This cannot alias r.
+  */
+static void bigSquareNoModulo(uint8_t *r, BigNum256 op1)
+{
+	uint8_t cached_op1;
+	uint8_t carry;
+	uint8_t top_bit;
+	uint16_t partial;
+	uint8_t i;
+	uint8_t j;
+
+	memset(r, 0, 64);
+	// Off-diagonal products.
+	for (i = 0; i < 31; i++)
+	{
+		cached_op1 = op1[i];
+		carry = 0;
+		for (j = (uint8_t)(i + 1); j < 32; j++)
+		{
+			// This can't overflow, since
+			// (2 ^ 8 - 1) ^ 2 + 2 * (2 ^ 8 - 1) = 2 ^ 16 - 1.
+			partial = (uint16_t)((uint16_t)cached_op1 * (uint16_t)op1[j] + (uint16_t)r[i + j] + (uint16_t)carry);
+			r[i + j] = (uint8_t)partial;
+			carry = (uint8_t)(partial >> 8);
+		}
+		r[i + 32] = carry;
+	}
+	// Double them. The sum of the off-diagonal products is < 2 ^ 511, so
+	// nothing is shifted out.
+	carry = 0;
+	for (i = 0; i < 64; i++)
+	{
+		top_bit = (uint8_t)(r[i] >> 7);
+		r[i] = (uint8_t)((r[i] << 1) | carry);
+		carry = top_bit;
+	}
+	// Add the diagonal squares.
+	carry = 0;
+	for (i = 0; i < 32; i++)
+	{
+		partial = (uint16_t)((uint16_t)op1[i] * (uint16_t)op1[i] + (uint16_t)r[2 * i] + (uint16_t)carry);
+		r[2 * i] = (uint8_t)partial;
+		partial = (uint16_t)((partial >> 8) + (uint16_t)r[2 * i + 1]);
+		r[2 * i + 1] = (uint8_t)partial;
+		carry = (uint8_t)(partial >> 8);
+	}
+#ifdef TEST
+	assert(carry == 0);
+#endif // #ifdef TEST
+}
+
+#endif // #ifdef BIGNUM_32BIT_LIMBS
+
+#endif // #if defined(PLATFORM_SPECIFIC_BIGSQUARE)
+
+/** Reduce (r = full_r modulo n) a 64 byte multi-precision number under
+  * the specified prime finite field.
+  * \param r The 32 byte result will be written into here.
+  * \param full_r The 64 byte number to reduce. This will be overwritten.
+  * \param field The prime finite field to operate under.
+  */
+static void bigReduce(BigNum256 r, uint8_t *full_r, const BigNumField *field)
+{
+	uint8_t temp[64] WORD_ALIGNED;
+	uint8_t remaining;
+
+	// The modular reduction is done by subtracting off some multiple of
+	// n. The upper 256 bits of r are used as an estimate for that multiple.
+	// As long as n is close to 2 ^ 256, this estimate should be very close.
+	// However, since n < 2 ^ 256, the estimate will always be an
+	// underestimate. That's okay, because the algorithm can be applied
+	// repeatedly, until the upper 256 bits of r are zero.
+	// remaining denotes the maximum number of possible non-zero bytes left in
+	// the result.
+	remaining = 64;
+	while (remaining > 32)
+	{
+		memset(temp, 0, 64);
+		// n should be equal to 2 ^ 256 - complement_n. Therefore, subtracting
+		// off (upper 256 bits of r) * n is equivalent to setting the
+		// upper 256 bits of r to 0 and
+		// adding (upper 256 bits of r) * complement_n.
+		bigMultiplyVariableSizeNoModulo(\
+			temp,
+			field->complement_n, field->size_complement_n,
+			&(full_r[32]), (uint8_t)(remaining - 32));
+		memset(&(full_r[32]), 0, 32);
+		bigAddVariableSizeNoModulo(full_r, full_r, temp, remaining);
+		// This update of the bound is only valid for remaining > 32.
+		remaining = (uint8_t)(remaining - 32 + field->size_complement_n);
+	}
+	// The upper 256 bits of r should now be 0. But r could still be >= n.
+	// As long as n > 2 ^ 255, at most one subtraction is
+	// required to ensure that r < n.
+	bigModuloInField(full_r, full_r, field);
+	bigAssign(r, full_r);
+}
+
+/** Multiplies (r = (op1 x op2) modulo n) two 32 byte multi-precision
+  * numbers under the specified prime finite field.
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The first 32 byte operand to multiply. This may alias r.
+  * \param op2 The second 32 byte operand to multiply. This may alias r or
+  *            op1.
+  * \param field The prime finite field to operate under.
+  */
+void bigMultiplyInField(BigNum256 r, BigNum256 op1, BigNum256 op2, const BigNumField *field)
+{
+	uint8_t full_r[64] WORD_ALIGNED;
+
+	bigMultiplyVariableSizeNoModulo(full_r, op1, 32, op2, 32);
+	bigReduce(r, full_r, field);
+}
+
+/** Multiplies (r = (op1 x op2) modulo n) two 32 byte multi-precision
+  * numbers under the current prime finite field. This is the same as
+  * bigMultiplyInField(), but uses the field set by bigSetField().
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The first 32 byte operand to multiply. This may alias r.
+  * \param op2 The second 32 byte operand to multiply. This may alias r or
+  *            op1.
+  */
+void bigMultiply(BigNum256 r, BigNum256 op1, BigNum256 op2)
+{
+	bigMultiplyInField(r, op1, op2, &current_field);
+}
+
+/** Squares (r = (op1 x op1) modulo n) a 32 byte multi-precision number
+  * under the specified prime finite field. This gives the same result as
+  * bigMultiplyInField(r, op1, op1, field), but is faster.
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The 32 byte operand to square. This may alias r.
+  * \param field The prime finite field to operate under.
+  */
+void bigSquareInField(BigNum256 r, BigNum256 op1, const BigNumField *field)
+{
+	uint8_t full_r[64] WORD_ALIGNED;
+
+	bigSquareNoModulo(full_r, op1);
+	bigReduce(r, full_r, field);
+}
+
+/** Squares (r = (op1 x op1) modulo n) a 32 byte multi-precision number
+  * under the current prime finite field. This is the same as
+  * bigSquareInField(), but uses the field set by bigSetField().
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The 32 byte operand to square. This may alias r.
+  */
+void bigSquare(BigNum256 r, BigNum256 op1)
+{
+	bigSquareInField(r, op1, &current_field);
+}
+
+/** Fold the upper part of a number into its lower 256 bits, without changing
+  * the value of the number modulo #secp256k1_field_p.
+  * Since #secp256k1_field_p = 2 ^ 256 - 2 ^ 32 - 977,
+  * 2 ^ 256 = 2 ^ 32 + 977 (modulo #secp256k1_field_p). So
+  * upper x 2 ^ 256 can be replaced with upper x 2 ^ 32 + upper x 977, which
+  * is a shift and a small multiplication.
+  * \param x The number to fold. The bytes at x[32] to
+  *          x[32 + upper_size - 1] (inclusive) are the upper part. They will
+  *          be cleared, then the folded result will be written back into
+  *          the first add_size bytes of x.
+  * \param upper_size The size, in number of bytes, of the upper part. This
+  *                   must be <= 32.
+  * \param add_size The size, in number of bytes, of the folded result. This
+  *                 must be large enough to hold the result, and must be
+  *                 between 33 and 37 inclusive.
+  */
+static void foldModP(uint8_t *x, uint8_t upper_size, uint8_t add_size)
+{
+	BigNum256Storage upper;
+	uint8_t temp[37] WORD_ALIGNED;
+
+	memcpy(upper, &(x[32]), upper_size);
+	memset(&(x[32]), 0, upper_size);
+	memset(temp, 0, sizeof(temp));
+	bigMultiplyVariableSizeNoModulo(temp, upper, upper_size, (uint8_t *)secp256k1_field_977, sizeof(secp256k1_field_977));
+	bigAddVariableSizeNoModulo(x, x, temp, add_size);
+	memset(temp, 0, sizeof(temp));
+	memcpy(&(temp[4]), upper, upper_size);
+	bigAddVariableSizeNoModulo(x, x, temp, add_size);
+}
+
+/** Reduce (r = full_r modulo #secp256k1_field_p) a 64 byte multi-precision
+  * number, using the special form of #secp256k1_field_p.
+  * \param r The 32 byte result will be written into here.
+  * \param full_r The 64 byte number to reduce. This will be overwritten.
+  */
+static void reduceModP(BigNum256 r, uint8_t *full_r)
+{
+	uint8_t cmp;
+	uint8_t *lookup[2];
+	BigNum256Storage zero;
+
+	// Every fold has a fixed size, so that the time taken doesn't depend on
+	// how big the intermediate results are. After the first fold,
+	// full_r < 2 ^ 289. After the second fold, full_r < 2 ^ 256 + 2 ^ 66.
+	// If bit 256 is still set, the lower 256 bits must be small, so the
+	// third fold can't overflow. After that, full_r < 2 ^ 256.
+	foldModP(full_r, 32, 37);
+	foldModP(full_r, 5, 33);
+	foldModP(full_r, 1, 33);
+	// 2 ^ 256 < 2 x #secp256k1_field_p, so at most one subtraction is
+	// required to ensure that r < #secp256k1_field_p.
+	bigSetZero(zero);
+	// The following 2 lines do: cmp = "bigCompare(full_r, p) == BIGCMP_LESS ? 1 : 0".
+	cmp = (uint8_t)(bigCompare(full_r, (BigNum256)secp256k1_field_p) ^ BIGCMP_LESS);
+	cmp = (uint8_t)((((uint16_t)(-(int)cmp)) >> 8) + 1);
+	lookup[0] = (uint8_t *)secp256k1_field_p;
+	lookup[1] = zero;
+	bigSubtractNoModulo(r, full_r, lookup[cmp]);
+}
+
+/** Multiplies (r = (op1 x op2) modulo #secp256k1_field_p) two 32 byte
+  * multi-precision numbers. This does the same thing as bigMultiply()
+  * with the field set to #secp256k1_field_p, except that the special form
+  * of #secp256k1_field_p is used to make reduction faster. The field set by
+  * bigSetField() is ignored.
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The first 32 byte operand to multiply. This may alias r.
+  * \param op2 The second 32 byte operand to multiply. This may alias r or
+  *            op1.
+  */
+void bigMultiplyModP(BigNum256 r, BigNum256 op1, BigNum256 op2)
+{
+	uint8_t full_r[64] WORD_ALIGNED;
+
+	bigMultiplyVariableSizeNoModulo(full_r, op1, 32, op2, 32);
+	reduceModP(r, full_r);
+}
+
+/** Squares (r = (op1 x op1) modulo #secp256k1_field_p) a 32 byte
+  * multi-precision number. This gives the same result as
+  * bigMultiplyModP(r, op1, op1), but is faster.
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The 32 byte operand to square. This may alias r.
+  */
+void bigSquareModP(BigNum256 r, BigNum256 op1)
+{
+	uint8_t full_r[64] WORD_ALIGNED;
+
+	bigSquareNoModulo(full_r, op1);
+	reduceModP(r, full_r);
+}
+
+/** Multiplies (r = (op1 x multiplier) modulo #secp256k1_field_p) a 32 byte
+  * multi-precision number by a small constant. This is much faster than
+  * bigMultiplyModP(), and is also faster than doing the same thing with a
+  * chain of bigAdd() calls, since each of those does a full conditional
+  * reduction whereas this only reduces once. The field set by bigSetField()
+  * is ignored.
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The 32 byte operand to multiply. This may alias r.
+  * \param multiplier The small constant to multiply op1 by.
+  * \warning op1 must be < #secp256k1_field_p.
+  */
+void bigMultiplySmallModP(BigNum256 r, BigNum256 op1, uint8_t multiplier)
+{
+	BigNum256Storage fold;
+	BigNum256Storage zero;
+	uint8_t *lookup[2];
+	uint8_t carry;
+	uint8_t cmp;
+	uint16_t partial;
+	uint32_t upper_977;
+	uint8_t i;
+
+#ifdef TEST
+	assert(bigCompare(op1, (BigNum256)secp256k1_field_p) == BIGCMP_LESS);
+#endif // #ifdef TEST
+	carry = 0;
+	for (i = 0; i < 32; i++)
+	{
+		partial = (uint16_t)((uint16_t)op1[i] * multiplier + carry);
+		r[i] = (uint8_t)partial;
+		carry = (uint8_t)(partial >> 8);
+	}
+	// carry is the upper part of the product, and is < multiplier. As in
+	// foldModP(), upper x 2 ^ 256 can be replaced with
+	// upper x 2 ^ 32 + upper x 977.
+	bigSetZero(fold);
+	upper_977 = (uint32_t)carry * 977;
+	fold[0] = (uint8_t)upper_977;
+	fold[1] = (uint8_t)(upper_977 >> 8);
+	fold[2] = (uint8_t)(upper_977 >> 16);
+	fold[4] = carry;
+	carry = bigAddVariableSizeNoModulo(r, r, fold, 32);
+	// If that overflowed, the lower 256 bits must be small, so a second
+	// fold (of 1 x 2 ^ 256) can't overflow.
+	bigSetZero(zero);
+	fold[0] = secp256k1_field_977[0];
+	fold[1] = secp256k1_field_977[1];
+	fold[2] = 0;
+	fold[4] = 1;
+	lookup[0] = zero;
+	lookup[1] = fold;
+	bigAddVariableSizeNoModulo(r, r, lookup[carry], 32);
+	// The following 2 lines do: cmp = "bigCompare(r, p) == BIGCMP_LESS ? 1 : 0".
+	cmp = (uint8_t)(bigCompare(r, (BigNum256)secp256k1_field_p) ^ BIGCMP_LESS);
+	cmp = (uint8_t)((((uint16_t)(-(int)cmp)) >> 8) + 1);
+	lookup[0] = (uint8_t *)secp256k1_field_p;
+	lookup[1] = zero;
+	bigSubtractNoModulo(r, r, lookup[cmp]);
+}
+
+/** Fold the upper part of a number into its lower 256 bits, without changing
+  * the value of the number modulo #secp256k1_field_n.
+  * Since #secp256k1_field_n = 2 ^ 256 - 2 ^ 128 - c,
+  * 2 ^ 256 = 2 ^ 128 + c (modulo #secp256k1_field_n). So
+  * upper x 2 ^ 256 can be replaced with upper x 2 ^ 128 + upper x c. c is
+  * only 16 bytes long, so this is cheaper than the generic reduction in
+  * bigReduce(), which multiplies by the whole 17 byte complement of n.
+  * \param x The number to fold. The bytes at x[32] to
+  *          x[32 + upper_size - 1] (inclusive) are the upper part. They will
+  *          be cleared, then the folded result will be written back into
+  *          the first add_size bytes of x.
+  * \param upper_size The size, in number of bytes, of the upper part. This
+  *                   must be <= 32.
+  * \param add_size The size, in number of bytes, of the folded result. This
+  *                 must be large enough to hold the result, and must be
+  *                 between 33 and 49 inclusive.
+  */
+static void foldModN(uint8_t *x, uint8_t upper_size, uint8_t add_size)
+{
+	uint8_t upper[33] WORD_ALIGNED;
+	uint8_t temp[49] WORD_ALIGNED;
+
+	// upper x 2 ^ 128 is added by adding upper to x starting at x[16], so
+	// upper is padded with zeroes to add_size - 16 bytes.
+	memset(upper, 0, sizeof(upper));
+	memcpy(upper, &(x[32]), upper_size);
+	memset(&(x[32]), 0, upper_size);
+	memset(&(temp[upper_size + 16]), 0, (uint8_t)(sizeof(temp) - upper_size - 16));
+	bigMultiplyVariableSizeNoModulo(temp, upper, upper_size, (uint8_t *)secp256k1_field_n_c, sizeof(secp256k1_field_n_c));
+	bigAddVariableSizeNoModulo(x, x, temp, add_size);
+	bigAddVariableSizeNoModulo(&(x[16]), &(x[16]), upper, (uint8_t)(add_size - 16));
+}
+
+/** Reduce (r = full_r modulo #secp256k1_field_n) a 64 byte multi-precision
+  * number, using the special form of #secp256k1_field_n.
+  * \param r The 32 byte result will be written into here.
+  * \param full_r The 64 byte number to reduce. This will be overwritten.
+  */
+static void reduceModN(BigNum256 r, uint8_t *full_r)
+{
+	BigNum256Storage fold;
+	BigNum256Storage zero;
+	uint8_t *lookup[2];
+	uint8_t upper;
+	uint8_t carry;
+	uint8_t cmp;
+	uint16_t partial;
+	uint8_t i;
+
+	// As in reduceModP(), every fold has a fixed size. After the first fold,
+	// full_r < 2 ^ 386. After the second fold, full_r < 2 ^ 260.
+	foldModN(full_r, 32, 49);
+	foldModN(full_r, 17, 33);
+	// The upper part is now a single byte (< 16), which is small enough to
+	// be folded in without a multi-precision multiplication.
+	upper = full_r[32];
+	bigSetZero(fold);
+	carry = 0;
+	for (i = 0; i < 16; i++)
+	{
+		partial = (uint16_t)((uint16_t)secp256k1_field_n_c[i] * upper + carry);
+		fold[i] = (uint8_t)partial;
+		carry = (uint8_t)(partial >> 8);
+	}
+	fold[16] = (uint8_t)(carry + upper);
+	carry = bigAddVariableSizeNoModulo(full_r, full_r, fold, 32);
+	// If that overflowed, the lower 256 bits must be < 2 ^ 133, so a
+	// second fold (of 1 x 2 ^ 256) can't overflow.
+	memcpy(fold, secp256k1_field_n_c, sizeof(secp256k1_field_n_c));
+	fold[16] = 1;
+	bigSetZero(zero);
+	lookup[0] = zero;
+	lookup[1] = fold;
+	bigAddVariableSizeNoModulo(full_r, full_r, lookup[carry], 32);
+	// 2 ^ 256 < 2 x #secp256k1_field_n, so at most one subtraction is
+	// required to ensure that r < #secp256k1_field_n.
+	// The following 2 lines do: cmp = "bigCompare(full_r, n) == BIGCMP_LESS ? 1 : 0".
+	cmp = (uint8_t)(bigCompare(full_r, (BigNum256)secp256k1_field_n) ^ BIGCMP_LESS);
+	cmp = (uint8_t)((((uint16_t)(-(int)cmp)) >> 8) + 1);
+	lookup[0] = (uint8_t *)secp256k1_field_n;
+	lookup[1] = zero;
+	bigSubtractNoModulo(r, full_r, lookup[cmp]);
+}
+
+/** Multiplies (r = (op1 x op2) modulo #secp256k1_field_n) two 32 byte
+  * multi-precision numbers. This does the same thing as bigMultiply()
+  * with the field set to #secp256k1_field_n, except that the special form
+  * of #secp256k1_field_n is used to make reduction faster. The field set by
+  * bigSetField() is ignored.
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The first 32 byte operand to multiply. This may alias r.
+  * \param op2 The second 32 byte operand to multiply. This may alias r or
+  *            op1.
+  */
+void bigMultiplyModN(BigNum256 r, BigNum256 op1, BigNum256 op2)
+{
+	uint8_t full_r[64] WORD_ALIGNED;
+
+	bigMultiplyVariableSizeNoModulo(full_r, op1, 32, op2, 32);
+	reduceModN(r, full_r);
+}
+
+/** Squares (r = (op1 x op1) modulo #secp256k1_field_n) a 32 byte
+  * multi-precision number. This gives the same result as
+  * bigMultiplyModN(r, op1, op1), but is faster.
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The 32 byte operand to square. This may alias r.
+  */
+void bigSquareModN(BigNum256 r, BigNum256 op1)
+{
+	uint8_t full_r[64] WORD_ALIGNED;
+
+	bigSquareNoModulo(full_r, op1);
+	reduceModN(r, full_r);
+}
+
+#ifdef BIGNUM_SIMD_BATCH
+
+/** Number of independent multiplications which bigMultiplyBatchNoModulo()
+  * does at once. */
+#define BIGNUM_BATCH_LANES		4
+
+/** A vector of #BIGNUM_BATCH_LANES 64 bit lanes. Each lane belongs to a
+  * different, independent multiplication. */
+typedef uint64_t BatchVector __attribute__((vector_size(BIGNUM_BATCH_LANES * 8)));
+
+/** Multiply (r = op1 x op2) #BIGNUM_BATCH_LANES pairs of 32 byte
+  * multi-precision numbers, without any modular reduction. The numbers are
+  * split into 32 bit limbs, and lane j of every vector belongs to the j-th
+  * pair. Partial products are split into their upper and lower halves
+  * before being accumulated, so that the column sums can't overflow 64 bits.
+  * Like everything else in this file, this takes the same time regardless of
+  * the operands.
+  * \param r The #BIGNUM_BATCH_LANES 64 byte results will be written here,
+  *          one after another.
+  * \param op1 The first operands, one after another. These must not alias
+  *            r.
+  * \param op2 The second operands, one after another. These must not alias
+  *            r.
+  */
+static void bigMultiplyBatchNoModulo(uint8_t *r, const uint8_t *op1, const uint8_t *op2)
+{
+	BatchVector a[8];
+	BatchVector b[8];
+	BatchVector lo[16];
+	BatchVector hi[16];
+	BatchVector product;
+	BatchVector carry;
+	BatchVector column;
+	uint8_t i;
+	uint8_t j;
+	uint8_t lane;
+	uint8_t k;
+
+	for (i = 0; i < 8; i++)
+	{
+		for (lane = 0; lane < BIGNUM_BATCH_LANES; lane++)
+		{
+			a[i][lane] = 0;
+			b[i][lane] = 0;
+			for (k = 0; k < 4; k++)
+			{
+				a[i][lane] |= (uint64_t)op1[lane * 32 + i * 4 + k] << (k * 8);
+				b[i][lane] |= (uint64_t)op2[lane * 32 + i * 4 + k] << (k * 8);
+			}
+		}
+	}
+	memset(lo, 0, sizeof(lo));
+	memset(hi, 0, sizeof(hi));
+	for (i = 0; i < 8; i++)
+	{
+		for (j = 0; j < 8; j++)
+		{
+			// Both operands are < 2 ^ 32, so the product fits in 64 bits.
+			// Each column gets at most 8 halves, so the sums are < 2 ^ 35.
+			product = a[i] * b[j];
+			lo[i + j] += product & 0xffffffff;
+			hi[i + j] += product >> 32;
+		}
+	}
+	memset(&carry, 0, sizeof(carry));
+	for (i = 0; i < 16; i++)
+	{
+		column = lo[i] + carry;
+		if (i != 0)
+		{
+			column += hi[i - 1];
+		}
+		carry = column >> 32;
+		for (lane = 0; lane < BIGNUM_BATCH_LANES; lane++)
+		{
+			for (k = 0; k < 4; k++)
+			{
+				r[lane * 64 + i * 4 + k] = (uint8_t)(column[lane] >> (k * 8));
+			}
+		}
+	}
+}
+
+/** Multiply many independent pairs of 32 byte multi-precision numbers,
+  * #BIGNUM_BATCH_LANES pairs at a time, and reduce each 64 byte product
+  * using the specified reduction function. The last group is padded
+  * with zeroes if count isn't a multiple of #BIGNUM_BATCH_LANES.
+  * \param r The count 32 byte results will be written here, one after
+  *          another.
+  * \param op1 The count first operands, one after another. This may alias
+  *            r.
+  * \param op2 The count second operands, one after another. This may alias
+  *            r or op1.
+  * \param count The number of multiplications to do.
+  * \param reduce The function which reduces a 64 byte product to 32 bytes;
+  *               either reduceModP() or reduceModN().
+  */
+static void bigMultiplyBatch(uint8_t *r, uint8_t *op1, uint8_t *op2, uint8_t count, void (*reduce)(BigNum256, uint8_t *))
+{
+	uint8_t in1[BIGNUM_BATCH_LANES * 32];
+	uint8_t in2[BIGNUM_BATCH_LANES * 32];
+	uint8_t full_r[BIGNUM_BATCH_LANES * 64] WORD_ALIGNED;
+	uint8_t group;
+	uint8_t lane;
+
+	while (count > 0)
+	{
+		group = MIN(count, BIGNUM_BATCH_LANES);
+		memset(in1, 0, sizeof(in1));
+		memset(in2, 0, sizeof(in2));
+		memcpy(in1, op1, (size_t)group * 32);
+		memcpy(in2, op2, (size_t)group * 32);
+		bigMultiplyBatchNoModulo(full_r, in1, in2);
+		for (lane = 0; lane < group; lane++)
+		{
+			reduce(&(r[lane * 32]), &(full_r[lane * 64]));
+		}
+		r += group * 32;
+		op1 += group * 32;
+		op2 += group * 32;
+		count = (uint8_t)(count - group);
+	}
+}
+
+#endif // #ifdef BIGNUM_SIMD_BATCH
+
+/** Multiply (r[i] = (op1[i] x op2[i]) modulo #secp256k1_field_p) many
+  * independent pairs of 32 byte multi-precision numbers. This gives the
+  * same results as calling bigMultiplyModP() for each pair, but if
+  * BIGNUM_SIMD_BATCH is defined, several pairs are multiplied at once using
+  * vector instructions.
+  * \param r The count 32 byte results will be written here, one after
+  *          another.
+  * \param op1 The count first operands, one after another. This may alias
+  *            r.
+  * \param op2 The count second operands, one after another. This may alias
+  *            r or op1.
+  * \param count The number of multiplications to do.
+  */
+void bigMultiplyModPBatch(uint8_t *r, uint8_t *op1, uint8_t *op2, uint8_t count)
+{
+#ifdef BIGNUM_SIMD_BATCH
+	bigMultiplyBatch(r, op1, op2, count, reduceModP);
+#else
+	uint8_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		bigMultiplyModP(&(r[i * 32]), &(op1[i * 32]), &(op2[i * 32]));
+	}
+#endif // #ifdef BIGNUM_SIMD_BATCH
+}
+
+/** Multiply (r[i] = (op1[i] x op2[i]) modulo #secp256k1_field_n) many
+  * independent pairs of 32 byte multi-precision numbers. This is the same
+  * as bigMultiplyModPBatch(), except for the modulus.
+  * \param r The count 32 byte results will be written here, one after
+  *          another.
+  * \param op1 The count first operands, one after another. This may alias
+  *            r.
+  * \param op2 The count second operands, one after another. This may alias
+  *            r or op1.
+  * \param count The number of multiplications to do.
+  */
+void bigMultiplyModNBatch(uint8_t *r, uint8_t *op1, uint8_t *op2, uint8_t count)
+{
+#ifdef BIGNUM_SIMD_BATCH
+	bigMultiplyBatch(r, op1, op2, count, reduceModN);
+#else
+	uint8_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		bigMultiplyModN(&(r[i * 32]), &(op1[i * 32]), &(op2[i * 32]));
+	}
+#endif // #ifdef BIGNUM_SIMD_BATCH
+}
+
+#ifdef BIGNUM_GCD_INVERT
+
+/** Swap (if swap is 1) or leave alone (if swap is 0) two 32 byte
+  * multi-precision numbers, without branching on swap.
+  * \param op1 The first 32 byte operand.
+  * \param op2 The second 32 byte operand. This must not alias op1.
+  * \param swap 1 to swap op1 and op2, 0 to leave them alone. This must not
+  *             be anything else.
+  */
+static void bigConditionalSwap(BigNum256 op1, BigNum256 op2, uint8_t swap)
+{
+	uint8_t mask;
+	uint8_t t;
+	uint8_t i;
+
+	mask = (uint8_t)(-(int)swap);
+	for (i = 0; i < 32; i++)
+	{
+		t = (uint8_t)((op1[i] ^ op2[i]) & mask);
+		op1[i] = (uint8_t)(op1[i] ^ t);
+		op2[i] = (uint8_t)(op2[i] ^ t);
+	}
+}
+
+/** Compute the modular inverse of a 32 byte multi-precision number under
+  * the specified prime finite field (i.e. find r such that
+  * (r x op1) modulo n = 1).
+  *
+  * This uses the constant-time binary extended GCD algorithm described in
+  * section 3 of "Fast and compact elliptic-curve cryptography" by Niels
+  * Moller (the same one used by mpn_sec_invert() in GMP). Every iteration
+  * does the same sequence of additions, subtractions and shifts, with
+  * data-dependent choices made using lookups instead of branches. The
+  * result is still 0 if op1 is 0.
   * \param r The 32 byte result will be written into here.
-  * \param op1 The first 32 byte operand to multiply. This may alias r.
-  * \param op2 The second 32 byte operand to multiply. This may alias r or
-  *            op1.
+  * \param op1 The 32 byte operand to find the inverse of. This may alias r.
+  *            This must be less than n.
+  * \param field The prime finite field to operate under.
   */
-void bigMultiply(BigNum256 r, BigNum256 op1, BigNum256 op2)
+void bigInvertInField(BigNum256 r, BigNum256 op1, const BigNumField *field)
 {
-	uint8_t temp[64];
-	uint8_t full_r[64];
-	uint8_t remaining;
-
-	bigMultiplyVariableSizeNoModulo(full_r, op1, 32, op2, 32);
-	// The modular reduction is done by subtracting off some multiple of
-	// n. The upper 256 bits of r are used as an estimate for that multiple.
-	// As long as n is close to 2 ^ 256, this estimate should be very close.
-	// However, since n < 2 ^ 256, the estimate will always be an
-	// underestimate. That's okay, because the algorithm can be applied
-	// repeatedly, until the upper 256 bits of r are zero.
-	// remaining denotes the maximum number of possible non-zero bytes left in
-	// the result.
-	remaining = 64;
-	while (remaining > 32)
+	BigNum256Storage a;
+	BigNum256Storage b;
+	BigNum256Storage u;
+	BigNum256Storage negated_a;
+	BigNum256Storage half_n_plus_1;
+	BigNum256Storage zero;
+	uint8_t *lookup[2];
+	uint8_t odd;
+	uint8_t borrow;
+	uint16_t i;
+	BigNum256 n;
+
+	n = field->n;
+	// Throughout the loop below, a = u x op1 and b = r x op1 (modulo n),
+	// with b odd. Every iteration reduces the total number of bits in a
+	// and b by at least 1, so after 512 iterations a = 0 and b = gcd(op1, n)
+	// = 1 (since n is prime), which means r is the inverse of op1.
+	bigAssign(a, op1);
+	bigAssign(b, n);
+	bigSetZero(u);
+	u[0] = 1;
+	bigSetZero(r);
+	bigSetZero(zero);
+	// half_n_plus_1 = (n + 1) / 2. This is used to divide by 2 modulo n.
+	bigShiftRightNoModulo(half_n_plus_1, n);
+	bigAddVariableSizeNoModulo(half_n_plus_1, half_n_plus_1, u, 32);
+	lookup[0] = zero;
+	for (i = 0; i < 512; i++)
 	{
-		memset(temp, 0, 64);
-		// n should be equal to 2 ^ 256 - complement_n. Therefore, subtracting
-		// off (upper 256 bits of r) * n is equivalent to setting the
-		// upper 256 bits of r to 0 and
-		// adding (upper 256 bits of r) * complement_n.
-		bigMultiplyVariableSizeNoModulo(\
-			temp,
-			complement_n, size_complement_n,
-			&(full_r[32]), (uint8_t)(remaining - 32));
-		memset(&(full_r[32]), 0, 32);
-		bigAddVariableSizeNoModulo(full_r, full_r, temp, remaining);
-		// This update of the bound is only valid for remaining > 32.
-		remaining = (uint8_t)(remaining - 32 + size_complement_n);
+		// The next few lines do the following:
+		// if (a is odd)
+		// {
+		//     if (a < b)
+		//     {
+		//         swap(a, b);
+		//         swap(u, r);
+		//     }
+		//     a = a - b;
+		//     u = u - r;
+		// }
+		odd = (uint8_t)(a[0] & 1);
+		lookup[1] = b;
+		borrow = bigSubtractNoModulo(a, a, lookup[odd]);
+		// If borrow occurred, a is now a - b + 2 ^ 256, so adding it to b
+		// sets b to the old value of a.
+		lookup[1] = a;
+		bigAddVariableSizeNoModulo(b, b, lookup[borrow], 32);
+		bigSubtractNoModulo(negated_a, zero, a);
+		bigConditionalSwap(a, negated_a, borrow);
+		bigConditionalSwap(u, r, borrow);
+		lookup[1] = r;
+		bigSubtractInField(u, u, lookup[odd], field);
+		// a is now even, so it can be halved.
+		bigShiftRightNoModulo(a, a);
+		// Halve u modulo n. If u is odd, then (u + n) / 2 = (u - 1) / 2 +
+		// (n + 1) / 2.
+		odd = (uint8_t)(u[0] & 1);
+		bigShiftRightNoModulo(u, u);
+		lookup[1] = half_n_plus_1;
+		bigAddVariableSizeNoModulo(u, u, lookup[odd], 32);
 	}
-	// The upper 256 bits of r should now be 0. But r could still be >= n.
-	// As long as n > 2 ^ 255, at most one subtraction is
-	// required to ensure that r < n.
-	bigModulo(full_r, full_r);
-	bigAssign(r, full_r);
 }
 
+#else
 
 /** Compute the modular inverse of a 32 byte multi-precision number under
-  * the current prime finite field (i.e. find r such that
-  * (r x op1) modulo #n = 1).
+  * the specified prime finite field (i.e. find r such that
+  * (r x op1) modulo n = 1).
   * \param r The 32 byte result will be written into here.
   * \param op1 The 32 byte operand to find the inverse of. This may alias r.
+  * \param field The prime finite field to operate under.
   */
-void bigInvert(BigNum256 r, BigNum256 op1)
+void bigInvertInField(BigNum256 r, BigNum256 op1, const BigNumField *field)
 {
-	uint8_t temp[32];
+	BigNum256Storage temp;
 	uint8_t i;
 	uint8_t j;
 	uint8_t byte_of_n_minus_2;
@@ -478,7 +1517,7 @@ void bigInvert(BigNum256 r, BigNum256 op1)
 	lookup[1] = temp;
 	for (i = 31; i < 32; i--)
 	{
-		byte_of_n_minus_2 = n[i];
+		byte_of_n_minus_2 = field->n[i];
 		if (i == 0)
 		{
 			byte_of_n_minus_2 = (uint8_t)(byte_of_n_minus_2 - 2);
@@ -490,20 +1529,234 @@ void bigInvert(BigNum256 r, BigNum256 op1)
 			// The next two lines do the following:
 			// if (bit_of_n_minus_2)
 			// {
-			//     bigMultiply(r, r, temp);
-			//     bigMultiply(temp, temp, temp);
+			//     bigMultiplyInField(r, r, temp, field);
+			//     bigSquareInField(temp, temp, field);
 			// }
 			// else
 			// {
-			//     bigMultiply(temp, r, temp);
-			//     bigMultiply(r, r, r);
+			//     bigMultiplyInField(temp, r, temp, field);
+			//     bigSquareInField(r, r, field);
 			// }
-			bigMultiply(lookup[1 - bit_of_n_minus_2], r, temp);
-			bigMultiply(lookup[bit_of_n_minus_2], lookup[bit_of_n_minus_2], lookup[bit_of_n_minus_2]);
+			bigMultiplyInField(lookup[1 - bit_of_n_minus_2], r, temp, field);
+			bigSquareInField(lookup[bit_of_n_minus_2], lookup[bit_of_n_minus_2], field);
 		}
 	}
 }
 
+#endif // #ifdef BIGNUM_GCD_INVERT
+
+/** Compute the modular inverse of a 32 byte multi-precision number under
+  * the current prime finite field. This is the same as bigInvertInField(),
+  * but uses the field set by bigSetField().
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The 32 byte operand to find the inverse of. This may alias r.
+  */
+void bigInvert(BigNum256 r, BigNum256 op1)
+{
+	bigInvertInField(r, op1, &current_field);
+}
+
+/** Square a 32 byte multi-precision number a number of times
+  * (r = op1 ^ (2 ^ count) modulo #secp256k1_field_p).
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The 32 byte operand to square. This may alias r.
+  * \param count The number of times to square op1. This must be at least 1.
+  */
+static void bigSquareRepeatModP(BigNum256 r, BigNum256 op1, uint8_t count)
+{
+	uint8_t i;
+
+	bigSquareModP(r, op1);
+	for (i = 1; i < count; i++)
+	{
+		bigSquareModP(r, r);
+	}
+}
+
+/** Do the part of the addition chains for (p - 2) and (p + 1) / 4 (where p
+  * is #secp256k1_field_p) which both exponents have in common. The upper
+  * 223 bits of both exponents are all ones, followed by a 0, followed by
+  * 22 ones, so the chain builds up runs of ones of increasing length:
+  * 2, 3, 6, 9, 11, 22, 44, 88, 176, 220 then 223.
+  * This is the addition chain used in libsecp256k1.
+  * \param t The 32 byte result op1 ^ (2 ^ 246 - 2 ^ 22 - 1) (the exponent
+  *          in binary is 223 ones, a 0 and 22 ones) will be written into
+  *          here.
+  * \param x2 op1 ^ (2 ^ 2 - 1) will be written into here.
+  * \param op1 The 32 byte operand to exponentiate. This cannot alias t or x2.
+  */
+static void bigChainCommonModP(BigNum256 t, BigNum256 x2, BigNum256 op1)
+{
+	BigNum256Storage x3;
+	BigNum256Storage x22;
+	BigNum256Storage x44;
+	BigNum256Storage u;
+
+	// In what follows, xn = op1 ^ (2 ^ n - 1), which is n ones in binary.
+	bigSquareModP(x2, op1);
+	bigMultiplyModP(x2, x2, op1);
+	bigSquareModP(x3, x2);
+	bigMultiplyModP(x3, x3, op1);
+	bigSquareRepeatModP(t, x3, 3);
+	bigMultiplyModP(t, t, x3); // t = x6
+	bigSquareRepeatModP(t, t, 3);
+	bigMultiplyModP(t, t, x3); // t = x9
+	bigSquareRepeatModP(t, t, 2);
+	bigMultiplyModP(t, t, x2); // t = x11
+	bigSquareRepeatModP(x22, t, 11);
+	bigMultiplyModP(x22, x22, t);
+	bigSquareRepeatModP(x44, x22, 22);
+	bigMultiplyModP(x44, x44, x22);
+	bigSquareRepeatModP(t, x44, 44);
+	bigMultiplyModP(t, t, x44); // t = x88
+	bigSquareRepeatModP(u, t, 88);
+	bigMultiplyModP(t, u, t); // t = x176
+	bigSquareRepeatModP(t, t, 44);
+	bigMultiplyModP(t, t, x44); // t = x220
+	bigSquareRepeatModP(t, t, 3);
+	bigMultiplyModP(t, t, x3); // t = x223
+	bigSquareRepeatModP(t, t, 23);
+	bigMultiplyModP(t, t, x22);
+}
+
+/** Compute the modular inverse of a 32 byte multi-precision number under
+  * #secp256k1_field_p (i.e. find r such that (r x op1) modulo p = 1). This
+  * gives the same result as bigInvert() with the field set to
+  * #secp256k1_field_p, and is always done in the same amount of time, but
+  * uses a fixed addition chain for the exponent p - 2, which needs only
+  * 255 squarings and 15 multiplications. The field set by bigSetField() is
+  * ignored.
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The 32 byte operand to find the inverse of. This may alias r.
+  *            The result is 0 if op1 is 0.
+  */
+void bigInvertModP(BigNum256 r, BigNum256 op1)
+{
+	BigNum256Storage a;
+	BigNum256Storage x2;
+
+	bigAssign(a, op1);
+	bigChainCommonModP(r, x2, a);
+	// The last 10 bits of p - 2 are 0000101101.
+	bigSquareRepeatModP(r, r, 5);
+	bigMultiplyModP(r, r, a);
+	bigSquareRepeatModP(r, r, 3);
+	bigMultiplyModP(r, r, x2);
+	bigSquareRepeatModP(r, r, 2);
+	bigMultiplyModP(r, r, a);
+}
+
+/** Compute a square root of a 32 byte multi-precision number under
+  * #secp256k1_field_p, by calculating op1 ^ ((p + 1) / 4) (which works
+  * because p = 3 modulo 4). This uses a fixed addition chain, so it is always
+  * done in the same amount of time. The field set by bigSetField() is
+  * ignored.
+  * \param r The 32 byte result will be written into here. If op1 isn't a
+  *          quadratic residue, this will be the square root of -op1
+  *          instead.
+  * \param op1 The 32 byte operand to find the square root of. This may
+  *            alias r.
+  * \return false on success, true if op1 has no square root.
+  */
+bool bigSqrtModP(BigNum256 r, BigNum256 op1)
+{
+	BigNum256Storage a;
+	BigNum256Storage x2;
+
+	bigAssign(a, op1);
+	bigChainCommonModP(r, x2, a);
+	// The last 8 bits of (p + 1) / 4 are 00001100.
+	bigSquareRepeatModP(r, r, 6);
+	bigMultiplyModP(r, r, x2);
+	bigSquareRepeatModP(r, r, 2);
+	bigSquareModP(x2, r);
+	return bigCompare(x2, a) != BIGCMP_EQUAL;
+}
+
+/** Square a 32 byte multi-precision number a number of times
+  * (r = op1 ^ (2 ^ count) modulo #secp256k1_field_n).
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The 32 byte operand to square. This may alias r.
+  * \param count The number of times to square op1. This must be at least 1.
+  */
+static void bigSquareRepeatModN(BigNum256 r, BigNum256 op1, uint8_t count)
+{
+	uint8_t i;
+
+	bigSquareModN(r, op1);
+	for (i = 1; i < count; i++)
+	{
+		bigSquareModN(r, r);
+	}
+}
+
+/** The lower 129 bits of #secp256k1_field_n - 2, split into windows which
+  * each end in a 1 bit. Each entry is the number of squarings to do,
+  * followed by an index into the table of odd powers in bigInvertModN() to
+  * multiply by afterwards (index i is op1 ^ (2i + 1)). Since the exponent
+  * is a constant, so is this schedule. */
+static const uint8_t n_minus_2_windows[26][2] = {
+{5, 5}, {3, 2}, {4, 2}, {4, 3}, {5, 6}, {2, 1}, {5, 3}, {6, 6},
+{5, 5}, {4, 6}, {3, 0}, {6, 2}, {10, 3}, {4, 3}, {5, 7}, {4, 7},
+{5, 4}, {6, 5}, {4, 6}, {5, 1}, {6, 6}, {10, 6}, {4, 4}, {9, 4},
+{4, 7}, {1, 0}};
+
+/** Compute the modular inverse of a 32 byte multi-precision number under
+  * #secp256k1_field_n (i.e. find r such that (r x op1) modulo n = 1). This
+  * gives the same result as bigInvert() with the field set to
+  * #secp256k1_field_n, and is always done in the same amount of time. The
+  * upper 127 bits of n - 2 are all ones, and are done with an addition
+  * chain; the rest is done with a sliding window over a table of odd
+  * powers. That needs 253 squarings and 42 multiplications, compared to 256
+  * of each in the Montgomery ladder used by bigInvert(). The field set by
+  * bigSetField() is ignored.
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The 32 byte operand to find the inverse of. This may alias r.
+  *            The result is 0 if op1 is 0.
+  */
+void bigInvertModN(BigNum256 r, BigNum256 op1)
+{
+	uint8_t table[8][32];
+	BigNum256Storage x8;
+	BigNum256Storage x16;
+	BigNum256Storage x32;
+	uint8_t i;
+
+	// table[i] = op1 ^ (2i + 1). x8 is used to hold op1 ^ 2 while this is
+	// being built.
+	bigAssign(table[0], op1);
+	bigSquareModN(x8, op1);
+	for (i = 1; i < 8; i++)
+	{
+		bigMultiplyModN(table[i], table[i - 1], x8);
+	}
+	// In what follows, xn = op1 ^ (2 ^ n - 1), which is n ones in binary.
+	// table[7] is x4 and table[3] is x3.
+	bigSquareRepeatModN(x8, table[7], 4);
+	bigMultiplyModN(x8, x8, table[7]);
+	bigSquareRepeatModN(x16, x8, 8);
+	bigMultiplyModN(x16, x16, x8);
+	bigSquareRepeatModN(x32, x16, 16);
+	bigMultiplyModN(x32, x32, x16);
+	bigSquareRepeatModN(r, x32, 32);
+	bigMultiplyModN(r, r, x32); // r = x64
+	bigSquareRepeatModN(r, r, 32);
+	bigMultiplyModN(r, r, x32); // r = x96
+	bigSquareRepeatModN(r, r, 16);
+	bigMultiplyModN(r, r, x16); // r = x112
+	bigSquareRepeatModN(r, r, 8);
+	bigMultiplyModN(r, r, x8); // r = x120
+	bigSquareRepeatModN(r, r, 4);
+	bigMultiplyModN(r, r, table[7]); // r = x124
+	bigSquareRepeatModN(r, r, 3);
+	bigMultiplyModN(r, r, table[3]); // r = x127
+	for (i = 0; i < (uint8_t)(sizeof(n_minus_2_windows) / sizeof(n_minus_2_windows[0])); i++)
+	{
+		bigSquareRepeatModN(r, r, n_minus_2_windows[i][0]);
+		bigMultiplyModN(r, r, table[n_minus_2_windows[i][1]]);
+	}
+}
+
 #ifdef TEST_BIGNUM256
 
 /** Number of low edge test numbers (numbers near minimum). */
@@ -557,6 +1810,11 @@ static const uint8_t secp256k1_complement_n[17] = {
 /** Storage for test numbers. */
 static uint8_t test_cases[TOTAL_CASES][32];
 
+/** Largest batch size which is tested with bigMultiplyModPBatch() and
+  * bigMultiplyModNBatch(). This is deliberately not a multiple of the
+  * number of vector lanes. */
+#define BATCH_TEST_SIZE		9
+
 /** Generate test numbers according to:
   * - Low edge cases will start from 0 and go up.
   * - High edge cases will start from max - 1 and go down.
@@ -570,7 +1828,7 @@ static void generateTestCases(BigNum256 max)
 	int test_num;
 	int i;
 	int j;
-	uint8_t current_test[32];
+	BigNum256Storage current_test;
 
 	bigSetZero(current_test);
 	test_num = 0;
@@ -611,6 +1869,9 @@ static void generateTestCases(BigNum256 max)
 #endif // #ifdef TEST
 }
 
+/** Number of GMP limbs in a 256 bit number. */
+#define MPN_LIMBS			((int)(32 / sizeof(mp_limb_t)))
+
 /** Convert number from byte array format to GMP limb array format.
   * \param out Destination GMP limb array.
   * \param in Source little-endian byte array.
@@ -619,10 +1880,15 @@ static void generateTestCases(BigNum256 max)
 static void byteToMpn(mp_limb_t *out, BigNum256 in, int n)
 {
 	int i;
+	int j;
 
 	for (i = 0; i < n; i++)
 	{
-		out[i] = (mp_limb_t)readU32LittleEndian(&(in[i * 4]));
+		out[i] = 0;
+		for (j = (int)sizeof(mp_limb_t) - 1; j >= 0; j--)
+		{
+			out[i] = (out[i] << 8) | (mp_limb_t)in[i * (int)sizeof(mp_limb_t) + j];
+		}
 	}
 }
 
@@ -634,25 +1900,36 @@ static void byteToMpn(mp_limb_t *out, BigNum256 in, int n)
 static void mpnToByte(BigNum256 out, mp_limb_t *in, int n)
 {
 	int i;
+	int j;
 
 	for (i = 0; i < n; i++)
 	{
-		writeU32LittleEndian(&(out[i * 4]), in[i]);
+		for (j = 0; j < (int)sizeof(mp_limb_t); j++)
+		{
+			out[i * (int)sizeof(mp_limb_t) + j] = (uint8_t)(in[i] >> (j * 8));
+		}
 	}
 }
 
+/** Multipliers to test bigMultiplySmallModP() with. */
+static const uint8_t small_multipliers[6] = {0, 1, 2, 3, 8, 255};
+
 int main(void)
 {
 	int operation;
 	int i;
 	int j;
-	uint8_t op1[32];
-	uint8_t op2[32];
-	uint8_t result[64];
-	uint8_t result_compare[64];
+	BigNum256Storage op1;
+	BigNum256Storage op2;
+	uint8_t result[64] WORD_ALIGNED;
+	uint8_t result_compare[64] WORD_ALIGNED;
 	uint8_t returned;
 	int result_size; // in number of GMP limbs
 	int divisor_select;
+	BigNumField n_field;
+	uint8_t batch_op1[BATCH_TEST_SIZE * 32];
+	uint8_t batch_op2[BATCH_TEST_SIZE * 32];
+	uint8_t batch_result[BATCH_TEST_SIZE * 32];
 	mp_limb_t mpn_op1[8];
 	mp_limb_t mpn_op2[8];
 	mp_limb_t mpn_result[16];
@@ -661,9 +1938,9 @@ int main(void)
 	mp_limb_t mpn_quotient[9];
 	mp_limb_t mpn_remainder[8];
 
-	if (sizeof(mp_limb_t) != 4)
+	if ((32 % sizeof(mp_limb_t)) != 0)
 	{
-		printf("Please run tests on platform where sizeof(mp_limb_t) == 4");
+		printf("Please run tests on platform where sizeof(mp_limb_t) divides 32");
 		exit(1);
 	}
 
@@ -770,40 +2047,40 @@ int main(void)
 				if (operation == 0)
 				{
 					returned = bigAddVariableSizeNoModulo(result, op1, op2, 32);
-					result_size = 8;
+					result_size = MPN_LIMBS;
 				}
 				else if (operation == 1)
 				{
 					returned = bigSubtractNoModulo(result, op1, op2);
-					result_size = 8;
+					result_size = MPN_LIMBS;
 				}
 				else
 				{
 					returned = 0;
 					bigMultiplyVariableSizeNoModulo(result, op1, 32, op2, 32);
-					result_size = 16;
+					result_size = 2 * MPN_LIMBS;
 				}
 
 				// Calculate result using GMP.
-				byteToMpn(mpn_op1, op1, 8);
-				byteToMpn(mpn_op2, op2, 8);
+				byteToMpn(mpn_op1, op1, MPN_LIMBS);
+				byteToMpn(mpn_op2, op2, MPN_LIMBS);
 				if (operation == 0)
 				{
-					compare_returned = mpn_add_n(mpn_result, mpn_op1, mpn_op2, 8);
+					compare_returned = mpn_add_n(mpn_result, mpn_op1, mpn_op2, MPN_LIMBS);
 				}
 				else if (operation == 1)
 				{
-					compare_returned = mpn_sub_n(mpn_result, mpn_op1, mpn_op2, 8);
+					compare_returned = mpn_sub_n(mpn_result, mpn_op1, mpn_op2, MPN_LIMBS);
 				}
 				else
 				{
 					compare_returned = 0;
-					mpn_mul_n(mpn_result, mpn_op1, mpn_op2, 8);
+					mpn_mul_n(mpn_result, mpn_op1, mpn_op2, MPN_LIMBS);
 				}
 
 				// Compare results.
 				mpnToByte(result_compare, mpn_result, result_size);
-				if ((memcmp(result, result_compare, (size_t)(result_size * 4)))
+				if ((memcmp(result, result_compare, (size_t)result_size * sizeof(mp_limb_t)))
 					|| (returned != compare_returned))
 				{
 					if (operation == 0)
@@ -823,13 +2100,13 @@ int main(void)
 					printf("\nop2: ");
 					printLittleEndian32(op2);
 					printf("\nExpected: ");
-					if (result_size > 8)
+					if (result_size > MPN_LIMBS)
 					{
 						printLittleEndian32(&(result_compare[32]));
 					}
 					printLittleEndian32(result_compare);
 					printf("\nGot: ");
-					if (result_size > 8)
+					if (result_size > MPN_LIMBS)
 					{
 						printLittleEndian32(&(result[32]));
 					}
@@ -852,9 +2129,9 @@ int main(void)
 	{
 		bigAssign(op1, test_cases[i]);
 		bigShiftRightNoModulo(result, op1);
-		byteToMpn(mpn_op1, op1, 8);
-		mpn_rshift(mpn_result, mpn_op1, 8, 1);
-		mpnToByte(result_compare, mpn_result, 8);
+		byteToMpn(mpn_op1, op1, MPN_LIMBS);
+		mpn_rshift(mpn_result, mpn_op1, MPN_LIMBS, 1);
+		mpnToByte(result_compare, mpn_result, MPN_LIMBS);
 		if (memcmp(result, result_compare, 32))
 		{
 			printf("Test failed (shift right)\n");
@@ -880,16 +2157,16 @@ int main(void)
 		if (divisor_select == 0)
 		{
 			generateTestCases(secp256k1_p);
-			byteToMpn(mpn_divisor, (BigNum256)secp256k1_p, 8);
+			byteToMpn(mpn_divisor, (BigNum256)secp256k1_p, MPN_LIMBS);
 			bigSetField(secp256k1_p, secp256k1_complement_p, sizeof(secp256k1_complement_p));
 		}
 		else
 		{
 			generateTestCases(secp256k1_n);
-			byteToMpn(mpn_divisor, (BigNum256)secp256k1_n, 8);
+			byteToMpn(mpn_divisor, (BigNum256)secp256k1_n, MPN_LIMBS);
 			bigSetField(secp256k1_n, secp256k1_complement_n, sizeof(secp256k1_complement_n));
 		}
-		for (operation = 0; operation < 4; operation++)
+		for (operation = 0; operation < 5; operation++)
 		{
 			for (i = 0; i < TOTAL_CASES; i++)
 			{
@@ -909,30 +2186,38 @@ int main(void)
 						{
 							bigSubtract(result, op1, op2);
 						}
-						else
+						else if (operation == 2)
 						{
 							bigMultiply(result, op1, op2);
 						}
+						else if (divisor_select == 0)
+						{
+							bigMultiplyModP(result, op1, op2);
+						}
+						else
+						{
+							bigMultiplyModN(result, op1, op2);
+						}
 
 						// Calculate result using GMP.
-						byteToMpn(mpn_op1, op1, 8);
-						byteToMpn(mpn_op2, op2, 8);
+						byteToMpn(mpn_op1, op1, MPN_LIMBS);
+						byteToMpn(mpn_op2, op2, MPN_LIMBS);
 						if (operation == 0)
 						{
-							compare_returned = mpn_add_n(mpn_result, mpn_op1, mpn_op2, 8);
+							compare_returned = mpn_add_n(mpn_result, mpn_op1, mpn_op2, MPN_LIMBS);
 							if (compare_returned)
 							{
-								mpn_result[8] = 1;
+								mpn_result[MPN_LIMBS] = 1;
 							}
 							else
 							{
-								mpn_result[8] = 0;
+								mpn_result[MPN_LIMBS] = 0;
 							}
-							result_size = 9;
+							result_size = MPN_LIMBS + 1;
 						}
 						else if (operation == 1)
 						{
-							compare_returned = mpn_sub_n(mpn_result, mpn_op1, mpn_op2, 8);
+							compare_returned = mpn_sub_n(mpn_result, mpn_op1, mpn_op2, MPN_LIMBS);
 							if (compare_returned)
 							{
 								// Because the low-level functions in GMP
@@ -942,21 +2227,21 @@ int main(void)
 								// The workaround is to add the divisor (which
 								// does not change mpn_result modulo the
 								// dovisor) to make mpn_result positive.
-								mpn_add_n(mpn_result, mpn_result, mpn_divisor, 8);
+								mpn_add_n(mpn_result, mpn_result, mpn_divisor, MPN_LIMBS);
 							}
-							result_size = 8;
+							result_size = MPN_LIMBS;
 						}
 						else
 						{
-							mpn_mul_n(mpn_result, mpn_op1, mpn_op2, 8);
-							result_size = 16;
+							mpn_mul_n(mpn_result, mpn_op1, mpn_op2, MPN_LIMBS);
+							result_size = 2 * MPN_LIMBS;
 						}
-						mpn_tdiv_qr(mpn_quotient, mpn_remainder, 0, mpn_result, result_size, mpn_divisor, 8);
+						mpn_tdiv_qr(mpn_quotient, mpn_remainder, 0, mpn_result, result_size, mpn_divisor, MPN_LIMBS);
 
 						// Compare results.
 						// Now that we're doing modular arithmetic, the
 						// results are always 256 bits (8 GMP limbs).
-						mpnToByte(result_compare, mpn_remainder, 8);
+						mpnToByte(result_compare, mpn_remainder, MPN_LIMBS);
 						if (bigCompare(result, result_compare) != BIGCMP_EQUAL)
 						{
 							if (operation == 0)
@@ -967,10 +2252,14 @@ int main(void)
 							{
 								printf("Test failed (modular subtraction)\n");
 							}
-							else
+							else if (operation == 2)
 							{
 								printf("Test failed (modular multiplication)\n");
 							}
+							else
+							{
+								printf("Test failed (modular multiplication, special form of divisor)\n");
+							}
 							printf("divisor: ");
 							if (divisor_select == 0)
 							{
@@ -999,6 +2288,94 @@ int main(void)
 				} // if (operation != 3)
 				else
 				{
+					// Assuming modular multiplication is working, squaring
+					// can be tested by comparing it with op1 * op1.
+					bigMultiply(result_compare, op1, op1);
+					bigSquare(result, op1);
+					if (bigCompare(result, result_compare) != BIGCMP_EQUAL)
+					{
+						printf("Test failed (modular squaring)\n");
+						printf("op1: ");
+						printLittleEndian32(op1);
+						printf("\nExpected: ");
+						printLittleEndian32(result_compare);
+						printf("\nGot: ");
+						printLittleEndian32(result);
+						printf("\n");
+						reportFailure();
+					}
+					else
+					{
+						reportSuccess();
+					}
+					if (divisor_select == 0)
+					{
+						bigSquareModP(result, op1);
+						if (bigCompare(result, result_compare) != BIGCMP_EQUAL)
+						{
+							printf("Test failed (modular squaring, special form of p)\n");
+							printf("op1: ");
+							printLittleEndian32(op1);
+							printf("\nExpected: ");
+							printLittleEndian32(result_compare);
+							printf("\nGot: ");
+							printLittleEndian32(result);
+							printf("\n");
+							reportFailure();
+						}
+						else
+						{
+							reportSuccess();
+						}
+						// Multiplication by small constants can be tested by
+						// comparing it with bigMultiplyModP(). Small
+						// multipliers, ones which are used by point
+						// operations and the largest one are tried.
+						for (j = 0; j < 6; j++)
+						{
+							bigSetZero(op2);
+							op2[0] = small_multipliers[j];
+							bigMultiplyModP(result_compare, op1, op2);
+							bigMultiplySmallModP(result, op1, small_multipliers[j]);
+							if (bigCompare(result, result_compare) != BIGCMP_EQUAL)
+							{
+								printf("Test failed (multiplication by %d, special form of p)\n", small_multipliers[j]);
+								printf("op1: ");
+								printLittleEndian32(op1);
+								printf("\nExpected: ");
+								printLittleEndian32(result_compare);
+								printf("\nGot: ");
+								printLittleEndian32(result);
+								printf("\n");
+								reportFailure();
+							}
+							else
+							{
+								reportSuccess();
+							}
+						}
+					}
+					else
+					{
+						bigSquareModN(result, op1);
+						if (bigCompare(result, result_compare) != BIGCMP_EQUAL)
+						{
+							printf("Test failed (modular squaring, special form of n)\n");
+							printf("op1: ");
+							printLittleEndian32(op1);
+							printf("\nExpected: ");
+							printLittleEndian32(result_compare);
+							printf("\nGot: ");
+							printLittleEndian32(result);
+							printf("\n");
+							reportFailure();
+						}
+						else
+						{
+							reportSuccess();
+						}
+					}
+
 					if (!bigIsZero(op1))
 					{
 						// Calculate result using functions in this file.
@@ -1036,9 +2413,162 @@ int main(void)
 							reportSuccess();
 						}
 					} // if (!bigIsZero(op1))
+
+					if (divisor_select == 0)
+					{
+						// The addition chain versions should give the same
+						// results as the generic versions.
+						bigInvert(result_compare, op1);
+						bigInvertModP(result, op1);
+						if (bigCompare(result, result_compare) != BIGCMP_EQUAL)
+						{
+							printf("Test failed (modular inversion, special form of p)\n");
+							printf("op1: ");
+							printLittleEndian32(op1);
+							printf("\nExpected: ");
+							printLittleEndian32(result_compare);
+							printf("\nGot: ");
+							printLittleEndian32(result);
+							printf("\n");
+							reportFailure();
+						}
+						else
+						{
+							reportSuccess();
+						}
+						// op1 ^ 2 always has a square root, which may be
+						// op1 or -op1. Since p = 3 (modulo 4), -(op1 ^ 2)
+						// never has one (unless op1 is 0).
+						bigSquareModP(op2, op1);
+						returned = (uint8_t)bigSqrtModP(result, op2);
+						bigSquareModP(result_compare, result);
+						if (returned || (bigCompare(result_compare, op2) != BIGCMP_EQUAL))
+						{
+							printf("Test failed (modular square root, special form of p)\n");
+							printf("op1: ");
+							printLittleEndian32(op1);
+							printf("\nGot: ");
+							printLittleEndian32(result);
+							printf("\n");
+							reportFailure();
+						}
+						else
+						{
+							reportSuccess();
+						}
+						bigSetZero(result_compare);
+						bigSubtract(op2, result_compare, op2);
+						returned = (uint8_t)bigSqrtModP(result, op2);
+						if (returned == bigIsZero(op1))
+						{
+							printf("Test failed (modular square root of non-residue, special form of p)\n");
+							printf("op1: ");
+							printLittleEndian32(op1);
+							printf("\n");
+							reportFailure();
+						}
+						else
+						{
+							reportSuccess();
+						}
+					}
+					else
+					{
+						bigInvert(result_compare, op1);
+						bigInvertModN(result, op1);
+						if (bigCompare(result, result_compare) != BIGCMP_EQUAL)
+						{
+							printf("Test failed (modular inversion, special form of n)\n");
+							printf("op1: ");
+							printLittleEndian32(op1);
+							printf("\nExpected: ");
+							printLittleEndian32(result_compare);
+							printf("\nGot: ");
+							printLittleEndian32(result);
+							printf("\n");
+							reportFailure();
+						}
+						else
+						{
+							reportSuccess();
+						}
+					}
 				} // if (operation != 3) (else clause)
 			} // for (i = 0; i < TOTAL_CASES; i++)
-		} // for (operation = 0; operation < 4; operation++)
+		} // for (operation = 0; operation < 5; operation++)
+	}
+
+	// The batched multiplications should give the same results as doing
+	// each multiplication separately, for every batch size (including ones
+	// which aren't a multiple of the number of vector lanes).
+	for (i = 0; i + 2 * BATCH_TEST_SIZE <= TOTAL_CASES; i += BATCH_TEST_SIZE)
+	{
+		for (divisor_select = 0; divisor_select < 2; divisor_select++)
+		{
+			for (j = 1; j <= BATCH_TEST_SIZE; j++)
+			{
+				memcpy(batch_op1, test_cases[i], (size_t)j * 32);
+				memcpy(batch_op2, test_cases[i + BATCH_TEST_SIZE], (size_t)j * 32);
+				if (divisor_select == 0)
+				{
+					bigMultiplyModPBatch(batch_result, batch_op1, batch_op2, (uint8_t)j);
+				}
+				else
+				{
+					bigMultiplyModNBatch(batch_result, batch_op1, batch_op2, (uint8_t)j);
+				}
+				for (operation = 0; operation < j; operation++)
+				{
+					if (divisor_select == 0)
+					{
+						bigMultiplyModP(result, test_cases[i + operation], test_cases[i + BATCH_TEST_SIZE + operation]);
+					}
+					else
+					{
+						bigMultiplyModN(result, test_cases[i + operation], test_cases[i + BATCH_TEST_SIZE + operation]);
+					}
+					if (bigCompare(result, &(batch_result[operation * 32])) != BIGCMP_EQUAL)
+					{
+						printf("Batched multiplication mismatch, test case %d, batch size %d, element %d\n", i, j, operation);
+						reportFailure();
+					}
+					else
+					{
+						reportSuccess();
+					}
+				}
+			}
+		}
+	}
+
+	// The "InField" functions should ignore the current field. The test
+	// cases are all < n at this point.
+	n_field.n = secp256k1_n;
+	n_field.complement_n = (uint8_t *)secp256k1_complement_n;
+	n_field.size_complement_n = sizeof(secp256k1_complement_n);
+	for (i = 0; i < TOTAL_CASES; i++)
+	{
+		bigAssign(op1, test_cases[i]);
+		bigAssign(op2, test_cases[TOTAL_CASES - 1 - i]);
+		bigSetField(secp256k1_n, secp256k1_complement_n, sizeof(secp256k1_complement_n));
+		bigMultiply(result_compare, op1, op2);
+		bigAdd(result_compare, result_compare, op2);
+		bigSubtract(result_compare, result_compare, op1);
+		bigInvert(result_compare, result_compare);
+		bigSetField(secp256k1_p, secp256k1_complement_p, sizeof(secp256k1_complement_p));
+		bigMultiplyInField(result, op1, op2, &n_field);
+		bigAddInField(result, result, op2, &n_field);
+		bigSubtractInField(result, result, op1, &n_field);
+		bigInvertInField(result, result, &n_field);
+		if (bigCompare(result, result_compare) != BIGCMP_EQUAL)
+		{
+			printf("\"InField\" functions used the current field, test case %d\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
 	}
 
 	finishTests();
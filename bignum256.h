@@ -2,8 +2,10 @@
   *
   * \brief Describes functions and constants exported by bignum256.c.
   * 
-  * To use most of the functions described here, you must call bigSetField()
-  * first to set field parameters. See bignum256.c for more details.
+  * To use most of the functions described here, you must either call
+  * bigSetField() first to set field parameters, or use the "InField"
+  * versions, which are passed a #BigNumField. See bignum256.c for more
+  * details.
   *
   * This file is licensed as described by the file LICENCE.
   */
@@ -20,6 +22,32 @@
   * pointer points to an array which may not be exactly 32 bytes in size. */
 typedef uint8_t * BigNum256;
 
+/** Storage for a #BigNum256: a 32 byte array which is aligned on a word
+  * boundary (see #WORD_ALIGNED). Like any other array, it converts to a
+  * #BigNum256, so use this instead of uint8_t [32] when declaring variables
+  * and structure members which hold multi-precision numbers. */
+typedef uint8_t BigNum256Storage[32] WORD_ALIGNED;
+
+/** Parameters of a prime finite field. Functions with names ending in
+  * "InField" (eg. bigAddInField()) take one of these, instead of using
+  * the field set by bigSetField(). The arrays pointed to are never written
+  * to. */
+typedef struct BigNumFieldStruct
+{
+	/** The prime modulus to operate under.
+	  * \warning This must be greater than 2 ^ 255.
+	  * \warning The least significant byte of this must be >= 2, otherwise
+	  *          bigInvertInField() will not work correctly.
+	  * \warning If BIGNUM_GCD_INVERT is defined, this must also be odd.
+	  */
+	uint8_t *n;
+	/** The 2s complement of #n, with most significant zero bytes
+	  * removed. */
+	uint8_t *complement_n;
+	/** The size of #complement_n, in number of bytes. */
+	uint8_t size_complement_n;
+} BigNumField;
+
 /**
  * \defgroup BigCompareReturn Return values for bigCompare()
  *
@@ -50,14 +78,38 @@ extern void bigAssign(BigNum256 r, BigNum256 op1);
 extern void swapEndian256(BigNum256 buffer);
 extern void bigSetField(const uint8_t *in_n, const uint8_t *in_complement_n, const uint8_t in_size_complement_n);
 extern void bigModulo(BigNum256 r, BigNum256 op1);
+extern void bigModuloInField(BigNum256 r, BigNum256 op1, const BigNumField *field);
 extern uint8_t bigAddVariableSizeNoModulo(uint8_t *r, uint8_t *op1, uint8_t *op2, uint8_t op_size);
 extern uint8_t bigSubtractVariableSizeNoModulo(uint8_t *r, uint8_t *op1, uint8_t *op2, uint8_t size);
 extern uint8_t bigSubtractNoModulo(BigNum256 r, BigNum256 op1, BigNum256 op2);
 extern void bigAdd(BigNum256 r, BigNum256 op1, BigNum256 op2);
+extern void bigAddInField(BigNum256 r, BigNum256 op1, BigNum256 op2, const BigNumField *field);
 extern void bigSubtract(BigNum256 r, BigNum256 op1, BigNum256 op2);
+extern void bigSubtractInField(BigNum256 r, BigNum256 op1, BigNum256 op2, const BigNumField *field);
 extern void bigShiftRightNoModulo(BigNum256 r, const BigNum256 op1);
+#ifdef PLATFORM_SPECIFIC_BIGMULTIPLY
+extern RAM_FUNCTION void bigMultiplyVariableSizeNoModulo(uint8_t *r, uint8_t *op1, uint8_t op1_size, uint8_t *op2, uint8_t op2_size);
+#else
 extern void bigMultiplyVariableSizeNoModulo(uint8_t *r, uint8_t *op1, uint8_t op1_size, uint8_t *op2, uint8_t op2_size);
+#endif // #ifdef PLATFORM_SPECIFIC_BIGMULTIPLY
+#ifdef PLATFORM_SPECIFIC_BIGSQUARE
+extern void bigSquareNoModulo(uint8_t *r, BigNum256 op1);
+#endif // #ifdef PLATFORM_SPECIFIC_BIGSQUARE
 extern void bigMultiply(BigNum256 r, BigNum256 op1, BigNum256 op2);
+extern void bigMultiplyInField(BigNum256 r, BigNum256 op1, BigNum256 op2, const BigNumField *field);
+extern void bigSquare(BigNum256 r, BigNum256 op1);
+extern void bigSquareInField(BigNum256 r, BigNum256 op1, const BigNumField *field);
+extern void bigMultiplyModP(BigNum256 r, BigNum256 op1, BigNum256 op2);
+extern void bigSquareModP(BigNum256 r, BigNum256 op1);
+extern void bigMultiplySmallModP(BigNum256 r, BigNum256 op1, uint8_t multiplier);
+extern void bigMultiplyModN(BigNum256 r, BigNum256 op1, BigNum256 op2);
+extern void bigSquareModN(BigNum256 r, BigNum256 op1);
+extern void bigMultiplyModPBatch(uint8_t *r, uint8_t *op1, uint8_t *op2, uint8_t count);
+extern void bigMultiplyModNBatch(uint8_t *r, uint8_t *op1, uint8_t *op2, uint8_t count);
 extern void bigInvert(BigNum256 r, BigNum256 op1);
+extern void bigInvertInField(BigNum256 r, BigNum256 op1, const BigNumField *field);
+extern void bigInvertModP(BigNum256 r, BigNum256 op1);
+extern bool bigSqrtModP(BigNum256 r, BigNum256 op1);
+extern void bigInvertModN(BigNum256 r, BigNum256 op1);
 
 #endif // #ifndef BIGNUM256_H_INCLUDED
@@ -6,6 +6,11 @@
   * https://github.com/bitcoin/bips/blob/master/bip-0032.mediawiki, obtained
   * on 19 Nov 2014.
   *
+  * This also implements the seed derivation part of BIP39, since its only
+  * purpose is to produce a seed for bip32SeedToNode(). All references to the
+  * "BIP39 specification" refer to
+  * https://github.com/bitcoin/bips/blob/master/bip-0039.mediawiki.
+  *
   * This file is licensed as described by the file LICENCE.
   */
 
@@ -16,6 +21,7 @@
 #include "test_helpers.h"
 #endif // #ifdef TEST_BIP32
 
+#include <stdlib.h> // for definition of NULL
 #include "common.h"
 #include "bignum256.h"
 #include "bip32.h"
@@ -23,6 +29,108 @@
 #include "endian.h"
 #include "ecdsa.h"
 #include "hwinterface.h"
+#include "pbkdf2.h"
+
+#ifndef BIP32_NO_CACHE
+/** Maximum number of derivation steps in a path prefix stored in the
+  * derivation cache. This is enough for the account-level chains
+  * (eg. m/44'/0'/0'/0) of BIP44-style paths. */
+#define CACHE_MAX_DEPTH			4
+/** Number of entries in the derivation cache. Two entries is enough to
+  * cover the external and internal (change) chains of one account. */
+#define CACHE_ENTRIES			2
+
+/** One entry in the derivation cache: an intermediate node together with the
+  * path prefix (from the master node) that leads to it. */
+typedef struct BIP32CacheEntryStruct
+{
+	/** The intermediate node, in the same format as current_node in
+	  * bip32DerivePrivate(). */
+	uint8_t node[NODE_LENGTH] WORD_ALIGNED;
+	/** Path prefix which was used to derive BIP32CacheEntry#node. */
+	uint32_t path[CACHE_MAX_DEPTH];
+	/** Number of steps in BIP32CacheEntry#path. This is 0 if the entry is
+	  * unused. */
+	unsigned int path_length;
+	/** Public key corresponding to the private key in BIP32CacheEntry#node.
+	  * This is only valid if BIP32CacheEntry#public_key_valid is true. */
+	PointAffine public_key;
+	/** Whether BIP32CacheEntry#public_key has been computed yet. */
+	bool public_key_valid;
+} BIP32CacheEntry;
+
+/** Master node which the entries in #derivation_cache were derived from. */
+static uint8_t cache_master_node[NODE_LENGTH] WORD_ALIGNED;
+/** Cache of intermediate nodes, so that deriving a series of keys which
+  * share a path prefix (eg. m/44'/0'/0'/0/i for i = 0, 1, 2...) only needs
+  * one derivation step per key. */
+static BIP32CacheEntry derivation_cache[CACHE_ENTRIES];
+/** Index into #derivation_cache of the entry which will be replaced next. */
+static unsigned int next_cache_entry;
+
+/** Clear the derivation cache. This should be called whenever the master
+  * node is no longer needed (eg. when a wallet is unloaded), because the
+  * cache contains private keys.
+  */
+void bip32ClearCache(void)
+{
+	memset(cache_master_node, 0, sizeof(cache_master_node));
+	memset(derivation_cache, 0, sizeof(derivation_cache));
+	next_cache_entry = 0;
+}
+
+/** Find the cache entry with the longest path prefix that is a prefix
+  * of path.
+  * \param master_node The master node that path starts from.
+  * \param path See bip32DerivePrivate().
+  * \param path_length See bip32DerivePrivate().
+  * \return The matching cache entry, or NULL if there is none.
+  */
+static BIP32CacheEntry *findCachedPrefix(const uint8_t *master_node, const uint32_t *path, const unsigned int path_length)
+{
+	BIP32CacheEntry *best;
+	unsigned int i;
+	unsigned int j;
+	uint8_t difference;
+
+	// The master node is compared without an early exit, so that the time it
+	// takes doesn't reveal how much of the master node matches.
+	difference = 0;
+	for (i = 0; i < NODE_LENGTH; i++)
+	{
+		difference |= (uint8_t)(cache_master_node[i] ^ master_node[i]);
+	}
+	if (difference != 0)
+	{
+		// Different master node; none of the cache entries apply.
+		bip32ClearCache();
+		memcpy(cache_master_node, master_node, sizeof(cache_master_node));
+		return NULL;
+	}
+	best = NULL;
+	for (i = 0; i < CACHE_ENTRIES; i++)
+	{
+		if ((derivation_cache[i].path_length == 0)
+			|| (derivation_cache[i].path_length > path_length)
+			|| ((best != NULL) && (derivation_cache[i].path_length <= best->path_length)))
+		{
+			continue;
+		}
+		for (j = 0; j < derivation_cache[i].path_length; j++)
+		{
+			if (derivation_cache[i].path[j] != path[j])
+			{
+				break;
+			}
+		}
+		if (j == derivation_cache[i].path_length)
+		{
+			best = &(derivation_cache[i]);
+		}
+	}
+	return best;
+}
+#endif // #ifndef BIP32_NO_CACHE
 
 /** Convert a master seed into a master node (an extended private key), as
   * described by the BIP32 specification.
@@ -36,31 +144,112 @@ void bip32SeedToNode(uint8_t *master_node, const uint8_t *seed, const unsigned i
 	hmacSha512(master_node, (const uint8_t *)"Bitcoin seed", 12, seed, seed_length);
 }
 
-/** Deterministically derive private key from a BIP32 node (a.k.a. extended
-  * private key), as described by the BIP32 specification.
-  * \param out The derived private key will be written here upon success. The
-  *            private key will be written as a little-endian 256 bit
-  *            multi-precision integer, suitable for input into a function
-  *            such as ecdsaSign().
-  * \param master_node The master node (a.k.a. extended private key) to derive
-  *                    the private key from.
-  * \param path Path through the derivation tree. See BIP32 specification for
-  *             more details.
-  * \param path_length Number of steps through derivation tree. This may be 0.
+/** Derive a seed from a BIP39 mnemonic sentence, as described in the
+  * "From mnemonic to seed" section of the BIP39 specification. The seed is
+  * PBKDF2-HMAC-SHA512 of the mnemonic, with "mnemonic" followed by the
+  * passphrase as the salt and #BIP39_ITERATIONS iterations.
+  *
+  * The mnemonic isn't checked against a word list (its checksum is the
+  * host's business). The BIP39 specification allows any mnemonic to be used,
+  * and the word list would take up a lot of space.
+  * \param seed The seed will be written here. This must be a byte array
+  *             with space for #BIP39_SEED_LENGTH bytes. The seed is suitable
+  *             for passing to bip32SeedToNode().
+  * \param mnemonic The mnemonic sentence, in UTF-8 NFKD form, with words
+  *                 separated by single spaces. This doesn't need to be
+  *                 null-terminated.
+  * \param mnemonic_length Length of the mnemonic sentence, in bytes.
+  * \param passphrase The passphrase, in UTF-8 NFKD form. This doesn't need
+  *                   to be null-terminated.
+  * \param passphrase_length Length of the passphrase, in bytes. This may be
+  *                          0, but must not be more than
+  *                          #BIP39_MAX_PASSPHRASE_LENGTH.
+  * \return false on success, true if the passphrase is too long.
+  */
+bool bip39MnemonicToSeed(uint8_t *seed, const uint8_t *mnemonic, const unsigned int mnemonic_length, const uint8_t *passphrase, const unsigned int passphrase_length)
+{
+	uint8_t salt[8 + BIP39_MAX_PASSPHRASE_LENGTH];
+
+	if (passphrase_length > BIP39_MAX_PASSPHRASE_LENGTH)
+	{
+		return true;
+	}
+	memcpy(salt, "mnemonic", 8);
+	memcpy(&(salt[8]), passphrase, passphrase_length);
+	pbkdf2(seed, mnemonic, mnemonic_length, salt, 8 + passphrase_length, BIP39_ITERATIONS);
+	memset(salt, 0, sizeof(salt));
+	return false;
+}
+
+/** Compute the compressed serialisation of a public key, for use as the
+  * first 33 bytes of the HMAC data in a non-hardened derivation step.
+  * \param hmac_data The serialised public key will be written here. This
+  *                  must have space for at least 33 bytes.
+  * \param public_key The public key to serialise.
   * \return false on success, true on error.
   */
-bool bip32DerivePrivate(BigNum256 out, const uint8_t *master_node, const uint32_t *path, const unsigned int path_length)
+static bool serialisePublicKeyForHmac(uint8_t *hmac_data, PointAffine *public_key)
 {
-	uint8_t current_node[NODE_LENGTH];
-	uint8_t temp[NODE_LENGTH];
-	uint8_t hmac_data[37]; // 1 for prefix + 32 for public/private key + 4 for "i"
 	uint8_t serialised[ECDSA_MAX_SERIALISE_SIZE];
 	uint8_t serialised_size;
+
+	serialised_size = ecdsaSerialise(serialised, public_key, true);
+	if (serialised_size != 33)
+	{
+		// Compressed public keys should always be 33 bytes; this should never
+		// happen.
+		fatalError();
+		return true;
+	}
+	memcpy(hmac_data, serialised, 33);
+	return false;
+}
+
+/** Derive a BIP32 node from a master node, starting from the longest
+  * matching prefix in the derivation cache (unless BIP32_NO_CACHE is
+  * defined).
+  * \param current_node The derived node will be written here upon success.
+  *                     This must be a byte array with space for #NODE_LENGTH
+  *                     bytes. The first 32 bytes are the (big-endian) private
+  *                     key and the last 32 bytes are the chain code.
+  * \param master_node See bip32DerivePrivate().
+  * \param path See bip32DerivePrivate().
+  * \param path_length See bip32DerivePrivate().
+  * \param cache_depth The node at this depth (number of steps from the
+  *                    master node) will be stored in the derivation cache,
+  *                    if it is derived. Use 0 to not store anything. This
+  *                    is ignored if BIP32_NO_CACHE is defined.
+  * \return false on success, true on error.
+  */
+static bool deriveNode(uint8_t *current_node, const uint8_t *master_node, const uint32_t *path, const unsigned int path_length, const unsigned int cache_depth)
+{
+	uint8_t temp[NODE_LENGTH] WORD_ALIGNED;
+	uint8_t hmac_data[37]; // 1 for prefix + 32 for public/private key + 4 for "i"
 	unsigned int i;
+	unsigned int start;
 	PointAffine p;
+#ifndef BIP32_NO_CACHE
+	BIP32CacheEntry *cached;
+#endif // #ifndef BIP32_NO_CACHE
 
-	memcpy(current_node, master_node, sizeof(current_node));
-	for (i = 0; i < path_length; i++)
+#ifdef BIP32_NO_CACHE
+	(void)cache_depth;
+	memcpy(current_node, master_node, NODE_LENGTH);
+	start = 0;
+#else
+	cached = findCachedPrefix(master_node, path, path_length);
+	if (cached != NULL)
+	{
+		memcpy(current_node, cached->node, NODE_LENGTH);
+		start = cached->path_length;
+	}
+	else
+	{
+		memcpy(current_node, master_node, NODE_LENGTH);
+		start = 0;
+	}
+#endif // #ifdef BIP32_NO_CACHE
+	for (i = start; i < path_length; i++)
 	{
 		if ((path[i] & 0x80000000) != 0)
 		{
@@ -70,21 +259,34 @@ bool bip32DerivePrivate(BigNum256 out, const uint8_t *master_node, const uint32_
 		}
 		else
 		{
-			// Non-hardened derivation.
-			setToG(&p);
+			// Non-hardened derivation. If starting from a cached node, its
+			// public key may also be cached, which saves a point multiply
+			// for every sibling key.
+#ifdef BIP32_NO_CACHE
 			memcpy(temp, current_node, 32);
 			swapEndian256(temp); // big-endian -> little-endian
-			pointMultiply(&p, temp);
-			// TODO: cache point multiply results so that repeated key derivation is faster
-			serialised_size = ecdsaSerialise(serialised, &p, true);
-			if (serialised_size != 33)
+			ecdsaMultiplyG(&p, temp);
+#else
+			if ((i == start) && (cached != NULL) && cached->public_key_valid)
+			{
+				memcpy(&p, &(cached->public_key), sizeof(PointAffine));
+			}
+			else
+			{
+				memcpy(temp, current_node, 32);
+				swapEndian256(temp); // big-endian -> little-endian
+				ecdsaMultiplyG(&p, temp);
+				if ((i == start) && (cached != NULL))
+				{
+					memcpy(&(cached->public_key), &p, sizeof(PointAffine));
+					cached->public_key_valid = true;
+				}
+			}
+#endif // #ifdef BIP32_NO_CACHE
+			if (serialisePublicKeyForHmac(hmac_data, &p))
 			{
-				// Compressed public keys should always be 33 bytes; this should never
-				// happen.
-				fatalError();
 				return true;
 			}
-			memcpy(hmac_data, serialised, 33);
 		}
 		writeU32BigEndian(&(hmac_data[33]), path[i]);
 		// Need to write to temp here (instead of current_node) because part of
@@ -99,20 +301,188 @@ bool bip32DerivePrivate(BigNum256 out, const uint8_t *master_node, const uint32_
 		{
 			return true; // I_L >= n
 		}
-		setFieldToN();
-		bigAdd(temp, temp, current_node); // add k_par to I_L (mod n)
+		bigAddInField(temp, temp, current_node, &secp256k1_n_field); // add k_par to I_L (mod n)
 		if (bigIsZero(temp))
 		{
 			return true; // k_i == 0
 		}
 		swapEndian256(temp); // little-endian -> big-endian (for next step)
-		memcpy(current_node, temp, sizeof(current_node));
+		memcpy(current_node, temp, NODE_LENGTH);
+#ifndef BIP32_NO_CACHE
+		if (((i + 1) == cache_depth) && (cache_depth <= CACHE_MAX_DEPTH))
+		{
+			cached = &(derivation_cache[next_cache_entry]);
+			memcpy(cached->node, current_node, sizeof(cached->node));
+			memcpy(cached->path, path, cache_depth * sizeof(uint32_t));
+			cached->path_length = cache_depth;
+			cached->public_key_valid = false;
+			next_cache_entry = (next_cache_entry + 1) % CACHE_ENTRIES;
+		}
+#endif // #ifndef BIP32_NO_CACHE
+	}
+	return false; // success
+}
+
+/** Deterministically derive private key from a BIP32 node (a.k.a. extended
+  * private key), as described by the BIP32 specification.
+  * \param out The derived private key will be written here upon success. The
+  *            private key will be written as a little-endian 256 bit
+  *            multi-precision integer, suitable for input into a function
+  *            such as ecdsaSign().
+  * \param master_node The master node (a.k.a. extended private key) to derive
+  *                    the private key from.
+  * \param path Path through the derivation tree. See BIP32 specification for
+  *             more details.
+  * \param path_length Number of steps through derivation tree. This may be 0.
+  * \return false on success, true on error.
+  * \warning Unless BIP32_NO_CACHE is defined, intermediate nodes are cached
+  *          in RAM (see #derivation_cache), so bip32ClearCache() must be
+  *          called when the master node is no longer needed.
+  */
+bool bip32DerivePrivate(BigNum256 out, const uint8_t *master_node, const uint32_t *path, const unsigned int path_length)
+{
+	uint8_t current_node[NODE_LENGTH] WORD_ALIGNED;
+
+	// Cache the parent of the final node, since that's the node which
+	// the next request (for a sibling key) is most likely to start from.
+	if (deriveNode(current_node, master_node, path, path_length, (path_length > 0) ? (path_length - 1) : 0))
+	{
+		return true;
 	}
 	memcpy(out, current_node, 32);
 	swapEndian256(out); // big-endian -> little-endian for result
 	return false; // success
 }
 
+/** Derive a non-hardened child public key from a parent public key and
+  * chain code, without knowing any private keys. This is the CKDpub function
+  * described in the BIP32 specification. The child public key is
+  * I_L x G + K_par, which costs one multiplication by G and one point
+  * addition.
+  * \param out The derived public key will be written here upon success.
+  * \param out_chain_code If this is not NULL, the derived chain code (32
+  *                       bytes) will be written here upon success.
+  * \param parent_public_key The parent public key, K_par.
+  * \param parent_chain_code The parent chain code, c_par (32 bytes).
+  * \param index The child index, which must not have its most significant bit
+  *              set (i.e. it must be a non-hardened index).
+  * \return false on success, true on error (including when index is a
+  *         hardened index).
+  */
+bool bip32DerivePublicChild(PointAffine *out, uint8_t *out_chain_code, PointAffine *parent_public_key, const uint8_t *parent_chain_code, const uint32_t index)
+{
+	uint8_t temp[NODE_LENGTH] WORD_ALIGNED;
+	uint8_t hmac_data[37]; // 1 for prefix + 32 for public key + 4 for "i"
+
+	if ((index & 0x80000000) != 0)
+	{
+		return true; // can't do hardened derivation from a public key
+	}
+	if (serialisePublicKeyForHmac(hmac_data, parent_public_key))
+	{
+		return true;
+	}
+	writeU32BigEndian(&(hmac_data[33]), index);
+	hmacSha512(temp, parent_chain_code, 32, hmac_data, sizeof(hmac_data));
+	// First 32 bytes of temp = I_L, last 32 bytes = I_R = derived chain code
+	swapEndian256(temp); // big-endian -> little-endian
+	if (bigCompare(temp, (BigNum256)secp256k1_n) != BIGCMP_LESS)
+	{
+		return true; // I_L >= n
+	}
+	ecdsaMultiplyGAdd(out, temp, parent_public_key);
+	if (out->is_point_at_infinity)
+	{
+		return true; // K_i is the point at infinity
+	}
+	if (out_chain_code != NULL)
+	{
+		memcpy(out_chain_code, &(temp[32]), 32);
+	}
+	return false; // success
+}
+
+/** Deterministically derive a public key from a BIP32 node, giving the
+  * same result as multiplying the output of bip32DerivePrivate() by G.
+  * When the final step of the path is non-hardened, the public key of its
+  * parent node is cached, so that deriving a sequence of sibling public
+  * keys only costs one bip32DerivePublicChild() per key.
+  * \param out The derived public key will be written here upon success.
+  * \param master_node See bip32DerivePrivate().
+  * \param path See bip32DerivePrivate().
+  * \param path_length See bip32DerivePrivate().
+  * \return false on success, true on error.
+  * \warning Like bip32DerivePrivate(), this uses the derivation cache
+  *          (unless BIP32_NO_CACHE is defined), so bip32ClearCache() must be
+  *          called when the master node is no longer needed.
+  */
+bool bip32DerivePublic(PointAffine *out, const uint8_t *master_node, const uint32_t *path, const unsigned int path_length)
+{
+	uint8_t current_node[NODE_LENGTH] WORD_ALIGNED;
+#ifdef BIP32_NO_CACHE
+
+	// Without the cache, there's no parent public key to reuse, so nothing
+	// is cheaper than a full private derivation.
+	if (bip32DerivePrivate((BigNum256)current_node, master_node, path, path_length))
+	{
+		return true;
+	}
+	ecdsaMultiplyG(out, (BigNum256)current_node);
+	memset(current_node, 0, sizeof(current_node));
+	return false;
+#else
+	unsigned int parent_length;
+	bool failed;
+	BIP32CacheEntry *cached;
+
+	if ((path_length == 0) || ((path[path_length - 1] & 0x80000000) != 0))
+	{
+		// The final step needs the parent private key, so a full private
+		// derivation can't be avoided.
+		if (bip32DerivePrivate((BigNum256)current_node, master_node, path, path_length))
+		{
+			return true;
+		}
+		ecdsaMultiplyG(out, (BigNum256)current_node);
+		memset(current_node, 0, sizeof(current_node));
+		return false;
+	}
+	parent_length = path_length - 1;
+	cached = findCachedPrefix(master_node, path, parent_length);
+	if ((cached == NULL) || (cached->path_length != parent_length))
+	{
+		// Parent node isn't cached. deriveNode() will store it in the cache,
+		// if it is shallow enough.
+		if (deriveNode(current_node, master_node, path, parent_length, parent_length))
+		{
+			return true;
+		}
+		cached = findCachedPrefix(master_node, path, parent_length);
+		if ((cached == NULL) || (cached->path_length != parent_length))
+		{
+			// Parent node is the master node or is too deep to be cached.
+			swapEndian256(current_node); // big-endian -> little-endian
+			ecdsaMultiplyG(out, current_node);
+			// out is both the parent public key and the result here, which is
+			// okay because ecdsaMultiplyGAdd() allows p and q to be the same.
+			failed = bip32DerivePublicChild(out, NULL, out, &(current_node[32]), path[parent_length]);
+			memset(current_node, 0, sizeof(current_node));
+			return failed;
+		}
+		memset(current_node, 0, sizeof(current_node));
+	}
+	if (!cached->public_key_valid)
+	{
+		memcpy(current_node, cached->node, 32);
+		swapEndian256(current_node); // big-endian -> little-endian
+		ecdsaMultiplyG(&(cached->public_key), current_node);
+		cached->public_key_valid = true;
+		memset(current_node, 0, sizeof(current_node));
+	}
+	return bip32DerivePublicChild(out, NULL, &(cached->public_key), &(cached->node[32]), path[parent_length]);
+#endif // #ifdef BIP32_NO_CACHE
+}
+
 #ifdef TEST_BIP32
 
 /** Length of write canary (for testing writing beyond the end of an array),
@@ -363,52 +733,246 @@ static void base58Decode(uint8_t *out, const char *in, const unsigned int len)
 	}
 }
 
+/** Stores one test vector for bip39MnemonicToSeed(). */
+struct BIP39TestVector
+{
+	/** Mnemonic sentence, with words separated by single spaces. */
+	const char *mnemonic;
+	/** Passphrase (may be empty). */
+	const char *passphrase;
+	/** Expected seed. */
+	const uint8_t seed[BIP39_SEED_LENGTH];
+};
+
+/** Test vectors for bip39MnemonicToSeed(). These are from the reference
+  * implementation (https://github.com/trezor/python-mnemonic, file
+  * vectors.json), except for the last, which checks that an empty passphrase
+  * works.
+  * \showinitializer
+  */
+const struct BIP39TestVector bip39_test_vectors[] =
+{
+{"abandon abandon abandon abandon abandon abandon abandon abandon "
+"abandon abandon abandon about",
+"TREZOR",
+{0xc5, 0x52, 0x57, 0xc3, 0x60, 0xc0, 0x7c, 0x72,
+0x02, 0x9a, 0xeb, 0xc1, 0xb5, 0x3c, 0x05, 0xed,
+0x03, 0x62, 0xad, 0xa3, 0x8e, 0xad, 0x3e, 0x3e,
+0x9e, 0xfa, 0x37, 0x08, 0xe5, 0x34, 0x95, 0x53,
+0x1f, 0x09, 0xa6, 0x98, 0x75, 0x99, 0xd1, 0x82,
+0x64, 0xc1, 0xe1, 0xc9, 0x2f, 0x2c, 0xf1, 0x41,
+0x63, 0x0c, 0x7a, 0x3c, 0x4a, 0xb7, 0xc8, 0x1b,
+0x2f, 0x00, 0x16, 0x98, 0xe7, 0x46, 0x3b, 0x04}},
+
+{"legal winner thank year wave sausage worth useful legal winner thank "
+"yellow",
+"TREZOR",
+{0x2e, 0x89, 0x05, 0x81, 0x9b, 0x87, 0x23, 0xfe,
+0x2c, 0x1d, 0x16, 0x18, 0x60, 0xe5, 0xee, 0x18,
+0x30, 0x31, 0x8d, 0xbf, 0x49, 0xa8, 0x3b, 0xd4,
+0x51, 0xcf, 0xb8, 0x44, 0x0c, 0x28, 0xbd, 0x6f,
+0xa4, 0x57, 0xfe, 0x12, 0x96, 0x10, 0x65, 0x59,
+0xa3, 0xc8, 0x09, 0x37, 0xa1, 0xc1, 0x06, 0x9b,
+0xe3, 0xa3, 0xa5, 0xbd, 0x38, 0x1e, 0xe6, 0x26,
+0x0e, 0x8d, 0x97, 0x39, 0xfc, 0xe1, 0xf6, 0x07}},
+
+{"void come effort suffer camp survey warrior heavy shoot primary "
+"clutch crush open amazing screen patrol group space point ten exist slush involve unfold",
+"TREZOR",
+{0x01, 0xf5, 0xbc, 0xed, 0x59, 0xde, 0xc4, 0x8e,
+0x36, 0x2f, 0x2c, 0x45, 0xb5, 0xde, 0x68, 0xb9,
+0xfd, 0x6c, 0x92, 0xc6, 0x63, 0x4f, 0x44, 0xd6,
+0xd4, 0x0a, 0xab, 0x69, 0x05, 0x65, 0x06, 0xf0,
+0xe3, 0x55, 0x24, 0xa5, 0x18, 0x03, 0x4d, 0xdc,
+0x11, 0x92, 0xe1, 0xda, 0xcd, 0x32, 0xc1, 0xed,
+0x3e, 0xaa, 0x3c, 0x3b, 0x13, 0x1c, 0x88, 0xed,
+0x8e, 0x7e, 0x54, 0xc4, 0x9a, 0x5d, 0x09, 0x98}},
+
+{"abandon abandon abandon abandon abandon abandon abandon abandon "
+"abandon abandon abandon about",
+"",
+{0x5e, 0xb0, 0x0b, 0xbd, 0xdc, 0xf0, 0x69, 0x08,
+0x48, 0x89, 0xa8, 0xab, 0x91, 0x55, 0x56, 0x81,
+0x65, 0xf5, 0xc4, 0x53, 0xcc, 0xb8, 0x5e, 0x70,
+0x81, 0x1a, 0xae, 0xd6, 0xf6, 0xda, 0x5f, 0xc1,
+0x9a, 0x5a, 0xc4, 0x0b, 0x38, 0x9c, 0xd3, 0x70,
+0xd0, 0x86, 0x20, 0x6d, 0xec, 0x8a, 0xa6, 0xc4,
+0x3d, 0xae, 0xa6, 0x69, 0x0f, 0x20, 0xad, 0x3d,
+0x8d, 0x48, 0xb2, 0xd2, 0xce, 0x9e, 0x38, 0xe4}}
+};
+
 int main(void)
 {
 	uint8_t expected_bytes[SERIALISED_BIP32_KEY_LENGTH];
-	uint8_t master_node[NODE_LENGTH];
+	uint8_t master_node[NODE_LENGTH] WORD_ALIGNED;
 	uint8_t canary[CANARY_LENGTH];
 	uint8_t out[32 + CANARY_LENGTH];
+	uint32_t path[16];
 	unsigned int i;
+	unsigned int j;
+	unsigned int pass;
+	PointAffine expected_public_key;
+	PointAffine public_key;
+	uint8_t bip39_seed[BIP39_MAX_PASSPHRASE_LENGTH + BIP39_SEED_LENGTH];
 
 	initTests(__FILE__);
 
-	for (i = 0; i < (sizeof(test_vectors) / sizeof(struct BIP32TestVector)); i++)
+	// The first pass clears the derivation cache before every derivation. The
+	// second pass doesn't, so that derivations can start from cached nodes.
+	// Since consecutive test vectors share path prefixes, this checks that
+	// cached nodes give the same results.
+	for (pass = 0; pass < 2; pass++)
 	{
-		bip32SeedToNode(master_node, test_vectors[i].master, test_vectors[i].master_length);
-		fillWithRandom(canary, sizeof(canary));
-		memcpy(&(out[32]), canary, sizeof(canary));
-		if (bip32DerivePrivate(out, master_node, test_vectors[i].path, test_vectors[i].path_length))
-		{
-			printf("Test vector %u failed to derive\n", i);
-			reportFailure();
-		}
-		else
+		for (i = 0; i < (sizeof(test_vectors) / sizeof(struct BIP32TestVector)); i++)
 		{
-			base58Decode(expected_bytes, test_vectors[i].base58_private, strlen(test_vectors[i].base58_private));
-			if (memcmp(&(out[0]), &(expected_bytes[4]), 32) != 0)
+#ifndef BIP32_NO_CACHE
+			if (pass == 0)
 			{
-				printf("Test vector %u derivation mismatch\n", i);
-				printf("Derived: ");
-				printLittleEndian32(&(out[0]));
-				printf("\n");
-				printf("Vector : ");
-				printLittleEndian32(&(expected_bytes[4]));
-				printf("\n");
-				reportFailure();
+				bip32ClearCache();
 			}
-			else if (memcmp(&(out[32]), canary, sizeof(canary)) != 0)
+#endif // #ifndef BIP32_NO_CACHE
+			bip32SeedToNode(master_node, test_vectors[i].master, test_vectors[i].master_length);
+			fillWithRandom(canary, sizeof(canary));
+			memcpy(&(out[32]), canary, sizeof(canary));
+			if (bip32DerivePrivate(out, master_node, test_vectors[i].path, test_vectors[i].path_length))
 			{
-				printf("Test vector %u caused write to canary\n", i);
+				printf("Test vector %u failed to derive\n", i);
 				reportFailure();
 			}
 			else
 			{
-				reportSuccess();
+				base58Decode(expected_bytes, test_vectors[i].base58_private, strlen(test_vectors[i].base58_private));
+				if (memcmp(&(out[0]), &(expected_bytes[4]), 32) != 0)
+				{
+					printf("Test vector %u derivation mismatch\n", i);
+					printf("Derived: ");
+					printLittleEndian32(&(out[0]));
+					printf("\n");
+					printf("Vector : ");
+					printLittleEndian32(&(expected_bytes[4]));
+					printf("\n");
+					reportFailure();
+				}
+				else if (memcmp(&(out[32]), canary, sizeof(canary)) != 0)
+				{
+					printf("Test vector %u caused write to canary\n", i);
+					reportFailure();
+				}
+				else
+				{
+					reportSuccess();
+				}
+			}
+		}
+	}
+
+	// Check that bip32DerivePublic() gives the same public keys as
+	// bip32DerivePrivate() followed by a multiplication by G. Siblings of
+	// each test vector are also tried, since that's when the cached parent
+	// public key is reused. Like above, the first pass clears the derivation
+	// cache before every derivation.
+	for (pass = 0; pass < 2; pass++)
+	{
+		for (i = 0; i < (sizeof(test_vectors) / sizeof(struct BIP32TestVector)); i++)
+		{
+			bip32SeedToNode(master_node, test_vectors[i].master, test_vectors[i].master_length);
+			memcpy(path, test_vectors[i].path, sizeof(path));
+			for (j = 0; j < 4; j++)
+			{
+#ifndef BIP32_NO_CACHE
+				if (pass == 0)
+				{
+					bip32ClearCache();
+				}
+#endif // #ifndef BIP32_NO_CACHE
+				if (bip32DerivePrivate(out, master_node, path, test_vectors[i].path_length))
+				{
+					printf("Test vector %u, sibling %u failed to derive private key\n", i, j);
+					reportFailure();
+					continue;
+				}
+				ecdsaMultiplyG(&expected_public_key, out);
+#ifndef BIP32_NO_CACHE
+				if (pass == 0)
+				{
+					bip32ClearCache();
+				}
+#endif // #ifndef BIP32_NO_CACHE
+				if (bip32DerivePublic(&public_key, master_node, path, test_vectors[i].path_length))
+				{
+					printf("Test vector %u, sibling %u failed to derive public key\n", i, j);
+					reportFailure();
+				}
+				else if ((bigCompare(public_key.x, expected_public_key.x) != BIGCMP_EQUAL)
+					|| (bigCompare(public_key.y, expected_public_key.y) != BIGCMP_EQUAL)
+					|| (public_key.is_point_at_infinity != expected_public_key.is_point_at_infinity))
+				{
+					printf("Test vector %u, sibling %u public key mismatch\n", i, j);
+					reportFailure();
+				}
+				else
+				{
+					reportSuccess();
+				}
+				if (test_vectors[i].path_length == 0)
+				{
+					break; // master node has no siblings
+				}
+				path[test_vectors[i].path_length - 1]++;
 			}
 		}
 	}
 
+	for (i = 0; i < (sizeof(bip39_test_vectors) / sizeof(struct BIP39TestVector)); i++)
+	{
+		if (bip39MnemonicToSeed(
+			bip39_seed,
+			(const uint8_t *)bip39_test_vectors[i].mnemonic,
+			(unsigned int)strlen(bip39_test_vectors[i].mnemonic),
+			(const uint8_t *)bip39_test_vectors[i].passphrase,
+			(unsigned int)strlen(bip39_test_vectors[i].passphrase)))
+		{
+			printf("BIP39 test vector %u failed\n", i);
+			reportFailure();
+		}
+		else if (memcmp(bip39_seed, bip39_test_vectors[i].seed, BIP39_SEED_LENGTH) != 0)
+		{
+			printf("BIP39 test vector %u seed mismatch\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+	}
+
+	// Overly long passphrases should be rejected, not truncated.
+	memset(bip39_seed, 'a', sizeof(bip39_seed));
+	if (bip39MnemonicToSeed(bip39_seed, bip39_seed, 4, bip39_seed, BIP39_MAX_PASSPHRASE_LENGTH + 1))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("bip39MnemonicToSeed() accepted overly long passphrase\n");
+		reportFailure();
+	}
+
+	// bip32DerivePublicChild() can't do hardened derivation.
+	bip32SeedToNode(master_node, test_vectors[0].master, test_vectors[0].master_length);
+	memcpy(out, master_node, 32);
+	swapEndian256(out);
+	ecdsaMultiplyG(&public_key, out);
+	if (!bip32DerivePublicChild(&expected_public_key, NULL, &public_key, &(master_node[32]), 0x80000000))
+	{
+		printf("bip32DerivePublicChild() accepted hardened index\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
 	finishTests();
 	exit(0);
 }
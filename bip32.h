@@ -10,12 +10,27 @@
 
 #include "common.h"
 #include "bignum256.h"
+#include "ecdsa.h"
 
 /** Length (in number of bytes) of a BIP32 node, a.k.a. extended private
   * key. */
 #define NODE_LENGTH		64
 
+/** Length (in number of bytes) of a seed derived by bip39MnemonicToSeed(). */
+#define BIP39_SEED_LENGTH				64
+/** Number of PBKDF2 iterations specified by BIP39. */
+#define BIP39_ITERATIONS				2048
+/** Maximum length (in number of bytes) of a BIP39 passphrase accepted by
+  * bip39MnemonicToSeed(). */
+#define BIP39_MAX_PASSPHRASE_LENGTH		64
+
 extern void bip32SeedToNode(uint8_t *master_node, const uint8_t *seed, const unsigned int seed_length);
+extern bool bip39MnemonicToSeed(uint8_t *seed, const uint8_t *mnemonic, const unsigned int mnemonic_length, const uint8_t *passphrase, const unsigned int passphrase_length);
+#ifndef BIP32_NO_CACHE
+extern void bip32ClearCache(void);
+#endif // #ifndef BIP32_NO_CACHE
 extern bool bip32DerivePrivate(BigNum256 out, const uint8_t *master_node, const uint32_t *path, const unsigned int path_length);
+extern bool bip32DerivePublicChild(PointAffine *out, uint8_t *out_chain_code, PointAffine *parent_public_key, const uint8_t *parent_chain_code, const uint32_t index);
+extern bool bip32DerivePublic(PointAffine *out, const uint8_t *master_node, const uint32_t *path, const unsigned int path_length);
 
 #endif // #ifndef BIP32_H_INCLUDED
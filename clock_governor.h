@@ -0,0 +1,44 @@
+/** \file clock_governor.h
+  *
+  * \brief Describes the macros used to mark operations which should run at
+  *        full clock speed.
+  *
+  * The clock governor is only compiled in if CLOCK_GOVERNOR is defined. If
+  * it isn't, CLOCK_BOOST_BEGIN() and CLOCK_BOOST_END() expand to nothing and
+  * the platform runs at one fixed clock speed, as before. When the governor
+  * is enabled, the platform normally runs at a reduced clock speed (with
+  * fewer flash wait states), which is all that's needed to wait for the host
+  * or for a button press. Operations which take a noticeable amount of
+  * time, such as point multiplication, PBKDF2 and filling the HWRNG sample
+  * buffer, are bracketed by CLOCK_BOOST_BEGIN() and CLOCK_BOOST_END(), and
+  * run at full speed. That way, crypto latency is the same as without the
+  * governor, but idle power consumption is lower, which matters on
+  * bus-powered hosts.
+  *
+  * Boosts nest, so an operation which is boosted can call other operations
+  * which are boosted. Every CLOCK_BOOST_BEGIN() must be matched by exactly
+  * one CLOCK_BOOST_END(), so be careful with early returns.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifndef CLOCK_GOVERNOR_H_INCLUDED
+#define CLOCK_GOVERNOR_H_INCLUDED
+
+#ifdef CLOCK_GOVERNOR
+
+#include "hwinterface.h"
+
+/** Run at full clock speed until the matching CLOCK_BOOST_END(). */
+#define CLOCK_BOOST_BEGIN()	clockBoost(true)
+/** Undo the matching CLOCK_BOOST_BEGIN(). */
+#define CLOCK_BOOST_END()	clockBoost(false)
+
+#else
+
+#define CLOCK_BOOST_BEGIN()
+#define CLOCK_BOOST_END()
+
+#endif // #ifdef CLOCK_GOVERNOR
+
+#endif // #ifndef CLOCK_GOVERNOR_H_INCLUDED
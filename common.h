@@ -91,6 +91,39 @@ typedef enum BoolEnum
 #define NOINLINE
 #endif // #if defined(__GNUC__)
 
+/** Multi-precision arithmetic can use word (32 bit) loads and stores when
+  * its operands are aligned on a word boundary, so buffers which are passed
+  * to the functions in bignum256.c should be marked with WORD_ALIGNED (or be
+  * declared as a #BigNum256Storage). The AVR has no word loads, so this
+  * does nothing there; that avoids padding structures. */
+#if defined(__GNUC__) && !defined(AVR)
+#define WORD_ALIGNED __attribute__((aligned(4)))
+#else
+#define WORD_ALIGNED
+#endif // #if defined(__GNUC__) && !defined(AVR)
+
+/** On the PIC32MX, flash needs wait states at full speed and the prefetch
+  * cache doesn't help much with the data-dependent branches and loads of the
+  * cryptographic inner loops. If RAM_KERNELS is defined, functions marked
+  * with RAM_FUNCTION are copied into RAM at startup and executed from there
+  * (see the RAM function budget in pic32/app_32MX695F512H.ld). The mark must
+  * appear on both the prototype and the definition, so that every call to
+  * the function is a long call.
+  *
+  * Code in RAM and code in flash are in different 256 MB regions, so a
+  * RAM_FUNCTION can't directly call a function in flash. Small helper
+  * functions used by a RAM_FUNCTION should be marked with RAM_FUNCTION_HELPER,
+  * which forces them to be inlined. If something is missed, the link will
+  * fail with a "relocation truncated to fit" error, rather than anything
+  * failing at runtime. On every other platform, both of these do nothing. */
+#if defined(RAM_KERNELS) && defined(__XC32)
+#define RAM_FUNCTION __attribute__((ramfunc, section(".ramfunc"), far, unique_section, noinline))
+#define RAM_FUNCTION_HELPER inline __attribute__((always_inline))
+#else
+#define RAM_FUNCTION
+#define RAM_FUNCTION_HELPER
+#endif // #if defined(RAM_KERNELS) && defined(__XC32)
+
 /** On certain platforms, unchanging, read-only data (eg. lookup tables) needs
   * to be marked and accessed in a way that is different to read/write data.
   * Marking this data with PROGMEM saves valuable RAM space. However, any data
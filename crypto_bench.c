@@ -0,0 +1,452 @@
+/** \file crypto_bench.c
+  *
+  * \brief Times the core cryptographic primitives on actual embedded
+  *        hardware.
+  *
+  * The host benchmarks (see bench.c) don't say much about how the
+  * microcontrollers behave, since their multipliers, flash wait states and
+  * memory systems are very different from a PC's. This file runs each
+  * primitive a fixed number of times, times it using the platform's cycle
+  * counter (see getCycleCount() in hwinterface.h) and sends the results
+  * over the stream, where a host program (crypto_bench_tester) can collect
+  * them. This is useful for choosing between the various build options
+  * (eg. BIGNUM_32BIT_LIMBS, ECDSA_NO_G_TABLE, SHA256_UNROLLED, AES_TTABLE,
+  * RAM_KERNELS, PLATFORM_SPECIFIC_FIX16_MUL) on real silicon.
+  *
+  * The device waits for the host to send one byte. It then sends:
+  * - the rate at which the cycle counter increments, in counts per second
+  *   (4 bytes, little-endian),
+  * - the number of CPU cycles per count (4 bytes, little-endian),
+  * - for each benchmark: the length of the benchmark's name (1 byte), the
+  *   name (not null-terminated), the number of iterations, the number of
+  *   message bytes processed per iteration (0 if not applicable) and the
+  *   total number of counts for all iterations (4 bytes each,
+  *   little-endian),
+  * - a zero byte (a name length of 0), to mark the end of the results.
+  *
+  * Then the device goes back to waiting for the host.
+  *
+  * If the byte the host sends is 'L', the device instead takes
+  * measurements for a timing leakage test (see runLeakageTest() in bench.c
+  * for the host version). bigMultiply(), bigInvert(), pointMultiply() and
+  * ecdsaSign() are each run many times, with inputs randomly chosen from a
+  * fixed class and a random class, and each run is timed individually. For
+  * each operation, the device sends: the length of the operation's name
+  * (1 byte), the name, the number of measurements (4 bytes, little-endian)
+  * and then, for each measurement, the class (1 byte, 0 = fixed, 1 = random)
+  * followed by the number of counts (4 bytes, little-endian). A zero byte
+  * marks the end of the results. The statistics are done by the host, which
+  * has the floating-point hardware and memory to do them properly.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifdef TEST_CRYPTO_BENCH
+
+#include "common.h"
+#include "endian.h"
+#include "hwinterface.h"
+#include "bignum256.h"
+#include "ecdsa.h"
+#include "sha256.h"
+#include "ripemd160.h"
+#include "hmac_sha512.h"
+#include "pbkdf2.h"
+#include "aes.h"
+#include "fix16.h"
+#include "crypto_bench.h"
+
+/** Number of measurements taken for fast operations (big number
+  * multiplication) in the timing leakage test. */
+#define LEAKAGE_MEASUREMENTS_FAST	2000
+/** Number of measurements taken for bigInvert() in the timing leakage
+  * test. */
+#define LEAKAGE_MEASUREMENTS_MEDIUM	200
+/** Number of measurements taken for slow operations (point multiplication
+  * and signing) in the timing leakage test. */
+#define LEAKAGE_MEASUREMENTS_SLOW	50
+
+/** First operand for big number and elliptic curve benchmarks. */
+static uint8_t op1[32];
+/** Second operand for big number and elliptic curve benchmarks. */
+static uint8_t op2[32];
+/** Result of big number and elliptic curve benchmarks. */
+static uint8_t result[32];
+/** Second result of elliptic curve benchmarks. */
+static uint8_t result2[32];
+/** Point used by elliptic curve benchmarks. */
+static PointAffine point;
+/** Public key used by ecdsaVerify() benchmark. */
+static PointAffine public_key;
+/** Message used by hash and cipher benchmarks. */
+static uint8_t message[128];
+/** Output of hash and cipher benchmarks. */
+static uint8_t digest[64];
+/** Hash state used by hash benchmarks. */
+static HashState hs;
+/** Expanded key for AES benchmarks. */
+static uint8_t expanded_key[EXPANDED_KEY_SIZE];
+/** Input for the operation being tested by runLeakageTest(). */
+static uint8_t leakage_input[32];
+/** State of the xorshift generator used to choose input classes and random
+  * inputs in runLeakageTest(). This doesn't need to be cryptographically
+  * secure; it only needs to be unrelated to the operations being tested. */
+static uint32_t leakage_rng_state;
+/** Result of the fixed-point benchmark. This is volatile so that the
+  * multiplications can't be optimised away. */
+static volatile fix16_t fix16_result;
+
+/** Send a 32 bit unsigned integer to the stream, in little-endian format.
+  * \param value The integer to send.
+  */
+static void sendU32(uint32_t value)
+{
+	uint8_t buffer[4];
+	uint8_t i;
+
+	writeU32LittleEndian(buffer, value);
+	for (i = 0; i < 4; i++)
+	{
+		streamPutOneByte(buffer[i]);
+	}
+}
+
+/** Repeat an operation, time it and send the results to the stream.
+  * \param name Name of the benchmark, as it will appear in the results.
+  *             This must be less than 256 characters long.
+  * \param op The operation to benchmark.
+  * \param iterations Number of times to repeat the operation. This should
+  *                   be chosen so that the cycle counter doesn't wrap
+  *                   around more than once.
+  * \param bytes_per_op Number of message bytes processed by each
+  *                     operation, or 0 if throughput is meaningless for
+  *                     this operation.
+  */
+static void runBenchmark(const char *name, void (*op)(void), uint32_t iterations, uint32_t bytes_per_op)
+{
+	uint32_t i;
+	uint32_t start_count;
+	uint32_t counts;
+	uint8_t name_length;
+
+	start_count = getCycleCount();
+	for (i = 0; i < iterations; i++)
+	{
+		op();
+	}
+	counts = getCycleCount() - start_count;
+
+	name_length = (uint8_t)strlen(name);
+	streamPutOneByte(name_length);
+	for (i = 0; i < name_length; i++)
+	{
+		streamPutOneByte((uint8_t)name[i]);
+	}
+	sendU32(iterations);
+	sendU32(bytes_per_op);
+	sendU32(counts);
+}
+
+/** Benchmark operation for bigMultiplyVariableSizeNoModulo(), the inner
+  * kernel of all big number multiplication. This only multiplies, and so
+  * isn't diluted by the cost of modular reduction. */
+static void benchBigMultiplyNoModulo(void)
+{
+	bigMultiplyVariableSizeNoModulo(digest, op1, 32, op2, 32);
+}
+
+/** Benchmark operation for bigMultiply(). */
+static void benchBigMultiply(void)
+{
+	bigMultiply(result, op1, op2);
+}
+
+/** Benchmark operation for bigMultiplyModP(). */
+static void benchBigMultiplyModP(void)
+{
+	bigMultiplyModP(result, op1, op2);
+}
+
+/** Benchmark operation for bigMultiplyModN(). */
+static void benchBigMultiplyModN(void)
+{
+	bigMultiplyModN(result, op1, op2);
+}
+
+/** Benchmark operation for bigInvert(). */
+static void benchBigInvert(void)
+{
+	bigInvert(result, op1);
+}
+
+/** Benchmark operation for bigInvertModN(). */
+static void benchBigInvertModN(void)
+{
+	bigInvertModN(result, op1);
+}
+
+/** Benchmark operation for pointMultiply(). */
+static void benchPointMultiply(void)
+{
+	setToG(&point);
+	pointMultiply(&point, op1);
+}
+
+#ifndef ECDSA_NO_COZ_LADDER
+/** Benchmark operation for pointMultiplyLadder(). */
+static void benchPointMultiplyLadder(void)
+{
+	setToG(&point);
+	pointMultiplyLadder(&point, op1);
+}
+#endif // #ifndef ECDSA_NO_COZ_LADDER
+
+/** Benchmark operation for ecdsaMultiplyG(). */
+static void benchEcdsaMultiplyG(void)
+{
+	ecdsaMultiplyG(&point, op1);
+}
+
+/** Benchmark operation for ecdsaSign(). */
+static void benchEcdsaSign(void)
+{
+	ecdsaSign(result, result2, op2, op1);
+}
+
+/** Benchmark operation for ecdsaVerify(). */
+static void benchEcdsaVerify(void)
+{
+	ecdsaVerify(result, result2, op2, &public_key);
+}
+
+/** Benchmark operation for SHA-256 compression, which processes one
+  * 64 byte block per call. */
+static void benchSha256Block(void)
+{
+	sha256WriteBytes(&hs, message, 64);
+}
+
+/** Benchmark operation for hash160() of a compressed public key. */
+static void benchHash160(void)
+{
+	hash160(digest, message, 33);
+}
+
+/** Benchmark operation for hmacSha512(). */
+static void benchHmacSha512(void)
+{
+	hmacSha512(digest, op1, sizeof(op1), message, sizeof(message));
+}
+
+/** Benchmark operation for pbkdf2(). */
+static void benchPbkdf2(void)
+{
+	pbkdf2(digest, message, 16, op1, sizeof(op1), getPBKDF2Iterations());
+}
+
+/** Benchmark operation for aesEncrypt(). */
+static void benchAesEncrypt(void)
+{
+	aesEncrypt(digest, message, expanded_key);
+}
+
+/** Benchmark operation for aesDecrypt(). */
+static void benchAesDecrypt(void)
+{
+	aesDecrypt(digest, message, expanded_key);
+}
+
+/** Benchmark operation for fix16_mul(), the inner operation of the FFT and
+  * the HWRNG statistical tests. This does 64 dependent multiplications. */
+static void benchFix16Mul(void)
+{
+	uint8_t i;
+	fix16_t r;
+
+	r = fix16_result;
+	for (i = 0; i < 64; i++)
+	{
+		r = fix16_mul(r, F16(1.0001));
+	}
+	fix16_result = r;
+}
+
+/** Timing leakage operation for bigMultiply(). */
+static void leakBigMultiply(void)
+{
+	bigMultiply(result, leakage_input, op2);
+}
+
+/** Timing leakage operation for bigInvert(). */
+static void leakBigInvert(void)
+{
+	bigInvert(result, leakage_input);
+}
+
+/** Timing leakage operation for pointMultiply(). */
+static void leakPointMultiply(void)
+{
+	setToG(&point);
+	pointMultiply(&point, leakage_input);
+}
+
+/** Timing leakage operation for ecdsaSign(). */
+static void leakEcdsaSign(void)
+{
+	ecdsaSign(result, result2, op2, leakage_input);
+}
+
+/** Get the next output of the xorshift generator (see #leakage_rng_state).
+  * \return A pseudo-random 32 bit integer.
+  */
+static uint32_t leakageRandom(void)
+{
+	uint32_t x;
+
+	x = leakage_rng_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	leakage_rng_state = x;
+	return x;
+}
+
+/** Time an operation many times, with inputs randomly chosen from a fixed
+  * class (the number 1) or a random class, and send each measurement to the
+  * stream. See the comments at the top of this file for the format.
+  * \param name Name of the operation, as it will appear in the results.
+  *             This must be less than 256 characters long.
+  * \param op The operation to test. It should use #leakage_input.
+  * \param measurements Number of measurements to take.
+  */
+static void runLeakageTest(const char *name, void (*op)(void), uint32_t measurements)
+{
+	uint32_t i;
+	uint32_t j;
+	uint32_t start_count;
+	uint32_t counts;
+	uint8_t input_class;
+	uint8_t name_length;
+
+	name_length = (uint8_t)strlen(name);
+	streamPutOneByte(name_length);
+	for (i = 0; i < name_length; i++)
+	{
+		streamPutOneByte((uint8_t)name[i]);
+	}
+	sendU32(measurements);
+	for (i = 0; i < measurements; i++)
+	{
+		input_class = (uint8_t)(leakageRandom() & 1);
+		if (input_class == 0)
+		{
+			memset(leakage_input, 0, sizeof(leakage_input));
+			leakage_input[0] = 1;
+		}
+		else
+		{
+			for (j = 0; j < sizeof(leakage_input); j += 4)
+			{
+				writeU32LittleEndian(&(leakage_input[j]), leakageRandom());
+			}
+			// Make sure the input is less than the group order.
+			leakage_input[31] &= 0x7f;
+		}
+		start_count = getCycleCount();
+		op();
+		counts = getCycleCount() - start_count;
+		// Sending is done after timing, so that stream activity doesn't
+		// overlap the next measurement.
+		streamPutOneByte(input_class);
+		sendU32(counts);
+	}
+}
+
+/** Fill a buffer with deterministic, but random-looking, test data.
+  * \param out The buffer to fill.
+  * \param length The length of the buffer, in bytes. This must be a multiple
+  *               of 32.
+  * \param seed Different seeds generate different data.
+  */
+static void fillTestData(uint8_t *out, uint32_t length, uint8_t seed)
+{
+	uint32_t i;
+
+	for (i = 0; i < length; i += 32)
+	{
+		sha256Begin(&hs);
+		sha256WriteByte(&hs, seed);
+		sha256WriteByte(&hs, (uint8_t)i);
+		sha256Finish(&hs);
+		writeHashToByteArray(&(out[i]), &hs, true);
+	}
+}
+
+/** Time the core cryptographic primitives and send the results to the
+  * stream, whenever the host asks for it. See the comments at the top of
+  * this file for the format of the results. This never returns.
+  * \param cycles_per_count Number of CPU cycles per increment of the
+  *                         counter returned by getCycleCount().
+  */
+void benchmarkCrypto(uint32_t cycles_per_count)
+{
+	uint8_t command;
+
+	while (true)
+	{
+		command = streamGetOneByte(); // wait for host
+
+		fillTestData(op1, sizeof(op1), 1);
+		fillTestData(op2, sizeof(op2), 2);
+		fillTestData(message, sizeof(message), 3);
+		// Make sure operands are less than the group order, so that they are
+		// valid field elements, private keys and hashes.
+		op1[31] &= 0x7f;
+		op2[31] &= 0x7f;
+		ecdsaMultiplyG(&public_key, op1);
+
+		if (command == 'L')
+		{
+			leakage_rng_state = 0x2545f491;
+			setFieldToN();
+			runLeakageTest("bigMultiply", leakBigMultiply, LEAKAGE_MEASUREMENTS_FAST);
+			runLeakageTest("bigInvert", leakBigInvert, LEAKAGE_MEASUREMENTS_MEDIUM);
+			runLeakageTest("pointMultiply", leakPointMultiply, LEAKAGE_MEASUREMENTS_SLOW);
+			runLeakageTest("ecdsaSign", leakEcdsaSign, LEAKAGE_MEASUREMENTS_SLOW);
+			streamPutOneByte(0); // end of results
+			continue;
+		}
+
+		sendU32(getCycleCountFrequency());
+		sendU32(cycles_per_count);
+		setFieldToN();
+		runBenchmark("bigMultiplyNoModulo", benchBigMultiplyNoModulo, 100, 0);
+		runBenchmark("bigMultiply", benchBigMultiply, 100, 0);
+		runBenchmark("bigMultiplyModP", benchBigMultiplyModP, 100, 0);
+		runBenchmark("bigMultiplyModN", benchBigMultiplyModN, 100, 0);
+		runBenchmark("bigInvert", benchBigInvert, 10, 0);
+		runBenchmark("bigInvertModN", benchBigInvertModN, 10, 0);
+		runBenchmark("pointMultiply", benchPointMultiply, 1, 0);
+#ifndef ECDSA_NO_COZ_LADDER
+		runBenchmark("pointMultiplyLadder", benchPointMultiplyLadder, 1, 0);
+#endif // #ifndef ECDSA_NO_COZ_LADDER
+		runBenchmark("ecdsaMultiplyG", benchEcdsaMultiplyG, 1, 0);
+		ecdsaSign(result, result2, op2, op1); // signature for ecdsaVerify()
+		runBenchmark("ecdsaVerify", benchEcdsaVerify, 1, 0);
+		runBenchmark("ecdsaSign", benchEcdsaSign, 1, 0);
+		sha256Begin(&hs);
+		runBenchmark("sha256Block", benchSha256Block, 100, 64);
+		runBenchmark("hash160", benchHash160, 100, 33);
+		runBenchmark("hmacSha512", benchHmacSha512, 10, sizeof(message));
+		runBenchmark("pbkdf2", benchPbkdf2, 1, 0);
+		aesExpandKey(expanded_key, op1);
+		runBenchmark("aesEncrypt", benchAesEncrypt, 100, 16);
+		aesExpandKeyDecrypt(expanded_key, op1);
+		runBenchmark("aesDecrypt", benchAesDecrypt, 100, 16);
+		fix16_result = F16(1.0);
+		runBenchmark("fix16Mul", benchFix16Mul, 100, 0);
+		streamPutOneByte(0); // end of results
+	}
+}
+
+#endif // #ifdef TEST_CRYPTO_BENCH
@@ -0,0 +1,17 @@
+/** \file crypto_bench.h
+  *
+  * \brief Describes functions exported by crypto_bench.c.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifndef CRYPTO_BENCH_H_INCLUDED
+#define CRYPTO_BENCH_H_INCLUDED
+
+#ifdef TEST_CRYPTO_BENCH
+#include "common.h"
+
+extern void benchmarkCrypto(uint32_t cycles_per_count);
+#endif // #ifdef TEST_CRYPTO_BENCH
+
+#endif // #ifndef CRYPTO_BENCH_H_INCLUDED
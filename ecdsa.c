@@ -37,6 +37,9 @@
 #include "ecdsa.h"
 #include "endian.h"
 #include "hmac_drbg.h"
+#include "background.h"
+#include "clock_governor.h"
+#include "trace.h"
 
 /** A point on the elliptic curve, in Jacobian coordinates. The
   * Jacobian coordinates (x, y, z) are related to affine coordinates
@@ -45,15 +48,22 @@
   *
   * Why use Jacobian coordinates? Because then point addition and
   * point doubling don't have to use inversion (division), which is very slow.
+  *
+  * If ECDSA_COMPLETE_ADDITION is defined, (x, y, z) are instead homogeneous
+  * projective coordinates, which are related to affine coordinates by:
+  * (x_affine, y_affine) = (x / z, y / z). The point at infinity is then
+  * represented by any point with z = 0 (normally (0, 1, 0)), and
+  * is_point_at_infinity is only a flag which is kept in step with z. See
+  * pointAdd() for why.
   */
 typedef struct PointJacobianStruct
 {
 	/** x component of a point in Jacobian coordinates. */
-	uint8_t x[32];
+	BigNum256Storage x;
 	/** y component of a point in Jacobian coordinates. */
-	uint8_t y[32];
+	BigNum256Storage y;
 	/** z component of a point in Jacobian coordinates. */
-	uint8_t z[32];
+	BigNum256Storage z;
 	/** If is_point_at_infinity is non-zero, then this point represents the
 	  * point at infinity and all other structure members are considered
 	  * invalid. */
@@ -61,7 +71,7 @@ typedef struct PointJacobianStruct
 } PointJacobian;
 
 /** The prime number used to define the prime finite field for secp256k1. */
-static const uint8_t secp256k1_p[32] = {
+static const BigNum256Storage secp256k1_p = {
 0x2f, 0xfc, 0xff, 0xff, 0xfe, 0xff, 0xff, 0xff,
 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
@@ -72,7 +82,7 @@ static const uint8_t secp256k1_complement_p[5] = {
 0xd1, 0x03, 0x00, 0x00, 0x01};
 
 /** The order of the base point used in secp256k1. */
-const uint8_t secp256k1_n[32] = {
+const BigNum256Storage secp256k1_n = {
 0x41, 0x41, 0x36, 0xd0, 0x8c, 0x5e, 0xd2, 0xbf,
 0x3b, 0xa0, 0x48, 0xaf, 0xe6, 0xdc, 0xae, 0xba,
 0xfe, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
@@ -84,6 +94,23 @@ static const uint8_t secp256k1_complement_n[17] = {
 0xc4, 0x5f, 0xb7, 0x50, 0x19, 0x23, 0x51, 0x45,
 0x01};
 
+/** Field parameters of the prime finite field defined by #secp256k1_p, for
+  * the "InField" functions in bignum256.c. */
+const BigNumField secp256k1_p_field = {
+(uint8_t *)secp256k1_p, (uint8_t *)secp256k1_complement_p, sizeof(secp256k1_complement_p)};
+
+/** Field parameters of the prime finite field defined by #secp256k1_n, for
+  * the "InField" functions in bignum256.c. */
+const BigNumField secp256k1_n_field = {
+(uint8_t *)secp256k1_n, (uint8_t *)secp256k1_complement_n, sizeof(secp256k1_complement_n)};
+
+/** The curve parameter b of secp256k1. The other parameter, a, is zero. */
+static const BigNum256Storage secp256k1_b = {
+0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+
 /** The x component of the base point G used in secp256k1. */
 static const uint8_t secp256k1_Gx[32] PROGMEM = {
 0x98, 0x17, 0xf8, 0x16, 0x5b, 0x81, 0xf2, 0x59,
@@ -98,6 +125,175 @@ static const uint8_t secp256k1_Gy[32] PROGMEM = {
 0xa8, 0x08, 0x11, 0x0e, 0xfc, 0xfb, 0xa4, 0x5d,
 0x65, 0xc4, 0xa3, 0x26, 0x77, 0xda, 0x3a, 0x48};
 
+#ifndef ECDSA_NO_G_TABLE
+
+#ifdef ECDSA_G_TABLE_HEADER
+// The comb table comes from a header generated at build time by
+// "gen_g_table <teeth> header" (see "make tables"), so that the size of the
+// table can be chosen per target. The header defines G_COMB_TEETH,
+// G_COMB_SPACING and secp256k1_G_comb.
+#include ECDSA_G_TABLE_HEADER
+#if (G_COMB_TEETH < 2) || (G_COMB_TEETH > 7)
+#error "G_COMB_TEETH must be between 2 and 7."
+#endif
+#else
+
+/** Number of teeth in the comb used by ecdsaMultiplyG(). */
+#define G_COMB_TEETH		6
+/** Spacing, in bits, between adjacent teeth of the comb used by
+  * ecdsaMultiplyG(). */
+#define G_COMB_SPACING		43
+
+#if (G_COMB_TEETH != 6) || (G_COMB_SPACING != 43)
+#error "You may need to update secp256k1_G_comb using gen_g_table."
+#endif
+/** Fixed-base comb table of multiples of the base point G, used by
+  * ecdsaMultiplyG(). Entry b - 1 is the point
+  * b_0 x G + b_1 x 2 ^ 43 x G + ... + b_5 x 2 ^ 215 x G, in affine
+  * coordinates, where b_j is bit j of b. Each entry consists of 8 x 32 bit
+  * words of the x component followed by 8 x 32 bit words of the y component,
+  * least significant word first.
+  *
+  * Table generated using gen_g_table.
+  * Teeth: 6, spacing: 43.
+  */
+static const uint32_t secp256k1_G_comb[63][16] PROGMEM = {
+{0x16f81798, 0x59f2815b, 0x2dce28d9, 0x029bfcdb, 0xce870b07, 0x55a06295, 0xf9dcbbac, 0x79be667e,
+0xfb10d4b8, 0x9c47d08f, 0xa6855419, 0xfd17b448, 0x0e1108a8, 0x5da4fbfc, 0x26a3c465, 0x483ada77},
+{0x43ff8359, 0x6048b060, 0xc65e7651, 0x46b4821d, 0xc21da014, 0xb7d282b5, 0x9f7bd253, 0xa2b7b362,
+0xfe86fec2, 0xa2397fec, 0x046f3835, 0x10d10835, 0xf71e29c9, 0x57a937a3, 0x1695122d, 0x69303894},
+{0xb10fd304, 0xbe27d057, 0x347f3a26, 0x86960638, 0x18e4a8ad, 0x8cd0b2d6, 0x8b4d88d4, 0x6576d554,
+0x74b35a7e, 0x3214fbf6, 0x19dca53c, 0xde91c8ff, 0x7471a2cd, 0x4ba282bd, 0x3a1e8c39, 0xb481e63e},
+{0xdfbfa4dc, 0x476706e4, 0x04c85b17, 0xf5948a78, 0x7adbb41f, 0x8392119d, 0x731fea19, 0xd6788590,
+0xbd3b5406, 0xca7bcd6b, 0xddc9a07c, 0x6206f1c4, 0xd21c13aa, 0x940ef5c6, 0x9d5063c4, 0x28eaa8c8},
+{0xf7866196, 0x3e73fcc8, 0x81b3f4aa, 0x25e21c36, 0x9339ae07, 0x52565e80, 0x891e3cc0, 0x29c47eab,
+0x26ac3dcd, 0x3d9d8aa9, 0x2ff10fdf, 0x3e49815b, 0x6aca3ef4, 0xd55a8dec, 0x88b83df0, 0x4e0d94b7},
+{0xedecc847, 0xea375008, 0x5844a04c, 0x309feffb, 0xcf58f7e0, 0x170a37e4, 0x1ad31962, 0xf73c1285,
+0x4b5d70e2, 0x2cf714db, 0x17b6864f, 0x99edbedf, 0x3e0d2581, 0x8c3a8a7d, 0x59c6b114, 0x506b9e27},
+{0x2b7fe6b1, 0x8f6ff9c4, 0x65ded430, 0xa647b5b0, 0x29aa5f4b, 0x5d53c326, 0x63d326c5, 0xcea2e172,
+0xb3cf7bd1, 0x7e5111e5, 0x99c547a7, 0x2c157fa2, 0xc251b9e4, 0x884e42ab, 0x9b97d96f, 0x31685db5},
+{0x4cf27076, 0xe6847df8, 0xe7627eae, 0xd89858ad, 0x7fd9af59, 0xfcafebe7, 0x784e8158, 0x4d49aefd,
+0x03aa781e, 0x6b90b662, 0x7df4d846, 0x6e0f2d1a, 0x359ca6f0, 0xe723f210, 0xa10dd135, 0xcd32fc59},
+{0xce279a45, 0x042f7989, 0x270f23bf, 0xea8b0fa8, 0xbd2623d6, 0x505c7ce5, 0xcd0123c6, 0x2c0e4587,
+0x79858da8, 0xaa5491ed, 0xc5348ebe, 0xc881dbf3, 0x946801eb, 0xf45baa5c, 0x07d42762, 0xa02f6127},
+{0x7f56f827, 0x0035af53, 0xd253e9a6, 0x8344fc81, 0x99e92f76, 0xca8f1b6a, 0x3cd4a952, 0xdcb97fc1,
+0x87b67c3d, 0x160a4b4e, 0x408c6130, 0x42443f4b, 0x12c01d14, 0x0a190512, 0xff5d737b, 0x2efbd169},
+{0x16f41f0a, 0x355569ba, 0xa5850c70, 0x4d1ebb05, 0x57e55d8a, 0x5a957698, 0x1ce7d833, 0x2543e5f8,
+0x0596238c, 0x50e913a0, 0x2fbfc3dd, 0xef0e4031, 0x573634ad, 0xc23eb566, 0x173c881f, 0x9af00533},
+{0x74b45960, 0xe0b3a843, 0x723df5a8, 0x76671c46, 0xc61ca37f, 0xd2429517, 0xbb68be24, 0xe5e08b13,
+0x6990cfc6, 0x1caf639c, 0xaabacff0, 0xf150b8e7, 0x19a76c68, 0xe2ec209e, 0x392329a9, 0xeae00d38},
+{0x78e4e9da, 0xf4ac2e21, 0xd33dc867, 0x37b8d870, 0x39ba6ea9, 0xb70813e4, 0x7d0c0bac, 0x3d56ce04,
+0x6e005f31, 0x1a7205c7, 0x0bbf0efa, 0x0b5b1892, 0x79d928ab, 0x8ab4d9bb, 0x2cb116d6, 0x42509897},
+{0xcc2a56d6, 0x8c30941c, 0x004c17ba, 0xa0ec8285, 0xa704d6d1, 0xb54f07c0, 0x14fe9bf7, 0x402d950e,
+0xffd37a94, 0x78296ec7, 0xb7a03ac1, 0xbe3298e1, 0x07122852, 0x72bbc0ef, 0xa04e067c, 0x92eae98f},
+{0xfacfba20, 0xbd776166, 0x32b1f491, 0xbda94162, 0x7909d66d, 0x25d8a1a1, 0x2192f380, 0x8fd85dd8,
+0x1275d68d, 0x0bf5973b, 0x7b5b9ab6, 0xca56c719, 0xcb3fb9e9, 0x144cb34f, 0xafb2fff6, 0x90e00591},
+{0xbe58ad71, 0x8f763889, 0xcf9a3a20, 0xbb30d1f5, 0x29de8c38, 0x0a05fe96, 0x28dec3e3, 0x7778a78c,
+0xfd9f43ac, 0x3b513fc1, 0xff24ac56, 0x87b38411, 0xf2ff5800, 0xf7098e12, 0xb5a5b22f, 0x34626d9a},
+{0x48ed1367, 0x92b072dd, 0x3d031297, 0x9c02cedd, 0xb38e947e, 0xfdb0a5a0, 0xa82f6607, 0x0d207580,
+0xf693d28e, 0x97607326, 0x73d7045f, 0x4bf8e9d4, 0x7806a821, 0x249d105e, 0x9f2e5ae6, 0x7f6f578e},
+{0xb15cb0a8, 0xe1c74aca, 0x59af20f2, 0x557e6c70, 0x33dd830d, 0x02cead82, 0xf4baaf3f, 0x42a4634a,
+0xe0da513c, 0xb2f7ccf5, 0x638fc0a9, 0xf4fa5d59, 0xa39f43ce, 0x8cdc23a3, 0x811e89b0, 0xb239264b},
+{0x48e82495, 0xb30f1951, 0x980ade7a, 0x0f7f6787, 0x8f7226b5, 0xed1ed050, 0xfa8c13a7, 0xc1964e0e,
+0xddab5f2c, 0x248b057c, 0x5ee35b01, 0x74d4e362, 0x3b8e224c, 0x9b019bbf, 0x01c21ffe, 0x9bc30516},
+{0x1d66e242, 0xaaa02855, 0xe3e64e20, 0xd114895e, 0x981ff163, 0xa4e1409d, 0x59373163, 0x7c636cdc,
+0xbda86be3, 0x22e7130e, 0xe9c411dc, 0x772062de, 0xfd6a1c16, 0x3be6c1ef, 0x952cc272, 0x7274a8e2},
+{0x1b2aea68, 0xf9668526, 0x3fada381, 0x6facbc2b, 0x23cd513e, 0xce134bef, 0xfa35ca7b, 0xc7abfc5c,
+0x92658c1c, 0xa1b5abd1, 0xd19d0eb0, 0xbc85b730, 0x29a3ccc5, 0xcfc5fba0, 0x38f755d9, 0x8758b7f1},
+{0xeb777697, 0x6eb52dd9, 0x55333c65, 0x8e30ca87, 0xbd496935, 0x2ec4adac, 0x5138c61f, 0x0278107b,
+0x00fc31a9, 0x809bd735, 0x907f17ba, 0xd450e064, 0x0927f99f, 0xb4e62680, 0x280282a7, 0xb5fe260e},
+{0x957b0a0d, 0x30663648, 0xf7643745, 0xf0d9b655, 0x46614891, 0x2a0b0c46, 0x2c4e3f25, 0x40e94e24,
+0xa60e3e05, 0x8d58f6f5, 0xe5a1d66c, 0x6d731d6f, 0xbd3e84df, 0xece08e1d, 0xab745c23, 0x169ee313},
+{0x15544867, 0x4005def4, 0x4403863c, 0x41133d51, 0xb15f58e4, 0xc0e4fbdc, 0x3d958a99, 0x5e67d697,
+0xde26e2cf, 0x410a4e8e, 0x82703792, 0x292dff5f, 0xd4843ba9, 0xe043d144, 0xa61301e9, 0x1d22c149},
+{0x35d63671, 0x87fa81c7, 0xf2eb49a9, 0x64885362, 0x3d7eb3c1, 0xf5eb487f, 0x457b84df, 0xf1a5eae5,
+0xaf57dca7, 0x1f664b95, 0x1b62afc2, 0xa394ce9c, 0xa22c8191, 0x9a8940fe, 0xcb8cb5b4, 0x0aebc938},
+{0xbb8c8298, 0xda173e1e, 0xac647203, 0xe4573e3a, 0xac6e28c8, 0x2bd53450, 0x7601ba84, 0xfa7ea771,
+0xd1f4270c, 0xfd9d7678, 0x063fa89b, 0x432bed96, 0xeb2b23ae, 0xd71af888, 0xc620fd3e, 0xdb11b810},
+{0x0153a230, 0x76205b8f, 0x20dd1a21, 0xe7b7f86f, 0x83c0c37e, 0xd3ae5d6d, 0x32c2827d, 0x5c1048a5,
+0xbc73a533, 0x2cf3d4d1, 0x98a8b3ad, 0x91ffb641, 0x0f3e2ad0, 0xbf2469c7, 0x2680c891, 0x6859fc33},
+{0x34087a25, 0xe19a13e9, 0x1ec217e7, 0x6e48000d, 0x7af20404, 0x30646a48, 0xdbd1bc55, 0xd43e05cd,
+0x86e439bc, 0x70fefab9, 0x1320dc1c, 0x67f66a71, 0x2483c19f, 0xd0b7b242, 0x58089217, 0x0aee0025},
+{0x710f1026, 0xddc3c419, 0xca267c4a, 0x946f2362, 0xa753c190, 0x0604b808, 0xfecee2e7, 0x0a34bb13,
+0x837b4596, 0xbc660551, 0x0ee17558, 0xd9411cfe, 0xc15f0f55, 0x0c1eaf02, 0xe08a903c, 0x1d69732c},
+{0xe954d499, 0x18dc08e5, 0x3b5fc120, 0x1ad0c60f, 0xf97cf585, 0x387e34d2, 0xa6e09ab5, 0xddb618eb,
+0x0acb5dd3, 0xeb60973f, 0xd770812b, 0x54abb29e, 0x7192db95, 0x8c2095c6, 0x6d221978, 0x7459f30c},
+{0x48506a70, 0x4b215fcf, 0xe7271fac, 0x8758bf9a, 0xc0cabb2b, 0xad70fba2, 0x1d06f3fe, 0x0e7ac39f,
+0x100ae7a9, 0x1455fa0e, 0x763c7a81, 0x93464741, 0xedcd7892, 0x2d0ac5ea, 0x94c7a28d, 0x25717899},
+{0xb26b64f1, 0x5cf39944, 0xf5476d99, 0xb7edcf28, 0x2511e59d, 0xd4cda4c6, 0x1b58f010, 0x7175407f,
+0xb24234d5, 0x426e7efa, 0x74471d2a, 0xb01fe8b7, 0x134cc86e, 0xf36d3401, 0x44e3d550, 0x43b45543},
+{0x700952ef, 0xaef3ddcc, 0x53ca9141, 0x3297f9bd, 0x553aeada, 0x2dd28fd1, 0xb0ccd48e, 0x1cc817b6,
+0x127f538e, 0x26b1dd83, 0x783d6a22, 0xcbe309dd, 0x75033d5a, 0xe444283c, 0xda85c29c, 0x1e3e58c7},
+{0xd7721115, 0x5884159b, 0xb8e16dc1, 0xb3664810, 0x6135a62f, 0xfa819d53, 0x217ddb87, 0x60cac14d,
+0xfb69e482, 0x4b5e3471, 0xd20bcad2, 0x5d330d63, 0x6976f1d0, 0x455ee5d2, 0x4e25e444, 0xc2feb935},
+{0x959bacad, 0x53d48500, 0x602a2a3d, 0x339b127a, 0xe641cb81, 0x1448bef4, 0x7e0dae3e, 0xefa53f42,
+0xca6afd2a, 0xcfa2a15e, 0x891f9e25, 0x25d7c847, 0xdd949df7, 0x07a27e70, 0xa2bb65c7, 0x6f5bbae1},
+{0x3dcbe5dd, 0x7ca3deea, 0xd03eb4fb, 0xace67db5, 0xbe39c4d5, 0x1cc96933, 0x7a56a16d, 0xe10e89b8,
+0x3d1806cd, 0xb99d5043, 0xe1466a33, 0xe8319ac5, 0x651b1e7a, 0xae56fa13, 0x4498cb19, 0x8e4cd19d},
+{0x122f0f71, 0x4f085199, 0x564b3619, 0x98bff21d, 0xea1344f7, 0x3c554918, 0xc729f953, 0x80f118a6,
+0x1f1a9ca2, 0x26207c60, 0x04b6563d, 0x2b6624a1, 0x9dde7fed, 0x92af032f, 0x7756af48, 0x43c9408c},
+{0x76a4596c, 0xe43fd414, 0x74f4fbe9, 0xd07984ed, 0x1a03d271, 0xe10744cc, 0x1fa88c85, 0x3fa3a959,
+0x4a7b42a2, 0x0d42f716, 0x30883954, 0xeb89fca4, 0x3a788f67, 0xb1eb18b2, 0xbc60f121, 0x7d47da22},
+{0x5ff781ed, 0x5408c204, 0x7687900e, 0x670205a7, 0x117953b2, 0x44f2847c, 0x9789510c, 0x38c5897a,
+0xfd6f3968, 0x9fe387c9, 0x1caefd1b, 0xffeb4826, 0x23ca7311, 0x1b4d3164, 0x6dfb3c09, 0x947858d5},
+{0x0cc1b9ed, 0xcfb4a087, 0x6b53beb2, 0xa9dee862, 0xd51620bc, 0x0bd8e3ae, 0x0980e5f2, 0x6e7f11c8,
+0x07ee8b3e, 0x28c8a205, 0x7c8e24b9, 0xd05f9ae5, 0xb355f0d8, 0xded3a615, 0x3b8aca26, 0x1498b6f1},
+{0xfbadaf91, 0xe6a6d143, 0x39e47148, 0xe45af203, 0xd04b9c13, 0x9bc61b74, 0xd26eaef4, 0x2f92485f,
+0x192d8926, 0x0b6a3795, 0x4a7699fa, 0x126b5cad, 0x7fc6f4ba, 0x1a176233, 0xf3824ca8, 0x20070b88},
+{0xdfbb68a2, 0xb79b5ecf, 0x4f279bbd, 0xf6de05e9, 0x7a39847d, 0xb906d78d, 0x79b928bf, 0x197ac92f,
+0x08912f0e, 0x6b38627a, 0xf2096e06, 0x66da353b, 0x80f7fb94, 0xdf136ff1, 0xbdfba5dc, 0xac2b3ffe},
+{0x99b8a0ba, 0x5c8e2b6c, 0x776eafc2, 0xd2cbaabb, 0xbc6bc541, 0x1d2024c2, 0x90d0dc18, 0x75b0fd5a,
+0x609ce2ec, 0xc09ef18e, 0x4031d2f6, 0xfbb2e1eb, 0xfcf1f434, 0xe59d734c, 0x58bf2658, 0x3cf9a44b},
+{0xeebf6bb7, 0x7fa42090, 0x3e8565b4, 0xae040881, 0xae51bf84, 0x09284cf6, 0xe0a29511, 0x27b2b3a4,
+0x1397ec0a, 0xc88b67e5, 0x1b219c9b, 0x7abe3db7, 0xe3bcdb3a, 0xae64b66d, 0x6942800c, 0x800e23b4},
+{0xaeb002a6, 0x2cd59c9d, 0x8e32d04a, 0x5c2c98db, 0xedf6aa05, 0xa7909e91, 0x457716dc, 0x802dddc6,
+0x20a34d02, 0xc1bb3aeb, 0xc7fd6c58, 0x9920e08a, 0xd91be4a0, 0xe4424fea, 0xdb848e62, 0xd46b7e27},
+{0x3c1dbe36, 0xfbc5e2c6, 0x499a8c7d, 0x4e4390f2, 0x7ef771b4, 0x09b89e98, 0x4d2df8fa, 0x03179e31,
+0x48b5ad2b, 0x71871abe, 0x01cbb15e, 0x2276676f, 0x43935012, 0x0fbe6332, 0xb73f95cb, 0xfa461b20},
+{0xc9d36995, 0x24cdcc14, 0x3b97b6e6, 0xc382a77a, 0xbccdefb3, 0x85a6d079, 0x693867e2, 0x7aa61648,
+0xad4e9e90, 0x6fa33dc1, 0x0c210b89, 0x9715b243, 0x99991d1c, 0x6b1d7aee, 0x56c3b7d6, 0x215ea706},
+{0x5ae60ba3, 0xbe35d078, 0x5368c6d6, 0x2717bd73, 0x1d660217, 0x20faebc1, 0x4ea4c464, 0x91b44adb,
+0x5eb7d71b, 0xff0217dd, 0xcbacdb25, 0x64864f81, 0x79db1649, 0xfa5643d7, 0xc58a4774, 0xf9a2a68c},
+{0x5d76033d, 0x315b0d5d, 0x39a2a2e7, 0x1725522c, 0x1270c1dd, 0x8e139689, 0x77e65bb1, 0x97cf990e,
+0x64d34089, 0xab150e3c, 0x0a79cd92, 0xa427e24a, 0x6eb4024e, 0x66a8943c, 0xf39bf3b1, 0x0c6f126a},
+{0x8aa5cd34, 0x2492273c, 0xaeb1ed2f, 0x1c796c26, 0x49711f57, 0xe6e60b49, 0x65551826, 0x10b21046,
+0x0c680613, 0xaf42a154, 0x0fc8d939, 0x6f5b700c, 0x7f0a41dc, 0xb14f59a2, 0x092d9be4, 0xf5498b37},
+{0x1499350d, 0x19756a7c, 0x476127b0, 0x0ce33ac1, 0x2bec1059, 0xddbd9023, 0xf5cce58d, 0x6fca2fe6,
+0x01e0f19f, 0xe0f0f83a, 0x3a3b24b1, 0x903cc85a, 0xf79bb62b, 0xd1f61b64, 0x7b2dadf7, 0x81bf2264},
+{0xace757fe, 0x28c79f0a, 0x2dca79ef, 0x75191457, 0x14761633, 0xd1a6bbbe, 0x4571386b, 0x17b832e4,
+0xcb5b0597, 0xf0a6cf26, 0xac3971a5, 0x92cf246a, 0xc73c3d28, 0x4e6675c1, 0x44c5fcc9, 0x5a7ab536},
+{0x607e5ba7, 0x40b90860, 0xf5c5549b, 0x1aa584bf, 0xe962d92c, 0x57f76e5c, 0x2b4e9144, 0x60d45efb,
+0x0417e3d3, 0xac84af0e, 0x0fae5b6c, 0x248e3dad, 0xe9a1346e, 0x26ee0961, 0x8ba9086c, 0xcaad90be},
+{0x404f423d, 0x8ad7d399, 0x4ab8a5f7, 0x59558598, 0x276ef53c, 0xf714d3fa, 0xe3b32a5b, 0x71c441d7,
+0x07388eb8, 0x495bd4c1, 0xc62bcb6d, 0x164eb4d7, 0x66bb2cda, 0x5140b981, 0xe309896c, 0xf642d5af},
+{0x40aeeec1, 0xa1a6b0ce, 0x8252ed26, 0x861b5597, 0x78eff849, 0x6c5f6de2, 0x18bdaea0, 0xb0fb446d,
+0xcc52cb4b, 0xdd4c2e4e, 0xa94f9a62, 0x614f658c, 0x734823c2, 0x4a02453e, 0xcb570754, 0x44573f4f},
+{0x9d2b66f6, 0x0847b97e, 0xae0e537a, 0xfd9a06ec, 0xe4121630, 0xfb8af82a, 0xe6d8f9a2, 0x2b5a3487,
+0x07fd388f, 0x8bb94c3a, 0xb8a94cb3, 0x55c3d037, 0xfaaca627, 0x53602650, 0x8e0f3281, 0x5bea4f2e},
+{0x716e7b6c, 0x792ea92c, 0xb2c822ff, 0x91a2d0aa, 0x45e2a74b, 0x39af1271, 0x05c8f5f6, 0xadc613ff,
+0xfb00cbf4, 0xe9d9793e, 0x71b4d7a7, 0x31b7a7cc, 0xe38703c1, 0xb5254c04, 0xf22280e9, 0xc97f9a92},
+{0x6f67a7fa, 0xbcee76e7, 0x93b18760, 0x9ed7eba3, 0xa69403a8, 0x2d464f09, 0xd03c30ce, 0xe0f4e23f,
+0x92cd776f, 0x43938577, 0x6d650a84, 0xbaf51315, 0x561b50eb, 0xf7aa6c27, 0x368a21be, 0xf4281bf2},
+{0x93605259, 0x886e0c32, 0x8d59b90b, 0x78df128a, 0x40223094, 0x93eba202, 0x067bef7f, 0x37ac7f14,
+0xda29e74a, 0x83bbbb5d, 0xa76e9b01, 0x5f455f8f, 0xb5ecb4c4, 0x58ba3533, 0x57c1c6bd, 0x288e321f},
+{0x59f54695, 0x1a6d4cb9, 0xa333feec, 0x2332bdb7, 0x872c146a, 0x7fc5f4d0, 0xcaf7a4cc, 0x2b3fefc1,
+0x709faf11, 0x15d04f75, 0xf8978b40, 0xeaf837ac, 0x59909228, 0x28b64297, 0x24602fd5, 0x92e6323d},
+{0x95da59e5, 0x8671b790, 0x0a748575, 0x7aa04ff6, 0xd5d6a26e, 0xc9b59947, 0x3b895a3e, 0x9e7dee38,
+0x53ee485b, 0x3e0fba1a, 0x026ca84f, 0x354a1921, 0x0ac7cc2f, 0xdd1ab3c3, 0x780722a4, 0x49831bfa},
+{0x3cd79f44, 0xf8d19d14, 0x59d0bd87, 0x7bc9f6be, 0x31e36c60, 0xfaad3077, 0x90c75ab2, 0x1c1e6283,
+0x3714ff9f, 0xbba3ba1e, 0x27969b07, 0x1e7bb20b, 0x4d391133, 0x523b1791, 0x9c57b316, 0xa7f4d242},
+{0x1f530fee, 0x93ccad49, 0xfb3b1b98, 0x5ae91d7f, 0xba91bf45, 0x142893fd, 0x570fba39, 0x25898ad2,
+0x1b7180e3, 0x0baa5982, 0xc7c54c52, 0x8a89e34c, 0xf28203db, 0xc9d4aad1, 0xb0267681, 0x2188b6d4}
+};
+
+#endif // #ifdef ECDSA_G_TABLE_HEADER
+
+#if (G_COMB_TEETH * G_COMB_SPACING) < 256
+#error "Comb doesn't cover all 256 bits of the scalar."
+#endif
+
+#endif // #ifndef ECDSA_NO_G_TABLE
+
 /** Convert a point from affine coordinates to Jacobian coordinates. This
   * is very fast.
   * \param out The destination point (in Jacobian coordinates).
@@ -114,6 +310,77 @@ static void affineToJacobian(PointJacobian *out, PointAffine *in)
 	out->z[0] = 1;
 }
 
+/** Add (r = (op1 + op2) modulo #secp256k1_p) two field elements.
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The first 32 byte operand to add. This may alias r.
+  * \param op2 The second 32 byte operand to add. This may alias r or op1.
+  */
+static void addModP(BigNum256 r, BigNum256 op1, BigNum256 op2)
+{
+	bigAddInField(r, op1, op2, &secp256k1_p_field);
+}
+
+/** Subtract (r = (op1 - op2) modulo #secp256k1_p) two field elements.
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The 32 byte operand to subtract from. This may alias r.
+  * \param op2 The 32 byte operand to subtract off op1. This may alias r or
+  *            op1.
+  */
+static void subtractModP(BigNum256 r, BigNum256 op1, BigNum256 op2)
+{
+	bigSubtractInField(r, op1, op2, &secp256k1_p_field);
+}
+
+/** Add (r = (op1 + op2) modulo #secp256k1_n) two scalars.
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The first 32 byte operand to add. This may alias r.
+  * \param op2 The second 32 byte operand to add. This may alias r or op1.
+  */
+static void addModN(BigNum256 r, BigNum256 op1, BigNum256 op2)
+{
+	bigAddInField(r, op1, op2, &secp256k1_n_field);
+}
+
+/** Reduce (r = op1 modulo #secp256k1_n) a 32 byte multi-precision number.
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The 32 byte operand to reduce. This may alias r.
+  */
+static void moduloN(BigNum256 r, BigNum256 op1)
+{
+	bigModuloInField(r, op1, &secp256k1_n_field);
+}
+
+/** Compute the modular inverse (r = op1 ^ (-1) modulo #secp256k1_p) of a
+  * field element. With BIGNUM_GCD_INVERT, bigInvertInField() is used, since
+  * its constant-time GCD is faster than any exponentiation. Otherwise, the
+  * addition chain in bigInvertModP() is used, which is much faster than the
+  * generic exponentiation in bigInvertInField().
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The 32 byte operand to find the inverse of. This may alias r.
+  */
+static void invertModP(BigNum256 r, BigNum256 op1)
+{
+#ifdef BIGNUM_GCD_INVERT
+	bigInvertInField(r, op1, &secp256k1_p_field);
+#else
+	bigInvertModP(r, op1);
+#endif // #ifdef BIGNUM_GCD_INVERT
+}
+
+/** Compute the modular inverse (r = op1 ^ (-1) modulo #secp256k1_n) of a
+  * scalar. This is the same as invertModP(), but for #secp256k1_n.
+  * \param r The 32 byte result will be written into here.
+  * \param op1 The 32 byte operand to find the inverse of. This may alias r.
+  */
+static void invertModN(BigNum256 r, BigNum256 op1)
+{
+#ifdef BIGNUM_GCD_INVERT
+	bigInvertInField(r, op1, &secp256k1_n_field);
+#else
+	bigInvertModN(r, op1);
+#endif // #ifdef BIGNUM_GCD_INVERT
+}
+
 /** Convert a point from Jacobian coordinates to affine coordinates. This
   * is very slow because it involves inversion (division).
   * \param out The destination point (in affine coordinates).
@@ -121,21 +388,300 @@ static void affineToJacobian(PointJacobian *out, PointAffine *in)
   */
 static NOINLINE void jacobianToAffine(PointAffine *out, PointJacobian *in)
 {
-	uint8_t s[32];
-	uint8_t t[32];
+#ifndef ECDSA_COMPLETE_ADDITION
+	BigNum256Storage s;
+#endif // #ifndef ECDSA_COMPLETE_ADDITION
+	BigNum256Storage t;
 
 	out->is_point_at_infinity = in->is_point_at_infinity;
 	// If out->is_point_at_infinity != 0, the rest of this function consists
 	// of dummy operations.
-	bigMultiply(s, in->z, in->z);
-	bigMultiply(t, s, in->z);
-	// Now s = z ^ 2 and t = z ^ 3.
-	bigInvert(s, s);
-	bigInvert(t, t);
-	bigMultiply(out->x, in->x, s);
-	bigMultiply(out->y, in->y, t);
+#ifdef ECDSA_COMPLETE_ADDITION
+	invertModP(t, in->z);
+	bigMultiplyModP(out->x, in->x, t);
+	bigMultiplyModP(out->y, in->y, t);
+#else
+	// Only one (slow) inversion is needed, since z ^ (-2) and z ^ (-3) can
+	// be obtained from z ^ (-1) using (fast) multiplication.
+	invertModP(t, in->z);
+	bigSquareModP(s, t);
+	bigMultiplyModP(t, s, t);
+	// Now s = z ^ (-2) and t = z ^ (-3).
+	bigMultiplyModP(out->x, in->x, s);
+	bigMultiplyModP(out->y, in->y, t);
+#endif // #ifdef ECDSA_COMPLETE_ADDITION
+}
+
+#if !defined(ECDSA_NO_WINDOWED_MULTIPLY) || !defined(ECDSA_NO_G_TABLE)
+
+#ifdef BIGNUM_SIMD_BATCH
+
+/** Finish off batchJacobianToAffine(), once the inverse of every z
+  * component is known. All the multiplications for one step are
+  * independent, so they are done using bigMultiplyModPBatch(). The x and
+  * y components have to be gathered into arrays for that, which needs more
+  * stack than embedded targets can spare, so this is only used if
+  * BIGNUM_SIMD_BATCH is defined.
+  * \param points See batchJacobianToAffine().
+  * \param t Scratch space, with room for count 32 byte numbers.
+  * \param inverse_z The inverses of the z components of the points. These
+  *                  will be overwritten.
+  * \param count The number of points. This must be at least 1 and at most
+  *              #ECDSA_MAX_BATCH_SIZE.
+  */
+static void batchScaleToAffine(PointAffine *points, uint8_t (*t)[32], uint8_t (*inverse_z)[32], uint8_t count)
+{
+	uint8_t x[ECDSA_MAX_BATCH_SIZE * 32];
+	uint8_t y[ECDSA_MAX_BATCH_SIZE * 32];
+	uint8_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		bigAssign(&(x[i * 32]), points[i].x);
+		bigAssign(&(y[i * 32]), points[i].y);
+	}
+#ifdef ECDSA_COMPLETE_ADDITION
+	(void)t;
+	bigMultiplyModPBatch(x, x, inverse_z[0], count);
+	bigMultiplyModPBatch(y, y, inverse_z[0], count);
+#else
+	bigMultiplyModPBatch(t[0], inverse_z[0], inverse_z[0], count);
+	bigMultiplyModPBatch(x, x, t[0], count);
+	bigMultiplyModPBatch(t[0], t[0], inverse_z[0], count);
+	bigMultiplyModPBatch(y, y, t[0], count);
+#endif // #ifdef ECDSA_COMPLETE_ADDITION
+	for (i = 0; i < count; i++)
+	{
+		bigAssign(points[i].x, &(x[i * 32]));
+		bigAssign(points[i].y, &(y[i * 32]));
+	}
+}
+
+#endif // #ifdef BIGNUM_SIMD_BATCH
+
+/** Convert a list of points from Jacobian coordinates to affine coordinates,
+  * using Montgomery's trick, so that only one (slow) inversion is needed for
+  * the whole list, instead of one for each point.
+  * \param points On entry, the x and y fields of each point should contain
+  *               its Jacobian x and y components, and is_point_at_infinity
+  *               should be set appropriately. On exit, the x and y fields
+  *               will contain the affine x and y components.
+  * \param z The Jacobian z components of the points. These will be
+  *          overwritten.
+  * \param prefix Scratch space, with room for count 32 byte numbers.
+  * \param count The number of points. This must be at least 1.
+  */
+static NOINLINE void batchJacobianToAffine(PointAffine *points, uint8_t (*z)[32], uint8_t (*prefix)[32], uint8_t count)
+{
+	BigNum256Storage inverse;
+	BigNum256Storage s;
+#if !defined(ECDSA_COMPLETE_ADDITION) && !defined(BIGNUM_SIMD_BATCH)
+	BigNum256Storage t;
+#endif // #if !defined(ECDSA_COMPLETE_ADDITION) && !defined(BIGNUM_SIMD_BATCH)
+	BigNum256Storage one;
+	uint8_t is_infinity;
+	uint8_t *lookup[2];
+	uint8_t i;
+
+	// The z component of a point at infinity could be 0, which would make
+	// the product of all z components 0. The x and y components of a point
+	// at infinity don't matter, so it's okay to use 1 as its z component.
+	bigSetZero(one);
+	one[0] = 1;
+	lookup[1] = one;
+	for (i = 0; i < count; i++)
+	{
+		// The following line does: "is_infinity = points[i].is_point_at_infinity ? 1 : 0;".
+		is_infinity = (uint8_t)((((uint16_t)(-(int)points[i].is_point_at_infinity)) >> 8) & 1);
+		lookup[0] = z[i];
+		bigAssign(s, lookup[is_infinity]);
+		bigAssign(z[i], s);
+	}
+	// prefix[i] = z[0] x z[1] x ... x z[i].
+	bigAssign(prefix[0], z[0]);
+	for (i = 1; i < count; i++)
+	{
+		bigMultiplyModP(prefix[i], prefix[i - 1], z[i]);
+	}
+	invertModP(inverse, prefix[count - 1]);
+	for (i = (uint8_t)(count - 1); i < count; i--)
+	{
+		// At this point, inverse = (z[0] x z[1] x ... x z[i]) ^ (-1).
+		if (i != 0)
+		{
+			bigMultiplyModP(s, inverse, prefix[i - 1]);
+			bigMultiplyModP(inverse, inverse, z[i]);
+		}
+		else
+		{
+			bigAssign(s, inverse);
+		}
+		// Now s = z[i] ^ (-1).
+#ifdef BIGNUM_SIMD_BATCH
+		// prefix[i] isn't needed any more, so it can hold s until
+		// batchScaleToAffine() uses it.
+		bigAssign(prefix[i], s);
+#elif defined(ECDSA_COMPLETE_ADDITION)
+		bigMultiplyModP(points[i].x, points[i].x, s);
+		bigMultiplyModP(points[i].y, points[i].y, s);
+#else
+		bigSquareModP(t, s);
+		bigMultiplyModP(points[i].x, points[i].x, t);
+		bigMultiplyModP(t, t, s);
+		bigMultiplyModP(points[i].y, points[i].y, t);
+#endif // #ifdef BIGNUM_SIMD_BATCH
+	}
+#ifdef BIGNUM_SIMD_BATCH
+	batchScaleToAffine(points, z, prefix, count);
+#endif // #ifdef BIGNUM_SIMD_BATCH
+}
+
+#endif // #if !defined(ECDSA_NO_WINDOWED_MULTIPLY) || !defined(ECDSA_NO_G_TABLE)
+
+#ifdef ECDSA_COMPLETE_ADDITION
+
+/** If the point p is flagged as the point at infinity, replace its
+  * coordinates with (0, 1, 0), the representation of the point at infinity
+  * which the complete formulae in pointDouble() and pointAdd() expect. This
+  * is done with masking instead of branching, so that it takes the same time
+  * whether p is the point at infinity or not.
+  * \param p The point (in projective coordinates) to normalise.
+  */
+static void normaliseInfinity(PointJacobian *p)
+{
+	uint8_t mask;
+	uint8_t i;
+
+	// The following line does: "mask = p->is_point_at_infinity ? 0x00 : 0xff;".
+	mask = (uint8_t)((((uint16_t)(-(int)p->is_point_at_infinity)) >> 8) ^ 0xff);
+	for (i = 0; i < 32; i++)
+	{
+		p->x[i] &= mask;
+		p->y[i] &= mask;
+		p->z[i] &= mask;
+	}
+	p->y[0] |= (uint8_t)(~mask & 1);
+}
+
+/** Double (p = 2 x p) the point p (which is in projective coordinates),
+  * placing the result back into p.
+  * The formulae for this function were obtained from the article:
+  * "Complete addition formulas for prime order elliptic curves", by
+  * J. Renes, C. Costello and L. Batina, obtained from
+  * https://eprint.iacr.org/2015/1060.pdf on 14-October-2026. See
+  * algorithm 9 ("exception-free point doubling for prime order short
+  * Weierstrass curves with a = 0") from that article. These formulae work
+  * for every point, including the point at infinity, so there are no
+  * special cases.
+  * \param p The point (in projective coordinates) to double.
+  */
+static NOINLINE void pointDouble(PointJacobian *p)
+{
+	BigNum256Storage t0;
+	BigNum256Storage t1;
+	BigNum256Storage t2;
+	BigNum256Storage u;
+
+	normaliseInfinity(p);
+	bigMultiplyModP(u, p->x, p->y);
+	bigSquareModP(t0, p->y);
+	bigMultiplyModP(t1, p->y, p->z);
+	bigSquareModP(t2, p->z);
+	// 3 * b = 21, since b = 7 in secp256k1.
+	bigMultiplySmallModP(t2, t2, 21);
+	bigMultiplySmallModP(p->z, t0, 8);
+	bigMultiplyModP(p->x, t2, p->z);
+	addModP(p->y, t0, t2);
+	bigMultiplyModP(p->z, t1, p->z);
+	bigMultiplySmallModP(t2, t2, 3);
+	subtractModP(t0, t0, t2);
+	bigMultiplyModP(p->y, t0, p->y);
+	addModP(p->y, p->x, p->y);
+	bigMultiplyModP(p->x, t0, u);
+	addModP(p->x, p->x, p->x);
+	p->is_point_at_infinity = bigIsZero(p->z);
+}
+
+/** Add (p1 = p1 + p2) the point p2 to the point p1, storing the result back
+  * into p1.
+  * The formulae for this function were obtained from algorithm 8 ("complete,
+  * mixed point addition for prime order short Weierstrass curves with
+  * a = 0") of the article described in the comments to pointDouble().
+  * Unlike the usual Jacobian formulae, these work when p1 is the point at
+  * infinity and when p1 == p2 or p1 == -p2, so there is no need to redirect
+  * writes or to call pointDouble(). The only case they don't cover is when p2
+  * is the point at infinity; in that case, the sum is calculated anyway
+  * and then discarded using masking. As a result, this always does exactly
+  * the same sequence of field operations, whatever its parameters are.
+  * \param p1 The point (in projective coordinates) to add p2 to.
+  * \param junk Not used; this is only here so that this has the same
+  *             interface as the Jacobian version of pointAdd().
+  * \param p2 The point (in affine coordinates) to add to p1.
+  */
+static NOINLINE void pointAdd(PointJacobian *p1, PointJacobian *junk, PointAffine *p2)
+{
+	PointJacobian sum;
+	BigNum256Storage x2;
+	BigNum256Storage y2;
+	BigNum256Storage t0;
+	BigNum256Storage t1;
+	BigNum256Storage t2;
+	BigNum256Storage t3;
+	BigNum256Storage t4;
+	uint8_t mask;
+	uint8_t i;
+
+	(void)junk;
+	normaliseInfinity(p1);
+	// If p2 is O, its coordinates could be anything (even out of range), so
+	// they are replaced with (0, 0). The sum will be discarded anyway.
+	// The following line does: "mask = p2->is_point_at_infinity ? 0x00 : 0xff;".
+	mask = (uint8_t)((((uint16_t)(-(int)p2->is_point_at_infinity)) >> 8) ^ 0xff);
+	for (i = 0; i < 32; i++)
+	{
+		x2[i] = (uint8_t)(p2->x[i] & mask);
+		y2[i] = (uint8_t)(p2->y[i] & mask);
+	}
+
+	bigMultiplyModP(t0, p1->x, x2);
+	bigMultiplyModP(t1, p1->y, y2);
+	addModP(t3, x2, y2);
+	addModP(t4, p1->x, p1->y);
+	bigMultiplyModP(t3, t3, t4);
+	addModP(t4, t0, t1);
+	subtractModP(t3, t3, t4);
+	bigMultiplyModP(t4, y2, p1->z);
+	addModP(t4, t4, p1->y);
+	bigMultiplyModP(sum.y, x2, p1->z);
+	addModP(sum.y, sum.y, p1->x);
+	bigMultiplySmallModP(t0, t0, 3);
+	// 3 * b = 21, since b = 7 in secp256k1.
+	bigMultiplySmallModP(t2, p1->z, 21);
+	addModP(sum.z, t1, t2);
+	subtractModP(t1, t1, t2);
+	bigMultiplySmallModP(sum.y, sum.y, 21);
+	bigMultiplyModP(sum.x, t4, sum.y);
+	bigMultiplyModP(t2, t3, t1);
+	subtractModP(sum.x, t2, sum.x);
+	bigMultiplyModP(sum.y, sum.y, t0);
+	bigMultiplyModP(t1, t1, sum.z);
+	addModP(sum.y, t1, sum.y);
+	bigMultiplyModP(t0, t0, t3);
+	bigMultiplyModP(sum.z, sum.z, t4);
+	addModP(sum.z, sum.z, t0);
+
+	// p1 + O == p1, so only replace p1 with the sum if p2 isn't O.
+	for (i = 0; i < 32; i++)
+	{
+		p1->x[i] = (uint8_t)((sum.x[i] & mask) | (p1->x[i] & ~mask));
+		p1->y[i] = (uint8_t)((sum.y[i] & mask) | (p1->y[i] & ~mask));
+		p1->z[i] = (uint8_t)((sum.z[i] & mask) | (p1->z[i] & ~mask));
+	}
+	p1->is_point_at_infinity = bigIsZero(p1->z);
 }
 
+#else
+
 /** Double (p = 2 x p) the point p (which is in Jacobian coordinates), placing
   * the result back into p.
   * The formulae for this function were obtained from the article:
@@ -148,8 +694,8 @@ static NOINLINE void jacobianToAffine(PointAffine *out, PointJacobian *in)
   */
 static NOINLINE void pointDouble(PointJacobian *p)
 {
-	uint8_t t[32];
-	uint8_t u[32];
+	BigNum256Storage t;
+	BigNum256Storage u;
 
 	// If p->is_point_at_infinity != 0, then the rest of this function will
 	// consist of dummy operations. Nothing else needs to be done since
@@ -160,31 +706,26 @@ static NOINLINE void pointDouble(PointJacobian *p)
 	// function will consist of dummy operations.
 	p->is_point_at_infinity |= bigIsZero(p->y);
 
-	bigMultiply(p->z, p->z, p->y);
-	bigAdd(p->z, p->z, p->z);
-	bigMultiply(p->y, p->y, p->y);
-	bigMultiply(t, p->y, p->x);
-	bigAdd(t, t, t);
-	bigAdd(t, t, t);
+	bigMultiplyModP(p->z, p->z, p->y);
+	addModP(p->z, p->z, p->z);
+	bigSquareModP(p->y, p->y);
+	bigMultiplyModP(t, p->y, p->x);
+	bigMultiplySmallModP(t, t, 4);
 	// t is now 4.0 * p->x * p->y ^ 2.
-	bigMultiply(p->x, p->x, p->x);
-	bigAssign(u, p->x);
-	bigAdd(u, u, u);
-	bigAdd(u, u, p->x);
+	bigSquareModP(p->x, p->x);
+	bigMultiplySmallModP(u, p->x, 3);
 	// u is now 3.0 * p->x ^ 2.
 	// For curves with a != 0, a * p->z ^ 4 needs to be added to u.
 	// But since a == 0 in secp256k1, we save 2 squarings and 1
 	// multiplication.
-	bigMultiply(p->x, u, u);
-	bigSubtract(p->x, p->x, t);
-	bigSubtract(p->x, p->x, t);
-	bigSubtract(t, t, p->x);
-	bigMultiply(t, t, u);
-	bigMultiply(p->y, p->y, p->y);
-	bigAdd(p->y, p->y, p->y);
-	bigAdd(p->y, p->y, p->y);
-	bigAdd(p->y, p->y, p->y);
-	bigSubtract(p->y, t, p->y);
+	bigSquareModP(p->x, u);
+	subtractModP(p->x, p->x, t);
+	subtractModP(p->x, p->x, t);
+	subtractModP(t, t, p->x);
+	bigMultiplyModP(t, t, u);
+	bigSquareModP(p->y, p->y);
+	bigMultiplySmallModP(p->y, p->y, 8);
+	subtractModP(p->y, t, p->y);
 }
 
 /** Add (p1 = p1 + p2) the point p2 to the point p1, storing the result back
@@ -202,10 +743,10 @@ static NOINLINE void pointDouble(PointJacobian *p)
   */
 static NOINLINE void pointAdd(PointJacobian *p1, PointJacobian *junk, PointAffine *p2)
 {
-	uint8_t s[32];
-	uint8_t t[32];
-	uint8_t u[32];
-	uint8_t v[32];
+	BigNum256Storage s;
+	BigNum256Storage t;
+	BigNum256Storage u;
+	BigNum256Storage v;
 	uint8_t is_O;
 	uint8_t is_O2;
 	uint8_t cmp_xs;
@@ -232,10 +773,10 @@ static NOINLINE void pointAdd(PointJacobian *p1, PointJacobian *junk, PointAffin
 	p1 = lookup[is_O2];
 	lookup[0] = p1; // p1 might have changed
 
-	bigMultiply(s, p1->z, p1->z);
-	bigMultiply(t, s, p1->z);
-	bigMultiply(t, t, p2->y);
-	bigMultiply(s, s, p2->x);
+	bigSquareModP(s, p1->z);
+	bigMultiplyModP(t, s, p1->z);
+	bigMultiplyModP(t, t, p2->y);
+	bigMultiplyModP(s, s, p2->x);
 	// The following two lines do: "cmp_xs = bigCompare(p1->x, s) == BIGCMP_EQUAL ? 0 : 0xff;".
 	cmp_xs = (uint8_t)(bigCompare(p1->x, s) ^ BIGCMP_EQUAL);
 	cmp_xs = (uint8_t)(((uint16_t)(-(int)cmp_xs)) >> 8);
@@ -246,116 +787,1121 @@ static NOINLINE void pointAdd(PointJacobian *p1, PointJacobian *junk, PointAffin
 	// so its existence doesn't compromise timing regularity.
 	if ((cmp_xs | cmp_yt | is_O | is_O2) == 0)
 	{
-		// Points are actually the same; use point doubling.
-		pointDouble(p1);
+		// Points are actually the same; use point doubling.
+		pointDouble(p1);
+		return;
+	}
+	// p2 == -p1 when p1->x == s and p1->y != t.
+	// If p1->is_point_at_infinity is set, then all subsequent operations in
+	// this function become dummy operations.
+	p1->is_point_at_infinity = (uint8_t)(p1->is_point_at_infinity | (~cmp_xs & cmp_yt & 1));
+	subtractModP(s, s, p1->x);
+	// s now contains p2->x * p1->z ^ 2 - p1->x.
+	subtractModP(t, t, p1->y);
+	// t now contains p2->y * p1->z ^ 3 - p1->y.
+	bigMultiplyModP(p1->z, p1->z, s);
+	bigSquareModP(v, s);
+	bigMultiplyModP(u, v, p1->x);
+	bigSquareModP(p1->x, t);
+	bigMultiplyModP(s, s, v);
+	subtractModP(p1->x, p1->x, s);
+	subtractModP(p1->x, p1->x, u);
+	subtractModP(p1->x, p1->x, u);
+	subtractModP(u, u, p1->x);
+	bigMultiplyModP(u, u, t);
+	bigMultiplyModP(s, s, p1->y);
+	subtractModP(p1->y, u, s);
+}
+
+#endif // #ifdef ECDSA_COMPLETE_ADDITION
+
+#ifdef TEST_ECDSA
+/** Set the current field parameters (see bigSetField()) to be those defined
+  * by the prime number p which is used in secp256k1. Only the tests need
+  * this; everything else in this file passes #secp256k1_p_field or
+  * #secp256k1_n_field explicitly. */
+static void setFieldToP(void)
+{
+	bigSetField(secp256k1_p, secp256k1_complement_p, sizeof(secp256k1_complement_p));
+}
+#endif // #ifdef TEST_ECDSA
+
+/** Set the current field parameters (see bigSetField()) to be those defined
+  * by the prime number n which is used in secp256k1. This is for callers
+  * which use bigAdd() etc.; new code should pass #secp256k1_n_field to the
+  * "InField" functions instead. */
+void setFieldToN(void)
+{
+	bigSetField(secp256k1_n, secp256k1_complement_n, sizeof(secp256k1_complement_n));
+}
+
+#ifndef ECDSA_NO_WINDOWED_MULTIPLY
+
+/** Number of points in the table built by buildWindowTable(). pointMultiply()
+  * uses signed 4 bit window digits, which range from -8 to 8, so
+  * only 1P ... 8P need to be stored. */
+#define WINDOW_TABLE_SIZE		8
+
+#if defined(BIGNUM_SIMD_BATCH) && (WINDOW_TABLE_SIZE > ECDSA_MAX_BATCH_SIZE)
+#error "WINDOW_TABLE_SIZE too big for batchScaleToAffine()"
+#endif // #if defined(BIGNUM_SIMD_BATCH) && (WINDOW_TABLE_SIZE > ECDSA_MAX_BATCH_SIZE)
+
+/** Build the table of small multiples of a point used by pointMultiply().
+  * The multiples are calculated in Jacobian coordinates and then
+  * converted to affine coordinates all at once, so that only
+  * one (slow) inversion is needed for the whole table.
+  * \param table The table will be written here. table[i] will be set
+  *              to (i + 1) x p, for i = 0 to #WINDOW_TABLE_SIZE - 1.
+  * \param p The point (in affine coordinates) to build the table for.
+  */
+static NOINLINE void buildWindowTable(PointAffine *table, PointAffine *p)
+{
+	PointJacobian current;
+	PointJacobian junk;
+	uint8_t z[WINDOW_TABLE_SIZE][32];
+	uint8_t prefix[WINDOW_TABLE_SIZE][32];
+	uint8_t i;
+
+	memset(&junk, 0, sizeof(PointJacobian));
+	affineToJacobian(&current, p);
+	for (i = 0; i < WINDOW_TABLE_SIZE; i++)
+	{
+		// None of these additions can be point doublings in disguise.
+		if (i == 1)
+		{
+			pointDouble(&current);
+		}
+		else if (i > 1)
+		{
+			pointAdd(&current, &junk, p);
+		}
+		bigAssign(table[i].x, current.x);
+		bigAssign(table[i].y, current.y);
+		bigAssign(z[i], current.z);
+		table[i].is_point_at_infinity = current.is_point_at_infinity;
+	}
+	batchJacobianToAffine(table, z, prefix, WINDOW_TABLE_SIZE);
+}
+
+/** Select (out = digit x P) a multiple of P from the table built by
+  * buildWindowTable(), in a way which does not depend on digit. Every entry
+  * of the table is read, so that memory access patterns don't leak digit.
+  * \param out The selected point will be written here.
+  * \param table The table built by buildWindowTable().
+  * \param digit The multiple to select, in the range -8 to 8 inclusive,
+  *              represented in two's complement.
+  */
+static void selectWindowTable(PointAffine *out, PointAffine *table, uint8_t digit)
+{
+	uint8_t sign;
+	uint8_t magnitude;
+	uint8_t diff;
+	uint8_t mask;
+	uint8_t i;
+	uint8_t j;
+	uint8_t *src;
+	uint8_t *dest;
+	BigNum256Storage y;
+	BigNum256Storage negated_y;
+	uint8_t *lookup[2];
+
+	sign = (uint8_t)(digit >> 7);
+	// The following line does: "magnitude = sign ? -digit : digit;".
+	magnitude = (uint8_t)((digit ^ (uint8_t)(-(int)sign)) + sign);
+	memset(out, 0, sizeof(PointAffine));
+	dest = (uint8_t *)out;
+	for (i = 0; i < WINDOW_TABLE_SIZE; i++)
+	{
+		diff = (uint8_t)((i + 1) ^ magnitude);
+		// The following line does: "mask = (diff == 0) ? 0xff : 0;".
+		mask = (uint8_t)((((uint16_t)(-(int)diff)) >> 8) ^ 0xff);
+		src = (uint8_t *)&(table[i]);
+		for (j = 0; j < sizeof(PointAffine); j++)
+		{
+			dest[j] |= (uint8_t)(src[j] & mask);
+		}
+	}
+	// The following line does: "if (magnitude == 0) out->is_point_at_infinity = 1;".
+	out->is_point_at_infinity |= (uint8_t)(((((uint16_t)(-(int)magnitude)) >> 8) & 1) ^ 1);
+	// -(x, y) = (x, -y). y is never 0, since secp256k1 has no points of
+	// order 2.
+	bigAssign(y, out->y);
+	bigSubtractNoModulo(negated_y, (BigNum256)secp256k1_p, y);
+	lookup[0] = y;
+	lookup[1] = negated_y;
+	bigAssign(out->y, lookup[sign]);
+}
+
+/** Recode a scalar into signed 4 bit window digits in the range -8 to 8,
+  * such that k = digits[0] + digits[1] x 16 + digits[2] x 16 ^ 2 + ...
+  * Like everything else used by pointMultiply(), this is done without
+  * branches which depend on k.
+  * \param digits The digits will be written here, in two's complement,
+  *               least significant first. This must have space for
+  *               size x 2 + 1 digits.
+  * \param k The multi-precision scalar to recode.
+  * \param size The size of k, in number of bytes.
+  */
+static void recodeWindowDigits(uint8_t *digits, uint8_t *k, uint8_t size)
+{
+	uint8_t nibble;
+	uint8_t carry;
+	uint8_t i;
+
+	carry = 0;
+	for (i = 0; i < (uint8_t)(size * 2); i++)
+	{
+		nibble = (uint8_t)(((k[i >> 1] >> ((i & 1) << 2)) & 0x0f) + carry);
+		// nibble is now in the range 0 to 16. If nibble >= 8, use
+		// nibble - 16 as the digit and carry 1 into the next digit.
+		carry = (uint8_t)((nibble + 8) >> 4);
+		digits[i] = (uint8_t)(nibble - (carry << 4));
+	}
+	digits[size * 2] = carry;
+}
+
+/** Perform scalar multiplication (p = k x p) of the point p by the scalar k.
+  * The result will be stored back into p. The multiplication is
+  * accomplished using a fixed window method: k is split into 65 signed
+  * 4 bit digits, and for each digit, the accumulator is doubled 4 times
+  * then the appropriate multiple of p (from a table of 1p ... 8p) is
+  * added. This needs only 65 point additions, instead of 256 for the
+  * bit-at-a-time method. All multi-precision integer operations are done
+  * under the prime finite field specified by #secp256k1_p.
+  *
+  * The special case in pointAdd() (adding a point to itself) can only
+  * happen for a handful of scalars extremely close to #secp256k1_n, and
+  * the result is still correct in that case.
+  *
+  * If ECDSA_NO_WINDOWED_MULTIPLY is defined, the slower bit-at-a-time
+  * method is used instead, which needs about 1 kilobyte less RAM.
+  * \param p The point (in affine coordinates) to multiply.
+  * \param k The 32 byte multi-precision scalar to multiply p by.
+  */
+void pointMultiply(PointAffine *p, BigNum256 k)
+{
+	PointJacobian accumulator;
+	PointJacobian junk;
+	PointAffine table[WINDOW_TABLE_SIZE];
+	PointAffine selected;
+	uint8_t digits[65];
+	uint8_t i;
+	uint8_t j;
+
+	CLOCK_BOOST_BEGIN();
+	memset(&accumulator, 0, sizeof(PointJacobian));
+	memset(&junk, 0, sizeof(PointJacobian));
+	buildWindowTable(table, p);
+	recodeWindowDigits(digits, k, 32);
+	// As with the bit-at-a-time method, dummy operations make this a
+	// constant time operation. See the comments in the
+	// ECDSA_NO_WINDOWED_MULTIPLY version below.
+	accumulator.is_point_at_infinity = 1;
+	for (i = 64; i < 65; i--)
+	{
+		// This branch doesn't depend on k; it just skips doubling the point
+		// at infinity.
+		if (i != 64)
+		{
+			for (j = 0; j < 4; j++)
+			{
+				pointDouble(&accumulator);
+			}
+		}
+		selectWindowTable(&selected, table, digits[i]);
+		pointAdd(&accumulator, &junk, &selected);
+		BACKGROUND_YIELD();
+	}
+	jacobianToAffine(p, &accumulator);
+	CLOCK_BOOST_END();
+}
+
+#else
+
+/** Perform scalar multiplication (p = k x p) of the point p by the scalar k.
+  * The result will be stored back into p. The multiplication is
+  * accomplished by repeated point doubling and adding of the
+  * original point. All multi-precision integer operations are done under
+  * the prime finite field specified by #secp256k1_p.
+  * \param p The point (in affine coordinates) to multiply.
+  * \param k The 32 byte multi-precision scalar to multiply p by.
+  */
+void pointMultiply(PointAffine *p, BigNum256 k)
+{
+	PointJacobian accumulator;
+	PointJacobian junk;
+	PointAffine always_point_at_infinity; // for dummy operations
+	uint8_t i;
+	uint8_t j;
+	uint8_t one_byte;
+	uint8_t one_bit;
+	PointAffine *lookup_affine[2];
+
+	CLOCK_BOOST_BEGIN();
+	memset(&accumulator, 0, sizeof(PointJacobian));
+	memset(&junk, 0, sizeof(PointJacobian));
+	memset(&always_point_at_infinity, 0, sizeof(PointAffine));
+	// Dummy operations are used to make point multiplication a constant
+	// time operation. However, the use of dummy operations does make this
+	// code more susceptible to fault analysis - by introducing faults where
+	// dummy operations may occur, an attacker can determine whether bits in
+	// the private key are set or not. So the use of this code is not
+	// appropriate in situations where fault analysis can occur; use
+	// pointMultiplyLadder() instead, which has no dummy operations (and
+	// with co-Z arithmetic, is actually a bit faster than this).
+	accumulator.is_point_at_infinity = 1;
+	always_point_at_infinity.is_point_at_infinity = 1;
+	lookup_affine[1] = p;
+	lookup_affine[0] = &always_point_at_infinity;
+	for (i = 31; i < 32; i--)
+	{
+		one_byte = k[i];
+		for (j = 0; j < 8; j++)
+		{
+			pointDouble(&accumulator);
+			one_bit = (uint8_t)((one_byte & 0x80) >> 7);
+			pointAdd(&accumulator, &junk, lookup_affine[one_bit]);
+			one_byte = (uint8_t)(one_byte << 1);
+		}
+		BACKGROUND_YIELD();
+	}
+	jacobianToAffine(p, &accumulator);
+	CLOCK_BOOST_END();
+}
+
+#endif // #ifndef ECDSA_NO_WINDOWED_MULTIPLY
+
+#ifndef ECDSA_NO_COZ_LADDER
+
+/** A point on the elliptic curve, in Jacobian coordinates, without its z
+  * component. The Montgomery ladder in pointMultiplyLadder() always keeps
+  * its two points "co-Z" (with the same z component), and the z component
+  * can be recovered at the end, so it never has to be calculated. */
+typedef struct PointCoZStruct
+{
+	/** x component of a point in Jacobian coordinates. */
+	BigNum256Storage x;
+	/** y component of a point in Jacobian coordinates. */
+	BigNum256Storage y;
+} PointCoZ;
+
+/** pointMultiplyLadder() processes a scalar k as k + n or k + 2n, whichever
+  * is in [2 ^ 256, 2 ^ 257). This is what has to be subtracted from the
+  * least significant 256 bits of that to get 0, 1, 2 or 3 when k is
+  * congruent to -2, -1, 0 or 1 (modulo #secp256k1_n). In other words, this
+  * is 2n - 2 ^ 256 - 2. */
+static const BigNum256Storage ladder_exception_base = {
+0x80, 0x82, 0x6c, 0xa0, 0x19, 0xbd, 0xa4, 0x7f,
+0x77, 0x40, 0x91, 0x5e, 0xcd, 0xb9, 0x5d, 0x75,
+0xfd, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+/** Calculate 2 x p and p, such that both have the same z component, using
+  * only the x and y components. This is what starts off the ladder in
+  * pointMultiplyLadder().
+  * The formulae for this function (and the other co-Z functions) were
+  * obtained from the article: "Scalar Multiplication on Weierstrass
+  * Elliptic Curves from Co-Z Arithmetic", by R. R. Goundar, M. Joye,
+  * A. Miyaji, M. Rivain and A. Venelli, obtained from:
+  * http://eprint.iacr.org/2010/309.pdf
+  * on 14-October-2026. See section 4 ("XYCZ-IDBL") of that article. The
+  * z component of both results is 2 x p->y.
+  * \param twice_p The result 2 x p will be written here.
+  * \param same_p The result p will be written here.
+  * \param p The point (in affine coordinates) to double.
+  */
+static NOINLINE void coZInitialDouble(PointCoZ *twice_p, PointCoZ *same_p, PointAffine *p)
+{
+	BigNum256Storage t;
+	BigNum256Storage u;
+
+	bigSquareModP(t, p->y);
+	bigMultiplyModP(same_p->x, t, p->x);
+	bigMultiplySmallModP(same_p->x, same_p->x, 4);
+	// same_p->x is now 4.0 * p->x * p->y ^ 2.
+	bigSquareModP(same_p->y, t);
+	bigMultiplySmallModP(same_p->y, same_p->y, 8);
+	// same_p->y is now 8.0 * p->y ^ 4.
+	bigSquareModP(t, p->x);
+	bigMultiplySmallModP(u, t, 3);
+	// u is now 3.0 * p->x ^ 2 (since a == 0 in secp256k1).
+	bigSquareModP(twice_p->x, u);
+	subtractModP(twice_p->x, twice_p->x, same_p->x);
+	subtractModP(twice_p->x, twice_p->x, same_p->x);
+	subtractModP(t, same_p->x, twice_p->x);
+	bigMultiplyModP(t, t, u);
+	subtractModP(twice_p->y, t, same_p->y);
+}
+
+/** Add (p2 = p1 + p2) two points which have the same z component. p1 is
+  * also updated, so that it has the same z component as the result.
+  * See section 4 ("XYCZ-ADD") of the article described in the comments
+  * to coZInitialDouble(). p1 and p2 must not be equal or negatives of each
+  * other, and neither can be the point at infinity.
+  * \param p1 The first point to add. This will be replaced by an
+  *           equivalent point.
+  * \param p2 The second point to add. This will be replaced by the sum.
+  */
+static NOINLINE void coZAdd(PointCoZ *p1, PointCoZ *p2)
+{
+	BigNum256Storage t;
+	BigNum256Storage u;
+	BigNum256Storage v;
+
+	subtractModP(t, p2->x, p1->x);
+	bigSquareModP(t, t);
+	bigMultiplyModP(u, p1->x, t);
+	bigMultiplyModP(t, p2->x, t);
+	// Now u = p1->x * (p2->x - p1->x) ^ 2 and
+	// t = p2->x * (p2->x - p1->x) ^ 2.
+	subtractModP(v, p2->y, p1->y);
+	bigSquareModP(p2->x, v);
+	subtractModP(p2->x, p2->x, u);
+	subtractModP(p2->x, p2->x, t);
+	subtractModP(t, t, u);
+	bigMultiplyModP(p1->y, p1->y, t);
+	bigAssign(p1->x, u);
+	subtractModP(u, u, p2->x);
+	bigMultiplyModP(u, u, v);
+	subtractModP(p2->y, u, p1->y);
+}
+
+/** Calculate p2 = p1 + p2 and p1 = p1 - p2 at the same time, for two
+  * points which have the same z component. Both results will have the
+  * same z component. This is much cheaper than two separate additions,
+  * because most of the work can be shared.
+  * See section 4 ("XYCZ-ADDC") of the article described in the comments
+  * to coZInitialDouble(). p1 and p2 must not be equal or negatives of each
+  * other, and neither can be the point at infinity.
+  * \param p1 The first point. This will be replaced by the difference.
+  * \param p2 The second point. This will be replaced by the sum.
+  */
+static NOINLINE void coZAddConjugate(PointCoZ *p1, PointCoZ *p2)
+{
+	BigNum256Storage t;
+	BigNum256Storage u;
+	BigNum256Storage v;
+	BigNum256Storage w;
+
+	subtractModP(t, p2->x, p1->x);
+	bigSquareModP(t, t);
+	bigMultiplyModP(u, p1->x, t);
+	bigMultiplyModP(t, p2->x, t);
+	// Now u = p1->x * (p2->x - p1->x) ^ 2 and
+	// t = p2->x * (p2->x - p1->x) ^ 2.
+	subtractModP(v, p2->y, p1->y);
+	addModP(w, p2->y, p1->y);
+	subtractModP(t, t, u);
+	bigMultiplyModP(p1->y, p1->y, t);
+	addModP(t, t, u);
+	addModP(t, t, u);
+	// t is now the sum of the two x components, scaled to the new z.
+	bigSquareModP(p2->x, v);
+	subtractModP(p2->x, p2->x, t);
+	bigSquareModP(p1->x, w);
+	subtractModP(p1->x, p1->x, t);
+	subtractModP(t, u, p2->x);
+	bigMultiplyModP(t, t, v);
+	subtractModP(p2->y, t, p1->y);
+	subtractModP(t, p1->x, u);
+	bigMultiplyModP(t, t, w);
+	subtractModP(p1->y, t, p1->y);
+}
+
+/** Perform scalar multiplication (p = k x p) of the point p by the scalar k,
+  * using a Montgomery ladder. The result will be stored back into p. All
+  * multi-precision integer operations are done under the prime finite
+  * field specified by #secp256k1_p.
+  *
+  * This gives the same results as pointMultiply(), but there are no dummy
+  * operations: every point operation contributes to the result. So unlike
+  * pointMultiply(), introducing a fault into any point operation will
+  * corrupt the result, regardless of what k is, and can't be used to find
+  * out bits of k.
+  *
+  * Each bit of k costs one coZAddConjugate() and one coZAdd(), which is 9
+  * multiplications and 5 squarings, compared to 10 multiplications and 7
+  * squarings for one pointDouble() and one pointAdd(). This uses co-Z
+  * arithmetic (see coZInitialDouble()), where the two points of the ladder
+  * always have the same z component. Since the difference of the two points
+  * is always p, the z component (which is needed for conversion to affine
+  * coordinates) can be recovered at the end and never has to be calculated
+  * during the ladder.
+  *
+  * For the ladder to have a fixed number of steps, the most significant
+  * bit of the scalar must be in a fixed position, so k + n or k + 2n is
+  * used as the scalar (that doesn't change the result, because n x p is
+  * the point at infinity). The co-Z formulae don't work for a few scalars
+  * (those congruent to -2, -1, 0 or 1 modulo n), because they lead to
+  * adding a point to itself or to the point at infinity. Those are
+  * detected beforehand, and the answer is substituted at the end without
+  * branching.
+  *
+  * If ECDSA_NO_COZ_LADDER is defined, this function is left out.
+  * \param p The point (in affine coordinates) to multiply.
+  * \param k The 32 byte multi-precision scalar to multiply p by.
+  */
+void pointMultiplyLadder(PointAffine *p, BigNum256 k)
+{
+	PointCoZ r[2];
+	PointCoZ twice_p;
+	BigNum256Storage scalar;
+	BigNum256Storage t;
+	BigNum256Storage u;
+	BigNum256Storage numerator;
+	BigNum256Storage denominator;
+	BigNum256Storage one;
+	uint8_t carry;
+	uint8_t exceptional;
+	uint8_t index;
+	uint8_t is_O;
+	uint8_t b;
+	uint8_t i;
+	uint8_t *lookup[2];
+	uint8_t *select_x[5];
+	uint8_t *select_y[5];
+	uint8_t *select_numerator[5];
+	uint8_t *select_denominator[5];
+
+	CLOCK_BOOST_BEGIN();
+	// scalar = least significant 256 bits of k + n or k + 2n, whichever
+	// is in [2 ^ 256, 2 ^ 257). If k + n carries, that's k + n.
+	carry = bigAddVariableSizeNoModulo(t, k, (BigNum256)secp256k1_n, 32);
+	bigAddVariableSizeNoModulo(u, t, (BigNum256)secp256k1_n, 32);
+	lookup[0] = u;
+	lookup[1] = t;
+	bigAssign(scalar, lookup[carry]);
+	// Work out whether k is one of the scalars which the co-Z formulae can't
+	// handle. index will be 0 if it isn't, or 1 + (scalar - base)
+	// if it is.
+	bigSubtractVariableSizeNoModulo(t, scalar, (BigNum256)ladder_exception_base, 32);
+	exceptional = (uint8_t)(t[0] & 0xfc);
+	for (i = 1; i < 32; i++)
+	{
+		exceptional |= t[i];
+	}
+	// The following line does: "exceptional = exceptional ? 0 : 0xff;".
+	exceptional = (uint8_t)((((uint16_t)(-(int)exceptional)) >> 8) ^ 0xff);
+	index = (uint8_t)((1 + (t[0] & 3)) & exceptional);
+
+	// The most significant bit of the scalar (bit 256) is always set, so
+	// the ladder starts at (p, 2 x p).
+	coZInitialDouble(&(r[1]), &(r[0]), p);
+	memcpy(&twice_p, &(r[1]), sizeof(twice_p));
+	for (i = 255; i > 0; i--)
+	{
+		b = (uint8_t)((scalar[i >> 3] >> (i & 7)) & 1);
+		// At this point, r[1] - r[0] = p. This does r[1 - b] = r[0] + r[1],
+		// r[b] = 2 x r[b].
+		coZAddConjugate(&(r[b]), &(r[1 - b]));
+		coZAdd(&(r[1 - b]), &(r[b]));
+		// This branch doesn't depend on k.
+		if ((i & 7) == 0)
+		{
+			BACKGROUND_YIELD();
+		}
+	}
+	b = (uint8_t)(scalar[0] & 1);
+	coZAddConjugate(&(r[b]), &(r[1 - b]));
+	// Now r[b] is p or -p (depending on b), which means that the z component
+	// can be recovered from p. The final coZAdd() multiplies the z component
+	// by r[1].x - r[0].x, so:
+	// 1 / z = (p->y * r[b].x) / (p->x * r[b].y * (r[1].x - r[0].x)).
+	bigMultiplyModP(numerator, p->y, r[b].x);
+	subtractModP(denominator, r[1].x, r[0].x);
+	bigMultiplyModP(denominator, denominator, r[b].y);
+	bigMultiplyModP(denominator, denominator, p->x);
+	coZAdd(&(r[1 - b]), &(r[b]));
+
+	// Prepare the answers for the exceptional scalars. In Jacobian
+	// coordinates, -2 x p is (twice_p.x, -twice_p.y, 2 x p->y), -p is
+	// (p->x, -p->y, 1) and p is (p->x, p->y, 1).
+	bigSetZero(t);
+	subtractModP(twice_p.y, t, twice_p.y);
+	subtractModP(u, t, p->y);
+	addModP(t, p->y, p->y);
+	bigSetZero(one);
+	one[0] = 1;
+	select_x[0] = r[0].x;
+	select_y[0] = r[0].y;
+	select_numerator[0] = numerator;
+	select_denominator[0] = denominator;
+	// k = -2 (mod n).
+	select_x[1] = twice_p.x;
+	select_y[1] = twice_p.y;
+	select_numerator[1] = one;
+	select_denominator[1] = t;
+	// k = -1 (mod n).
+	select_x[2] = p->x;
+	select_y[2] = u;
+	select_numerator[2] = one;
+	select_denominator[2] = one;
+	// k = 0 (mod n); anything will do, since the result is O.
+	select_x[3] = p->x;
+	select_y[3] = p->y;
+	select_numerator[3] = one;
+	select_denominator[3] = one;
+	// k = 1 (mod n).
+	select_x[4] = p->x;
+	select_y[4] = p->y;
+	select_numerator[4] = one;
+	select_denominator[4] = one;
+	// The following line does: "is_O = (index == 3) ? 1 : 0;".
+	is_O = (uint8_t)(((((uint16_t)(-(int)(index ^ 3))) >> 8) & 1) ^ 1);
+
+	// Convert to affine coordinates. The result can't be written into p
+	// straight away, since some of the selections refer to p.
+	invertModP(denominator, select_denominator[index]);
+	bigMultiplyModP(denominator, denominator, select_numerator[index]);
+	// denominator is now 1 / z.
+	bigSquareModP(t, denominator);
+	bigMultiplyModP(numerator, select_x[index], t);
+	bigMultiplyModP(t, t, denominator);
+	bigMultiplyModP(u, select_y[index], t);
+	bigAssign(p->x, numerator);
+	bigAssign(p->y, u);
+	p->is_point_at_infinity |= is_O;
+	CLOCK_BOOST_END();
+}
+
+#endif // #ifndef ECDSA_NO_COZ_LADDER
+
+#ifndef ECDSA_NO_WINDOWED_MULTIPLY
+
+/** A non-trivial cube root of unity modulo #secp256k1_p. For any point
+  * (x, y) on secp256k1, (beta x x, y) = lambda x (x, y), where lambda is
+  * the corresponding cube root of unity modulo #secp256k1_n. */
+static const BigNum256Storage secp256k1_beta = {
+0xee, 0x01, 0x95, 0x71, 0x28, 0x6c, 0x39, 0xc1,
+0x95, 0x89, 0xf5, 0x12, 0x75, 0x49, 0xf0, 0x9c,
+0xe9, 0x34, 0x34, 0xac, 0x9e, 0x47, 0x64, 0x6e,
+0x10, 0x07, 0x7c, 0x65, 0x2b, 0x6a, 0xe9, 0x7a};
+
+/** #secp256k1_n - lambda. */
+static const BigNum256Storage glv_minus_lambda = {
+0xcf, 0x83, 0x12, 0xb5, 0x10, 0xc8, 0xcf, 0xe0,
+0xc2, 0x39, 0xc7, 0x8e, 0xfc, 0xb9, 0x80, 0xa8,
+0xa4, 0x9b, 0xed, 0x77, 0xfd, 0xe3, 0xd9, 0x5a,
+0x1f, 0xcf, 0xa3, 0x3f, 0xb3, 0x52, 0x9c, 0xac};
+
+/** -b1 (modulo #secp256k1_n), where (a1, b1) and (a2, b2) are the short
+  * basis vectors of the lattice used to split scalars. */
+static const BigNum256Storage glv_minus_b1 = {
+0xc3, 0xe4, 0xbf, 0x0a, 0xa9, 0x7f, 0x54, 0x6f,
+0x28, 0x88, 0x0e, 0x01, 0xd6, 0x7e, 0x43, 0xe4,
+0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+/** -b2 (modulo #secp256k1_n). See #glv_minus_b1. */
+static const BigNum256Storage glv_minus_b2 = {
+0x2c, 0x56, 0xb1, 0x3d, 0xa8, 0xcd, 0x65, 0xd7,
+0x6d, 0x34, 0x74, 0x07, 0xc5, 0x0a, 0x28, 0x8a,
+0xfe, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+/** round(2 ^ 384 x b2 / #secp256k1_n). See #glv_minus_b1. */
+static const BigNum256Storage glv_g1 = {
+0x31, 0xb0, 0xdb, 0x45, 0x9a, 0x20, 0x93, 0xe8,
+0x7f, 0xca, 0xe8, 0x71, 0x14, 0x8a, 0xaa, 0x3d,
+0x15, 0xeb, 0x84, 0x92, 0xe4, 0x90, 0x6c, 0xe8,
+0xcd, 0x6b, 0xd4, 0xa7, 0x21, 0xd2, 0x86, 0x30};
+
+/** round(2 ^ 384 x (-b1) / #secp256k1_n). See #glv_minus_b1. */
+static const BigNum256Storage glv_g2 = {
+0x71, 0x7f, 0xc4, 0x8a, 0xae, 0xb4, 0x71, 0x15,
+0xc6, 0x06, 0xf5, 0x9d, 0xac, 0x08, 0x12, 0x22,
+0xc4, 0xe4, 0xbf, 0x0a, 0xa9, 0x7f, 0x54, 0x6f,
+0x28, 0x88, 0x0e, 0x01, 0xd6, 0x7e, 0x43, 0xe4};
+
+/** Calculate r = round(k x g / 2 ^ 384), where g is one of #glv_g1 or
+  * #glv_g2. The result is always less than 2 ^ 129.
+  * \param r The 32 byte result will be written here.
+  * \param k A 32 byte multi-precision scalar.
+  * \param g The 32 byte constant to multiply k by.
+  */
+static void glvMultiplyShift(BigNum256 r, BigNum256 k, const uint8_t *g)
+{
+	uint8_t full_r[64] WORD_ALIGNED;
+	BigNum256Storage round_bit;
+
+	bigMultiplyVariableSizeNoModulo(full_r, k, 32, (uint8_t *)g, 32);
+	bigSetZero(round_bit);
+	round_bit[0] = (uint8_t)(full_r[47] >> 7);
+	bigSetZero(r);
+	memcpy(r, &(full_r[48]), 16);
+	bigAddVariableSizeNoModulo(r, r, round_bit, 32);
+}
+
+/** Replace a number modulo #secp256k1_n with its absolute value, where
+  * numbers greater than #secp256k1_n / 2 are interpreted as negative.
+  * This is done without branches which depend on x.
+  * \param x The 32 byte number to take the absolute value of.
+  * \return 1 if x was negative, 0 otherwise.
+  */
+static uint8_t glvAbsolute(BigNum256 x)
+{
+	BigNum256Storage half_n;
+	BigNum256Storage original;
+	BigNum256Storage negated;
+	uint8_t is_negative;
+	uint8_t *lookup[2];
+
+	bigShiftRightNoModulo(half_n, (const BigNum256)secp256k1_n);
+	// The following 2 lines do: "is_negative = bigCompare(x, half_n) == BIGCMP_GREATER ? 1 : 0".
+	is_negative = (uint8_t)(bigCompare(x, half_n) ^ BIGCMP_GREATER);
+	is_negative = (uint8_t)((((uint16_t)(-(int)is_negative)) >> 8) + 1);
+	bigAssign(original, x);
+	bigSubtractNoModulo(negated, (BigNum256)secp256k1_n, original);
+	lookup[0] = original;
+	lookup[1] = negated;
+	bigAssign(x, lookup[is_negative]);
+	return is_negative;
+}
+
+/** Split a scalar k into two halves k1 and k2, such that
+  * k = k1 + k2 x lambda (modulo #secp256k1_n), where both k1 and k2 have
+  * absolute values less than 2 ^ 128. The method is the one from
+  * "Faster Point Multiplication on Elliptic Curves with Efficient
+  * Endomorphisms" by R. P. Gallant, R. J. Lambert and S. A. Vanstone, with
+  * the rounding trick used by libsecp256k1 so that no division is needed.
+  * \param k1 The absolute value of k1 (a 32 byte multi-precision number)
+  *           will be written here.
+  * \param k1_is_negative Will be set to 1 if k1 is negative, 0 otherwise.
+  * \param k2 The absolute value of k2 (a 32 byte multi-precision number)
+  *           will be written here.
+  * \param k2_is_negative Will be set to 1 if k2 is negative, 0 otherwise.
+  * \param k The 32 byte multi-precision scalar to split.
+  */
+static void glvSplitScalar(BigNum256 k1, uint8_t *k1_is_negative, BigNum256 k2, uint8_t *k2_is_negative, BigNum256 k)
+{
+	BigNum256Storage reduced_k;
+	BigNum256Storage c1;
+	BigNum256Storage c2;
+
+	moduloN(reduced_k, k);
+	glvMultiplyShift(c1, reduced_k, glv_g1);
+	glvMultiplyShift(c2, reduced_k, glv_g2);
+	bigMultiplyModN(c1, c1, (BigNum256)glv_minus_b1);
+	bigMultiplyModN(c2, c2, (BigNum256)glv_minus_b2);
+	addModN(k2, c1, c2);
+	bigMultiplyModN(k1, k2, (BigNum256)glv_minus_lambda);
+	addModN(k1, k1, reduced_k);
+	*k1_is_negative = glvAbsolute(k1);
+	*k2_is_negative = glvAbsolute(k2);
+}
+
+/** Negate a list of window digits, if required. This is done without
+  * branches which depend on the parameters.
+  * \param digits The digits (in two's complement) to negate.
+  * \param count The number of digits.
+  * \param do_negate 1 to negate the digits, 0 to leave them alone.
+  */
+static void negateWindowDigits(uint8_t *digits, uint8_t count, uint8_t do_negate)
+{
+	uint8_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		digits[i] = (uint8_t)((digits[i] ^ (uint8_t)(-(int)do_negate)) + do_negate);
+	}
+}
+
+#endif // #ifndef ECDSA_NO_WINDOWED_MULTIPLY
+
+/** Perform scalar multiplication (p = k x p) of the point p by the scalar k,
+  * using the secp256k1 endomorphism. This gives the same result as
+  * pointMultiply(), but is faster. k is split into two halves, each about
+  * 128 bits long, so that k x p = k1 x p + k2 x (lambda x p). Since
+  * lambda x (x, y) = (beta x x, y), both halves can share the same table
+  * and the same point doublings. This needs only 128 point doublings
+  * instead of 256 (and 66 point additions, as before).
+  *
+  * Like pointMultiply(), dummy operations are used to make this a
+  * constant time operation, and all multi-precision integer operations
+  * are done under the prime finite field specified by #secp256k1_p. Adding
+  * a point to itself in pointAdd() is possible but will only happen with
+  * negligible probability.
+  *
+  * If ECDSA_NO_WINDOWED_MULTIPLY is defined, this just calls
+  * pointMultiply().
+  * \param p The point (in affine coordinates) to multiply.
+  * \param k The 32 byte multi-precision scalar to multiply p by.
+  */
+void pointMultiplyGLV(PointAffine *p, BigNum256 k)
+{
+#ifdef ECDSA_NO_WINDOWED_MULTIPLY
+	pointMultiply(p, k);
+#else
+	PointJacobian accumulator;
+	PointJacobian junk;
+	PointAffine table[WINDOW_TABLE_SIZE];
+	PointAffine selected;
+	BigNum256Storage k1;
+	BigNum256Storage k2;
+	uint8_t k1_is_negative;
+	uint8_t k2_is_negative;
+	uint8_t digits1[33];
+	uint8_t digits2[33];
+	uint8_t i;
+	uint8_t j;
+
+	CLOCK_BOOST_BEGIN();
+	glvSplitScalar(k1, &k1_is_negative, k2, &k2_is_negative, k);
+	recodeWindowDigits(digits1, k1, 16);
+	recodeWindowDigits(digits2, k2, 16);
+	// Negative halves are dealt with by negating the points that are added,
+	// which is equivalent to negating the digits.
+	negateWindowDigits(digits1, sizeof(digits1), k1_is_negative);
+	negateWindowDigits(digits2, sizeof(digits2), k2_is_negative);
+	memset(&accumulator, 0, sizeof(PointJacobian));
+	memset(&junk, 0, sizeof(PointJacobian));
+	buildWindowTable(table, p);
+	accumulator.is_point_at_infinity = 1;
+	for (i = 32; i < 33; i--)
+	{
+		// This branch doesn't depend on k; it just skips doubling the point
+		// at infinity.
+		if (i != 32)
+		{
+			for (j = 0; j < 4; j++)
+			{
+				pointDouble(&accumulator);
+			}
+		}
+		selectWindowTable(&selected, table, digits1[i]);
+		pointAdd(&accumulator, &junk, &selected);
+		selectWindowTable(&selected, table, digits2[i]);
+		bigMultiplyModP(selected.x, selected.x, (BigNum256)secp256k1_beta);
+		pointAdd(&accumulator, &junk, &selected);
+		BACKGROUND_YIELD();
+	}
+	jacobianToAffine(p, &accumulator);
+	CLOCK_BOOST_END();
+#endif // #ifdef ECDSA_NO_WINDOWED_MULTIPLY
+}
+
+/** Set a point to the base point of secp256k1.
+  * \param p The point to set.
+  */
+void setToG(PointAffine *p)
+{
+	BigNum256Storage buffer;
+	uint8_t i;
+
+	p->is_point_at_infinity = 0;
+	for (i = 0; i < 32; i++)
+	{
+		buffer[i] = LOOKUP_BYTE(secp256k1_Gx[i]);
+	}
+	bigAssign(p->x, (BigNum256)buffer);
+	for (i = 0; i < 32; i++)
+	{
+		buffer[i] = LOOKUP_BYTE(secp256k1_Gy[i]);
+	}
+	bigAssign(p->y, (BigNum256)buffer);
+}
+
+#ifndef ECDSA_NO_G_TABLE
+
+/** Select an entry from #secp256k1_G_comb, in a way which does not depend
+  * on which entry is selected. Every entry of the table is read, so that
+  * memory access patterns don't leak the index.
+  * \param out The selected point will be written here.
+  * \param index Which point to select. If this is 0, the point at infinity
+  *              will be written to out, otherwise entry index - 1 of
+  *              #secp256k1_G_comb will be written to out.
+  */
+static void selectGComb(PointAffine *out, uint8_t index)
+{
+	uint32_t selected[16];
+	uint32_t mask;
+	uint8_t diff;
+	uint8_t i;
+	uint8_t j;
+
+	memset(selected, 0, sizeof(selected));
+	for (i = 1; i < (1 << G_COMB_TEETH); i++)
+	{
+		diff = (uint8_t)(i ^ index);
+		// The following line does: "mask = (diff == 0) ? 0xffffffff : 0;".
+		mask = (uint32_t)(((((uint16_t)(-(int)diff)) >> 8) & 1) - 1);
+		for (j = 0; j < 16; j++)
+		{
+			selected[j] |= LOOKUP_DWORD(secp256k1_G_comb[i - 1][j]) & mask;
+		}
+	}
+	for (j = 0; j < 8; j++)
+	{
+		writeU32LittleEndian(&(out->x[j * 4]), selected[j]);
+		writeU32LittleEndian(&(out->y[j * 4]), selected[j + 8]);
+	}
+	// The following line does: "out->is_point_at_infinity = (index == 0) ? 1 : 0;".
+	out->is_point_at_infinity = (uint8_t)(((((uint16_t)(-(int)index)) >> 8) & 1) ^ 1);
+}
+
+/** Perform scalar multiplication (p = k x G) of the base point G by the
+  * scalar k, leaving the result in Jacobian coordinates. See
+  * ecdsaMultiplyG() for more details.
+  * \param p The result (in Jacobian coordinates) will be written here.
+  * \param k The 32 byte multi-precision scalar to multiply G by. This should
+  *          be less than #secp256k1_n.
+  */
+static void multiplyGJacobian(PointJacobian *p, BigNum256 k)
+{
+	PointJacobian junk;
+	PointAffine selected;
+	uint16_t bit_position;
+	uint8_t index;
+	uint8_t i;
+	uint8_t j;
+
+	CLOCK_BOOST_BEGIN();
+	memset(p, 0, sizeof(PointJacobian));
+	memset(&junk, 0, sizeof(PointJacobian));
+	p->is_point_at_infinity = 1;
+	for (i = G_COMB_SPACING - 1; i < G_COMB_SPACING; i--)
+	{
+		pointDouble(p);
+		index = 0;
+		for (j = 0; j < G_COMB_TEETH; j++)
+		{
+			bit_position = (uint16_t)(i + j * G_COMB_SPACING);
+			// This branch doesn't depend on k.
+			if (bit_position < 256)
+			{
+				index = (uint8_t)(index | (((k[bit_position >> 3] >> (bit_position & 7)) & 1) << j));
+			}
+		}
+		selectGComb(&selected, index);
+		pointAdd(p, &junk, &selected);
+	}
+	CLOCK_BOOST_END();
+}
+
+#endif // #ifndef ECDSA_NO_G_TABLE
+
+/** Perform scalar multiplication (p = k x G) of the base point G by the
+  * scalar k. This gives the same result as calling setToG() and then
+  * pointMultiply(), but is much faster because it uses a fixed-base comb
+  * (see "Fast Implementation of Elliptic Curve Arithmetic in GF(p^n)" by
+  * C. H. Lim and H. S. Hwang). The comb has #G_COMB_TEETH teeth, so only
+  * #G_COMB_SPACING point doublings and additions are needed, instead of 256
+  * of each.
+  *
+  * Like pointMultiply(), dummy operations are used to make this a
+  * constant time operation, and all multi-precision integer operations
+  * are done under the prime finite field specified by #secp256k1_p.
+  * The special case in pointAdd() (adding a point to itself) can't happen,
+  * since the bits of k in the accumulator and the bits of k in a table
+  * entry never overlap.
+  *
+  * If ECDSA_NO_G_TABLE is defined, #secp256k1_G_comb (which occupies about
+  * 4 kilobytes) is left out and this falls back to pointMultiply().
+  * A smaller or larger table can be used instead by defining
+  * ECDSA_G_TABLE_HEADER (see "make tables"); each extra tooth roughly
+  * doubles the table size and saves about 1 / (teeth + 1) of the work.
+  * \param p The result (in affine coordinates) will be written here.
+  * \param k The 32 byte multi-precision scalar to multiply G by. This should
+  *          be less than #secp256k1_n.
+  */
+void ecdsaMultiplyG(PointAffine *p, BigNum256 k)
+{
+#ifdef ECDSA_NO_G_TABLE
+	setToG(p);
+	pointMultiply(p, k);
+#else
+	PointJacobian accumulator;
+
+	multiplyGJacobian(&accumulator, k);
+	jacobianToAffine(p, &accumulator);
+#endif // #ifdef ECDSA_NO_G_TABLE
+}
+
+/** Perform scalar multiplication (out[i] = k_i x G) of the base point G by
+  * a list of scalars. This gives the same results as calling
+  * ecdsaMultiplyG() for each scalar, but is faster, because the
+  * conversions from Jacobian to affine coordinates are done all at once,
+  * using only one inversion.
+  *
+  * If ECDSA_NO_G_TABLE is defined, this just calls ecdsaMultiplyG() for
+  * each scalar.
+  * \param out The results (in affine coordinates) will be written here.
+  *            This must be an array with space for count points.
+  * \param k The list of scalars, as count consecutive 32 byte
+  *          multi-precision numbers. Each one should be less than
+  *          #secp256k1_n.
+  * \param count The number of scalars. This must be no greater than
+  *              #ECDSA_MAX_BATCH_SIZE.
+  */
+void ecdsaMultiplyGBatch(PointAffine *out, uint8_t *k, uint8_t count)
+{
+#ifdef ECDSA_NO_G_TABLE
+	uint8_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		ecdsaMultiplyG(&(out[i]), &(k[i * 32]));
+	}
+#else
+	PointJacobian accumulator;
+	uint8_t z[ECDSA_MAX_BATCH_SIZE][32];
+	uint8_t prefix[ECDSA_MAX_BATCH_SIZE][32];
+	uint8_t i;
+
+	if (count == 0)
+	{
 		return;
 	}
-	// p2 == -p1 when p1->x == s and p1->y != t.
-	// If p1->is_point_at_infinity is set, then all subsequent operations in
-	// this function become dummy operations.
-	p1->is_point_at_infinity = (uint8_t)(p1->is_point_at_infinity | (~cmp_xs & cmp_yt & 1));
-	bigSubtract(s, s, p1->x);
-	// s now contains p2->x * p1->z ^ 2 - p1->x.
-	bigSubtract(t, t, p1->y);
-	// t now contains p2->y * p1->z ^ 3 - p1->y.
-	bigMultiply(p1->z, p1->z, s);
-	bigMultiply(v, s, s);
-	bigMultiply(u, v, p1->x);
-	bigMultiply(p1->x, t, t);
-	bigMultiply(s, s, v);
-	bigSubtract(p1->x, p1->x, s);
-	bigSubtract(p1->x, p1->x, u);
-	bigSubtract(p1->x, p1->x, u);
-	bigSubtract(u, u, p1->x);
-	bigMultiply(u, u, t);
-	bigMultiply(s, s, p1->y);
-	bigSubtract(p1->y, u, s);
+	for (i = 0; i < count; i++)
+	{
+		multiplyGJacobian(&accumulator, &(k[i * 32]));
+		bigAssign(out[i].x, accumulator.x);
+		bigAssign(out[i].y, accumulator.y);
+		bigAssign(z[i], accumulator.z);
+		out[i].is_point_at_infinity = accumulator.is_point_at_infinity;
+	}
+	batchJacobianToAffine(out, z, prefix, count);
+#endif // #ifdef ECDSA_NO_G_TABLE
 }
 
-/** Set field parameters to be those defined by the prime number p which
-  * is used in secp256k1. */
-static void setFieldToP(void)
+/** Calculate p = k x G + q, where G is the base point. This is the operation
+  * needed to derive a child public key from a parent public key (see
+  * bip32DerivePublicChild()), without knowing any private keys. It is much
+  * faster than calling pointMultiply() on the parent public key, because the
+  * multiplication is done using the fixed-base comb (see ecdsaMultiplyG())
+  * and only one more point addition is needed.
+  *
+  * Unlike ecdsaMultiplyG(), this isn't a constant time operation when p
+  * ends up as the point at infinity, or when k x G happens to equal q.
+  * Those cases are only possible if q's discrete logarithm is known, and
+  * the only intended use of this function is with public scalars (the
+  * output of HMAC-SHA512 in BIP32 derivation) anyway.
+  * \param p The result (in affine coordinates) will be written here.
+  * \param k The 32 byte multi-precision scalar to multiply G by. This should
+  *          be less than #secp256k1_n.
+  * \param q The point (in affine coordinates) to add to k x G. This may be
+  *          the same as p.
+  */
+void ecdsaMultiplyGAdd(PointAffine *p, BigNum256 k, PointAffine *q)
 {
-	bigSetField(secp256k1_p, secp256k1_complement_p, sizeof(secp256k1_complement_p));
+	PointJacobian accumulator;
+	PointJacobian junk;
+#ifdef ECDSA_NO_G_TABLE
+	PointAffine product;
+
+	// A separate variable is used for k x G, so that this still works if
+	// p and q point to the same thing.
+	ecdsaMultiplyG(&product, k);
+	affineToJacobian(&accumulator, &product);
+#else
+	multiplyGJacobian(&accumulator, k);
+#endif // #ifdef ECDSA_NO_G_TABLE
+	memset(&junk, 0, sizeof(PointJacobian));
+	pointAdd(&accumulator, &junk, q);
+	jacobianToAffine(p, &accumulator);
 }
 
-/** Set field parameters to be those defined by the prime number n which
-  * is used in secp256k1. */
-void setFieldToN(void)
+/** Instantiate the deterministic random bit generator which produces the
+  * ephemeral private keys ("k") for an ECDSA signature, as described in
+  * RFC 6979, section 3.3a.
+  * \param state The DRBG state to instantiate.
+  * \param hash The message digest of the message to sign, represented as a
+  *             32 byte multi-precision number.
+  * \param private_key The private key to use in the signing operation,
+  *                    represented as a 32 byte multi-precision number.
+  */
+static void nonceInstantiate(HMACDRBGState *state, const BigNum256 hash, const BigNum256 private_key)
 {
-	bigSetField(secp256k1_n, secp256k1_complement_n, sizeof(secp256k1_complement_n));
+	uint8_t seed_material[32 + SHA256_HASH_LENGTH];
+
+	// From RFC 6979, section 3.3a:
+	// seed_material = int2octets(private_key) || bits2octets(hash)
+	// int2octets and bits2octets both interpret the number as big-endian.
+	// However, both the private_key and hash parameters are BigNum256, which
+	// is little-endian.
+	bigAssign(seed_material, private_key);
+	swapEndian256(seed_material); // little-endian -> big-endian
+	bigAssign(&(seed_material[32]), hash);
+	swapEndian256(&(seed_material[32])); // little-endian -> big-endian
+	drbgInstantiate(state, seed_material, sizeof(seed_material));
 }
 
-/** Perform scalar multiplication (p = k x p) of the point p by the scalar k.
-  * The result will be stored back into p. The multiplication is
-  * accomplished by repeated point doubling and adding of the
-  * original point. All multi-precision integer operations are done under
-  * the prime finite field specified by #secp256k1_p.
-  * \param p The point (in affine coordinates) to multiply.
-  * \param k The 32 byte multi-precision scalar to multiply p by.
+/** Generate the next candidate ephemeral private key ("k") for an ECDSA
+  * signature, as described in RFC 6979, section 3.3b.
+  * \param k The candidate will be written here, as a 32 byte
+  *          multi-precision number.
+  * \param state The DRBG state, which must have been instantiated using
+  *              nonceInstantiate().
+  * \return false if k is usable, true if k is out of range and the next
+  *         candidate should be tried.
   */
-void pointMultiply(PointAffine *p, BigNum256 k)
+static bool nonceGenerate(BigNum256 k, HMACDRBGState *state)
 {
-	PointJacobian accumulator;
-	PointJacobian junk;
-	PointAffine always_point_at_infinity; // for dummy operations
-	uint8_t i;
-	uint8_t j;
-	uint8_t one_byte;
-	uint8_t one_bit;
-	PointAffine *lookup_affine[2];
-
-	memset(&accumulator, 0, sizeof(PointJacobian));
-	memset(&junk, 0, sizeof(PointJacobian));
-	memset(&always_point_at_infinity, 0, sizeof(PointAffine));
-	setFieldToP();
-	// The Montgomery ladder method can't be used here because it requires
-	// point addition to be done in pure Jacobian coordinates. Point addition
-	// in pure Jacobian coordinates would make point multiplication about
-	// 26% slower. Instead, dummy operations are used to make point
-	// multiplication a constant time operation. However, the use of dummy
-	// operations does make this code more susceptible to fault analysis -
-	// by introducing faults where dummy operations may occur, an attacker
-	// can determine whether bits in the private key are set or not.
-	// So the use of this code is not appropriate in situations where fault
-	// analysis can occur.
-	accumulator.is_point_at_infinity = 1;
-	always_point_at_infinity.is_point_at_infinity = 1;
-	lookup_affine[1] = p;
-	lookup_affine[0] = &always_point_at_infinity;
-	for (i = 31; i < 32; i--)
+	drbgGenerate(k, state, 32, NULL, 0);
+	// From RFC 6979, section 3.3b, the output of the DRBG is run through
+	// the bits2int function, which interprets the output as a big-endian
+	// integer. However, functions in bignum256.c expect a little-endian
+	// integer.
+	swapEndian256(k); // big-endian -> little-endian
+
+	// This is one of many data-dependent branches in ecdsaSign(). They do
+	// not compromise timing attack resistance because these branches are
+	// expected to occur extremely infrequently.
+	if (bigIsZero(k))
 	{
-		one_byte = k[i];
-		for (j = 0; j < 8; j++)
-		{
-			pointDouble(&accumulator);
-			one_bit = (uint8_t)((one_byte & 0x80) >> 7);
-			pointAdd(&accumulator, &junk, lookup_affine[one_bit]);
-			one_byte = (uint8_t)(one_byte << 1);
-		}
+		return true;
 	}
-	jacobianToAffine(p, &accumulator);
+	if (bigCompare(k, (BigNum256)secp256k1_n) != BIGCMP_LESS)
+	{
+		return true;
+	}
+	return false;
 }
 
-/** Set a point to the base point of secp256k1.
-  * \param p The point to set.
+/** Calculate both halves of an ECDSA signature, given the ephemeral key
+  * pair (k, big_r).
+  * \param r The "r" component of the signature will be written to here as
+  *          a 32 byte multi-precision number.
+  * \param s The "s" component of the signature will be written to here, as
+  *          a 32 byte multi-precision number.
+  * \param big_r k x G, in affine coordinates. This will be overwritten,
+  *              since it is used as a temporary.
+  * \param k The ephemeral private key. This will be overwritten, since it is
+  *          used as a temporary.
+  * \param hash The message digest of the message to sign, represented as a
+  *             32 byte multi-precision number.
+  * \param private_key The private key to use in the signing operation,
+  *                    represented as a 32 byte multi-precision number.
+  * \return false on success, true if r or s turned out to be 0 and the next
+  *         candidate k should be tried.
   */
-void setToG(PointAffine *p)
+static bool signWithNonce(BigNum256 r, BigNum256 s, PointAffine *big_r, BigNum256 k, const BigNum256 hash, const BigNum256 private_key)
 {
-	uint8_t buffer[32];
-	uint8_t i;
-
-	p->is_point_at_infinity = 0;
-	for (i = 0; i < 32; i++)
+	moduloN(r, big_r->x);
+	// r now contains (k * G).x (mod n).
+	if (bigIsZero(r))
 	{
-		buffer[i] = LOOKUP_BYTE(secp256k1_Gx[i]);
+		return true;
 	}
-	bigAssign(p->x, (BigNum256)buffer);
-	for (i = 0; i < 32; i++)
+	bigMultiplyModN(s, r, private_key);
+	moduloN(big_r->y, hash); // use big_r->y as temporary
+	addModN(s, s, big_r->y);
+	invertModN(big_r->y, k);
+	bigMultiplyModN(s, s, big_r->y);
+	// s now contains (hash + (r * private_key)) / k (mod n).
+	if (bigIsZero(s))
 	{
-		buffer[i] = LOOKUP_BYTE(secp256k1_Gy[i]);
+		return true;
 	}
-	bigAssign(p->y, (BigNum256)buffer);
+
+	// Canonicalise s by negating it if s > secp256k1_n / 2.
+	// See https://github.com/bitcoin/bitcoin/pull/3016 for more info.
+	bigShiftRightNoModulo(k, (const BigNum256)secp256k1_n); // use k as temporary
+	if (bigCompare(s, k) == BIGCMP_GREATER)
+	{
+		bigSubtractNoModulo(s, (BigNum256)secp256k1_n, s);
+	}
+	return false;
 }
 
 /** Create a deterministic ECDSA signature of a given message (digest) and
@@ -377,73 +1923,250 @@ void setToG(PointAffine *p)
 void ecdsaSign(BigNum256 r, BigNum256 s, const BigNum256 hash, const BigNum256 private_key)
 {
 	PointAffine big_r;
-	uint8_t k[32];
-	uint8_t seed_material[32 + SHA256_HASH_LENGTH];
+	BigNum256Storage k;
 	HMACDRBGState state;
 
-	// From RFC 6979, section 3.3a:
-	// seed_material = int2octets(private_key) || bits2octets(hash)
-	// int2octets and bits2octets both interpret the number as big-endian.
-	// However, both the private_key and hash parameters are BigNum256, which
-	// is little-endian.
-	bigAssign(seed_material, private_key);
-	swapEndian256(seed_material); // little-endian -> big-endian
-	bigAssign(&(seed_material[32]), hash);
-	swapEndian256(&(seed_material[32])); // little-endian -> big-endian
-	drbgInstantiate(&state, seed_material, sizeof(seed_material));
-
+	TRACE(TRACE_ECDSA_SIGN_BEGIN, 0);
+	CLOCK_BOOST_BEGIN();
+	nonceInstantiate(&state, hash, private_key);
 	while (true)
 	{
-		drbgGenerate(k, &state, 32, NULL, 0);
-		// From RFC 6979, section 3.3b, the output of the DRBG is run through
-		// the bits2int function, which interprets the output as a big-endian
-		// integer. However, functions in bignum256.c expect a little-endian
-		// integer.
-		swapEndian256(k); // big-endian -> little-endian
-
-		// This is one of many data-dependent branches in this function. They do
-		// not compromise timing attack resistance because these branches are
-		// expected to occur extremely infrequently.
-		if (bigIsZero(k))
+		if (nonceGenerate(k, &state))
 		{
 			continue;
 		}
-		if (bigCompare(k, (BigNum256)secp256k1_n) != BIGCMP_LESS)
+		// Compute ephemeral elliptic curve key pair (k, big_r).
+		ecdsaMultiplyG(&big_r, k);
+		// big_r now contains k * G.
+		if (signWithNonce(r, s, &big_r, k, hash, private_key))
 		{
 			continue;
 		}
+		break;
+	}
+	CLOCK_BOOST_END();
+	TRACE(TRACE_ECDSA_SIGN_END, 0);
+}
 
-		// Compute ephemeral elliptic curve key pair (k, big_r).
-		setToG(&big_r);
-		pointMultiply(&big_r, k);
-		// big_r now contains k * G.
-		setFieldToN();
-		bigModulo(r, big_r.x);
-		// r now contains (k * G).x (mod n).
-		if (bigIsZero(r))
+/** Create deterministic ECDSA signatures of a list of message digests, each
+  * with its own private key. This gives exactly the same signatures as
+  * calling ecdsaSign() for each one, but is faster, since the ephemeral
+  * public keys (k x G) are all calculated by one call to
+  * ecdsaMultiplyGBatch(). This is meant for transactions with more than one
+  * input to sign.
+  * \param r The "r" components of the signatures will be written to here,
+  *          as count consecutive 32 byte multi-precision numbers.
+  * \param s The "s" components of the signatures will be written to here,
+  *          as count consecutive 32 byte multi-precision numbers.
+  * \param hashes The message digests of the messages to sign, as count
+  *               consecutive 32 byte multi-precision numbers.
+  * \param private_keys The private keys to use, as count consecutive 32 byte
+  *                     multi-precision numbers.
+  * \param count The number of signatures to create. This must be no greater
+  *              than #ECDSA_MAX_BATCH_SIZE.
+  */
+void ecdsaSignBatch(uint8_t *r, uint8_t *s, uint8_t *hashes, uint8_t *private_keys, uint8_t count)
+{
+	PointAffine big_r[ECDSA_MAX_BATCH_SIZE];
+	uint8_t k[ECDSA_MAX_BATCH_SIZE * 32];
+	bool retry[ECDSA_MAX_BATCH_SIZE];
+	HMACDRBGState state;
+	uint8_t i;
+
+	TRACE(TRACE_ECDSA_SIGN_BEGIN, count);
+	CLOCK_BOOST_BEGIN();
+	for (i = 0; i < count; i++)
+	{
+		nonceInstantiate(&state, &(hashes[i * 32]), &(private_keys[i * 32]));
+		retry[i] = nonceGenerate(&(k[i * 32]), &state);
+		if (retry[i])
 		{
-			continue;
+			// Keep the batch valid; this signature will be redone below.
+			bigSetZero(&(k[i * 32]));
+		}
+	}
+	ecdsaMultiplyGBatch(big_r, k, count);
+	for (i = 0; i < count; i++)
+	{
+		if (retry[i] || signWithNonce(&(r[i * 32]), &(s[i * 32]), &(big_r[i]), &(k[i * 32]), &(hashes[i * 32]), &(private_keys[i * 32])))
+		{
+			// The first candidate k wasn't usable. This is extremely
+			// unlikely, so just start again. Since k is deterministic,
+			// ecdsaSign() will go through the same candidates.
+			ecdsaSign(&(r[i * 32]), &(s[i * 32]), &(hashes[i * 32]), &(private_keys[i * 32]));
 		}
-		bigMultiply(s, r, private_key);
-		bigModulo(big_r.y, hash); // use big_r.y as temporary
-		bigAdd(s, s, big_r.y);
-		bigInvert(big_r.y, k);
-		bigMultiply(s, s, big_r.y);
-		// s now contains (hash + (r * private_key)) / k (mod n).
-		if (bigIsZero(s))
+	}
+	CLOCK_BOOST_END();
+	TRACE(TRACE_ECDSA_SIGN_END, count);
+}
+
+#ifndef ECDSA_NO_WINDOWED_MULTIPLY
+
+/** Add (p1 = p1 + digit x P) a multiple of P, from a table built by
+  * buildWindowTable(), to p1. Unlike selectWindowTable(), this doesn't
+  * attempt to be constant time.
+  * \param p1 The point (in Jacobian coordinates) to add to.
+  * \param junk Pointer to a dummy variable which may receive dummy writes.
+  * \param table The table built by buildWindowTable().
+  * \param digit The multiple to add, in the range -8 to 8 inclusive,
+  *              represented in two's complement.
+  */
+static void addWindowDigit(PointJacobian *p1, PointJacobian *junk, PointAffine *table, uint8_t digit)
+{
+	PointAffine selected;
+
+	if (digit == 0)
+	{
+		return;
+	}
+	if ((digit & 0x80) != 0)
+	{
+		memcpy(&selected, &(table[(uint8_t)(-(int)digit) - 1]), sizeof(PointAffine));
+		bigSubtractNoModulo(selected.y, (BigNum256)secp256k1_p, selected.y);
+	}
+	else
+	{
+		memcpy(&selected, &(table[digit - 1]), sizeof(PointAffine));
+	}
+	pointAdd(p1, junk, &selected);
+}
+
+#endif // #ifndef ECDSA_NO_WINDOWED_MULTIPLY
+
+/** Verify an ECDSA signature. This uses the verification algorithm described
+  * in section 4.1.4 ("Verifying Operation") of the SEC 1 document mentioned
+  * in the comments to ecdsaSign(). The point u1 x G + u2 x Q is
+  * calculated using Shamir's trick: the signed 4 bit window digits of u1
+  * and u2 are interleaved, so that they share one chain of 256 point
+  * doublings.
+  *
+  * Since everything involved in verification is public, this does not
+  * attempt to be constant time.
+  *
+  * If ECDSA_NO_WINDOWED_MULTIPLY is defined, ecdsaMultiplyG() and
+  * pointMultiply() are used to calculate u1 x G and u2 x Q separately,
+  * which is slower but needs less RAM.
+  * \param r The "r" component of the signature, as a 32 byte
+  *          multi-precision number.
+  * \param s The "s" component of the signature, as a 32 byte
+  *          multi-precision number.
+  * \param hash The message digest of the message that was signed,
+  *             represented as a 32 byte multi-precision number.
+  * \param public_key The public key (Q) to verify the signature against.
+  * \return false if the signature is valid, true if it is not.
+  */
+bool ecdsaVerify(BigNum256 r, BigNum256 s, BigNum256 hash, PointAffine *public_key)
+{
+	PointJacobian accumulator;
+	PointJacobian junk;
+	BigNum256Storage u1;
+	BigNum256Storage u2;
+	BigNum256Storage temp;
+	BigNum256Storage temp2;
+#ifdef ECDSA_NO_WINDOWED_MULTIPLY
+	PointAffine u2_q;
+	PointAffine u1_g;
+#else
+	PointAffine g_table[WINDOW_TABLE_SIZE];
+	PointAffine q_table[WINDOW_TABLE_SIZE];
+	PointAffine g;
+	uint8_t u1_digits[65];
+	uint8_t u2_digits[65];
+	uint8_t i;
+	uint8_t j;
+#endif // #ifdef ECDSA_NO_WINDOWED_MULTIPLY
+
+	// r and s must be in [1, n - 1].
+	if (bigIsZero(r) || (bigCompare(r, (BigNum256)secp256k1_n) != BIGCMP_LESS)
+		|| bigIsZero(s) || (bigCompare(s, (BigNum256)secp256k1_n) != BIGCMP_LESS))
+	{
+		return true;
+	}
+	// Q must be on the curve. Because secp256k1 has a prime order, this also
+	// means that n x Q = O.
+	if (public_key->is_point_at_infinity
+		|| (bigCompare(public_key->x, (BigNum256)secp256k1_p) != BIGCMP_LESS)
+		|| (bigCompare(public_key->y, (BigNum256)secp256k1_p) != BIGCMP_LESS))
+	{
+		return true;
+	}
+	bigSquareModP(temp, public_key->x);
+	bigMultiplyModP(temp, temp, public_key->x);
+	addModP(temp, temp, (BigNum256)secp256k1_b);
+	bigSquareModP(temp2, public_key->y);
+	if (bigCompare(temp, temp2) != BIGCMP_EQUAL)
+	{
+		return true;
+	}
+
+	// u1 = hash / s and u2 = r / s (mod n).
+	invertModN(temp, s);
+	moduloN(u1, hash);
+	bigMultiplyModN(u1, u1, temp);
+	bigMultiplyModN(u2, r, temp);
+
+	memset(&junk, 0, sizeof(PointJacobian));
+#ifdef ECDSA_NO_WINDOWED_MULTIPLY
+	memcpy(&u2_q, public_key, sizeof(PointAffine));
+	pointMultiply(&u2_q, u2);
+	ecdsaMultiplyG(&u1_g, u1);
+	affineToJacobian(&accumulator, &u1_g);
+	pointAdd(&accumulator, &junk, &u2_q);
+#else
+	CLOCK_BOOST_BEGIN();
+	recodeWindowDigits(u1_digits, u1, 32);
+	recodeWindowDigits(u2_digits, u2, 32);
+	setToG(&g);
+	buildWindowTable(g_table, &g);
+	buildWindowTable(q_table, public_key);
+	memset(&accumulator, 0, sizeof(PointJacobian));
+	accumulator.is_point_at_infinity = 1;
+	for (i = 64; i < 65; i--)
+	{
+		if (!accumulator.is_point_at_infinity)
 		{
-			continue;
+			for (j = 0; j < 4; j++)
+			{
+				pointDouble(&accumulator);
+			}
 		}
+		addWindowDigit(&accumulator, &junk, g_table, u1_digits[i]);
+		addWindowDigit(&accumulator, &junk, q_table, u2_digits[i]);
+	}
+	CLOCK_BOOST_END();
+#endif // #ifdef ECDSA_NO_WINDOWED_MULTIPLY
+	if (accumulator.is_point_at_infinity)
+	{
+		return true;
+	}
 
-		// Canonicalise s by negating it if s > secp256k1_n / 2.
-		// See https://github.com/bitcoin/bitcoin/pull/3016 for more info.
-		bigShiftRightNoModulo(k, (const BigNum256)secp256k1_n); // use k as temporary
-		if (bigCompare(s, k) == BIGCMP_GREATER)
+	// The signature is valid if x_affine (mod n) == r. Since
+	// x_affine = x / (z ^ 2), this can be checked without an inversion by
+	// checking whether x == r x z ^ 2 (mod p). Because n < p, x_affine
+	// (mod n) can also equal r if x_affine = r + n, which is possible when
+	// r < p - n. With ECDSA_COMPLETE_ADDITION, x_affine = x / z, so z is
+	// used instead of z ^ 2.
+#ifdef ECDSA_COMPLETE_ADDITION
+	bigAssign(temp, accumulator.z);
+#else
+	bigSquareModP(temp, accumulator.z);
+#endif // #ifdef ECDSA_COMPLETE_ADDITION
+	bigMultiplyModP(temp2, r, temp);
+	if (bigCompare(accumulator.x, temp2) == BIGCMP_EQUAL)
+	{
+		return false;
+	}
+	bigSubtractNoModulo(temp2, (BigNum256)secp256k1_p, (BigNum256)secp256k1_n);
+	if (bigCompare(r, temp2) == BIGCMP_LESS)
+	{
+		bigAddVariableSizeNoModulo(temp2, r, (BigNum256)secp256k1_n, 32);
+		bigMultiplyModP(temp2, temp2, temp);
+		if (bigCompare(accumulator.x, temp2) == BIGCMP_EQUAL)
 		{
-			bigSubtractNoModulo(s, (BigNum256)secp256k1_n, s);
+			return false;
 		}
-		break;
 	}
+	return true;
 }
 
 /** Serialise an elliptic curve point in a manner which is Bitcoin-compatible.
@@ -504,22 +2227,119 @@ uint8_t ecdsaSerialise(uint8_t *out, const PointAffine *point, const bool do_com
 	}
 }
 
-#ifdef TEST_ECDSA
+/** Calculate the right-hand side of the secp256k1 curve equation
+  * (r = x ^ 3 + b, which is y ^ 2 for a point on the curve).
+  * The current field must be #secp256k1_p.
+  * \param r The 32 byte result will be written into here.
+  * \param x The 32 byte x component. This must be < #secp256k1_p.
+  */
+static void curveRightHandSide(BigNum256 r, BigNum256 x)
+{
+	BigNum256Storage x_squared;
 
-/** The curve parameter b of secp256k1. The other parameter, a, is zero. */
-static const uint8_t secp256k1_b[32] = {
-0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+	bigSquareModP(x_squared, x);
+	bigMultiplyModP(r, x_squared, x);
+	addModP(r, r, (BigNum256)secp256k1_b);
+}
 
-/** This is #secp256k1_p plus 1, then divided by 4. It is a constant used for
-  * decompressing elliptic curve points. */
-static const uint8_t secp256k1_p_plus1over4[32] = {
-0x0c, 0xff, 0xff, 0xbf, 0xff, 0xff, 0xff, 0xff,
-0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3f};
+/** Decompress an elliptic curve point - that is, given only the x value of
+  * a point, this will calculate the y value. This means that only the x value
+  * needs to be stored, which decreases memory use at the expense of time.
+  *
+  * Since y ^ 2 = x ^ 3 + b in secp256k1, y = sqrt(x ^ 3 + b). The square
+  * root is done using the fixed addition chain in bigSqrtModP(), so this
+  * costs about as much as one modular inversion.
+  * \param point The point to decompress. Only the x field needs to be filled
+  *              in - the y field will be ignored and overwritten. The x
+  *              field must be < #secp256k1_p.
+  * \param is_odd For any x value, there are two valid y values - one odd and
+  *               one even. This parameter instructs the function to pick
+  *               one of them. Use 0 to pick the even one, 1 to pick the odd
+  *               one.
+  * \return false on success, true if point could not be decompressed.
+  */
+bool ecdsaPointDecompress(PointAffine *point, uint8_t is_odd)
+{
+	BigNum256Storage temp;
+	BigNum256Storage root;
+	BigNum256Storage x_cubed_plus_b;
+	bool no_root;
+	BigNum256 lookup[2];
+
+	curveRightHandSide(x_cubed_plus_b, point->x);
+	no_root = bigSqrtModP(root, x_cubed_plus_b);
+	// sqrt(y^2) has two solutions ("positive" and "negative"). One of the
+	// solutions is odd and the other even. The is_odd parameter controls
+	// which one is picked.
+	bigSubtractNoModulo(temp, (BigNum256)secp256k1_p, root); // temp = -root
+	lookup[0] = root; // root has correct least significant bit
+	lookup[1] = temp; // root has incorrect least significant bit; use -root
+	memcpy(point->y, lookup[(root[0] ^ is_odd) & 1], sizeof(point->y));
+	return no_root;
+}
+
+/** Parse an elliptic curve point which was serialised by ecdsaSerialise()
+  * (or any other SEC 1 compatible serialiser). Both compressed and
+  * uncompressed points are accepted. Uncompressed points are checked to be
+  * on the curve; compressed points are decompressed using
+  * ecdsaPointDecompress().
+  * \param point The parsed point will be written here. If in represents the
+  *              point at infinity (a single 0x00 byte), is_point_at_infinity
+  *              will be set, so callers which are expecting a public key
+  *              should check that.
+  * \param in The serialised point.
+  * \param length The length, in bytes, of the serialised point.
+  * \return false on success, true if the serialised point is invalid (wrong
+  *         length, unknown prefix, coordinates not less than #secp256k1_p
+  *         or point not on the curve).
+  */
+bool ecdsaDeserialise(PointAffine *point, const uint8_t *in, const uint8_t length)
+{
+	BigNum256Storage y_squared;
+	BigNum256Storage x_cubed_plus_b;
+
+	memset(point, 0, sizeof(PointAffine));
+	if (length == 0)
+	{
+		return true;
+	}
+	if ((in[0] == 0x00) && (length == 1))
+	{
+		point->is_point_at_infinity = 1;
+		return false;
+	}
+	if (((in[0] != 0x02) && (in[0] != 0x03) && (in[0] != 0x04))
+		|| ((in[0] == 0x04) && (length != 65))
+		|| ((in[0] != 0x04) && (length != 33)))
+	{
+		return true; // unknown prefix or wrong length
+	}
+	memcpy(point->x, &(in[1]), 32);
+	swapEndian256(point->x);
+	if (bigCompare(point->x, (BigNum256)secp256k1_p) != BIGCMP_LESS)
+	{
+		return true;
+	}
+	if (in[0] != 0x04)
+	{
+		return ecdsaPointDecompress(point, (uint8_t)(in[0] & 1));
+	}
+	memcpy(point->y, &(in[33]), 32);
+	swapEndian256(point->y);
+	if (bigCompare(point->y, (BigNum256)secp256k1_p) != BIGCMP_LESS)
+	{
+		return true;
+	}
+	curveRightHandSide(x_cubed_plus_b, point->x);
+	bigSquareModP(y_squared, point->y);
+	if (bigCompare(y_squared, x_cubed_plus_b) != BIGCMP_EQUAL)
+	{
+		return true; // not on curve
+	}
+	return false;
+}
+
+#ifdef TEST_ECDSA
 
 /** Test vector generated using https://brainwallet.github.io/, which is a
   * convenient way to generate serialised public keys. */
@@ -527,7 +2347,7 @@ struct BrainwalletTestCase
 {
 	/** Private key (brainwallet.org calls this the private exponent. This is
 	  * big-endian. */
-	uint8_t private_exponent[32];
+	BigNum256Storage private_exponent;
 	/** Whether the public key should be compressed. */
 	bool is_compressed;
 	/** Serialised public key. */
@@ -635,7 +2455,7 @@ true, // is compressed?
 struct RFC6979TestCase
 {
 	/** Private key. This is big-endian. */
-	uint8_t private_key[32];
+	BigNum256Storage private_key;
 	/** Message to sign. */
 	const char *message;
 	/** Expected signature, as r concatenated with s, big-endian. */
@@ -809,7 +2629,7 @@ true // use SHA-256 twice
 
 /** Order ("n") divided by 2. Obtained from BIP 0062, from the
   * section "Low S values in signatures". */
-static const uint8_t halforder[32] = {
+static const BigNum256Storage halforder = {
 0xA0, 0x20, 0x1B, 0x68, 0x46, 0x2F, 0xE9, 0xDF,
 0x1D, 0x50, 0xA4, 0x57, 0x73, 0x6E, 0x57, 0x5D,
 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
@@ -821,8 +2641,8 @@ static const uint8_t halforder[32] = {
   */
 static void checkPointIsOnCurve(PointAffine *p)
 {
-	uint8_t y_squared[32];
-	uint8_t x_cubed[32];
+	BigNum256Storage y_squared;
+	BigNum256Storage x_cubed;
 
 	if (p->is_point_at_infinity)
 	{
@@ -830,8 +2650,8 @@ static void checkPointIsOnCurve(PointAffine *p)
 		reportSuccess();
 		return;
 	}
-	bigMultiply(y_squared, p->y, p->y);
-	bigMultiply(x_cubed, p->x, p->x);
+	bigSquare(y_squared, p->y);
+	bigSquare(x_cubed, p->x);
 	bigMultiply(x_cubed, x_cubed, p->x);
 	bigAdd(x_cubed, x_cubed, (BigNum256)secp256k1_b);
 	if (bigCompare(y_squared, x_cubed) != BIGCMP_EQUAL)
@@ -851,77 +2671,6 @@ static void checkPointIsOnCurve(PointAffine *p)
 	}
 }
 
-/** Decompress an elliptic curve point - that is, given only the x value of
-  * a point, this will calculate the y value. This means that only the x value
-  * needs to be stored, which decreases memory use at the expense of time.
-  * \param point The point to decompress. Only the x field needs to be filled
-  *              in - the y field will be ignored and overwritten.
-  * \param is_odd For any x value, there are two valid y values - one odd and
-  *               one even. This parameter instructs the function to pick
-  *               one of them. Use 0 to pick the even one, 1 to pick the odd
-  *               one.
-  * \return false on success, true if point could not be decompressed.
-  */
-static bool ecdsaPointDecompress(PointAffine *point, uint8_t is_odd)
-{
-	uint8_t temp[32];
-	uint8_t sqrt_y_squared[32];
-	uint8_t x_cubed_plus_b[32];
-	uint8_t is_sqrt_y_squared_odd;
-	uint8_t supposed_to_be_odd;
-	BigNum256 lookup[2];
-	unsigned int i;
-	unsigned int byte_num;
-	unsigned int bit_num;
-
-	setFieldToP();
-	bigMultiply(x_cubed_plus_b, point->x, point->x);
-	bigMultiply(x_cubed_plus_b, x_cubed_plus_b, point->x);
-	bigAdd(x_cubed_plus_b, x_cubed_plus_b, (BigNum256)secp256k1_b); // x_cubed_plus_b = x^3 + b = y^2
-	// Since y^2 = x^3 + b in secp256k1, y = sqrt(x^3 + b). The square
-	// root can be performed using the Tonelli-Shanks algorithm. Here, a special
-	// case is used, which only works for p = 3 (mod 4) - this is satisfied for
-	// the secp256k1 curve. For more information see:
-	// http://point-at-infinity.org/ecc/Algorithm_of_Shanks_&_Tonelli.html
-	// Exponentiation is done by a standard binary square-and-multiply
-	// algorithm.
-	bigSetZero(sqrt_y_squared);
-	sqrt_y_squared[0] = 1;
-	for (i = 255; i < 256; i--)
-	{
-		bigMultiply(sqrt_y_squared, sqrt_y_squared, sqrt_y_squared);
-		byte_num = i >> 3;
-		bit_num = i & 7;
-		// Yes, this is a data-dependent branch, but it is based on
-		// secp256k1_p_plus1over4, which is a (public) constant.
-		if (((secp256k1_p_plus1over4[byte_num] >> bit_num) & 1) != 0)
-		{
-			bigMultiply(sqrt_y_squared, sqrt_y_squared, x_cubed_plus_b);
-		}
-	}
-	// sqrt(y^2) has two solutions ("positive" and "negative"). One of the
-	// solutions is odd and the other even. The is_odd parameter controls
-	// which one is picked.
-	bigSubtractNoModulo(temp, (BigNum256)secp256k1_p, sqrt_y_squared); // temp = -sqrt_y_squared
-	is_sqrt_y_squared_odd = (uint8_t)(sqrt_y_squared[0] & 1);
-	supposed_to_be_odd = (uint8_t)(is_odd & 1);
-	lookup[0] = sqrt_y_squared; // sqrt_y_squared has correct least significant bit
-	lookup[1] = temp; // sqrt_y_squared has incorrect least significant bit; use -sqrt_y_squared
-	memcpy(point->y, lookup[is_sqrt_y_squared_odd ^ supposed_to_be_odd], sizeof(point->y));
-
-	// Check that y^2 does actually equal x^3 + b (i.e. the point is on the
-	// curve).
-	bigMultiply(temp, point->y, point->y);
-	if (bigCompare(temp, x_cubed_plus_b) == BIGCMP_EQUAL)
-	{
-		return false; // success
-	}
-	else
-	{
-		return true; // could not decompress (resulting point is not on curve)
-	}
-}
-
 /** Read hex string containing a little-endian 256 bit integer from a file.
   * \param r Where the number will be stored into after it is read. This must
   *          be a byte array with space for 32 bytes.
@@ -958,10 +2707,10 @@ static int crappyVerifySignature(BigNum256 r, BigNum256 s, BigNum256 hash, BigNu
 	PointJacobian pj;
 	PointJacobian junk;
 	PointAffine result;
-	uint8_t temp1[32];
-	uint8_t temp2[32];
-	uint8_t k1[32];
-	uint8_t k2[32];
+	BigNum256Storage temp1;
+	BigNum256Storage temp2;
+	BigNum256Storage k1;
+	BigNum256Storage k2;
 
 	setFieldToN();
 	bigModulo(temp1, hash);
@@ -998,15 +2747,21 @@ int main(void)
 	PointJacobian p2;
 	PointJacobian junk;
 	PointAffine compare;
-	uint8_t temp[32];
-	uint8_t r[32];
-	uint8_t s[32];
-	uint8_t r_again[32];
-	uint8_t s_again[32];
-	uint8_t private_key[32];
-	uint8_t public_key_x[32];
-	uint8_t public_key_y[32];
-	uint8_t hash[32];
+	BigNum256Storage temp;
+	BigNum256Storage r;
+	BigNum256Storage s;
+	BigNum256Storage r_again;
+	BigNum256Storage s_again;
+	BigNum256Storage hash_again;
+	uint8_t batch_k[ECDSA_MAX_BATCH_SIZE * 32];
+	PointAffine batch_p[ECDSA_MAX_BATCH_SIZE];
+	uint8_t batch_hashes[ECDSA_MAX_BATCH_SIZE * 32];
+	uint8_t batch_r[ECDSA_MAX_BATCH_SIZE * 32];
+	uint8_t batch_s[ECDSA_MAX_BATCH_SIZE * 32];
+	BigNum256Storage private_key;
+	BigNum256Storage public_key_x;
+	BigNum256Storage public_key_y;
+	BigNum256Storage hash;
 	uint8_t serialised[ECDSA_MAX_SERIALISE_SIZE + 10];
 	uint8_t serialised_sentinel[10]; // used to detect writes beyond serialised[ECDSA_MAX_SERIALISE_SIZE]
 	uint8_t serialised_size;
@@ -1122,6 +2877,48 @@ int main(void)
 		reportSuccess();
 	}
 
+	// Test that 2P + 2P produces the same result as 4P, where the first 2P
+	// has z != 1. This catches addition formulae which only handle
+	// p1 == p2 when z == 1.
+	setToG(&p);
+	affineToJacobian(&p2, &p);
+	pointDouble(&p2);
+	jacobianToAffine(&compare, &p2);
+	pointAdd(&p2, &junk, &compare);
+	jacobianToAffine(&p, &p2);
+	affineToJacobian(&p2, &compare);
+	pointDouble(&p2);
+	jacobianToAffine(&compare, &p2);
+	if ((p.is_point_at_infinity != compare.is_point_at_infinity)
+		|| (bigCompare(p.x, compare.x) != BIGCMP_EQUAL)
+		|| (bigCompare(p.y, compare.y) != BIGCMP_EQUAL))
+	{
+		printf("2P + 2P != 4P\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// Test that 2P + -2P = O, where the first 2P has z != 1.
+	setToG(&p);
+	affineToJacobian(&p2, &p);
+	pointDouble(&p2);
+	jacobianToAffine(&p, &p2);
+	bigSetZero(temp);
+	bigSubtract(p.y, temp, p.y);
+	pointAdd(&p2, &junk, &p);
+	if (!p2.is_point_at_infinity)
+	{
+		printf("2P + -2P != O\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
 	// Test that 2P + P gives a point on curve.
 	setToG(&p);
 	affineToJacobian(&p2, &p);
@@ -1273,6 +3070,83 @@ int main(void)
 		reportSuccess();
 	}
 
+	// Test that ecdsaDeserialise() undoes ecdsaSerialise(), for compressed
+	// and uncompressed points.
+	for (i = 0; i < 100; i++)
+	{
+		fillWithRandom(temp, sizeof(temp));
+		temp[31] = (uint8_t)(temp[31] & 0x7f); // ensure temp < n
+		ecdsaMultiplyG(&p, temp);
+		serialised_size = ecdsaSerialise(serialised, &p, (i & 1) != 0);
+		if (ecdsaDeserialise(&compare, serialised, serialised_size))
+		{
+			printf("ecdsaDeserialise() failed to parse point %d\n", i);
+			reportFailure();
+		}
+		else if ((bigCompare(compare.x, p.x) != BIGCMP_EQUAL)
+			|| (bigCompare(compare.y, p.y) != BIGCMP_EQUAL)
+			|| compare.is_point_at_infinity)
+		{
+			printf("ecdsaDeserialise() doesn't match original for point %d\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+	}
+	// Test that ecdsaDeserialise() rejects invalid points. serialised
+	// contains an uncompressed point from the loop above.
+	for (i = 0; i < 6; i++)
+	{
+		serialised_size = ecdsaSerialise(serialised, &p, false);
+		if (i == 0)
+		{
+			serialised[0] = 0x05; // unknown prefix
+		}
+		else if (i == 1)
+		{
+			serialised_size = 64; // too short
+		}
+		else if (i == 2)
+		{
+			serialised[0] = 0x02; // compressed prefix with uncompressed length
+		}
+		else if (i == 3)
+		{
+			serialised[64] ^= 1; // y changed, so point is not on curve
+		}
+		else if (i == 4)
+		{
+			// x = p (not a field element).
+			memcpy(&(serialised[1]), secp256k1_p, 32);
+			swapEndian256(&(serialised[1]));
+		}
+		else
+		{
+			serialised_size = 0;
+		}
+		if (!ecdsaDeserialise(&compare, serialised, serialised_size))
+		{
+			printf("ecdsaDeserialise() accepted invalid point %d\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+	}
+	serialised[0] = 0x00;
+	if (ecdsaDeserialise(&p, serialised, 1) || !p.is_point_at_infinity)
+	{
+		printf("ecdsaDeserialise() doesn't parse point at infinity\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
 	// Test against some point multiplication test vectors.
 	// It's hard to find such test vectors for secp256k1. But they can be
 	// generated using OpenSSL. Using the command:
@@ -1324,9 +3198,255 @@ int main(void)
 		{
 			reportSuccess();
 		}
+		ecdsaMultiplyG(&p, temp);
+		if ((p.is_point_at_infinity != compare.is_point_at_infinity) 
+			|| (bigCompare(p.x, compare.x) != BIGCMP_EQUAL)
+			|| (bigCompare(p.y, compare.y) != BIGCMP_EQUAL))
+		{
+			printf("Keypair test vector %d failed (using ecdsaMultiplyG())\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
 	}
 	fclose(f);
 
+	// Test that ecdsaMultiplyG() gives the same results as pointMultiply()
+	// for some edge cases and some random scalars. The edge cases include
+	// 0, 1, values which exercise only one tooth of the comb, n - 1
+	// (which sets bits in every tooth) and n - 2.
+	for (i = 0; i < 300; i++)
+	{
+		bigSetZero(temp);
+		if (i < 256)
+		{
+			temp[i >> 3] = (uint8_t)(1 << (i & 7));
+		}
+		else if (i == 256)
+		{
+			// temp is already 0.
+		}
+		else if ((i == 257) || (i == 258))
+		{
+			// n - 2 exercises the point doubling special case in
+			// pointAdd() when it is called from pointMultiply().
+			bigAssign(temp, (BigNum256)secp256k1_n);
+			temp[0] = (uint8_t)(temp[0] - (i - 256));
+		}
+		else
+		{
+			fillWithRandom(temp, sizeof(temp));
+			temp[31] = (uint8_t)(temp[31] & 0x7f); // ensure temp < n
+		}
+		setToG(&compare);
+		pointMultiply(&compare, temp);
+		memset(&p, 42, sizeof(p)); // make sure everything gets overwritten
+		ecdsaMultiplyG(&p, temp);
+		if ((p.is_point_at_infinity != compare.is_point_at_infinity)
+			|| (!compare.is_point_at_infinity
+				&& ((bigCompare(p.x, compare.x) != BIGCMP_EQUAL)
+				|| (bigCompare(p.y, compare.y) != BIGCMP_EQUAL))))
+		{
+			printf("ecdsaMultiplyG() doesn't match pointMultiply(), i = %d\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+	}
+
+	// Test that ecdsaMultiplyGBatch() gives the same results as
+	// ecdsaMultiplyG(), for every batch size. Some of the scalars are 0, to
+	// check that a point at infinity doesn't affect the rest of the batch.
+	for (i = 0; i < 100; i++)
+	{
+		fillWithRandom(batch_k, sizeof(batch_k));
+		for (j = 0; j < ECDSA_MAX_BATCH_SIZE; j++)
+		{
+			batch_k[j * 32 + 31] = (uint8_t)(batch_k[j * 32 + 31] & 0x7f); // ensure k < n
+			if ((i >= 50) && ((((unsigned int)i + j) % 3) == 0))
+			{
+				bigSetZero(&(batch_k[j * 32]));
+			}
+		}
+		memset(batch_p, 42, sizeof(batch_p)); // make sure everything gets overwritten
+		ecdsaMultiplyGBatch(batch_p, batch_k, (uint8_t)((i % ECDSA_MAX_BATCH_SIZE) + 1));
+		fail_count = 0;
+		for (j = 0; j < (unsigned int)((i % ECDSA_MAX_BATCH_SIZE) + 1); j++)
+		{
+			ecdsaMultiplyG(&compare, &(batch_k[j * 32]));
+			if ((batch_p[j].is_point_at_infinity != compare.is_point_at_infinity)
+				|| (!compare.is_point_at_infinity
+					&& ((bigCompare(batch_p[j].x, compare.x) != BIGCMP_EQUAL)
+					|| (bigCompare(batch_p[j].y, compare.y) != BIGCMP_EQUAL))))
+			{
+				fail_count++;
+			}
+		}
+		if (fail_count != 0)
+		{
+			printf("ecdsaMultiplyGBatch() doesn't match ecdsaMultiplyG(), i = %d\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+	}
+
+	// Test that ecdsaMultiplyGAdd() gives the same results as
+	// ecdsaMultiplyG() of the sum of the scalars. The last few iterations
+	// check the special cases where the points are the same (so pointAdd()
+	// has to double) and where they are negatives of each other (so the
+	// result is the point at infinity).
+	for (i = 0; i < 100; i++)
+	{
+		fillWithRandom(private_key, sizeof(private_key));
+		private_key[31] = (uint8_t)(private_key[31] & 0x7f); // ensure k < n
+		setFieldToN();
+		if (i == 98)
+		{
+			bigAssign(temp, private_key);
+		}
+		else if (i == 99)
+		{
+			bigSetZero(temp);
+			bigSubtract(temp, temp, private_key);
+		}
+		else
+		{
+			fillWithRandom(temp, sizeof(temp));
+			temp[31] = (uint8_t)(temp[31] & 0x7f); // ensure k < n
+		}
+		ecdsaMultiplyG(&p, temp);
+		ecdsaMultiplyGAdd(&p, private_key, &p);
+		setFieldToN();
+		bigAdd(hash, private_key, temp);
+		ecdsaMultiplyG(&compare, hash);
+		if ((p.is_point_at_infinity != compare.is_point_at_infinity)
+			|| (!compare.is_point_at_infinity
+				&& ((bigCompare(p.x, compare.x) != BIGCMP_EQUAL)
+				|| (bigCompare(p.y, compare.y) != BIGCMP_EQUAL))))
+		{
+			printf("ecdsaMultiplyGAdd() doesn't match ecdsaMultiplyG(), i = %d\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+	}
+
+	// Test that pointMultiplyGLV() gives the same results as
+	// pointMultiply(), using points other than G.
+	for (i = 0; i < 300; i++)
+	{
+		bigSetZero(temp);
+		if (i < 256)
+		{
+			fillWithRandom(temp, sizeof(temp));
+			temp[31] = (uint8_t)(temp[31] & 0x7f); // ensure temp < n
+		}
+		else if (i < 290)
+		{
+			// n - 33 to n - 1, which have troublesome halves.
+			bigAssign(temp, (BigNum256)secp256k1_n);
+			temp[0] = (uint8_t)(temp[0] - (i - 256) - 1);
+		}
+		else
+		{
+			// 0 to 9.
+			temp[0] = (uint8_t)(i - 290);
+		}
+		setToG(&p);
+		bigSetZero(private_key);
+		private_key[0] = (uint8_t)(i + 2);
+		pointMultiply(&p, private_key);
+		memcpy(&compare, &p, sizeof(compare));
+		pointMultiply(&compare, temp);
+		pointMultiplyGLV(&p, temp);
+		if ((p.is_point_at_infinity != compare.is_point_at_infinity)
+			|| (!compare.is_point_at_infinity
+				&& ((bigCompare(p.x, compare.x) != BIGCMP_EQUAL)
+				|| (bigCompare(p.y, compare.y) != BIGCMP_EQUAL))))
+		{
+			printf("pointMultiplyGLV() doesn't match pointMultiply(), i = %d\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+	}
+
+#ifndef ECDSA_NO_COZ_LADDER
+	// Test that pointMultiplyLadder() gives the same results as
+	// pointMultiply(), especially for the scalars which it has to treat
+	// as exceptions.
+	for (i = 0; i < 302; i++)
+	{
+		bigSetZero(temp);
+		if (i < 256)
+		{
+			fillWithRandom(temp, sizeof(temp));
+			temp[31] = (uint8_t)(temp[31] & 0x7f); // ensure temp < n
+		}
+		else if (i < 290)
+		{
+			// n - 33 to n - 1.
+			bigAssign(temp, (BigNum256)secp256k1_n);
+			temp[0] = (uint8_t)(temp[0] - (i - 256) - 1);
+		}
+		else if (i < 300)
+		{
+			// 0 to 9.
+			temp[0] = (uint8_t)(i - 290);
+		}
+		else
+		{
+			// n and n + 1, which are congruent to 0 and 1.
+			bigAssign(temp, (BigNum256)secp256k1_n);
+			temp[0] = (uint8_t)(temp[0] + (i - 300));
+		}
+		setToG(&p);
+		bigSetZero(private_key);
+		private_key[0] = (uint8_t)(i + 2);
+		pointMultiply(&p, private_key);
+		memcpy(&compare, &p, sizeof(compare));
+		pointMultiply(&compare, temp);
+		pointMultiplyLadder(&p, temp);
+		if ((p.is_point_at_infinity != compare.is_point_at_infinity)
+			|| (!compare.is_point_at_infinity
+				&& ((bigCompare(p.x, compare.x) != BIGCMP_EQUAL)
+				|| (bigCompare(p.y, compare.y) != BIGCMP_EQUAL))))
+		{
+			printf("pointMultiplyLadder() doesn't match pointMultiply(), i = %d\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+	}
+	// Multiplying the point at infinity should give the point at infinity.
+	memset(&p, 0, sizeof(p));
+	p.is_point_at_infinity = 1;
+	fillWithRandom(temp, sizeof(temp));
+	pointMultiplyLadder(&p, temp);
+	if (!p.is_point_at_infinity)
+	{
+		printf("pointMultiplyLadder() doesn't preserve O\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+#endif // #ifndef ECDSA_NO_COZ_LADDER
+
 	// Test signatures by signing and then verifying. For keypairs, just
 	// use the ones generated for the pointMultiply test.
 	srand(42);
@@ -1392,9 +3512,87 @@ int main(void)
 		{
 			reportSuccess();
 		}
+
+		// Check that ecdsaVerify() accepts the signature, and rejects it
+		// when one bit of r, s or the hash is flipped.
+		p.is_point_at_infinity = 0;
+		bigAssign(p.x, public_key_x);
+		bigAssign(p.y, public_key_y);
+		if (ecdsaVerify(r, s, hash, &p))
+		{
+			printf("ecdsaVerify() rejected good signature %d\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+		bigAssign(r_again, r);
+		bigAssign(s_again, s);
+		bigAssign(hash_again, hash);
+		j = (unsigned int)rand();
+		if ((i % 3) == 0)
+		{
+			r_again[j & 31] ^= (uint8_t)(1 << ((j >> 5) & 7));
+		}
+		else if ((i % 3) == 1)
+		{
+			s_again[j & 31] ^= (uint8_t)(1 << ((j >> 5) & 7));
+		}
+		else
+		{
+			hash_again[j & 31] ^= (uint8_t)(1 << ((j >> 5) & 7));
+		}
+		if (!ecdsaVerify(r_again, s_again, hash_again, &p))
+		{
+			printf("ecdsaVerify() accepted bad signature %d\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
 	}
 	fclose(f);
 
+	// Check that ecdsaVerify() rejects out of range r and s, and public keys
+	// which aren't on the curve. p is the public key from the last test,
+	// and r, s and hash are a valid signature for it.
+	bigSetZero(temp);
+	if (!ecdsaVerify(temp, s, hash, &p) || !ecdsaVerify(r, temp, hash, &p)
+		|| !ecdsaVerify((BigNum256)secp256k1_n, s, hash, &p)
+		|| !ecdsaVerify(r, (BigNum256)secp256k1_n, hash, &p))
+	{
+		printf("ecdsaVerify() accepted out of range r or s\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	memcpy(&compare, &p, sizeof(compare));
+	compare.y[0] ^= 1;
+	if (!ecdsaVerify(r, s, hash, &compare))
+	{
+		printf("ecdsaVerify() accepted public key which isn't on the curve\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	compare.y[0] ^= 1;
+	compare.is_point_at_infinity = 1;
+	if (!ecdsaVerify(r, s, hash, &compare))
+	{
+		printf("ecdsaVerify() accepted point at infinity as public key\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
 	// Test serialisation/decompression against vectors in pointMultiply test
 	// (the ones generated by OpenSSL).
 	srand(42);
@@ -1626,6 +3824,40 @@ int main(void)
 	}
 	fclose(f);
 
+	// Test that ecdsaSignBatch() gives the same signatures as ecdsaSign(),
+	// for every batch size.
+	for (i = 0; i < 40; i++)
+	{
+		fillWithRandom(batch_k, sizeof(batch_k));
+		fillWithRandom(batch_hashes, sizeof(batch_hashes));
+		for (j = 0; j < ECDSA_MAX_BATCH_SIZE; j++)
+		{
+			batch_k[j * 32 + 31] = (uint8_t)(batch_k[j * 32 + 31] & 0x7f); // ensure private key < n
+		}
+		memset(batch_r, 42, sizeof(batch_r)); // make sure everything gets overwritten
+		memset(batch_s, 42, sizeof(batch_s));
+		ecdsaSignBatch(batch_r, batch_s, batch_hashes, batch_k, (uint8_t)((i % ECDSA_MAX_BATCH_SIZE) + 1));
+		fail_count = 0;
+		for (j = 0; j < (unsigned int)((i % ECDSA_MAX_BATCH_SIZE) + 1); j++)
+		{
+			ecdsaSign(r, s, &(batch_hashes[j * 32]), &(batch_k[j * 32]));
+			if ((bigCompare(&(batch_r[j * 32]), r) != BIGCMP_EQUAL)
+				|| (bigCompare(&(batch_s[j * 32]), s) != BIGCMP_EQUAL))
+			{
+				fail_count++;
+			}
+		}
+		if (fail_count != 0)
+		{
+			printf("ecdsaSignBatch() doesn't match ecdsaSign(), i = %d\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+	}
+
 	finishTests();
 
 	exit(0);
@@ -16,6 +16,10 @@
   * written by ecdsaSerialise(). */
 #define ECDSA_MAX_SERIALISE_SIZE	65
 
+/** Maximum number of scalars which can be passed to ecdsaMultiplyGBatch()
+  * at once. */
+#define ECDSA_MAX_BATCH_SIZE		8
+
 /** A point on the elliptic curve, in affine coordinates. Affine
   * coordinates are the (x, y) that satisfy the elliptic curve
   * equation y ^ 2 = x ^ 3 + a * x + b.
@@ -23,9 +27,9 @@
 typedef struct PointAffineStruct
 {
 	/** x component of a point in affine coordinates. */
-	uint8_t x[32];
+	BigNum256Storage x;
 	/** y component of a point in affine coordinates. */
-	uint8_t y[32];
+	BigNum256Storage y;
 	/** If is_point_at_infinity is non-zero, then this point represents the
 	  * point at infinity and all other structure members are considered
 	  * invalid. */
@@ -33,11 +37,24 @@ typedef struct PointAffineStruct
 } PointAffine;
 
 extern const uint8_t secp256k1_n[];
+extern const BigNumField secp256k1_p_field;
+extern const BigNumField secp256k1_n_field;
 
 extern void setFieldToN(void);
 extern void setToG(PointAffine *p);
 extern void pointMultiply(PointAffine *p, BigNum256 k);
+extern void pointMultiplyGLV(PointAffine *p, BigNum256 k);
+#ifndef ECDSA_NO_COZ_LADDER
+extern void pointMultiplyLadder(PointAffine *p, BigNum256 k);
+#endif // #ifndef ECDSA_NO_COZ_LADDER
+extern void ecdsaMultiplyG(PointAffine *p, BigNum256 k);
+extern void ecdsaMultiplyGBatch(PointAffine *out, uint8_t *k, uint8_t count);
+extern void ecdsaMultiplyGAdd(PointAffine *p, BigNum256 k, PointAffine *q);
 extern void ecdsaSign(BigNum256 r, BigNum256 s, const BigNum256 hash, const BigNum256 privatekey);
+extern void ecdsaSignBatch(uint8_t *r, uint8_t *s, uint8_t *hashes, uint8_t *private_keys, uint8_t count);
+extern bool ecdsaVerify(BigNum256 r, BigNum256 s, BigNum256 hash, PointAffine *public_key);
 extern uint8_t ecdsaSerialise(uint8_t *out, const PointAffine *point, const bool do_compress);
+extern bool ecdsaPointDecompress(PointAffine *point, uint8_t is_odd);
+extern bool ecdsaDeserialise(PointAffine *point, const uint8_t *in, const uint8_t length);
 
 #endif // #ifndef ECDSA_H_INCLUDED
@@ -38,7 +38,7 @@ void writeU32LittleEndian(uint8_t *out, uint32_t in)
   * \param in The source byte array.
   * \return The integer.
   */
-uint32_t readU32BigEndian(uint8_t *in)
+uint32_t readU32BigEndian(const uint8_t *in)
 {
 	return ((uint32_t)in[0] << 24)
 		| ((uint32_t)in[1] << 16)
@@ -50,7 +50,7 @@ uint32_t readU32BigEndian(uint8_t *in)
   * \param in The source byte array.
   * \return The integer.
   */
-uint32_t readU32LittleEndian(uint8_t *in)
+uint32_t readU32LittleEndian(const uint8_t *in)
 {
 	return ((uint32_t)in[0])
 		| ((uint32_t)in[1] << 8)
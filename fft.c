@@ -20,6 +20,12 @@
   *   on a 22050 Hz bandwidth signal in real-time.
   * - Another aim was to have code size (including required fixed-point
   *   functions) be below 2 kilobytes on ARM Cortex-M0 microcontrollers.
+  * - If FFT_RADIX4 is defined, fft() combines pairs of radix-2 stages into
+  *   radix-4 stages. That needs 25% fewer complex multiplications, at the
+  *   cost of larger code.
+  * - If FFT_FULL_TWIDDLE_TABLE is defined, fft() reads twiddle factors
+  *   sequentially from a full, precomputed table. That's faster, but the
+  *   table uses an extra 2 kilobytes of (read-only) memory.
   *
   * This file is licensed as described by the file LICENCE.
   */
@@ -80,6 +86,156 @@ const uint16_t twiddle_factor_lookup[128] = {
 0xfec4, 0xff0e, 0xff4e, 0xff85, 0xffb1, 0xffd4, 0xffec, 0xfffb
 };
 
+#ifdef FFT_FULL_TWIDDLE_TABLE
+/** Full lookup table of twiddle factors, in the order that fft() uses them.
+  * Each entry is exp(j * phi), where phi is the (positive) angle of the
+  * twiddle factor, so entries need to be conjugated for a forward FFT.
+  * This table is about 8 times as big as #twiddle_factor_lookup, but it
+  * means fft() can read twiddle factors sequentially, without
+  * getTwiddleFactor()'s index arithmetic and range folding. The radix-2
+  * and radix-4 kernels use twiddle factors in a different order, so each
+  * has its own table.
+  *
+  * Table generated using gen_twiddle.
+  * FFT size: 256, order: full4 (if FFT_RADIX4 is defined) or full.
+  */
+#ifdef FFT_RADIX4
+static const ComplexFixed full_twiddle_table[255] = {
+{ 0x00010000, 0x00000000}, { 0x00010000, 0x00000000}, { 0x00010000, 0x00000000}, { 0x00010000, 0x00000000},
+{ 0x00010000, 0x00000000}, { 0x00010000, 0x00000000}, { 0x0000ec83, 0x000061f8}, { 0x0000b505, 0x0000b505},
+{ 0x000061f8, 0x0000ec83}, { 0x0000b505, 0x0000b505}, { 0x00000000, 0x00010000}, {-0x0000b505, 0x0000b505},
+{ 0x000061f8, 0x0000ec83}, {-0x0000b505, 0x0000b505}, {-0x0000ec83,-0x000061f8}, { 0x00010000, 0x00000000},
+{ 0x00010000, 0x00000000}, { 0x00010000, 0x00000000}, { 0x0000fec4, 0x00001918}, { 0x0000fb15, 0x000031f1},
+{ 0x0000f4fa, 0x00004a50}, { 0x0000fb15, 0x000031f1}, { 0x0000ec83, 0x000061f8}, { 0x0000d4db, 0x00008e3a},
+{ 0x0000f4fa, 0x00004a50}, { 0x0000d4db, 0x00008e3a}, { 0x0000a268, 0x0000c5e4}, { 0x0000ec83, 0x000061f8},
+{ 0x0000b505, 0x0000b505}, { 0x000061f8, 0x0000ec83}, { 0x0000e1c6, 0x000078ad}, { 0x00008e3a, 0x0000d4db},
+{ 0x00001918, 0x0000fec4}, { 0x0000d4db, 0x00008e3a}, { 0x000061f8, 0x0000ec83}, {-0x000031f1, 0x0000fb15},
+{ 0x0000c5e4, 0x0000a268}, { 0x000031f1, 0x0000fb15}, {-0x000078ad, 0x0000e1c6}, { 0x0000b505, 0x0000b505},
+{ 0x00000000, 0x00010000}, {-0x0000b505, 0x0000b505}, { 0x0000a268, 0x0000c5e4}, {-0x000031f1, 0x0000fb15},
+{-0x0000e1c6, 0x000078ad}, { 0x00008e3a, 0x0000d4db}, {-0x000061f8, 0x0000ec83}, {-0x0000fb15, 0x000031f1},
+{ 0x000078ad, 0x0000e1c6}, {-0x00008e3a, 0x0000d4db}, {-0x0000fec4,-0x00001918}, { 0x000061f8, 0x0000ec83},
+{-0x0000b505, 0x0000b505}, {-0x0000ec83,-0x000061f8}, { 0x00004a50, 0x0000f4fa}, {-0x0000d4db, 0x00008e3a},
+{-0x0000c5e4,-0x0000a268}, { 0x000031f1, 0x0000fb15}, {-0x0000ec83, 0x000061f8}, {-0x00008e3a,-0x0000d4db},
+{ 0x00001918, 0x0000fec4}, {-0x0000fb15, 0x000031f1}, {-0x00004a50,-0x0000f4fa}, { 0x00010000, 0x00000000},
+{ 0x00010000, 0x00000000}, { 0x00010000, 0x00000000}, { 0x0000ffec, 0x00000648}, { 0x0000ffb1, 0x00000c90},
+{ 0x0000ff4e, 0x000012d5}, { 0x0000ffb1, 0x00000c90}, { 0x0000fec4, 0x00001918}, { 0x0000fd3b, 0x00002590},
+{ 0x0000ff4e, 0x000012d5}, { 0x0000fd3b, 0x00002590}, { 0x0000f9c8, 0x00003817}, { 0x0000fec4, 0x00001918},
+{ 0x0000fb15, 0x000031f1}, { 0x0000f4fa, 0x00004a50}, { 0x0000fe13, 0x00001f56}, { 0x0000f854, 0x00003e34},
+{ 0x0000eed9, 0x00005c22}, { 0x0000fd3b, 0x00002590}, { 0x0000f4fa, 0x00004a50}, { 0x0000e76c, 0x00006d74},
+{ 0x0000fc3b, 0x00002bc4}, { 0x0000f109, 0x0000563e}, { 0x0000debe, 0x00007e2f}, { 0x0000fb15, 0x000031f1},
+{ 0x0000ec83, 0x000061f8}, { 0x0000d4db, 0x00008e3a}, { 0x0000f9c8, 0x00003817}, { 0x0000e76c, 0x00006d74},
+{ 0x0000c9d1, 0x00009d80}, { 0x0000f854, 0x00003e34}, { 0x0000e1c6, 0x000078ad}, { 0x0000bdaf, 0x0000abeb},
+{ 0x0000f6ba, 0x00004447}, { 0x0000db94, 0x0000839c}, { 0x0000b086, 0x0000b968}, { 0x0000f4fa, 0x00004a50},
+{ 0x0000d4db, 0x00008e3a}, { 0x0000a268, 0x0000c5e4}, { 0x0000f314, 0x0000504d}, { 0x0000cd9f, 0x00009880},
+{ 0x00009368, 0x0000d14d}, { 0x0000f109, 0x0000563e}, { 0x0000c5e4, 0x0000a268}, { 0x0000839c, 0x0000db94},
+{ 0x0000eed9, 0x00005c22}, { 0x0000bdaf, 0x0000abeb}, { 0x0000731a, 0x0000e4aa}, { 0x0000ec83, 0x000061f8},
+{ 0x0000b505, 0x0000b505}, { 0x000061f8, 0x0000ec83}, { 0x0000ea0a, 0x000067be}, { 0x0000abeb, 0x0000bdaf},
+{ 0x0000504d, 0x0000f314}, { 0x0000e76c, 0x00006d74}, { 0x0000a268, 0x0000c5e4}, { 0x00003e34, 0x0000f854},
+{ 0x0000e4aa, 0x0000731a}, { 0x00009880, 0x0000cd9f}, { 0x00002bc4, 0x0000fc3b}, { 0x0000e1c6, 0x000078ad},
+{ 0x00008e3a, 0x0000d4db}, { 0x00001918, 0x0000fec4}, { 0x0000debe, 0x00007e2f}, { 0x0000839c, 0x0000db94},
+{ 0x00000648, 0x0000ffec}, { 0x0000db94, 0x0000839c}, { 0x000078ad, 0x0000e1c6}, {-0x00000c90, 0x0000ffb1},
+{ 0x0000d848, 0x000088f6}, { 0x00006d74, 0x0000e76c}, {-0x00001f56, 0x0000fe13}, { 0x0000d4db, 0x00008e3a},
+{ 0x000061f8, 0x0000ec83}, {-0x000031f1, 0x0000fb15}, { 0x0000d14d, 0x00009368}, { 0x0000563e, 0x0000f109},
+{-0x00004447, 0x0000f6ba}, { 0x0000cd9f, 0x00009880}, { 0x00004a50, 0x0000f4fa}, {-0x0000563e, 0x0000f109},
+{ 0x0000c9d1, 0x00009d80}, { 0x00003e34, 0x0000f854}, {-0x000067be, 0x0000ea0a}, { 0x0000c5e4, 0x0000a268},
+{ 0x000031f1, 0x0000fb15}, {-0x000078ad, 0x0000e1c6}, { 0x0000c1d8, 0x0000a736}, { 0x00002590, 0x0000fd3b},
+{-0x000088f6, 0x0000d848}, { 0x0000bdaf, 0x0000abeb}, { 0x00001918, 0x0000fec4}, {-0x00009880, 0x0000cd9f},
+{ 0x0000b968, 0x0000b086}, { 0x00000c90, 0x0000ffb1}, {-0x0000a736, 0x0000c1d8}, { 0x0000b505, 0x0000b505},
+{ 0x00000000, 0x00010000}, {-0x0000b505, 0x0000b505}, { 0x0000b086, 0x0000b968}, {-0x00000c90, 0x0000ffb1},
+{-0x0000c1d8, 0x0000a736}, { 0x0000abeb, 0x0000bdaf}, {-0x00001918, 0x0000fec4}, {-0x0000cd9f, 0x00009880},
+{ 0x0000a736, 0x0000c1d8}, {-0x00002590, 0x0000fd3b}, {-0x0000d848, 0x000088f6}, { 0x0000a268, 0x0000c5e4},
+{-0x000031f1, 0x0000fb15}, {-0x0000e1c6, 0x000078ad}, { 0x00009d80, 0x0000c9d1}, {-0x00003e34, 0x0000f854},
+{-0x0000ea0a, 0x000067be}, { 0x00009880, 0x0000cd9f}, {-0x00004a50, 0x0000f4fa}, {-0x0000f109, 0x0000563e},
+{ 0x00009368, 0x0000d14d}, {-0x0000563e, 0x0000f109}, {-0x0000f6ba, 0x00004447}, { 0x00008e3a, 0x0000d4db},
+{-0x000061f8, 0x0000ec83}, {-0x0000fb15, 0x000031f1}, { 0x000088f6, 0x0000d848}, {-0x00006d74, 0x0000e76c},
+{-0x0000fe13, 0x00001f56}, { 0x0000839c, 0x0000db94}, {-0x000078ad, 0x0000e1c6}, {-0x0000ffb1, 0x00000c90},
+{ 0x00007e2f, 0x0000debe}, {-0x0000839c, 0x0000db94}, {-0x0000ffec,-0x00000648}, { 0x000078ad, 0x0000e1c6},
+{-0x00008e3a, 0x0000d4db}, {-0x0000fec4,-0x00001918}, { 0x0000731a, 0x0000e4aa}, {-0x00009880, 0x0000cd9f},
+{-0x0000fc3b,-0x00002bc4}, { 0x00006d74, 0x0000e76c}, {-0x0000a268, 0x0000c5e4}, {-0x0000f854,-0x00003e34},
+{ 0x000067be, 0x0000ea0a}, {-0x0000abeb, 0x0000bdaf}, {-0x0000f314,-0x0000504d}, { 0x000061f8, 0x0000ec83},
+{-0x0000b505, 0x0000b505}, {-0x0000ec83,-0x000061f8}, { 0x00005c22, 0x0000eed9}, {-0x0000bdaf, 0x0000abeb},
+{-0x0000e4aa,-0x0000731a}, { 0x0000563e, 0x0000f109}, {-0x0000c5e4, 0x0000a268}, {-0x0000db94,-0x0000839c},
+{ 0x0000504d, 0x0000f314}, {-0x0000cd9f, 0x00009880}, {-0x0000d14d,-0x00009368}, { 0x00004a50, 0x0000f4fa},
+{-0x0000d4db, 0x00008e3a}, {-0x0000c5e4,-0x0000a268}, { 0x00004447, 0x0000f6ba}, {-0x0000db94, 0x0000839c},
+{-0x0000b968,-0x0000b086}, { 0x00003e34, 0x0000f854}, {-0x0000e1c6, 0x000078ad}, {-0x0000abeb,-0x0000bdaf},
+{ 0x00003817, 0x0000f9c8}, {-0x0000e76c, 0x00006d74}, {-0x00009d80,-0x0000c9d1}, { 0x000031f1, 0x0000fb15},
+{-0x0000ec83, 0x000061f8}, {-0x00008e3a,-0x0000d4db}, { 0x00002bc4, 0x0000fc3b}, {-0x0000f109, 0x0000563e},
+{-0x00007e2f,-0x0000debe}, { 0x00002590, 0x0000fd3b}, {-0x0000f4fa, 0x00004a50}, {-0x00006d74,-0x0000e76c},
+{ 0x00001f56, 0x0000fe13}, {-0x0000f854, 0x00003e34}, {-0x00005c22,-0x0000eed9}, { 0x00001918, 0x0000fec4},
+{-0x0000fb15, 0x000031f1}, {-0x00004a50,-0x0000f4fa}, { 0x000012d5, 0x0000ff4e}, {-0x0000fd3b, 0x00002590},
+{-0x00003817,-0x0000f9c8}, { 0x00000c90, 0x0000ffb1}, {-0x0000fec4, 0x00001918}, {-0x00002590,-0x0000fd3b},
+{ 0x00000648, 0x0000ffec}, {-0x0000ffb1, 0x00000c90}, {-0x000012d5,-0x0000ff4e}
+};
+#else
+static const ComplexFixed full_twiddle_table[255] = {
+{ 0x00010000, 0x00000000}, { 0x00010000, 0x00000000}, { 0x00000000, 0x00010000}, { 0x00010000, 0x00000000},
+{ 0x0000b505, 0x0000b505}, { 0x00000000, 0x00010000}, {-0x0000b505, 0x0000b505}, { 0x00010000, 0x00000000},
+{ 0x0000ec83, 0x000061f8}, { 0x0000b505, 0x0000b505}, { 0x000061f8, 0x0000ec83}, { 0x00000000, 0x00010000},
+{-0x000061f8, 0x0000ec83}, {-0x0000b505, 0x0000b505}, {-0x0000ec83, 0x000061f8}, { 0x00010000, 0x00000000},
+{ 0x0000fb15, 0x000031f1}, { 0x0000ec83, 0x000061f8}, { 0x0000d4db, 0x00008e3a}, { 0x0000b505, 0x0000b505},
+{ 0x00008e3a, 0x0000d4db}, { 0x000061f8, 0x0000ec83}, { 0x000031f1, 0x0000fb15}, { 0x00000000, 0x00010000},
+{-0x000031f1, 0x0000fb15}, {-0x000061f8, 0x0000ec83}, {-0x00008e3a, 0x0000d4db}, {-0x0000b505, 0x0000b505},
+{-0x0000d4db, 0x00008e3a}, {-0x0000ec83, 0x000061f8}, {-0x0000fb15, 0x000031f1}, { 0x00010000, 0x00000000},
+{ 0x0000fec4, 0x00001918}, { 0x0000fb15, 0x000031f1}, { 0x0000f4fa, 0x00004a50}, { 0x0000ec83, 0x000061f8},
+{ 0x0000e1c6, 0x000078ad}, { 0x0000d4db, 0x00008e3a}, { 0x0000c5e4, 0x0000a268}, { 0x0000b505, 0x0000b505},
+{ 0x0000a268, 0x0000c5e4}, { 0x00008e3a, 0x0000d4db}, { 0x000078ad, 0x0000e1c6}, { 0x000061f8, 0x0000ec83},
+{ 0x00004a50, 0x0000f4fa}, { 0x000031f1, 0x0000fb15}, { 0x00001918, 0x0000fec4}, { 0x00000000, 0x00010000},
+{-0x00001918, 0x0000fec4}, {-0x000031f1, 0x0000fb15}, {-0x00004a50, 0x0000f4fa}, {-0x000061f8, 0x0000ec83},
+{-0x000078ad, 0x0000e1c6}, {-0x00008e3a, 0x0000d4db}, {-0x0000a268, 0x0000c5e4}, {-0x0000b505, 0x0000b505},
+{-0x0000c5e4, 0x0000a268}, {-0x0000d4db, 0x00008e3a}, {-0x0000e1c6, 0x000078ad}, {-0x0000ec83, 0x000061f8},
+{-0x0000f4fa, 0x00004a50}, {-0x0000fb15, 0x000031f1}, {-0x0000fec4, 0x00001918}, { 0x00010000, 0x00000000},
+{ 0x0000ffb1, 0x00000c90}, { 0x0000fec4, 0x00001918}, { 0x0000fd3b, 0x00002590}, { 0x0000fb15, 0x000031f1},
+{ 0x0000f854, 0x00003e34}, { 0x0000f4fa, 0x00004a50}, { 0x0000f109, 0x0000563e}, { 0x0000ec83, 0x000061f8},
+{ 0x0000e76c, 0x00006d74}, { 0x0000e1c6, 0x000078ad}, { 0x0000db94, 0x0000839c}, { 0x0000d4db, 0x00008e3a},
+{ 0x0000cd9f, 0x00009880}, { 0x0000c5e4, 0x0000a268}, { 0x0000bdaf, 0x0000abeb}, { 0x0000b505, 0x0000b505},
+{ 0x0000abeb, 0x0000bdaf}, { 0x0000a268, 0x0000c5e4}, { 0x00009880, 0x0000cd9f}, { 0x00008e3a, 0x0000d4db},
+{ 0x0000839c, 0x0000db94}, { 0x000078ad, 0x0000e1c6}, { 0x00006d74, 0x0000e76c}, { 0x000061f8, 0x0000ec83},
+{ 0x0000563e, 0x0000f109}, { 0x00004a50, 0x0000f4fa}, { 0x00003e34, 0x0000f854}, { 0x000031f1, 0x0000fb15},
+{ 0x00002590, 0x0000fd3b}, { 0x00001918, 0x0000fec4}, { 0x00000c90, 0x0000ffb1}, { 0x00000000, 0x00010000},
+{-0x00000c90, 0x0000ffb1}, {-0x00001918, 0x0000fec4}, {-0x00002590, 0x0000fd3b}, {-0x000031f1, 0x0000fb15},
+{-0x00003e34, 0x0000f854}, {-0x00004a50, 0x0000f4fa}, {-0x0000563e, 0x0000f109}, {-0x000061f8, 0x0000ec83},
+{-0x00006d74, 0x0000e76c}, {-0x000078ad, 0x0000e1c6}, {-0x0000839c, 0x0000db94}, {-0x00008e3a, 0x0000d4db},
+{-0x00009880, 0x0000cd9f}, {-0x0000a268, 0x0000c5e4}, {-0x0000abeb, 0x0000bdaf}, {-0x0000b505, 0x0000b505},
+{-0x0000bdaf, 0x0000abeb}, {-0x0000c5e4, 0x0000a268}, {-0x0000cd9f, 0x00009880}, {-0x0000d4db, 0x00008e3a},
+{-0x0000db94, 0x0000839c}, {-0x0000e1c6, 0x000078ad}, {-0x0000e76c, 0x00006d74}, {-0x0000ec83, 0x000061f8},
+{-0x0000f109, 0x0000563e}, {-0x0000f4fa, 0x00004a50}, {-0x0000f854, 0x00003e34}, {-0x0000fb15, 0x000031f1},
+{-0x0000fd3b, 0x00002590}, {-0x0000fec4, 0x00001918}, {-0x0000ffb1, 0x00000c90}, { 0x00010000, 0x00000000},
+{ 0x0000ffec, 0x00000648}, { 0x0000ffb1, 0x00000c90}, { 0x0000ff4e, 0x000012d5}, { 0x0000fec4, 0x00001918},
+{ 0x0000fe13, 0x00001f56}, { 0x0000fd3b, 0x00002590}, { 0x0000fc3b, 0x00002bc4}, { 0x0000fb15, 0x000031f1},
+{ 0x0000f9c8, 0x00003817}, { 0x0000f854, 0x00003e34}, { 0x0000f6ba, 0x00004447}, { 0x0000f4fa, 0x00004a50},
+{ 0x0000f314, 0x0000504d}, { 0x0000f109, 0x0000563e}, { 0x0000eed9, 0x00005c22}, { 0x0000ec83, 0x000061f8},
+{ 0x0000ea0a, 0x000067be}, { 0x0000e76c, 0x00006d74}, { 0x0000e4aa, 0x0000731a}, { 0x0000e1c6, 0x000078ad},
+{ 0x0000debe, 0x00007e2f}, { 0x0000db94, 0x0000839c}, { 0x0000d848, 0x000088f6}, { 0x0000d4db, 0x00008e3a},
+{ 0x0000d14d, 0x00009368}, { 0x0000cd9f, 0x00009880}, { 0x0000c9d1, 0x00009d80}, { 0x0000c5e4, 0x0000a268},
+{ 0x0000c1d8, 0x0000a736}, { 0x0000bdaf, 0x0000abeb}, { 0x0000b968, 0x0000b086}, { 0x0000b505, 0x0000b505},
+{ 0x0000b086, 0x0000b968}, { 0x0000abeb, 0x0000bdaf}, { 0x0000a736, 0x0000c1d8}, { 0x0000a268, 0x0000c5e4},
+{ 0x00009d80, 0x0000c9d1}, { 0x00009880, 0x0000cd9f}, { 0x00009368, 0x0000d14d}, { 0x00008e3a, 0x0000d4db},
+{ 0x000088f6, 0x0000d848}, { 0x0000839c, 0x0000db94}, { 0x00007e2f, 0x0000debe}, { 0x000078ad, 0x0000e1c6},
+{ 0x0000731a, 0x0000e4aa}, { 0x00006d74, 0x0000e76c}, { 0x000067be, 0x0000ea0a}, { 0x000061f8, 0x0000ec83},
+{ 0x00005c22, 0x0000eed9}, { 0x0000563e, 0x0000f109}, { 0x0000504d, 0x0000f314}, { 0x00004a50, 0x0000f4fa},
+{ 0x00004447, 0x0000f6ba}, { 0x00003e34, 0x0000f854}, { 0x00003817, 0x0000f9c8}, { 0x000031f1, 0x0000fb15},
+{ 0x00002bc4, 0x0000fc3b}, { 0x00002590, 0x0000fd3b}, { 0x00001f56, 0x0000fe13}, { 0x00001918, 0x0000fec4},
+{ 0x000012d5, 0x0000ff4e}, { 0x00000c90, 0x0000ffb1}, { 0x00000648, 0x0000ffec}, { 0x00000000, 0x00010000},
+{-0x00000648, 0x0000ffec}, {-0x00000c90, 0x0000ffb1}, {-0x000012d5, 0x0000ff4e}, {-0x00001918, 0x0000fec4},
+{-0x00001f56, 0x0000fe13}, {-0x00002590, 0x0000fd3b}, {-0x00002bc4, 0x0000fc3b}, {-0x000031f1, 0x0000fb15},
+{-0x00003817, 0x0000f9c8}, {-0x00003e34, 0x0000f854}, {-0x00004447, 0x0000f6ba}, {-0x00004a50, 0x0000f4fa},
+{-0x0000504d, 0x0000f314}, {-0x0000563e, 0x0000f109}, {-0x00005c22, 0x0000eed9}, {-0x000061f8, 0x0000ec83},
+{-0x000067be, 0x0000ea0a}, {-0x00006d74, 0x0000e76c}, {-0x0000731a, 0x0000e4aa}, {-0x000078ad, 0x0000e1c6},
+{-0x00007e2f, 0x0000debe}, {-0x0000839c, 0x0000db94}, {-0x000088f6, 0x0000d848}, {-0x00008e3a, 0x0000d4db},
+{-0x00009368, 0x0000d14d}, {-0x00009880, 0x0000cd9f}, {-0x00009d80, 0x0000c9d1}, {-0x0000a268, 0x0000c5e4},
+{-0x0000a736, 0x0000c1d8}, {-0x0000abeb, 0x0000bdaf}, {-0x0000b086, 0x0000b968}, {-0x0000b505, 0x0000b505},
+{-0x0000b968, 0x0000b086}, {-0x0000bdaf, 0x0000abeb}, {-0x0000c1d8, 0x0000a736}, {-0x0000c5e4, 0x0000a268},
+{-0x0000c9d1, 0x00009d80}, {-0x0000cd9f, 0x00009880}, {-0x0000d14d, 0x00009368}, {-0x0000d4db, 0x00008e3a},
+{-0x0000d848, 0x000088f6}, {-0x0000db94, 0x0000839c}, {-0x0000debe, 0x00007e2f}, {-0x0000e1c6, 0x000078ad},
+{-0x0000e4aa, 0x0000731a}, {-0x0000e76c, 0x00006d74}, {-0x0000ea0a, 0x000067be}, {-0x0000ec83, 0x000061f8},
+{-0x0000eed9, 0x00005c22}, {-0x0000f109, 0x0000563e}, {-0x0000f314, 0x0000504d}, {-0x0000f4fa, 0x00004a50},
+{-0x0000f6ba, 0x00004447}, {-0x0000f854, 0x00003e34}, {-0x0000f9c8, 0x00003817}, {-0x0000fb15, 0x000031f1},
+{-0x0000fc3b, 0x00002bc4}, {-0x0000fd3b, 0x00002590}, {-0x0000fe13, 0x00001f56}, {-0x0000fec4, 0x00001918},
+{-0x0000ff4e, 0x000012d5}, {-0x0000ffb1, 0x00000c90}, {-0x0000ffec, 0x00000648}
+};
+#endif // #ifdef FFT_RADIX4
+#endif // #ifdef FFT_FULL_TWIDDLE_TABLE
+
 /** Add two complex numbers.
   * \param op1 The first operand.
   * \param op2 The second operand.
@@ -155,16 +311,17 @@ static uint32_t reverseBits(uint32_t op1)
 /** Get the complex twiddle factor (complex root of unity) for a given angle.
   * This function uses the lookup table #twiddle_factor_lookup and complements
   * it with trigonometric symmetries.
-  * \param tf_index The angle, in radian * FFT_SIZE / (2 * pi). This parameter
-  *                 is range-checked.
+  * \param tf_index The angle, in radian * FFT_SIZE / pi. This parameter
+  *                 is range-checked; it must be less than 2 * #FFT_SIZE.
   * \return The complex twiddle factor.
   */
 static ComplexFixed getTwiddleFactor(uint32_t tf_index)
 {
 	ComplexFixed r;
 	uint32_t first_quadrant_tf_index;
+	bool negate;
 
-	if (tf_index > FFT_SIZE)
+	if (tf_index >= (FFT_SIZE * 2))
 	{
 		// tf_index too large.
 		r.real = fix16_zero;
@@ -172,6 +329,13 @@ static ComplexFixed getTwiddleFactor(uint32_t tf_index)
 		fix16_error_occurred = true;
 		return r;
 	}
+	negate = false;
+	if (tf_index > FFT_SIZE)
+	{
+		// exp(j * (pi + phi)) = -exp(j * phi).
+		tf_index -= FFT_SIZE;
+		negate = true;
+	}
 	// tf_index must now be in [0, FFT_SIZE].
 	first_quadrant_tf_index = tf_index;
 	if (tf_index > (FFT_SIZE / 2))
@@ -201,12 +365,17 @@ static ComplexFixed getTwiddleFactor(uint32_t tf_index)
 		// cos(pi - phi) = -cos(phi).
 		r.real = fix16_sub(fix16_zero, r.real);
 	}
+	if (negate)
+	{
+		r.real = fix16_sub(fix16_zero, r.real);
+		r.imag = fix16_sub(fix16_zero, r.imag);
+	}
 
 	return r;
 }
 
 /** Perform a complex, in-place Fast Fourier Transform using the radix-2
-  * Cooley-Tukey algorithm.
+  * Cooley-Tukey algorithm (or radix-4, if FFT_RADIX4 is defined).
   * This does a complex FFT of size #FFT_SIZE. If the input data is purely
   * real, this can do a real FFT of size #FFT_SIZE * 2, but that requires
   * some post-processing. See fftRealPostProcess() for more details.
@@ -217,6 +386,9 @@ static ComplexFixed getTwiddleFactor(uint32_t tf_index)
   * - A lookup table for twiddle factors (see getTwiddleFactor()) is used
   *   instead of a trigonometric recurrence relation. This gives better
   *   numerical performance, at little space cost.
+  *   If FFT_FULL_TWIDDLE_TABLE is defined, #full_twiddle_table is used
+  *   instead, so that twiddle factors don't need to be reconstructed from
+  *   the smaller table.
   * - If the twiddle factor is 1, no multiplication is done. For a size
   *   512 complex FFT, this removes 12.5% of the multiplications, at little
   *   space cost.
@@ -239,7 +411,20 @@ bool fft(ComplexFixed *data, bool is_inverse)
 	uint32_t tf_step; // twiddle factor index increment
 	ComplexFixed factor; // twiddle factor
 	ComplexFixed product;
+#ifdef FFT_FULL_TWIDDLE_TABLE
+	const ComplexFixed *tf_pointer; // next entry in full_twiddle_table
+#endif // #ifdef FFT_FULL_TWIDDLE_TABLE
 	ComplexFixed temp;
+#ifdef FFT_RADIX4
+	ComplexFixed factor2; // twiddle factor squared
+	ComplexFixed factor3; // twiddle factor cubed
+	ComplexFixed product2;
+	ComplexFixed product3;
+	ComplexFixed sum;
+	ComplexFixed sum2;
+	ComplexFixed difference;
+	ComplexFixed difference2;
+#endif // #ifdef FFT_RADIX4
 
 	fix16_error_occurred = false;
 
@@ -256,6 +441,86 @@ bool fft(ComplexFixed *data, bool is_inverse)
 	}
 
 	// Perform the actual FFT calculation.
+#ifdef FFT_FULL_TWIDDLE_TABLE
+	tf_pointer = full_twiddle_table;
+#endif // #ifdef FFT_FULL_TWIDDLE_TABLE
+#ifdef FFT_RADIX4
+	// Each pass of the loop below does the work of two radix-2 stages (of
+	// span i and 2 * i) at once. Let w = exp(-+ j * pi * k / (2 * i)) be the
+	// twiddle factor of the second of those stages. Then the twiddle factor
+	// of the first stage is w ^ 2, so the four outputs of a radix-4
+	// butterfly can be expressed in terms of w * a2, w ^ 2 * a1
+	// and w ^ 3 * a3. That's 3 complex multiplications, instead of the 4
+	// which two radix-2 stages need.
+	// The following loop assumes that the number of radix-2 stages is even.
+#if (FFT_SIZE != 4) && (FFT_SIZE != 16) && (FFT_SIZE != 64) && (FFT_SIZE != 256) && (FFT_SIZE != 1024)
+#error "FFT_SIZE not a power of 4; FFT_RADIX4 needs an extra radix-2 stage"
+#endif
+	tf_step = FFT_SIZE >> 1;
+	for (i = 1; i < FFT_SIZE; i <<= 2)
+	{
+		jump = i << 2;
+		tf_index = 0;
+		for (j = 0; j < i; j++)
+		{
+#ifdef FFT_FULL_TWIDDLE_TABLE
+			factor = *(tf_pointer++);
+			factor2 = *(tf_pointer++);
+			factor3 = *(tf_pointer++);
+#else
+			factor = getTwiddleFactor(tf_index);
+			factor2 = getTwiddleFactor(tf_index * 2);
+			factor3 = getTwiddleFactor(tf_index * 3);
+#endif // #ifdef FFT_FULL_TWIDDLE_TABLE
+			if (!is_inverse)
+			{
+				factor = complexFixedConjugate(factor);
+				factor2 = complexFixedConjugate(factor2);
+				factor3 = complexFixedConjugate(factor3);
+			}
+			for (pair = j; pair < FFT_SIZE; pair += jump)
+			{
+				match = pair + i;
+				if (tf_index == 0)
+				{
+					// Save multiplications since all twiddle factors
+					// are 1.0.
+					product = data[match];
+					product2 = data[match + i];
+					product3 = data[match + 2 * i];
+				}
+				else
+				{
+					product = complexFixedMultiply(factor2, data[match]);
+					product2 = complexFixedMultiply(factor, data[match + i]);
+					product3 = complexFixedMultiply(factor3, data[match + 2 * i]);
+				}
+				sum = complexFixedAdd(data[pair], product);
+				difference = complexFixedSubtract(data[pair], product);
+				sum2 = complexFixedAdd(product2, product3);
+				// Multiply (product2 - product3) by -j (forward) or
+				// j (inverse). This doesn't need any multiplications.
+				temp = complexFixedSubtract(product2, product3);
+				if (is_inverse)
+				{
+					difference2.real = fix16_sub(fix16_zero, temp.imag);
+					difference2.imag = temp.real;
+				}
+				else
+				{
+					difference2.real = temp.imag;
+					difference2.imag = fix16_sub(fix16_zero, temp.real);
+				}
+				data[pair] = complexFixedAdd(sum, sum2);
+				data[match] = complexFixedAdd(difference, difference2);
+				data[match + i] = complexFixedSubtract(sum, sum2);
+				data[match + 2 * i] = complexFixedSubtract(difference, difference2);
+			}
+			tf_index += tf_step;
+		}
+		tf_step >>= 2;
+	} // end for (i = 1; i < FFT_SIZE; i <<= 2)
+#else
 	tf_step = FFT_SIZE;
 	for (i = 1; i < FFT_SIZE; i <<= 1)
 	{
@@ -263,7 +528,11 @@ bool fft(ComplexFixed *data, bool is_inverse)
 		tf_index = 0;
 		for (j = 0; j < i; j++)
 		{
+#ifdef FFT_FULL_TWIDDLE_TABLE
+			factor = *(tf_pointer++);
+#else
 			factor = getTwiddleFactor(tf_index);
+#endif // #ifdef FFT_FULL_TWIDDLE_TABLE
 			if (!is_inverse)
 			{
 				factor = complexFixedConjugate(factor);
@@ -287,6 +556,7 @@ bool fft(ComplexFixed *data, bool is_inverse)
 		}
 		tf_step >>= 1;
 	} // end for (i = 1; i < FFT_SIZE; i <<= 1)
+#endif // #ifdef FFT_RADIX4
 
 	if (is_inverse)
 	{
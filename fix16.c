@@ -13,6 +13,8 @@
   *   returning #fix16_overflow.
   * - Moved fix16_log2() into fix16.c.
   * - Changed fix16_log2() to avoid division.
+  * - Added fix16_sq(), and PLATFORM_SPECIFIC_FIX16_MUL to allow fix16_mul()
+  *   and fix16_sq() to be implemented in assembly.
   *
   * The rest of the file was written mainly by the libfixmath contributors.
   * A list of contributors can be retrieved from
@@ -74,6 +76,18 @@ fix16_t fix16_sub(fix16_t a, fix16_t b)
 	return diff;
 }
 
+#ifdef PLATFORM_SPECIFIC_FIX16_MUL
+
+// fix16_mul() and fix16_sq() are provided by platform-specific assembly (see
+// pic32/fix16_multiply.S and lpc11uxx/fix16_multiply.S). Those always
+// round and check for overflow, with the same results as the 64-bit
+// implementation below.
+#if defined(FIXMATH_NO_ROUNDING) || defined(FIXMATH_NO_OVERFLOW) || defined(FIXMATH_OPTIMIZE_8BIT)
+#error "PLATFORM_SPECIFIC_FIX16_MUL is incompatible with FIXMATH_NO_ROUNDING, FIXMATH_NO_OVERFLOW and FIXMATH_OPTIMIZE_8BIT"
+#endif
+
+#else
+
 /* 64-bit implementation for fix16_mul. Fastest version for e.g. ARM Cortex M3.
  * Performs a 32*32 -> 64bit multiplication. The middle 32 bits are the result,
  * bottom 16 bits are used for rounding, and upper 16 bits are used for overflow
@@ -292,6 +306,17 @@ fix16_t fix16_mul(fix16_t inArg0, fix16_t inArg1)
 }
 #endif
 
+/* Squares the given number. This is only here so that code which uses
+ * fix16_sq() works without PLATFORM_SPECIFIC_FIX16_MUL; the platform-specific
+ * versions can skip some of the work of a general multiply.
+ */
+fix16_t fix16_sq(fix16_t x)
+{
+	return fix16_mul(x, x);
+}
+
+#endif // #ifdef PLATFORM_SPECIFIC_FIX16_MUL
+
 /**
  * Divides x by 2 and returns the result, rounding if appropriate.
  */
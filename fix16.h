@@ -94,6 +94,11 @@ extern fix16_t fix16_sub(fix16_t a, fix16_t b) FIXMATH_FUNC_ATTRS;
 */
 extern fix16_t fix16_mul(fix16_t inArg0, fix16_t inArg1) FIXMATH_FUNC_ATTRS;
 
+/*! Squares the given fix16_t and returns the result. This gives exactly the
+    same result as fix16_mul(x, x), but can be faster.
+*/
+extern fix16_t fix16_sq(fix16_t x) FIXMATH_FUNC_ATTRS;
+
 /*! Returns the base 2 logarithm of the given fix16_t.
  */
 extern fix16_t fix16_log2(fix16_t x) FIXMATH_FUNC_ATTRS;
@@ -0,0 +1,725 @@
+/** \file gen_g_table.c
+  *
+  * \brief Generates fixed-base comb table for multiplication by G.
+  *
+  * This generates the lookup table used by ecdsaMultiplyG() in ecdsa.c.
+  * This outputs the table as C source. For a comb with t teeth and a
+  * spacing of d bits (where t x d >= 256), entry b - 1 of the table is the
+  * point:
+  * b_0 x G + b_1 x 2 ^ d x G + ... + b_(t - 1) x 2 ^ ((t - 1) x d) x G,
+  * where b_j is bit j of b. The entry for b = 0 (the point at infinity) is
+  * not included in the table.
+  *
+  * Each point is outputted in affine coordinates, as 8 x 32 bit words of
+  * the x component, followed by 8 x 32 bit words of the y component. The
+  * words are in little-endian order (least significant word first).
+  *
+  * With the "header" option, the table is wrapped up as a header file which
+  * also defines G_COMB_TEETH and G_COMB_SPACING, so that it can be
+  * included by ecdsa.c (see ECDSA_G_TABLE_HEADER there). That way, the
+  * size of the table can be chosen per target, at build time.
+  *
+  * "gen_g_table constants" instead outputs the curve constants and GLV
+  * endomorphism constants in ecdsa.c, in the same format as ecdsa.c. The
+  * endomorphism constants are derived from scratch (cube roots of unity,
+  * then a short lattice basis using the extended Euclidean algorithm).
+  *
+  * Everything is checked against reference math before it is outputted:
+  * every table entry is compared against a plain double-and-add scalar
+  * multiplication of G, and every derived constant is checked against the
+  * relation which defines it. If anything doesn't check out, nothing is
+  * outputted and the exit status is non-zero.
+  *
+  * GMP is used for the point arithmetic, since speed and timing regularity
+  * don't matter here.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <gmp.h>
+
+/** Maximum number of teeth. 8 teeth would already need a 16 kilobyte
+  * table. */
+#define MAX_TEETH			8
+/** Minimum number of teeth in a table outputted as a header file.
+  * ecdsa.c uses uint8_t loop counters to go through the comb, so the
+  * spacing can't be more than 255 bits. */
+#define MIN_HEADER_TEETH	2
+/** Maximum number of teeth in a table outputted as a header file. Like
+  * #MIN_HEADER_TEETH, this is because of uint8_t loop counters; the table
+  * can't have more than 255 entries. */
+#define MAX_HEADER_TEETH	7
+/** Number of bytes per line when outputting byte arrays. */
+#define BYTES_PER_LINE		8
+
+/** The prime number used to define the prime finite field for secp256k1. */
+static const char secp256k1_p_hex[] = "fffffffffffffffffffffffffffffffffffffffffffffffffffffffefffffc2f";
+/** The x component of the base point G used in secp256k1. */
+static const char secp256k1_Gx_hex[] = "79be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798";
+/** The y component of the base point G used in secp256k1. */
+static const char secp256k1_Gy_hex[] = "483ada7726a3c4655da4fbfc0e1108a8fd17b448a68554199c47d08ffb10d4b8";
+/** The order of the base point used in secp256k1. */
+static const char secp256k1_n_hex[] = "fffffffffffffffffffffffffffffffebaaedce6af48a03bbfd25e8cd0364141";
+
+/** The prime number used to define the prime finite field for secp256k1. */
+static mpz_t p;
+/** The order of the base point G. */
+static mpz_t n;
+
+/** A point on the elliptic curve, in affine coordinates. The points used
+  * here are never the point at infinity. */
+typedef struct PointStruct
+{
+	/** x component of a point in affine coordinates. */
+	mpz_t x;
+	/** y component of a point in affine coordinates. */
+	mpz_t y;
+} Point;
+
+/** Add (r = p1 + p2) two distinct points, neither of which is the point at
+  * infinity, and where p1 != -p2.
+  * \param r The result will be written here. This may alias p1 or p2.
+  * \param p1 The first point to add.
+  * \param p2 The second point to add.
+  */
+static void pointAdd(Point *r, Point *p1, Point *p2)
+{
+	mpz_t lambda;
+	mpz_t temp;
+	mpz_t new_x;
+
+	mpz_init(lambda);
+	mpz_init(temp);
+	mpz_init(new_x);
+	// lambda = (y2 - y1) / (x2 - x1).
+	mpz_sub(temp, p2->x, p1->x);
+	mpz_mod(temp, temp, p);
+	if (mpz_invert(temp, temp, p) == 0)
+	{
+		printf("Error: p1 and p2 have the same x component\n");
+		exit(1);
+	}
+	mpz_sub(lambda, p2->y, p1->y);
+	mpz_mul(lambda, lambda, temp);
+	mpz_mod(lambda, lambda, p);
+	// new_x = lambda ^ 2 - x1 - x2.
+	mpz_mul(new_x, lambda, lambda);
+	mpz_sub(new_x, new_x, p1->x);
+	mpz_sub(new_x, new_x, p2->x);
+	mpz_mod(new_x, new_x, p);
+	// new_y = lambda * (x1 - new_x) - y1.
+	mpz_sub(temp, p1->x, new_x);
+	mpz_mul(temp, temp, lambda);
+	mpz_sub(temp, temp, p1->y);
+	mpz_mod(r->y, temp, p);
+	mpz_set(r->x, new_x);
+	mpz_clear(lambda);
+	mpz_clear(temp);
+	mpz_clear(new_x);
+}
+
+/** Double (r = 2 x p1) a point which isn't the point at infinity.
+  * \param r The result will be written here. This may alias p1.
+  * \param p1 The point to double.
+  */
+static void pointDouble(Point *r, Point *p1)
+{
+	mpz_t lambda;
+	mpz_t temp;
+	mpz_t new_x;
+
+	mpz_init(lambda);
+	mpz_init(temp);
+	mpz_init(new_x);
+	// lambda = (3 * x1 ^ 2) / (2 * y1). Note that a = 0 in secp256k1.
+	mpz_mul_ui(temp, p1->y, 2);
+	if (mpz_invert(temp, temp, p) == 0)
+	{
+		printf("Error: y component is zero\n");
+		exit(1);
+	}
+	mpz_mul(lambda, p1->x, p1->x);
+	mpz_mul_ui(lambda, lambda, 3);
+	mpz_mul(lambda, lambda, temp);
+	mpz_mod(lambda, lambda, p);
+	// new_x = lambda ^ 2 - 2 * x1.
+	mpz_mul(new_x, lambda, lambda);
+	mpz_submul_ui(new_x, p1->x, 2);
+	mpz_mod(new_x, new_x, p);
+	// new_y = lambda * (x1 - new_x) - y1.
+	mpz_sub(temp, p1->x, new_x);
+	mpz_mul(temp, temp, lambda);
+	mpz_sub(temp, temp, p1->y);
+	mpz_mod(r->y, temp, p);
+	mpz_set(r->x, new_x);
+	mpz_clear(lambda);
+	mpz_clear(temp);
+	mpz_clear(new_x);
+}
+
+/** Check whether a point is on secp256k1 (y ^ 2 = x ^ 3 + 7).
+  * \param p1 The point to check.
+  * \return Non-zero if the point is on the curve, zero if it isn't.
+  */
+static int isOnCurve(Point *p1)
+{
+	mpz_t lhs;
+	mpz_t rhs;
+	int r;
+
+	mpz_init(lhs);
+	mpz_init(rhs);
+	mpz_mul(lhs, p1->y, p1->y);
+	mpz_mod(lhs, lhs, p);
+	mpz_powm_ui(rhs, p1->x, 3, p);
+	mpz_add_ui(rhs, rhs, 7);
+	mpz_mod(rhs, rhs, p);
+	r = (mpz_cmp(lhs, rhs) == 0);
+	mpz_clear(lhs);
+	mpz_clear(rhs);
+	return r;
+}
+
+/** Set a point to G.
+  * \param r The point to set.
+  */
+static void setToG(Point *r)
+{
+	mpz_set_str(r->x, secp256k1_Gx_hex, 16);
+	mpz_set_str(r->y, secp256k1_Gy_hex, 16);
+}
+
+/** Reference scalar multiplication (r = k x G), using the most
+  * straightforward left-to-right double-and-add method. This is
+  * deliberately independent of how the comb table is built, so that it
+  * can be used to check the table.
+  * \param r The result will be written here.
+  * \param k The scalar to multiply G by. This must be in [1, n - 1].
+  */
+static void referenceMultiplyG(Point *r, mpz_t k)
+{
+	Point g;
+	long int i;
+
+	mpz_init(g.x);
+	mpz_init(g.y);
+	setToG(&g);
+	// Start with the most significant bit of k, which is always set.
+	setToG(r);
+	for (i = (long int)mpz_sizeinbase(k, 2) - 2; i >= 0; i--)
+	{
+		pointDouble(r, r);
+		if (mpz_tstbit(k, (mp_bitcnt_t)i))
+		{
+			// r is (prefix of k) x G and the prefix is less than n - 1,
+			// so r can't be G or -G.
+			pointAdd(r, r, &g);
+		}
+	}
+	mpz_clear(g.x);
+	mpz_clear(g.y);
+}
+
+/** Check every entry of the comb table against the reference scalar
+  * multiplication.
+  * \param table The comb table to check.
+  * \param teeth Number of teeth in the comb.
+  * \param spacing Spacing, in bits, between adjacent teeth.
+  * \return Non-zero if every entry is correct, zero if any isn't.
+  */
+static int checkTable(Point *table, int teeth, int spacing)
+{
+	int b;
+	int j;
+	int ok;
+	mpz_t k;
+	Point expected;
+
+	mpz_init(k);
+	mpz_init(expected.x);
+	mpz_init(expected.y);
+	ok = 1;
+	for (b = 1; b < (1 << teeth); b++)
+	{
+		mpz_set_ui(k, 0);
+		for (j = 0; j < teeth; j++)
+		{
+			if ((b >> j) & 1)
+			{
+				mpz_setbit(k, (mp_bitcnt_t)(j * spacing));
+			}
+		}
+		referenceMultiplyG(&expected, k);
+		if ((mpz_cmp(expected.x, table[b - 1].x) != 0)
+			|| (mpz_cmp(expected.y, table[b - 1].y) != 0)
+			|| !isOnCurve(&(table[b - 1])))
+		{
+			fprintf(stderr, "Error: table entry %d is wrong\n", b - 1);
+			ok = 0;
+		}
+	}
+	mpz_clear(k);
+	mpz_clear(expected.x);
+	mpz_clear(expected.y);
+	return ok;
+}
+
+/** Output one component of a point as C source, as a comma-separated list
+  * of 32 bit words.
+  * \param in The component to output.
+  */
+static void printComponent(mpz_t in)
+{
+	int i;
+	unsigned long word;
+	mpz_t temp;
+
+	mpz_init(temp);
+	for (i = 0; i < 8; i++)
+	{
+		mpz_tdiv_q_2exp(temp, in, (mp_bitcnt_t)(32 * i));
+		word = mpz_get_ui(temp) & 0xffffffffUL;
+		printf("0x%08lx", word);
+		if (i != 7)
+		{
+			printf(", ");
+		}
+	}
+	mpz_clear(temp);
+}
+
+/** Output a non-negative number as a C byte array initialiser, least
+  * significant byte first, in the same format as the constants in ecdsa.c.
+  * \param declaration The declaration (everything before the " = {").
+  * \param in The number to output.
+  * \param length The number of bytes to output.
+  */
+static void printBytes(const char *declaration, mpz_t in, int length)
+{
+	int i;
+	mpz_t temp;
+
+	mpz_init(temp);
+	printf("%s = {\n", declaration);
+	for (i = 0; i < length; i++)
+	{
+		mpz_tdiv_q_2exp(temp, in, (mp_bitcnt_t)(8 * i));
+		printf("0x%02lx", mpz_get_ui(temp) & 0xffUL);
+		if (i == (length - 1))
+		{
+			printf("};\n");
+		}
+		else if (((i + 1) % BYTES_PER_LINE) == 0)
+		{
+			printf(",\n");
+		}
+		else
+		{
+			printf(", ");
+		}
+	}
+	printf("\n");
+	mpz_clear(temp);
+}
+
+/** Find the smallest non-trivial cube root of unity modulo m.
+  * \param r The cube root will be written here.
+  * \param m The modulus. This must be a prime congruent to 1 modulo 3.
+  */
+static void findCubeRoot(mpz_t r, mpz_t m)
+{
+	mpz_t exponent;
+	mpz_t candidate;
+	mpz_t other;
+	unsigned long g;
+
+	mpz_init(exponent);
+	mpz_init(candidate);
+	mpz_init(other);
+	mpz_sub_ui(exponent, m, 1);
+	mpz_divexact_ui(exponent, exponent, 3);
+	// g ^ ((m - 1) / 3) is a cube root of unity for any g; it's
+	// non-trivial for most g.
+	for (g = 2; ; g++)
+	{
+		mpz_set_ui(candidate, g);
+		mpz_powm(candidate, candidate, exponent, m);
+		if (mpz_cmp_ui(candidate, 1) != 0)
+		{
+			break;
+		}
+	}
+	// The other non-trivial cube root is the square of this one.
+	mpz_mul(other, candidate, candidate);
+	mpz_mod(other, other, m);
+	if (mpz_cmp(other, candidate) < 0)
+	{
+		mpz_set(r, other);
+	}
+	else
+	{
+		mpz_set(r, candidate);
+	}
+	mpz_clear(exponent);
+	mpz_clear(candidate);
+	mpz_clear(other);
+}
+
+/** Derive, check and output the secp256k1 curve constants and the GLV
+  * endomorphism constants used by ecdsa.c.
+  * \return Non-zero on success, zero if any check failed.
+  */
+static int outputConstants(void)
+{
+	mpz_t beta;
+	mpz_t lambda;
+	mpz_t temp;
+	mpz_t q;
+	mpz_t r[3];
+	mpz_t t[3];
+	mpz_t a1, b1, a2, b2;
+	mpz_t alt_a2, alt_b2;
+	mpz_t norm, alt_norm;
+	mpz_t sqrt_n;
+	mpz_t g1, g2;
+	Point g;
+	Point endo;
+	Point check;
+	int ok;
+	int i;
+
+	mpz_init(beta);
+	mpz_init(lambda);
+	mpz_init(temp);
+	mpz_init(q);
+	for (i = 0; i < 3; i++)
+	{
+		mpz_init(r[i]);
+		mpz_init(t[i]);
+	}
+	mpz_inits(a1, b1, a2, b2, alt_a2, alt_b2, norm, alt_norm, sqrt_n, g1, g2, NULL);
+	mpz_inits(g.x, g.y, endo.x, endo.y, check.x, check.y, NULL);
+	ok = 1;
+
+	// beta is a cube root of unity modulo p, and lambda is the cube root of
+	// unity modulo n such that lambda x (x, y) = (beta x x, y).
+	findCubeRoot(beta, p);
+	setToG(&g);
+	mpz_mul(endo.x, beta, g.x);
+	mpz_mod(endo.x, endo.x, p);
+	mpz_set(endo.y, g.y);
+	findCubeRoot(lambda, n);
+	referenceMultiplyG(&check, lambda);
+	if ((mpz_cmp(check.x, endo.x) != 0) || (mpz_cmp(check.y, endo.y) != 0))
+	{
+		// It must be the other one.
+		mpz_mul(lambda, lambda, lambda);
+		mpz_mod(lambda, lambda, n);
+		referenceMultiplyG(&check, lambda);
+		if ((mpz_cmp(check.x, endo.x) != 0) || (mpz_cmp(check.y, endo.y) != 0))
+		{
+			fprintf(stderr, "Error: lambda x G != (beta x Gx, Gy)\n");
+			ok = 0;
+		}
+	}
+
+	// Find short vectors (a, b) with a + b x lambda = 0 (mod n), using the
+	// extended Euclidean algorithm on n and lambda, as described in
+	// section 4 of "Faster Point Multiplication on Elliptic Curves with
+	// Efficient Endomorphisms" by R. P. Gallant, R. J. Lambert and
+	// S. A. Vanstone. Each remainder r_i satisfies
+	// r_i = s_i x n + t_i x lambda, so (r_i, -t_i) is such a vector.
+	mpz_sqrt(sqrt_n, n);
+	mpz_set(r[0], n);
+	mpz_set_ui(t[0], 0);
+	mpz_set(r[1], lambda);
+	mpz_set_ui(t[1], 1);
+	// Stop when r[1] is the first remainder less than sqrt(n).
+	while (mpz_cmp(r[1], sqrt_n) >= 0)
+	{
+		mpz_fdiv_q(q, r[0], r[1]);
+		mpz_set(temp, r[1]);
+		mpz_submul(r[0], q, r[1]);
+		mpz_swap(r[0], r[1]);
+		mpz_set(r[0], temp);
+		mpz_set(temp, t[1]);
+		mpz_submul(t[0], q, t[1]);
+		mpz_swap(t[0], t[1]);
+		mpz_set(t[0], temp);
+	}
+	// r[0] is now the last remainder >= sqrt(n). One more step gives
+	// r[2].
+	mpz_fdiv_q(q, r[0], r[1]);
+	mpz_set(r[2], r[0]);
+	mpz_submul(r[2], q, r[1]);
+	mpz_set(t[2], t[0]);
+	mpz_submul(t[2], q, t[1]);
+	mpz_set(a1, r[1]);
+	mpz_neg(b1, t[1]);
+	// The second vector is whichever of the neighbours is shorter.
+	mpz_set(a2, r[0]);
+	mpz_neg(b2, t[0]);
+	mpz_set(alt_a2, r[2]);
+	mpz_neg(alt_b2, t[2]);
+	mpz_mul(norm, a2, a2);
+	mpz_addmul(norm, b2, b2);
+	mpz_mul(alt_norm, alt_a2, alt_a2);
+	mpz_addmul(alt_norm, alt_b2, alt_b2);
+	if (mpz_cmp(alt_norm, norm) < 0)
+	{
+		mpz_set(a2, alt_a2);
+		mpz_set(b2, alt_b2);
+	}
+	// Check a + b x lambda = 0 (mod n) for both vectors.
+	mpz_set(temp, a1);
+	mpz_addmul(temp, b1, lambda);
+	mpz_mod(temp, temp, n);
+	if (mpz_sgn(temp) != 0)
+	{
+		fprintf(stderr, "Error: a1 + b1 x lambda != 0\n");
+		ok = 0;
+	}
+	mpz_set(temp, a2);
+	mpz_addmul(temp, b2, lambda);
+	mpz_mod(temp, temp, n);
+	if (mpz_sgn(temp) != 0)
+	{
+		fprintf(stderr, "Error: a2 + b2 x lambda != 0\n");
+		ok = 0;
+	}
+	// The basis must be short enough for the split scalars to be about
+	// 128 bits, and the determinant must be n for it to span the lattice.
+	mpz_mul(temp, a1, b2);
+	mpz_submul(temp, a2, b1);
+	mpz_abs(temp, temp);
+	if ((mpz_sizeinbase(a1, 2) > 129) || (mpz_sizeinbase(b1, 2) > 129)
+		|| (mpz_sizeinbase(a2, 2) > 129) || (mpz_sizeinbase(b2, 2) > 129)
+		|| (mpz_cmp(temp, n) != 0))
+	{
+		fprintf(stderr, "Error: lattice basis is not short or doesn't span the lattice\n");
+		ok = 0;
+	}
+
+	// g1 = round(2 ^ 384 x b2 / n), g2 = round(2 ^ 384 x (-b1) / n).
+	mpz_mul_2exp(g1, b2, 384);
+	mpz_fdiv_q_2exp(temp, n, 1);
+	mpz_add(g1, g1, temp);
+	mpz_fdiv_q(g1, g1, n);
+	mpz_neg(g2, b1);
+	mpz_mul_2exp(g2, g2, 384);
+	mpz_add(g2, g2, temp);
+	mpz_fdiv_q(g2, g2, n);
+	if ((mpz_sgn(g1) < 0) || (mpz_sgn(g2) < 0)
+		|| (mpz_sizeinbase(g1, 2) > 256) || (mpz_sizeinbase(g2, 2) > 256))
+	{
+		fprintf(stderr, "Error: g1 or g2 doesn't fit in 256 bits\n");
+		ok = 0;
+	}
+
+	if (ok)
+	{
+		printf("// Constants generated using gen_g_table.\n");
+		printBytes("static const BigNum256Storage secp256k1_p", p, 32);
+		mpz_set_ui(temp, 0);
+		mpz_setbit(temp, 256);
+		mpz_sub(temp, temp, p);
+		printBytes("static const uint8_t secp256k1_complement_p[5]", temp, 5);
+		printBytes("const BigNum256Storage secp256k1_n", n, 32);
+		mpz_set_ui(temp, 0);
+		mpz_setbit(temp, 256);
+		mpz_sub(temp, temp, n);
+		printBytes("static const uint8_t secp256k1_complement_n[17]", temp, 17);
+		mpz_set_ui(temp, 7);
+		printBytes("static const BigNum256Storage secp256k1_b", temp, 32);
+		printBytes("static const uint8_t secp256k1_Gx[32] PROGMEM", g.x, 32);
+		printBytes("static const uint8_t secp256k1_Gy[32] PROGMEM", g.y, 32);
+		printBytes("static const BigNum256Storage secp256k1_beta", beta, 32);
+		mpz_sub(temp, n, lambda);
+		printBytes("static const BigNum256Storage glv_minus_lambda", temp, 32);
+		mpz_neg(temp, b1);
+		mpz_mod(temp, temp, n);
+		printBytes("static const BigNum256Storage glv_minus_b1", temp, 32);
+		mpz_neg(temp, b2);
+		mpz_mod(temp, temp, n);
+		printBytes("static const BigNum256Storage glv_minus_b2", temp, 32);
+		printBytes("static const BigNum256Storage glv_g1", g1, 32);
+		printBytes("static const BigNum256Storage glv_g2", g2, 32);
+	}
+
+	mpz_clears(g.x, g.y, endo.x, endo.y, check.x, check.y, NULL);
+	mpz_clears(a1, b1, a2, b2, alt_a2, alt_b2, norm, alt_norm, sqrt_n, g1, g2, NULL);
+	for (i = 0; i < 3; i++)
+	{
+		mpz_clear(r[i]);
+		mpz_clear(t[i]);
+	}
+	mpz_clear(beta);
+	mpz_clear(lambda);
+	mpz_clear(temp);
+	mpz_clear(q);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+	int j;
+	int teeth;
+	int spacing;
+	int table_size;
+	int lowest_bit;
+	int as_header;
+	int ok;
+	Point tooth[MAX_TEETH];
+	Point *table;
+
+	if ((argc != 2) && (argc != 3))
+	{
+		printf("Usage: %s <teeth> [header]\n", argv[0]);
+		printf("       %s constants\n", argv[0]);
+		printf("  <teeth>: number of teeth in comb\n");
+		printf("  header: output a header file for ECDSA_G_TABLE_HEADER\n");
+		printf("  constants: output curve and GLV endomorphism constants\n");
+		printf("\n");
+		exit(1);
+	}
+
+	mpz_init_set_str(p, secp256k1_p_hex, 16);
+	mpz_init_set_str(n, secp256k1_n_hex, 16);
+	if (!strcmp(argv[1], "constants") && (argc == 2))
+	{
+		ok = outputConstants();
+		mpz_clear(p);
+		mpz_clear(n);
+		exit(ok ? 0 : 1);
+	}
+	if (sscanf(argv[1], "%d", &teeth) != 1)
+	{
+		printf("Error: Invalid number of teeth\n");
+		exit(1);
+	}
+	as_header = 0;
+	if (argc == 3)
+	{
+		if (strcmp(argv[2], "header"))
+		{
+			printf("Error: Unknown option \"%s\"\n", argv[2]);
+			exit(1);
+		}
+		as_header = 1;
+	}
+	if ((teeth <= 0) || (teeth > MAX_TEETH))
+	{
+		printf("Error: Number of teeth must be between 1 and %d\n", MAX_TEETH);
+		exit(1);
+	}
+	if (as_header && ((teeth < MIN_HEADER_TEETH) || (teeth > MAX_HEADER_TEETH)))
+	{
+		printf("Error: Number of teeth must be between %d and %d for a header\n", MIN_HEADER_TEETH, MAX_HEADER_TEETH);
+		exit(1);
+	}
+
+	spacing = (256 + teeth - 1) / teeth;
+	table_size = (1 << teeth) - 1;
+	// tooth[j] = 2 ^ (j * spacing) x G.
+	for (j = 0; j < teeth; j++)
+	{
+		mpz_init(tooth[j].x);
+		mpz_init(tooth[j].y);
+	}
+	setToG(&(tooth[0]));
+	for (j = 1; j < teeth; j++)
+	{
+		pointDouble(&(tooth[j]), &(tooth[j - 1]));
+		for (i = 1; i < spacing; i++)
+		{
+			pointDouble(&(tooth[j]), &(tooth[j]));
+		}
+	}
+	// Each table entry is built by adding a tooth to a previous table
+	// entry. This never adds a point to itself or its negation, since
+	// the entries are distinct multiples of G which are much less than
+	// the order of G.
+	table = malloc(table_size * sizeof(Point));
+	if (table == NULL)
+	{
+		printf("Error: Could not allocate memory for table\n");
+		exit(1);
+	}
+	for (i = 0; i < table_size; i++)
+	{
+		mpz_init(table[i].x);
+		mpz_init(table[i].y);
+		for (lowest_bit = 0; (((i + 1) >> lowest_bit) & 1) == 0; lowest_bit++)
+		{
+			// do nothing
+		}
+		if ((i + 1) == (1 << lowest_bit))
+		{
+			mpz_set(table[i].x, tooth[lowest_bit].x);
+			mpz_set(table[i].y, tooth[lowest_bit].y);
+		}
+		else
+		{
+			pointAdd(&(table[i]), &(table[(i + 1) - (1 << lowest_bit) - 1]), &(tooth[lowest_bit]));
+		}
+	}
+
+	if (!checkTable(table, teeth, spacing))
+	{
+		exit(1);
+	}
+
+	if (as_header)
+	{
+		printf("// Header generated using \"gen_g_table %d header\".\n", teeth);
+		printf("// Comb table for ecdsaMultiplyG(); see ECDSA_G_TABLE_HEADER in ecdsa.c.\n");
+		printf("\n");
+		printf("#ifndef ECDSA_G_TABLE_H_INCLUDED\n");
+		printf("#define ECDSA_G_TABLE_H_INCLUDED\n");
+		printf("\n");
+		printf("#define G_COMB_TEETH\t\t%d\n", teeth);
+		printf("#define G_COMB_SPACING\t\t%d\n", spacing);
+		printf("\n");
+	}
+	printf("// Table generated using gen_g_table.\n");
+	printf("// Teeth: %d, spacing: %d.\n", teeth, spacing);
+	printf("static const uint32_t secp256k1_G_comb[%d][16] PROGMEM = {\n", table_size);
+	for (i = 0; i < table_size; i++)
+	{
+		printf("{");
+		printComponent(table[i].x);
+		printf(",\n");
+		printComponent(table[i].y);
+		printf("}");
+		if (i != (table_size - 1))
+		{
+			printf(",");
+		}
+		printf("\n");
+	}
+	printf("};\n");
+	if (as_header)
+	{
+		printf("\n");
+		printf("#endif // #ifndef ECDSA_G_TABLE_H_INCLUDED\n");
+	}
+
+	for (i = 0; i < table_size; i++)
+	{
+		mpz_clear(table[i].x);
+		mpz_clear(table[i].y);
+	}
+	free(table);
+	for (j = 0; j < teeth; j++)
+	{
+		mpz_clear(tooth[j].x);
+		mpz_clear(tooth[j].y);
+	}
+	mpz_clear(p);
+	mpz_clear(n);
+	exit(0);
+}
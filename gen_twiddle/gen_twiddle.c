@@ -16,29 +16,106 @@
   * - Only the fractional part of sin(phi) is outputted, since sin(phi) is in
   *   [0, 1) when phi is in [0, pi / 2).
   *
+  * Alternatively, this can generate a full table of complex twiddle factors
+  * (for fft.c's FFT_FULL_TWIDDLE_TABLE option), in the order that fft()
+  * uses them. That's about 8 times as big, but it allows fft() to read
+  * twiddle factors sequentially, without any index arithmetic or folding.
+  * There are two orders: "full" for the radix-2 kernel and "full4" for the
+  * radix-4 kernel (FFT_RADIX4).
+  *
   * This file is licensed as described by the file LICENCE.
   */
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
 
 /** Mmmm. Pie. */
 #define PI					3.141592653589793238462643
 /** Number of constants per line in C source output. */
 #define VALUES_PER_LINE		8
+/** Number of complex constants per line in C source output. */
+#define COMPLEX_VALUES_PER_LINE		4
+
+/** Number of complex constants outputted so far by printComplex(). */
+static int complex_values_printed;
+
+/** Convert a real number to 16.16 fixed-point, rounding to the nearest
+  * integer. Rounding is symmetric about 0, so that (for example) cos(phi)
+  * and -cos(pi - phi) give the same result.
+  * \param x The real number to convert.
+  * \return The fixed-point representation.
+  */
+static long toFixed(double x)
+{
+	// The "* (double)0x00010000" is to convert to 16.16 fixed-point.
+	if (x >= 0.0)
+	{
+		return (long)(x * (double)0x00010000 + 0.5);
+	}
+	else
+	{
+		return -(long)(-x * (double)0x00010000 + 0.5);
+	}
+}
+
+/** Output one fixed-point constant, in hexadecimal.
+  * \param value The constant to output.
+  */
+static void printFixed(long value)
+{
+	if (value < 0)
+	{
+		printf("-0x%08lx", -value);
+	}
+	else
+	{
+		printf(" 0x%08lx", value);
+	}
+}
+
+/** Output one entry of a full twiddle factor table, as a ComplexFixed
+  * initialiser.
+  * \param phi The angle of the twiddle factor, in radians.
+  * \param is_last Non-zero if this is the last entry in the table.
+  */
+static void printComplex(double phi, int is_last)
+{
+	printf("{");
+	printFixed(toFixed(cos(phi)));
+	printf(",");
+	printFixed(toFixed(sin(phi)));
+	printf("}");
+	if (!is_last)
+	{
+		printf(",");
+	}
+	complex_values_printed++;
+	if (((complex_values_printed % COMPLEX_VALUES_PER_LINE) == 0) || is_last)
+	{
+		printf("\n");
+	}
+	else
+	{
+		printf(" ");
+	}
+}
 
 int main(int argc, char **argv)
 {
 	int i;
+	int k;
 	int fft_size;
 	int table_size;
 	unsigned int out; // C spec guarantees unsigned int can hold [0, 65535]
 
-	if (argc != 2)
+	if ((argc != 2) && (argc != 3))
 	{
-		printf("Usage: %s <size>\n", argv[0]);
+		printf("Usage: %s <size> [full | full4]\n", argv[0]);
 		printf("  <size>: size of (complex) FFT\n");
+		printf("  full: generate full table for radix-2 kernel\n");
+		printf("  full4: generate full table for radix-4 kernel\n");
 		printf("\n");
 		exit(1);
 	}
@@ -53,6 +130,47 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
+	if (argc == 3)
+	{
+		printf("// Table generated using gen_twiddle.\n");
+		printf("// FFT size: %d, order: %s.\n", fft_size, argv[2]);
+		printf("static const ComplexFixed full_twiddle_table[%d] = {\n", fft_size - 1);
+		complex_values_printed = 0;
+		if (!strcmp(argv[2], "full"))
+		{
+			// For each radix-2 stage (of span i), fft() needs the i twiddle
+			// factors exp(j * pi * k / i), in order of k.
+			for (i = 1; i < fft_size; i <<= 1)
+			{
+				for (k = 0; k < i; k++)
+				{
+					printComplex(PI * k / (double)i, (i == (fft_size / 2)) && (k == (i - 1)));
+				}
+			}
+		}
+		else if (!strcmp(argv[2], "full4"))
+		{
+			// For each radix-4 stage (of span i), fft() needs
+			// w = exp(j * pi * k / (2 * i)), w ^ 2 then w ^ 3, in order of k.
+			for (i = 1; i < fft_size; i <<= 2)
+			{
+				for (k = 0; k < i; k++)
+				{
+					printComplex(PI * k / (2.0 * i), 0);
+					printComplex(2.0 * PI * k / (2.0 * i), 0);
+					printComplex(3.0 * PI * k / (2.0 * i), ((i << 2) >= fft_size) && (k == (i - 1)));
+				}
+			}
+		}
+		else
+		{
+			printf("Error: Invalid table type\n");
+			exit(1);
+		}
+		printf("};\n");
+		exit(0);
+	}
+
 	// A complex FFT of size fft_size would normally need fft_size / 2 twiddle
 	// factors, corresponding to phi in [0, pi). But since fft.c uses various
 	// symmetries of sin(phi), only the values in [0, pi / 2) are needed.
@@ -70,6 +70,55 @@ void hashWriteByte(HashState *hs, uint8_t byte)
 	}
 }
 
+/** Add many bytes to the message buffer, calling HashState#hashBlock()
+  * whenever the message buffer is full. This has the same effect as
+  * calling hashWriteByte() for each byte, but whole (32 bit) words are
+  * written into the message buffer directly, instead of one byte at a time.
+  * \param hs The hash state to act on.
+  * \param buffer The bytes to add. This must be a byte array with space for
+  *               length bytes.
+  * \param length The number of bytes to add.
+  */
+void hashWriteBytes(HashState *hs, const uint8_t *buffer, uint32_t length)
+{
+	// Get to a word boundary first.
+	while ((length > 0) && (hs->byte_position_m != 0))
+	{
+		hashWriteByte(hs, *buffer);
+		buffer++;
+		length--;
+	}
+	while (length >= 4)
+	{
+		// Since the message buffer is cleared after every block and the
+		// current word hasn't been written to yet, the word can be assigned
+		// instead of ORed in.
+		if (hs->is_big_endian)
+		{
+			hs->m[hs->index_m] = readU32BigEndian(buffer);
+		}
+		else
+		{
+			hs->m[hs->index_m] = readU32LittleEndian(buffer);
+		}
+		hs->index_m++;
+		hs->message_length += 4;
+		buffer += 4;
+		length -= 4;
+		if (hs->index_m == 16)
+		{
+			hs->hashBlock(hs);
+			clearM(hs);
+		}
+	}
+	while (length > 0)
+	{
+		hashWriteByte(hs, *buffer);
+		buffer++;
+		length--;
+	}
+}
+
 /** Finalise the hashing of a message by writing appropriate padding and
   * length bytes.
   * \param hs The hash state to act on.
@@ -77,35 +126,44 @@ void hashWriteByte(HashState *hs, uint8_t byte)
 void hashFinish(HashState *hs)
 {
 	uint32_t length_bits;
+	uint8_t pos; // corrected for endianness
 	uint8_t i;
-	uint8_t buffer[8];
 
-	// Subsequent calls to hashWriteByte() will keep incrementing
-	// message_length, so the calculation of length (in bits) must be
-	// done before padding.
 	length_bits = hs->message_length << 3;
 
 	// Pad using a 1 bit followed by enough 0 bits to get the message buffer
-	// to exactly 448 bits full.
-	hashWriteByte(hs, (uint8_t)0x80);
-	while ((hs->index_m != 14) || (hs->byte_position_m != 0))
-	{
-		hashWriteByte(hs, 0);
-	}
-	// Write 64 bit length (in bits).
-	memset(buffer, 0, 8);
+	// to exactly 448 bits full. The message buffer is cleared after every
+	// block, so everything after the 1 bit is already zero; all that needs
+	// to be done is to place the 1 bit, skip to the next word and then (if
+	// the length won't fit) to the next block.
 	if (hs->is_big_endian)
 	{
-		writeU32BigEndian(&(buffer[4]), length_bits);
+		pos = (uint8_t)(3 - hs->byte_position_m);
 	}
 	else
 	{
-		writeU32LittleEndian(&(buffer[0]), length_bits);
+		pos = hs->byte_position_m;
+	}
+	hs->m[hs->index_m] |= ((uint32_t)0x80 << (pos << 3));
+	hs->index_m++;
+	hs->byte_position_m = 0;
+	if (hs->index_m > 14)
+	{
+		hs->hashBlock(hs);
+		clearM(hs);
+	}
+	// Write 64 bit length (in bits). Lengths are only 32 bits, so the
+	// upper half is always zero.
+	if (hs->is_big_endian)
+	{
+		hs->m[15] = length_bits;
 	}
-	for (i = 0; i < 8; i++)
+	else
 	{
-		hashWriteByte(hs, buffer[i]);
+		hs->m[14] = length_bits;
 	}
+	hs->hashBlock(hs);
+	clearM(hs);
 	// Swap endianness if necessary.
 	if (!hs->is_big_endian)
 	{
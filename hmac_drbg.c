@@ -54,38 +54,24 @@
 #include "test_helpers.h"
 #endif // #ifdef TEST_HMAC_DRBG
 
-/** Calculate a 32 byte HMAC of an arbitrary message and key using SHA-256 as
-  * the hash function.
+/** Precompute the parts of a HMAC-SHA256 calculation which only depend on
+  * the key. These are the hash states after hashing (K_0 XOR ipad) and
+  * (K_0 XOR opad). Since each of those is exactly one SHA-256 block, caching
+  * them saves two SHA-256 compressions for every HMAC calculated using
+  * the same key (see hmacSha256Precomputed()).
   * The code in here is based on the description in section 5
   * ("HMAC SPECIFICATION") of FIPS PUB 198.
-  *
-  * The message can be split up into two separate parts, (denoted by the
-  * parameters text1 and text2). This is done because the HMAC_DRBG update
-  * function uses a message which is concatenated from two pieces of data.
-  * Allowing the message to be split into two parts absolves the caller of
-  * the responsibility of concatenating those pieces into a separate,
-  * contiguous buffer.
-  * \param out A byte array where the HMAC-SHA256 hash value will be written.
-  *            This must have space for #SHA256_HASH_LENGTH bytes.
+  * \param out_inner The hash state after hashing (K_0 XOR ipad) will be
+  *                  written here.
+  * \param out_outer The hash state after hashing (K_0 XOR opad) will be
+  *                  written here.
   * \param key A byte array containing the key to use in the HMAC-SHA256
   *            calculation. The key can be of any length.
   * \param key_length The length, in bytes, of the key.
-  * \param text1 A byte array containing the first part of the message to use
-  *              in the HMAC-SHA256 calculation. The message can be of any
-  *              length.
-  * \param text1_length The length, in bytes, of the first part of the
-  *                     message.
-  * \param text2 A byte array containing the second part of the message to use
-  *              in the HMAC-SHA256 calculation. This part will be appended to
-  *              the first part of the message. This parameter is optional; it
-  *              can be NULL.
-  * \param text2_length The length, in bytes, of the second part of the
-  *                     message.
   */
-static void hmacSha256(uint8_t *out, const uint8_t *key, const unsigned int key_length, const uint8_t *text1, const unsigned int text1_length, const uint8_t *text2, const unsigned int text2_length)
+static void hmacSha256PrecomputeKey(HashState *out_inner, HashState *out_outer, const uint8_t *key, const unsigned int key_length)
 {
 	unsigned int i;
-	uint8_t hash[SHA256_HASH_LENGTH];
 	uint8_t padded_key[64];
 	HashState hs;
 
@@ -105,43 +91,98 @@ static void hmacSha256(uint8_t *out, const uint8_t *key, const unsigned int key_
 		sha256Finish(&hs);
 		writeHashToByteArray(padded_key, &hs, true);
 	}
-	// Calculate hash = H((K_0 XOR ipad) || text).
-	sha256Begin(&hs);
+	// Begin calculating H((K_0 XOR ipad) || text).
+	sha256Begin(out_inner);
+	for (i = 0; i < sizeof(padded_key); i++)
+	{
+		sha256WriteByte(out_inner, (uint8_t)(padded_key[i] ^ 0x36));
+	}
+	// Begin calculating H((K_0 XOR opad) || hash).
+	sha256Begin(out_outer);
 	for (i = 0; i < sizeof(padded_key); i++)
 	{
-		sha256WriteByte(&hs, (uint8_t)(padded_key[i] ^ 0x36));
+		sha256WriteByte(out_outer, (uint8_t)(padded_key[i] ^ 0x5c));
 	}
+}
+
+/** Calculate a 32 byte HMAC of an arbitrary message using SHA-256 as
+  * the hash function, using hash states precomputed by
+  * hmacSha256PrecomputeKey().
+  *
+  * The message can be split up into two separate parts, (denoted by the
+  * parameters text1 and text2). This is done because the HMAC_DRBG update
+  * function uses a message which is concatenated from two pieces of data.
+  * Allowing the message to be split into two parts absolves the caller of
+  * the responsibility of concatenating those pieces into a separate,
+  * contiguous buffer.
+  * \param out A byte array where the HMAC-SHA256 hash value will be written.
+  *            This must have space for #SHA256_HASH_LENGTH bytes.
+  * \param inner The hash state after hashing (K_0 XOR ipad). This will not
+  *              be modified.
+  * \param outer The hash state after hashing (K_0 XOR opad). This will not
+  *              be modified.
+  * \param text1 A byte array containing the first part of the message to use
+  *              in the HMAC-SHA256 calculation. The message can be of any
+  *              length.
+  * \param text1_length The length, in bytes, of the first part of the
+  *                     message.
+  * \param text2 A byte array containing the second part of the message to use
+  *              in the HMAC-SHA256 calculation. This part will be appended to
+  *              the first part of the message. This parameter is optional; it
+  *              can be NULL.
+  * \param text2_length The length, in bytes, of the second part of the
+  *                     message.
+  */
+static void hmacSha256Precomputed(uint8_t *out, const HashState *inner, const HashState *outer, const uint8_t *text1, const unsigned int text1_length, const uint8_t *text2, const unsigned int text2_length)
+{
+	uint8_t hash[SHA256_HASH_LENGTH];
+	HashState hs;
+
+	// Calculate hash = H((K_0 XOR ipad) || text).
 	// Note that text = text1 || text2.
+	hs = *inner;
 	if (text1 != NULL)
 	{
-		for (i = 0; i < text1_length; i++)
-		{
-			sha256WriteByte(&hs, text1[i]);
-		}
+		sha256WriteBytes(&hs, text1, text1_length);
 	}
 	if (text2 != NULL)
 	{
-		for (i = 0; i < text2_length; i++)
-		{
-			sha256WriteByte(&hs, text2[i]);
-		}
+		sha256WriteBytes(&hs, text2, text2_length);
 	}
 	sha256Finish(&hs);
 	writeHashToByteArray(hash, &hs, true);
 	// Calculate H((K_0 XOR opad) || hash).
-	sha256Begin(&hs);
-	for (i = 0; i < sizeof(padded_key); i++)
-	{
-		sha256WriteByte(&hs, (uint8_t)(padded_key[i] ^ 0x5c));
-	}
-	for (i = 0; i < sizeof(hash); i++)
-	{
-		sha256WriteByte(&hs, hash[i]);
-	}
+	hs = *outer;
+	sha256WriteBytes(&hs, hash, sizeof(hash));
 	sha256Finish(&hs);
 	writeHashToByteArray(out, &hs, true);
 }
 
+#ifdef TEST_HMAC_DRBG
+/** Calculate a 32 byte HMAC of an arbitrary message and key using SHA-256 as
+  * the hash function. This is only used to test hmacSha256PrecomputeKey()
+  * and hmacSha256Precomputed() against the HMAC test vectors; the DRBG
+  * functions use those directly so that the key-dependent hash states can
+  * be cached in #HMACDRBGState.
+  * \param out A byte array where the HMAC-SHA256 hash value will be written.
+  *            This must have space for #SHA256_HASH_LENGTH bytes.
+  * \param key A byte array containing the key to use in the HMAC-SHA256
+  *            calculation. The key can be of any length.
+  * \param key_length The length, in bytes, of the key.
+  * \param text A byte array containing the message to use in the
+  *             HMAC-SHA256 calculation. The message can be of any length.
+  * \param text_length The length, in bytes, of the message.
+  */
+static void hmacSha256(uint8_t *out, const uint8_t *key, const unsigned int key_length, const uint8_t *text, const unsigned int text_length)
+{
+	HashState inner;
+	HashState outer;
+
+	hmacSha256PrecomputeKey(&inner, &outer, key, key_length);
+	hmacSha256Precomputed(out, &inner, &outer, text, text_length, NULL, 0);
+}
+#endif // #ifdef TEST_HMAC_DRBG
+
 /** HMAC_DRBG update function. This is a function common to all HMAC_DRBG
   * operations. This function updates the internal state of the DRBG, mixing
   * in some (optional) provided data.
@@ -158,25 +199,29 @@ static void hmacSha256(uint8_t *out, const uint8_t *key, const unsigned int key_
 static void drbgUpdate(HMACDRBGState *state, const uint8_t *provided_data, const unsigned int provided_data_length)
 {
 	uint8_t temp[SHA256_HASH_LENGTH + 1];
+	uint8_t key[SHA256_HASH_LENGTH];
 
 	// This algorithm is described in pages 45-46 of NIST SP 800-90A.
 	// 1. K = HMAC (K, V || 0x00 || provided_data).
 	memcpy(temp, state->v, sizeof(state->v));
 	temp[SHA256_HASH_LENGTH] = 0x00;
-	hmacSha256(state->key, state->key, sizeof(state->key), temp, sizeof(temp), provided_data, provided_data_length);
+	hmacSha256Precomputed(key, &(state->inner), &(state->outer), temp, sizeof(temp), provided_data, provided_data_length);
+	hmacSha256PrecomputeKey(&(state->inner), &(state->outer), key, sizeof(key));
 	// 2. V = HMAC (K, V).
-	hmacSha256(state->v, state->key, sizeof(state->key), state->v, sizeof(state->v), NULL, 0);
+	hmacSha256Precomputed(state->v, &(state->inner), &(state->outer), state->v, sizeof(state->v), NULL, 0);
 	// 3. If (provided_data = Null), then return K and V.
 	if (provided_data != NULL)
 	{
 		// 4. K = HMAC (K, V || 0x01 || provided_data).
 		memcpy(temp, state->v, sizeof(state->v));
 		temp[SHA256_HASH_LENGTH] = 0x01;
-		hmacSha256(state->key, state->key, sizeof(state->key), temp, sizeof(temp), provided_data, provided_data_length);
+		hmacSha256Precomputed(key, &(state->inner), &(state->outer), temp, sizeof(temp), provided_data, provided_data_length);
+		hmacSha256PrecomputeKey(&(state->inner), &(state->outer), key, sizeof(key));
 		// 5. V = HMAC (K, V).
-		hmacSha256(state->v, state->key, sizeof(state->key), state->v, sizeof(state->v), NULL, 0);
+		hmacSha256Precomputed(state->v, &(state->inner), &(state->outer), state->v, sizeof(state->v), NULL, 0);
 		// 6. Return K and V.
 	}
+	memset(key, 0, sizeof(key));
 }
 
 /** Instantiate a HMAC_DRBG state using some seed material.
@@ -194,7 +239,10 @@ static void drbgUpdate(HMACDRBGState *state, const uint8_t *provided_data, const
   */
 void drbgInstantiate(HMACDRBGState *state, const uint8_t *seed_material, const unsigned int seed_material_length)
 {
-	memset(state->key, 0x00, sizeof(state->key));
+	uint8_t key[SHA256_HASH_LENGTH];
+
+	memset(key, 0x00, sizeof(key));
+	hmacSha256PrecomputeKey(&(state->inner), &(state->outer), key, sizeof(key));
 	memset(state->v, 0x01, sizeof(state->v));
 	drbgUpdate(state, seed_material, seed_material_length);
 }
@@ -243,7 +291,7 @@ void drbgGenerate(uint8_t *out, HMACDRBGState *state, const unsigned int request
 	while (bytes < requested_bytes)
 	{
 		// V = HMAC (Key, V).
-		hmacSha256(state->v, state->key, sizeof(state->key), state->v, sizeof(state->v), NULL, 0);
+		hmacSha256Precomputed(state->v, &(state->inner), &(state->outer), state->v, sizeof(state->v), NULL, 0);
 		copy_size = MIN(requested_bytes - bytes, sizeof(state->v));
 		memcpy(&(out[bytes]), state->v, copy_size);
 		bytes += copy_size;
@@ -362,7 +410,7 @@ http://csrc.nist.gov/groups/STM/cavp/index.html#07", filename);
 		readHexVariableAssignment(&expected_result, "Mac = ", result_length, f);
 		skipWhiteSpace(f);
 		// Calculate HMAC-SHA256 and compare.
-		hmacSha256(actual_result, key, key_length, message, message_length, NULL, 0);
+		hmacSha256(actual_result, key, key_length, message, message_length);
 		compare_length = MIN(result_length, sizeof(actual_result));
 		if (!memcmp(actual_result, expected_result, compare_length))
 		{
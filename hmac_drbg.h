@@ -16,9 +16,14 @@
   * used for bit generation via. drbgGenerate(). */
 typedef struct HMACDRBGStateStruct
 {
-	/** This is sometimes called "K" in NIST SP 800-90A. It is usually used as
-	  * the key in HMAC invocations. */
-	uint8_t key[SHA256_HASH_LENGTH];
+	/** Hash state after hashing (K XOR ipad), where K is sometimes called
+	  * "K" in NIST SP 800-90A. K is only ever used as the key in HMAC
+	  * invocations, so instead of storing K itself, the key-dependent parts
+	  * of those HMAC invocations are stored. This halves the number of
+	  * SHA-256 compressions needed per HMAC invocation. */
+	HashState inner;
+	/** Hash state after hashing (K XOR opad). See #inner. */
+	HashState outer;
 	/** This is sometimes called "V" in NIST SP 800-90A This is usually used as
 	  * the message/value in HMAC invocations. */
 	uint8_t v[SHA256_HASH_LENGTH];
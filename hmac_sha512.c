@@ -51,22 +51,6 @@ static uint64_t my_pgm_read_qword_near(const void *address)
 #define LOOKUP_QWORD(x)		(x)
 #endif // #if defined(AVR) && defined(__GNUC__)
 
-/** Container for 64 bit hash state. */
-typedef struct HashState64Struct
-{
-	/** Where final hash value will be placed. */
-	uint64_t h[8];
-	/** Current index into HashState64#m, ranges from 0 to 15. */
-	uint8_t index_m;
-	/** Current byte within (64 bit) double word of HashState64#m. 0 = most
-	  * significant byte, 7 = least significant byte. */
-	uint8_t byte_position_m;
-	/** 1024 bit message buffer. */
-	uint64_t m[16];
-	/** Total length of message; updated as bytes are written. */
-	uint32_t message_length;
-} HashState64;
-
 /** Constants for SHA-512. See section 4.2.3 of FIPS PUB 180-4. */
 static const uint64_t k[80] PROGMEM = {
 0x428a2f98d728ae22, 0x7137449123ef65cd, 0xb5c0fbcfec4d3b2f, 0xe9b5dba58189dbbc,
@@ -90,12 +74,151 @@ static const uint64_t k[80] PROGMEM = {
 0x28db77f523047d84, 0x32caab7b40c72493, 0x3c9ebe0a15c9bebc, 0x431d67c49c100d4c,
 0x4cc5d4becb3e42b6, 0x597f299cfc657e2a, 0x5fcb6fab3ad6faec, 0x6c44198c4a475817};
 
+#ifdef SHA512_32BIT
+
+/**
+ * \defgroup Split64 64 bit operations on pairs of 32 bit words.
+ *
+ * On targets without native 64 bit arithmetic (e.g. the Cortex-M0), every
+ * 64 bit rotate or add becomes a library call or a long instruction
+ * sequence. These macros operate on the high and low halves of 64 bit
+ * integers directly. Rotations by 32 or more are done by swapping the
+ * halves and rotating by the remainder, so every shift amount is a constant
+ * less than 32.
+ *
+ * @{
+ */
+/** Add the 64 bit integer (hi, lo) to (dest_hi, dest_lo). */
+#define ADD64(dest_hi, dest_lo, hi, lo)		\
+	do										\
+	{										\
+		(dest_lo) += (lo);					\
+		(dest_hi) += (hi) + ((dest_lo) < (lo));	\
+	} while (0)
+/** High half of the 64 bit integer (hi, lo) rotated right by n (n < 32). */
+#define ROTR_HI(hi, lo, n)	(((hi) >> (n)) | ((lo) << (32 - (n))))
+/** Low half of the 64 bit integer (hi, lo) rotated right by n (n < 32). */
+#define ROTR_LO(hi, lo, n)	(((lo) >> (n)) | ((hi) << (32 - (n))))
+/** High half of function (4.10) in section 4.1.3 of FIPS PUB 180-4.
+  * Rotations are by 28, 34 (32 + 2) and 39 (32 + 7). */
+#define BIG_SIGMA0_HI(hi, lo)	(ROTR_HI(hi, lo, 28) ^ ROTR_LO(hi, lo, 2) ^ ROTR_LO(hi, lo, 7))
+/** Low half of function (4.10) in section 4.1.3 of FIPS PUB 180-4. */
+#define BIG_SIGMA0_LO(hi, lo)	(ROTR_LO(hi, lo, 28) ^ ROTR_HI(hi, lo, 2) ^ ROTR_HI(hi, lo, 7))
+/** High half of function (4.11) in section 4.1.3 of FIPS PUB 180-4.
+  * Rotations are by 14, 18 and 41 (32 + 9). */
+#define BIG_SIGMA1_HI(hi, lo)	(ROTR_HI(hi, lo, 14) ^ ROTR_HI(hi, lo, 18) ^ ROTR_LO(hi, lo, 9))
+/** Low half of function (4.11) in section 4.1.3 of FIPS PUB 180-4. */
+#define BIG_SIGMA1_LO(hi, lo)	(ROTR_LO(hi, lo, 14) ^ ROTR_LO(hi, lo, 18) ^ ROTR_HI(hi, lo, 9))
+/** High half of function (4.12) in section 4.1.3 of FIPS PUB 180-4.
+  * Rotations are by 1 and 8, and the shift is by 7. */
+#define LITTLE_SIGMA0_HI(hi, lo)	(ROTR_HI(hi, lo, 1) ^ ROTR_HI(hi, lo, 8) ^ ((hi) >> 7))
+/** Low half of function (4.12) in section 4.1.3 of FIPS PUB 180-4. */
+#define LITTLE_SIGMA0_LO(hi, lo)	(ROTR_LO(hi, lo, 1) ^ ROTR_LO(hi, lo, 8) ^ ROTR_LO(hi, lo, 7))
+/** High half of function (4.13) in section 4.1.3 of FIPS PUB 180-4.
+  * Rotations are by 19 and 61 (32 + 29), and the shift is by 6. */
+#define LITTLE_SIGMA1_HI(hi, lo)	(ROTR_HI(hi, lo, 19) ^ ROTR_LO(hi, lo, 29) ^ ((hi) >> 6))
+/** Low half of function (4.13) in section 4.1.3 of FIPS PUB 180-4. */
+#define LITTLE_SIGMA1_LO(hi, lo)	(ROTR_LO(hi, lo, 19) ^ ROTR_HI(hi, lo, 29) ^ ROTR_LO(hi, lo, 6))
+/** Function (4.8) in section 4.1.3 of FIPS PUB 180-4, for one half. */
+#define CH32(x, y, z)		((z) ^ ((x) & ((y) ^ (z))))
+/** Function (4.9) in section 4.1.3 of FIPS PUB 180-4, for one half. */
+#define MAJ32(x, y, z)		(((x) & (y)) | ((z) & ((x) | (y))))
+/**@}*/
+
+/** Update hash value based on the contents of a full message buffer.
+  * This implements the pseudo-code in section 6.4.2 of FIPS PUB 180-4,
+  * using only 32 bit arithmetic (see \ref Split64).
+  *
+  * The message schedule is only 16 words long; word t replaces word t - 16,
+  * which is no longer needed. The working variables are kept in a circular
+  * buffer, so that instead of shifting them along after every round, only
+  * the ones which change (d and h) are written to.
+  * \param hs64 The 64 bit hash state to update.
+  */
+static RAM_FUNCTION void sha512Block(HashState64 *hs64)
+{
+	uint32_t v_hi[8];
+	uint32_t v_lo[8];
+	uint32_t w_hi[16];
+	uint32_t w_lo[16];
+	uint32_t t1_hi, t1_lo;
+	uint32_t t2_hi, t2_lo;
+	uint32_t x_hi, x_lo;
+	uint64_t kt;
+	uint8_t t;
+	uint8_t j;
+	uint8_t a, b, c, d, e, f, g, h;
+
+	for (t = 0; t < 16; t++)
+	{
+		w_hi[t] = (uint32_t)(hs64->m[t] >> 32);
+		w_lo[t] = (uint32_t)hs64->m[t];
+	}
+	for (t = 0; t < 8; t++)
+	{
+		v_hi[t] = (uint32_t)(hs64->h[t] >> 32);
+		v_lo[t] = (uint32_t)hs64->h[t];
+	}
+	for (t = 0; t < 80; t++)
+	{
+		j = (uint8_t)(t & 15);
+		if (t >= 16)
+		{
+			// w[t] = littleSigma1(w[t - 2]) + w[t - 7]
+			//        + littleSigma0(w[t - 15]) + w[t - 16]
+			x_hi = w_hi[(t - 2) & 15];
+			x_lo = w_lo[(t - 2) & 15];
+			ADD64(w_hi[j], w_lo[j], LITTLE_SIGMA1_HI(x_hi, x_lo), LITTLE_SIGMA1_LO(x_hi, x_lo));
+			ADD64(w_hi[j], w_lo[j], w_hi[(t - 7) & 15], w_lo[(t - 7) & 15]);
+			x_hi = w_hi[(t - 15) & 15];
+			x_lo = w_lo[(t - 15) & 15];
+			ADD64(w_hi[j], w_lo[j], LITTLE_SIGMA0_HI(x_hi, x_lo), LITTLE_SIGMA0_LO(x_hi, x_lo));
+		}
+		// Working variable a is at index -t (mod 8) of the circular buffer,
+		// b is at index -t + 1 and so on.
+		a = (uint8_t)((8 - (t & 7)) & 7);
+		b = (uint8_t)((a + 1) & 7);
+		c = (uint8_t)((a + 2) & 7);
+		d = (uint8_t)((a + 3) & 7);
+		e = (uint8_t)((a + 4) & 7);
+		f = (uint8_t)((a + 5) & 7);
+		g = (uint8_t)((a + 6) & 7);
+		h = (uint8_t)((a + 7) & 7);
+		// t1 = h + bigSigma1(e) + ch(e, f, g) + k[t] + w[t]
+		kt = LOOKUP_QWORD(k[t]);
+		t1_hi = v_hi[h];
+		t1_lo = v_lo[h];
+		ADD64(t1_hi, t1_lo, BIG_SIGMA1_HI(v_hi[e], v_lo[e]), BIG_SIGMA1_LO(v_hi[e], v_lo[e]));
+		ADD64(t1_hi, t1_lo, CH32(v_hi[e], v_hi[f], v_hi[g]), CH32(v_lo[e], v_lo[f], v_lo[g]));
+		ADD64(t1_hi, t1_lo, (uint32_t)(kt >> 32), (uint32_t)kt);
+		ADD64(t1_hi, t1_lo, w_hi[j], w_lo[j]);
+		// t2 = bigSigma0(a) + maj(a, b, c)
+		t2_hi = BIG_SIGMA0_HI(v_hi[a], v_lo[a]);
+		t2_lo = BIG_SIGMA0_LO(v_hi[a], v_lo[a]);
+		ADD64(t2_hi, t2_lo, MAJ32(v_hi[a], v_hi[b], v_hi[c]), MAJ32(v_lo[a], v_lo[b], v_lo[c]));
+		// Next round's e is d + t1 and next round's a is t1 + t2; those
+		// are in the slots that this round's d and h occupy.
+		ADD64(v_hi[d], v_lo[d], t1_hi, t1_lo);
+		v_hi[h] = t1_hi;
+		v_lo[h] = t1_lo;
+		ADD64(v_hi[h], v_lo[h], t2_hi, t2_lo);
+	}
+	// After 80 rounds (a multiple of 8), every working variable is back
+	// where it started.
+	for (t = 0; t < 8; t++)
+	{
+		hs64->h[t] += ((uint64_t)v_hi[t] << 32) | v_lo[t];
+	}
+}
+
+#else
+
 /** 64 bit rotate right.
   * \param x The integer to rotate right.
   * \param n Number of times to rotate right.
   * \return The rotated integer.
   */
-static uint64_t rotateRight(const uint64_t x, const uint8_t n)
+static RAM_FUNCTION_HELPER uint64_t rotateRight(const uint64_t x, const uint8_t n)
 {
 	return (x >> n) | (x << (64 - n));
 }
@@ -106,7 +229,7 @@ static uint64_t rotateRight(const uint64_t x, const uint8_t n)
   * \param z Third input integer.
   * \return Non-linear combination of x, y and z.
   */
-static uint64_t ch(const uint64_t x, const uint64_t y, const uint64_t z)
+static RAM_FUNCTION_HELPER uint64_t ch(const uint64_t x, const uint64_t y, const uint64_t z)
 {
 	return (x & y) ^ ((~x) & z);
 }
@@ -117,7 +240,7 @@ static uint64_t ch(const uint64_t x, const uint64_t y, const uint64_t z)
   * \param z Third input integer.
   * \return Non-linear combination of x, y and z.
   */
-static uint64_t maj(const uint64_t x, const uint64_t y, const uint64_t z)
+static RAM_FUNCTION_HELPER uint64_t maj(const uint64_t x, const uint64_t y, const uint64_t z)
 {
 	return (x & y) ^ (x & z) ^ (y & z);
 }
@@ -126,7 +249,7 @@ static uint64_t maj(const uint64_t x, const uint64_t y, const uint64_t z)
   * \param x Input integer.
   * \return Transformed integer.
   */
-static uint64_t bigSigma0(const uint64_t x)
+static RAM_FUNCTION_HELPER uint64_t bigSigma0(const uint64_t x)
 {
 	return rotateRight(x, 28) ^ rotateRight(x, 34) ^ rotateRight(x, 39);
 }
@@ -135,7 +258,7 @@ static uint64_t bigSigma0(const uint64_t x)
   * \param x Input integer.
   * \return Transformed integer.
   */
-static uint64_t bigSigma1(const uint64_t x)
+static RAM_FUNCTION_HELPER uint64_t bigSigma1(const uint64_t x)
 {
 	return rotateRight(x, 14) ^ rotateRight(x, 18) ^ rotateRight(x, 41);
 }
@@ -144,7 +267,7 @@ static uint64_t bigSigma1(const uint64_t x)
   * \param x Input integer.
   * \return Transformed integer.
   */
-static uint64_t littleSigma0(const uint64_t x)
+static RAM_FUNCTION_HELPER uint64_t littleSigma0(const uint64_t x)
 {
 	return rotateRight(x, 1) ^ rotateRight(x, 8) ^ (x >> 7);
 }
@@ -153,7 +276,7 @@ static uint64_t littleSigma0(const uint64_t x)
   * \param x Input integer.
   * \return Transformed integer.
   */
-static uint64_t littleSigma1(const uint64_t x)
+static RAM_FUNCTION_HELPER uint64_t littleSigma1(const uint64_t x)
 {
 	return rotateRight(x, 19) ^ rotateRight(x, 61) ^ (x >> 6);
 }
@@ -162,7 +285,7 @@ static uint64_t littleSigma1(const uint64_t x)
   * This implements the pseudo-code in section 6.4.2 of FIPS PUB 180-4.
   * \param hs64 The 64 bit hash state to update.
   */
-static void sha512Block(HashState64 *hs64)
+static RAM_FUNCTION void sha512Block(HashState64 *hs64)
 {
 	uint64_t a, b, c, d, e, f, g, h;
 	uint64_t t1, t2;
@@ -208,6 +331,8 @@ static void sha512Block(HashState64 *hs64)
 	hs64->h[7] += h;
 }
 
+#endif // #ifdef SHA512_32BIT
+
 /** Clear the message buffer.
   * \param hs64 The 64 bit hash state to act on.
   */
@@ -264,36 +389,45 @@ static void sha512WriteByte(HashState64 *hs64, const uint8_t byte)
 }
 
 /** Finalise the hashing of a message by writing appropriate padding and
-  * length bytes, then write the hash value into a byte array.
-  * \param out A byte array where the final SHA-512 hash value will be written
-  *            into. This must have space for #SHA512_HASH_LENGTH bytes.
+  * length words. Afterwards, the hash value is in HashState64#h and the
+  * message buffer is cleared.
   * \param hs64 The 64 bit hash state to act on.
   */
-static void sha512Finish(uint8_t *out, HashState64 *hs64)
+static void sha512Pad(HashState64 *hs64)
 {
 	uint32_t length_bits;
-	uint8_t i;
-	uint8_t buffer[16];
 
-	// Subsequent calls to sha512WriteByte() will keep incrementing
-	// message_length, so the calculation of length (in bits) must be
-	// done before padding.
 	length_bits = hs64->message_length << 3;
 
 	// Pad using a 1 bit followed by enough 0 bits to get the message buffer
-	// to exactly 896 bits full.
-	sha512WriteByte(hs64, (uint8_t)0x80);
-	while ((hs64->index_m != 14) || (hs64->byte_position_m != 0))
-	{
-		sha512WriteByte(hs64, 0);
-	}
-	// Write 128 bit length (in bits).
-	memset(buffer, 0, 16);
-	writeU32BigEndian(&(buffer[12]), length_bits);
-	for (i = 0; i < 16; i++)
+	// to exactly 896 bits full. The message buffer is cleared after every
+	// block, so everything after the 1 bit is already zero; all that needs
+	// to be done is to skip to the next double word and then (if the
+	// length won't fit) to the next block.
+	hs64->m[hs64->index_m] |= ((uint64_t)0x80 << ((7 - hs64->byte_position_m) << 3));
+	hs64->index_m++;
+	hs64->byte_position_m = 0;
+	if (hs64->index_m > 14)
 	{
-		sha512WriteByte(hs64, buffer[i]);
+		sha512Block(hs64);
+		clearM(hs64);
 	}
+	// Write 128 bit length (in bits). Lengths are only 32 bits, so
+	// everything but the last double word is always zero.
+	hs64->m[15] = length_bits;
+	sha512Block(hs64);
+	clearM(hs64);
+}
+
+/** Write the hash value of a finished hash into a byte array.
+  * \param out A byte array where the final SHA-512 hash value will be written
+  *            into. This must have space for #SHA512_HASH_LENGTH bytes.
+  * \param hs64 The 64 bit hash state to read the hash value from.
+  */
+static void writeSha512Hash(uint8_t *out, const HashState64 *hs64)
+{
+	uint8_t i;
+
 	for (i = 0; i < 8; i++)
 	{
 		writeU32BigEndian(&(out[i * 8]), (uint32_t)(hs64->h[i] >> 32));
@@ -301,6 +435,18 @@ static void sha512Finish(uint8_t *out, HashState64 *hs64)
 	}
 }
 
+/** Finalise the hashing of a message by writing appropriate padding and
+  * length bytes, then write the hash value into a byte array.
+  * \param out A byte array where the final SHA-512 hash value will be written
+  *            into. This must have space for #SHA512_HASH_LENGTH bytes.
+  * \param hs64 The 64 bit hash state to act on.
+  */
+static void sha512Finish(uint8_t *out, HashState64 *hs64)
+{
+	sha512Pad(hs64);
+	writeSha512Hash(out, hs64);
+}
+
 /** Calculate a 64 byte HMAC of an arbitrary message and key using SHA-512 as
   * the hash function.
   * The code in here is based on the description in section 5
@@ -315,11 +461,33 @@ static void sha512Finish(uint8_t *out, HashState64 *hs64)
   * \param text_length The length, in bytes, of the message.
   */
 void hmacSha512(uint8_t *out, const uint8_t *key, const unsigned int key_length, const uint8_t *text, const unsigned int text_length)
+{
+	HmacSha512Context context;
+
+	hmacSha512PrepareKey(&context, key, key_length);
+	hmacSha512Prepared(out, &context, text, text_length);
+	memset(&context, 0, sizeof(context));
+}
+
+/** Prepare a HMAC-SHA512 context for a key, so that many HMAC-SHA512 values
+  * which use the same key can be calculated (using hmacSha512Prepared())
+  * without processing the key each time.
+  *
+  * The two hash states in the context are advanced past the
+  * (K_0 XOR ipad) and (K_0 XOR opad) blocks. Those blocks are exactly one
+  * SHA-512 block long, so this saves two SHA-512 compressions for each
+  * HMAC-SHA512 calculation.
+  * \param context The context to prepare. Since this contains state derived
+  *                from the key, it should be cleared once it is no longer
+  *                needed.
+  * \param key A byte array containing the key to use in the HMAC-SHA512
+  *            calculation. The key can be of any length.
+  * \param key_length The length, in bytes, of the key.
+  */
+void hmacSha512PrepareKey(HmacSha512Context *context, const uint8_t *key, const unsigned int key_length)
 {
 	unsigned int i;
-	uint8_t hash[SHA512_HASH_LENGTH];
 	uint8_t padded_key[128];
-	HashState64 hs64;
 
 	// Determine key.
 	memset(padded_key, 0, sizeof(padded_key));
@@ -329,35 +497,86 @@ void hmacSha512(uint8_t *out, const uint8_t *key, const unsigned int key_length,
 	}
 	else
 	{
-		sha512Begin(&hs64);
+		sha512Begin(&(context->inner));
 		for (i = 0; i < key_length; i++)
 		{
-			sha512WriteByte(&hs64, key[i]);
+			sha512WriteByte(&(context->inner), key[i]);
 		}
-		sha512Finish(padded_key, &hs64);
+		sha512Finish(padded_key, &(context->inner));
 	}
-	// Calculate hash = H((K_0 XOR ipad) || text).
-	sha512Begin(&hs64);
+	// Start calculating H((K_0 XOR ipad) || text).
+	sha512Begin(&(context->inner));
 	for (i = 0; i < sizeof(padded_key); i++)
 	{
-		sha512WriteByte(&hs64, (uint8_t)(padded_key[i] ^ 0x36));
+		sha512WriteByte(&(context->inner), (uint8_t)(padded_key[i] ^ 0x36));
 	}
-	for (i = 0; i < text_length; i++)
+	// Start calculating H((K_0 XOR opad) || hash).
+	sha512Begin(&(context->outer));
+	for (i = 0; i < sizeof(padded_key); i++)
 	{
-		sha512WriteByte(&hs64, text[i]);
+		sha512WriteByte(&(context->outer), (uint8_t)(padded_key[i] ^ 0x5c));
 	}
-	sha512Finish(hash, &hs64);
-	// Calculate H((K_0 XOR opad) || hash).
-	sha512Begin(&hs64);
-	for (i = 0; i < sizeof(padded_key); i++)
+	memset(padded_key, 0, sizeof(padded_key));
+}
+
+/** Calculate a 64 byte HMAC of an arbitrary message using SHA-512 as
+  * the hash function, using a key which has already been processed by
+  * hmacSha512PrepareKey(). The result is the same as if hmacSha512() had
+  * been called with that key.
+  * \param out A byte array where the HMAC-SHA512 hash value will be written.
+  *            This must have space for #SHA512_HASH_LENGTH bytes.
+  * \param context A context which was prepared using hmacSha512PrepareKey().
+  *                This is not modified, so it can be used again.
+  * \param text A byte array containing the message to use in the HMAC-SHA512
+  *             calculation. The message can be of any length.
+  * \param text_length The length, in bytes, of the message.
+  */
+void hmacSha512Prepared(uint8_t *out, const HmacSha512Context *context, const uint8_t *text, const unsigned int text_length)
+{
+	hmacSha512PreparedConcatenated(out, context, text, text_length, NULL, 0);
+}
+
+/** Like hmacSha512Prepared(), except that the message is the concatenation
+  * of two byte arrays. This saves callers (like pbkdf2()) from having to copy
+  * both parts into one buffer, which would limit how long they could be.
+  * \param out A byte array where the HMAC-SHA512 hash value will be written.
+  *            This must have space for #SHA512_HASH_LENGTH bytes.
+  * \param context A context which was prepared using hmacSha512PrepareKey().
+  *                This is not modified, so it can be used again.
+  * \param text1 A byte array containing the first part of the message.
+  * \param text1_length The length, in bytes, of the first part.
+  * \param text2 A byte array containing the second part of the message. This
+  *              may be NULL if text2_length is 0.
+  * \param text2_length The length, in bytes, of the second part.
+  */
+void hmacSha512PreparedConcatenated(uint8_t *out, const HmacSha512Context *context, const uint8_t *text1, const unsigned int text1_length, const uint8_t *text2, const unsigned int text2_length)
+{
+	unsigned int i;
+	uint64_t hash[8];
+	HashState64 hs64;
+
+	// Calculate hash = H((K_0 XOR ipad) || text1 || text2).
+	memcpy(&hs64, &(context->inner), sizeof(hs64));
+	for (i = 0; i < text1_length; i++)
 	{
-		sha512WriteByte(&hs64, (uint8_t)(padded_key[i] ^ 0x5c));
+		sha512WriteByte(&hs64, text1[i]);
 	}
-	for (i = 0; i < sizeof(hash); i++)
+	for (i = 0; i < text2_length; i++)
 	{
-		sha512WriteByte(&hs64, hash[i]);
+		sha512WriteByte(&hs64, text2[i]);
 	}
-	sha512Finish(out, &hs64);
+	sha512Pad(&hs64);
+	memcpy(hash, hs64.h, sizeof(hash));
+	// Calculate H((K_0 XOR opad) || hash). The outer hash state is at a
+	// block boundary and hash is exactly half a block, so the final block
+	// is entirely predictable: hash, the 1 bit of padding, and a length of
+	// 1536 bits (one block for (K_0 XOR opad), plus half a block for hash).
+	memcpy(&hs64, &(context->outer), sizeof(hs64));
+	memcpy(hs64.m, hash, sizeof(hash));
+	hs64.m[8] = 0x8000000000000000;
+	hs64.m[15] = (128 + SHA512_HASH_LENGTH) << 3;
+	sha512Block(&hs64);
+	writeSha512Hash(out, &hs64);
 }
 
 #ifdef TEST_HMAC_SHA512
@@ -382,7 +601,9 @@ static void scanTestVectors(char *filename)
 	uint8_t *message;
 	uint8_t *expected_result;
 	uint8_t actual_result[SHA512_HASH_LENGTH];
+	uint8_t prepared_result[SHA512_HASH_LENGTH];
 	char buffer[2048];
+	HmacSha512Context context;
 
 	f = fopen(filename, "r");
 	if (f == NULL)
@@ -475,6 +696,20 @@ http://csrc.nist.gov/groups/STM/cavp/index.html#07", filename);
 			printf("Test number %d failed (key len = %u, result len = %u)\n", test_number, key_length, result_length);
 			reportFailure();
 		}
+		// A prepared context should give the same result, even when it is
+		// used more than once.
+		hmacSha512PrepareKey(&context, key, key_length);
+		hmacSha512Prepared(prepared_result, &context, message, message_length);
+		hmacSha512Prepared(prepared_result, &context, message, message_length);
+		if (!memcmp(prepared_result, expected_result, compare_length))
+		{
+			reportSuccess();
+		}
+		else
+		{
+			printf("Test number %d failed with prepared key\n", test_number);
+			reportFailure();
+		}
 		free(key);
 		free(message);
 		free(expected_result);
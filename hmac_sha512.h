@@ -13,6 +13,35 @@
 /** Number of bytes a SHA-512 hash requires. */
 #define SHA512_HASH_LENGTH		64
 
+/** Container for 64 bit hash state. */
+typedef struct HashState64Struct
+{
+	/** Where final hash value will be placed. */
+	uint64_t h[8];
+	/** Current index into HashState64#m, ranges from 0 to 15. */
+	uint8_t index_m;
+	/** Current byte within (64 bit) double word of HashState64#m. 0 = most
+	  * significant byte, 7 = least significant byte. */
+	uint8_t byte_position_m;
+	/** 1024 bit message buffer. */
+	uint64_t m[16];
+	/** Total length of message; updated as bytes are written. */
+	uint32_t message_length;
+} HashState64;
+
+/** HMAC-SHA512 state which only depends on the key. See
+  * hmacSha512PrepareKey(). */
+typedef struct HmacSha512ContextStruct
+{
+	/** Hash state after the (K_0 XOR ipad) block has been written. */
+	HashState64 inner;
+	/** Hash state after the (K_0 XOR opad) block has been written. */
+	HashState64 outer;
+} HmacSha512Context;
+
 extern void hmacSha512(uint8_t *out, const uint8_t *key, const unsigned int key_length, const uint8_t *text, const unsigned int text_length);
+extern void hmacSha512PrepareKey(HmacSha512Context *context, const uint8_t *key, const unsigned int key_length);
+extern void hmacSha512Prepared(uint8_t *out, const HmacSha512Context *context, const uint8_t *text, const unsigned int text_length);
+extern void hmacSha512PreparedConcatenated(uint8_t *out, const HmacSha512Context *context, const uint8_t *text1, const unsigned int text1_length, const uint8_t *text2, const unsigned int text2_length);
 
 #endif // #ifndef HMAC_SHA512_H_INCLUDED
@@ -0,0 +1,17 @@
+/** \file host.h
+  *
+  * \brief Describes functions exported by the host build's platform files.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifndef HOST_H_INCLUDED
+#define HOST_H_INCLUDED
+
+#include "../common.h"
+
+extern void initHostStream(int fd);
+extern bool openNVFile(const char *filename);
+extern void initUserInterface(bool auto_approve);
+
+#endif // #ifndef HOST_H_INCLUDED
@@ -0,0 +1,505 @@
+/** \file main.c
+  *
+  * \brief Entry point for the host build of the hardware Bitcoin wallet.
+  *
+  * The host build runs the full firmware (stream_comm.c, wallet.c,
+  * transaction.c, prandom.c etc.) as an ordinary process, so that client
+  * software can be tested (or load tested) against it, and so that the
+  * platform-independent code can be profiled with real profilers. The
+  * communication stream is a TCP or Unix domain socket (see stream.c) and
+  * non-volatile storage is a memory-mapped file (see nv_file.c).
+  *
+  * Connections are handled one at a time. Each connection is handled by a
+  * child process, which starts from a fresh copy of the firmware's RAM,
+  * just like a real device being plugged in. That way, a client which goes
+  * away in the middle of something can't leave the next client with a
+  * half-finished transaction. Anything written to non-volatile storage is
+  * shared, of course. Use the "-1" option to handle a single connection
+  * without forking, which is easier for profilers and debuggers to follow.
+  *
+  * If PC_SAMPLING is defined, the PC sampler (see pc_sampling.c) is driven
+  * by a SIGPROF timer, so it samples processor time rather than wall clock
+  * time. Its histogram is kept in memory shared by every child process, so
+  * that one client can read the samples taken while another client was
+  * connected. Addresses are reported relative to where the executable was
+  * loaded, so that they match the executable's symbol table even if it is
+  * position independent.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifdef PC_SAMPLING
+// Needed for dl_iterate_phdr() and REG_RIP.
+#define _GNU_SOURCE
+#endif // #ifdef PC_SAMPLING
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#ifdef PC_SAMPLING
+#include <link.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#endif // #ifdef PC_SAMPLING
+#include "../common.h"
+#include "../hwinterface.h"
+#include "../pc_sampling.h"
+#include "../stream_comm.h"
+#include "../wallet.h"
+#include "host.h"
+
+/** Default TCP port to listen on. */
+#define DEFAULT_TCP_PORT		7654
+/** Default name of non-volatile storage file. */
+#define DEFAULT_NV_FILENAME		"wallet_storage.bin"
+
+/** This will be called whenever something very unexpected occurs. This
+  * function must not return. */
+void fatalError(void)
+{
+	fprintf(stderr, "************\n");
+	fprintf(stderr, "FATAL ERROR!\n");
+	fprintf(stderr, "************\n");
+	exit(1);
+}
+
+/** PBKDF2 is used to derive encryption keys. This returns the same number of
+  * iterations as the hardware ports, so that the host build does as much work
+  * per key derivation as a real device.
+  * \return Number of iterations to use in PBKDF2 algorithm.
+  */
+uint32_t getPBKDF2Iterations(void)
+{
+	return 128;
+}
+
+/** Fill buffer with 32 random bytes from the operating system's random
+  * number generator.
+  * \param buffer The buffer to fill. This should have enough space for 32
+  *               bytes.
+  * \return The number of bits of entropy in the buffer (256, since the
+  *         operating system's generator is assumed to be good), or a
+  *         negative number if the random bytes couldn't be read.
+  */
+int hardwareRandom32Bytes(uint8_t *buffer)
+{
+	int fd;
+	ssize_t r;
+	size_t offset;
+
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	offset = 0;
+	while (offset < 32)
+	{
+		r = read(fd, &(buffer[offset]), 32 - offset);
+		if (r <= 0)
+		{
+			if ((r < 0) && (errno == EINTR))
+			{
+				continue;
+			}
+			close(fd);
+			return -1;
+		}
+		offset += (size_t)r;
+	}
+	close(fd);
+	return 256;
+}
+
+/** Overwrite anything in RAM which could contain sensitive data. On the
+  * host, the firmware's RAM only lasts as long as one connection (see the
+  * comments at the top of this file), so this does nothing. */
+void sanitiseRam(void)
+{
+	// do nothing
+}
+
+#if defined(STREAM_COMM_PROFILE) || defined(TEST_CRYPTO_BENCH) || defined(PBKDF2_CALIBRATE)
+/** Get the current value of a free-running cycle counter. The host build
+  * uses a monotonic clock, in nanoseconds.
+  * \return The current value of the cycle counter.
+  */
+uint32_t getCycleCount(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+}
+
+/** Get the rate at which the counter returned by getCycleCount() increments.
+  * \return The number of counts per second.
+  */
+uint32_t getCycleCountFrequency(void)
+{
+	return 1000000000;
+}
+#endif // #if defined(STREAM_COMM_PROFILE) || defined(TEST_CRYPTO_BENCH) || defined(PBKDF2_CALIBRATE)
+
+#ifdef STREAM_COMM_TRACE
+/** The host build doesn't record events from signal handlers, so there's
+  * nothing to disable. See traceDisableInterrupts() in hwinterface.h.
+  * \return Ignored by traceRestoreInterrupts().
+  */
+uint32_t traceDisableInterrupts(void)
+{
+	return 0;
+}
+
+/** Counterpart to traceDisableInterrupts(), which does nothing.
+  * \param status Ignored.
+  */
+void traceRestoreInterrupts(uint32_t status)
+{
+	(void)status;
+}
+#endif // #ifdef STREAM_COMM_TRACE
+
+#ifdef PC_SAMPLING
+/** Address the executable was loaded at, relative to the addresses in its
+  * symbol table. This is subtracted from every sample. */
+static uintptr_t load_bias;
+/** State of the PC sampler, in memory shared with every child process. */
+static PCSamplingState *shared_pc_sampling_state;
+
+/** Callback for dl_iterate_phdr() which finds the load bias of the
+  * executable, which is always the first object visited.
+  * \param info Information about the object.
+  * \param size Unused.
+  * \param data Unused.
+  * \return Non-zero, to stop after the first object.
+  */
+static int findLoadBias(struct dl_phdr_info *info, size_t size, void *data)
+{
+	(void)size;
+	(void)data;
+	load_bias = (uintptr_t)info->dlpi_addr;
+	return 1;
+}
+
+/** Get the range of addresses which contains the executable's code. See
+  * pcSamplingGetCodeRange() in hwinterface.h.
+  * \param out_start The lowest code address will be written here.
+  * \param out_end One past the highest code address will be written here.
+  */
+void pcSamplingGetCodeRange(uint32_t *out_start, uint32_t *out_end)
+{
+	extern char __executable_start;
+	extern char etext;
+
+	*out_start = (uint32_t)((uintptr_t)&__executable_start - load_bias);
+	*out_end = (uint32_t)((uintptr_t)&etext - load_bias);
+}
+
+/** Get the rate at which samples are taken. This is per second of
+  * processor time; samples aren't taken while the process is waiting.
+  * \return The number of samples per second.
+  */
+uint32_t pcSamplingGetRate(void)
+{
+	return PC_SAMPLE_RATE;
+}
+
+/** SIGPROF handler, which takes a sample.
+  * \param signal_number Unused.
+  * \param info Unused.
+  * \param context The context which was interrupted by the signal.
+  */
+static void pcSampleHandler(int signal_number, siginfo_t *info, void *context)
+{
+	ucontext_t *uc;
+	uintptr_t pc;
+
+	(void)signal_number;
+	(void)info;
+	uc = (ucontext_t *)context;
+#if defined(__x86_64__)
+	pc = (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+	pc = (uintptr_t)uc->uc_mcontext.gregs[REG_EIP];
+#elif defined(__aarch64__)
+	pc = (uintptr_t)uc->uc_mcontext.pc;
+#else
+	(void)uc;
+	pc = 0; // unknown architecture; everything will be out of range
+#endif
+	pcSamplingRecord((uint32_t)(pc - load_bias));
+}
+
+/** Set up the PC sampler's shared memory. This must be called before any
+  * child processes are created. */
+static void initPCSampling(void)
+{
+	void *p;
+
+	dl_iterate_phdr(&findLoadBias, NULL);
+	p = mmap(NULL, sizeof(PCSamplingState), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(1);
+	}
+	// The mapping starts off full of zeroes, so the first call to
+	// pcSamplingInit() will set it up.
+	shared_pc_sampling_state = (PCSamplingState *)p;
+}
+
+/** Start taking samples. Interval timers aren't inherited by child
+  * processes, so this is called in each one. */
+static void startPCSampling(void)
+{
+	struct sigaction action;
+	struct itimerval timer;
+
+	pcSamplingInit(shared_pc_sampling_state);
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = &pcSampleHandler;
+	// Socket reads and writes are restarted, so stream.c doesn't notice
+	// the signals.
+	action.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGPROF, &action, NULL);
+	timer.it_interval.tv_sec = 0;
+	timer.it_interval.tv_usec = 1000000 / PC_SAMPLE_RATE;
+	timer.it_value = timer.it_interval;
+	setitimer(ITIMER_PROF, &timer, NULL);
+}
+#endif // #ifdef PC_SAMPLING
+
+/** Run the firmware on a connected socket. This only returns (by exiting,
+  * in stream.c) when the host closes the connection.
+  * \param fd File descriptor of a connected stream socket.
+  */
+static void runFirmware(int fd)
+{
+	initHostStream(fd);
+#ifdef PC_SAMPLING
+	startPCSampling();
+#endif // #ifdef PC_SAMPLING
+	// If a format was interrupted (eg. by a loss of power), finish it
+	// before doing anything else.
+	finishInterruptedSanitisation();
+	do
+	{
+		processPacket();
+	} while (true);
+}
+
+/** Create a socket which listens for connections.
+  * \param unix_path If this is not NULL, a Unix domain socket will be
+  *                  created at this path. Otherwise, a TCP socket will be
+  *                  used.
+  * \param port The TCP port to listen on (ignored if unix_path is not NULL).
+  *             The socket is only bound to the loopback interface.
+  * \return A file descriptor on success, or -1 on error.
+  */
+static int createListener(const char *unix_path, uint16_t port)
+{
+	int fd;
+	int one;
+	struct sockaddr_un un_addr;
+	struct sockaddr_in in_addr;
+
+	if (unix_path != NULL)
+	{
+		if (strlen(unix_path) >= sizeof(un_addr.sun_path))
+		{
+			fprintf(stderr, "Socket path is too long\n");
+			return -1;
+		}
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+		{
+			perror("socket");
+			return -1;
+		}
+		memset(&un_addr, 0, sizeof(un_addr));
+		un_addr.sun_family = AF_UNIX;
+		strcpy(un_addr.sun_path, unix_path);
+		unlink(unix_path);
+		if (bind(fd, (struct sockaddr *)&un_addr, sizeof(un_addr)) != 0)
+		{
+			perror(unix_path);
+			close(fd);
+			return -1;
+		}
+	}
+	else
+	{
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0)
+		{
+			perror("socket");
+			return -1;
+		}
+		one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		memset(&in_addr, 0, sizeof(in_addr));
+		in_addr.sin_family = AF_INET;
+		in_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		in_addr.sin_port = htons(port);
+		if (bind(fd, (struct sockaddr *)&in_addr, sizeof(in_addr)) != 0)
+		{
+			perror("bind");
+			close(fd);
+			return -1;
+		}
+	}
+	if (listen(fd, 1) != 0)
+	{
+		perror("listen");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/** Display usage information.
+  * \param program_name Name of the executable.
+  */
+static void printUsage(const char *program_name)
+{
+	fprintf(stderr, "Usage: %s [-p port | -u socket_path] [-f storage_file] [-y] [-1]\n", program_name);
+	fprintf(stderr, "  -p port          Listen on TCP port (on 127.0.0.1); default is %d\n", DEFAULT_TCP_PORT);
+	fprintf(stderr, "  -u socket_path   Listen on Unix domain socket instead of TCP\n");
+	fprintf(stderr, "  -f storage_file  Non-volatile storage file; default is %s\n", DEFAULT_NV_FILENAME);
+	fprintf(stderr, "  -y               Accept every action without asking\n");
+	fprintf(stderr, "  -1               Handle one connection, without forking, then exit\n");
+}
+
+/** Entry point. This listens for connections and runs the firmware on each
+  * one in turn. */
+int main(int argc, char **argv)
+{
+	int opt;
+	int listen_fd;
+	int fd;
+	int one;
+	pid_t pid;
+	long port;
+	const char *unix_path;
+	const char *nv_filename;
+	bool approve_everything;
+	bool single_connection;
+
+	port = DEFAULT_TCP_PORT;
+	unix_path = NULL;
+	nv_filename = DEFAULT_NV_FILENAME;
+	approve_everything = false;
+	single_connection = false;
+	while ((opt = getopt(argc, argv, "p:u:f:y1")) != -1)
+	{
+		switch (opt)
+		{
+		case 'p':
+			port = strtol(optarg, NULL, 10);
+			if ((port <= 0) || (port > 65535))
+			{
+				fprintf(stderr, "Invalid port: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'u':
+			unix_path = optarg;
+			break;
+		case 'f':
+			nv_filename = optarg;
+			break;
+		case 'y':
+			approve_everything = true;
+			break;
+		case '1':
+			single_connection = true;
+			break;
+		default:
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (openNVFile(nv_filename))
+	{
+		return 1;
+	}
+	initUserInterface(approve_everything);
+#ifdef PC_SAMPLING
+	initPCSampling();
+#endif // #ifdef PC_SAMPLING
+	// A host which goes away while a response is being written shouldn't
+	// kill the process with SIGPIPE; stream.c deals with the write error.
+	signal(SIGPIPE, SIG_IGN);
+	listen_fd = createListener(unix_path, (uint16_t)port);
+	if (listen_fd < 0)
+	{
+		return 1;
+	}
+	if (unix_path != NULL)
+	{
+		printf("Listening on %s\n", unix_path);
+	}
+	else
+	{
+		printf("Listening on 127.0.0.1:%ld\n", port);
+	}
+	fflush(stdout);
+
+	do
+	{
+		fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			perror("accept");
+			return 1;
+		}
+		if (unix_path == NULL)
+		{
+			// Packets are small and the protocol is strictly
+			// request/response, so don't let Nagle's algorithm delay them.
+			one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		}
+		if (single_connection)
+		{
+			close(listen_fd);
+			runFirmware(fd);
+		}
+		pid = fork();
+		if (pid < 0)
+		{
+			perror("fork");
+			return 1;
+		}
+		else if (pid == 0)
+		{
+			close(listen_fd);
+			runFirmware(fd);
+		}
+		close(fd);
+		while ((waitpid(pid, NULL, 0) < 0) && (errno == EINTR))
+		{
+			// try again
+		}
+	} while (true);
+}
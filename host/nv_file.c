@@ -0,0 +1,261 @@
+/** \file nv_file.c
+  *
+  * \brief Implements non-volatile storage using a memory-mapped file.
+  *
+  * The file contains the global partition, followed by the accounts
+  * partition. It is mapped into memory with MAP_SHARED, so reads and writes
+  * are just memcpy() calls and anything written survives the process
+  * exiting (which is what happens when the host closes the connection).
+  * nonVolatileFlush() uses msync() to make sure that everything has
+  * actually reached the disk.
+  *
+  * A new (or too short) file is extended and filled with 0xff, which is
+  * what erased flash memory looks like.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../common.h"
+#include "../hwinterface.h"
+#include "../profile.h"
+#include "host.h"
+
+#ifndef HOST_GLOBAL_PARTITION_SIZE
+/** Size of global partition, in bytes. This must be a multiple of 4. */
+#define HOST_GLOBAL_PARTITION_SIZE		512
+#endif // #ifndef HOST_GLOBAL_PARTITION_SIZE
+#ifndef HOST_ACCOUNTS_PARTITION_SIZE
+/** Size of accounts partition, in bytes. This must be a multiple of 4. The
+  * default is large enough for many wallets, so that tests which create lots
+  * of wallets don't have to keep deleting them. */
+#define HOST_ACCOUNTS_PARTITION_SIZE	65536
+#endif // #ifndef HOST_ACCOUNTS_PARTITION_SIZE
+
+/** Total size of the non-volatile storage file, in bytes. */
+#define NV_FILE_SIZE	(HOST_GLOBAL_PARTITION_SIZE + HOST_ACCOUNTS_PARTITION_SIZE)
+
+/** Where the non-volatile storage file is mapped into memory. This is NULL
+  * if openNVFile() hasn't succeeded. */
+static uint8_t *nv_contents;
+
+/** Open (creating it if necessary) a file and map it into memory, so that
+  * it can be used as non-volatile storage.
+  * \param filename The name of the file.
+  * \return false on success, true on error.
+  */
+bool openNVFile(const char *filename)
+{
+	int fd;
+	struct stat st;
+	off_t old_size;
+	void *p;
+
+	fd = open(filename, O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+	{
+		perror(filename);
+		return true;
+	}
+	if (fstat(fd, &st) != 0)
+	{
+		perror(filename);
+		close(fd);
+		return true;
+	}
+	old_size = st.st_size;
+	if (old_size < NV_FILE_SIZE)
+	{
+		if (ftruncate(fd, NV_FILE_SIZE) != 0)
+		{
+			perror(filename);
+			close(fd);
+			return true;
+		}
+	}
+	p = mmap(NULL, NV_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd); // the mapping stays valid after this
+	if (p == MAP_FAILED)
+	{
+		perror(filename);
+		return true;
+	}
+	nv_contents = p;
+	if (old_size < NV_FILE_SIZE)
+	{
+		memset(&(nv_contents[old_size]), 0xff, (size_t)(NV_FILE_SIZE - old_size));
+	}
+	return false;
+}
+
+/** Get size of a partition.
+  * \param out_size On success, the size of the partition (in number of bytes)
+  *                 will be written here.
+  * \param partition Partition to query. Must be one of #NVPartitions.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+NonVolatileReturn nonVolatileGetSize(uint32_t *out_size, NVPartitions partition)
+{
+	if (partition == PARTITION_GLOBAL)
+	{
+		*out_size = HOST_GLOBAL_PARTITION_SIZE;
+		return NV_NO_ERROR;
+	}
+	else if (partition == PARTITION_ACCOUNTS)
+	{
+		*out_size = HOST_ACCOUNTS_PARTITION_SIZE;
+		return NV_NO_ERROR;
+	}
+	else
+	{
+		return NV_INVALID_ADDRESS;
+	}
+}
+
+/** Work out where a range of addresses within a partition is in the
+  * memory-mapped file.
+  * \param out_offset On success, the offset (in bytes) from the start of the
+  *                   file will be written here.
+  * \param partition The partition. Must be one of #NVPartitions.
+  * \param address Byte offset, within the partition, of the start of the
+  *                range.
+  * \param length The number of bytes in the range.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+static NonVolatileReturn getFileOffset(uint32_t *out_offset, NVPartitions partition, uint32_t address, uint32_t length)
+{
+	uint32_t size;
+	NonVolatileReturn r;
+
+	if (nv_contents == NULL)
+	{
+		return NV_IO_ERROR;
+	}
+	if ((address > 0x10000000) || (length > 0x10000000))
+	{
+		// address + length might overflow.
+		return NV_INVALID_ADDRESS;
+	}
+	r = nonVolatileGetSize(&size, partition);
+	if (r != NV_NO_ERROR)
+	{
+		return r;
+	}
+	if ((address + length) > size)
+	{
+		return NV_INVALID_ADDRESS;
+	}
+	if (partition == PARTITION_GLOBAL)
+	{
+		*out_offset = address;
+	}
+	else
+	{
+		*out_offset = HOST_GLOBAL_PARTITION_SIZE + address;
+	}
+	return NV_NO_ERROR;
+}
+
+/** Write to non-volatile storage.
+  * \param data A pointer to the data to be written.
+  * \param partition The partition to write to. Must be one of #NVPartitions.
+  * \param address Byte offset specifying where in the partition to
+  *                start writing to.
+  * \param length The number of bytes to write.
+  * \return See #NonVolatileReturnEnum for return values.
+  * \warning Writes may be buffered; use nonVolatileFlush() to be sure that
+  *          data is actually written to non-volatile storage.
+  */
+NonVolatileReturn nonVolatileWrite(uint8_t *data, NVPartitions partition, uint32_t address, uint32_t length)
+{
+	uint32_t offset;
+	NonVolatileReturn r;
+
+	r = getFileOffset(&offset, partition, address, length);
+	if (r == NV_NO_ERROR)
+	{
+		PROFILE_ENTER(PROFILE_NV_IO);
+		memcpy(&(nv_contents[offset]), data, length);
+		PROFILE_EXIT();
+	}
+	return r;
+}
+
+#ifdef NATIVE_NV_FILL
+/** Fill a range of non-volatile storage with one byte value.
+  * \param pattern The byte value to fill the range with.
+  * \param partition The partition to write to. Must be one of #NVPartitions.
+  * \param address Byte offset specifying where in the partition to
+  *                start writing to.
+  * \param length The number of bytes to write.
+  * \return See #NonVolatileReturnEnum for return values.
+  * \warning Writes may be buffered; use nonVolatileFlush() to be sure that
+  *          data is actually written to non-volatile storage.
+  */
+NonVolatileReturn nonVolatileFill(uint8_t pattern, NVPartitions partition, uint32_t address, uint32_t length)
+{
+	uint32_t offset;
+	NonVolatileReturn r;
+
+	r = getFileOffset(&offset, partition, address, length);
+	if (r == NV_NO_ERROR)
+	{
+		PROFILE_ENTER(PROFILE_NV_IO);
+		memset(&(nv_contents[offset]), pattern, length);
+		PROFILE_EXIT();
+	}
+	return r;
+}
+#endif // #ifdef NATIVE_NV_FILL
+
+/** Read from non-volatile storage.
+  * \param data A pointer to the buffer which will receive the data.
+  * \param partition The partition to read from. Must be one of #NVPartitions.
+  * \param address Byte offset specifying where in the partition to
+  *                start reading from.
+  * \param length The number of bytes to read.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+NonVolatileReturn nonVolatileRead(uint8_t *data, NVPartitions partition, uint32_t address, uint32_t length)
+{
+	uint32_t offset;
+	NonVolatileReturn r;
+
+	r = getFileOffset(&offset, partition, address, length);
+	if (r == NV_NO_ERROR)
+	{
+		PROFILE_ENTER(PROFILE_NV_IO);
+		memcpy(data, &(nv_contents[offset]), length);
+		PROFILE_EXIT();
+	}
+	return r;
+}
+
+/** Ensure that all buffered writes are committed to non-volatile storage.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+NonVolatileReturn nonVolatileFlush(void)
+{
+	NonVolatileReturn r;
+
+	if (nv_contents == NULL)
+	{
+		return NV_IO_ERROR;
+	}
+	PROFILE_ENTER(PROFILE_NV_IO);
+	if (msync(nv_contents, NV_FILE_SIZE, MS_SYNC) == 0)
+	{
+		r = NV_NO_ERROR;
+	}
+	else
+	{
+		r = NV_IO_ERROR;
+	}
+	PROFILE_EXIT();
+	return r;
+}
@@ -0,0 +1,200 @@
+/** \file stream.c
+  *
+  * \brief Implements the communication stream over a socket.
+  *
+  * This contains the stream functions (streamGetOneByte() etc.) of
+  * hwinterface.h, using a connected TCP or Unix domain socket. The socket
+  * carries exactly the same bytes as the serial or USB link of a real
+  * device, so anything which talks to a real device can also talk to the
+  * host build, given a socket instead.
+  *
+  * Received bytes are read into a buffer, so that streamBorrowBytes() can
+  * hand out more than one byte at a time. Bytes to be sent are also
+  * buffered and are only written to the socket when the buffer fills up or
+  * when the stream is about to wait for more received bytes. Since the host
+  * can't send anything else until it gets a response, this means that a
+  * response is usually sent in a single write().
+  *
+  * The host closing the connection looks like a power cycle of the device:
+  * the process handling the connection exits.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "../common.h"
+#include "../hwinterface.h"
+#include "host.h"
+
+/** Size of receive buffer, in bytes. */
+#define RECEIVE_BUFFER_SIZE		4096
+/** Size of transmit buffer, in bytes. */
+#define TRANSMIT_BUFFER_SIZE	4096
+
+/** File descriptor of connected socket. This is -1 if there isn't one. */
+static int stream_fd = -1;
+/** Bytes which have been received but not yet taken by the firmware. */
+static uint8_t receive_buffer[RECEIVE_BUFFER_SIZE];
+/** Index into #receive_buffer of the next byte to be taken. */
+static uint32_t receive_start;
+/** Index into #receive_buffer just past the last received byte. */
+static uint32_t receive_end;
+/** Bytes which the firmware has sent but which haven't been written to the
+  * socket yet. */
+static uint8_t transmit_buffer[TRANSMIT_BUFFER_SIZE];
+/** Number of bytes in #transmit_buffer. */
+static uint32_t transmit_length;
+
+/** Set the socket that all the stream functions will use.
+  * \param fd File descriptor of a connected stream socket.
+  */
+void initHostStream(int fd)
+{
+	stream_fd = fd;
+	receive_start = 0;
+	receive_end = 0;
+	transmit_length = 0;
+}
+
+/** Write everything in the transmit buffer to the socket. */
+static void flushTransmitBuffer(void)
+{
+	uint32_t offset;
+	ssize_t r;
+
+	offset = 0;
+	while (offset < transmit_length)
+	{
+		r = write(stream_fd, &(transmit_buffer[offset]), transmit_length - offset);
+		if (r < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			// The host has gone away.
+			exit(0);
+		}
+		offset += (uint32_t)r;
+	}
+	transmit_length = 0;
+}
+
+/** Block until the receive buffer contains at least one byte. Anything in
+  * the transmit buffer is sent first, since the host may be waiting for it
+  * before it sends anything else. */
+static void fillReceiveBuffer(void)
+{
+	ssize_t r;
+
+	if (receive_start != receive_end)
+	{
+		return;
+	}
+	flushTransmitBuffer();
+	receive_start = 0;
+	receive_end = 0;
+	do
+	{
+		r = read(stream_fd, receive_buffer, RECEIVE_BUFFER_SIZE);
+	} while ((r < 0) && (errno == EINTR));
+	if (r <= 0)
+	{
+		// The host closed the connection (or the connection broke). There's
+		// no way to tell the firmware this, so treat it like a loss of power.
+		exit(0);
+	}
+	receive_end = (uint32_t)r;
+}
+
+/** Grab one byte from the communication stream. See streamGetOneByte() in
+  * hwinterface.h for more details.
+  * \return The received byte.
+  */
+uint8_t streamGetOneByte(void)
+{
+	uint8_t one_byte;
+
+	streamGetBytes(&one_byte, 1);
+	return one_byte;
+}
+
+/** Send one byte to the communication stream. See streamPutOneByte() in
+  * hwinterface.h for more details.
+  * \param one_byte The byte to send.
+  */
+void streamPutOneByte(uint8_t one_byte)
+{
+	streamPutBytes(&one_byte, 1);
+}
+
+/** Grab a number of bytes from the communication stream. This blocks until
+  * all the bytes have been received.
+  * \param buffer The received bytes will be written here. This must have
+  *               space for length bytes.
+  * \param length The number of bytes to receive.
+  */
+void streamGetBytes(uint8_t *buffer, uint32_t length)
+{
+	uint32_t count;
+
+	while (length > 0)
+	{
+		fillReceiveBuffer();
+		count = MIN(length, receive_end - receive_start);
+		memcpy(buffer, &(receive_buffer[receive_start]), count);
+		receive_start += count;
+		buffer += count;
+		length -= count;
+	}
+}
+
+/** Borrow bytes straight out of the receive buffer, without copying them.
+  * See streamBorrowBytes() in hwinterface.h for more details.
+  * \param length The number of contiguous bytes available at the returned
+  *               address will be written here. This will be at least 1.
+  * \return A pointer to the borrowed bytes.
+  */
+const uint8_t *streamBorrowBytes(uint32_t *length)
+{
+	fillReceiveBuffer();
+	*length = receive_end - receive_start;
+	return &(receive_buffer[receive_start]);
+}
+
+/** Remove bytes previously borrowed by streamBorrowBytes() from the receive
+  * buffer.
+  * \param length The number of bytes to remove.
+  */
+void streamReleaseBytes(uint32_t length)
+{
+	receive_start += length;
+}
+
+/** Send a number of bytes to the communication stream. The bytes are
+  * buffered; see the comments at the top of this file for when they
+  * actually get written to the socket.
+  * \param buffer The bytes to send.
+  * \param length The number of bytes to send.
+  */
+void streamPutBytes(const uint8_t *buffer, uint32_t length)
+{
+	uint32_t count;
+
+	while (length > 0)
+	{
+		if (transmit_length == TRANSMIT_BUFFER_SIZE)
+		{
+			flushTransmitBuffer();
+		}
+		count = MIN(length, TRANSMIT_BUFFER_SIZE - transmit_length);
+		memcpy(&(transmit_buffer[transmit_length]), buffer, count);
+		transmit_length += count;
+		buffer += count;
+		length -= count;
+	}
+}
@@ -0,0 +1,199 @@
+/** \file user_interface.c
+  *
+  * \brief Implements the user interface on the console.
+  *
+  * Everything which a real device would show on its display (outputs,
+  * addresses, one-time passwords and backup seeds) is printed to stdout.
+  * When asked to approve an action, this will either ask on stdin, or (if
+  * auto-approve was requested, as it usually is for load testing) accept
+  * every action without asking.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#include <stdio.h>
+#include "../common.h"
+#include "../hwinterface.h"
+#include "../baseconv.h"
+#include "../prandom.h"
+#include "host.h"
+
+/** Whether to accept every action without asking. */
+static bool auto_approve;
+
+/** Initialise the user interface.
+  * \param approve_everything Use true to accept every action without asking,
+  *                           false to ask on stdin.
+  */
+void initUserInterface(bool approve_everything)
+{
+	auto_approve = approve_everything;
+}
+
+/** Notify the user interface that the transaction parser has seen a new
+  * Bitcoin amount/address pair. On the console, there's no limit to how many
+  * can be shown, so they are printed straight away.
+  * \param output The output amount and address, in binary form.
+  * \return false if no error occurred, true if there was not enough space to
+  *         store the amount/address pair.
+  */
+bool newOutputSeen(OutputDescriptor *output)
+{
+	char text_amount[TEXT_AMOUNT_LENGTH];
+	char text_address[TEXT_ADDRESS_LENGTH];
+
+	outputToText(text_amount, text_address, output);
+	printf("Amount: %s\n", text_amount);
+	printf("Address: %s\n", text_address);
+	return false; // success
+}
+
+/** Notify the user interface that the transaction parser has seen the
+  * transaction fee.
+  * \param amount The transaction fee, as a 64 bit, unsigned, little-endian
+  *               integer with the amount in 10 ^ -8 BTC.
+  */
+void setTransactionFee(uint8_t *amount)
+{
+	char text_amount[TEXT_AMOUNT_LENGTH];
+
+	amountToText(text_amount, amount);
+	printf("Transaction fee: %s\n", text_amount);
+}
+
+/** Notify the user interface that the list of Bitcoin amount/address pairs
+  * should be cleared. Since they were printed as they were seen, there's
+  * nothing to clear. */
+void clearOutputsSeen(void)
+{
+}
+
+/** Inform the user that an address has been generated.
+  * \param address The output address, as a null-terminated text string.
+  * \param num_sigs The number of required signatures to redeem Bitcoins from
+  *                 the address.
+  * \param num_pubkeys The number of public keys involved in the address.
+  */
+void displayAddress(char *address, uint8_t num_sigs, uint8_t num_pubkeys)
+{
+	printf("Address (%d of %d): %s\n", (int)num_sigs, (int)num_pubkeys, address);
+}
+
+/** Display human-readable description of an action on stdout.
+  * \param command The action to display. See #AskUserCommandEnum.
+  */
+static void printAction(AskUserCommand command)
+{
+	switch (command)
+	{
+	case ASKUSER_NEW_WALLET:
+		printf("Create new wallet? ");
+		break;
+	case ASKUSER_NEW_ADDRESS:
+		printf("Create new address? ");
+		break;
+	case ASKUSER_SIGN_TRANSACTION:
+		printf("Sign transaction? ");
+		break;
+	case ASKUSER_FORMAT:
+		printf("Format storage area? ");
+		break;
+	case ASKUSER_CHANGE_NAME:
+		printf("Change wallet name? ");
+		break;
+	case ASKUSER_BACKUP_WALLET:
+		printf("Do a wallet backup? ");
+		break;
+	case ASKUSER_RESTORE_WALLET:
+		printf("Restore wallet from backup? ");
+		break;
+	case ASKUSER_CHANGE_KEY:
+		printf("Change wallet encryption key? ");
+		break;
+	case ASKUSER_GET_MASTER_KEY:
+		printf("Reveal master public key? ");
+		break;
+	case ASKUSER_DELETE_WALLET:
+		printf("Delete existing wallet? ");
+		break;
+	default:
+		printf("Unknown action (%d)? ", (int)command);
+		break;
+	}
+}
+
+/** Ask user if they want to allow some action.
+  * \param command The action to ask the user about. See #AskUserCommandEnum.
+  * \return false if the user accepted, true if the user denied.
+  */
+bool userDenied(AskUserCommand command)
+{
+	int c;
+
+	printAction(command);
+	if (auto_approve)
+	{
+		printf("accepted\n");
+		fflush(stdout);
+		return false;
+	}
+	printf("y/[n]: ");
+	fflush(stdout);
+	do
+	{
+		c = getchar();
+	} while ((c == '\n') || (c == '\r'));
+	if ((c == 'y') || (c == 'Y'))
+	{
+		return false;
+	}
+	else
+	{
+		return true;
+	}
+}
+
+/** Display a short (maximum 8 characters) one-time password for the user to
+  * see.
+  * \param command The action to ask the user about. See #AskUserCommandEnum.
+  * \param otp The one-time password to display.
+  */
+void displayOTP(AskUserCommand command, char *otp)
+{
+	printAction(command);
+	printf("OTP: %s\n", otp);
+	fflush(stdout);
+}
+
+/** Clear the OTP (one-time password) shown by displayOTP() from the
+  * display. Nothing can be unprinted, so this does nothing. */
+void clearOTP(void)
+{
+}
+
+/** Write backup seed to stdout, as a hexadecimal string.
+  * \param seed A byte array of length #SEED_LENGTH bytes which contains the
+  *             backup seed.
+  * \param is_encrypted Specifies whether the seed has been encrypted.
+  * \param destination_device Specifies which device the backup seed should
+  *                           be sent to. Only device 0 (stdout) exists.
+  * \return false on success, true if the backup seed could not be written
+  *         to the destination device.
+  */
+bool writeBackupSeed(uint8_t *seed, bool is_encrypted, uint32_t destination_device)
+{
+	int i;
+
+	if (destination_device > 0)
+	{
+		return true;
+	}
+	printf("Backup seed (%s):", is_encrypted ? "encrypted" : "unencrypted");
+	for (i = 0; i < SEED_LENGTH; i++)
+	{
+		printf(" %02x", seed[i]);
+	}
+	printf("\n");
+	fflush(stdout);
+	return false;
+}
@@ -13,6 +13,7 @@
 #define HWINTERFACE_H_INCLUDED
 
 #include "common.h"
+#include "baseconv.h"
 
 /** Return values for non-volatile storage I/O functions. */
 typedef enum NonVolatileReturnEnum
@@ -127,6 +128,21 @@ extern char getString(StringSet set, uint8_t spec, uint16_t pos);
   * \return The length of the string, in number of characters.
   */
 extern uint16_t getStringLength(StringSet set, uint8_t spec);
+/** Find one of the device's strings, so that it can be copied or written
+  * out in one go, instead of one character at a time with getString().
+  * \param set Specifies which set of strings to use; should be
+  *            one of #StringSetEnum.
+  * \param spec Specifies which string to get. The interpretation of this
+  *             depends on the value of set; see #StringSetEnum for
+  *             clarification.
+  * \param out_length The length of the string, in number of characters, will
+  *                   be written here.
+  * \return A pointer to the first character of the string. The string
+  *         is not guaranteed to be null-terminated. The pointer must remain
+  *         valid for the lifetime of the program (i.e. it should point to
+  *         something in flash memory).
+  */
+extern const char *getStringSpan(StringSet set, uint8_t spec, uint16_t *out_length);
 
 /** Grab one byte from the communication stream. There is no way for this
   * function to indicate a read error. This is intentional; it
@@ -163,24 +179,66 @@ extern uint8_t streamGetOneByte(void);
   * \param one_byte The byte to send.
   */
 extern void streamPutOneByte(uint8_t one_byte);
+/** Grab a number of bytes from the communication stream. This has the same
+  * effect as calling streamGetOneByte() length times, but allows the
+  * implementation to move bytes out of its receive buffer in chunks. Like
+  * streamGetOneByte(), this should only return once all the requested bytes
+  * have been received free of read errors.
+  * \param buffer The received bytes will be written here. This must have
+  *               space for length bytes.
+  * \param length The number of bytes to receive.
+  */
+extern void streamGetBytes(uint8_t *buffer, uint32_t length);
+/** Send a number of bytes to the communication stream. This has the same
+  * effect as calling streamPutOneByte() for each byte, but allows the
+  * implementation to move bytes into its transmit buffer in chunks. Like
+  * streamPutOneByte(), this should only return once all the bytes have
+  * been sent free of write errors.
+  * \param buffer The bytes to send.
+  * \param length The number of bytes to send.
+  */
+extern void streamPutBytes(const uint8_t *buffer, uint32_t length);
+/** Borrow bytes straight out of the communication stream's receive buffer,
+  * without copying them anywhere. This is useful when the caller only needs
+  * to look at the bytes (e.g. to hash them). This will block until at least
+  * one byte has been received. The borrowed bytes remain valid (and remain
+  * in the receive buffer) until streamReleaseBytes() is called. See
+  * streamGetOneByte() for why this can't indicate read errors.
+  * \param length The number of contiguous bytes available at the returned
+  *               address will be written here. This will be at least 1.
+  * \return A pointer to the borrowed bytes.
+  * \warning No other stream function may be called between this and the
+  *          matching call to streamReleaseBytes().
+  */
+extern const uint8_t *streamBorrowBytes(uint32_t *length);
+/** Remove bytes previously borrowed using streamBorrowBytes() from the
+  * communication stream's receive buffer. The effect (including any flow
+  * control) is as if those bytes had been read with streamGetBytes().
+  * \param length The number of bytes to remove. This must not be more than
+  *               the length returned by the most recent call to
+  *               streamBorrowBytes().
+  */
+extern void streamReleaseBytes(uint32_t length);
 
 /** Notify the user interface that the transaction parser has seen a new
   * Bitcoin amount/address pair.
-  * \param text_amount The output amount, as a null-terminated text string
-  *                    such as "0.01".
-  * \param text_address The output address, as a null-terminated text string
-  *                     such as "1RaTTuSEN7jJUDiW1EGogHwtek7g9BiEn".
+  * \param output The output amount and address, in binary form. The contents
+  *               of this must be copied, since it may be overwritten after
+  *               this returns. Use outputToText() to get the text to
+  *               display.
   * \return false if no error occurred, true if there was not enough space to
   *         store the amount/address pair.
   */
-extern bool newOutputSeen(char *text_amount, char *text_address);
+extern bool newOutputSeen(OutputDescriptor *output);
 /** Notify the user interface that the transaction parser has seen the
   * transaction fee. If there is no transaction fee, the transaction parser
   * will not call this.
-  * \param text_amount The transaction fee, as a null-terminated text string
-  *                    such as "0.01".
+  * \param amount The transaction fee, as a 64 bit, unsigned, little-endian
+  *               integer with the amount in 10 ^ -8 BTC. The contents of this
+  *               must be copied, since it may be overwritten after this
+  *               returns. Use amountToText() to get the text to display.
   */
-extern void setTransactionFee(char *text_amount);
+extern void setTransactionFee(uint8_t *amount);
 /** Notify the user interface that the list of Bitcoin amount/address pairs
   * should be cleared. */
 extern void clearOutputsSeen(void);
@@ -245,6 +303,25 @@ extern NonVolatileReturn nonVolatileGetSize(uint32_t *out_size, NVPartitions par
   *          data is actually written to non-volatile storage.
   */
 extern NonVolatileReturn nonVolatileWrite(uint8_t *data, NVPartitions partition, uint32_t address, uint32_t length);
+#ifdef NATIVE_NV_FILL
+/** Fill a range of non-volatile storage with one byte value. The result is
+  * the same as calling nonVolatileWrite() with a buffer of length bytes,
+  * all equal to pattern, but this allows the platform to use whatever is
+  * quickest for large ranges (for example, a sector erase for 0xff) instead
+  * of a read-modify-write of every sector.
+  * This only needs to be implemented on platforms which
+  * support NATIVE_NV_FILL.
+  * \param pattern The byte value to fill the range with.
+  * \param partition The partition to write to. Must be one of #NVPartitions.
+  * \param address Byte offset specifying where in the partition to
+  *                start writing to.
+  * \param length The number of bytes to write.
+  * \return See #NonVolatileReturnEnum for return values.
+  * \warning Writes may be buffered; use nonVolatileFlush() to be sure that
+  *          data is actually written to non-volatile storage.
+  */
+extern NonVolatileReturn nonVolatileFill(uint8_t pattern, NVPartitions partition, uint32_t address, uint32_t length);
+#endif // #ifdef NATIVE_NV_FILL
 /** Read from non-volatile storage.
   * \param data A pointer to the buffer which will receive the data.
   * \param partition The partition to read from. Must be one of #NVPartitions.
@@ -295,8 +372,184 @@ extern bool writeBackupSeed(uint8_t *seed, bool is_encrypted, uint32_t destinati
   * this should be a power of 2. That way, an implementation can use
   * successively greater powers of 2 until the correct number of iterations is
   * found.
+  *
+  * If PBKDF2_CALIBRATE is defined, this is only a lower bound for new
+  * wallets; see calibratePBKDF2Exponent(). It is still used as is for hidden
+  * wallets and for wallets created without calibration.
   * \return Number of iterations to use in PBKDF2 algorithm.
   */
 extern uint32_t getPBKDF2Iterations(void);
 
+#if defined(STREAM_COMM_PROFILE) || defined(TEST_CRYPTO_BENCH) || defined(PBKDF2_CALIBRATE)
+/** Get the current value of a free-running cycle counter. This is only used
+  * for profiling (see profile.h), for on-device benchmarks (see
+  * crypto_bench.c) and for calibrating PBKDF2 (see
+  * calibratePBKDF2Exponent()), so it only needs to be implemented on
+  * platforms which support STREAM_COMM_PROFILE, TEST_CRYPTO_BENCH or
+  * PBKDF2_CALIBRATE. The counter may wrap around; callers only ever look at
+  * the difference between two values.
+  * \return The current value of the cycle counter.
+  */
+extern uint32_t getCycleCount(void);
+
+/** Get the rate at which the counter returned by getCycleCount() increments.
+  * \return The number of counts per second.
+  */
+extern uint32_t getCycleCountFrequency(void);
+#endif // #if defined(STREAM_COMM_PROFILE) || defined(TEST_CRYPTO_BENCH) || defined(PBKDF2_CALIBRATE)
+
+#ifdef STREAM_COMM_TRACE
+/** Disable interrupts, so that the event trace (see trace.c) can be updated
+  * without being interrupted by an interrupt handler which also records
+  * events. Platforms which never record events from interrupt handlers can
+  * make this do nothing. This only needs to be implemented on platforms
+  * which support STREAM_COMM_TRACE.
+  * \return A value to pass to traceRestoreInterrupts().
+  */
+extern uint32_t traceDisableInterrupts(void);
+
+/** Undo the effect of the matching traceDisableInterrupts().
+  * \param status The value returned by the matching traceDisableInterrupts().
+  */
+extern void traceRestoreInterrupts(uint32_t status);
+#endif // #ifdef STREAM_COMM_TRACE
+
+#ifdef NV_STATISTICS
+/** Wear and latency statistics for non-volatile storage, as returned
+  * by nonVolatileGetStatistics(). */
+typedef struct NVStatisticsStruct
+{
+	/** Number of calls to nonVolatileFlush() which had something to
+	  * write back. */
+	uint32_t flush_count;
+	/** Total time spent in those calls, in cycles (see getCycleCount()). */
+	uint64_t flush_total_cycles;
+	/** Longest time spent in one of those calls, in cycles. */
+	uint32_t flush_max_cycles;
+	/** Number of erasable units (eg. flash sectors) which have an erase
+	  * counter. These can be read using nonVolatileGetEraseCount(). */
+	uint32_t num_erase_counters;
+} NVStatistics;
+
+/** Get wear and latency statistics for non-volatile storage. These should
+  * persist across resets, so that they cover the whole life of the device.
+  * This only needs to be implemented on platforms which
+  * support NV_STATISTICS.
+  * \param out_statistics The statistics will be written here.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+extern NonVolatileReturn nonVolatileGetStatistics(NVStatistics *out_statistics);
+
+/** Get the number of times one erasable unit of non-volatile storage has
+  * been erased. This only needs to be implemented on platforms which
+  * support NV_STATISTICS.
+  * \param out_count On success, the erase count will be written here.
+  * \param unit Which erasable unit to query, in order of physical address
+  *             (0 = first). This must be less than the num_erase_counters
+  *             field returned by nonVolatileGetStatistics().
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+extern NonVolatileReturn nonVolatileGetEraseCount(uint32_t *out_count, uint32_t unit);
+
+/** Reset the flush latency statistics (everything in #NVStatistics except
+  * the erase counters, which are a record of wear and so are never reset).
+  * This only needs to be implemented on platforms which
+  * support NV_STATISTICS.
+  */
+extern void nonVolatileResetFlushStatistics(void);
+#endif // #ifdef NV_STATISTICS
+
+#ifdef PC_SAMPLING
+/** Get the range of addresses which contains all of the firmware's code.
+  * This is the range which the PC sampler (see pc_sampling.c) covers by
+  * default. The addresses must be the same as the ones in the firmware's
+  * ELF file, so that the host can look them up there. This only needs to
+  * be implemented on platforms which support PC_SAMPLING.
+  * \param out_start The lowest code address will be written here.
+  * \param out_end One past the highest code address will be written here.
+  */
+extern void pcSamplingGetCodeRange(uint32_t *out_start, uint32_t *out_end);
+
+/** Get the rate at which the platform's timer interrupt handler calls
+  * pcSamplingRecord(). This only needs to be implemented on platforms which
+  * support PC_SAMPLING.
+  * \return The number of samples per second.
+  */
+extern uint32_t pcSamplingGetRate(void);
+#endif // #ifdef PC_SAMPLING
+
+#ifdef STREAM_COMM_LINK_SPEED
+/** Check whether the link to the host can be switched to a given speed.
+  * This only needs to be implemented on platforms which support
+  * STREAM_COMM_LINK_SPEED (ie. those which talk to the host over a serial
+  * link with a configurable baud rate).
+  * \param baud_rate The requested link speed, in baud.
+  * \return true if the link speed is supported, false if it isn't.
+  */
+extern bool isLinkSpeedSupported(uint32_t baud_rate);
+
+/** Switch the link to the host to a new speed. This will only be called
+  * with speeds for which isLinkSpeedSupported() returned true. It will be
+  * called just after the response to the request has been written to the
+  * stream, so it must wait until everything written so far has actually
+  * been transmitted before switching.
+  * \param baud_rate The new link speed, in baud.
+  */
+extern void setLinkSpeed(uint32_t baud_rate);
+#endif // #ifdef STREAM_COMM_LINK_SPEED
+
+#ifdef BACKGROUND_TASKS
+/** Give each of the platform's background tasks a chance to do a small
+  * piece of work. This is called (via BACKGROUND_YIELD() in background.h)
+  * at regular points during long operations, so it only needs to be
+  * implemented on platforms which support BACKGROUND_TASKS. Background
+  * tasks must return quickly and must not use the stream, the display,
+  * non-volatile storage or anything in bignum256.c, since they can run in
+  * the middle of operations which use them. The one exception is a task
+  * which checks that nothing else is running first (see
+  * precomputeAddressTask() in stream_comm.c).
+  */
+extern void backgroundYield(void);
+#endif // #ifdef BACKGROUND_TASKS
+
+#ifdef CLOCK_GOVERNOR
+/** Start or stop running at full clock speed. This is called (via
+  * CLOCK_BOOST_BEGIN() and CLOCK_BOOST_END() in clock_governor.h) around
+  * long operations, so it only needs to be implemented on platforms which
+  * support CLOCK_GOVERNOR. Calls nest: the clock stays at full speed until
+  * every clockBoost(true) has been matched by a clockBoost(false), and then
+  * goes back to the platform's reduced speed. This is never called from
+  * interrupt handlers.
+  * \param boost Use true to start running at full speed, false to undo the
+  *              matching clockBoost(true).
+  */
+extern void clockBoost(bool boost);
+
+/** Find out how much slower than full speed the CPU is currently running.
+  * Platform code uses this to keep delays which count CPU cycles (or timer
+  * ticks derived from the CPU clock) correct.
+  * \return The base 2 logarithm of the current clock divider; 0 means full
+  *         speed.
+  */
+extern uint8_t getClockShift(void);
+#endif // #ifdef CLOCK_GOVERNOR
+
+#ifdef CHECK_STACK_USAGE
+/** Fill the unused part of the stack (everything below the caller's stack
+  * frame) with a marker value, so that getStackUsage() can later find out
+  * how deep the stack got. This is only used for stack profiling (see
+  * profilePacketBegin() in stream_comm.c), so it only needs to be
+  * implemented on platforms which support CHECK_STACK_USAGE.
+  */
+extern void paintStack(void);
+
+/** Find out the maximum amount of stack space that has been used since the
+  * last call to paintStack(), by looking for the deepest place where the
+  * marker value has been overwritten.
+  * \return The maximum stack usage, in bytes, measured from the top of
+  *         the stack. This includes stack space used by interrupt handlers.
+  */
+extern uint32_t getStackUsage(void);
+#endif // #ifdef CHECK_STACK_USAGE
+
 #endif // #ifndef HWINTERFACE_H_INCLUDED
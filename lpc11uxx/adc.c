@@ -8,14 +8,25 @@
   * PCM data at that rate. It's slow enough that the code in fft.c can handle
   * real-time FFTs at that sample rate. Conversions are done with a fixed
   * period in between each conversion so that the results of FFTs are
-  * meaningful.
+  * meaningful. The statistical limits in hwrng_limits.h were measured at
+  * this sample rate, so it shouldn't be changed without re-measuring them.
   *
-  * The results of conversions go into #adc_sample_buffer. To begin a series
-  * of conversions, call beginFillingADCBuffer(), then wait
-  * until #sample_buffer_full is true. #adc_sample_buffer will then
-  * contain #SAMPLE_BUFFER_SIZE samples. This interface allows one buffer of
-  * samples to be collected while the previous one is processed, which speeds
-  * up entropy collection.
+  * The results of conversions are written into #adc_sample_buffer by the
+  * ADC interrupt handler. #adc_sample_buffer is split into two halves, each
+  * containing #SAMPLE_BUFFER_SIZE samples. Once sampling is started using
+  * startADCSampling(), the interrupt handler fills the halves alternately
+  * ("ping pong" buffering), so the caller can process one half while the
+  * other half is being filled; use isADCBufferHalfFull() to find out when a
+  * half is ready and clearADCBufferHalfFull() to note that it has been
+  * consumed. Unlike the PIC32 version (which uses DMA), the interrupt handler
+  * never overwrites a half which hasn't been consumed yet. Instead, it stops
+  * the timer, and clearADCBufferHalfFull() starts it again. So each half
+  * always contains #SAMPLE_BUFFER_SIZE consecutive, evenly spaced samples,
+  * but there may be a gap between halves if the caller falls behind.
+  *
+  * The interrupt handler does as little as possible (one store and one
+  * increment per conversion, plus some bookkeeping at the end of each half),
+  * so that sampling doesn't take much time away from the serial link.
   *
   * For details on hardware interfacing requirements, see initADC().
   *
@@ -26,14 +37,21 @@
 #include "LPC11Uxx.h"
 #include "adc.h"
 
-/** A place to store samples from the ADC. When #sample_buffer_full is
-  * true, every entry in this array will be filled with ADC samples
+/** A place to store samples from the ADC. When isADCBufferHalfFull() returns
+  * true for a half, every entry in that half will be filled with ADC samples
   * taken periodically. */
-volatile uint16_t adc_sample_buffer[SAMPLE_BUFFER_SIZE];
-/** Index into #sample_buffer where the next sample will be written. */
-static volatile uint32_t sample_buffer_current_index;
-/** Whether #sample_buffer is full.  */
-volatile bool sample_buffer_full;
+volatile uint16_t adc_sample_buffer[2][SAMPLE_BUFFER_SIZE];
+/** Where the next sample will be written. This points into the half
+  * indicated by #fill_half. */
+static volatile uint16_t *fill_pointer;
+/** Which half of #adc_sample_buffer is being filled (0 or 1). */
+static volatile unsigned int fill_half;
+/** Whether each half of #adc_sample_buffer is full. A half which is full
+  * won't be written to until clearADCBufferHalfFull() is called. */
+static volatile bool half_full[2];
+/** Whether the interrupt handler stopped the timer because it had nowhere
+  * to put the next sample. */
+static volatile bool sampling_stalled;
 
 /** Set up ADC to sample from AD5 (pin 19 on mbed) periodically using the
   * 32-bit counter CT32B0. */
@@ -49,7 +67,7 @@ void initADC(void)
 	LPC_ADC->INTEN = 0x20; // interrupt on AD5 conversion completion
 	LPC_CT32B0->TCR = 0; // disable timer
 	LPC_SYSCON->SYSAHBCLKCTRL |= 0x200; // enable clock to CT32B0
-	LPC_CT32B0->PR = 63; // prescaler = 64
+	LPC_CT32B0->PR = ADC_TIMER_PRESCALER; // prescaler = 64
 	LPC_CT32B0->MR0 = 17; // match = 17 (f = 44118 Hz)
 	LPC_CT32B0->MCR = 2; // reset on MR0
 	LPC_CT32B0->EMR = 0x30; // toggle CT32B0_MAT0 on match
@@ -61,36 +79,90 @@ void initADC(void)
 void ADC_IRQHandler(void)
 {
 	uint32_t sample;
+	unsigned int next_half;
 
 	// Always read DR5 so that the ADC interrupt is cleared.
 	sample = (LPC_ADC->DR5 >> 6) & 0x3ff;
-	if (sample_buffer_current_index >= SAMPLE_BUFFER_SIZE)
+	if (sampling_stalled)
 	{
-		LPC_CT32B0->TCR = 0; // disable timer
-		sample_buffer_full = true;
+		return; // a conversion was already in progress when the timer stopped
 	}
-	else
+	*fill_pointer = (uint16_t)sample;
+	fill_pointer++;
+	if (fill_pointer == &(adc_sample_buffer[fill_half][SAMPLE_BUFFER_SIZE]))
 	{
-		adc_sample_buffer[sample_buffer_current_index] = (uint16_t)sample;
-		sample_buffer_current_index++;
+		half_full[fill_half] = true;
+		next_half = fill_half ^ 1;
+		fill_half = next_half;
+		fill_pointer = adc_sample_buffer[next_half];
+		if (half_full[next_half])
+		{
+			// The caller is still using the next half, so stop sampling
+			// instead of overwriting it.
+			LPC_CT32B0->TCR = 0; // disable timer
+			sampling_stalled = true;
+		}
 	}
 }
 
-/** Begin collecting #SAMPLE_BUFFER_SIZE samples, filling
-  * up #adc_sample_buffer. This will return before all the samples have been
-  * collected, allowing the caller to do something else while samples are
-  * collected in the background. #sample_buffer_full can be used to indicate
-  * when #adc_sample_buffer is full.
+/** Begin collecting samples continuously, alternately filling up each half
+  * of #adc_sample_buffer. This will return immediately; the samples are
+  * collected in the background. The first half to be filled will be
+  * half 0, followed by half 1, then half 0 again etc.
+  * isADCBufferHalfFull() can be used to determine when each half is full.
   *
-  * It is okay to call this while the sample buffer is still being filled up.
-  * In that case, calling this will reset #sample_buffer_current_index so that
-  * the sample buffer will commence filling from the start.
+  * It is okay to call this while sampling is already in progress. In that
+  * case, calling this will abort the current fill and commence filling from
+  * the start of half 0.
   */
-void beginFillingADCBuffer(void)
+void startADCSampling(void)
 {
 	__disable_irq();
-	sample_buffer_current_index = 0;
-	sample_buffer_full = false;
+	LPC_CT32B0->TCR = 2; // disable and reset timer
+	fill_half = 0;
+	fill_pointer = adc_sample_buffer[0];
+	half_full[0] = false;
+	half_full[1] = false;
+	sampling_stalled = false;
 	LPC_CT32B0->TCR = 1; // enable timer
 	__enable_irq();
 }
+
+/** Stop collecting samples. The contents of #adc_sample_buffer are left
+  * alone. */
+void stopADCSampling(void)
+{
+	__disable_irq();
+	LPC_CT32B0->TCR = 0; // disable timer
+	sampling_stalled = true;
+	__enable_irq();
+}
+
+/** Check whether one half of the ADC buffer (#adc_sample_buffer) has been
+  * filled since the last call to startADCSampling()
+  * or clearADCBufferHalfFull() for that half.
+  * \param half Which half to check (0 or 1).
+  * \return false if that half is not full, true if it is.
+  */
+bool isADCBufferHalfFull(unsigned int half)
+{
+	return half_full[half];
+}
+
+/** Note that one half of the ADC buffer (#adc_sample_buffer) has been
+  * consumed, so that isADCBufferHalfFull() will only return true for that
+  * half once it has been filled again. If sampling was stopped because
+  * there was nowhere to put the next sample, it is restarted.
+  * \param half Which half to clear (0 or 1).
+  */
+void clearADCBufferHalfFull(unsigned int half)
+{
+	__disable_irq();
+	half_full[half] = false;
+	if (sampling_stalled && (fill_half == half))
+	{
+		sampling_stalled = false;
+		LPC_CT32B0->TCR = 1; // enable timer
+	}
+	__enable_irq();
+}
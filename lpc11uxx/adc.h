@@ -10,16 +10,24 @@
 
 #include "../fft.h" // for FFT_SIZE
 
-/** Size of #sample_buffer, in number of samples.
+/** Size of each half of #adc_sample_buffer, in number of samples.
   * \warning This must be a multiple of 16, or else hardwareRandom32Bytes()
   *          will attempt to read past the end of the sample buffer.
   */
 #define SAMPLE_BUFFER_SIZE		(FFT_SIZE * 2)
 
-extern volatile uint16_t adc_sample_buffer[SAMPLE_BUFFER_SIZE];
-extern volatile bool sample_buffer_full;
+/** CT32B0 prescaler value at full clock speed. The ADC is triggered every
+  * 18 * 2 * (this + 1) system clock cycles. This must be one less than a power
+  * of 2, so that the prescaler can be scaled along with the system clock
+  * divider when CLOCK_GOVERNOR is defined (see setClockSpeed() in main.c). */
+#define ADC_TIMER_PRESCALER		63
+
+extern volatile uint16_t adc_sample_buffer[2][SAMPLE_BUFFER_SIZE];
 
 extern void initADC(void);
-extern void beginFillingADCBuffer(void);
+extern void startADCSampling(void);
+extern void stopADCSampling(void);
+extern bool isADCBufferHalfFull(unsigned int half);
+extern void clearADCBufferHalfFull(unsigned int half);
 
 #endif // #ifndef LPC11UXX_ADC_H_INCLUDED
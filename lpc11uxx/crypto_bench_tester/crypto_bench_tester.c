@@ -0,0 +1,417 @@
+// ***********************************************************************
+// crypto_bench_tester.c
+// ***********************************************************************
+//
+// Collect on-device benchmark results from hardware Bitcoin wallet. The
+// firmware should be compiled with the "TEST_CRYPTO_BENCH" preprocessor
+// definition set (see ../../crypto_bench.c).
+//
+// Results are displayed and also written, in comma-separated values format,
+// to a file, so that different builds (eg. with and without
+// BIGNUM_32BIT_LIMBS, ECDSA_NO_G_TABLE or AES_TTABLE) can be compared.
+//
+// This file is licensed as described by the file LICENCE.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+
+// The default number of bytes (transmitted or received) in between
+// acknowledgments.
+#define DEFAULT_ACKNOWLEDGE_INTERVAL	16
+// The number of received bytes in between acknowledgments that this program
+// will use (doesn't have to be the default).
+#define RX_ACKNOWLEDGE_INTERVAL			32
+
+// Remaining number of bytes that can be transmitted before listening for
+// acknowledge.
+static uint32_t tx_bytes_to_ack;
+// Remaining number of bytes that can be received before other side expects an
+// acknowledge.
+static uint32_t rx_bytes_to_ack;
+
+int fd_serial; // file descriptor for serial port
+
+// Write the 32-bit unsigned integer specified by in into the byte array
+// specified by out. This will write the bytes in a little-endian format.
+static void writeU32LittleEndian(uint8_t *out, uint32_t in)
+{
+	out[0] = (uint8_t)in;
+	out[1] = (uint8_t)(in >> 8);
+	out[2] = (uint8_t)(in >> 16);
+	out[3] = (uint8_t)(in >> 24);
+}
+
+// Read a 32-bit unsigned integer from the byte array specified by in.
+// The bytes will be read in a little-endian format.
+static uint32_t readU32LittleEndian(uint8_t *in)
+{
+	return ((uint32_t)in[0])
+		| ((uint32_t)in[1] << 8)
+		| ((uint32_t)in[2] << 16)
+		| ((uint32_t)in[3] << 24);
+}
+
+// Get a byte from the serial link, sending an acknowledgement if required.
+static uint8_t receiveByte(void)
+{
+	uint8_t ack_buffer[5];
+	uint8_t buffer;
+
+	read(fd_serial, &buffer, 1);
+	rx_bytes_to_ack--;
+	if (!rx_bytes_to_ack)
+	{
+		rx_bytes_to_ack = RX_ACKNOWLEDGE_INTERVAL;
+		ack_buffer[0] = 0xff;
+		writeU32LittleEndian(&(ack_buffer[1]), rx_bytes_to_ack);
+		write(fd_serial, ack_buffer, 5);
+	}
+	return buffer;
+}
+
+// Send a byte to the serial link, waiting for acknowledgement if required.
+static void sendByte(uint8_t data)
+{
+	uint8_t ack_buffer[5];
+	uint8_t buffer;
+
+	buffer = data;
+	write(fd_serial, &buffer, 1);
+	tx_bytes_to_ack--;
+	if (!tx_bytes_to_ack)
+	{
+		read(fd_serial, ack_buffer, 5);
+		if (ack_buffer[0] != 0xff)
+		{
+			printf("Unexpected acknowledgement format (%d)\n", (int)ack_buffer[0]);
+			printf("Exiting, since the serial link is probably dodgy\n");
+			exit(1);
+		}
+		tx_bytes_to_ack = readU32LittleEndian(&(ack_buffer[1]));
+	}
+}
+
+// Receive a 32-bit unsigned integer (in little-endian format) from the
+// device.
+static uint32_t receiveU32(void)
+{
+	uint8_t buffer[4];
+	int i;
+
+	for (i = 0; i < 4; i++)
+	{
+		buffer[i] = receiveByte();
+	}
+	return readU32LittleEndian(buffer);
+}
+
+// Receive benchmark results from the device, display them and write them
+// (in the same comma-separated values format as the host benchmarks in
+// ../../bench.c) to the file specified by f_results.
+static void receiveResults(FILE *f_results)
+{
+	char name[256];
+	uint32_t counts_per_second;
+	uint32_t cycles_per_count;
+	uint32_t iterations;
+	uint32_t bytes_per_op;
+	uint32_t counts;
+	double ns_per_op;
+	double cycles_per_op;
+	double bytes_per_second;
+	int name_length;
+	int i;
+
+	counts_per_second = receiveU32();
+	cycles_per_count = receiveU32();
+	printf("Cycle counter frequency: %u Hz, CPU cycles per count: %u\n", counts_per_second, cycles_per_count);
+	fprintf(f_results, "name,iterations,bytes_per_op,ns_per_op,cycles_per_op,bytes_per_second\n");
+	while (1)
+	{
+		name_length = receiveByte();
+		if (name_length == 0)
+		{
+			break; // end of results
+		}
+		for (i = 0; i < name_length; i++)
+		{
+			name[i] = (char)receiveByte();
+		}
+		name[name_length] = '\0';
+		iterations = receiveU32();
+		bytes_per_op = receiveU32();
+		counts = receiveU32();
+		if (iterations == 0)
+		{
+			iterations = 1; // avoid division by zero
+		}
+		ns_per_op = (double)counts * 1.0e9 / (double)counts_per_second / (double)iterations;
+		cycles_per_op = (double)counts * (double)cycles_per_count / (double)iterations;
+		if (bytes_per_op != 0)
+		{
+			bytes_per_second = (double)bytes_per_op * 1.0e9 / ns_per_op;
+		}
+		else
+		{
+			bytes_per_second = 0.0;
+		}
+		printf("%-20s %6u ops %16.1f ns/op %14.1f cycles/op", name, iterations, ns_per_op, cycles_per_op);
+		if (bytes_per_op != 0)
+		{
+			printf(" %10.3f kB/s", bytes_per_second / 1.0e3);
+		}
+		printf("\n");
+		fprintf(f_results, "%s,%u,%u,%.1f,%.1f,%.0f\n", name, iterations, bytes_per_op, ns_per_op, cycles_per_op, bytes_per_second);
+	}
+}
+
+// A |t| above this is considered evidence of timing leakage. This is the
+// threshold which dudect uses (see ../../bench.c).
+#define LEAKAGE_T_THRESHOLD		4.5
+
+// Percentiles above which measurements are discarded, for each cropped
+// t-test in leakageMaxT().
+static const double leakage_crop_percentiles[] = {50.0, 75.0, 90.0, 95.0, 99.0};
+
+// Comparison function for qsort(), for sorting measurements in ascending
+// order.
+static int compareDoubles(const void *a, const void *b)
+{
+	double x;
+	double y;
+
+	x = *(const double *)a;
+	y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// Calculate Welch's t statistic for the measurements which are no larger
+// than threshold. classes[i] is the class (0 = fixed, 1 = random) of
+// measurement i.
+static double leakageT(double *measurements, uint8_t *classes, uint32_t count, double threshold)
+{
+	double n[2];
+	double sum[2];
+	double sum_sq[2];
+	double mean[2];
+	double var[2];
+	uint32_t i;
+	int c;
+
+	memset(n, 0, sizeof(n));
+	memset(sum, 0, sizeof(sum));
+	memset(sum_sq, 0, sizeof(sum_sq));
+	for (i = 0; i < count; i++)
+	{
+		if (measurements[i] <= threshold)
+		{
+			c = classes[i] & 1;
+			n[c] += 1.0;
+			sum[c] += measurements[i];
+		}
+	}
+	if ((n[0] < 2.0) || (n[1] < 2.0))
+	{
+		return 0.0;
+	}
+	mean[0] = sum[0] / n[0];
+	mean[1] = sum[1] / n[1];
+	for (i = 0; i < count; i++)
+	{
+		if (measurements[i] <= threshold)
+		{
+			c = classes[i] & 1;
+			sum_sq[c] += (measurements[i] - mean[c]) * (measurements[i] - mean[c]);
+		}
+	}
+	var[0] = sum_sq[0] / (n[0] - 1.0);
+	var[1] = sum_sq[1] / (n[1] - 1.0);
+	if ((var[0] + var[1]) == 0.0)
+	{
+		return 0.0;
+	}
+	return (mean[0] - mean[1]) / sqrt((var[0] / n[0]) + (var[1] / n[1]));
+}
+
+// Get the largest |t| over the uncropped measurements and the measurements
+// cropped at each of leakage_crop_percentiles.
+static double leakageMaxT(double *measurements, uint8_t *classes, uint32_t count)
+{
+	double *sorted;
+	double t;
+	double max_t;
+	unsigned int j;
+
+	sorted = malloc(count * sizeof(double));
+	if (sorted == NULL)
+	{
+		printf("Out of memory\n");
+		exit(1);
+	}
+	memcpy(sorted, measurements, count * sizeof(double));
+	qsort(sorted, count, sizeof(double), compareDoubles);
+	max_t = fabs(leakageT(measurements, classes, count, sorted[count - 1]));
+	for (j = 0; j < (sizeof(leakage_crop_percentiles) / sizeof(leakage_crop_percentiles[0])); j++)
+	{
+		t = fabs(leakageT(measurements, classes, count, sorted[(uint32_t)(leakage_crop_percentiles[j] * (count - 1) / 100.0)]));
+		if (t > max_t)
+		{
+			max_t = t;
+		}
+	}
+	free(sorted);
+	return max_t;
+}
+
+// Receive timing leakage measurements from the device, run Welch's t-test
+// on them, display the results and write them (in comma-separated values
+// format) to the file specified by f_results.
+static void receiveLeakageResults(FILE *f_results)
+{
+	char name[256];
+	double *measurements;
+	uint8_t *classes;
+	uint32_t count;
+	uint32_t i;
+	double max_t;
+	int name_length;
+	int j;
+
+	fprintf(f_results, "name,measurements,max_abs_t\n");
+	while (1)
+	{
+		name_length = receiveByte();
+		if (name_length == 0)
+		{
+			break; // end of results
+		}
+		for (j = 0; j < name_length; j++)
+		{
+			name[j] = (char)receiveByte();
+		}
+		name[name_length] = '\0';
+		count = receiveU32();
+		measurements = malloc(count * sizeof(double));
+		classes = malloc(count);
+		if ((count == 0) || (measurements == NULL) || (classes == NULL))
+		{
+			printf("Invalid number of measurements: %u\n", count);
+			exit(1);
+		}
+		for (i = 0; i < count; i++)
+		{
+			classes[i] = receiveByte();
+			measurements[i] = (double)receiveU32();
+		}
+		max_t = leakageMaxT(measurements, classes, count);
+		printf("%-20s %6u measurements, max |t| = %8.2f", name, count, max_t);
+		if (max_t > LEAKAGE_T_THRESHOLD)
+		{
+			printf("  <-- probable timing leakage");
+		}
+		printf("\n");
+		fprintf(f_results, "%s,%u,%.2f\n", name, count, max_t);
+		free(measurements);
+		free(classes);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *results_file_name;
+	FILE *f_results;
+	struct termios options;
+	struct termios old_options;
+	int leakage_test;
+	int arg;
+
+	leakage_test = 0;
+	arg = 2;
+	if ((argc > arg) && !strcmp(argv[arg], "-l"))
+	{
+		leakage_test = 1;
+		arg++;
+	}
+	if ((argc < 2) || (argc > (arg + 1)))
+	{
+		printf("Usage: %s <serial device> [-l] [<results file>]\n", argv[0]);
+		printf("Use -l to test for timing leakage instead of benchmarking.\n");
+		printf("\n");
+		printf("Example: %s /dev/ttyUSB0 lpc_results.csv\n", argv[0]);
+		exit(1);
+	}
+	if (argc == (arg + 1))
+	{
+		results_file_name = argv[arg];
+	}
+	else if (leakage_test)
+	{
+		results_file_name = "crypto_leakage_results.csv";
+	}
+	else
+	{
+		results_file_name = "crypto_bench_results.csv";
+	}
+
+	// Attempt to open serial link.
+	fd_serial = open(argv[1], O_RDWR | O_NOCTTY);
+	if (fd_serial == -1)
+	{
+		printf("Could not open device \"%s\"\n", argv[1]);
+		printf("Make sure you have permission to open it. In many systems, only\n");
+		printf("root can access devices by default.\n");
+		exit(1);
+	}
+
+	fcntl(fd_serial, F_SETFL, 0); // block on reads
+	tcgetattr(fd_serial, &old_options); // save configuration
+	memcpy(&options, &old_options, sizeof(options));
+	cfsetispeed(&options, B57600); // baud rate 57600
+	cfsetospeed(&options, B57600);
+	options.c_cflag |= (CLOCAL | CREAD); // enable receiver and set local mode on
+	options.c_cflag &= ~PARENB; // no parity
+	options.c_cflag &= ~CSTOPB; // 1 stop bit
+	options.c_cflag &= ~CSIZE; // character size mask
+	options.c_cflag |= CS8; // 8 data bits
+	options.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG); // raw input
+	options.c_lflag &= ~(XCASE | ECHOK | ECHONL | ECHOCTL | ECHOPRT | ECHOKE); // disable more stuff
+	options.c_iflag &= ~(IXON | IXOFF | IXANY); // no software flow control
+	options.c_iflag &= ~(INPCK | INLCR | IGNCR | ICRNL | IUCLC); // disable more stuff
+	options.c_oflag &= ~OPOST; // raw output
+	tcsetattr(fd_serial, TCSANOW, &options);
+	rx_bytes_to_ack = DEFAULT_ACKNOWLEDGE_INTERVAL;
+	tx_bytes_to_ack = DEFAULT_ACKNOWLEDGE_INTERVAL;
+
+	f_results = fopen(results_file_name, "w");
+	if (f_results == NULL)
+	{
+		printf("Could not open \"%s\" for writing\n", results_file_name);
+		exit(1);
+	}
+
+	if (leakage_test)
+	{
+		printf("Measuring timing leakage; this may take a while...\n");
+		sendByte('L'); // tell device to start
+		receiveLeakageResults(f_results);
+	}
+	else
+	{
+		printf("Benchmarking; this may take a minute...\n");
+		sendByte(0); // tell device to start
+		receiveResults(f_results);
+	}
+	printf("Results written to \"%s\"\n", results_file_name);
+
+	fclose(f_results);
+	tcsetattr(fd_serial, TCSANOW, &old_options); // restore configuration
+	close(fd_serial);
+	exit(0);
+}
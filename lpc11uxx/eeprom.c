@@ -6,11 +6,23 @@
   * LPC11Uxx's EEPROM. The in application programming (IAP) interface is
   * used to access the EEPROM.
   *
+  * Every IAP call has a significant fixed overhead and runs with interrupts
+  * disabled, so calls are batched up using a RAM window onto the EEPROM.
+  * The window covers #EEPROM_WINDOW_SIZE bytes starting at a page boundary
+  * and always holds the current contents of that part of the EEPROM. Reads
+  * and writes which fall within the window don't need an IAP call at all;
+  * writes only mark part of the window as dirty. Dirty data is written
+  * back, in one page-aligned IAP call, by nonVolatileFlush() or when the
+  * window needs to move. The window is large enough to contain any wallet
+  * record, so repeated readWalletRecord() calls are served from RAM.
+  *
   * This file is licensed as described by the file LICENCE.
   */
 
+#include <string.h>
 #include "../common.h"
 #include "../hwinterface.h"
+#include "../profile.h"
 
 /** In application programming entry point. The 0th bit is set to force
   * the instruction mode to Thumb mode. */
@@ -34,6 +46,126 @@ static uint32_t iap_result[5];
   */
 #define EEPROM_SIZE		4032
 
+/** Size of an EEPROM page, in bytes. The EEPROM is programmed one page at a
+  * time, so writes which begin and end on a page boundary are the most
+  * efficient. */
+#define EEPROM_PAGE_SIZE	64
+
+#ifndef EEPROM_WINDOW_SIZE
+/** Size of the RAM window onto the EEPROM, in bytes. This must be a
+  * multiple of #EEPROM_PAGE_SIZE. The default of 256 bytes is enough to
+  * contain a whole wallet record (176 bytes) no matter where it starts
+  * within a page.
+  */
+#define EEPROM_WINDOW_SIZE	256
+#endif // #ifndef EEPROM_WINDOW_SIZE
+
+#if (EEPROM_WINDOW_SIZE % EEPROM_PAGE_SIZE) != 0
+#error "EEPROM_WINDOW_SIZE must be a multiple of EEPROM_PAGE_SIZE"
+#endif
+
+/** Copy of the EEPROM contents from #window_start onwards. This is only
+  * valid if #window_valid is true. */
+static uint8_t window_data[EEPROM_WINDOW_SIZE];
+/** EEPROM address of the first byte in #window_data. This is always a
+  * multiple of #EEPROM_PAGE_SIZE. */
+static uint32_t window_start;
+/** Number of valid bytes in #window_data. This is only less
+  * than #EEPROM_WINDOW_SIZE if the window reaches the end of the EEPROM. */
+static uint32_t window_length;
+/** Whether #window_data contains anything. This is false after a reset (and
+  * after sanitiseRam(), because it is zero-initialised). */
+static bool window_valid;
+/** Offset (within the window) of the first byte which has been written to
+  * but not yet committed to EEPROM. This is only meaningful
+  * if #window_dirty_end is non-zero. */
+static uint32_t window_dirty_start;
+/** Offset (within the window) of the byte after the last byte which has
+  * been written to but not yet committed to EEPROM. 0 means that nothing in
+  * the window is dirty. */
+static uint32_t window_dirty_end;
+
+/** Call an IAP EEPROM command.
+  * \param command The IAP command code: 61 for "Write EEPROM" or 62 for
+  *                "Read EEPROM".
+  * \param data The RAM address to read from or write to.
+  * \param address The EEPROM address to read from or write to.
+  * \param length The number of bytes to transfer.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+static NonVolatileReturn iapEEPROMCommand(uint32_t command, uint8_t *data, uint32_t address, uint32_t length)
+{
+	iap_command[0] = command; // IAP command code
+	iap_command[1] = address; // EEPROM address
+	iap_command[2] = (uint32_t)data; // RAM address
+	iap_command[3] = length; // number of bytes to be transferred
+#ifdef CLOCK_GOVERNOR
+	iap_command[4] = 48000 >> getClockShift(); // system clock frequency in kHz
+#else
+	iap_command[4] = 48000; // system clock frequency in kHz
+#endif // #ifdef CLOCK_GOVERNOR
+	PROFILE_ENTER(PROFILE_NV_IO);
+	iapEntry(iap_command, iap_result);
+	PROFILE_EXIT();
+	if (iap_result[0] == 0)
+	{
+		return NV_NO_ERROR;
+	}
+	else
+	{
+		return NV_IO_ERROR;
+	}
+}
+
+/** Check whether a range of EEPROM addresses lies entirely within the
+  * window.
+  * \param address The first EEPROM address of the range.
+  * \param length The number of bytes in the range.
+  * \return true if the range is within the window, false if it isn't.
+  */
+static bool isInWindow(uint32_t address, uint32_t length)
+{
+	return window_valid
+		&& (address >= window_start)
+		&& ((address + length) <= (window_start + window_length));
+}
+
+/** Move the window so that it covers a range of EEPROM addresses. Anything
+  * dirty in the old window is written back first.
+  * \param address The first EEPROM address of the range.
+  * \param length The number of bytes in the range.
+  * \return See #NonVolatileReturnEnum for return values. If the range can't
+  *         fit in the window, this will return #NV_INVALID_ADDRESS (and the
+  *         window will be empty).
+  */
+static NonVolatileReturn moveWindow(uint32_t address, uint32_t length)
+{
+	NonVolatileReturn r;
+
+	r = nonVolatileFlush();
+	if (r != NV_NO_ERROR)
+	{
+		return r;
+	}
+	window_valid = false;
+	window_start = address & ~(uint32_t)(EEPROM_PAGE_SIZE - 1);
+	if ((address + length) > (window_start + EEPROM_WINDOW_SIZE))
+	{
+		return NV_INVALID_ADDRESS;
+	}
+	window_length = EEPROM_SIZE - window_start;
+	if (window_length > EEPROM_WINDOW_SIZE)
+	{
+		window_length = EEPROM_WINDOW_SIZE;
+	}
+	r = iapEEPROMCommand(62, window_data, window_start, window_length);
+	if (r == NV_NO_ERROR)
+	{
+		window_valid = true;
+	}
+	return r;
+}
+
 /** Write to non-volatile storage.
   * \param data A pointer to the data to be written.
   * \param address Byte offset specifying where in non-volatile storage to
@@ -45,6 +177,9 @@ static uint32_t iap_result[5];
   */
 NonVolatileReturn nonVolatileWrite(uint8_t *data, uint32_t address, uint32_t length)
 {
+	NonVolatileReturn r;
+	uint32_t offset;
+
 	// Since EEPROM_SIZE is much smaller than 2 ^ 32, address + length cannot
 	// overflow.
 	if ((address > EEPROM_SIZE) || (length > EEPROM_SIZE)
@@ -52,20 +187,41 @@ NonVolatileReturn nonVolatileWrite(uint8_t *data, uint32_t address, uint32_t len
 	{
 		return NV_INVALID_ADDRESS;
 	}
-	iap_command[0] = 61; // IAP command code for "Write EEPROM"
-	iap_command[1] = address; // EEPROM address
-	iap_command[2] = (uint32_t)data; // RAM address
-	iap_command[3] = length; // number of bytes to be written
-	iap_command[4] = 48000; // system clock frequency in kHz
-	iapEntry(iap_command, iap_result);
-	if (iap_result[0] == 0)
+	if (!isInWindow(address, length))
 	{
-		return NV_NO_ERROR;
+		r = moveWindow(address, length);
+		if (r == NV_INVALID_ADDRESS)
+		{
+			// Too big for the window; write it directly. The window is
+			// empty now, so it can't end up with stale contents.
+			return iapEEPROMCommand(61, data, address, length);
+		}
+		else if (r != NV_NO_ERROR)
+		{
+			return r;
+		}
+	}
+	offset = address - window_start;
+	memcpy(&(window_data[offset]), data, length);
+	if (window_dirty_end == 0)
+	{
+		window_dirty_start = offset;
+		window_dirty_end = offset + length;
 	}
 	else
 	{
-		return NV_IO_ERROR;
+		// Everything in between is valid, so the dirty range can just be
+		// widened to cover both.
+		if (offset < window_dirty_start)
+		{
+			window_dirty_start = offset;
+		}
+		if ((offset + length) > window_dirty_end)
+		{
+			window_dirty_end = offset + length;
+		}
 	}
+	return NV_NO_ERROR;
 }
 
 /** Read from non-volatile storage.
@@ -77,6 +233,8 @@ NonVolatileReturn nonVolatileWrite(uint8_t *data, uint32_t address, uint32_t len
   */
 NonVolatileReturn nonVolatileRead(uint8_t *data, uint32_t address, uint32_t length)
 {
+	NonVolatileReturn r;
+
 	// Since EEPROM_SIZE is much smaller than 2 ^ 32, address + length cannot
 	// overflow.
 	if ((address > EEPROM_SIZE) || (length > EEPROM_SIZE)
@@ -84,20 +242,22 @@ NonVolatileReturn nonVolatileRead(uint8_t *data, uint32_t address, uint32_t leng
 	{
 		return NV_INVALID_ADDRESS;
 	}
-	iap_command[0] = 62; // IAP command code for "Read EEPROM"
-	iap_command[1] = address; // EEPROM address
-	iap_command[2] = (uint32_t)data; // RAM address
-	iap_command[3] = length; // number of bytes to be read
-	iap_command[4] = 48000; // system clock frequency in kHz
-	iapEntry(iap_command, iap_result);
-	if (iap_result[0] == 0)
-	{
-		return NV_NO_ERROR;
-	}
-	else
+	if (!isInWindow(address, length))
 	{
-		return NV_IO_ERROR;
+		r = moveWindow(address, length);
+		if (r == NV_INVALID_ADDRESS)
+		{
+			// Too big for the window; read it directly. Nothing is dirty,
+			// since moveWindow() flushed everything.
+			return iapEEPROMCommand(62, data, address, length);
+		}
+		else if (r != NV_NO_ERROR)
+		{
+			return r;
+		}
 	}
+	memcpy(data, &(window_data[address - window_start]), length);
+	return NV_NO_ERROR;
 }
 
 /** Ensure that all buffered writes are committed to non-volatile storage.
@@ -105,6 +265,29 @@ NonVolatileReturn nonVolatileRead(uint8_t *data, uint32_t address, uint32_t leng
   */
 NonVolatileReturn nonVolatileFlush(void)
 {
-	// Nothing to do; writes are never buffered.
-	return NV_NO_ERROR;
+	NonVolatileReturn r;
+	uint32_t start;
+	uint32_t end;
+
+	if (window_dirty_end == 0)
+	{
+		return NV_NO_ERROR;
+	}
+	// Round out to page boundaries (the window contents are valid there),
+	// so that the IAP call doesn't have to merge partial pages.
+	start = window_dirty_start & ~(uint32_t)(EEPROM_PAGE_SIZE - 1);
+	end = (window_dirty_end + EEPROM_PAGE_SIZE - 1) & ~(uint32_t)(EEPROM_PAGE_SIZE - 1);
+	if (end > window_length)
+	{
+		end = window_length;
+	}
+	r = iapEEPROMCommand(61, &(window_data[start]), window_start + start, end - start);
+	window_dirty_end = 0;
+	if (r != NV_NO_ERROR)
+	{
+		// The EEPROM contents are now unknown, so the window can't be
+		// trusted any more.
+		window_valid = false;
+	}
+	return r;
 }
@@ -26,6 +26,7 @@
 #include "../statistics.h"
 #include "hwrng_limits.h"
 #include "adc.h"
+#include "../clock_governor.h"
 
 #ifdef TEST_STATISTICS
 #include "ssd1306.h"
@@ -61,9 +62,14 @@ static int report_to_stream;
   * that way so that it is initially false.
   */
 static bool is_not_first_in_histogram;
-/** Number of samples in the sample buffer that hardwareRandom32Bytes() has
-  * used up. */
+/** Number of samples in the current half of the sample buffer
+  * that hardwareRandom32Bytes() has used up. */
 static uint32_t sample_buffer_consumed;
+/** Which half of the sample buffer (#adc_sample_buffer)
+  * hardwareRandom32Bytes() is reading from. */
+static unsigned int sample_buffer_half;
+/** Whether startADCSampling() has been called. */
+static bool sampling_started;
 
 /** Obtains an estimate of the bandwidth of the HWRNG, based on the power
   * spectrum density estimate (see #psd_accumulator).
@@ -192,10 +198,7 @@ static NOINLINE uint32_t histogramTestsFailed(fix16_t *variance)
 	fix16_t entropy_estimate;
 
 	fix16_error_occurred = false;
-	mean = calculateCentralMoment(fix16_zero, 1);
-	*variance = calculateCentralMoment(mean, 2);
-	kappa3 = calculateCentralMoment(mean, 3);
-	kappa4 = calculateCentralMoment(mean, 4);
+	calculateCentralMoments(&mean, variance, &kappa3, &kappa4);
 	moment_error_occurred = fix16_error_occurred;
 	fix16_error_occurred = false;
 	entropy_estimate = estimateEntropy();
@@ -272,6 +275,67 @@ static NOINLINE uint32_t histogramTestsFailed(fix16_t *variance)
 	return tests_failed;
 }
 
+/** Check the results of the repetition count and adaptive proportion tests
+  * (see updateHealthTests()) against their cutoffs.
+  * \return 0 if all tests passed, non-zero if any tests failed.
+  */
+static uint32_t healthTestsFailed(void)
+{
+	uint32_t tests_failed;
+
+	tests_failed = 0;
+	if (max_repetition_count >= REPETITION_COUNT_CUTOFF)
+	{
+		tests_failed |= 256; // HWRNG output got stuck on one value
+	}
+	if (max_proportion_count >= ADAPTIVE_PROPORTION_CUTOFF)
+	{
+		tests_failed |= 256; // one value occurred far too often
+	}
+	return tests_failed;
+}
+
+/** Work out how much entropy to credit to the #SAMPLE_COUNT samples which
+  * were just tested. This only should be called after the histogram and
+  * the power spectral density accumulator are full. The measured
+  * min-entropy per sample is scaled down by the bandwidth of the HWRNG
+  * signal and by #ENTROPY_DERATING_FACTOR, then capped
+  * at #MAX_ENTROPY_BITS_PER_SAMPLE.
+  * \return The number of bits of entropy to credit.
+  */
+static int calculateEntropyBits(void)
+{
+	int bandwidth; // as FFT bin number
+	int max_bin; // as FFT bin number
+	int bits;
+	fix16_t rate;
+
+	bandwidth = estimateBandwidth(&max_bin);
+	fix16_error_occurred = false;
+	rate = scaleEntropyByBandwidth(estimateMinEntropy(), bandwidth);
+	rate = fix16_mul(rate, F16(1.0 / ENTROPY_DERATING_FACTOR));
+	if (fix16_error_occurred)
+	{
+		// Fall back to a fixed, extremely conservative estimate. For a
+		// SAMPLE_COUNT of 4096, this probably underestimates the usable
+		// entropy by a factor of about 50.
+		return 512;
+	}
+	if (rate > F16(MAX_ENTROPY_BITS_PER_SAMPLE))
+	{
+		rate = F16(MAX_ENTROPY_BITS_PER_SAMPLE);
+	}
+	bits = (int)((rate * SAMPLE_COUNT) / 65536); // round towards zero
+	// hardwareRandom32Bytes() returning 0 means something else, so always
+	// credit at least 1 bit. Samples this poor would fail the statistical
+	// tests anyway.
+	if (bits < 1)
+	{
+		bits = 1;
+	}
+	return bits;
+}
+
 /** Run FFT-based statistical tests on HWRNG signal and report any failures.
   * This only should be called once the power spectral density accumulator
   * (see #psd_accumulator) has accumulated enough samples.
@@ -350,19 +414,30 @@ int hardwareRandom32Bytes(uint8_t *buffer)
 		// everything needs to start from a blank state.
 		clearHistogram();
 		clearPowerSpectralDensity();
-		// The histogram is empty. The sample buffer is also assumed to be
-		// empty, since this may be the first call to hardwareRandom32Bytes()
-		// after power-on. Therefore an extra call to beginFillingADCBuffer()
-		// needs to be done to ensure that a full, current sample buffer is
-		// available.
-		sample_buffer_consumed = 0;
-		beginFillingADCBuffer();
+		clearHealthTests();
+		// Sampling is only started by the first call to
+		// hardwareRandom32Bytes() after power-on; after that, it keeps
+		// going between series of samples. Each series ends on the boundary
+		// between halves of the sample buffer, so nothing needs to be reset
+		// here.
+#if ((SAMPLE_COUNT % SAMPLE_BUFFER_SIZE) != 0)
+#error "SAMPLE_COUNT not a multiple of SAMPLE_BUFFER_SIZE"
+#endif // #if ((SAMPLE_COUNT % SAMPLE_BUFFER_SIZE) != 0)
+		if (!sampling_started)
+		{
+			sample_buffer_consumed = 0;
+			sample_buffer_half = 0;
+			startADCSampling();
+			sampling_started = true;
+		}
 		is_not_first_in_histogram = true;
 	}
 	if (sample_buffer_consumed == 0)
 	{
-		// Need to wait until next sample buffer has been filled.
-		while (!sample_buffer_full)
+		// Need to wait until the next half of the sample buffer has been
+		// filled. The ADC keeps filling the other half while this half is
+		// used up, so usually this won't need to wait.
+		while (!isADCBufferHalfFull(sample_buffer_half))
 		{
 			// do nothing
 		}
@@ -377,8 +452,9 @@ int hardwareRandom32Bytes(uint8_t *buffer)
 #endif // #if ((SAMPLE_BUFFER_SIZE & 15) != 0)
 	for (i = 0; i < 16; i++)
 	{
-		sample = adc_sample_buffer[sample_buffer_consumed];
+		sample = adc_sample_buffer[sample_buffer_half][sample_buffer_consumed];
 		incrementHistogram(sample);
+		updateHealthTests(sample);
 		// Fill entropy buffer with ADC sample data.
 		buffer[i * 2] = (uint8_t)sample;
 		buffer[i * 2 + 1] = (uint8_t)(sample >> 8);
@@ -393,18 +469,28 @@ int hardwareRandom32Bytes(uint8_t *buffer)
 #if SAMPLE_BUFFER_SIZE != (FFT_SIZE * 2)
 #error "SAMPLE_BUFFER_SIZE not twice FFT_SIZE"
 #endif // #if SAMPLE_BUFFER_SIZE != (FFT_SIZE * 2)
-		accumulatePowerSpectralDensity(adc_sample_buffer);
-		// Sample buffer fully consumed; need to get a new buffer.
+		// The FFT and the statistical tests below are the expensive part of
+		// this; waiting for the sample buffer above doesn't get any faster,
+		// since the ADC sample rate is fixed.
+		CLOCK_BOOST_BEGIN();
+		accumulatePowerSpectralDensity(adc_sample_buffer[sample_buffer_half]);
+		CLOCK_BOOST_END();
+		// This half is fully consumed; give it back to the ADC and move on
+		// to the other half.
+		clearADCBufferHalfFull(sample_buffer_half);
+		sample_buffer_half ^= 1;
 		sample_buffer_consumed = 0;
-		beginFillingADCBuffer();
 	}
 
 	if (samples_in_histogram >= SAMPLE_COUNT)
 	{
 		// Histogram is full. Statistical properties can now be calculated.
 		is_not_first_in_histogram = false;
+		CLOCK_BOOST_BEGIN();
 		tests_failed = histogramTestsFailed(&variance);
 		tests_failed |= fftTestsFailed(variance);
+		tests_failed |= healthTestsFailed();
+		CLOCK_BOOST_END();
 #ifdef TEST_STATISTICS
 		reportStatistics(tests_failed);
 #endif // #ifdef TEST_STATISTICS
@@ -412,13 +498,13 @@ int hardwareRandom32Bytes(uint8_t *buffer)
 		{
 			return -1; // statistical tests indicate HWRNG failure
 		}
-		// Why return 512 (bits)? This ensures that hardwareRandom32Bytes()
-		// will be called a minimum number of times per getRandom256() call,
-		// assuming an entropy safety factor of 2 in prandom.c.
-		// This is extremely conservative, given any reasonable value of
-		// SAMPLE_COUNT. For example, for a SAMPLE_COUNT of 4096, this
-		// probably underestimates the usable entropy by a factor of about 50.
-		return 512;
+		// Entropy is only credited once all SAMPLE_COUNT samples have been
+		// tested, so the return value is for all of them. A good noise
+		// source returns more than the 512 bits which getRandom256()
+		// needs (assuming an entropy safety factor of 2 in prandom.c); a
+		// poor one makes getRandom256() wait for another SAMPLE_COUNT
+		// samples.
+		return calculateEntropyBits();
 	}
 	else
 	{
@@ -756,10 +842,7 @@ void testStatistics(void)
 			SysTick->LOAD = 0x00FFFFFF; // set timer reload to max
 			SysTick->CTRL = 5; // enable system tick timer, frequency = CPU
 
-			mean = calculateCentralMoment(fix16_zero, 1);
-			variance = calculateCentralMoment(mean, 2);
-			kappa3 = calculateCentralMoment(mean, 3);
-			kappa4 = calculateCentralMoment(mean, 4);
+			calculateCentralMoments(&mean, &variance, &kappa3, &kappa4);
 			entropy_estimate = estimateEntropy();
 
 			cycles = SysTick->VAL; // read as soon as possible
@@ -157,5 +157,36 @@
   * deviation of 24. This was calculated using Monte Carlo simulation.
   */
 #define STATTEST_MIN_ENTROPY		6.43
+/** The entropy credited to each #SAMPLE_COUNT samples is the min-entropy per
+  * sample (from the histogram), scaled by the measured bandwidth of the
+  * HWRNG signal as a fraction of the Nyquist frequency, then divided by this
+  * safety factor.
+  */
+#define ENTROPY_DERATING_FACTOR		2.0
+/** Upper limit on the measured entropy (in bits) per sample. The HWRNG
+  * signal hasn't been characterised beyond this, so a measurement above
+  * this is more likely to indicate a problem with the estimate than an
+  * unusually good noise source.
+  */
+#define MAX_ENTROPY_BITS_PER_SAMPLE	4.0
+
+/** Cutoff for the repetition count test (see updateHealthTests()). A run of
+  * this many identical consecutive samples is a failure. This was calculated
+  * using the formula in section 4.4.1 of NIST SP 800-90B, with a false
+  * positive probability of 2 ^ -20 and 1 bit of entropy per sample:
+  * 1 + ceil(20 / 1.0) = 21. 1 bit per sample is far below what
+  * #STATTEST_MIN_ENTROPY and #STATTEST_MIN_VARIANCE allow; the entropy
+  * estimate returned by hardwareRandom32Bytes() is even lower, but using
+  * that would make the cutoffs too loose to detect anything.
+  */
+#define REPETITION_COUNT_CUTOFF		21
+/** Cutoff for the adaptive proportion test (see updateHealthTests()). If the
+  * first sample of a window occurs this many times within
+  * the #PROPORTION_WINDOW_SIZE samples of that window, the test fails. This
+  * is the critical value of a binomial distribution (N = 512, p = 0.5) for a
+  * false positive probability of 2 ^ -20, as listed in section 4.4.2 of
+  * NIST SP 800-90B for 1 bit of entropy per sample.
+  */
+#define ADAPTIVE_PROPORTION_CUTOFF	410
 
 #endif // #ifndef LPC11UXX_HWRNG_LIMITS_H_INCLUDED
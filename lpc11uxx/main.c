@@ -15,6 +15,8 @@
 #include "adc.h"
 #include "../hwinterface.h"
 #include "../stream_comm.h"
+#include "../wallet.h"
+#include "../pc_sampling.h"
 
 #ifdef TEST_FFT
 #include "test_fft.h"
@@ -22,6 +24,9 @@
 #ifdef TEST_STATISTICS
 #include "hwrng.h"
 #endif // #ifdef TEST_STATISTICS
+#ifdef TEST_CRYPTO_BENCH
+#include "../crypto_bench.h"
+#endif // #ifdef TEST_CRYPTO_BENCH
 
 /** Upon reset, the LPC11Uxx clock source is its IRC oscillator. This
   * function switches it to run at 48 Mhz the system PLL, using an external
@@ -48,6 +53,248 @@ static void initSystemClock(void)
 	LPC_SYSCON->SYSAHBCLKDIV = 1; // set system clock divider = 1
 }
 
+#ifdef PC_SAMPLING
+/** Value of the CT16B1 prescaler register at full clock speed. 47 means
+  * divide by 48, so CT16B1 increments at 1 Mhz. */
+#define PC_SAMPLE_TIMER_PRESCALER	47
+#endif // #ifdef PC_SAMPLING
+
+#ifdef CLOCK_GOVERNOR
+/** Base 2 logarithm of the system clock divider used while the clock isn't
+  * boosted. 1 gives 24 Mhz. The USART and SSP clocks have their own
+  * dividers from the main clock, so they aren't affected by this.
+  */
+#define REDUCED_CLOCK_SHIFT		1
+
+/** Number of calls to clockBoost(true) which haven't been matched by a
+  * call to clockBoost(false) yet. */
+static unsigned int clock_boost_count;
+/** Base 2 logarithm of the current system clock divider
+  * (see getClockShift()). */
+static uint8_t clock_shift;
+
+/** Switch between full clock speed and the reduced clock speed used while
+  * the clock isn't boosted, by changing the system clock divider. Flash
+  * access time is increased before speeding up and decreased after slowing
+  * down, so that flash is never accessed too quickly. The CT32B0 prescaler
+  * is scaled too, so that the ADC sample rate doesn't change if the clock
+  * speed changes while the sample buffer is being filled. So is the CT16B1
+  * prescaler (if PC_SAMPLING is defined), so that PC samples are taken at
+  * the same rate regardless of clock speed.
+  * \param full_speed Use true to run at full speed, false to run at the
+  *                   reduced speed.
+  */
+static void setClockSpeed(bool full_speed)
+{
+	uint32_t primask;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	if (full_speed)
+	{
+		LPC_FLASHCTRL->FLASHCFG = (LPC_FLASHCTRL->FLASHCFG & ~0x03) | 2; // flash access time = 3 clocks
+		clock_shift = 0;
+	}
+	else
+	{
+		clock_shift = REDUCED_CLOCK_SHIFT;
+	}
+	LPC_SYSCON->SYSAHBCLKDIV = 1 << clock_shift;
+	LPC_CT32B0->PR = ADC_TIMER_PRESCALER >> clock_shift;
+#ifdef PC_SAMPLING
+	LPC_CT16B1->PR = PC_SAMPLE_TIMER_PRESCALER >> clock_shift;
+#endif // #ifdef PC_SAMPLING
+	if (!full_speed)
+	{
+		LPC_FLASHCTRL->FLASHCFG = (LPC_FLASHCTRL->FLASHCFG & ~0x03) | 1; // flash access time = 2 clocks
+	}
+	__set_PRIMASK(primask);
+}
+
+/** Start or stop running at full clock speed. See clockBoost() in
+  * hwinterface.h.
+  * \param boost Use true to start running at full speed, false to undo the
+  *              matching clockBoost(true).
+  */
+void clockBoost(bool boost)
+{
+	if (boost)
+	{
+		if (clock_boost_count == 0)
+		{
+			setClockSpeed(true);
+		}
+		clock_boost_count++;
+	}
+	else if (clock_boost_count > 0)
+	{
+		clock_boost_count--;
+		if (clock_boost_count == 0)
+		{
+			setClockSpeed(false);
+		}
+	}
+}
+
+/** Find out how much slower than full speed the CPU is currently running.
+  * See getClockShift() in hwinterface.h.
+  * \return The base 2 logarithm of the current system clock divider.
+  */
+uint8_t getClockShift(void)
+{
+	return clock_shift;
+}
+#endif // #ifdef CLOCK_GOVERNOR
+
+#if defined(STREAM_COMM_PROFILE) || defined(TEST_CRYPTO_BENCH) || defined(PBKDF2_CALIBRATE)
+/** Set up the CT32B1 timer so that it can be used as the cycle counter for
+  * profiling and benchmarking. SysTick isn't used because it is only 24 bits wide and is
+  * reprogrammed by wait1ms() in user_interface.c. CT32B0 is used by the ADC,
+  * so it isn't available either.
+  */
+static void initCycleCounter(void)
+{
+	LPC_SYSCON->SYSAHBCLKCTRL |= 0x400; // enable clock to CT32B1
+	LPC_CT32B1->TCR = 2; // disable and reset timer
+	LPC_CT32B1->CTCR = 0; // timer mode
+	LPC_CT32B1->PR = 0; // no prescaling; increment every system clock cycle
+	LPC_CT32B1->MCR = 0; // no match actions; let timer wrap around
+	LPC_CT32B1->TCR = 1; // enable timer
+}
+
+/** Get the current value of the CT32B1 timer. See getCycleCount() in
+  * hwinterface.h.
+  * \return The current value of the timer.
+  */
+uint32_t getCycleCount(void)
+{
+	return LPC_CT32B1->TC;
+}
+
+/** Get the rate at which the CT32B1 timer increments.
+  * \return The number of counts per second.
+  */
+uint32_t getCycleCountFrequency(void)
+{
+	// With CLOCK_GOVERNOR, CT32B1 increments more slowly than this whenever
+	// the clock isn't boosted (see getClockShift()), so time spent waiting
+	// is under-reported.
+	return 48000000;
+}
+#endif // #if defined(STREAM_COMM_PROFILE) || defined(TEST_CRYPTO_BENCH) || defined(PBKDF2_CALIBRATE)
+
+#ifdef STREAM_COMM_TRACE
+/** Disable interrupts while the event trace is being updated. See
+  * traceDisableInterrupts() in hwinterface.h.
+  * \return Previous value of PRIMASK.
+  */
+uint32_t traceDisableInterrupts(void)
+{
+	uint32_t primask;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	return primask;
+}
+
+/** Restore interrupt handling behaviour after the event trace has been
+  * updated.
+  * \param status Value returned by traceDisableInterrupts().
+  */
+void traceRestoreInterrupts(uint32_t status)
+{
+	__set_PRIMASK(status);
+}
+#endif // #ifdef STREAM_COMM_TRACE
+
+#ifdef PC_SAMPLING
+/** Start of code, defined in the linker script. */
+extern uint32_t __text_start;
+/** Address just past the end of code, defined in the linker script. */
+extern uint32_t __text_end;
+
+/** The PC sampler's histogram. With only 8 KB of RAM, it may be necessary
+  * to define PC_SAMPLE_BUCKETS to something smaller than the default (eg.
+  * 128, which gives 256 byte buckets over 32 KB of flash). */
+static PCSamplingState pc_sampling_state;
+
+/** Get the range of addresses which the firmware's code occupies. See
+  * pcSamplingGetCodeRange() in hwinterface.h.
+  * \param out_start The lowest address will be written here.
+  * \param out_end One past the highest address will be written here.
+  */
+void pcSamplingGetCodeRange(uint32_t *out_start, uint32_t *out_end)
+{
+	*out_start = (uint32_t)&__text_start;
+	*out_end = (uint32_t)&__text_end;
+}
+
+/** Get the rate at which PC samples are taken. See pcSamplingGetRate() in
+  * hwinterface.h.
+  * \return The number of samples per second.
+  */
+uint32_t pcSamplingGetRate(void)
+{
+	return PC_SAMPLE_RATE;
+}
+
+/** Set up the CT16B1 timer to interrupt at #PC_SAMPLE_RATE Hz. Its
+  * interrupt has the highest priority, so that other interrupt handlers get
+  * sampled too. Every interrupt starts off with the highest priority, so
+  * this must be called after the USART and ADC interrupts are enabled, and
+  * their priority is lowered here. */
+static void initPCSampling(void)
+{
+	pcSamplingInit(&pc_sampling_state);
+	LPC_SYSCON->SYSAHBCLKCTRL |= 0x100; // enable clock to CT16B1
+	LPC_CT16B1->TCR = 2; // disable and reset timer
+	LPC_CT16B1->CTCR = 0; // timer mode
+	LPC_CT16B1->PR = PC_SAMPLE_TIMER_PRESCALER;
+	LPC_CT16B1->MR0 = (1000000 / PC_SAMPLE_RATE) - 1;
+	LPC_CT16B1->MCR = 3; // interrupt and reset timer on match with MR0
+	LPC_CT16B1->IR = 0x1f; // clear any pending interrupts
+	NVIC_SetPriority(21, 1); // 21 = USART interrupt
+	NVIC_SetPriority(24, 1); // 24 = ADC interrupt
+	NVIC_SetPriority(17, 0); // 17 = CT16B1 interrupt
+	NVIC_EnableIRQ(17);
+	LPC_CT16B1->TCR = 1; // enable timer
+}
+
+/** Called by TIMER16_1_IRQHandler() with the address of the instruction
+  * which was interrupted.
+  * \param pc The stacked program counter.
+  */
+static void __attribute__((used)) recordPCSample(uint32_t pc)
+{
+	LPC_CT16B1->IR = 1; // clear MR0 interrupt
+	pcSamplingRecord(pc & ~1u);
+}
+
+/** Interrupt service handler for CT16B1. The interrupted program counter
+  * is in the exception stack frame, on whichever stack (main or process)
+  * was in use, so this needs to be written in assembly. It tail calls
+  * recordPCSample(), which returns from the exception. Code which runs with
+  * interrupts disabled can't be sampled; its samples land on the
+  * instruction which re-enables interrupts instead. */
+void __attribute__((naked)) TIMER16_1_IRQHandler(void)
+{
+	asm volatile(
+		"movs r0, #4\n"
+		"mov r1, lr\n"
+		"tst r0, r1\n" // bit 2 of EXC_RETURN is set if PSP was in use
+		"beq 1f\n"
+		"mrs r0, psp\n"
+		"b 2f\n"
+		"1:\n"
+		"mrs r0, msp\n"
+		"2:\n"
+		"ldr r0, [r0, #24]\n" // stacked PC
+		"ldr r1, =recordPCSample\n"
+		"bx r1\n"
+		".ltorg\n");
+}
+#endif // #ifdef PC_SAMPLING
+
 /** This will be called whenever something very unexpected occurs. This
   * function must not return. */
 void fatalError(void)
@@ -78,35 +325,78 @@ uint32_t getPBKDF2Iterations(void)
 }
 
 #ifdef CHECK_STACK_USAGE
-#include "../endian.h"
-extern void *__stack_start;
-extern void *__stack_end;
-#endif // #ifdef CHECK_STACK_USAGE
+/** Lowest address of the stack, defined in the linker script. */
+extern uint32_t __stack_start;
+/** Address just past the top of the stack, defined in the linker script.
+  * The stack grows downwards from here. */
+extern uint32_t __stack_end;
 
-/** Entry point. This is the first thing which is called after startup code.
-  * This never returns. */
-int main(void)
+/** Value which unused stack words are filled with. */
+#define STACK_MARKER		0xcccccccc
+/** The part of the stack this close (in bytes) to paintStack()'s own stack
+  * frame isn't painted, since it may be in use. */
+#define STACK_PAINT_MARGIN	64
+
+/** Fill unused part of stack with a marker value. See paintStack() in
+  * hwinterface.h. */
+void paintStack(void)
 {
-#ifdef CHECK_STACK_USAGE
-	uint32_t i;
-	int j;
-	uint8_t buffer[4];
+	uint32_t here; // used to find current stack pointer
+	uint32_t *p;
 
-	// Mark out stack with 0xcc.
-	for (i = (uint32_t)&__stack_start; i < (((uint32_t)&i) - 256); i++)
+	for (p = &__stack_start; p < (uint32_t *)(((uint8_t *)&here) - STACK_PAINT_MARGIN); p++)
 	{
-		*((uint8_t *)i) = 0xcc;
+		*p = STACK_MARKER;
 	}
+}
+
+/** Get maximum stack usage since last paintStack(). See getStackUsage() in
+  * hwinterface.h.
+  * \return The maximum stack usage, in bytes.
+  */
+uint32_t getStackUsage(void)
+{
+	uint32_t *p;
+
+	for (p = &__stack_start; p < &__stack_end; p++)
+	{
+		if (*p != STACK_MARKER)
+		{
+			break;
+		}
+	}
+	return (uint32_t)(((uint8_t *)&__stack_end) - ((uint8_t *)p));
+}
 #endif // #ifdef CHECK_STACK_USAGE
+
+/** Entry point. This is the first thing which is called after startup code.
+  * This never returns. */
+int main(void)
+{
 	initSystemClock();
 	initUsart();
 	initSerialFIFO();
-	initSSD1306();
-	initUserInterface();
 	initADC();
+#ifdef CLOCK_GOVERNOR
+	setClockSpeed(false);
+#endif // #ifdef CLOCK_GOVERNOR
+#if defined(STREAM_COMM_PROFILE) || defined(TEST_CRYPTO_BENCH) || defined(PBKDF2_CALIBRATE)
+	initCycleCounter();
+#endif // #if defined(STREAM_COMM_PROFILE) || defined(TEST_CRYPTO_BENCH) || defined(PBKDF2_CALIBRATE)
+#ifdef PC_SAMPLING
+	initPCSampling();
+#endif // #ifdef PC_SAMPLING
 
 	__enable_irq();
 
+	// The serial link and ADC are interrupt-driven, so they are brought up
+	// first; anything the host sends while the display is being
+	// initialised (which involves clearing all of GDDRAM over a slow SPI
+	// link) is buffered, and the ADC is filling the HWRNG sample buffer in
+	// the meantime. Nothing before the main loop writes to the display.
+	initSSD1306();
+	initUserInterface();
+
 #if defined(TEST_FFT)
 	testFFT();
 	while (true)
@@ -119,26 +409,15 @@ int main(void)
 	{
 		// do nothing
 	}
+#elif defined(TEST_CRYPTO_BENCH)
+	benchmarkCrypto(1); // CT32B1 increments every CPU cycle
 #else
+	// If a format was interrupted (eg. by a loss of power), finish it
+	// before doing anything else.
+	finishInterruptedSanitisation();
 	do
 	{
 		processPacket();
-#ifdef CHECK_STACK_USAGE
-		// Find out how much stack space was used by looking for changes to
-		// the 0xcc marker.
-		for (i = (uint32_t)&__stack_start; i < (((uint32_t)&i) - 256); i++)
-		{
-			if (*((uint8_t *)i) != 0xcc)
-			{
-				writeU32LittleEndian(buffer, ((uint32_t)&__stack_end) - i);
-				for (j = 0; j < 4; j++)
-				{
-					streamPutOneByte(buffer[j]);
-				}
-				break;
-			}
-		}
-#endif // #ifdef CHECK_STACK_USAGE
 	} while (true);
 #endif // #ifdef TEST_FFT
 }
@@ -12,6 +12,13 @@
   * since storage is implemented as a circular queue. Instead, when a buffer
   * overflow is detected, streamError() is called.
   *
+  * Each buffer has exactly one producer and one consumer: the receive
+  * buffer is filled by UART_IRQHandler() and emptied by the main program,
+  * and the transmit buffer is the other way around. The producer only ever
+  * modifies the head index and the consumer only ever modifies the tail
+  * index, so interrupts don't need to be disabled to move data in or out of
+  * a buffer.
+  *
   * The functions in this file don't actually interface with any
   * communications hardware. The interface of circular buffers to hardware
   * must be handled elsewhere.
@@ -51,6 +58,13 @@
   */
 #define USBRAM_END			((volatile uint8_t *)0x20004800)
 
+/** Make sure that all memory accesses before this are done before any
+  * memory accesses after this. This is used to ensure that a byte is in
+  * a buffer's storage before the other side can see a head index which
+  * includes it, and that a byte has been read out of storage before the
+  * other side can see a tail index which frees up its space. */
+#define MEMORY_BARRIER()	__DMB()
+
 /** Storage for the transmit buffer.
   * \warning This is stored in USB RAM. See #USBRAM_END for more details.
   */
@@ -83,13 +97,13 @@ void initSerialFIFO(void)
 	memset((void *)receive_buffer_storage, 0xff, RECEIVE_BUFFER_SIZE); // just to be sure
 	memset((void *)transmit_buffer_storage, 0, TRANSMIT_BUFFER_SIZE);
 	memset((void *)receive_buffer_storage, 0, RECEIVE_BUFFER_SIZE);
-	transmit_buffer.next = 0;
-	transmit_buffer.remaining = 0;
+	transmit_buffer.head = 0;
+	transmit_buffer.tail = 0;
 	transmit_buffer.size = TRANSMIT_BUFFER_SIZE;
 	transmit_buffer.error_occurred = 0;
 	transmit_buffer.storage = transmit_buffer_storage;
-	receive_buffer.next = 0;
-	receive_buffer.remaining = 0;
+	receive_buffer.head = 0;
+	receive_buffer.tail = 0;
 	receive_buffer.size = RECEIVE_BUFFER_SIZE;
 	receive_buffer.error_occurred = 0;
 	receive_buffer.storage = receive_buffer_storage;
@@ -105,13 +119,27 @@ static void enterSleepMode(void)
 	__asm("wfi"); // wait for interrupt
 }
 
+/** Obtain the number of bytes currently in a circular buffer. The result
+  * is only a snapshot; if the caller is the consumer, the buffer might
+  * gain bytes, and if the caller is the producer, the buffer might lose
+  * bytes.
+  * \param buffer The circular buffer to check.
+  * \return The number of bytes in the circular buffer.
+  */
+static uint32_t circularBufferCount(volatile CircularBuffer *buffer)
+{
+	// This works even when head wraps around, because the size is a power
+	// of 2 and unsigned arithmetic is done modulo 2 ^ 32.
+	return buffer->head - buffer->tail;
+}
+
 /** Check whether a circular buffer is empty.
   * \param buffer The circular buffer to check.
   * \return true if it is empty, false if it is non-empty.
   */
 bool isCircularBufferEmpty(volatile CircularBuffer *buffer)
 {
-	if (buffer->remaining == 0)
+	if (circularBufferCount(buffer) == 0)
 	{
 		return true;
 	}
@@ -138,10 +166,18 @@ void circularBufferSignalError(volatile CircularBuffer *buffer)
   */
 uint8_t circularBufferRead(volatile CircularBuffer *buffer, bool is_irq)
 {
+	uint32_t tail;
 	uint8_t r;
 
 	while(isCircularBufferEmpty(buffer))
 	{
+		if (is_irq)
+		{
+			// Interrupt request handlers should never try to read from an
+			// empty buffer, since the producer can't run until they
+			// return.
+			fatalError();
+		}
 		enterSleepMode();
 	}
 	if (buffer->error_occurred)
@@ -153,17 +189,11 @@ uint8_t circularBufferRead(volatile CircularBuffer *buffer, bool is_irq)
 			// do nothing
 		}
 	}
-	if (!is_irq)
-	{
-		__disable_irq();
-	}
-	r = buffer->storage[buffer->next];
-	buffer->remaining--;
-	buffer->next = (buffer->next + 1) & (buffer->size - 1);
-	if (!is_irq)
-	{
-		__enable_irq();
-	}
+	tail = buffer->tail;
+	MEMORY_BARRIER();
+	r = buffer->storage[tail & (buffer->size - 1)];
+	MEMORY_BARRIER();
+	buffer->tail = tail + 1;
 	return r;
 }
 
@@ -178,7 +208,7 @@ uint8_t circularBufferRead(volatile CircularBuffer *buffer, bool is_irq)
   */
 void circularBufferWrite(volatile CircularBuffer *buffer, uint8_t data, bool is_irq)
 {
-	uint32_t index;
+	uint32_t head;
 
 	if (!is_irq)
 	{
@@ -192,7 +222,7 @@ void circularBufferWrite(volatile CircularBuffer *buffer, uint8_t data, bool is_
 			}
 		}
 	}
-	if (buffer->remaining == buffer->size)
+	if (circularBufferCount(buffer) == buffer->size)
 	{
 		// Buffer is full.
 		if (is_irq)
@@ -204,23 +234,194 @@ void circularBufferWrite(volatile CircularBuffer *buffer, uint8_t data, bool is_
 		}
 		else
 		{
-			while (buffer->remaining == buffer->size)
+			while (circularBufferCount(buffer) == buffer->size)
 			{
 				enterSleepMode();
 			}
 		}
 	}
-	if (!is_irq)
+	head = buffer->head;
+	buffer->storage[head & (buffer->size - 1)] = data;
+	MEMORY_BARRIER();
+	buffer->head = head + 1;
+}
+
+/** Read up to a number of bytes from a circular buffer. This will block
+  * until at least one byte is read, but it won't wait for more bytes than
+  * are currently in the buffer.
+  * \param buffer The circular buffer to read from.
+  * \param data The bytes will be written here. This must have space for
+  *             length bytes.
+  * \param length The maximum number of bytes to read. This must be
+  *               non-zero.
+  * \return The number of bytes that were read from the buffer. This will
+  *         be between 1 and length inclusive.
+  * \warning This must not be called from an interrupt request handler.
+  */
+uint32_t circularBufferReadBytes(volatile CircularBuffer *buffer, uint8_t *data, uint32_t length)
+{
+	uint32_t tail;
+	uint32_t count;
+	uint32_t i;
+
+	while(isCircularBufferEmpty(buffer))
 	{
+		enterSleepMode();
+	}
+	if (buffer->error_occurred)
+	{
+		streamError();
 		__disable_irq();
+		while (true)
+		{
+			// do nothing
+		}
 	}
-	index = (buffer->next + buffer->remaining) & (buffer->size - 1);
-	buffer->storage[index] = data;
-	buffer->remaining++;
-	if (!is_irq)
+	tail = buffer->tail;
+	count = MIN(length, buffer->head - tail);
+	MEMORY_BARRIER();
+	for (i = 0; i < count; i++)
 	{
-		__enable_irq();
+		data[i] = buffer->storage[(tail + i) & (buffer->size - 1)];
 	}
+	MEMORY_BARRIER();
+	buffer->tail = tail + count;
+	return count;
+}
+
+/** Borrow bytes straight out of a circular buffer's storage, without
+  * copying them. This will block until the buffer is non-empty. The bytes
+  * stay in the buffer until circularBufferRelease() is called.
+  * \param buffer The circular buffer to borrow from.
+  * \param length The number of contiguous bytes available at the returned
+  *               address will be written here. This will be at least 1.
+  * \return A pointer to the borrowed bytes.
+  * \warning This must not be called from an interrupt request handler.
+  */
+const uint8_t *circularBufferBorrow(volatile CircularBuffer *buffer, uint32_t *length)
+{
+	uint32_t index;
+
+	while(isCircularBufferEmpty(buffer))
+	{
+		enterSleepMode();
+	}
+	if (buffer->error_occurred)
+	{
+		streamError();
+		__disable_irq();
+		while (true)
+		{
+			// do nothing
+		}
+	}
+	// An interrupt request handler can only add bytes to the buffer, so
+	// the bytes won't go away before circularBufferRelease() is called.
+	// Only the bytes up to the end of the storage array are contiguous.
+	index = buffer->tail & (buffer->size - 1);
+	*length = MIN(circularBufferCount(buffer), buffer->size - index);
+	MEMORY_BARRIER();
+	return (const uint8_t *)&(buffer->storage[index]);
+}
+
+/** Remove bytes borrowed with circularBufferBorrow() from a circular buffer.
+  * \param buffer The circular buffer the bytes were borrowed from.
+  * \param length The number of bytes to remove. This must not be more than
+  *               the length returned by circularBufferBorrow().
+  */
+void circularBufferRelease(volatile CircularBuffer *buffer, uint32_t length)
+{
+	MEMORY_BARRIER();
+	buffer->tail += length;
+}
+
+/** Write up to a number of bytes to a circular buffer. If the buffer is
+  * full, this will block until it isn't, but it won't wait for more space
+  * than is needed to write one byte.
+  * \param buffer The circular buffer to write to.
+  * \param data The bytes to write to the buffer.
+  * \param length The maximum number of bytes to write. This must be
+  *               non-zero.
+  * \return The number of bytes that were written to the buffer. This will
+  *         be between 1 and length inclusive.
+  * \warning This must not be called from an interrupt request handler.
+  */
+uint32_t circularBufferWriteBytes(volatile CircularBuffer *buffer, const uint8_t *data, uint32_t length)
+{
+	uint32_t head;
+	uint32_t count;
+	uint32_t i;
+
+	if (buffer->error_occurred)
+	{
+		streamError();
+		__disable_irq();
+		while (true)
+		{
+			// do nothing
+		}
+	}
+	while (circularBufferCount(buffer) == buffer->size)
+	{
+		enterSleepMode();
+	}
+	head = buffer->head;
+	count = MIN(length, buffer->size - (head - buffer->tail));
+	for (i = 0; i < count; i++)
+	{
+		buffer->storage[(head + i) & (buffer->size - 1)] = data[i];
+	}
+	MEMORY_BARRIER();
+	buffer->head = head + count;
+	return count;
+}
+
+/** Write bytes into the transmit buffer and notify the serial
+  * hardware, without doing any flow control.
+  * \param buffer The bytes to send.
+  * \param length The number of bytes to send.
+  */
+static void streamPutRaw(const uint8_t *buffer, uint32_t length)
+{
+	uint32_t count;
+
+	while (length > 0)
+	{
+		count = circularBufferWriteBytes(&transmit_buffer, buffer, length);
+		serialSendNotify();
+		buffer += count;
+		length -= count;
+	}
+}
+
+/** Send an acknowledgement to the other side, telling it that another
+  * #RECEIVE_BUFFER_SIZE bytes can be sent. */
+static void sendAcknowledgement(void)
+{
+	uint8_t buffer[5];
+
+	receive_acknowledge = RECEIVE_BUFFER_SIZE;
+	buffer[0] = 0xff;
+	writeU32LittleEndian(&(buffer[1]), receive_acknowledge);
+	streamPutRaw(buffer, sizeof(buffer));
+}
+
+/** Wait for an acknowledgement from the other side, which says how many
+  * more bytes can be sent. */
+static void waitForAcknowledgement(void)
+{
+	uint8_t buffer[4];
+	uint32_t i;
+
+	do
+	{
+		// do nothing
+	} while (circularBufferRead(&receive_buffer, false) != 0xff);
+	for (i = 0; i < 4; i++)
+	{
+		buffer[i] = circularBufferRead(&receive_buffer, false);
+	}
+	transmit_acknowledge = readU32LittleEndian(buffer);
 }
 
 /** Grab one byte from the communication stream. There is no way for this
@@ -249,23 +450,8 @@ void circularBufferWrite(volatile CircularBuffer *buffer, uint8_t data, bool is_
 uint8_t streamGetOneByte(void)
 {
 	uint8_t one_byte;
-	uint8_t buffer[4];
-	uint32_t i;
 
-	one_byte = circularBufferRead(&receive_buffer, false);
-	receive_acknowledge--;
-	if (receive_acknowledge == 0)
-	{
-		// Send acknowledgement to other side.
-		receive_acknowledge = RECEIVE_BUFFER_SIZE;
-		writeU32LittleEndian(buffer, receive_acknowledge);
-		circularBufferWrite(&transmit_buffer, 0xff, false);
-		for (i = 0; i < 4; i++)
-		{
-			circularBufferWrite(&transmit_buffer, buffer[i], false);
-		}
-		serialSendNotify();
-	}
+	streamGetBytes(&one_byte, 1);
 	return one_byte;
 }
 
@@ -281,24 +467,85 @@ uint8_t streamGetOneByte(void)
   */
 void streamPutOneByte(uint8_t one_byte)
 {
-	uint8_t buffer[4];
-	uint32_t i;
+	streamPutBytes(&one_byte, 1);
+}
 
-	circularBufferWrite(&transmit_buffer, one_byte, false);
-	serialSendNotify();
-	transmit_acknowledge--;
-	if (transmit_acknowledge == 0)
+/** Grab a number of bytes from the communication stream. Bytes are moved
+  * out of the receive buffer in chunks, stopping only when the receive
+  * buffer runs dry or when an acknowledgement needs to be sent.
+  * See streamGetOneByte() for why this can't indicate read errors.
+  * \param buffer The received bytes will be written here. This must have
+  *               space for length bytes.
+  * \param length The number of bytes to receive.
+  */
+void streamGetBytes(uint8_t *buffer, uint32_t length)
+{
+	uint32_t count;
+
+	while (length > 0)
 	{
-		// Need to wait for acknowledgement from other side.
-		do
+		count = circularBufferReadBytes(&receive_buffer, buffer, MIN(length, receive_acknowledge));
+		buffer += count;
+		length -= count;
+		receive_acknowledge -= count;
+		if (receive_acknowledge == 0)
 		{
-			// do nothing
-		} while (circularBufferRead(&receive_buffer, false) != 0xff);
-		for (i = 0; i < 4; i++)
+			sendAcknowledgement();
+		}
+	}
+}
+
+/** Borrow bytes straight out of the receive buffer, without copying them.
+  * See streamBorrowBytes() in hwinterface.h for more details.
+  * \param length The number of contiguous bytes available at the returned
+  *               address will be written here. This will be at least 1.
+  * \return A pointer to the borrowed bytes.
+  */
+const uint8_t *streamBorrowBytes(uint32_t *length)
+{
+	const uint8_t *r;
+
+	r = circularBufferBorrow(&receive_buffer, length);
+	*length = MIN(*length, receive_acknowledge);
+	return r;
+}
+
+/** Remove bytes previously borrowed by streamBorrowBytes() from the receive
+  * buffer.
+  * \param length The number of bytes to remove.
+  */
+void streamReleaseBytes(uint32_t length)
+{
+	circularBufferRelease(&receive_buffer, length);
+	receive_acknowledge -= length;
+	if (receive_acknowledge == 0)
+	{
+		sendAcknowledgement();
+	}
+}
+
+/** Send a number of bytes to the communication stream. Bytes are moved
+  * into the transmit buffer in chunks, stopping only when the transmit
+  * buffer fills up or when an acknowledgement needs to be waited for.
+  * See streamGetOneByte() for why this can't indicate write errors.
+  * \param buffer The bytes to send.
+  * \param length The number of bytes to send.
+  */
+void streamPutBytes(const uint8_t *buffer, uint32_t length)
+{
+	uint32_t count;
+
+	while (length > 0)
+	{
+		count = MIN(length, transmit_acknowledge);
+		streamPutRaw(buffer, count);
+		buffer += count;
+		length -= count;
+		transmit_acknowledge -= count;
+		if (transmit_acknowledge == 0)
 		{
-			buffer[i] = circularBufferRead(&receive_buffer, false);
+			waitForAcknowledgement();
 		}
-		transmit_acknowledge = readU32LittleEndian(buffer);
 	}
 }
 
@@ -354,6 +601,9 @@ void sanitiseRam(void)
 	// was called as a result of a "unload wallet" packet, since the host
 	// isn't supposed to send anything until it receives a response from
 	// here.
+	// The EEPROM window lives in RAM, so anything dirty in it must be
+	// written back before it is cleared.
+	nonVolatileFlush();
 	saved_receive_acknowledge = receive_acknowledge;
 	saved_transmit_acknowledge = transmit_acknowledge;
 	sanitiseRamInternal();
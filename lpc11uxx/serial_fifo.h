@@ -10,13 +10,17 @@
 
 #include <stdbool.h>
 
-/** A circular buffer. */
+/** A single-producer, single-consumer circular buffer. The head and tail
+  * indices count bytes and are never reduced modulo #size, so the number of
+  * bytes in the buffer is always head - tail. */
 typedef struct CircularBufferStruct
 {
-	/** Index of the next element to remove. */
-	volatile uint32_t next;
-	/** Number of elements remaining in buffer. */
-	volatile uint32_t remaining;
+	/** Total number of elements ever added to the buffer. Only the producer
+	  * modifies this. */
+	volatile uint32_t head;
+	/** Total number of elements ever removed from the buffer. Only the
+	  * consumer modifies this. */
+	volatile uint32_t tail;
 	/** The maximum number of elements the buffer can store.
 	  * \warning This must be a power of 2.
 	  */
@@ -37,5 +41,9 @@ extern bool isCircularBufferEmpty(volatile CircularBuffer *buffer);
 extern void circularBufferSignalError(volatile CircularBuffer *buffer);
 extern uint8_t circularBufferRead(volatile CircularBuffer *buffer, bool is_irq);
 extern void circularBufferWrite(volatile CircularBuffer *buffer, uint8_t data, bool is_irq);
+extern uint32_t circularBufferReadBytes(volatile CircularBuffer *buffer, uint8_t *data, uint32_t length);
+extern uint32_t circularBufferWriteBytes(volatile CircularBuffer *buffer, const uint8_t *data, uint32_t length);
+extern const uint8_t *circularBufferBorrow(volatile CircularBuffer *buffer, uint32_t *length);
+extern void circularBufferRelease(volatile CircularBuffer *buffer, uint32_t length);
 
 #endif // #ifndef SERIAL_FIFO_H_INCLUDED
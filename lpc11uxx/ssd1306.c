@@ -180,6 +180,11 @@ static uint32_t cursor_line;
   * writeStringToDisplay() will write to next.
   */
 static uint32_t cursor_pos;
+/** What the display is currently showing, in the same format
+  * as #text_buffer. renderDisplay() compares this with #text_buffer so that
+  * it only sends the parts of the display which have changed.
+  */
+static uint8_t displayed_buffer[CHARACTERS_PER_LINE * NUMBER_OF_LINES];
 
 /** Set up LPC11Uxx peripherals to communicate with the SSD1306-based display.
   * The SPI1 bus is set up at 1 Mhz to communicate with the SSD1306 controller
@@ -302,29 +307,42 @@ static void resetSSD1306(void)
 	writeSPI1Byte(false, 0x01); // memory addressing mode = vertical
 }
 
-/** Clear the display and all associated buffers. */
-void clearDisplay(void)
+/** Restrict subsequent data writes to a rectangular window of the
+  * SSD1306's GDDRAM. Since the memory addressing mode is vertical (see
+  * resetSSD1306()), data bytes fill the window column by column, starting
+  * from the top-left corner of the window.
+  * \param first_column The leftmost column of the window (0 = leftmost).
+  * \param last_column The rightmost column of the window (inclusive).
+  * \param first_page The topmost page (8 pixel high row) of the window
+  *                   (0 = topmost).
+  * \param last_page The bottommost page of the window (inclusive).
+  */
+static void setAddressWindow(uint32_t first_column, uint32_t last_column, uint32_t first_page, uint32_t last_page)
+{
+	writeSPI1Byte(false, 0x21); // set column address
+	writeSPI1Byte(false, (uint8_t)first_column);
+	writeSPI1Byte(false, (uint8_t)last_column);
+	writeSPI1Byte(false, 0x22); // set page address
+	writeSPI1Byte(false, (uint8_t)first_page);
+	writeSPI1Byte(false, (uint8_t)last_page);
+}
+
+/** Clear the SSD1306's entire GDDRAM, regardless of what the display is
+  * supposed to be showing. This is needed after a reset, since GDDRAM
+  * contents are undefined then. */
+static void clearGDDRAM(void)
 {
 	uint32_t i;
 
-	for (i = 0; i < 1024; i++)
+	setAddressWindow(0, DISPLAY_WIDTH - 1, 0, (DISPLAY_HEIGHT / 8) - 1);
+	for (i = 0; i < (DISPLAY_WIDTH * DISPLAY_HEIGHT / 8); i++)
 	{
 		writeSPI1Byte(true, 0);
 	}
-	cursor_line = 0;
-	cursor_pos = 0;
-	memset(text_buffer, FONT_BLANK, sizeof(text_buffer));
-}
-
-/** Set up everything so that the display is ready to start having text
-  * rendered on it. */
-void initSSD1306(void)
-{
-	configurePeripheralsForSSD1306();
-	resetSSD1306();
-	clearDisplay();
+	memset(displayed_buffer, FONT_BLANK, sizeof(displayed_buffer));
 }
 
+#if (CHARACTER_HEIGHT % 8) != 0
 /** Font table byte lookup function which has bit granularity. Alternatively,
   * this can be thought of as treating the font table as a giant little-endian
   * multi-precision integer, shifting it to the right bit_offset times and
@@ -346,6 +364,7 @@ static uint8_t lookupFontTable(uint32_t bit_offset)
 	data = font_table[index] | (font_table[index + 1] << 8);
 	return (uint8_t)(data >> (bit_offset & 7));
 }
+#endif // #if (CHARACTER_HEIGHT % 8) != 0
 
 /** Text buffer query function. As well as obtaining a character from
   * the text buffer, this also range checks its inputs and accounts
@@ -377,93 +396,154 @@ static uint8_t lookupTextBuffer(uint32_t char_x, uint32_t char_y)
 }
 
 /** Using the contents of the text buffer (#text_buffer) and the font
-  * in #font_table, this outputs a series of data bytes to the SSD1306
-  * display.
-  *
-  * Since the SSD1306 memory addressing mode is set to "vertical" by
-  * resetSSD1306(), this function renders in columns, 8 pixels at a time.
-  * The rendering loop starts at the top-left, moves downwards and when it
-  * hits the bottom of the current column, moves right to start at the top
-  * of the next column. Column-based rendering is done because the SSD1306's
-  * GDDRAM is column-based (each byte of data corresponds to an 8 pixel high
-  * column).
+  * in #font_table, this calculates one data byte (an 8 pixel high column)
+  * of the display.
   *
-  * In order for the renderer to work
-  * correctly, #DISPLAY_WIDTH, #DISPLAY_HEIGHT, #CHARACTER_WIDTH
-  * and #CHARACTER_HEIGHT must be set correctly.
-  * The renderer only supports monochrome, fixed-width fonts.
-  * However, the renderer can deal with fonts with a height which is not a
-  * multiple of 8.
-  *
-  * This renderer isn't very fast. But it doesn't need to be. With the SPI bus
-  * running at a bit rate of 1 Mhz, the renderer only needs to be able to
-  * write one byte every 384 cycles, which is a long time.
+  * Each data byte of the SSD1306's GDDRAM corresponds to an 8 pixel high
+  * column. If #CHARACTER_HEIGHT is a multiple of 8, every column of every
+  * glyph in #font_table starts on a byte boundary and every data byte lies
+  * within one character, so data bytes are copied straight out of the font
+  * table. Otherwise, a data byte may straddle two lines of text and has to
+  * be assembled from bits of two glyphs using lookupFontTable().
+  * \param x x location (0 = left edge) of the column.
+  * \param y y location (0 = top edge) of the top of the column. This must be
+  *          a multiple of 8.
+  * \return The data byte for that column.
   */
-static void renderDisplay(void)
+static uint8_t renderColumnByte(uint32_t x, uint32_t y)
 {
-	uint32_t x; // 0 = left edge, positive = right
-	uint32_t y; // 0 = top edge, positive = down
 	uint32_t char_x; // 0 = leftmost character, 1 = the one to the right of that etc.
 	uint32_t char_y; // 0 = topmost character, 1 = the one below that etc.
 	uint32_t char_x_offset; // x offset within character
 	uint32_t char_y_offset; // y offset within character
+#if (CHARACTER_HEIGHT % 8) == 0
+	uint32_t index;
+#else
 	uint32_t amount; // number of bits to use
-	uint8_t current_character;
-	uint8_t next_character;
 	uint8_t data;
 	uint8_t temp_data;
+#endif // #if (CHARACTER_HEIGHT % 8) == 0
 
-	char_x = 0;
-	char_x_offset = 0;
-	for (x = 0; x < DISPLAY_WIDTH; x++)
+	char_x = x / CHARACTER_WIDTH;
+	char_x_offset = x % CHARACTER_WIDTH;
+	char_y = y / CHARACTER_HEIGHT;
+	char_y_offset = y % CHARACTER_HEIGHT;
+#if (CHARACTER_HEIGHT % 8) == 0
+	index = (lookupTextBuffer(char_x, char_y) * CHARACTER_BITS + char_y_offset + char_x_offset * CHARACTER_HEIGHT) >> 3;
+	if (index >= (sizeof(font_table) - 1))
 	{
-		// Render a column.
-		char_y = 0;
-		char_y_offset = 0;
-		// The next (i.e. one below) character needs to be fetched in advance
-		// because the next 8 pixels may go across the current's character
-		// height boundary.
-		current_character = lookupTextBuffer(char_x, char_y);
-		next_character = lookupTextBuffer(char_x, char_y + 1);
-		for (y = 0; y < DISPLAY_HEIGHT; y += 8)
+		return 0; // empty character
+	}
+	return font_table[index];
+#else
+	if ((char_y_offset + 8) > CHARACTER_HEIGHT)
+	{
+		// Byte goes across character height boundary.
+		amount = CHARACTER_HEIGHT - char_y_offset;
+	}
+	else
+	{
+		// Byte resides entirely within current character.
+		amount = 8;
+	}
+	data = lookupFontTable(lookupTextBuffer(char_x, char_y) * CHARACTER_BITS + char_y_offset + char_x_offset * CHARACTER_HEIGHT);
+	data &= (1 << amount) - 1;
+	if ((char_y_offset + 8) > CHARACTER_HEIGHT)
+	{
+		// Need to fetch partial character column from next character.
+		temp_data = lookupFontTable(lookupTextBuffer(char_x, char_y + 1) * CHARACTER_BITS + char_x_offset * CHARACTER_HEIGHT);
+		data |= temp_data << amount;
+	}
+	return data;
+#endif // #if (CHARACTER_HEIGHT % 8) == 0
+}
+
+/** Using the contents of the text buffer (#text_buffer) and the font
+  * in #font_table, this updates the parts of the SSD1306 display which
+  * have changed since the last time this was called.
+  *
+  * For each line, the leftmost and rightmost characters which differ
+  * from #displayed_buffer are found. An address window (see
+  * setAddressWindow()) covering that span is set up, and only that window
+  * is rendered, in columns, 8 pixels at a time. Column-based rendering is
+  * done because the SSD1306 memory addressing mode is set to "vertical" by
+  * resetSSD1306(). So if a single character changes, only one character's
+  * worth of data is sent, instead of the whole display.
+  *
+  * In order for the renderer to work
+  * correctly, #DISPLAY_WIDTH, #DISPLAY_HEIGHT, #CHARACTER_WIDTH
+  * and #CHARACTER_HEIGHT must be set correctly.
+  * The renderer only supports monochrome, fixed-width fonts.
+  */
+static void renderDisplay(void)
+{
+	uint32_t line;
+	uint32_t first_char; // leftmost changed character on line
+	uint32_t last_char; // rightmost changed character on line
+	uint32_t x; // 0 = left edge, positive = right
+	uint32_t page; // 0 = top 8 pixels, positive = down
+	uint32_t first_page;
+	uint32_t last_page;
+	uint8_t *text_line;
+	uint8_t *displayed_line;
+
+	for (line = 0; line < NUMBER_OF_LINES; line++)
+	{
+		text_line = &(text_buffer[line * CHARACTERS_PER_LINE]);
+		displayed_line = &(displayed_buffer[line * CHARACTERS_PER_LINE]);
+		first_char = 0;
+		while ((first_char < CHARACTERS_PER_LINE) && (text_line[first_char] == displayed_line[first_char]))
 		{
-			if ((char_y_offset + 8) > CHARACTER_HEIGHT)
-			{
-				// Byte goes across character height boundary.
-				amount = CHARACTER_HEIGHT - char_y_offset;
-			}
-			else
-			{
-				// Next byte resides entirely within current character.
-				amount = 8;
-			}
-			data = lookupFontTable(current_character * CHARACTER_BITS + char_y_offset + char_x_offset * CHARACTER_HEIGHT);
-			data &= (1 << amount) - 1;
-			if ((char_y_offset + 8) > CHARACTER_HEIGHT)
-			{
-				// Need to fetch partial character column from next character.
-				temp_data = lookupFontTable(next_character * CHARACTER_BITS + char_x_offset * CHARACTER_HEIGHT);
-				data |= temp_data << amount;
-			}
-			writeSPI1Byte(true, data);
-			// Prepare for next byte.
-			char_y_offset += 8;
-			if (char_y_offset >= CHARACTER_HEIGHT)
+			first_char++;
+		}
+		if (first_char == CHARACTERS_PER_LINE)
+		{
+			continue; // nothing on this line has changed
+		}
+		last_char = CHARACTERS_PER_LINE - 1;
+		while (text_line[last_char] == displayed_line[last_char])
+		{
+			last_char--;
+		}
+		// If CHARACTER_HEIGHT is not a multiple of 8, the first and last
+		// pages are shared with adjacent lines. That's fine, since
+		// renderColumnByte() renders from the whole text buffer.
+		first_page = (line * CHARACTER_HEIGHT) / 8;
+		last_page = ((line + 1) * CHARACTER_HEIGHT - 1) / 8;
+		if (last_page >= (DISPLAY_HEIGHT / 8))
+		{
+			last_page = (DISPLAY_HEIGHT / 8) - 1;
+		}
+		setAddressWindow(first_char * CHARACTER_WIDTH, (last_char + 1) * CHARACTER_WIDTH - 1, first_page, last_page);
+		for (x = first_char * CHARACTER_WIDTH; x < ((last_char + 1) * CHARACTER_WIDTH); x++)
+		{
+			for (page = first_page; page <= last_page; page++)
 			{
-				char_y_offset -= CHARACTER_HEIGHT;
-				char_y++;
-				current_character = next_character;
-				next_character = lookupTextBuffer(char_x, char_y + 1);
+				writeSPI1Byte(true, renderColumnByte(x, page * 8));
 			}
-		} // end for (y = 0; y < DISPLAY_HEIGHT; y += 8)
-		// Prepare for next column.
-		char_x_offset++;
-		if (char_x_offset >= CHARACTER_WIDTH)
-		{
-			char_x_offset = 0;
-			char_x++;
 		}
-	} // end for (x = 0; x < DISPLAY_WIDTH; x++)
+		memcpy(&(displayed_line[first_char]), &(text_line[first_char]), last_char - first_char + 1);
+	} // end for (line = 0; line < NUMBER_OF_LINES; line++)
+}
+
+/** Clear the display and all associated buffers. Only the parts of the
+  * display which actually had something on them are sent to the SSD1306. */
+void clearDisplay(void)
+{
+	cursor_line = 0;
+	cursor_pos = 0;
+	memset(text_buffer, FONT_BLANK, sizeof(text_buffer));
+	renderDisplay();
+}
+
+/** Set up everything so that the display is ready to start having text
+  * rendered on it. */
+void initSSD1306(void)
+{
+	configurePeripheralsForSSD1306();
+	resetSSD1306();
+	clearGDDRAM();
+	clearDisplay();
 }
 
 /** Move cursor to the start of the next line, but only if the cursor is not
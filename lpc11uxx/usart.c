@@ -8,6 +8,10 @@
   * with the wallet over a USB connection.
   * See initUsart() for serial communication parameters.
   *
+  * The USART's receive and transmit FIFOs are used, so that each interrupt
+  * moves several bytes instead of one. If STREAM_COMM_LINK_SPEED is defined,
+  * the host can also switch to a faster baud rate (see setLinkSpeed()).
+  *
   * This file is only intended to be used for early development. Later
   * versions will probably use LPC11Uxx's USB controller for communication
   * with the host.
@@ -19,6 +23,48 @@
 #include "../common.h"
 #include "usart.h"
 #include "serial_fifo.h"
+#include "../hwinterface.h"
+
+/** Number of bytes in the USART's transmit FIFO. This is how many bytes
+  * can be written to THR in one go once THRE is set. */
+#define TRANSMIT_FIFO_SIZE		16
+
+/** Divisor latch and fractional divider settings for one baud rate. The
+  * resulting baud rate is 48000000 / (16 * dll * (1 + DIVADDVAL / MULVAL)),
+  * where DIVADDVAL and MULVAL are the bottom and top 4 bits of fdr. */
+typedef struct BaudRateDivisorsStruct
+{
+	/** Nominal baud rate. */
+	uint32_t baud_rate;
+	/** Value for DLL (least significant 8 bits of divisor latch). */
+	uint8_t dll;
+	/** Value for FDR (fractional divider register). */
+	uint8_t fdr;
+} BaudRateDivisors;
+
+/** Supported baud rates. The first entry is the rate used after reset.
+  * The divisors were found by exhaustive search, keeping the oversampling
+  * ratio at 16 so that noise immunity isn't compromised. */
+static const BaudRateDivisors baud_rate_divisors[] = {
+	{57600, 27, 0xed}, // 1 + 13 / 14, differs by 0.02%
+	{115200, 17, 0xf8}, // 1 + 8 / 15, differs by 0.10%
+	{230400, 7, 0x76}, // 1 + 6 / 7, differs by 0.16%
+	{460800, 4, 0x85}, // 1 + 5 / 8, differs by 0.16%
+	{921600, 3, 0xc1} // 1 + 1 / 12, differs by 0.16%
+};
+
+/** Set the USART divisors.
+  * \param divisors The divisor settings to use.
+  */
+static void setDivisors(const BaudRateDivisors *divisors)
+{
+	LPC_USART->LCR |= 0x80; // enable access to divisor latches
+	LPC_USART->FDR = divisors->fdr;
+	LPC_USART->DLL = divisors->dll;
+	LPC_USART->DLM = 0; // set most significant 8 bits of divisor latch to 0
+	LPC_USART->OSR = 0xf0; // oversampling ratio = 16
+	LPC_USART->LCR &= ~0x80; // disable access to divisor latches
+}
 
 /** Initialise USART at 57600 baud, 8 data bits, no parity and 1 stop bit. */
 void initUsart(void)
@@ -28,15 +74,7 @@ void initUsart(void)
 	LPC_IOCON->PIO0_19 = 0x91; // set TXD pin, pull-up enabled
 	LPC_SYSCON->UARTCLKDIV = 1; // UART_CLK divider = 1
 
-	// Set baud rate to 57600. The divisors were found by exhaustive search.
-	// The resulting baud rate is 48000000 / (16 * 27 * (1 + 13 / 14)),
-	// which differs from 57600 by 0.02%.
-	LPC_USART->LCR |= 0x80; // enable access to divisor latches
-	LPC_USART->FDR = 0xed; // fractional divider = 1 + 13 / 14
-	LPC_USART->DLL = 27; // set least significant 8 bits of divisor latch to 27
-	LPC_USART->DLM = 0; // set most significant 8 bits of divisor latch to 0
-	LPC_USART->OSR = 0xf0; // oversampling ratio = 16
-	LPC_USART->LCR &= ~0x80; // disable access to divisor latches
+	setDivisors(&(baud_rate_divisors[0]));
 	// Disable stuff that isn't used.
 	LPC_USART->ACR = 0; // no auto-baud
 	LPC_USART->ICR = 0; // disable IrDA mode
@@ -48,25 +86,47 @@ void initUsart(void)
 	LPC_USART->LCR = 0x03; // no parity, 8 data bits, 1 stop bit
 	LPC_USART->MCR = 0; // disable hardware flow control
 	LPC_USART->FCR = 1; // enable access to other bits of FCR
-	LPC_USART->FCR = 7; // clear receive and transmit FIFOs, trigger level = 1 character
+	// Clear receive and transmit FIFOs, trigger level = 8 characters. Fewer
+	// bytes than that are picked up by the character timeout interrupt.
+	LPC_USART->FCR = 0x87;
 	LPC_USART->TER = 0x80; // enable transmit
 	LPC_USART->IER = 7; // enable receive, transmit and error interrupts
 	NVIC_EnableIRQ(21); // 21 = USART interrupt
 }
 
-/** Interrupt request handler for USART. This is invoked in 3 situations:
-  * - whenever a byte is received,
-  * - another byte can be shoved into the transmit FIFO,
-  * - a receive error occurs.
+/** Move as many bytes as will fit from the transmit buffer into the
+  * USART's transmit FIFO.
+  * \warning This must only be called from UART_IRQHandler(), since that is
+  *          the only consumer of the transmit buffer.
+  */
+static void fillTransmitFIFO(void)
+{
+	uint32_t i;
+
+	for (i = 0; (i < TRANSMIT_FIFO_SIZE) && !isCircularBufferEmpty(&transmit_buffer); i++)
+	{
+		LPC_USART->THR = circularBufferRead(&transmit_buffer, true);
+	}
+}
+
+/** Interrupt request handler for USART. This is invoked in 5 situations:
+  * - the receive FIFO reaches its trigger level,
+  * - there are bytes in the receive FIFO, but nothing more has been
+  *   received for a while (character timeout),
+  * - the transmit FIFO is empty,
+  * - a receive error occurs,
+  * - serialSendNotify() sets the interrupt pending.
   */
 void UART_IRQHandler(void)
 {
+	uint32_t iir;
 	uint32_t source;
 
-	source = ((uint32_t)LPC_USART->IIR >> 1) & 7;
-	if (source == 2)
+	iir = LPC_USART->IIR;
+	source = (iir >> 1) & 7;
+	if ((source == 2) || (source == 6))
 	{
-		// Receive data available interrupt.
+		// Receive data available or character timeout interrupt.
 		// Move bytes from RBR into circular buffer until hardware FIFO is empty.
 		while (LPC_USART->LSR & 0x01)
 		{
@@ -75,37 +135,93 @@ void UART_IRQHandler(void)
 	}
 	else if (source == 1)
 	{
-		// THRE (Transmit Holding Register Empty) interrupt.
-		if (!isCircularBufferEmpty(&transmit_buffer) && (LPC_USART->LSR & 0x20))
-		{
-			// There's data to send and THR is empty.
-			LPC_USART->THR = circularBufferRead(&transmit_buffer, true);
-		}
+		// THRE (Transmit Holding Register Empty) interrupt. This is dealt
+		// with below.
 	}
-	else
+	else if ((iir & 1) == 0)
 	{
 		// Receive line status (or unknown) interrupt.
 		LPC_USART->LSR; // read LSR to clear any RLS interrupt
 		circularBufferSignalError(&receive_buffer);
 	}
+	// If nothing is being transmitted, the THRE interrupt won't happen by
+	// itself, so check for that here (in particular, for when the interrupt
+	// was set pending by serialSendNotify()).
+	if (LPC_USART->LSR & 0x20)
+	{
+		fillTransmitFIFO();
+	}
 }
 
 /** This must be called whenever the transmit buffer transitions from empty
   * to non-empty, in order to initiate the transmission of the contents of the
   * transmit buffer.
-  * This function may directly handle the transmission of the first byte (the
-  * interrupt handler UART_IRQHandler() will handle the rest).
+  * This doesn't touch the transmit buffer itself; it just sets the USART
+  * interrupt pending, so that UART_IRQHandler() (which is the only consumer
+  * of the transmit buffer) starts transmitting.
   */
 void serialSendNotify(void)
 {
-	// Need to disable interrupts otherwise the transmit buffer might be
-	// emptied between the check and use.
-	__disable_irq();
-	if (!isCircularBufferEmpty(&transmit_buffer) && (LPC_USART->LSR & 0x20))
+	NVIC_SetPendingIRQ(21); // 21 = USART interrupt
+}
+
+#ifdef STREAM_COMM_LINK_SPEED
+/** Look up the divisor settings for a baud rate.
+  * \param baud_rate The baud rate to look up.
+  * \return The divisor settings, or NULL if the baud rate isn't supported.
+  */
+static const BaudRateDivisors *lookupBaudRate(uint32_t baud_rate)
+{
+	uint32_t i;
+
+	for (i = 0; i < (sizeof(baud_rate_divisors) / sizeof(baud_rate_divisors[0])); i++)
+	{
+		if (baud_rate_divisors[i].baud_rate == baud_rate)
+		{
+			return &(baud_rate_divisors[i]);
+		}
+	}
+	return NULL;
+}
+
+/** Check whether the USART can be switched to a given baud rate.
+  * \param baud_rate The requested baud rate.
+  * \return true if the baud rate is supported, false if it isn't.
+  */
+bool isLinkSpeedSupported(uint32_t baud_rate)
+{
+	if (lookupBaudRate(baud_rate) != NULL)
+	{
+		return true;
+	}
+	else
+	{
+		return false;
+	}
+}
+
+/** Switch the USART to a new baud rate. This waits until everything in the
+  * transmit buffer has been sent (at the old baud rate) first.
+  * \param baud_rate The new baud rate. This must be one for which
+  *                  isLinkSpeedSupported() returns true.
+  */
+void setLinkSpeed(uint32_t baud_rate)
+{
+	const BaudRateDivisors *divisors;
+
+	divisors = lookupBaudRate(baud_rate);
+	if (divisors == NULL)
 	{
-		// There's data to send and THR is empty.
-		LPC_USART->THR = circularBufferRead(&transmit_buffer, false);
-		// Warning: circularBufferRead() enables interrupts.
+		fatalError();
 	}
+	// Wait until the transmit buffer, transmit FIFO and transmit shift
+	// register are all empty.
+	while (!isCircularBufferEmpty(&transmit_buffer) || !(LPC_USART->LSR & 0x40))
+	{
+		// do nothing
+	}
+	__disable_irq();
+	setDivisors(divisors);
 	__enable_irq();
 }
+#endif // #ifdef STREAM_COMM_LINK_SPEED
@@ -15,6 +15,11 @@
 #include "../hwinterface.h"
 #include "../baseconv.h"
 #include "../prandom.h"
+#ifdef UI_SUMMARISE_EXTRA_OUTPUTS
+#include "../hash.h"
+#include "../sha256.h"
+#include "../bignum256.h"
+#endif // #ifdef UI_SUMMARISE_EXTRA_OUTPUTS
 #include "ssd1306.h"
 #include "user_interface.h"
 #include "LPC11Uxx.h"
@@ -24,25 +29,45 @@
 #define DEBOUNCE_COUNT	50
 
 /** Maximum number of address/amount pairs that can be stored in RAM waiting
-  * for approval from the user. This incidentally sets the maximum
-  * number of outputs per transaction that parseTransaction() can deal with.
+  * for approval from the user. Unless UI_SUMMARISE_EXTRA_OUTPUTS is defined,
+  * this incidentally sets the maximum number of outputs per transaction that
+  * parseTransaction() can deal with.
   */
 #define MAX_OUTPUTS		16
 
-/** Storage for the text of transaction output amounts. */
-static char list_amount[MAX_OUTPUTS][TEXT_AMOUNT_LENGTH];
-/** Storage for the text of transaction output addresses. */
-static char list_address[MAX_OUTPUTS][TEXT_ADDRESS_LENGTH];
-/** Index into #list_amount and #list_address which specifies where the next
-  * output amount/address will be copied into. */
+/** Storage for transaction outputs. These are kept in binary form and only
+  * converted to text when they are displayed. */
+static OutputDescriptor list_outputs[MAX_OUTPUTS];
+/** Index into #list_outputs which specifies where the next output will be
+  * copied into. */
 static uint32_t list_index;
 /** Whether the transaction fee has been set. If
   * the transaction fee still hasn't been set after parsing, then the
   * transaction is free. */
 static bool transaction_fee_set;
-/** Storage for transaction fee amount. This is only valid
-  * if #transaction_fee_set is true. */
-static char transaction_fee_amount[TEXT_AMOUNT_LENGTH];
+/** Storage for transaction fee amount, in the same binary form as
+  * OutputDescriptor#amount. This is only valid if #transaction_fee_set is
+  * true. */
+static uint8_t transaction_fee_amount[8];
+
+#ifdef UI_SUMMARISE_EXTRA_OUTPUTS
+/** Number of outputs which didn't fit in #list_outputs. Those outputs aren't
+  * displayed one at a time; instead, they are summarised by their number,
+  * their total amount (#extra_outputs_total) and a digest of all of them
+  * (#extra_outputs_hs). This allows transactions with any number of
+  * outputs (eg. large batch payouts) to be approved, using a fixed amount
+  * of RAM. */
+static uint32_t extra_outputs_count;
+/** Total amount of the outputs which didn't fit in #list_outputs, as a 64 bit,
+  * unsigned, little-endian integer with the amount in 10 ^ -8 BTC. */
+static uint8_t extra_outputs_total[8];
+/** SHA-256 hash of the outputs which didn't fit in #list_outputs. Each output
+  * contributes its amount (8 bytes, little-endian), address version (1 byte)
+  * and hash (20 bytes), in that order, so that the host can calculate (and
+  * display) the same digest for the user to compare against. This is only
+  * valid if #extra_outputs_count is non-zero. */
+static HashState extra_outputs_hs;
+#endif // #ifdef UI_SUMMARISE_EXTRA_OUTPUTS
 
 /** Set up LPC11Uxx peripherals to get input from two pushbuttons. The
   * pushbuttons should be connected as follows:
@@ -91,7 +116,11 @@ static void wait1ms(void)
 {
 	SysTick->CTRL = 0; // disable system tick timer
 	SysTick->VAL = 0; // clear system tick timer
+#ifdef CLOCK_GOVERNOR
+	SysTick->LOAD = 24000 >> getClockShift(); // system clock may be divided
+#else
 	SysTick->LOAD = 24000; // set timer reload to 1 ms (48000000 / (1000 * 2))
+#endif // #ifdef CLOCK_GOVERNOR
 	SysTick->CTRL = 1; // enable system tick timer
 	// Wait until timer counts to 0.
 	while ((SysTick->CTRL & (1 << SysTick_CTRL_COUNTFLAG_Pos)) == 0)
@@ -161,28 +190,33 @@ static bool waitForButtonPress(void)
 
 /** Notify the user interface that the transaction parser has seen a new
   * Bitcoin amount/address pair.
-  * \param text_amount The output amount, as a null-terminated text string
-  *                    such as "0.01".
-  * \param text_address The output address, as a null-terminated text string
-  *                     such as "1RaTTuSEN7jJUDiW1EGogHwtek7g9BiEn".
+  * \param output The output amount and address, in binary form.
   * \return false if no error occurred, true if there was not enough space to
   *         store the amount/address pair.
   */
-bool newOutputSeen(char *text_amount, char *text_address)
+bool newOutputSeen(OutputDescriptor *output)
 {
-	char *amount_dest;
-	char *address_dest;
-
 	if (list_index >= MAX_OUTPUTS)
 	{
+#ifdef UI_SUMMARISE_EXTRA_OUTPUTS
+		if (bigAddVariableSizeNoModulo(extra_outputs_total, extra_outputs_total, output->amount, 8))
+		{
+			return true; // total amount overflowed
+		}
+		if (extra_outputs_count == 0)
+		{
+			sha256Begin(&extra_outputs_hs);
+		}
+		sha256WriteBytes(&extra_outputs_hs, output->amount, 8);
+		sha256WriteByte(&extra_outputs_hs, output->address_version);
+		sha256WriteBytes(&extra_outputs_hs, output->hash, 20);
+		extra_outputs_count++;
+		return false; // success
+#else
 		return true; // not enough space to store the amount/address pair
+#endif // #ifdef UI_SUMMARISE_EXTRA_OUTPUTS
 	}
-	amount_dest = list_amount[list_index];
-	address_dest = list_address[list_index];
-	strncpy(amount_dest, text_amount, TEXT_AMOUNT_LENGTH);
-	strncpy(address_dest, text_address, TEXT_ADDRESS_LENGTH);
-	amount_dest[TEXT_AMOUNT_LENGTH - 1] = '\0';
-	address_dest[TEXT_ADDRESS_LENGTH - 1] = '\0';
+	memcpy(&(list_outputs[list_index]), output, sizeof(OutputDescriptor));
 	list_index++;
 	return false; // success
 }
@@ -190,13 +224,12 @@ bool newOutputSeen(char *text_amount, char *text_address)
 /** Notify the user interface that the transaction parser has seen the
   * transaction fee. If there is no transaction fee, the transaction parser
   * will not call this.
-  * \param text_amount The transaction fee, as a null-terminated text string
-  *                    such as "0.01".
+  * \param amount The transaction fee, as a 64 bit, unsigned, little-endian
+  *               integer with the amount in 10 ^ -8 BTC.
   */
-void setTransactionFee(char *text_amount)
+void setTransactionFee(uint8_t *amount)
 {
-	strncpy(transaction_fee_amount, text_amount, TEXT_AMOUNT_LENGTH);
-	transaction_fee_amount[TEXT_AMOUNT_LENGTH - 1] = '\0';
+	memcpy(transaction_fee_amount, amount, sizeof(transaction_fee_amount));
 	transaction_fee_set = true;
 }
 
@@ -206,7 +239,83 @@ void clearOutputsSeen(void)
 {
 	list_index = 0;
 	transaction_fee_set = false;
+#ifdef UI_SUMMARISE_EXTRA_OUTPUTS
+	extra_outputs_count = 0;
+	memset(extra_outputs_total, 0, sizeof(extra_outputs_total));
+#endif // #ifdef UI_SUMMARISE_EXTRA_OUTPUTS
+}
+
+/** Convert 4 bit number into corresponding hexadecimal character. For
+  * example, 0 is converted into '0' and 15 is converted into 'f'.
+  * \param nibble The 4 bit number to look at. Only the least significant
+  *               4 bits are considered.
+  * \return The hexadecimal character.
+  */
+static char nibbleToHex(uint8_t nibble)
+{
+	uint8_t temp;
+	temp = (uint8_t)(nibble & 0xf);
+	if (temp < 10)
+	{
+		return (char)('0' + temp);
+	}
+	else
+	{
+		return (char)('a' + (temp - 10));
+	}
+}
+
+#ifdef UI_SUMMARISE_EXTRA_OUTPUTS
+/** Ask the user to approve the outputs which didn't fit in #list_outputs,
+  * using the summary described in #extra_outputs_count. Only the first 64
+  * bits of the digest are displayed, to make comparing it practical.
+  * \return false if the user accepted, true if the user denied.
+  */
+static bool approveExtraOutputs(void)
+{
+	HashState hs;
+	uint8_t digest[32];
+	char text_amount[TEXT_AMOUNT_LENGTH];
+	char text_count[11];
+	char text_digest[17];
+	uint32_t n;
+	uint8_t start;
+	uint8_t i;
+
+	// Convert number of outputs to decimal, least significant digit first.
+	n = extra_outputs_count;
+	start = sizeof(text_count) - 1;
+	text_count[start] = '\0';
+	do
+	{
+		start--;
+		text_count[start] = (char)('0' + (n % 10));
+		n /= 10;
+	} while (n != 0);
+	amountToText(text_amount, extra_outputs_total);
+	// Finish a copy of the hash state, so that this can be called more
+	// than once for the same outputs.
+	memcpy(&hs, &extra_outputs_hs, sizeof(hs));
+	sha256Finish(&hs);
+	writeHashToByteArray(digest, &hs, true);
+	for (i = 0; i < 8; i++)
+	{
+		text_digest[i * 2] = nibbleToHex((uint8_t)(digest[i] >> 4));
+		text_digest[i * 2 + 1] = nibbleToHex(digest[i]);
+	}
+	text_digest[16] = '\0';
+	clearDisplay();
+	waitForNoButtonPress();
+	writeStringToDisplay("Send ");
+	writeStringToDisplay(text_amount);
+	writeStringToDisplay(" BTC to ");
+	writeStringToDisplay(&(text_count[start]));
+	writeStringToDisplay(" more outputs (digest ");
+	writeStringToDisplay(text_digest);
+	writeStringToDisplay(")?");
+	return waitForButtonPress();
 }
+#endif // #ifdef UI_SUMMARISE_EXTRA_OUTPUTS
 
 /** Ask user if they want to allow some action.
   * \param command The action to ask the user about. See #AskUserCommandEnum.
@@ -216,6 +325,8 @@ bool userDenied(AskUserCommand command)
 {
 	uint8_t i;
 	bool r; // what will be returned
+	char text_amount[TEXT_AMOUNT_LENGTH];
+	char text_address[TEXT_ADDRESS_LENGTH];
 
 	clearDisplay();
 	displayOn();
@@ -239,12 +350,14 @@ bool userDenied(AskUserCommand command)
 		// wrapping wastes too much display space.
 		for (i = 0; i < list_index; i++)
 		{
+			// Outputs are only converted to text when they are displayed.
+			outputToText(text_amount, text_address, &(list_outputs[i]));
 			clearDisplay();
 			waitForNoButtonPress();
 			writeStringToDisplay("Send ");
-			writeStringToDisplay(list_amount[i]);
+			writeStringToDisplay(text_amount);
 			writeStringToDisplay(" BTC to ");
-			writeStringToDisplay(list_address[i]);
+			writeStringToDisplay(text_address);
 			writeStringToDisplay("?");
 			r = waitForButtonPress();
 			if (r)
@@ -255,13 +368,20 @@ bool userDenied(AskUserCommand command)
 				break;
 			}
 		}
+#ifdef UI_SUMMARISE_EXTRA_OUTPUTS
+		if (!r && (extra_outputs_count > 0))
+		{
+			r = approveExtraOutputs();
+		}
+#endif // #ifdef UI_SUMMARISE_EXTRA_OUTPUTS
 		if (!r && transaction_fee_set)
 		{
 			clearDisplay();
 			waitForNoButtonPress();
 			writeStringToDisplay("Transaction fee:");
 			nextLine();
-			writeStringToDisplay(transaction_fee_amount);
+			amountToText(text_amount, transaction_fee_amount);
+			writeStringToDisplay(text_amount);
 			writeStringToDisplay(" BTC.");
 			nextLine();
 			writeStringToDisplay("Is this okay?");
@@ -331,26 +451,6 @@ bool userDenied(AskUserCommand command)
 	return r;
 }
 
-/** Convert 4 bit number into corresponding hexadecimal character. For
-  * example, 0 is converted into '0' and 15 is converted into 'f'.
-  * \param nibble The 4 bit number to look at. Only the least significant
-  *               4 bits are considered.
-  * \return The hexadecimal character.
-  */
-static char nibbleToHex(uint8_t nibble)
-{
-	uint8_t temp;
-	temp = (uint8_t)(nibble & 0xf);
-	if (temp < 10)
-	{
-		return (char)('0' + temp);
-	}
-	else
-	{
-		return (char)('a' + (temp - 10));
-	}
-}
-
 /** Write backup seed to some output device. The choice of output device and
   * seed representation is up to the platform-dependent code. But a typical
   * example would be displaying the seed as a hexadecimal string on a LCD.
@@ -9,14 +9,20 @@ const bool NewWallet_is_hidden_default = false;
 const uint32_t LoadWallet_wallet_number_default = 0;
 const bool BackupWallet_is_encrypted_default = false;
 const uint32_t BackupWallet_device_default = 0;
+const bool GetPerformanceCounters_reset_default = false;
+const bool GetTrace_clear_default = false;
+const bool GetStorageStatistics_reset_default = false;
+const uint32_t GetPCSamples_first_bucket_default = 0;
+const bool GetPCSamples_clear_default = false;
 
 
-const pb_field_t Initialize_fields[2] = {
+const pb_field_t Initialize_fields[3] = {
     PB_FIELD2(  1, BYTES   , REQUIRED, STATIC, FIRST, Initialize, session_id, session_id, 0),
+    PB_FIELD2(  2, BOOL    , OPTIONAL, STATIC, OTHER, Initialize, compact_records, session_id, 0),
     PB_LAST_FIELD
 };
 
-const pb_field_t Features_fields[11] = {
+const pb_field_t Features_fields[12] = {
     PB_FIELD2(  1, BYTES   , REQUIRED, STATIC, FIRST, Features, echoed_session_id, echoed_session_id, 0),
     PB_FIELD2(  2, STRING  , OPTIONAL, CALLBACK, OTHER, Features, vendor, echoed_session_id, 0),
     PB_FIELD2(  3, UINT32  , OPTIONAL, STATIC, OTHER, Features, major_version, vendor, 0),
@@ -27,6 +33,7 @@ const pb_field_t Features_fields[11] = {
     PB_FIELD2(  8, BOOL    , OPTIONAL, STATIC, OTHER, Features, spv, pin, 0),
     PB_FIELD2(  9, ENUM    , REPEATED, STATIC, OTHER, Features, algo, spv, 0),
     PB_FIELD2( 10, BOOL    , OPTIONAL, STATIC, OTHER, Features, debug_link, algo, 0),
+    PB_FIELD2( 11, BOOL    , OPTIONAL, STATIC, OTHER, Features, compact_records, debug_link, 0),
     PB_LAST_FIELD
 };
 
@@ -127,6 +134,17 @@ const pb_field_t GetAddressAndPublicKey_fields[2] = {
     PB_LAST_FIELD
 };
 
+const pb_field_t GetAddressesAndPublicKeys_fields[3] = {
+    PB_FIELD2(  1, UINT32  , REQUIRED, STATIC, FIRST, GetAddressesAndPublicKeys, start_address_handle, start_address_handle, 0),
+    PB_FIELD2(  2, UINT32  , REQUIRED, STATIC, OTHER, GetAddressesAndPublicKeys, count, start_address_handle, 0),
+    PB_LAST_FIELD
+};
+
+const pb_field_t Addresses_fields[2] = {
+    PB_FIELD2(  1, MESSAGE , REPEATED, CALLBACK, FIRST, Addresses, address, address, &Address_fields),
+    PB_LAST_FIELD
+};
+
 const pb_field_t SignTransaction_fields[3] = {
     PB_FIELD2(  1, UINT32  , REQUIRED, STATIC, FIRST, SignTransaction, address_handle, address_handle, 0),
     PB_FIELD2(  2, BYTES   , REQUIRED, CALLBACK, OTHER, SignTransaction, transaction_data, address_handle, 0),
@@ -138,6 +156,18 @@ const pb_field_t Signature_fields[2] = {
     PB_LAST_FIELD
 };
 
+const pb_field_t SignTransactionMultiple_fields[4] = {
+    PB_FIELD2(  1, UINT32  , REPEATED, STATIC, FIRST, SignTransactionMultiple, input_index, input_index, 0),
+    PB_FIELD2(  2, UINT32  , REPEATED, STATIC, OTHER, SignTransactionMultiple, address_handle, input_index, 0),
+    PB_FIELD2(  3, BYTES   , REQUIRED, CALLBACK, OTHER, SignTransactionMultiple, transaction_data, address_handle, 0),
+    PB_LAST_FIELD
+};
+
+const pb_field_t Signatures_fields[2] = {
+    PB_FIELD2(  1, BYTES   , REPEATED, STATIC, FIRST, Signatures, signature_data, signature_data, 0),
+    PB_LAST_FIELD
+};
+
 const pb_field_t LoadWallet_fields[2] = {
     PB_FIELD2(  1, UINT32  , OPTIONAL, STATIC, FIRST, LoadWallet, wallet_number, wallet_number, &LoadWallet_wallet_number_default),
     PB_LAST_FIELD
@@ -186,6 +216,13 @@ const pb_field_t RestoreWallet_fields[3] = {
     PB_LAST_FIELD
 };
 
+const pb_field_t RestoreWalletMnemonic_fields[4] = {
+    PB_FIELD2(  1, MESSAGE , REQUIRED, STATIC, FIRST, RestoreWalletMnemonic, new_wallet, new_wallet, &NewWallet_fields),
+    PB_FIELD2(  2, BYTES   , REQUIRED, STATIC, OTHER, RestoreWalletMnemonic, mnemonic, new_wallet, 0),
+    PB_FIELD2(  3, BYTES   , OPTIONAL, STATIC, OTHER, RestoreWalletMnemonic, passphrase, mnemonic, 0),
+    PB_LAST_FIELD
+};
+
 const pb_field_t GetDeviceUUID_fields[1] = {
     PB_LAST_FIELD
 };
@@ -215,13 +252,121 @@ const pb_field_t MasterPublicKey_fields[3] = {
     PB_LAST_FIELD
 };
 
+const pb_field_t GetPerformanceCounters_fields[2] = {
+    PB_FIELD2(  1, BOOL    , OPTIONAL, STATIC, FIRST, GetPerformanceCounters, reset, reset, &GetPerformanceCounters_reset_default),
+    PB_LAST_FIELD
+};
+
+const pb_field_t PacketCounters_fields[10] = {
+    PB_FIELD2(  1, UINT32  , REQUIRED, STATIC, FIRST, PacketCounters, packet_type, packet_type, 0),
+    PB_FIELD2(  2, UINT32  , REQUIRED, STATIC, OTHER, PacketCounters, count, packet_type, 0),
+    PB_FIELD2(  3, UINT64  , REQUIRED, STATIC, OTHER, PacketCounters, parse_cycles, count, 0),
+    PB_FIELD2(  4, UINT64  , REQUIRED, STATIC, OTHER, PacketCounters, crypto_cycles, parse_cycles, 0),
+    PB_FIELD2(  5, UINT64  , REQUIRED, STATIC, OTHER, PacketCounters, nv_cycles, crypto_cycles, 0),
+    PB_FIELD2(  6, UINT64  , REQUIRED, STATIC, OTHER, PacketCounters, stream_cycles, nv_cycles, 0),
+    PB_FIELD2(  7, UINT64  , REQUIRED, STATIC, OTHER, PacketCounters, total_cycles, stream_cycles, 0),
+    PB_FIELD2(  8, UINT32  , REQUIRED, STATIC, OTHER, PacketCounters, max_cycles, total_cycles, 0),
+    PB_FIELD2(  9, UINT32  , OPTIONAL, STATIC, OTHER, PacketCounters, max_stack_bytes, max_cycles, 0),
+    PB_LAST_FIELD
+};
+
+const pb_field_t PerformanceCounters_fields[3] = {
+    PB_FIELD2(  1, UINT32  , REQUIRED, STATIC, FIRST, PerformanceCounters, cycles_per_second, cycles_per_second, 0),
+    PB_FIELD2(  2, MESSAGE , REPEATED, CALLBACK, OTHER, PerformanceCounters, packet_counters, cycles_per_second, &PacketCounters_fields),
+    PB_LAST_FIELD
+};
+
+const pb_field_t SetLinkSpeed_fields[2] = {
+    PB_FIELD2(  1, UINT32  , REQUIRED, STATIC, FIRST, SetLinkSpeed, baud_rate, baud_rate, 0),
+    PB_LAST_FIELD
+};
+
+const pb_field_t GetTrustedInput_fields[2] = {
+    PB_FIELD2(  1, BYTES   , REQUIRED, CALLBACK, FIRST, GetTrustedInput, transaction_data, transaction_data, 0),
+    PB_LAST_FIELD
+};
+
+const pb_field_t TrustedInput_fields[2] = {
+    PB_FIELD2(  1, BYTES   , REQUIRED, STATIC, FIRST, TrustedInput, token, token, 0),
+    PB_LAST_FIELD
+};
+
+const pb_field_t GetTrace_fields[2] = {
+    PB_FIELD2(  1, BOOL    , OPTIONAL, STATIC, FIRST, GetTrace, clear, clear, &GetTrace_clear_default),
+    PB_LAST_FIELD
+};
+
+const pb_field_t Trace_fields[4] = {
+    PB_FIELD2(  1, UINT32  , REQUIRED, STATIC, FIRST, Trace, cycles_per_second, cycles_per_second, 0),
+    PB_FIELD2(  2, UINT32  , REQUIRED, STATIC, OTHER, Trace, total_events, cycles_per_second, 0),
+    PB_FIELD2(  3, BYTES   , REQUIRED, CALLBACK, OTHER, Trace, events, total_events, 0),
+    PB_LAST_FIELD
+};
+
+const pb_field_t SignTransactionChunked_fields[3] = {
+    PB_FIELD2(  1, UINT32  , REQUIRED, STATIC, FIRST, SignTransactionChunked, address_handle, address_handle, 0),
+    PB_FIELD2(  2, UINT32  , REQUIRED, STATIC, OTHER, SignTransactionChunked, transaction_length, address_handle, 0),
+    PB_LAST_FIELD
+};
+
+const pb_field_t ChunkRequest_fields[3] = {
+    PB_FIELD2(  1, UINT32  , REQUIRED, STATIC, FIRST, ChunkRequest, next_offset, next_offset, 0),
+    PB_FIELD2(  2, BYTES   , REQUIRED, STATIC, OTHER, ChunkRequest, running_hash, next_offset, 0),
+    PB_LAST_FIELD
+};
+
+const pb_field_t TransactionChunk_fields[3] = {
+    PB_FIELD2(  1, UINT32  , REQUIRED, STATIC, FIRST, TransactionChunk, offset, offset, 0),
+    PB_FIELD2(  2, BYTES   , REQUIRED, CALLBACK, OTHER, TransactionChunk, data, offset, 0),
+    PB_LAST_FIELD
+};
+
+const pb_field_t SelectWalletContext_fields[2] = {
+    PB_FIELD2(  1, UINT32  , REQUIRED, STATIC, FIRST, SelectWalletContext, context, context, 0),
+    PB_LAST_FIELD
+};
+
+const pb_field_t GetStorageStatistics_fields[2] = {
+    PB_FIELD2(  1, BOOL    , OPTIONAL, STATIC, FIRST, GetStorageStatistics, reset, reset, &GetStorageStatistics_reset_default),
+    PB_LAST_FIELD
+};
+
+const pb_field_t StorageStatistics_fields[6] = {
+    PB_FIELD2(  1, UINT32  , REQUIRED, STATIC, FIRST, StorageStatistics, cycles_per_second, cycles_per_second, 0),
+    PB_FIELD2(  2, UINT32  , REQUIRED, STATIC, OTHER, StorageStatistics, flush_count, cycles_per_second, 0),
+    PB_FIELD2(  3, UINT64  , REQUIRED, STATIC, OTHER, StorageStatistics, flush_total_cycles, flush_count, 0),
+    PB_FIELD2(  4, UINT32  , REQUIRED, STATIC, OTHER, StorageStatistics, flush_max_cycles, flush_total_cycles, 0),
+    PB_FIELD2(  5, BYTES   , REQUIRED, CALLBACK, OTHER, StorageStatistics, erase_counts, flush_max_cycles, 0),
+    PB_LAST_FIELD
+};
+
+const pb_field_t GetPCSamples_fields[5] = {
+    PB_FIELD2(  1, UINT32  , OPTIONAL, STATIC, FIRST, GetPCSamples, first_bucket, first_bucket, &GetPCSamples_first_bucket_default),
+    PB_FIELD2(  2, BOOL    , OPTIONAL, STATIC, OTHER, GetPCSamples, clear, first_bucket, &GetPCSamples_clear_default),
+    PB_FIELD2(  3, UINT32  , OPTIONAL, STATIC, OTHER, GetPCSamples, range_start, clear, 0),
+    PB_FIELD2(  4, UINT32  , OPTIONAL, STATIC, OTHER, GetPCSamples, range_end, range_start, 0),
+    PB_LAST_FIELD
+};
+
+const pb_field_t PCSamples_fields[9] = {
+    PB_FIELD2(  1, UINT32  , REQUIRED, STATIC, FIRST, PCSamples, sample_rate, sample_rate, 0),
+    PB_FIELD2(  2, UINT32  , REQUIRED, STATIC, OTHER, PCSamples, range_start, sample_rate, 0),
+    PB_FIELD2(  3, UINT32  , REQUIRED, STATIC, OTHER, PCSamples, range_end, range_start, 0),
+    PB_FIELD2(  4, UINT32  , REQUIRED, STATIC, OTHER, PCSamples, bucket_shift, range_end, 0),
+    PB_FIELD2(  5, UINT32  , REQUIRED, STATIC, OTHER, PCSamples, num_buckets, bucket_shift, 0),
+    PB_FIELD2(  6, UINT32  , REQUIRED, STATIC, OTHER, PCSamples, total_samples, num_buckets, 0),
+    PB_FIELD2(  7, UINT32  , REQUIRED, STATIC, OTHER, PCSamples, out_of_range_samples, total_samples, 0),
+    PB_FIELD2(  8, BYTES   , REQUIRED, CALLBACK, OTHER, PCSamples, counts, out_of_range_samples, 0),
+    PB_LAST_FIELD
+};
+
 
 /* Check that field information fits in pb_field_t */
 #if !defined(PB_FIELD_16BIT) && !defined(PB_FIELD_32BIT)
-STATIC_ASSERT((pb_membersize(Wallets, wallet_info) < 256 && pb_membersize(RestoreWallet, new_wallet) < 256), YOU_MUST_DEFINE_PB_FIELD_16BIT_FOR_MESSAGES_Initialize_Features_Ping_PingResponse_Success_Failure_ButtonRequest_ButtonAck_ButtonCancel_PinRequest_PinAck_PinCancel_OtpRequest_OtpAck_OtpCancel_DeleteWallet_NewWallet_NewAddress_Address_GetNumberOfAddresses_NumberOfAddresses_GetAddressAndPublicKey_SignTransaction_Signature_LoadWallet_FormatWalletArea_ChangeEncryptionKey_ChangeWalletName_ListWallets_WalletInfo_Wallets_BackupWallet_RestoreWallet_GetDeviceUUID_DeviceUUID_GetEntropy_Entropy_GetMasterPublicKey_MasterPublicKey)
+STATIC_ASSERT((pb_membersize(Wallets, wallet_info) < 256 && pb_membersize(Addresses, address) < 256 && pb_membersize(RestoreWallet, new_wallet) < 256 && pb_membersize(RestoreWalletMnemonic, new_wallet) < 256 && pb_membersize(RestoreWalletMnemonic, mnemonic) < 256 && pb_membersize(PerformanceCounters, packet_counters) < 256), YOU_MUST_DEFINE_PB_FIELD_16BIT_FOR_MESSAGES_Initialize_Features_Ping_PingResponse_Success_Failure_ButtonRequest_ButtonAck_ButtonCancel_PinRequest_PinAck_PinCancel_OtpRequest_OtpAck_OtpCancel_DeleteWallet_NewWallet_NewAddress_Address_GetNumberOfAddresses_NumberOfAddresses_GetAddressAndPublicKey_GetAddressesAndPublicKeys_Addresses_SignTransaction_Signature_SignTransactionMultiple_Signatures_LoadWallet_FormatWalletArea_ChangeEncryptionKey_ChangeWalletName_ListWallets_WalletInfo_Wallets_BackupWallet_RestoreWallet_RestoreWalletMnemonic_GetDeviceUUID_DeviceUUID_GetEntropy_Entropy_GetMasterPublicKey_MasterPublicKey_GetPerformanceCounters_PacketCounters_PerformanceCounters_SetLinkSpeed_GetTrustedInput_TrustedInput_GetTrace_Trace_SignTransactionChunked_ChunkRequest_TransactionChunk_SelectWalletContext_GetStorageStatistics_StorageStatistics_GetPCSamples_PCSamples)
 #endif
 
 #if !defined(PB_FIELD_32BIT)
-STATIC_ASSERT((pb_membersize(Wallets, wallet_info) < 65536 && pb_membersize(RestoreWallet, new_wallet) < 65536), YOU_MUST_DEFINE_PB_FIELD_32BIT_FOR_MESSAGES_Initialize_Features_Ping_PingResponse_Success_Failure_ButtonRequest_ButtonAck_ButtonCancel_PinRequest_PinAck_PinCancel_OtpRequest_OtpAck_OtpCancel_DeleteWallet_NewWallet_NewAddress_Address_GetNumberOfAddresses_NumberOfAddresses_GetAddressAndPublicKey_SignTransaction_Signature_LoadWallet_FormatWalletArea_ChangeEncryptionKey_ChangeWalletName_ListWallets_WalletInfo_Wallets_BackupWallet_RestoreWallet_GetDeviceUUID_DeviceUUID_GetEntropy_Entropy_GetMasterPublicKey_MasterPublicKey)
+STATIC_ASSERT((pb_membersize(Wallets, wallet_info) < 65536 && pb_membersize(Addresses, address) < 65536 && pb_membersize(RestoreWallet, new_wallet) < 65536 && pb_membersize(RestoreWalletMnemonic, new_wallet) < 65536 && pb_membersize(RestoreWalletMnemonic, mnemonic) < 65536 && pb_membersize(PerformanceCounters, packet_counters) < 65536), YOU_MUST_DEFINE_PB_FIELD_32BIT_FOR_MESSAGES_Initialize_Features_Ping_PingResponse_Success_Failure_ButtonRequest_ButtonAck_ButtonCancel_PinRequest_PinAck_PinCancel_OtpRequest_OtpAck_OtpCancel_DeleteWallet_NewWallet_NewAddress_Address_GetNumberOfAddresses_NumberOfAddresses_GetAddressAndPublicKey_GetAddressesAndPublicKeys_Addresses_SignTransaction_Signature_SignTransactionMultiple_Signatures_LoadWallet_FormatWalletArea_ChangeEncryptionKey_ChangeWalletName_ListWallets_WalletInfo_Wallets_BackupWallet_RestoreWallet_RestoreWalletMnemonic_GetDeviceUUID_DeviceUUID_GetEntropy_Entropy_GetMasterPublicKey_MasterPublicKey_GetPerformanceCounters_PacketCounters_PerformanceCounters_SetLinkSpeed_GetTrustedInput_TrustedInput_GetTrace_Trace_SignTransactionChunked_ChunkRequest_TransactionChunk_SelectWalletContext_GetStorageStatistics_StorageStatistics_GetPCSamples_PCSamples)
 #endif
 
@@ -127,6 +127,98 @@ typedef struct _Failure {
     pb_callback_t error_message;
 } Failure;
 
+typedef struct _GetPerformanceCounters {
+    bool has_reset;
+    bool reset;
+} GetPerformanceCounters;
+
+typedef struct _SetLinkSpeed {
+    uint32_t baud_rate;
+} SetLinkSpeed;
+
+typedef struct _GetTrustedInput {
+    pb_callback_t transaction_data;
+} GetTrustedInput;
+
+typedef struct {
+    size_t size;
+    uint8_t bytes[76];
+} TrustedInput_token_t;
+
+typedef struct _TrustedInput {
+    TrustedInput_token_t token;
+} TrustedInput;
+
+typedef struct _GetTrace {
+    bool has_clear;
+    bool clear;
+} GetTrace;
+
+typedef struct _Trace {
+    uint32_t cycles_per_second;
+    uint32_t total_events;
+    pb_callback_t events;
+} Trace;
+
+typedef struct _GetStorageStatistics {
+    bool has_reset;
+    bool reset;
+} GetStorageStatistics;
+
+typedef struct _StorageStatistics {
+    uint32_t cycles_per_second;
+    uint32_t flush_count;
+    uint64_t flush_total_cycles;
+    uint32_t flush_max_cycles;
+    pb_callback_t erase_counts;
+} StorageStatistics;
+
+typedef struct _GetPCSamples {
+    bool has_first_bucket;
+    uint32_t first_bucket;
+    bool has_clear;
+    bool clear;
+    bool has_range_start;
+    uint32_t range_start;
+    bool has_range_end;
+    uint32_t range_end;
+} GetPCSamples;
+
+typedef struct _PCSamples {
+    uint32_t sample_rate;
+    uint32_t range_start;
+    uint32_t range_end;
+    uint32_t bucket_shift;
+    uint32_t num_buckets;
+    uint32_t total_samples;
+    uint32_t out_of_range_samples;
+    pb_callback_t counts;
+} PCSamples;
+
+typedef struct _SignTransactionChunked {
+    uint32_t address_handle;
+    uint32_t transaction_length;
+} SignTransactionChunked;
+
+typedef struct {
+    size_t size;
+    uint8_t bytes[32];
+} ChunkRequest_running_hash_t;
+
+typedef struct _ChunkRequest {
+    uint32_t next_offset;
+    ChunkRequest_running_hash_t running_hash;
+} ChunkRequest;
+
+typedef struct _TransactionChunk {
+    uint32_t offset;
+    pb_callback_t data;
+} TransactionChunk;
+
+typedef struct _SelectWalletContext {
+    uint32_t context;
+} SelectWalletContext;
+
 typedef struct {
     size_t size;
     uint8_t bytes[64];
@@ -150,6 +242,8 @@ typedef struct _Features {
     Algorithm algo[2];
     bool has_debug_link;
     bool debug_link;
+    bool has_compact_records;
+    bool compact_records;
 } Features;
 
 typedef struct {
@@ -165,6 +259,11 @@ typedef struct _GetAddressAndPublicKey {
     uint32_t address_handle;
 } GetAddressAndPublicKey;
 
+typedef struct _GetAddressesAndPublicKeys {
+    uint32_t start_address_handle;
+    uint32_t count;
+} GetAddressesAndPublicKeys;
+
 typedef struct _GetEntropy {
     uint32_t number_of_bytes;
 } GetEntropy;
@@ -176,6 +275,8 @@ typedef struct {
 
 typedef struct _Initialize {
     Initialize_session_id_t session_id;
+    bool has_compact_records;
+    bool compact_records;
 } Initialize;
 
 typedef struct _LoadWallet {
@@ -255,6 +356,24 @@ typedef struct _Signature {
     Signature_signature_data_t signature_data;
 } Signature;
 
+typedef struct _SignTransactionMultiple {
+    size_t input_index_count;
+    uint32_t input_index[3];
+    size_t address_handle_count;
+    uint32_t address_handle[3];
+    pb_callback_t transaction_data;
+} SignTransactionMultiple;
+
+typedef struct {
+    size_t size;
+    uint8_t bytes[73];
+} Signatures_signature_data_t;
+
+typedef struct _Signatures {
+    size_t signature_data_count;
+    Signatures_signature_data_t signature_data[3];
+} Signatures;
+
 typedef struct {
     size_t size;
     uint8_t bytes[40];
@@ -275,6 +394,28 @@ typedef struct _Wallets {
     pb_callback_t wallet_info;
 } Wallets;
 
+typedef struct _Addresses {
+    pb_callback_t address;
+} Addresses;
+
+typedef struct _PacketCounters {
+    uint32_t packet_type;
+    uint32_t count;
+    uint64_t parse_cycles;
+    uint64_t crypto_cycles;
+    uint64_t nv_cycles;
+    uint64_t stream_cycles;
+    uint64_t total_cycles;
+    uint32_t max_cycles;
+    bool has_max_stack_bytes;
+    uint32_t max_stack_bytes;
+} PacketCounters;
+
+typedef struct _PerformanceCounters {
+    uint32_t cycles_per_second;
+    pb_callback_t packet_counters;
+} PerformanceCounters;
+
 typedef struct {
     size_t size;
     uint8_t bytes[64];
@@ -285,6 +426,23 @@ typedef struct _RestoreWallet {
     RestoreWallet_seed_t seed;
 } RestoreWallet;
 
+typedef struct {
+    size_t size;
+    uint8_t bytes[240];
+} RestoreWalletMnemonic_mnemonic_t;
+
+typedef struct {
+    size_t size;
+    uint8_t bytes[64];
+} RestoreWalletMnemonic_passphrase_t;
+
+typedef struct _RestoreWalletMnemonic {
+    NewWallet new_wallet;
+    RestoreWalletMnemonic_mnemonic_t mnemonic;
+    bool has_passphrase;
+    RestoreWalletMnemonic_passphrase_t passphrase;
+} RestoreWalletMnemonic;
+
 /* Default values for struct fields */
 extern const uint32_t DeleteWallet_wallet_handle_default;
 extern const uint32_t NewWallet_wallet_number_default;
@@ -292,6 +450,11 @@ extern const bool NewWallet_is_hidden_default;
 extern const uint32_t LoadWallet_wallet_number_default;
 extern const bool BackupWallet_is_encrypted_default;
 extern const uint32_t BackupWallet_device_default;
+extern const bool GetPerformanceCounters_reset_default;
+extern const bool GetTrace_clear_default;
+extern const bool GetStorageStatistics_reset_default;
+extern const uint32_t GetPCSamples_first_bucket_default;
+extern const bool GetPCSamples_clear_default;
 
 /* Field tags (for use in manual encoding/decoding) */
 #define Address_address_handle_tag               1
@@ -316,10 +479,15 @@ extern const uint32_t BackupWallet_device_default;
 #define Features_spv_tag                         8
 #define Features_algo_tag                        9
 #define Features_debug_link_tag                  10
+#define Features_compact_records_tag             11
 #define FormatWalletArea_initial_entropy_pool_tag 1
 #define GetAddressAndPublicKey_address_handle_tag 1
+#define GetAddressesAndPublicKeys_start_address_handle_tag 1
+#define GetAddressesAndPublicKeys_count_tag      2
+#define Addresses_address_tag                    1
 #define GetEntropy_number_of_bytes_tag           1
 #define Initialize_session_id_tag                1
+#define Initialize_compact_records_tag           2
 #define LoadWallet_wallet_number_tag             1
 #define MasterPublicKey_public_key_tag           1
 #define MasterPublicKey_chain_code_tag           2
@@ -336,16 +504,67 @@ extern const uint32_t BackupWallet_device_default;
 #define SignTransaction_address_handle_tag       1
 #define SignTransaction_transaction_data_tag     2
 #define Signature_signature_data_tag             1
+#define SignTransactionMultiple_input_index_tag  1
+#define SignTransactionMultiple_address_handle_tag 2
+#define SignTransactionMultiple_transaction_data_tag 3
+#define Signatures_signature_data_tag            1
 #define WalletInfo_wallet_number_tag             1
 #define WalletInfo_wallet_name_tag               2
 #define WalletInfo_wallet_uuid_tag               3
 #define Wallets_wallet_info_tag                  1
 #define RestoreWallet_new_wallet_tag             1
 #define RestoreWallet_seed_tag                   2
+#define RestoreWalletMnemonic_new_wallet_tag     1
+#define RestoreWalletMnemonic_mnemonic_tag       2
+#define RestoreWalletMnemonic_passphrase_tag     3
+#define GetPerformanceCounters_reset_tag         1
+#define PacketCounters_packet_type_tag           1
+#define PacketCounters_count_tag                 2
+#define PacketCounters_parse_cycles_tag          3
+#define PacketCounters_crypto_cycles_tag         4
+#define PacketCounters_nv_cycles_tag             5
+#define PacketCounters_stream_cycles_tag         6
+#define PacketCounters_total_cycles_tag          7
+#define PacketCounters_max_cycles_tag            8
+#define PacketCounters_max_stack_bytes_tag       9
+#define PerformanceCounters_cycles_per_second_tag 1
+#define PerformanceCounters_packet_counters_tag  2
+#define SetLinkSpeed_baud_rate_tag               1
+#define GetTrustedInput_transaction_data_tag     1
+#define TrustedInput_token_tag                   1
+#define GetTrace_clear_tag                       1
+#define Trace_cycles_per_second_tag              1
+#define Trace_total_events_tag                   2
+#define Trace_events_tag                         3
+#define SignTransactionChunked_address_handle_tag 1
+#define SignTransactionChunked_transaction_length_tag 2
+#define ChunkRequest_next_offset_tag             1
+#define ChunkRequest_running_hash_tag            2
+#define TransactionChunk_offset_tag              1
+#define TransactionChunk_data_tag                2
+#define SelectWalletContext_context_tag          1
+#define GetStorageStatistics_reset_tag           1
+#define StorageStatistics_cycles_per_second_tag  1
+#define StorageStatistics_flush_count_tag        2
+#define StorageStatistics_flush_total_cycles_tag 3
+#define StorageStatistics_flush_max_cycles_tag   4
+#define StorageStatistics_erase_counts_tag       5
+#define GetPCSamples_first_bucket_tag            1
+#define GetPCSamples_clear_tag                   2
+#define GetPCSamples_range_start_tag             3
+#define GetPCSamples_range_end_tag               4
+#define PCSamples_sample_rate_tag                1
+#define PCSamples_range_start_tag                2
+#define PCSamples_range_end_tag                  3
+#define PCSamples_bucket_shift_tag               4
+#define PCSamples_num_buckets_tag                5
+#define PCSamples_total_samples_tag              6
+#define PCSamples_out_of_range_samples_tag       7
+#define PCSamples_counts_tag                     8
 
 /* Struct field encoding specification for nanopb */
-extern const pb_field_t Initialize_fields[2];
-extern const pb_field_t Features_fields[11];
+extern const pb_field_t Initialize_fields[3];
+extern const pb_field_t Features_fields[12];
 extern const pb_field_t Ping_fields[2];
 extern const pb_field_t PingResponse_fields[3];
 extern const pb_field_t Success_fields[1];
@@ -366,8 +585,12 @@ extern const pb_field_t Address_fields[4];
 extern const pb_field_t GetNumberOfAddresses_fields[1];
 extern const pb_field_t NumberOfAddresses_fields[2];
 extern const pb_field_t GetAddressAndPublicKey_fields[2];
+extern const pb_field_t GetAddressesAndPublicKeys_fields[3];
+extern const pb_field_t Addresses_fields[2];
 extern const pb_field_t SignTransaction_fields[3];
 extern const pb_field_t Signature_fields[2];
+extern const pb_field_t SignTransactionMultiple_fields[4];
+extern const pb_field_t Signatures_fields[2];
 extern const pb_field_t LoadWallet_fields[2];
 extern const pb_field_t FormatWalletArea_fields[2];
 extern const pb_field_t ChangeEncryptionKey_fields[2];
@@ -377,15 +600,32 @@ extern const pb_field_t WalletInfo_fields[4];
 extern const pb_field_t Wallets_fields[2];
 extern const pb_field_t BackupWallet_fields[3];
 extern const pb_field_t RestoreWallet_fields[3];
+extern const pb_field_t RestoreWalletMnemonic_fields[4];
 extern const pb_field_t GetDeviceUUID_fields[1];
 extern const pb_field_t DeviceUUID_fields[2];
 extern const pb_field_t GetEntropy_fields[2];
 extern const pb_field_t Entropy_fields[2];
 extern const pb_field_t GetMasterPublicKey_fields[1];
 extern const pb_field_t MasterPublicKey_fields[3];
+extern const pb_field_t GetPerformanceCounters_fields[2];
+extern const pb_field_t PacketCounters_fields[10];
+extern const pb_field_t PerformanceCounters_fields[3];
+extern const pb_field_t SetLinkSpeed_fields[2];
+extern const pb_field_t GetTrustedInput_fields[2];
+extern const pb_field_t TrustedInput_fields[2];
+extern const pb_field_t GetTrace_fields[2];
+extern const pb_field_t Trace_fields[4];
+extern const pb_field_t SignTransactionChunked_fields[3];
+extern const pb_field_t ChunkRequest_fields[3];
+extern const pb_field_t TransactionChunk_fields[3];
+extern const pb_field_t SelectWalletContext_fields[2];
+extern const pb_field_t GetStorageStatistics_fields[2];
+extern const pb_field_t StorageStatistics_fields[6];
+extern const pb_field_t GetPCSamples_fields[5];
+extern const pb_field_t PCSamples_fields[9];
 
 /* Maximum encoded size of messages (where known) */
-#define Initialize_size                          66
+#define Initialize_size                          68
 #define Ping_size                                66
 #define PingResponse_size                        132
 #define Success_size                             0
@@ -403,7 +643,9 @@ extern const pb_field_t MasterPublicKey_fields[3];
 #define GetNumberOfAddresses_size                0
 #define NumberOfAddresses_size                   6
 #define GetAddressAndPublicKey_size              6
+#define GetAddressesAndPublicKeys_size           12
 #define Signature_size                           75
+#define Signatures_size                          225
 #define LoadWallet_size                          6
 #define FormatWalletArea_size                    34
 #define ChangeWalletName_size                    42
@@ -415,6 +657,15 @@ extern const pb_field_t MasterPublicKey_fields[3];
 #define GetEntropy_size                          6
 #define GetMasterPublicKey_size                  0
 #define MasterPublicKey_size                     101
+#define GetPerformanceCounters_size              2
+#define PacketCounters_size                      79
+#define TrustedInput_size                        78
+#define GetTrace_size                            2
+#define SignTransactionChunked_size              12
+#define ChunkRequest_size                        40
+#define SelectWalletContext_size                 6
+#define GetStorageStatistics_size                2
+#define GetPCSamples_size                        20
 
 #ifdef __cplusplus
 } /* extern "C" */
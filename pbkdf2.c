@@ -3,8 +3,9 @@
   * \brief Implements the PBKDF2 algorithm.
   *
   * PBKDF2 can be used to derive encryption keys from a password. The
-  * number of iterations is controlled by the platform-dependent
-  * getPBKDF2Iterations() function. Using PBKDF2 provides more resistance
+  * number of iterations is chosen by the caller; usually it comes from the
+  * platform-dependent getPBKDF2Iterations() function, or (if
+  * PBKDF2_CALIBRATE is defined) from calibratePBKDF2Exponent(). Using PBKDF2 provides more resistance
   * against online and offline brute-force attacks, as compared to using
   * a hash function once.
   *
@@ -28,6 +29,8 @@
 #include "endian.h"
 #include "hwinterface.h"
 #include "pbkdf2.h"
+#include "background.h"
+#include "clock_governor.h"
 
 /** Derive a key using the specified password and salt, using HMAC-SHA512 as
   * the underlying pseudo-random function. The derived key length is fixed
@@ -42,47 +45,135 @@
   * \param password Byte array specifying the password to use in PBKDF2.
   * \param password_length The length (in bytes) of the password.
   * \param salt Byte array specifying the salt to use in PBKDF2.
-  * \param salt_length The length (in bytes) of the salt.
-  * \warning salt cannot be too long; salt_length must be less than or equal
-  *          to #SHA512_HASH_LENGTH - 4.
+  * \param salt_length The length (in bytes) of the salt. The salt can be of
+  *                    any length.
+  * \param num_iterations The number of iterations of HMAC-SHA512 to do. See
+  *                       getPBKDF2Iterations() for why this should be a
+  *                       power of 2.
   */
-void pbkdf2(uint8_t *out, const uint8_t *password, const unsigned int password_length, const uint8_t *salt, const unsigned int salt_length)
+void pbkdf2(uint8_t *out, const uint8_t *password, const unsigned int password_length, const uint8_t *salt, const unsigned int salt_length, const uint32_t num_iterations)
 {
 	uint8_t u[SHA512_HASH_LENGTH];
 	uint8_t hmac_result[SHA512_HASH_LENGTH];
-	unsigned int u_length;
-	uint32_t num_iterations;
+	uint8_t block_index[4];
 	uint32_t i;
 	unsigned int j;
+	HmacSha512Context context;
 
 	memset(out, 0, SHA512_HASH_LENGTH);
-	memset(u, 0, sizeof(u));
-	if (salt_length > (SHA512_HASH_LENGTH - 4))
-	{
-		// Salt too long.
-		fatalError();
-		return;
-	}
-	else
-	{
-		u_length = salt_length;
-	}
-	memcpy(u, salt, u_length);
-	writeU32BigEndian(&(u[u_length]), 1);
-	u_length += 4;
+	// Only one block of output is ever needed, so the block index is
+	// always 1.
+	writeU32BigEndian(block_index, 1);
 
-	num_iterations = getPBKDF2Iterations();
+	// The password is the HMAC key for every iteration, so it only needs to
+	// be processed once.
+	CLOCK_BOOST_BEGIN();
+	hmacSha512PrepareKey(&context, password, password_length);
 	for (i = 0; i < num_iterations; i++)
 	{
-		hmacSha512(hmac_result, password, password_length, u, u_length);
+		if (i == 0)
+		{
+			// The first iteration is over (salt || block index). Passing the
+			// two separately means the salt can be any length.
+			hmacSha512PreparedConcatenated(hmac_result, &context, salt, salt_length, block_index, sizeof(block_index));
+		}
+		else
+		{
+			hmacSha512Prepared(hmac_result, &context, u, sizeof(u));
+		}
 		memcpy(u, hmac_result, sizeof(u));
-		u_length = SHA512_HASH_LENGTH;
 		for (j = 0; j < SHA512_HASH_LENGTH; j++)
 		{
 			out[j] ^= u[j];
 		}
+		BACKGROUND_YIELD();
+	}
+	memset(&context, 0, sizeof(context));
+	memset(u, 0, sizeof(u));
+	memset(hmac_result, 0, sizeof(hmac_result));
+	CLOCK_BOOST_END();
+}
+
+#ifdef PBKDF2_CALIBRATE
+/** Time how long it takes to do this many iterations of HMAC-SHA512 in
+  * calibratePBKDF2Exponent(). This only needs to be enough for the cycle
+  * counter to resolve; the result is only used to within a factor of 2. */
+#define PBKDF2_CALIBRATION_ITERATIONS	32
+
+/** Greatest value that calibratePBKDF2Exponent() will return. No supported
+  * platform can do anywhere near 2 ^ 24 iterations in a reasonable time; this
+  * stops a misbehaving cycle counter from producing a wallet which takes
+  * forever to unlock. */
+#define PBKDF2_MAX_EXPONENT				24
+
+#ifndef PBKDF2_TARGET_MILLISECONDS
+/** How long key derivation should take, in milliseconds, when the number of
+  * iterations is chosen by calibratePBKDF2Exponent(). This can be overridden
+  * on the command line, e.g. to keep the tests quick. */
+#define PBKDF2_TARGET_MILLISECONDS		1000
+#endif // #ifndef PBKDF2_TARGET_MILLISECONDS
+
+/** Work out how many PBKDF2 iterations this device can do in
+  * #PBKDF2_TARGET_MILLISECONDS, by timing a few iterations of HMAC-SHA512
+  * with the cycle counter (see getCycleCount()).
+  *
+  * The number of iterations that getPBKDF2Iterations() returns has to suit
+  * the slowest configuration of a platform, which wastes most of the unlock
+  * time on faster ones. Calibrating when a wallet is created (and storing the
+  * result with the wallet) lets each device use as many iterations as it
+  * can afford.
+  * \return The base 2 logarithm of the number of iterations to use. This is
+  *         never less than that of getPBKDF2Iterations() (so calibration
+  *         never makes key derivation weaker) and never more than
+  *         #PBKDF2_MAX_EXPONENT.
+  */
+uint8_t calibratePBKDF2Exponent(void)
+{
+	uint8_t u[SHA512_HASH_LENGTH];
+	uint8_t hmac_result[SHA512_HASH_LENGTH];
+	HmacSha512Context context;
+	uint32_t start_count;
+	uint32_t counts;
+	uint64_t budget;
+	uint8_t exponent;
+	uint32_t i;
+
+	memset(u, 0, sizeof(u));
+	CLOCK_BOOST_BEGIN();
+	hmacSha512PrepareKey(&context, u, sizeof(u));
+	start_count = getCycleCount();
+	for (i = 0; i < PBKDF2_CALIBRATION_ITERATIONS; i++)
+	{
+		hmacSha512Prepared(hmac_result, &context, u, sizeof(u));
+		memcpy(u, hmac_result, sizeof(u));
+	}
+	counts = getCycleCount() - start_count;
+	CLOCK_BOOST_END();
+	memset(&context, 0, sizeof(context));
+	if (counts == 0)
+	{
+		counts = 1;
 	}
+
+	// budget is the number of counts available for
+	// PBKDF2_CALIBRATION_ITERATIONS lots of key derivation, so that it can
+	// be compared directly against counts shifted by the exponent.
+	budget = (uint64_t)getCycleCountFrequency() * PBKDF2_TARGET_MILLISECONDS / 1000;
+	budget *= PBKDF2_CALIBRATION_ITERATIONS;
+	exponent = 0;
+	while ((exponent < PBKDF2_MAX_EXPONENT)
+		&& (((uint32_t)1 << (exponent + 1)) <= getPBKDF2Iterations()))
+	{
+		exponent++;
+	}
+	while ((exponent < PBKDF2_MAX_EXPONENT)
+		&& (((uint64_t)counts << (exponent + 1)) <= budget))
+	{
+		exponent++;
+	}
+	return exponent;
 }
+#endif // #ifdef PBKDF2_CALIBRATE
 
 #ifdef TEST
 
@@ -255,7 +346,19 @@ LongCatIsLongLongCatIsLong", 546,
 0x9f, 0xa9, 0x56, 0x0a, 0xc9, 0x4b, 0x53, 0x20,
 0x1f, 0xbc, 0x06, 0x04, 0xd6, 0xa5, 0xf0, 0xc2,
 0x39, 0x4f, 0xee, 0xa9, 0x91, 0x73, 0x61, 0xd7,
-0xf5, 0xb6, 0x3a, 0xdb, 0x30, 0x0f, 0xdc, 0x85}}
+0xf5, 0xb6, 0x3a, 0xdb, 0x30, 0x0f, 0xdc, 0x85}},
+
+{"password", 8,
+"a salt which is much longer than the 60 bytes that used to be the limit, \
+to check that any length works", 103,
+{0x1d, 0x3a, 0x56, 0x6e, 0xc7, 0x52, 0xa6, 0xa0,
+0x06, 0x2c, 0xc7, 0x91, 0x1b, 0x8d, 0xb4, 0x36,
+0xd9, 0x92, 0x32, 0x3d, 0xce, 0xf2, 0xeb, 0x50,
+0x28, 0x85, 0x56, 0xac, 0xd3, 0xe3, 0x8c, 0x68,
+0x40, 0x4b, 0xfe, 0x10, 0xa7, 0xe9, 0xb6, 0x38,
+0x84, 0x34, 0x2e, 0x54, 0x71, 0xbc, 0xd4, 0x94,
+0x00, 0xfd, 0xcc, 0x9f, 0x53, 0xe2, 0xe8, 0xa0,
+0x95, 0xc3, 0x78, 0x4c, 0x8e, 0x4b, 0xcb, 0xf0}}
 };
 
 int main(void)
@@ -263,6 +366,9 @@ int main(void)
 	unsigned int num_test_vectors;
 	unsigned int i;
 	uint8_t out[SHA512_HASH_LENGTH];
+#ifdef PBKDF2_CALIBRATE
+	uint8_t exponent;
+#endif // #ifdef PBKDF2_CALIBRATE
 
 	initTests(__FILE__);
 
@@ -274,7 +380,8 @@ int main(void)
 			(const uint8_t *)pbkdf2_test_vectors[i].password,
 			pbkdf2_test_vectors[i].password_length,
 			(const uint8_t *)pbkdf2_test_vectors[i].salt,
-			pbkdf2_test_vectors[i].salt_length);
+			pbkdf2_test_vectors[i].salt_length,
+			getPBKDF2Iterations());
 		if (memcmp(out, pbkdf2_test_vectors[i].expected_result, SHA512_HASH_LENGTH))
 		{
 			printf("Test %u mismatch, got:\n", i);
@@ -290,6 +397,23 @@ int main(void)
 		}
 	}
 
+#ifdef PBKDF2_CALIBRATE
+	// The result depends on timing, so only its range can be checked.
+	// Calibration should never go below the platform's fixed number of
+	// iterations.
+	exponent = calibratePBKDF2Exponent();
+	if ((((uint32_t)1 << exponent) < getPBKDF2Iterations())
+		|| (exponent > PBKDF2_MAX_EXPONENT))
+	{
+		printf("Calibrated exponent %u out of range\n", (unsigned int)exponent);
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+#endif // #ifdef PBKDF2_CALIBRATE
+
 	finishTests();
 	exit(0);
 }
@@ -10,6 +10,9 @@
 
 #include "common.h"
 
-extern void pbkdf2(uint8_t *out, const uint8_t *password, const unsigned int password_length, const uint8_t *salt, const unsigned int salt_length);
+extern void pbkdf2(uint8_t *out, const uint8_t *password, const unsigned int password_length, const uint8_t *salt, const unsigned int salt_length, const uint32_t num_iterations);
+#ifdef PBKDF2_CALIBRATE
+extern uint8_t calibratePBKDF2Exponent(void);
+#endif // #ifdef PBKDF2_CALIBRATE
 
 #endif // #ifndef PBKDF2_H_INCLUDED
@@ -0,0 +1,158 @@
+/** \file pc_sampling.c
+  *
+  * \brief Accumulates a histogram of program counter samples.
+  *
+  * See pc_sampling.h for what the PC sampler is for. Platforms which
+  * support PC_SAMPLING call pcSamplingInit() once at startup, then call
+  * pcSamplingRecord() from a periodic timer interrupt handler with the
+  * address of the code which was interrupted. That handler should have a
+  * higher priority than every other interrupt handler, so that time spent
+  * in interrupt handlers is sampled too.
+  *
+  * pcSamplingRecord() is expected to be called from an interrupt handler
+  * which can't itself be interrupted by anything which calls it, so it
+  * doesn't disable interrupts. Everything else is called from the main loop,
+  * and freezes the sampler (see pcSamplingFreeze()) while changing the
+  * histogram, so that pcSamplingRecord() never sees it half changed.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifdef PC_SAMPLING
+
+#ifndef STREAM_COMM_PROFILE
+#error "PC_SAMPLING requires STREAM_COMM_PROFILE"
+#endif // #ifndef STREAM_COMM_PROFILE
+
+#include <string.h>
+#include "common.h"
+#include "hwinterface.h"
+#include "pc_sampling.h"
+
+/** Where the sampler's state lives, as passed to pcSamplingInit(). This is
+  * NULL until then, so that samples taken before initialisation are
+  * ignored. */
+static PCSamplingState *volatile sampling_state;
+/** While this is true, samples are thrown away. */
+static volatile bool sampling_frozen;
+
+/** Start using some memory for the sampler's state. If the memory is all
+  * zeroes (as it will be for a static variable after a reset), the
+  * histogram is set up to cover all of the firmware's code (see
+  * pcSamplingGetCodeRange()). Otherwise, it is assumed to already contain a
+  * histogram, which is kept. Platforms can use that to keep the histogram
+  * going across something which would otherwise clear RAM.
+  * \param state The memory to use. This must stay valid forever.
+  */
+void pcSamplingInit(PCSamplingState *state)
+{
+	uint32_t range_start;
+	uint32_t range_end;
+
+	sampling_frozen = true;
+	sampling_state = state;
+	if (state->range_end == 0)
+	{
+		pcSamplingGetCodeRange(&range_start, &range_end);
+		if (pcSamplingSetRange(range_start, range_end))
+		{
+			// The platform's code range must be valid.
+			fatalError();
+		}
+	}
+	sampling_frozen = false;
+}
+
+/** Add one sample to the histogram. This should be called from a periodic
+  * timer interrupt handler. If the sampler is frozen or hasn't been
+  * initialised yet, the sample is thrown away.
+  * \param pc The address of the instruction which was interrupted.
+  */
+void pcSamplingRecord(uint32_t pc)
+{
+	PCSamplingState *state;
+	uint32_t bucket;
+
+	state = sampling_state;
+	if ((state == NULL) || sampling_frozen)
+	{
+		return;
+	}
+	state->total_samples++;
+	if ((pc < state->range_start) || (pc >= state->range_end))
+	{
+		state->out_of_range_samples++;
+	}
+	else
+	{
+		bucket = (pc - state->range_start) >> state->bucket_shift;
+		if (state->counts[bucket] != 0xffff)
+		{
+			state->counts[bucket]++;
+		}
+	}
+}
+
+/** Change the range of addresses covered by the histogram. The bucket size
+  * is made as small as possible while still fitting the whole range
+  * in #PC_SAMPLE_BUCKETS buckets. This also clears the histogram, since the
+  * old counts would be meaningless.
+  * \param range_start Lowest address to sample.
+  * \param range_end One past the highest address to sample.
+  * \return false on success, true if the range is empty.
+  */
+bool pcSamplingSetRange(uint32_t range_start, uint32_t range_end)
+{
+	PCSamplingState *state;
+	uint32_t bucket_shift;
+	bool was_frozen;
+
+	if (range_end <= range_start)
+	{
+		return true;
+	}
+	state = sampling_state;
+	was_frozen = sampling_frozen;
+	sampling_frozen = true;
+	bucket_shift = 0;
+	while (((range_end - range_start - 1) >> bucket_shift) >= PC_SAMPLE_BUCKETS)
+	{
+		bucket_shift++;
+	}
+	state->range_start = range_start;
+	state->range_end = range_end;
+	state->bucket_shift = bucket_shift;
+	state->total_samples = 0;
+	state->out_of_range_samples = 0;
+	memset(state->counts, 0, sizeof(state->counts));
+	sampling_frozen = was_frozen;
+	return false;
+}
+
+/** Throw away every sample in the histogram, without changing the range
+  * it covers. */
+void pcSamplingClear(void)
+{
+	pcSamplingSetRange(sampling_state->range_start, sampling_state->range_end);
+}
+
+/** Stop or start taking samples. The sampler should be frozen while the
+  * histogram is being read, so that what the host gets is consistent.
+  * \param freeze Use true to stop taking samples, false to start taking
+  *               samples again.
+  */
+void pcSamplingFreeze(bool freeze)
+{
+	sampling_frozen = freeze;
+}
+
+/** Get the sampler's state, so that the histogram can be read. This should
+  * only be called after pcSamplingInit().
+  * \return The sampler's state. This must not be written to.
+  */
+const PCSamplingState *pcSamplingGetState(void)
+{
+	return sampling_state;
+}
+
+#endif // #ifdef PC_SAMPLING
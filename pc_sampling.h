@@ -0,0 +1,79 @@
+/** \file pc_sampling.h
+  *
+  * \brief Describes the statistical PC sampler, a histogram of where the
+  *        firmware spends its time.
+  *
+  * The performance counters in profile.h and the event trace in trace.h only
+  * cover code which has been instrumented in advance. To find hot spots
+  * which nobody thought of instrumenting, a platform can sample the
+  * program counter from a periodic timer interrupt. Each sample is added to
+  * a histogram of program counter "buckets" in RAM. The host can read the
+  * histogram using a GetPCSamples message (see stream_comm.c);
+  * pic32/testers/hwb_pcsample.c does that and uses the firmware's ELF file
+  * to turn buckets into function names.
+  *
+  * Each bucket covers 2 ^ bucket_shift bytes of the sampled address range.
+  * The bucket shift is chosen so that the whole range fits
+  * in #PC_SAMPLE_BUCKETS buckets. The range defaults to all of the
+  * firmware's code (see pcSamplingGetCodeRange()), but the host can narrow
+  * it down to get finer buckets.
+  *
+  * Sampling is only compiled in if PC_SAMPLING is defined. Since the
+  * histogram is read over the debug link, PC_SAMPLING requires
+  * STREAM_COMM_PROFILE.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifndef PC_SAMPLING_H_INCLUDED
+#define PC_SAMPLING_H_INCLUDED
+
+#ifdef PC_SAMPLING
+
+#include "common.h"
+
+#ifndef PC_SAMPLE_BUCKETS
+/** Number of buckets in the histogram. Each bucket takes up 2 bytes of
+  * RAM. */
+#define PC_SAMPLE_BUCKETS		512
+#endif // #ifndef PC_SAMPLE_BUCKETS
+
+#ifndef PC_SAMPLE_RATE
+/** Nominal rate, in Hz, at which platforms should take samples. This is
+  * deliberately not a round number, so that sampling doesn't lock step with
+  * other periodic activity (such as timer interrupts at 2 kHz or a 1 ms
+  * delay loop) and keep catching it at the same point. */
+#define PC_SAMPLE_RATE			997
+#endif // #ifndef PC_SAMPLE_RATE
+
+/** Everything the sampler knows. This is a structure so that a platform can
+  * decide where it lives (see pcSamplingInit()). */
+typedef struct PCSamplingStateStruct
+{
+	/** Lowest address which is sampled. */
+	uint32_t range_start;
+	/** One past the highest address which is sampled. If this is 0, the
+	  * state hasn't been set up yet. */
+	uint32_t range_end;
+	/** Base 2 logarithm of the number of bytes covered by each bucket. */
+	uint32_t bucket_shift;
+	/** Total number of samples taken since the histogram was last cleared,
+	  * including ones which were outside the sampled range. */
+	uint32_t total_samples;
+	/** Number of samples which were outside the sampled range. */
+	uint32_t out_of_range_samples;
+	/** The histogram. Each count sticks at 65535 instead of wrapping
+	  * around. */
+	uint16_t counts[PC_SAMPLE_BUCKETS];
+} PCSamplingState;
+
+extern void pcSamplingInit(PCSamplingState *state);
+extern void pcSamplingRecord(uint32_t pc);
+extern bool pcSamplingSetRange(uint32_t range_start, uint32_t range_end);
+extern void pcSamplingClear(void);
+extern void pcSamplingFreeze(bool freeze);
+extern const PCSamplingState *pcSamplingGetState(void);
+
+#endif // #ifdef PC_SAMPLING
+
+#endif // #ifndef PC_SAMPLING_H_INCLUDED
@@ -11,11 +11,16 @@
   * meaningful.
   *
   * The results of conversions are written into #adc_sample_buffer using DMA
-  * transfers. To begin a series of conversions, call beginFillingADCBuffer(),
-  * then wait until isADCBufferFull() returns
-  * true. #adc_sample_buffer will then contain #ADC_SAMPLE_BUFFER_SIZE
-  * samples. This interface allows one buffer of samples to be collected while
-  * the previous one is processed, which speeds up entropy collection.
+  * transfers. #adc_sample_buffer is split into two halves, each
+  * containing #ADC_SAMPLE_BUFFER_SIZE samples, and the DMA channel is set to
+  * re-enable itself after every block transfer. So once sampling is started
+  * using startADCSampling(), the ADC fills the halves alternately ("ping
+  * pong" buffering) until stopADCSampling() is called. The caller can
+  * process one half while the other half is being filled; use
+  * isADCBufferHalfFull() to find out when a half is ready
+  * and clearADCBufferHalfFull() to note that it has been consumed. This
+  * allows filtering and statistical testing of samples to overlap their
+  * collection, which speeds up entropy collection.
   *
   * For details on hardware interfacing requirements, see initADC().
   *
@@ -32,10 +37,10 @@
 #include "adc.h"
 #include "pic32_system.h"
 
-/** A place to store samples from the ADC. When isADCBufferFull() returns
-  * true, every entry in this array will be filled with ADC samples
+/** A place to store samples from the ADC. When isADCBufferHalfFull() returns
+  * true for a half, every entry in that half will be filled with ADC samples
   * taken periodically. */
-volatile uint16_t adc_sample_buffer[ADC_SAMPLE_BUFFER_SIZE];
+volatile uint16_t adc_sample_buffer[2][ADC_SAMPLE_BUFFER_SIZE];
 
 /** Set up the PIC32 ADC to sample from AN2 periodically using Timer3 as the
   * trigger. DMA is used to move the ADC result into #adc_sample_buffer. */
@@ -104,22 +109,23 @@ void initADC(void)
 	T3CONbits.ON = 1; // turn timer on
 }
 
-/** Begin collecting #ADC_SAMPLE_BUFFER_SIZE samples, filling
-  * up #adc_sample_buffer. This will return before all the samples have been
-  * collected, allowing the caller to do something else while samples are
-  * collected in the background. isADCBufferFull() can be used to determine
-  * when #adc_sample_buffer is full.
+/** Begin collecting samples continuously, alternately filling up each half
+  * of #adc_sample_buffer. This will return immediately; the samples are
+  * collected in the background. The first half to be filled will be
+  * half 0, followed by half 1, then half 0 again etc.
+  * isADCBufferHalfFull() can be used to determine when each half is full.
   *
-  * It is okay to call this while the sample buffer is still being filled up.
-  * In that case, calling this will abort the current fill and commence
-  * filling from the start.
+  * It is okay to call this while sampling is already in progress. In that
+  * case, calling this will abort the current fill and commence filling from
+  * the start of half 0.
   */
-void beginFillingADCBuffer(void)
+void startADCSampling(void)
 {
 	uint32_t status;
 
 	status = disableInterrupts();
 	DCH0CONbits.CHEN = 0; // disable channel
+	DCH0CONbits.CHAEN = 0; // disable auto-enable
 	asm("nop"); // just to be safe
 	DCH0ECONbits.CABORT = 1; // abort any existing transfer and reset pointers
 	// Delay a couple of cycles, just to be safe. DMA transfers are observed
@@ -137,23 +143,67 @@ void beginFillingADCBuffer(void)
 	DCH0SSA = VIRTUAL_TO_PHYSICAL(&ADC1BUF0); // transfer source physical address
 	DCH0DSA = VIRTUAL_TO_PHYSICAL(&adc_sample_buffer); // transfer destination physical address
 	DCH0SSIZ = sizeof(uint16_t); // source size
-	DCH0DSIZ = sizeof(adc_sample_buffer); // destination size
+	DCH0DSIZ = sizeof(adc_sample_buffer); // destination size (both halves)
 	DCH0CSIZ = sizeof(uint16_t); // cell size (bytes transferred per event)
+	// With auto-enable set, the channel stays enabled after each block
+	// transfer and the destination pointer goes back to the start of half 0.
+	DCH0CONbits.CHAEN = 1; // enable auto-enable
 	DCH0CONbits.CHEN = 1; // enable channel
 	restoreInterrupts(status);
 }
 
-/** Check whether ADC buffer (#adc_sample_buffer) is full.
-  * \return false if ADC buffer is not full, true if it is.
+/** Stop collecting samples. The contents of #adc_sample_buffer are left
+  * alone. */
+void stopADCSampling(void)
+{
+	uint32_t status;
+
+	status = disableInterrupts();
+	DCH0CONbits.CHAEN = 0; // disable auto-enable
+	DCH0CONbits.CHEN = 0; // disable channel
+	restoreInterrupts(status);
+}
+
+/** Check whether one half of the ADC buffer (#adc_sample_buffer) has been
+  * filled since the last call to startADCSampling()
+  * or clearADCBufferHalfFull() for that half.
+  * \param half Which half to check (0 or 1).
+  * \return false if that half is not full, true if it is.
+  */
+bool isADCBufferHalfFull(unsigned int half)
+{
+	if (half == 0)
+	{
+		// Destination half full means half 0 has just been filled.
+		if (DCH0INTbits.CHDHIF != 0)
+		{
+			return true;
+		}
+	}
+	else
+	{
+		// Block transfer complete means half 1 has just been filled.
+		if (DCH0INTbits.CHBCIF != 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Note that one half of the ADC buffer (#adc_sample_buffer) has been
+  * consumed, so that isADCBufferHalfFull() will only return true for that
+  * half once it has been filled again.
+  * \param half Which half to clear (0 or 1).
   */
-bool isADCBufferFull(void)
+void clearADCBufferHalfFull(unsigned int half)
 {
-	if (DCH0INTbits.CHBCIF != 0)
+	if (half == 0)
 	{
-		return true;
+		DCH0INTCLR = _DCH0INT_CHDHIF_MASK;
 	}
 	else
 	{
-		return false;
+		DCH0INTCLR = _DCH0INT_CHBCIF_MASK;
 	}
 }
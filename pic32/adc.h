@@ -11,16 +11,18 @@
 #include <stdint.h>
 #include "../fft.h" // for FFT_SIZE
 
-/** Size of #sample_buffer, in number of samples.
+/** Size of each half of #adc_sample_buffer, in number of samples.
   * \warning This must be a multiple of 16, or else hardwareRandom32Bytes()
   *          will attempt to read past the end of the sample buffer.
   */
 #define ADC_SAMPLE_BUFFER_SIZE	(FFT_SIZE * 4)
 
-extern volatile uint16_t adc_sample_buffer[ADC_SAMPLE_BUFFER_SIZE];
+extern volatile uint16_t adc_sample_buffer[2][ADC_SAMPLE_BUFFER_SIZE];
 
 extern void initADC(void);
-extern void beginFillingADCBuffer(void);
-extern bool isADCBufferFull(void);
+extern void startADCSampling(void);
+extern void stopADCSampling(void);
+extern bool isADCBufferHalfFull(unsigned int half);
+extern void clearADCBufferHalfFull(unsigned int half);
 
 #endif // #ifndef PIC32_ADC_H_INCLUDED
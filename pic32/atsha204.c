@@ -28,6 +28,7 @@
 #include <stdint.h>
 #include <p32xxxx.h>
 #include "../common.h"
+#include "../clock_governor.h"
 #include "pic32_system.h"
 #include "atsha204.h"
 
@@ -161,6 +162,9 @@ static void sendBytes(const uint8_t *buffer, const unsigned int length)
 	uint32_t token;
 	uint32_t status;
 
+	// Token timing (see atsha204_bitbang.S) counts CPU cycles, so it's only
+	// right at full clock speed.
+	CLOCK_BOOST_BEGIN();
 	status = disableInterrupts();
 	for (i = 0; i < length; i++)
 	{
@@ -180,6 +184,7 @@ static void sendBytes(const uint8_t *buffer, const unsigned int length)
 		}
 	}
 	restoreInterrupts(status);
+	CLOCK_BOOST_END();
 }
 
 /** Wait for and receive a single token from the ATSHA204. If this does
@@ -406,11 +411,14 @@ static uint32_t sendAndReceiveBytes(uint8_t *buffer, const unsigned int transmit
 	uint32_t r;
 
 	// Interrupts are disabled for the entire sequence so that the receive
-	// loop doesn't miss any response.
+	// loop doesn't miss any response. Receive timeouts count CPU cycles, so
+	// this has to run at full clock speed too.
+	CLOCK_BOOST_BEGIN();
 	status = disableInterrupts();
 	sendBytes(buffer, transmit_length);
 	r = receiveBytes(buffer, buffer_length);
 	restoreInterrupts(status);
+	CLOCK_BOOST_END();
 	return r;
 }
 
@@ -466,18 +474,55 @@ void atsha204Sleep(void)
 	sendBytes(buffer, 1);
 }
 
-/** Get the output of the ATSHA204's internal hardware random number
-  * generator.
-  * \param random_bytes Byte array which, on success, will be written with
-  *                     32 random bytes.
-  * \return false on success, true on failure.
+/** Number of core timer counts (each is 2 CPU cycles) to wait between
+  * attempts to receive the response to a "Random" command. A failed receive
+  * attempt takes about 250 microsecond (see #TOKEN_TIMEOUT_ITERATIONS), so
+  * this makes each attempt about 1 millisecond apart. */
+#define RANDOM_POLL_INTERVAL_COUNTS	((750 * CYCLES_PER_MICROSECOND) / 2)
+/** Maximum number of attempts to receive the response to a "Random" command.
+  * From Table 8-4 of the ATSHA204 datasheet, the maximum execution time of
+  * the "Random" command is 50 millisecond. This value includes a safety
+  * factor of 1.5. */
+#define RANDOM_POLL_ATTEMPTS		75
+
+/** Whether a "Random" command has been sent by atsha204RandomBegin() but its
+  * response hasn't been received by atsha204RandomPoll() yet. */
+static bool random_in_progress;
+/** Value of the core timer at the most recent send or receive attempt
+  * associated with the "Random" command in progress. */
+static uint32_t random_last_count;
+/** Number of receive attempts made for the "Random" command in progress. */
+static unsigned int random_poll_count;
+
+/** Get the current value of the core timer (the CP0 Count register), which
+  * increments every 2 CPU cycles.
+  * \return The current value of the core timer.
   */
-bool atsha204Random(uint8_t *random_bytes)
+static uint32_t __attribute__((nomips16)) getCoreTimerCount(void)
 {
-	uint32_t received_length;
-	uint8_t buffer[64];
-	unsigned int timeout_counter;
+	uint32_t count;
+
+	asm volatile("mfc0 %0, $9" : "=r"(count));
+	return count;
+}
+
+/** Ask the ATSHA204's internal hardware random number generator for
+  * 32 random bytes, without waiting for them. The ATSHA204 takes tens of
+  * milliseconds to generate the bytes; the CPU can do other things in the
+  * meantime, and then call atsha204RandomPoll() (at least every
+  * millisecond or so) to collect the bytes.
+  * The ATSHA204 must be awake (see atsha204Wake()) before calling this.
+  * \return false on success, true on failure (another "Random" command is
+  *         already in progress).
+  */
+bool atsha204RandomBegin(void)
+{
+	uint8_t buffer[8];
 
+	if (random_in_progress)
+	{
+		return true; // only one command can be in progress at a time
+	}
 	buffer[0] = COMMAND_FLAG;
 	buffer[1] = 7; // length
 	buffer[2] = OPCODE_RANDOM;
@@ -486,32 +531,86 @@ bool atsha204Random(uint8_t *random_bytes)
 	buffer[5] = 0; // reserved; must be 0
 	appendCRC16(&(buffer[1]), 5);
 	sendBytes(buffer, 8);
-	timeout_counter = 0;
-	do
+	random_in_progress = true;
+	random_last_count = getCoreTimerCount();
+	random_poll_count = 0;
+	return false; // success
+}
+
+/** Check whether the ATSHA204 has finished the "Random" command started by
+  * atsha204RandomBegin() and if so, collect its output. This returns
+  * immediately if it hasn't been long enough since the last receive attempt,
+  * so it's safe to call this in a busy-wait loop. Each receive attempt
+  * disables interrupts for about 250 microsecond, or about 11 millisecond if
+  * the response is actually received.
+  * \param random_bytes Byte array which, when this returns 1, will be written
+  *                     with 32 random bytes.
+  * \return 0 if the response isn't ready yet, 1 if random_bytes has been
+  *         written with the response, or -1 if the command failed (or no
+  *         command was in progress).
+  */
+int atsha204RandomPoll(uint8_t *random_bytes)
+{
+	uint32_t received_length;
+	uint8_t buffer[64];
+
+	if (!random_in_progress)
 	{
-		// The token receive timeout (#TOKEN_TIMEOUT_ITERATIONS) equates to
-		// about 250 microsecond. The idea here is to delay enough to make
-		// each iteration of this do loop about 1 millisecond.
-		delayCycles(750 * CYCLES_PER_MICROSECOND); // 750 microsecond
-		buffer[0] = TRANSMIT_FLAG;
-		received_length = sendAndReceiveBytes(buffer, 1, sizeof(buffer));
-		timeout_counter++;
-		// From Table 8-4 of the ATSHA204 datasheet, the maximum execution
-		// time of the "Random" command is 50 millisecond. The timeout
-		// value of 75 below includes a safety factor of 1.5.
-	} while ((received_length == 0) && (timeout_counter < 75));
+		return -1; // no command in progress
+	}
+	if ((getCoreTimerCount() - random_last_count) < RANDOM_POLL_INTERVAL_COUNTS)
+	{
+		return 0; // too early for another receive attempt
+	}
+	buffer[0] = TRANSMIT_FLAG;
+	received_length = sendAndReceiveBytes(buffer, 1, sizeof(buffer));
+	random_last_count = getCoreTimerCount();
+	random_poll_count++;
 	if (received_length == 0)
 	{
-		return true; // timeout
+		if (random_poll_count < RANDOM_POLL_ATTEMPTS)
+		{
+			return 0; // ATSHA204 still busy
+		}
+		random_in_progress = false;
+		return -1; // timeout
 	}
+	random_in_progress = false;
 	if (!isBlockValid(buffer, received_length))
 	{
-		return true; // invalid block received
+		return -1; // invalid block received
 	}
 	if (received_length != 35)
 	{
-		return true; // unexpected packet size
+		return -1; // unexpected packet size
 	}
 	memcpy(random_bytes, &(buffer[1]), 32);
+	return 1; // success
+}
+
+/** Get the output of the ATSHA204's internal hardware random number
+  * generator. This blocks until the output is available; see
+  * atsha204RandomBegin() and atsha204RandomPoll() for a version which
+  * doesn't block.
+  * \param random_bytes Byte array which, on success, will be written with
+  *                     32 random bytes.
+  * \return false on success, true on failure.
+  */
+bool atsha204Random(uint8_t *random_bytes)
+{
+	int r;
+
+	if (atsha204RandomBegin())
+	{
+		return true; // another command already in progress
+	}
+	do
+	{
+		r = atsha204RandomPoll(random_bytes);
+	} while (r == 0);
+	if (r < 0)
+	{
+		return true; // timeout, or invalid response
+	}
 	return false; // success
 }
@@ -15,6 +15,8 @@ extern void initATSHA204(void);
 extern bool atsha204Wake(void);
 extern void atsha204Sleep(void);
 extern bool atsha204Random(uint8_t *random_bytes);
+extern bool atsha204RandomBegin(void);
+extern int atsha204RandomPoll(uint8_t *random_bytes);
 
 #endif	// #ifndef ATSHA204_H_INCLUDED
 
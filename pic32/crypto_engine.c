@@ -0,0 +1,246 @@
+/** \file crypto_engine.c
+  *
+  * \brief Routes AES block operations to the PIC32MZ crypto engine.
+  *
+  * This replaces the portable AES implementation in aes.c when
+  * PLATFORM_SPECIFIC_AES is defined. The PIC32MZ family has a crypto
+  * engine which does AES (among other things) by DMA: the CPU fills in a
+  * security association (which describes the algorithm and holds the key)
+  * and a buffer descriptor (which says where the data comes from and where
+  * it goes), then tells the engine where the buffer descriptor is. Besides
+  * being faster than software AES, this avoids the data-dependent table
+  * lookups of aes.c, which on the PIC32MZ (unlike the PIC32MX) go through a
+  * data cache.
+  *
+  * The engine works with raw keys, so the "expanded key" used here is just
+  * the key itself, followed by zeroes. The same expanded key is used for
+  * encryption and decryption.
+  *
+  * The engine also does SHA-256 and HMAC, but that isn't used here. The
+  * engine pads and finishes a hash at the end of every frame, so it can
+  * only hash whole messages that are in RAM. Everything in this project
+  * hashes incrementally, through HashState#hashBlock(), often with several
+  * hashes in progress at once (see transaction.c).
+  *
+  * All references to the "PIC32 family reference manual" refer to
+  * Section 49 (Crypto Engine and Random Number Generator).
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifdef PLATFORM_SPECIFIC_AES
+
+#include <p32xxxx.h>
+#include <stdint.h>
+#include <string.h>
+#include "pic32_system.h"
+#include "../common.h"
+#include "../endian.h"
+#include "../aes.h"
+#include "../hwinterface.h"
+
+/** Convert a virtual address into an uncached (KSEG1) virtual address, so
+  * that the CPU sees what the crypto engine's DMA sees. */
+#define UNCACHED(x)					((void *)(VIRTUAL_TO_PHYSICAL(x) | 0xa0000000))
+
+// Security association control (SA_CTRL) bits. See the description of
+// the security association in the PIC32 family reference manual.
+/** CRYPTOALGO field value for AES in ECB mode. */
+#define SA_CTRL_CRYPTOALGO_RECB		0x00000008
+/** KEYSIZE field value for 128 bit AES keys. */
+#define SA_CTRL_KEYSIZE_128			0x00000000
+/** ENCTYPE bit: set for encryption, clear for decryption. */
+#define SA_CTRL_ENCTYPE				0x00000200
+/** ALGO field value for AES. */
+#define SA_CTRL_ALGO_AES			0x00001000
+/** FB bit: this is the first block of a frame. */
+#define SA_CTRL_FB					0x00200000
+/** LNC bit: load a new key from the security association. */
+#define SA_CTRL_LNC					0x00800000
+
+// Buffer descriptor control (BD_CTRL) bits. See the description of the
+// buffer descriptor in the PIC32 family reference manual.
+/** PKT_INT_EN bit: signal completion of the packet in CEINTSRC. */
+#define BD_CTRL_PKT_INT_EN			0x00020000
+/** LIFM bit: this buffer is the last in the frame. */
+#define BD_CTRL_LIFM				0x00040000
+/** LAST_BD bit: this is the last buffer descriptor in the chain. */
+#define BD_CTRL_LAST_BD				0x00080000
+/** SA_FETCH_EN bit: fetch the security association for this descriptor. */
+#define BD_CTRL_SA_FETCH_EN			0x00400000
+/** DESC_EN bit: this descriptor belongs to the engine. */
+#define BD_CTRL_DESC_EN				0x80000000
+
+/** CECON value which enables buffer descriptor fetching and DMA, with byte
+  * swapping of input and output data (so that data is in the same order in
+  * memory as it is for aes.c). */
+#define CECON_START					0x000000a5
+/** CECON value which resets the crypto engine. */
+#define CECON_SOFTWARE_RESET		0x00000040
+
+/** Security association, as fetched by the crypto engine. */
+typedef struct SecurityAssociationStruct
+{
+	/** Algorithm and mode. See the SA_CTRL_ defines. */
+	uint32_t sa_ctrl;
+	/** Authentication key (unused). */
+	uint32_t sa_authkey[8];
+	/** Encryption key. A 128 bit key goes in the last 4 words. */
+	uint32_t sa_enckey[8];
+	/** Authentication IV (unused). */
+	uint32_t sa_authiv[8];
+	/** Encryption IV (unused, since ECB mode doesn't have one). */
+	uint32_t sa_enciv[4];
+} SecurityAssociation;
+
+/** Buffer descriptor, as fetched by the crypto engine. */
+typedef struct BufferDescriptorStruct
+{
+	/** Buffer length and flags. See the BD_CTRL_ defines. */
+	uint32_t bd_ctrl;
+	/** Physical address of the security association. */
+	uint32_t sa_addr;
+	/** Physical address of the input data. */
+	uint32_t srcaddr;
+	/** Physical address where the output data will be written. */
+	uint32_t dstaddr;
+	/** Physical address of the next buffer descriptor. */
+	uint32_t nxtptr;
+	/** Physical address where results are written (unused for AES). */
+	uint32_t updptr;
+	/** Total length of the message, in bytes. */
+	uint32_t msg_len;
+	/** Offset of the encrypted part of the message (unused). */
+	uint32_t enc_off;
+} BufferDescriptor;
+
+/** The crypto engine's security association. This is only accessed through
+  * its uncached address. */
+static SecurityAssociation security_association __attribute__((aligned(8)));
+/** The crypto engine's buffer descriptor. This is only accessed through its
+  * uncached address. */
+static BufferDescriptor buffer_descriptor __attribute__((aligned(8)));
+/** The block that the crypto engine reads from and writes to. Using a
+  * dedicated, aligned buffer means that out and in (which may be anywhere,
+  * with any alignment) never have to be flushed from the data cache. */
+static uint8_t engine_block[16] __attribute__((aligned(16)));
+
+/** Run the crypto engine on one 128 bit block, in ECB mode.
+  * \param out The result will be written here. This should be a 16 byte
+  *            array.
+  * \param in The block to encrypt or decrypt. This should also be a 16 byte
+  *           array. This may alias out.
+  * \param expanded_key Should point to an array containing the key, expanded
+  *                     using aesExpandKey() or aesExpandKeyDecrypt().
+  * \param do_encrypt Use true to encrypt, false to decrypt.
+  */
+static void runCryptoEngine(uint8_t *out, uint8_t *in, uint8_t *expanded_key, bool do_encrypt)
+{
+	SecurityAssociation *sa;
+	BufferDescriptor *bd;
+	uint8_t *block;
+	uint8_t i;
+
+	sa = UNCACHED(&security_association);
+	bd = UNCACHED(&buffer_descriptor);
+	block = UNCACHED(engine_block);
+
+	sa->sa_ctrl = SA_CTRL_CRYPTOALGO_RECB | SA_CTRL_KEYSIZE_128 | SA_CTRL_ALGO_AES
+		| SA_CTRL_FB | SA_CTRL_LNC;
+	if (do_encrypt)
+	{
+		sa->sa_ctrl |= SA_CTRL_ENCTYPE;
+	}
+	// The engine expects the key as big-endian words.
+	for (i = 0; i < 4; i++)
+	{
+		sa->sa_enckey[4 + i] = readU32BigEndian(&(expanded_key[i * 4]));
+	}
+	memcpy(block, in, 16);
+
+	bd->bd_ctrl = 16 | BD_CTRL_PKT_INT_EN | BD_CTRL_LIFM | BD_CTRL_LAST_BD
+		| BD_CTRL_SA_FETCH_EN;
+	bd->sa_addr = VIRTUAL_TO_PHYSICAL(&security_association);
+	bd->srcaddr = VIRTUAL_TO_PHYSICAL(engine_block);
+	bd->dstaddr = VIRTUAL_TO_PHYSICAL(engine_block);
+	bd->nxtptr = VIRTUAL_TO_PHYSICAL(&buffer_descriptor);
+	bd->updptr = 0;
+	bd->msg_len = 16;
+	bd->enc_off = 0;
+	bd->bd_ctrl |= BD_CTRL_DESC_EN;
+
+	CECON = CECON_SOFTWARE_RESET;
+	while (CECON != 0)
+	{
+		// do nothing
+	}
+	CEINTSRC = 0xf; // clear all interrupt flags
+	CEBDPADDR = VIRTUAL_TO_PHYSICAL(&buffer_descriptor);
+	CEINTEN = 0x07;
+	CECON = CECON_START;
+	while (CEINTSRCbits.PKTIF == 0)
+	{
+		// do nothing
+	}
+	CEINTSRC = 0xf;
+	if ((CESTATbits.ERROP != 0) || (CESTATbits.ERRPHASE != 0))
+	{
+		// This should never happen, since everything passed to the engine
+		// is always the same (apart from data and key).
+		fatalError();
+	}
+
+	memcpy(out, block, 16);
+	// Don't leave plaintext or the key lying around.
+	memset(block, 0, 16);
+	memset(sa->sa_enckey, 0, sizeof(sa->sa_enckey));
+}
+
+/** Expand a key for use with aesEncrypt(). Since the crypto engine expands
+  * keys itself, this only copies the key.
+  * \param expanded_key Buffer of size #EXPANDED_KEY_SIZE bytes to store
+  *                     expanded key.
+  * \param key 16 byte input key.
+  */
+void aesExpandKey(uint8_t *expanded_key, uint8_t *key)
+{
+	memcpy(expanded_key, key, 16);
+	memset(&(expanded_key[16]), 0, EXPANDED_KEY_SIZE - 16);
+}
+
+/** Expand a key for use with aesDecrypt(). For the crypto engine, this is
+  * the same as aesExpandKey().
+  * \param expanded_key Buffer of size #EXPANDED_KEY_SIZE bytes to store
+  *                     expanded key.
+  * \param key 16 byte input key.
+  */
+void aesExpandKeyDecrypt(uint8_t *expanded_key, uint8_t *key)
+{
+	aesExpandKey(expanded_key, key);
+}
+
+/** Encrypt one 128 bit block.
+  * \param out The resulting ciphertext will be placed here. This should be a
+  *            16 byte array.
+  * \param in The plaintext to encrypt. This should also be a 16 byte array.
+  * \param expanded_key Should point to an array containing the expanded
+  *                     key (see aesExpandKey()).
+  */
+void aesEncrypt(uint8_t *out, uint8_t *in, uint8_t *expanded_key)
+{
+	runCryptoEngine(out, in, expanded_key, true);
+}
+
+/** Decrypt one 128 bit block.
+  * \param out The resulting plaintext will be placed here. This should be a
+  *            16 byte array.
+  * \param in The ciphertext to decrypt. This should also be a 16 byte array.
+  * \param expanded_key Should point to an array containing the expanded
+  *                     key (see aesExpandKeyDecrypt()).
+  */
+void aesDecrypt(uint8_t *out, uint8_t *in, uint8_t *expanded_key)
+{
+	runCryptoEngine(out, in, expanded_key, false);
+}
+
+#endif // #ifdef PLATFORM_SPECIFIC_AES
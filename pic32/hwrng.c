@@ -16,6 +16,15 @@
   * here is that the HWRNG is a white Gaussian noise source.
   * The statistical limits for each test are defined in hwrng_limits.h.
   *
+  * If HWRNG_USE_ATSHA204 is defined, the ATSHA204's internal random number
+  * generator (see atsha204.c) is used as a second, parallel entropy source.
+  * Its output is requested before each batch of ADC samples is collected,
+  * collected while waiting for the ADC, and then mixed into the output of
+  * hardwareRandom32Bytes(). Since the ATSHA204 takes tens of milliseconds
+  * per request, doing this in parallel with ADC sampling means it costs
+  * almost no extra time. Don't define HWRNG_USE_ATSHA204 when characterising
+  * the ADC HWRNG, because the ATSHA204 output will hide the ADC samples.
+  *
   * This file is licensed as described by the file LICENCE.
   */
 
@@ -28,6 +37,13 @@
 #include "hwrng_limits.h"
 #include "adc.h"
 #include "pic32_system.h"
+#include "hwrng.h"
+#include "ram_overlay.h"
+#include "../trace.h"
+#include "../clock_governor.h"
+#ifdef HWRNG_USE_ATSHA204
+#include "atsha204.h"
+#endif // #ifdef HWRNG_USE_ATSHA204
 
 #ifdef TEST_STATISTICS
 #include "ssd1306.h"
@@ -76,6 +92,41 @@ static const int32_t fir_lowpass_coefficients[FILTER_ORDER] = {
 26236,
 19161, 5309, -2929, -2681, 0, 711, 202, -123};
 
+/** Number of coefficients in each polyphase component of the FIR filter.
+  * Coefficient k of polyphase component p is
+  * fir_lowpass_coefficients[k * #OVERSAMPLE_RATIO + p]. */
+#define POLYPHASE_LENGTH				((FILTER_ORDER + OVERSAMPLE_RATIO - 1) / OVERSAMPLE_RATIO)
+/** Polyphase components of one half of #adc_sample_buffer, as written by
+  * splitPolyphase(). Polyphase component p, entry u is the ADC sample with
+  * index u * #OVERSAMPLE_RATIO + p - #FILTER_HALF_ORDER (modulo the size of
+  * each half). Because the wrap-around at the edges of the ADC buffer is
+  * already done here, firFilter() can walk through each component linearly.
+  * Every decimated output only ever needs one tap per input sample per
+  * component, so no computation is wasted on inputs that decimation would
+  * throw away. */
+#define polyphase_buffer				(hwrng_overlay->polyphase)
+
+#ifndef STATISTICS_BORROWED_BUFFERS
+#error "STATISTICS_BORROWED_BUFFERS must be defined, so that the statistics buffers can be placed in the RAM overlay region"
+#endif // #ifndef STATISTICS_BORROWED_BUFFERS
+
+/** Everything which is only needed while fillAndTestSamplesArray() is
+  * running. This lives in the RAM overlay region (see ram_overlay.c), so
+  * that the same memory can be used by the non-volatile memory write cache
+  * at other times. */
+typedef struct HwrngOverlayStruct
+{
+	/** Histogram and power spectral density estimate used by
+	  * statistics.c. */
+	StatisticsBuffers statistics;
+	/** See #polyphase_buffer. */
+	uint16_t polyphase[OVERSAMPLE_RATIO][DECIMATED_SAMPLE_BUFFER_SIZE + POLYPHASE_LENGTH - 1];
+} HwrngOverlay;
+
+/** Points to the RAM overlay region while fillAndTestSamplesArray() owns
+  * it. */
+static HwrngOverlay *hwrng_overlay;
+
 /** Array of samples which have passed statistical tests. #SAMPLE_COUNT samples
   * need to be stored because hardwareRandom32Bytes() cannot start returning
   * samples from this array until all statistical tests have passed. */
@@ -83,6 +134,82 @@ static volatile uint16_t samples[SAMPLE_COUNT];
 /** Number of samples in #samples that hardwareRandom32Bytes() has
   * used up. */
 static uint32_t samples_consumed;
+/** Number of bits of entropy that hardwareRandom32Bytes() credits to each 16
+  * samples from #samples. This is calculated by updateEntropyRate() from
+  * the same statistics which the samples were tested with, so a better noise
+  * source gets more output out of each fill of #samples. */
+static int entropy_bits_per_16_samples;
+
+#ifdef HWRNG_USE_ATSHA204
+/** Number of bits of entropy that each 32 byte block from the ATSHA204 is
+  * assumed to contain. The ATSHA204's random number generator can't be
+  * tested here, so this is deliberately much lower than 256. */
+#define ATSHA204_ENTROPY_BITS			64
+/** Most recent 32 byte block received from the ATSHA204. This is only valid
+  * if #atsha204_block_valid is true. */
+static uint8_t atsha204_block[32];
+/** Whether #atsha204_block contains a block that hasn't been mixed into the
+  * output of hardwareRandom32Bytes() yet. */
+static bool atsha204_block_valid;
+/** Whether a request for a block is in progress (see atsha204RandomBegin()). */
+static bool atsha204_request_pending;
+
+/** Ask the ATSHA204 for another block of random bytes, if one isn't already
+  * available or on its way. This doesn't wait for the block; see
+  * pollATSHA204(). */
+static void requestATSHA204Block(void)
+{
+	if (!atsha204_block_valid && !atsha204_request_pending)
+	{
+		if (!atsha204Wake())
+		{
+			if (!atsha204RandomBegin())
+			{
+				atsha204_request_pending = true;
+			}
+			else
+			{
+				atsha204Sleep();
+			}
+		}
+	}
+}
+
+/** Collect the block requested by requestATSHA204Block(), if it's ready.
+  * This returns quickly if it isn't, so it can be called while waiting for
+  * the ADC. */
+static void pollATSHA204(void)
+{
+	int r;
+
+	if (atsha204_request_pending)
+	{
+		r = atsha204RandomPoll(atsha204_block);
+		if (r != 0)
+		{
+			atsha204_request_pending = false;
+			atsha204_block_valid = (r > 0);
+			atsha204Sleep();
+		}
+	}
+}
+#endif // #ifdef HWRNG_USE_ATSHA204
+
+#ifdef BACKGROUND_TASKS
+/** Background task (see backgroundYield() in main.c) which keeps a block
+  * from the ATSHA204 on its way, so that the next call to
+  * hardwareRandom32Bytes() is less likely to have to wait for it. This
+  * does nothing if HWRNG_USE_ATSHA204 isn't defined, since ADC samples are
+  * already collected in the background using DMA.
+  */
+void hwrngBackgroundTask(void)
+{
+#ifdef HWRNG_USE_ATSHA204
+	requestATSHA204Block();
+	pollATSHA204();
+#endif // #ifdef HWRNG_USE_ATSHA204
+}
+#endif // #ifdef BACKGROUND_TASKS
 
 /** Obtains an estimate of the bandwidth of the HWRNG, based on the power
   * spectrum density estimate (see #psd_accumulator).
@@ -211,10 +338,7 @@ static NOINLINE uint32_t histogramTestsFailed(fix16_t *variance)
 	fix16_t entropy_estimate;
 
 	fix16_error_occurred = false;
-	mean = calculateCentralMoment(fix16_zero, 1);
-	*variance = calculateCentralMoment(mean, 2);
-	kappa3 = calculateCentralMoment(mean, 3);
-	kappa4 = calculateCentralMoment(mean, 4);
+	calculateCentralMoments(&mean, variance, &kappa3, &kappa4);
 	moment_error_occurred = fix16_error_occurred;
 	fix16_error_occurred = false;
 	entropy_estimate = estimateEntropy();
@@ -291,6 +415,26 @@ static NOINLINE uint32_t histogramTestsFailed(fix16_t *variance)
 	return tests_failed;
 }
 
+/** Check the results of the repetition count and adaptive proportion tests
+  * (see updateHealthTests()) against their cutoffs.
+  * \return 0 if all tests passed, non-zero if any tests failed.
+  */
+static uint32_t healthTestsFailed(void)
+{
+	uint32_t tests_failed;
+
+	tests_failed = 0;
+	if (max_repetition_count >= REPETITION_COUNT_CUTOFF)
+	{
+		tests_failed |= 256; // HWRNG output got stuck on one value
+	}
+	if (max_proportion_count >= ADAPTIVE_PROPORTION_CUTOFF)
+	{
+		tests_failed |= 256; // one value occurred far too often
+	}
+	return tests_failed;
+}
+
 /** Run FFT-based statistical tests on HWRNG signal and report any failures.
   * This only should be called once the power spectral density accumulator
   * (see #psd_accumulator) has accumulated enough samples.
@@ -350,51 +494,146 @@ static NOINLINE uint32_t fftTestsFailed(fix16_t variance)
 	return tests_failed;
 }
 
-/** Apply FIR filter to samples.
+/** Work out how much entropy to credit to the samples which were just
+  * tested, and place the result in #entropy_bits_per_16_samples. This only
+  * should be called after the histogram and the power spectral density
+  * accumulator are full. The measured min-entropy per sample is scaled
+  * down by the bandwidth of the HWRNG signal and
+  * by #ENTROPY_DERATING_FACTOR, then capped
+  * at #MAX_ENTROPY_BITS_PER_SAMPLE.
+  */
+static void updateEntropyRate(void)
+{
+	int bandwidth; // as FFT bin number
+	int max_bin; // as FFT bin number
+	int bits;
+	fix16_t rate;
+
+	bandwidth = estimateBandwidth(&max_bin);
+	fix16_error_occurred = false;
+	rate = scaleEntropyByBandwidth(estimateMinEntropy(), bandwidth);
+	rate = fix16_mul(rate, F16(16.0 / ENTROPY_DERATING_FACTOR));
+	if (fix16_error_occurred)
+	{
+		bits = (int)(16.0 * ENTROPY_BITS_PER_SAMPLE);
+	}
+	else
+	{
+		bits = (int)(rate / 65536); // round towards zero
+	}
+	if (bits > (int)(16.0 * MAX_ENTROPY_BITS_PER_SAMPLE))
+	{
+		bits = (int)(16.0 * MAX_ENTROPY_BITS_PER_SAMPLE);
+	}
+	// hardwareRandom32Bytes() returning 0 means something else, so always
+	// credit at least 1 bit. Samples this poor would fail the statistical
+	// tests anyway.
+	if (bits < 1)
+	{
+		bits = 1;
+	}
+	entropy_bits_per_16_samples = bits;
+}
+
+/** Split one half of the ADC buffer into its polyphase components, placing
+  * them into #polyphase_buffer. This is the only place where the ADC buffer
+  * needs to be indexed in a circular manner, and it only needs to be done
+  * once per sample instead of once per filter tap.
   * \param samples Array of input samples. It must
   *                contain #ADC_SAMPLE_BUFFER_SIZE samples.
-  * \param base_index Index into samples array to begin applying filter.
-  * \param coefficients Array of FIR filter coefficients, in Q16.16
-  *                     fixed-point representation.
-  * \param order Order (number of coefficients) of the filter.
+  */
+static void splitPolyphase(const volatile uint16_t *samples)
+{
+	unsigned int phase;
+	unsigned int u;
+	unsigned int index;
+
+	for (phase = 0; phase < OVERSAMPLE_RATIO; phase++)
+	{
+		for (u = 0; u < (DECIMATED_SAMPLE_BUFFER_SIZE + POLYPHASE_LENGTH - 1); u++)
+		{
+			// The "- FILTER_HALF_ORDER" is there to account for the
+			// delay of the low-pass filter.
+			// The "& (ADC_SAMPLE_BUFFER_SIZE - 1)" makes the filter a
+			// circular convolution. Circular convolution treats every
+			// sample in the ADC buffer fairly.
+			index = ((u * OVERSAMPLE_RATIO) + phase - FILTER_HALF_ORDER) & (ADC_SAMPLE_BUFFER_SIZE - 1);
+			polyphase_buffer[phase][u] = samples[index];
+		}
+	}
+}
+
+/** Apply FIR filter to samples, producing one decimated output sample. The
+  * filter is applied to the polyphase components in #polyphase_buffer, so
+  * splitPolyphase() must be called before this.
+  * \param output_index Index (after decimation) of the output sample.
   * \return The output sample.
   * \warning All filter coefficients should have a magnitude of less than one.
   */
-static int32_t firFilter(const volatile uint16_t *samples, const unsigned int base_index, const int32_t *coefficients, const unsigned int order)
+static int32_t firFilter(const unsigned int output_index)
 {
 	int32_t sum; // Q16.16 fixed-point representation
+	unsigned int phase;
 	unsigned int i;
-	unsigned int index;
+	const uint16_t *input;
+	const int32_t *coefficient;
 
-	// Convolute samples with coefficients.
+	// Convolute each polyphase component with the corresponding
+	// coefficients. Both the input and coefficients are read sequentially.
 	sum = 0;
-	for (i = 0; i < order; i++)
+	for (phase = 0; phase < OVERSAMPLE_RATIO; phase++)
 	{
-		// The "& (ADC_SAMPLE_BUFFER_SIZE - 1)" makes this a circular
-		// convolution. Circular convolution treats every sample in the
-		// ADC buffer fairly.
-		index = (base_index + i) & (ADC_SAMPLE_BUFFER_SIZE - 1);
-		sum += ((int32_t)samples[index]) * coefficients[i];
+		input = &(polyphase_buffer[phase][output_index]);
+		coefficient = &(fir_lowpass_coefficients[phase]);
+		for (i = phase; i < FILTER_ORDER; i += OVERSAMPLE_RATIO)
+		{
+			sum += ((int32_t)(*input)) * (*coefficient);
+			input++;
+			coefficient += OVERSAMPLE_RATIO;
+		}
 	}
 	return (sum >> 16) + ((sum >> 15) & 1); // round result
 }
 
 /** Gather #SAMPLE_COUNT ADC samples into #samples and run statistical tests
   * on the sample array.
+  *
+  * The ADC fills the halves of #adc_sample_buffer alternately (see adc.c), so
+  * filtering one half and accumulating its statistics is done while the
+  * other half is being collected. If that processing ever takes so long that
+  * the ADC finishes the other half (and so may have started overwriting the
+  * half being processed), the processed half is thrown away and sampling is
+  * restarted.
   * \return false on success, true if any statistical test failed.
   */
 static bool fillAndTestSamplesArray(void)
 {
 	unsigned int i;
 	unsigned int j;
-	unsigned int base_index;
+	unsigned int half;
 	int32_t filtered_sample;
 	uint32_t tests_failed;
 	fix16_t variance;
 
+	// Nothing else runs while the samples array is being filled and tested,
+	// so the overlay region is only held until the end of this function and
+	// can't be evicted. If the write cache currently holds the region, this
+	// will flush it.
+	hwrng_overlay = ramOverlayAcquire(OVERLAY_HWRNG_TESTS, sizeof(HwrngOverlay), NULL);
+	if (hwrng_overlay == NULL)
+	{
+		return true; // couldn't get memory for tests
+	}
+	statistics_buffers = &(hwrng_overlay->statistics);
 	clearHistogram();
 	clearPowerSpectralDensity();
+	clearHealthTests();
 	samples_consumed = 0;
+	TRACE(TRACE_HWRNG_FILL_BEGIN, 0);
+	// The ADC sample rate is derived from the peripheral bus clock, which
+	// only has its nominal frequency at full clock speed. Filtering and
+	// testing the samples also needs to keep up with the ADC.
+	CLOCK_BOOST_BEGIN();
 
 	// Fill samples array.
 	// The following loop assumes that #SAMPLE_COUNT is a multiple
@@ -402,45 +641,75 @@ static bool fillAndTestSamplesArray(void)
 #if ((SAMPLE_COUNT % DECIMATED_SAMPLE_BUFFER_SIZE) != 0)
 #error "SAMPLE_COUNT not a multiple of DECIMATED_SAMPLE_BUFFER_SIZE"
 #endif // #if ((SAMPLE_COUNT % DECIMATED_SAMPLE_BUFFER_SIZE) != 0)
-	for (i = 0; i < SAMPLE_COUNT; i += DECIMATED_SAMPLE_BUFFER_SIZE)
+	// Statistics are accumulated one half at a time, so the following loop
+	// also assumes that #DECIMATED_SAMPLE_BUFFER_SIZE is a multiple
+	// of #FFT_SIZE * 2.
+#if ((DECIMATED_SAMPLE_BUFFER_SIZE % (FFT_SIZE * 2)) != 0)
+#error "DECIMATED_SAMPLE_BUFFER_SIZE not a multiple of FFT_SIZE * 2"
+#endif // #if ((DECIMATED_SAMPLE_BUFFER_SIZE % (FFT_SIZE * 2)) != 0)
+#ifdef HWRNG_USE_ATSHA204
+	requestATSHA204Block();
+#endif // #ifdef HWRNG_USE_ATSHA204
+	suppressIdleMode(true); // start suppressing CPU idle mode
+	startADCSampling();
+	half = 0;
+	i = 0;
+	while (i < SAMPLE_COUNT)
 	{
-		suppressIdleMode(true); // start suppressing CPU idle mode
-		beginFillingADCBuffer();
-		while (!isADCBufferFull())
+		while (!isADCBufferHalfFull(half))
 		{
-			// do nothing
+#ifdef HWRNG_USE_ATSHA204
+			pollATSHA204();
+#endif // #ifdef HWRNG_USE_ATSHA204
 		}
-		suppressIdleMode(false); // stop suppressing CPU idle mode
+		clearADCBufferHalfFull(half);
 		// Filter ADC samples, placing result into samples array.
+		splitPolyphase(adc_sample_buffer[half]);
 		for (j = 0; j < DECIMATED_SAMPLE_BUFFER_SIZE; j++)
 		{
-			// The "- FILTER_HALF_ORDER" is there to account for the
-			// delay of the low-pass filter.
-			base_index = ((j * OVERSAMPLE_RATIO) - FILTER_HALF_ORDER) & (ADC_SAMPLE_BUFFER_SIZE - 1);
-			filtered_sample = firFilter(adc_sample_buffer, base_index, fir_lowpass_coefficients, FILTER_ORDER);
+			filtered_sample = firFilter(j);
 			samples[i + j] = filtered_sample;
 		}
+		if (isADCBufferHalfFull(half ^ 1))
+		{
+			// The other half was filled while this half was being filtered
+			// (or while the previous half was being tested), so the ADC
+			// may have overwritten some of this half. Start again from
+			// half 0, without advancing through the samples array.
+			TRACE(TRACE_HWRNG_OVERRUN, i);
+			startADCSampling();
+			half = 0;
+			continue;
+		}
+		// Run statistical tests on this part of the samples array, while the
+		// ADC fills the other half.
+		for (j = 0; j < DECIMATED_SAMPLE_BUFFER_SIZE; j++)
+		{
+			incrementHistogram(samples[i + j]);
+			updateHealthTests(samples[i + j]);
+		}
+		for (j = 0; j < DECIMATED_SAMPLE_BUFFER_SIZE; j += (FFT_SIZE * 2))
+		{
+			accumulatePowerSpectralDensity(&(samples[i + j]));
+		}
+		i += DECIMATED_SAMPLE_BUFFER_SIZE;
+		half ^= 1;
 	}
+	stopADCSampling();
+	suppressIdleMode(false); // stop suppressing CPU idle mode
 
-	// Run statistical tests on samples array.
-	for (i = 0; i < SAMPLE_COUNT; i++)
-	{
-		incrementHistogram(samples[i]);
-	}
-	// The following loop assumes that #SAMPLE_COUNT is a multiple
-	// of #FFT_SIZE * 2.
-#if ((SAMPLE_COUNT % (FFT_SIZE * 2)) != 0)
-#error "SAMPLE_COUNT not a multiple of FFT_SIZE * 2"
-#endif // #if ((SAMPLE_COUNT % (FFT_SIZE * 2)) != 0)
-	for (i = 0; i < SAMPLE_COUNT; i += (FFT_SIZE * 2))
-	{
-		accumulatePowerSpectralDensity(&(samples[i]));
-	}
 	tests_failed = histogramTestsFailed(&variance);
 	tests_failed |= fftTestsFailed(variance);
+	tests_failed |= healthTestsFailed();
+	updateEntropyRate();
+	TRACE(TRACE_HWRNG_FILL_END, tests_failed != 0);
+	CLOCK_BOOST_END();
 #ifdef TEST_STATISTICS
 	reportStatistics(tests_failed);
 #endif // #ifdef TEST_STATISTICS
+	statistics_buffers = NULL;
+	hwrng_overlay = NULL;
+	ramOverlayRelease(OVERLAY_HWRNG_TESTS);
 	if (tests_failed != 0)
 	{
 #ifdef IGNORE_HWRNG_FAILURE
@@ -500,10 +769,22 @@ int hardwareRandom32Bytes(uint8_t *buffer)
 	{
 		return -1; // statistical tests indicate HWRNG failure
 	}
-	else
+#ifdef HWRNG_USE_ATSHA204
+	// The ATSHA204 block is only ever used once. XOR is fine for mixing
+	// because the caller hashes the output anyway.
+	pollATSHA204();
+	if (atsha204_block_valid)
 	{
-		return (int)(16.0 * ENTROPY_BITS_PER_SAMPLE);
+		for (i = 0; i < 32; i++)
+		{
+			buffer[i] ^= atsha204_block[i];
+			atsha204_block[i] = 0;
+		}
+		atsha204_block_valid = false;
+		return entropy_bits_per_16_samples + ATSHA204_ENTROPY_BITS;
 	}
+#endif // #ifdef HWRNG_USE_ATSHA204
+	return entropy_bits_per_16_samples;
 }
 
 #ifdef TEST_STATISTICS
@@ -838,10 +1119,7 @@ void __attribute__ ((nomips16)) testStatistics(void)
 
 			asm volatile("mfc0 %0, $9" : "=r"(start_count));
 
-			mean = calculateCentralMoment(fix16_zero, 1);
-			variance = calculateCentralMoment(mean, 2);
-			kappa3 = calculateCentralMoment(mean, 3);
-			kappa4 = calculateCentralMoment(mean, 4);
+			calculateCentralMoments(&mean, &variance, &kappa3, &kappa4);
 			entropy_estimate = estimateEntropy();
 
 			asm volatile("mfc0 %0, $9" : "=r"(end_count)); // read as soon as possible
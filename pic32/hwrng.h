@@ -8,8 +8,14 @@
 #ifndef PIC32_HWRNG_H_INCLUDED
 #define PIC32_HWRNG_H_INCLUDED
 
+#ifdef BACKGROUND_TASKS
+extern void hwrngBackgroundTask(void);
+#endif // #ifdef BACKGROUND_TASKS
 #ifdef TEST_STATISTICS
 extern void __attribute__ ((nomips16)) testStatistics(void);
-#endif // #ifdef TEST_STATISTICS
+#endif // #ifdef BACKGROUND_TASKS
+extern void hwrngBackgroundTask(void);
+#endif // #ifdef BACKGROUND_TASKS
+#ifdef TEST_STATISTICS
 
 #endif // #ifndef PIC32_HWRNG_H_INCLUDED
@@ -162,7 +162,40 @@
   * than #STATTEST_MIN_ENTROPY because the bandwidth of the HWRNG signal is
   * smaller than the Nyquist frequency (see #PSD_MIN_BANDWIDTH) by a factor
   * of about 3. An additional safety factor of 2 has also been incorporated.
+  * This is roughly what the measured estimate (see #ENTROPY_DERATING_FACTOR)
+  * comes to for a HWRNG which only just passes the statistical tests. It is
+  * only used if the measured estimate can't be calculated.
   */
 #define ENTROPY_BITS_PER_SAMPLE		1.0
+/** The entropy credited to each batch of samples is the min-entropy per
+  * sample (from the histogram), scaled by the measured bandwidth of the
+  * HWRNG signal as a fraction of the Nyquist frequency, then divided by this
+  * safety factor. This is the same safety factor as is incorporated
+  * into #ENTROPY_BITS_PER_SAMPLE.
+  */
+#define ENTROPY_DERATING_FACTOR		2.0
+/** Upper limit on the measured entropy (in bits) per sample. The HWRNG
+  * signal hasn't been characterised beyond this, and the health test
+  * cutoffs (see #REPETITION_COUNT_CUTOFF) assume much less, so a measurement
+  * above this is more likely to indicate a problem with the estimate than
+  * an unusually good noise source.
+  */
+#define MAX_ENTROPY_BITS_PER_SAMPLE	4.0
+
+/** Cutoff for the repetition count test (see updateHealthTests()). A run of
+  * this many identical consecutive samples is a failure. This was calculated
+  * using the formula in section 4.4.1 of NIST SP 800-90B, with a false
+  * positive probability of 2 ^ -20 and #ENTROPY_BITS_PER_SAMPLE bits of
+  * entropy per sample: 1 + ceil(20 / 1.0) = 21.
+  */
+#define REPETITION_COUNT_CUTOFF		21
+/** Cutoff for the adaptive proportion test (see updateHealthTests()). If the
+  * first sample of a window occurs this many times within
+  * the #PROPORTION_WINDOW_SIZE samples of that window, the test fails. This
+  * is the critical value of a binomial distribution (N = 512, p = 0.5) for a
+  * false positive probability of 2 ^ -20, as listed in section 4.4.2 of
+  * NIST SP 800-90B for 1 bit of entropy per sample.
+  */
+#define ADAPTIVE_PROPORTION_CUTOFF	410
 
 #endif // #ifndef PIC32_HWRNG_LIMITS_H_INCLUDED
@@ -24,10 +24,14 @@
 #include "../hwinterface.h"
 #include "../endian.h"
 #include "../stream_comm.h"
+#include "../wallet.h"
 
 #ifdef TEST_FFT
 #include "test_fft.h"
 #endif // #ifdef TEST_FFT
+#ifdef TEST_CRYPTO_BENCH
+#include "../crypto_bench.h"
+#endif // #ifdef TEST_CRYPTO_BENCH
 
 /** This will be called whenever an unrecoverable error occurs. This should
   * not return. */
@@ -65,6 +69,48 @@ uint32_t getPBKDF2Iterations(void)
 	return 128;
 }
 
+#ifdef BACKGROUND_TASKS
+/** The type of a background task. Each call should do a small, bounded
+  * amount of work and then return; a task which has nothing to do should
+  * return straight away. See backgroundYield() in hwinterface.h for what
+  * background tasks must not do. */
+typedef void (*BackgroundTask)(void);
+
+/** Background tasks, in the order in which they are run
+  * by backgroundYield(). */
+static const BackgroundTask background_tasks[] = {
+	hwrngBackgroundTask
+#ifndef WALLET_NO_ADDRESS_CACHE
+	, precomputeAddressTask
+#endif // #ifndef WALLET_NO_ADDRESS_CACHE
+	};
+
+/** Whether backgroundYield() is running. This stops a background task which
+  * reaches a yield point from running all the background tasks again. */
+static bool in_background_task;
+
+/** Run each background task once. This is a simple cooperative scheduler:
+  * long operations call this (via BACKGROUND_YIELD()) and while the stream is
+  * waiting for the host, and the tasks do a bit of work each time. USB
+  * transfers, ADC sampling and display DMA don't need to be here, since
+  * they are driven by interrupts or DMA anyway.
+  */
+void backgroundYield(void)
+{
+	unsigned int i;
+
+	if (!in_background_task)
+	{
+		in_background_task = true;
+		for (i = 0; i < (sizeof(background_tasks) / sizeof(background_tasks[0])); i++)
+		{
+			background_tasks[i]();
+		}
+		in_background_task = false;
+	}
+}
+#endif // #ifdef BACKGROUND_TASKS
+
 /** Entry point. This is the first thing which is called after startup code.
   * This never returns. */
 int main(void)
@@ -89,7 +135,6 @@ int main(void)
 	DDPCONbits.JTAGEN = 0;
 
 	pic32SystemInit();
-	initSSD1306();
 	initPushButtons();
 	initSST25x();
 	initATSHA204();
@@ -111,6 +156,15 @@ int main(void)
 	// calling usbConnect().
 	usbConnect();
 
+	// Display initialisation involves clearing all of GDDRAM over SPI,
+	// which takes a while. Doing it after usbConnect() means that
+	// enumeration (which is interrupt-driven) proceeds in the meantime, so
+	// the host can start sending requests sooner. Nothing before the main
+	// loop writes to the display.
+	// This must be after initADC() because initADC() resets the DMA
+	// controller.
+	initSSD1306();
+
 #ifdef TEST_MODE
 	mode = streamGetOneByte();
 	if (mode == 'd')
@@ -242,7 +296,12 @@ int main(void)
 	{
 		// do nothing
 	}
+#elif TEST_CRYPTO_BENCH
+	benchmarkCrypto(2); // Count register increments every 2 CPU cycles
 #else
+	// If a format was interrupted (eg. by a loss of power), finish it
+	// before doing anything else.
+	finishInterruptedSanitisation();
 	while (true)
 	{
 		processPacket();
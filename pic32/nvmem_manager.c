@@ -9,9 +9,42 @@
   * to wear out much more quickly.
   *
   * To deal with this problem, the functions in this file implement a
-  * translation layer which uses a cache to accumulate writes within a sector.
-  * nonVolatileFlush() can then be used to actually write the sector to
-  * flash memory.
+  * translation layer which uses a cache to accumulate writes within a few
+  * sectors. nonVolatileFlush() can then be used to actually write the
+  * sectors to flash memory. When a write needs a sector which isn't cached,
+  * the least recently used sector is written back to make room for it.
+  *
+  * The layout of the partitions (see sst25x.h) is sector-aligned, so a
+  * write to one partition never causes a sector belonging to another
+  * partition to be rewritten. The global partition is much hotter than the
+  * accounts partition, so it is wear-levelled: it rotates between
+  * #GLOBAL_PARTITION_SECTORS physical sectors. Each one ends with a sequence
+  * number, and the one with the highest valid sequence number is the
+  * current copy. Whenever a write to the global partition needs an erase,
+  * the new contents (with the next sequence number) are programmed into
+  * the next sector in rotation instead. The sequence number is the last
+  * thing to be programmed, so if power is lost part way through, the
+  * previous copy remains current. Writes which only need to clear bits are
+  * still done in place, so each write costs at most one sector erase no
+  * matter how big the flash is.
+  *
+  * The write cache is only needed while there are writes which haven't been
+  * flushed, so it doesn't have memory of its own. It borrows the RAM overlay
+  * region (see ram_overlay.c) on the first write after a flush, and gives it
+  * back once everything has been written back. If another subsystem needs
+  * the region in the meantime, the write cache is flushed early.
+  *
+  * If NV_STATISTICS is defined, every sector erase is counted, and the time
+  * taken by each nonVolatileFlush() is measured. These statistics are kept
+  * in #STATISTICS_SECTORS reserved sectors after the accounts partition, so
+  * that they cover the whole life of the device. Each record (see
+  * #STATISTICS_RECORD_SIZE) is appended after the previous one, and starts
+  * with a sequence number like the global partition's, so the current one
+  * is the valid one with the highest sequence number. When a sector is
+  * full, the next one is erased and used. A record is only written when
+  * nonVolatileFlush() finds that some sector has been erased since the last
+  * one, so this adds about one erase for every
+  * #STATISTICS_RECORDS_PER_SECTOR data erases.
   *
   * This file is licensed as described by the file LICENCE.
   */
@@ -19,22 +52,160 @@
 #include <stdint.h>
 #include <string.h>
 #include "../hwinterface.h"
+#include "../endian.h"
+#include "../trace.h"
 #include "sst25x.h"
+#include "ram_overlay.h"
+
+#if defined(NV_STATISTICS) && !defined(STREAM_COMM_PROFILE)
+#error "NV_STATISTICS requires STREAM_COMM_PROFILE"
+#endif
+
+// WRITE_CACHE_ENTRIES (the number of sectors which the write cache can hold)
+// is defined in ram_overlay.h, since it determines the size of the overlay
+// region. Each entry uses #SECTOR_SIZE bytes of RAM. More than one entry
+// means that writes which alternate between sectors (for example, between
+// the entropy pool in #PARTITION_GLOBAL and a wallet in #PARTITION_ACCOUNTS)
+// don't force a sector erase every time they switch sectors.
 
-/** Whether write cache is valid. */
-static bool write_cache_valid;
-/** Sector address of current contents of write cache. This is only
-  * well-defined if #write_cache_valid is true. */
-static uint32_t write_cache_tag;
-/** Current contents of write cache. This is only well-defined
-  * if #write_cache_valid is true. */
-static uint8_t write_cache[SECTOR_SIZE];
+/** One entry in the write cache. Entries only become valid when they are
+  * written to, so every valid entry is also dirty. */
+typedef struct WriteCacheEntryStruct
+{
+	/** Whether this entry is valid. */
+	bool valid;
+	/** Sector address of current contents of this entry. This is only
+	  * well-defined if valid is true. */
+	uint32_t tag;
+	/** Value of #write_cache_clock when this entry was last used. This is
+	  * used to determine which entry is least recently used. */
+	uint32_t last_used;
+	/** Current contents of this entry. This is only well-defined
+	  * if valid is true. */
+	uint8_t data[SECTOR_SIZE];
+} WriteCacheEntry;
+
+/** The write cache. Writes are accumulated here until nonVolatileFlush()
+  * is called, or until a write to another sector needs an entry. This
+  * points into the RAM overlay region, and is NULL whenever the write cache
+  * doesn't own that region (in which case every entry is invalid). */
+static WriteCacheEntry *write_cache;
+/** Incremented every time a write cache entry is used. */
+static uint32_t write_cache_clock;
+
+/** Whether #global_sector and #global_sequence have been set by
+  * findGlobalSector(). */
+static bool global_sector_found;
+/** Physical address of the sector which holds the current copy of the
+  * global partition. This is only well-defined if #global_sector_found is
+  * true. */
+static uint32_t global_sector;
+/** Sequence number of the current copy of the global partition. This is
+  * only well-defined if #global_sector_found is true. */
+static uint32_t global_sequence;
+
+#ifdef NV_STATISTICS
+/** Size, in bytes, of each record in the statistics sectors. Each record
+  * consists of:
+  * - the sequence number (4 bytes), at offset 0;
+  * - the ones' complement of the sequence number (4 bytes), at offset 4;
+  * - the flush count (4 bytes), at offset 8;
+  * - the longest flush time, in cycles (4 bytes), at offset 12;
+  * - the total flush time, in cycles (8 bytes), at offset 16;
+  * - the erase counter of each sector (4 bytes each), starting at
+  *   offset 24.
+  * Everything is little-endian.
+  */
+#define STATISTICS_RECORD_SIZE	(24 + 4 * ERASE_COUNTED_SECTORS)
+/** Number of records which fit in one statistics sector. */
+#define STATISTICS_RECORDS_PER_SECTOR	(SECTOR_SIZE / STATISTICS_RECORD_SIZE)
+
+#if STATISTICS_SECTORS < 2
+#error "STATISTICS_SECTORS must be at least 2"
+#endif
+#if STATISTICS_RECORDS_PER_SECTOR < 1
+#error "Statistics record doesn't fit in a sector"
+#endif
+
+/** Current flush statistics. The num_erase_counters field isn't used;
+  * see #erase_counts instead. */
+static NVStatistics nv_statistics;
+/** Number of times each sector has been erased, indexed by physical sector
+  * number. */
+static uint32_t erase_counts[ERASE_COUNTED_SECTORS];
+/** Whether #nv_statistics and #erase_counts have been read from flash
+  * memory yet. */
+static bool statistics_loaded;
+/** Whether a new record needs to be written at the next nonVolatileFlush(),
+  * because a sector has been erased. */
+static bool statistics_dirty;
+/** Sequence number of the current record. */
+static uint32_t statistics_sequence;
+/** Flash memory address where the next record will be written. */
+static uint32_t statistics_next_address;
+#endif // #ifdef NV_STATISTICS
 
 /** Bitmask applied to addresses to get the sector address. */
 #define SECTOR_TAG_MASK			(~(SECTOR_SIZE - 1))
 /** Bitmask applied to addresses to get the offset within a sector. */
 #define SECTOR_OFFSET_MASK		(SECTOR_SIZE - 1)
 
+/** Find the current copy of the global partition, by looking for the
+  * valid sequence number which is highest. A sequence number is valid if
+  * it is followed by its ones' complement; erased (all 1s) or all 0s
+  * sectors are never valid. If no sector has a valid sequence number (for
+  * example, when the flash is new), then the first sector is used. This
+  * sets #global_sector, #global_sequence and #global_sector_found.
+  */
+static void findGlobalSector(void)
+{
+	unsigned int i;
+	uint8_t header[GLOBAL_SECTOR_HEADER_SIZE];
+	uint32_t sequence;
+	bool found_valid;
+
+	global_sector = 0;
+	global_sequence = 0;
+	found_valid = false;
+	for (i = 0; i < GLOBAL_PARTITION_SECTORS; i++)
+	{
+		sst25xRead(header, i * SECTOR_SIZE + GLOBAL_PARTITION_SIZE, sizeof(header));
+		sequence = readU32LittleEndian(header);
+		if ((readU32LittleEndian(&(header[4])) == ~sequence)
+			&& (!found_valid || (sequence > global_sequence)))
+		{
+			global_sector = i * SECTOR_SIZE;
+			global_sequence = sequence;
+			found_valid = true;
+		}
+	}
+	global_sector_found = true;
+}
+
+/** Convert a non-volatile memory offset (as produced by
+  * checkAndTweakAddress()) into a flash memory address. The global
+  * partition occupies non-volatile memory offsets 0 to #SECTOR_SIZE - 1,
+  * but physically it is wherever the current copy is. Everything else is
+  * stored at the same address in flash memory.
+  * \param address Non-volatile memory offset to convert.
+  * \return The corresponding flash memory address.
+  */
+static uint32_t physicalAddress(uint32_t address)
+{
+	if (address < SECTOR_SIZE)
+	{
+		if (!global_sector_found)
+		{
+			findGlobalSector();
+		}
+		return global_sector + address;
+	}
+	else
+	{
+		return address;
+	}
+}
+
 /** Get size of a partition.
   * \param out_size On success, the size of the partition (in number of bytes)
   *                 will be written here.
@@ -96,11 +267,429 @@ static NonVolatileReturn checkAndTweakAddress(uint32_t *address, NVPartitions pa
     // non-volatile memory offset.
     if (partition == PARTITION_ACCOUNTS)
     {
-        *address += GLOBAL_PARTITION_SIZE;
+        *address += ACCOUNTS_PARTITION_START;
     }
     return NV_NO_ERROR;
 }
 
+#ifdef NV_STATISTICS
+/** Read the current statistics record from the statistics sectors (see the
+  * comments at the top of this file), and work out where the next one
+  * goes. If there is no valid record (for example, when the flash is new),
+  * all statistics start at 0. This sets #statistics_loaded.
+  */
+static void loadStatistics(void)
+{
+	unsigned int i;
+	unsigned int j;
+	uint32_t address;
+	uint32_t sequence;
+	uint32_t current_address;
+	bool found_valid;
+	uint8_t record[STATISTICS_RECORD_SIZE];
+
+	found_valid = false;
+	current_address = STATISTICS_START;
+	statistics_sequence = 0;
+	for (i = 0; i < STATISTICS_SECTORS; i++)
+	{
+		for (j = 0; j < STATISTICS_RECORDS_PER_SECTOR; j++)
+		{
+			address = STATISTICS_START + i * SECTOR_SIZE + j * STATISTICS_RECORD_SIZE;
+			sst25xRead(record, address, 8);
+			sequence = readU32LittleEndian(record);
+			if ((readU32LittleEndian(&(record[4])) == ~sequence)
+				&& (!found_valid || (sequence > statistics_sequence)))
+			{
+				current_address = address;
+				statistics_sequence = sequence;
+				found_valid = true;
+			}
+		}
+	}
+
+	memset(&nv_statistics, 0, sizeof(nv_statistics));
+	memset(erase_counts, 0, sizeof(erase_counts));
+	if (found_valid)
+	{
+		sst25xRead(record, current_address, STATISTICS_RECORD_SIZE);
+		nv_statistics.flush_count = readU32LittleEndian(&(record[8]));
+		nv_statistics.flush_max_cycles = readU32LittleEndian(&(record[12]));
+		nv_statistics.flush_total_cycles = readU32LittleEndian(&(record[16]));
+		nv_statistics.flush_total_cycles |= (uint64_t)readU32LittleEndian(&(record[20])) << 32;
+		for (i = 0; i < ERASE_COUNTED_SECTORS; i++)
+		{
+			erase_counts[i] = readU32LittleEndian(&(record[24 + 4 * i]));
+		}
+		statistics_next_address = current_address + STATISTICS_RECORD_SIZE;
+	}
+	else
+	{
+		// This makes writeStatistics() start by erasing the first sector.
+		statistics_next_address = STATISTICS_START + STATISTICS_SECTORS * SECTOR_SIZE;
+	}
+	statistics_loaded = true;
+}
+
+/** Erase a sector of flash memory, and count the erase.
+  * \param physical The flash memory address of the sector.
+  */
+static void eraseSector(uint32_t physical)
+{
+	if (!statistics_loaded)
+	{
+		loadStatistics();
+	}
+	sst25xEraseSector(physical);
+	if ((physical / SECTOR_SIZE) < ERASE_COUNTED_SECTORS)
+	{
+		erase_counts[physical / SECTOR_SIZE]++;
+	}
+	statistics_dirty = true;
+}
+
+/** Append a new record, containing the current statistics, to the statistics
+  * sectors. The record is written into the next unused slot; if there
+  * isn't one left in the current sector, the next sector is erased first.
+  * The sequence number is programmed last, so that if power is lost part way
+  * through, the previous record remains current.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+static NonVolatileReturn writeStatistics(void)
+{
+	unsigned int i;
+	unsigned int attempts;
+	uint32_t offset;
+	uint32_t sector;
+	bool blank;
+	uint8_t record[STATISTICS_RECORD_SIZE];
+	uint8_t read_buffer[STATISTICS_RECORD_SIZE];
+
+	// Look for a slot which is completely erased. A slot may have been
+	// partially programmed if power was lost while it was being written,
+	// in which case it is skipped.
+	blank = false;
+	for (attempts = 0; !blank && (attempts < (STATISTICS_SECTORS * STATISTICS_RECORDS_PER_SECTOR)); attempts++)
+	{
+		offset = (statistics_next_address - STATISTICS_START) % SECTOR_SIZE;
+		if ((statistics_next_address >= (STATISTICS_START + STATISTICS_SECTORS * SECTOR_SIZE))
+			|| ((offset + STATISTICS_RECORD_SIZE) > SECTOR_SIZE))
+		{
+			// Move on to the start of the next sector, wrapping around.
+			sector = (statistics_next_address - STATISTICS_START) / SECTOR_SIZE;
+			if ((offset + STATISTICS_RECORD_SIZE) > SECTOR_SIZE)
+			{
+				sector++;
+			}
+			if (sector >= STATISTICS_SECTORS)
+			{
+				sector = 0;
+			}
+			statistics_next_address = STATISTICS_START + sector * SECTOR_SIZE;
+			eraseSector(statistics_next_address);
+		}
+		sst25xRead(read_buffer, statistics_next_address, STATISTICS_RECORD_SIZE);
+		blank = true;
+		for (i = 0; i < STATISTICS_RECORD_SIZE; i++)
+		{
+			if (read_buffer[i] != 0xff)
+			{
+				blank = false;
+			}
+		}
+		if (!blank)
+		{
+			statistics_next_address += STATISTICS_RECORD_SIZE;
+		}
+	}
+	if (!blank)
+	{
+		return NV_IO_ERROR; // erase did not complete properly
+	}
+
+	writeU32LittleEndian(&(record[0]), statistics_sequence + 1);
+	writeU32LittleEndian(&(record[4]), ~(statistics_sequence + 1));
+	writeU32LittleEndian(&(record[8]), nv_statistics.flush_count);
+	writeU32LittleEndian(&(record[12]), nv_statistics.flush_max_cycles);
+	writeU32LittleEndian(&(record[16]), (uint32_t)nv_statistics.flush_total_cycles);
+	writeU32LittleEndian(&(record[20]), (uint32_t)(nv_statistics.flush_total_cycles >> 32));
+	for (i = 0; i < ERASE_COUNTED_SECTORS; i++)
+	{
+		writeU32LittleEndian(&(record[24 + 4 * i]), erase_counts[i]);
+	}
+	sst25xProgramWords(&(record[8]), statistics_next_address + 8, STATISTICS_RECORD_SIZE - 8);
+	sst25xProgramWords(record, statistics_next_address, 8);
+	sst25xRead(read_buffer, statistics_next_address, STATISTICS_RECORD_SIZE);
+	statistics_next_address += STATISTICS_RECORD_SIZE;
+	if (memcmp(read_buffer, record, STATISTICS_RECORD_SIZE))
+	{
+		return NV_IO_ERROR; // program did not complete properly
+	}
+	statistics_sequence++;
+	statistics_dirty = false;
+	return NV_NO_ERROR;
+}
+
+/** Get wear and latency statistics for non-volatile storage. The erase
+  * counters cover every sector up to the end of the statistics sectors.
+  * \param out_statistics The statistics will be written here.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+NonVolatileReturn nonVolatileGetStatistics(NVStatistics *out_statistics)
+{
+	if (!statistics_loaded)
+	{
+		loadStatistics();
+	}
+	memcpy(out_statistics, &nv_statistics, sizeof(NVStatistics));
+	out_statistics->num_erase_counters = ERASE_COUNTED_SECTORS;
+	return NV_NO_ERROR;
+}
+
+/** Get the number of times one sector of flash memory has been erased.
+  * \param out_count On success, the erase count will be written here.
+  * \param unit Physical sector number of the sector to query.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+NonVolatileReturn nonVolatileGetEraseCount(uint32_t *out_count, uint32_t unit)
+{
+	if (unit >= ERASE_COUNTED_SECTORS)
+	{
+		return NV_INVALID_ADDRESS;
+	}
+	if (!statistics_loaded)
+	{
+		loadStatistics();
+	}
+	*out_count = erase_counts[unit];
+	return NV_NO_ERROR;
+}
+
+/** Reset the flush latency statistics. The reset only reaches flash memory
+  * when the next record is written.
+  */
+void nonVolatileResetFlushStatistics(void)
+{
+	if (!statistics_loaded)
+	{
+		loadStatistics();
+	}
+	nv_statistics.flush_count = 0;
+	nv_statistics.flush_total_cycles = 0;
+	nv_statistics.flush_max_cycles = 0;
+}
+#else
+/** Erase a sector of flash memory. Without NV_STATISTICS, erases aren't
+  * counted. */
+#define eraseSector(physical)	sst25xEraseSector(physical)
+#endif // #ifdef NV_STATISTICS
+
+/** Find the write cache entry which holds a sector.
+  * \param tag Sector address of the sector to look for.
+  * \return A pointer to the entry, or NULL if the sector isn't in the write
+  *         cache.
+  */
+static WriteCacheEntry *findWriteCacheEntry(uint32_t tag)
+{
+	unsigned int i;
+
+	if (write_cache == NULL)
+	{
+		return NULL;
+	}
+	for (i = 0; i < WRITE_CACHE_ENTRIES; i++)
+	{
+		if (write_cache[i].valid && (write_cache[i].tag == tag))
+		{
+			return &(write_cache[i]);
+		}
+	}
+	return NULL;
+}
+
+/** Choose a write cache entry to load a new sector into. Invalid entries
+  * are preferred; otherwise the least recently used entry is chosen.
+  * \return A pointer to the chosen entry. If the entry is valid, it must be
+  *         written back (using flushWriteCacheEntry()) before it is reused.
+  */
+static WriteCacheEntry *leastRecentlyUsedEntry(void)
+{
+	unsigned int i;
+	WriteCacheEntry *lru;
+
+	lru = &(write_cache[0]);
+	for (i = 0; i < WRITE_CACHE_ENTRIES; i++)
+	{
+		if (!write_cache[i].valid)
+		{
+			return &(write_cache[i]);
+		}
+		// Subtracting from the clock means that this still works after
+		// the clock wraps around.
+		if ((write_cache_clock - write_cache[i].last_used) > (write_cache_clock - lru->last_used))
+		{
+			lru = &(write_cache[i]);
+		}
+	}
+	return lru;
+}
+
+/** Write back one write cache entry to flash memory and then invalidate it.
+  * The sector is only erased if some bit needs to go from 0 to 1. Otherwise,
+  * only the words which have changed are programmed. This is much quicker
+  * and causes less wear, since many updates (for example, incrementing a
+  * counter or filling in a previously erased area) only clear bits. If the
+  * entry holds the global partition and an erase is needed, the next sector
+  * in rotation is erased and programmed instead (see the comments at the
+  * top of this file).
+  * \param entry The entry to write back. This must be valid.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+static NonVolatileReturn flushWriteCacheEntry(WriteCacheEntry *entry)
+{
+	unsigned int i;
+	unsigned int run_start;
+	bool need_erase;
+	bool rotate;
+	uint32_t physical;
+	uint8_t read_buffer[SECTOR_SIZE];
+
+	if (entry->tag >= NV_MEMORY_SIZE)
+	{
+		return NV_INVALID_ADDRESS;
+	}
+
+	physical = physicalAddress(entry->tag);
+	sst25xRead(read_buffer, physical, SECTOR_SIZE);
+	need_erase = false;
+	for (i = 0; i < SECTOR_SIZE; i++)
+	{
+		if ((entry->data[i] & (uint8_t)~read_buffer[i]) != 0)
+		{
+			need_erase = true; // a bit needs to go from 0 to 1
+		}
+	}
+
+	rotate = false;
+	if (need_erase && (entry->tag == 0))
+	{
+		// Write the global partition to the next sector in rotation, with
+		// the next sequence number.
+		rotate = true;
+		physical += SECTOR_SIZE;
+		if (physical >= ACCOUNTS_PARTITION_START)
+		{
+			physical = 0;
+		}
+		writeU32LittleEndian(&(entry->data[GLOBAL_PARTITION_SIZE]), global_sequence + 1);
+		writeU32LittleEndian(&(entry->data[GLOBAL_PARTITION_SIZE + 4]), ~(global_sequence + 1));
+	}
+
+	if (need_erase)
+	{
+		// Erase sector and verify erase.
+		eraseSector(physical);
+		sst25xRead(read_buffer, physical, SECTOR_SIZE);
+		for (i = 0; i < SECTOR_SIZE; i++)
+		{
+			if (read_buffer[i] != 0xff)
+			{
+				return NV_IO_ERROR; // erase did not complete properly
+			}
+		}
+
+		// Program sector.
+		sst25xProgramSector(entry->data, physical);
+	}
+	else
+	{
+		// Bytes which haven't changed are programmed with 0xff, which leaves
+		// them alone. Changed bytes can never be 0xff here, since that would
+		// require a bit to go from 0 to 1.
+		for (i = 0; i < SECTOR_SIZE; i++)
+		{
+			if (read_buffer[i] == entry->data[i])
+			{
+				read_buffer[i] = 0xff;
+			}
+			else
+			{
+				read_buffer[i] = entry->data[i];
+			}
+		}
+		// Program each run of changed words with one auto-address increment
+		// sequence.
+		i = 0;
+		while (i < SECTOR_SIZE)
+		{
+			if ((read_buffer[i] == 0xff) && (read_buffer[i + 1] == 0xff))
+			{
+				i += 2;
+			}
+			else
+			{
+				run_start = i;
+				while ((i < SECTOR_SIZE)
+					&& ((read_buffer[i] != 0xff) || (read_buffer[i + 1] != 0xff)))
+				{
+					i += 2;
+				}
+				sst25xProgramWords(&(read_buffer[run_start]), physical + run_start, i - run_start);
+			}
+		}
+	}
+
+	// Verify program.
+	sst25xRead(read_buffer, physical, SECTOR_SIZE);
+	if (memcmp(read_buffer, entry->data, SECTOR_SIZE))
+	{
+		if (rotate)
+		{
+			// Don't let a bad copy become current after a reset.
+			eraseSector(physical);
+		}
+		return NV_IO_ERROR; // program did not complete properly
+	}
+	if (rotate)
+	{
+		global_sector = physical;
+		global_sequence++;
+	}
+
+	entry->valid = false;
+	entry->tag = 0;
+	memset(entry->data, 0, sizeof(entry->data));
+	return NV_NO_ERROR;
+}
+
+/** Eviction function for the write cache (see #RamOverlayEvictFunction).
+  * This writes back everything in the write cache, which also gives the
+  * overlay region back.
+  * \return false on success, true if something couldn't be written back.
+  */
+static bool evictWriteCache(void)
+{
+	return nonVolatileFlush() != NV_NO_ERROR;
+}
+
+/** Give the write cache some memory, by borrowing the RAM overlay region (if
+  * it hasn't already been borrowed). Every entry starts off invalid.
+  * \return false on success, true if the region couldn't be borrowed.
+  */
+static bool acquireWriteCache(void)
+{
+	if (write_cache == NULL)
+	{
+		write_cache = ramOverlayAcquire(OVERLAY_WRITE_CACHE, sizeof(WriteCacheEntry) * WRITE_CACHE_ENTRIES, &evictWriteCache);
+		if (write_cache == NULL)
+		{
+			return true;
+		}
+		memset(write_cache, 0, sizeof(WriteCacheEntry) * WRITE_CACHE_ENTRIES);
+	}
+	return false;
+}
+
 /** Write to non-volatile storage. All platform-independent code assumes that
   * non-volatile memory acts like NOR flash/EEPROM: arbitrary bits may be
   * reset from 1 to 0 ("programmed") in any order, but setting bits
@@ -118,7 +707,8 @@ extern NonVolatileReturn nonVolatileWrite(uint8_t *data, NVPartitions partition,
 {
 	uint32_t address_tag;
 	uint32_t end; // exclusive
-	uint32_t data_index;
+	uint32_t chunk_length;
+	WriteCacheEntry *entry;
 	NonVolatileReturn r;
 
     r = checkAndTweakAddress(&address, partition, length);
@@ -126,36 +716,173 @@ extern NonVolatileReturn nonVolatileWrite(uint8_t *data, NVPartitions partition,
     {
         return r;
     }
+	if (acquireWriteCache())
+	{
+		return NV_IO_ERROR;
+	}
 
 	end = address + length;
-	data_index = 0;
 	while (address < end)
 	{
 		address_tag = address & SECTOR_TAG_MASK;
-		if (!write_cache_valid || (address_tag != write_cache_tag))
+		entry = findWriteCacheEntry(address_tag);
+		if (entry == NULL)
 		{
-			// Address is not in cache; load sector into cache.
-			if (write_cache_valid)
+			// Address is not in cache; load sector into the least recently
+			// used entry, writing back that entry if necessary.
+			entry = leastRecentlyUsedEntry();
+			if (entry->valid)
 			{
-				r = nonVolatileFlush();
+				TRACE(TRACE_NV_FLUSH_BEGIN, entry->tag / SECTOR_SIZE);
+				r = flushWriteCacheEntry(entry);
+				TRACE(TRACE_NV_FLUSH_END, r);
 				if (r != NV_NO_ERROR)
 				{
 					return r;
 				}
 			}
-			write_cache_valid = true;
-			write_cache_tag = address_tag;
-			sst25xRead(write_cache, address_tag, SECTOR_SIZE);
+			entry->valid = true;
+			entry->tag = address_tag;
+			sst25xRead(entry->data, physicalAddress(address_tag), SECTOR_SIZE);
 		}
-		// Address is guaranteed to be in cache; write to the cache.
-		write_cache[address & SECTOR_OFFSET_MASK] = data[data_index];
-		address++;
-		data_index++;
+		entry->last_used = write_cache_clock++;
+		// Address is guaranteed to be in cache; write as much as possible
+		// of this sector to the cache.
+		chunk_length = address_tag + SECTOR_SIZE - address;
+		if (chunk_length > (end - address))
+		{
+			chunk_length = end - address;
+		}
+		memcpy(&(entry->data[address & SECTOR_OFFSET_MASK]), data, chunk_length);
+		data += chunk_length;
+		address += chunk_length;
 	}
 	return NV_NO_ERROR;
 }
 
-/** Read from non-volatile storage.
+#ifdef NATIVE_NV_FILL
+/** Fill an entire sector of flash memory with one byte value, without going
+  * through the write cache. 0xff only needs an erase and 0x00 only needs
+  * programming (since programming can always clear bits); anything else
+  * needs both.
+  * \param pattern The byte value to fill the sector with.
+  * \param physical The flash memory address of the sector. This must be
+  *                 aligned to a multiple of #SECTOR_SIZE.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+static NonVolatileReturn fillSector(uint8_t pattern, uint32_t physical)
+{
+	unsigned int i;
+	unsigned int j;
+	uint8_t read_buffer[256];
+
+	if (pattern != 0x00)
+	{
+		eraseSector(physical);
+	}
+	if (pattern != 0xff)
+	{
+		sst25xProgramPattern(pattern, physical, SECTOR_SIZE);
+	}
+
+	// Verify erase/program. This is done in chunks so that the whole sector
+	// doesn't need to be on the stack.
+	for (i = 0; i < SECTOR_SIZE; i += sizeof(read_buffer))
+	{
+		sst25xRead(read_buffer, physical + i, sizeof(read_buffer));
+		for (j = 0; j < sizeof(read_buffer); j++)
+		{
+			if (read_buffer[j] != pattern)
+			{
+				return NV_IO_ERROR; // erase/program did not complete properly
+			}
+		}
+	}
+	return NV_NO_ERROR;
+}
+
+/** Fill a range of non-volatile storage with one byte value. Whole sectors
+  * outside the global partition are filled directly (see fillSector()),
+  * discarding any cached writes to them, since they would be overwritten
+  * anyway. That avoids the read, compare and full program which
+  * flushWriteCacheEntry() would do for each sector. The rest of the range
+  * (the partial sectors at each end, and the global partition, which must
+  * keep its sequence number) is written through the write cache as usual.
+  * \param pattern The byte value to fill the range with.
+  * \param partition The partition to write to. Must be one of #NVPartitions.
+  * \param address Byte offset specifying where in the partition to
+  *                start writing to.
+  * \param length The number of bytes to write.
+  * \return See #NonVolatileReturnEnum for return values.
+  * \warning Writes may be buffered; use nonVolatileFlush() to be sure that
+  *          data is actually written to non-volatile storage.
+  */
+extern NonVolatileReturn nonVolatileFill(uint8_t pattern, NVPartitions partition, uint32_t address, uint32_t length)
+{
+	uint32_t address_tag;
+	uint32_t end; // exclusive
+	uint32_t chunk_length;
+	uint32_t partition_start;
+	WriteCacheEntry *entry;
+	NonVolatileReturn r;
+	uint8_t buffer[32];
+
+	partition_start = address;
+	r = checkAndTweakAddress(&address, partition, length);
+	if (r != NV_NO_ERROR)
+	{
+		return r;
+	}
+	// Partial sectors are written using nonVolatileWrite(), which expects
+	// partition offsets, not non-volatile memory offsets.
+	partition_start = address - partition_start;
+
+	memset(buffer, pattern, sizeof(buffer));
+	end = address + length;
+	while (address < end)
+	{
+		address_tag = address & SECTOR_TAG_MASK;
+		chunk_length = address_tag + SECTOR_SIZE - address;
+		if (chunk_length > (end - address))
+		{
+			chunk_length = end - address;
+		}
+		if ((address_tag != 0) && (chunk_length == SECTOR_SIZE))
+		{
+			entry = findWriteCacheEntry(address_tag);
+			if (entry != NULL)
+			{
+				entry->valid = false;
+				entry->tag = 0;
+				memset(entry->data, 0, sizeof(entry->data));
+			}
+			TRACE(TRACE_NV_FLUSH_BEGIN, address_tag / SECTOR_SIZE);
+			r = fillSector(pattern, address_tag);
+			TRACE(TRACE_NV_FLUSH_END, r);
+		}
+		else
+		{
+			if (chunk_length > sizeof(buffer))
+			{
+				chunk_length = sizeof(buffer);
+			}
+			r = nonVolatileWrite(buffer, partition, address - partition_start, chunk_length);
+		}
+		if (r != NV_NO_ERROR)
+		{
+			return r;
+		}
+		address += chunk_length;
+	}
+	return NV_NO_ERROR;
+}
+#endif // #ifdef NATIVE_NV_FILL
+
+/** Read from non-volatile storage. Parts of the range which lie in a sector
+  * held by the write cache are read from the cache, so buffered writes are
+  * visible immediately and never need to be flushed first. The other parts
+  * are read from flash memory, grouping contiguous runs into as few
+  * sst25xRead() calls as possible.
   * \param data A pointer to the buffer which will receive the data.
   * \param partition The partition to read from. Must be one of #NVPartitions.
   * \param address Byte offset specifying where in the partition to
@@ -168,7 +895,9 @@ extern NonVolatileReturn nonVolatileRead(uint8_t *data, NVPartitions partition,
 	uint32_t address_tag;
 	uint32_t end; // exclusive
 	uint32_t nv_read_length; // length of contiguous non-volatile read
+	uint32_t chunk_length;
 	uint32_t data_index;
+	WriteCacheEntry *entry;
     NonVolatileReturn r;
 
 	r = checkAndTweakAddress(&address, partition, length);
@@ -190,72 +919,100 @@ extern NonVolatileReturn nonVolatileRead(uint8_t *data, NVPartitions partition,
 	while (address < end)
 	{
 		address_tag = address & SECTOR_TAG_MASK;
-		if (write_cache_valid && (address_tag == write_cache_tag))
+		chunk_length = address_tag + SECTOR_SIZE - address;
+		if (chunk_length > (end - address))
+		{
+			chunk_length = end - address;
+		}
+		entry = findWriteCacheEntry(address_tag);
+		if (entry != NULL)
 		{
 			if (nv_read_length > 0)
 			{
 				// Beginning of write cache; end of contiguous non-volatile
 				// read.
-				sst25xRead(&(data[data_index]), address - nv_read_length, nv_read_length);
+				sst25xRead(&(data[data_index]), physicalAddress(address - nv_read_length), nv_read_length);
 				data_index += nv_read_length;
 				nv_read_length = 0;
 			}
 			// Address is in cache; read from the cache.
-			data[data_index] = write_cache[address & SECTOR_OFFSET_MASK];
-			data_index++;
+			entry->last_used = write_cache_clock++;
+			memcpy(&(data[data_index]), &(entry->data[address & SECTOR_OFFSET_MASK]), chunk_length);
+			data_index += chunk_length;
 		}
 		else
 		{
 			// Don't read just yet; queue it up and do all the reads together.
-			nv_read_length++;
+			nv_read_length += chunk_length;
 		}
-		address++;
+		address += chunk_length;
 	}
 	if (nv_read_length > 0)
 	{
-		// End of contiguous non-volatile read.
-		sst25xRead(&(data[data_index]), address - nv_read_length, nv_read_length);
+		// End of contiguous non-volatile read. Reads never cross a partition
+		// boundary, and the global partition lies within one sector, so
+		// the whole read can be translated using its start address.
+		sst25xRead(&(data[data_index]), physicalAddress(address - nv_read_length), nv_read_length);
 	}
 	return NV_NO_ERROR;
 }
 
 /** Ensure that all buffered writes are committed to non-volatile storage.
+  * Once everything has been written back, the write cache gives the RAM
+  * overlay region back.
   * \return See #NonVolatileReturnEnum for return values.
   */
 NonVolatileReturn nonVolatileFlush(void)
 {
 	unsigned int i;
-	uint8_t read_buffer[SECTOR_SIZE];
+	NonVolatileReturn r;
+#ifdef NV_STATISTICS
+	uint32_t start_cycles;
+	uint32_t cycles;
+#endif // #ifdef NV_STATISTICS
 
-	if (write_cache_valid)
+	if (write_cache == NULL)
 	{
-		if (write_cache_tag >= NV_MEMORY_SIZE)
-		{
-			return NV_INVALID_ADDRESS;
-		}
-
-		// Erase sector and verify erase.
-		sst25xEraseSector(write_cache_tag);
-		sst25xRead(read_buffer, write_cache_tag, SECTOR_SIZE);
-		for (i = 0; i < SECTOR_SIZE; i++)
+		return NV_NO_ERROR; // nothing to write back
+	}
+#ifdef NV_STATISTICS
+	if (!statistics_loaded)
+	{
+		loadStatistics();
+	}
+	start_cycles = getCycleCount();
+#endif // #ifdef NV_STATISTICS
+	for (i = 0; i < WRITE_CACHE_ENTRIES; i++)
+	{
+		if (write_cache[i].valid)
 		{
-			if (read_buffer[i] != 0xff)
+			TRACE(TRACE_NV_FLUSH_BEGIN, write_cache[i].tag / SECTOR_SIZE);
+			r = flushWriteCacheEntry(&(write_cache[i]));
+			TRACE(TRACE_NV_FLUSH_END, r);
+			if (r != NV_NO_ERROR)
 			{
-				return NV_IO_ERROR; // erase did not complete properly
+				return r;
 			}
 		}
-
-		// Program sector and verify program.
-		sst25xProgramSector(write_cache, write_cache_tag);
-		sst25xRead(read_buffer, write_cache_tag, SECTOR_SIZE);
-		if (memcmp(read_buffer, write_cache, SECTOR_SIZE))
-		{
-			return NV_IO_ERROR; // program did not complete properly
-		}
-
-		write_cache_valid = false;
-		write_cache_tag = 0;
-		memset(write_cache, 0, sizeof(write_cache));
 	}
+	write_cache = NULL;
+	ramOverlayRelease(OVERLAY_WRITE_CACHE);
+#ifdef NV_STATISTICS
+	if (statistics_dirty)
+	{
+		// Failing to record statistics isn't a reason to fail the flush,
+		// since everything else has been written back.
+		writeStatistics();
+	}
+	// The time taken to write the statistics counts as part of this flush,
+	// but it only appears in the next record.
+	cycles = getCycleCount() - start_cycles;
+	nv_statistics.flush_count++;
+	nv_statistics.flush_total_cycles += cycles;
+	if (cycles > nv_statistics.flush_max_cycles)
+	{
+		nv_statistics.flush_max_cycles = cycles;
+	}
+#endif // #ifdef NV_STATISTICS
 	return NV_NO_ERROR;
 }
@@ -3,7 +3,8 @@
   * \brief Miscellaneous PIC32-related system functions
   *
   * Note that this does use the Timer2 peripheral. See enterIdleMode() for
-  * reasons why.
+  * reasons why. If PC_SAMPLING is defined, this also uses the Timer5
+  * peripheral.
   *
   * This file is licensed as described by the file LICENCE.
   */
@@ -12,6 +13,8 @@
 #include <stdbool.h>
 #include <p32xxxx.h>
 #include "pic32_system.h"
+#include "../hwinterface.h"
+#include "../pc_sampling.h"
 
 // This series of #pragma declarations set the device configuration bits.
 // TODO: Implemented these in a less Microchip toolchain-specific way.
@@ -48,6 +51,26 @@ static uint32_t timer2_interrupt_counter;
   * the CPU is allowed to enter idle mode. */
 static bool idle_mode_suppressed;
 
+#ifdef CLOCK_GOVERNOR
+/** Value of the PLLODIV field of OSCCON (the PLL output divider) while the
+  * clock isn't boosted. 1 means divide by 2, so the CPU runs at 36 MHz. The
+  * peripheral bus clock is divided along with it, so this shouldn't be much
+  * lower: the USB module, Timer2 and the SPI links to the display and
+  * external flash all slow down too. */
+#define REDUCED_PLLODIV			1
+/** Base 2 logarithm of the clock divider selected by #REDUCED_PLLODIV. */
+#define REDUCED_CLOCK_SHIFT		1
+/** Number of flash wait states while the clock isn't boosted. 1 wait state
+  * is okay for CPU operation from 0 to 60 MHz. */
+#define REDUCED_WAIT_STATES		1
+
+/** Number of calls to clockBoost(true) which haven't been matched by a
+  * call to clockBoost(false) yet. */
+static unsigned int clock_boost_count;
+/** Base 2 logarithm of the current clock divider (see getClockShift()). */
+static uint8_t clock_shift;
+#endif // #ifdef CLOCK_GOVERNOR
+
 /** Disable interrupts.
   * \return Saved value of Status CP0 register, to pass to restoreInterrupts().
   */
@@ -82,6 +105,11 @@ void __attribute__((nomips16)) delayCycles(uint32_t num_cycles)
 
 	// Note that Count is incremented every 2 CPU cycles.
 	num_cycles >>= 1;
+#ifdef CLOCK_GOVERNOR
+	// num_cycles is in full speed CPU cycles, but Count only increments at
+	// the current clock speed.
+	num_cycles >>= clock_shift;
+#endif // #ifdef CLOCK_GOVERNOR
 	// Use Count register ($9) to count cycles.
 	asm volatile("mfc0 %0, $9" : "=r"(start_count));
 	do
@@ -102,6 +130,11 @@ void __attribute__((nomips16)) delayCyclesAndIdle(uint32_t num_cycles)
 
 	// Note that Count is incremented every 2 CPU cycles.
 	num_cycles >>= 1;
+#ifdef CLOCK_GOVERNOR
+	// num_cycles is in full speed CPU cycles, but Count only increments at
+	// the current clock speed.
+	num_cycles >>= clock_shift;
+#endif // #ifdef CLOCK_GOVERNOR
 	// Use Count register ($9) to count cycles.
 	asm volatile("mfc0 %0, $9" : "=r"(start_count));
 	do
@@ -114,6 +147,150 @@ void __attribute__((nomips16)) delayCyclesAndIdle(uint32_t num_cycles)
 	} while ((current_count - start_count) < num_cycles);
 }
 
+#if defined(STREAM_COMM_PROFILE) || defined(TEST_CRYPTO_BENCH) || defined(PBKDF2_CALIBRATE)
+/** Get the current value of the CP0 Count register, which is used as the
+  * cycle counter for profiling and benchmarking. See getCycleCount() in hwinterface.h.
+  * \return The current value of the Count register.
+  */
+uint32_t __attribute__((nomips16)) getCycleCount(void)
+{
+	uint32_t count;
+
+	asm volatile("mfc0 %0, $9" : "=r"(count));
+	return count;
+}
+
+/** Get the rate at which the Count register increments.
+  * \return The number of counts per second.
+  */
+uint32_t getCycleCountFrequency(void)
+{
+	// Count is incremented every 2 CPU cycles. With CLOCK_GOVERNOR, it
+	// increments more slowly than this whenever the clock isn't boosted
+	// (see getClockShift()), so time spent waiting is under-reported.
+	return CYCLES_PER_SECOND / 2;
+}
+#endif // #if defined(STREAM_COMM_PROFILE) || defined(TEST_CRYPTO_BENCH) || defined(PBKDF2_CALIBRATE)
+
+#ifdef STREAM_COMM_TRACE
+/** Disable interrupts while the event trace is being updated, since events
+  * are recorded from the USB and ADC interrupt handlers as well as the main
+  * loop. See traceDisableInterrupts() in hwinterface.h.
+  * \return Saved value of Status CP0 register.
+  */
+uint32_t traceDisableInterrupts(void)
+{
+	return disableInterrupts();
+}
+
+/** Restore interrupt handling behaviour after the event trace has been
+  * updated.
+  * \param status Value returned by traceDisableInterrupts().
+  */
+void traceRestoreInterrupts(uint32_t status)
+{
+	restoreInterrupts(status);
+}
+#endif // #ifdef STREAM_COMM_TRACE
+
+#ifdef PC_SAMPLING
+/** Lowest address of program flash which the firmware can occupy. The
+  * bootloader lives below this; see app_32MX695F512H.ld. */
+#define CODE_START				0x9D006000
+/** One past the highest address of program flash (512 KB), in kseg0. */
+#define CODE_END				0x9D080000
+
+/** The PC sampler's histogram. */
+static PCSamplingState pc_sampling_state;
+
+/** Get the range of addresses which the firmware's code occupies. See
+  * pcSamplingGetCodeRange() in hwinterface.h.
+  * \param out_start The lowest address will be written here.
+  * \param out_end One past the highest address will be written here.
+  */
+void pcSamplingGetCodeRange(uint32_t *out_start, uint32_t *out_end)
+{
+	*out_start = CODE_START;
+	*out_end = CODE_END;
+}
+
+/** Get the rate at which PC samples are taken. See pcSamplingGetRate() in
+  * hwinterface.h.
+  * \return The number of samples per second.
+  */
+uint32_t pcSamplingGetRate(void)
+{
+	// Timer5 is clocked from the peripheral bus clock. With CLOCK_GOVERNOR,
+	// that slows down whenever the clock isn't boosted (see
+	// getClockShift()), so fewer samples are taken per second than this and
+	// time spent waiting is under-reported, just like with
+	// getCycleCountFrequency().
+	return PC_SAMPLE_RATE;
+}
+
+/** Interrupt service handler for Timer5, which samples the program counter.
+  * This has a higher priority than every other interrupt handler, so that
+  * they get sampled too. Code which runs with interrupts disabled can't be
+  * sampled; its samples land on the instruction which re-enables
+  * interrupts instead. */
+void __attribute__((vector(_TIMER_5_VECTOR), interrupt(ipl6), nomips16)) _Timer5Handler(void)
+{
+	uint32_t epc;
+
+	IFS0bits.T5IF = 0; // clear interrupt flag
+	// EPC holds the address of the instruction which was interrupted.
+	// Nothing can interrupt this handler, so EPC can't have changed since
+	// the handler was entered.
+	asm volatile("mfc0 %0, $14" : "=r"(epc));
+	pcSamplingRecord(epc);
+}
+#endif // #ifdef PC_SAMPLING
+
+#ifdef CHECK_STACK_USAGE
+/** Stack limit (lowest address the stack may grow down to), generated by
+  * the linker. */
+extern uint32_t _splim;
+/** Initial stack pointer (top of the stack), generated by the linker. */
+extern uint32_t _stack;
+
+/** Value which unused stack words are filled with. */
+#define STACK_MARKER		0xcccccccc
+/** The part of the stack this close (in bytes) to paintStack()'s own stack
+  * frame isn't painted, since it may be in use. */
+#define STACK_PAINT_MARGIN	64
+
+/** Fill unused part of stack with a marker value. See paintStack() in
+  * hwinterface.h. */
+void paintStack(void)
+{
+	uint32_t here; // used to find current stack pointer
+	uint32_t *p;
+
+	for (p = &_splim; p < (uint32_t *)(((uint8_t *)&here) - STACK_PAINT_MARGIN); p++)
+	{
+		*p = STACK_MARKER;
+	}
+}
+
+/** Get maximum stack usage since last paintStack(). See getStackUsage() in
+  * hwinterface.h.
+  * \return The maximum stack usage, in bytes.
+  */
+uint32_t getStackUsage(void)
+{
+	uint32_t *p;
+
+	for (p = &_splim; p < &_stack; p++)
+	{
+		if (*p != STACK_MARKER)
+		{
+			break;
+		}
+	}
+	return (uint32_t)(((uint8_t *)&_stack) - ((uint8_t *)p));
+}
+#endif // #ifdef CHECK_STACK_USAGE
+
 /** Initialise caching module and set up CPU for instruction caching. */
 static void __attribute__ ((nomips16)) prefetchInit(void)
 {
@@ -138,6 +315,90 @@ static void __attribute__ ((nomips16)) prefetchInit(void)
 	asm volatile("mtc0 %0, $16, 0" : : "r"(config1));
 }
 
+#ifdef CLOCK_GOVERNOR
+/** Switch between full clock speed and the reduced clock speed used while
+  * the clock isn't boosted. This changes the PLL output divider, which
+  * (unlike the PLL multiplier) can be changed on the fly, without a clock
+  * switch or waiting for the PLL to lock. Flash wait states are added
+  * before speeding up and removed after slowing down, so that flash is
+  * never accessed too quickly.
+  * \param full_speed Use true to run at full speed, false to run at the
+  *                   reduced speed.
+  */
+static void setClockSpeed(bool full_speed)
+{
+	uint32_t status;
+	uint32_t dma_suspended;
+
+	status = disableInterrupts();
+	// DMA must be suspended during the system unlock sequence.
+	dma_suspended = DMACONbits.SUSPEND;
+	DMACONbits.SUSPEND = 1;
+	while (DMACONbits.DMABUSY)
+	{
+		// do nothing
+	}
+	if (full_speed)
+	{
+		CHECONbits.PFMWS = 2;
+	}
+	SYSKEY = 0;
+	SYSKEY = 0xaa996655;
+	SYSKEY = 0x556699aa;
+	if (full_speed)
+	{
+		OSCCONbits.PLLODIV = 0; // divide by 1
+		clock_shift = 0;
+	}
+	else
+	{
+		OSCCONbits.PLLODIV = REDUCED_PLLODIV;
+		clock_shift = REDUCED_CLOCK_SHIFT;
+	}
+	SYSKEY = 0;
+	if (!full_speed)
+	{
+		CHECONbits.PFMWS = REDUCED_WAIT_STATES;
+	}
+	DMACONbits.SUSPEND = dma_suspended;
+	restoreInterrupts(status);
+}
+
+/** Start or stop running at full clock speed. See clockBoost() in
+  * hwinterface.h.
+  * \param boost Use true to start running at full speed, false to undo the
+  *              matching clockBoost(true).
+  */
+void clockBoost(bool boost)
+{
+	if (boost)
+	{
+		if (clock_boost_count == 0)
+		{
+			setClockSpeed(true);
+		}
+		clock_boost_count++;
+	}
+	else if (clock_boost_count > 0)
+	{
+		clock_boost_count--;
+		if (clock_boost_count == 0)
+		{
+			setClockSpeed(false);
+		}
+	}
+}
+
+/** Find out how much slower than full speed the CPU is currently running.
+  * See getClockShift() in hwinterface.h.
+  * \return The base 2 logarithm of the current clock divider.
+  */
+uint8_t getClockShift(void)
+{
+	return clock_shift;
+}
+#endif // #ifdef CLOCK_GOVERNOR
+
 /** Enter PIC32 idle mode to conserve power. The CPU will leave idle mode when
   * an interrupt occurs.
   * There is the possibility of a race condition. Say, for example, the caller
@@ -239,6 +500,27 @@ void pic32SystemInit(void)
 	IFS0bits.T2IF = 0; // clear interrupt flag
 	IEC0bits.T2IE = 1; // enable interrupt
 
+#ifdef PC_SAMPLING
+	// Initialise Timer5 for PC sampling.
+	pcSamplingInit(&pc_sampling_state);
+	T5CONbits.ON = 0; // turn timer off
+	T5CONbits.TCKPS = 3; // 1:8 prescaler
+	T5CONbits.TGATE = 0; // disable gated time accumulation
+	T5CONbits.SIDL = 0; // continue in idle mode
+	TMR5 = 0; // clear count
+	PR5 = (CYCLES_PER_SECOND / 8) / PC_SAMPLE_RATE - 1; // frequency = PC_SAMPLE_RATE
+	T5CONbits.ON = 1; // turn timer on
+	IPC5bits.T5IP = 6; // priority level = 6
+	IPC5bits.T5IS = 0; // sub-priority level = 0
+	IFS0bits.T5IF = 0; // clear interrupt flag
+	IEC0bits.T5IE = 1; // enable interrupt
+#endif // #ifdef PC_SAMPLING
+
 	INTCONbits.MVEC = 1; // enable multi-vector mode
 	prefetchInit();
+#ifdef CLOCK_GOVERNOR
+	// The configuration bits start the CPU at full speed. Nothing needs
+	// full speed until something asks for it.
+	setClockSpeed(false);
+#endif // #ifdef CLOCK_GOVERNOR
 }
@@ -0,0 +1,104 @@
+/** \file ram_overlay.c
+  *
+  * \brief Lends one region of RAM to subsystems which never need it at the
+  *        same time.
+  *
+  * Some subsystems need a large buffer, but only for a short while. The
+  * HWRNG only needs its histogram, power spectral density accumulator and
+  * filter buffer while it is filling and testing a batch of samples, and
+  * the non-volatile memory write cache only needs its sector buffers
+  * between the first write and the next nonVolatileFlush(). Each of these
+  * used to be statically allocated, which meant they were all resident
+  * even though (almost) nothing uses more than one of them at once.
+  *
+  * Instead, those subsystems borrow the same region, using
+  * ramOverlayAcquire() and ramOverlayRelease(). Ownership is always
+  * explicit: exactly one subsystem (or nothing) owns the region at any
+  * time, and the contents of the region don't survive a change of owner.
+  * If a subsystem asks for the region while another one holds it, the
+  * current owner is asked to give it up through the eviction function it
+  * supplied when it acquired the region. For example, the write cache's
+  * eviction function writes back whatever it holds. An owner which can't
+  * be evicted (because it only holds the region for the duration of one
+  * function which never yields to another owner) supplies no eviction
+  * function; if anything else asks for the region while such an owner holds
+  * it, that's a bug, so fatalError() is called.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../hwinterface.h"
+#include "ram_overlay.h"
+
+/** The overlay region itself. This is declared as an array of words so that
+  * it is suitably aligned for whatever is placed in it. */
+static uint32_t overlay_region[(RAM_OVERLAY_SIZE + 3) / 4];
+/** Which subsystem currently owns #overlay_region. */
+static RamOverlayOwner overlay_owner;
+/** Eviction function supplied by the current owner of #overlay_region. This
+  * is NULL if the current owner can't be evicted. */
+static RamOverlayEvictFunction overlay_evict;
+
+/** Borrow the overlay region. If another subsystem owns the region, it is
+  * asked to give it up first. The contents of the region are undefined
+  * (unless owner already owned it, in which case they are unchanged), so
+  * the new owner must initialise whatever it needs.
+  * \param owner The subsystem which wants the region.
+  * \param size The number of bytes needed. This must not be more
+  *             than #RAM_OVERLAY_SIZE.
+  * \param evict Function which will be called if another subsystem needs
+  *              the region while owner holds it. Use NULL if owner can't be
+  *              evicted. See #RamOverlayEvictFunction.
+  * \return A pointer to the start of the region on success, or NULL if the
+  *         current owner couldn't give it up.
+  */
+void *ramOverlayAcquire(RamOverlayOwner owner, uint32_t size, RamOverlayEvictFunction evict)
+{
+	if ((owner == OVERLAY_FREE) || (size > sizeof(overlay_region)))
+	{
+		fatalError(); // this should never happen
+	}
+	if (overlay_owner != owner)
+	{
+		if (overlay_owner != OVERLAY_FREE)
+		{
+			if (overlay_evict == NULL)
+			{
+				// The current owner only holds the region for a short,
+				// self-contained operation, so this should never happen.
+				fatalError();
+			}
+			if (overlay_evict())
+			{
+				return NULL; // current owner couldn't give it up
+			}
+			// The eviction function should have released the region.
+			if (overlay_owner != OVERLAY_FREE)
+			{
+				fatalError();
+			}
+		}
+		overlay_owner = owner;
+	}
+	overlay_evict = evict;
+	return overlay_region;
+}
+
+/** Give up the overlay region. The contents of the region are cleared, so
+  * that nothing the owner left behind (a sector of non-volatile memory,
+  * for example) is visible to the next owner.
+  * \param owner The subsystem which is giving up the region. If it doesn't
+  *              own the region, this does nothing.
+  */
+void ramOverlayRelease(RamOverlayOwner owner)
+{
+	if ((owner != OVERLAY_FREE) && (overlay_owner == owner))
+	{
+		memset(overlay_region, 0, sizeof(overlay_region));
+		overlay_owner = OVERLAY_FREE;
+		overlay_evict = NULL;
+	}
+}
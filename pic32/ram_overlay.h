@@ -0,0 +1,50 @@
+/** \file ram_overlay.h
+  *
+  * \brief Describes functions, types and constants exported by ram_overlay.c.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifndef PIC32_RAM_OVERLAY_H_INCLUDED
+#define PIC32_RAM_OVERLAY_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sst25x.h"
+
+/** Number of sectors which the non-volatile memory write cache (see
+  * nvmem_manager.c) can hold. The write cache is the largest user of the
+  * overlay, so this determines #RAM_OVERLAY_SIZE. */
+#ifndef WRITE_CACHE_ENTRIES
+#define WRITE_CACHE_ENTRIES		2
+#endif // #ifndef WRITE_CACHE_ENTRIES
+
+/** Size, in bytes, of the overlay region. This is enough for the write
+  * cache: #WRITE_CACHE_ENTRIES sectors, each with a few words of
+  * bookkeeping. */
+#define RAM_OVERLAY_SIZE		(WRITE_CACHE_ENTRIES * (SECTOR_SIZE + 16))
+
+/** The subsystems which can borrow the overlay region. */
+typedef enum RamOverlayOwnerEnum
+{
+	/** Nothing is using the overlay region. */
+	OVERLAY_FREE				= 0,
+	/** The HWRNG is filling and testing a batch of samples (see
+	  * fillAndTestSamplesArray() in hwrng.c). */
+	OVERLAY_HWRNG_TESTS			= 1,
+	/** The write cache holds writes which haven't been flushed yet (see
+	  * nvmem_manager.c). */
+	OVERLAY_WRITE_CACHE			= 2
+} RamOverlayOwner;
+
+/** Function which makes the current owner of the overlay region give it
+  * up (for example, by writing back what it holds). This is called by
+  * ramOverlayAcquire() when another subsystem needs the region. It should
+  * return false on success, or true if the region can't be given up yet.
+  */
+typedef bool (*RamOverlayEvictFunction)(void);
+
+extern void *ramOverlayAcquire(RamOverlayOwner owner, uint32_t size, RamOverlayEvictFunction evict);
+extern void ramOverlayRelease(RamOverlayOwner owner);
+
+#endif // #ifndef PIC32_RAM_OVERLAY_H_INCLUDED
@@ -4,8 +4,11 @@
   *
   * Each FIFO buffer is intended to be used in a producer-consumer process,
   * with the producer existing in a non-IRH (Interrupt Request Handler) context
-  * and the consumer existing in an IRH context, or vice versa. Synchronisation
-  * is handled using critical sections.
+  * and the consumer existing in an IRH context, or vice versa. There must
+  * only be one producer and one consumer for each buffer. The producer only
+  * ever modifies the head index and the consumer only ever modifies the tail
+  * index, so no critical sections are needed to move data in and out of a
+  * buffer.
   * The functions in this file don't actually interface with any
   * communications hardware. The interface of circular buffers to hardware
   * must be handled elsewhere.
@@ -22,29 +25,51 @@
 #include "../common.h"
 #include "../hwinterface.h"
 
+/** Make sure that all memory accesses before this are done before any
+  * memory accesses after this. This is used to ensure that a byte is in
+  * the buffer's storage before the other side can see a head index which
+  * includes it, and that a byte has been read out of storage before the
+  * other side can see a tail index which frees up its space. */
+#define MEMORY_BARRIER()	asm volatile("sync" : : : "memory")
+
 /** Clear and initialise contents of circular buffer.
   * \param buffer The circular buffer to initialise and clear.
   * \param storage Storage array for buffer contents. This must be large enough
   *                to store the number of bytes specified by size.
-  * \param size Size, in bytes, of the storage array.
+  * \param size Size, in bytes, of the storage array. This must be a power
+  *             of 2.
   */
 void initCircularBuffer(volatile CircularBuffer *buffer, volatile uint8_t *storage, uint32_t size)
 {
 	memset((void *)storage, 0xff, size); // just to be sure
 	memset((void *)storage, 0, size);
-	buffer->next = 0;
-	buffer->remaining = 0;
+	buffer->head = 0;
+	buffer->tail = 0;
 	buffer->size = size;
 	buffer->storage = storage;
 }
 
+/** Obtain the number of bytes currently in a circular buffer. The result
+  * is only a snapshot; if the caller is the consumer, the buffer might
+  * gain bytes, and if the caller is the producer, the buffer might lose
+  * bytes.
+  * \param buffer The circular buffer to check.
+  * \return The number of bytes in the circular buffer.
+  */
+static uint32_t circularBufferCount(volatile CircularBuffer *buffer)
+{
+	// This works even when head wraps around, because the size is a power
+	// of 2 and unsigned arithmetic is done modulo 2 ^ 32.
+	return buffer->head - buffer->tail;
+}
+
 /** Check whether a circular buffer is empty.
   * \param buffer The circular buffer to check.
   * \return true if it is empty, false if it is non-empty.
   */
 bool isCircularBufferEmpty(volatile CircularBuffer *buffer)
 {
-	if (buffer->remaining == 0)
+	if (circularBufferCount(buffer) == 0)
 	{
 		return true;
 	}
@@ -60,7 +85,7 @@ bool isCircularBufferEmpty(volatile CircularBuffer *buffer)
   */
 bool isCircularBufferFull(volatile CircularBuffer *buffer)
 {
-	if (buffer->remaining == buffer->size)
+	if (circularBufferCount(buffer) == buffer->size)
 	{
 		return true;
 	}
@@ -78,21 +103,20 @@ bool isCircularBufferFull(volatile CircularBuffer *buffer)
   */
 uint32_t circularBufferSpaceRemaining(volatile CircularBuffer *buffer)
 {
-	// No need to put this in a critical section since (outside of init),
-	// nothing else touches size.
-	return buffer->size - buffer->remaining;
+	return buffer->size - circularBufferCount(buffer);
 }
 
 /** Read a byte from a circular buffer. This will block until a byte is
   * read.
   * \param buffer The circular buffer to read from.
   * \param is_irq Use true if calling this from an interrupt
-  *               request handler, otherwise use false.
+  *               request handler (or with interrupts disabled), otherwise
+  *               use false.
   * \return The byte that was read from the buffer.
   */
 uint8_t circularBufferRead(volatile CircularBuffer *buffer, bool is_irq)
 {
-	uint32_t status;
+	uint32_t tail;
 	uint8_t r;
 
 	while(isCircularBufferEmpty(buffer))
@@ -108,11 +132,11 @@ uint8_t circularBufferRead(volatile CircularBuffer *buffer, bool is_irq)
 		enterIdleMode();
 	}
 
-	status = disableInterrupts();
-	r = buffer->storage[buffer->next];
-	buffer->remaining--;
-	buffer->next = (buffer->next + 1) & (buffer->size - 1);
-	restoreInterrupts(status);
+	tail = buffer->tail;
+	MEMORY_BARRIER();
+	r = buffer->storage[tail & (buffer->size - 1)];
+	MEMORY_BARRIER();
+	buffer->tail = tail + 1;
 	return r;
 }
 
@@ -121,12 +145,12 @@ uint8_t circularBufferRead(volatile CircularBuffer *buffer, bool is_irq)
   * \param buffer The circular buffer to write to.
   * \param data The byte to write to the buffer.
   * \param is_irq Use true if calling this from an interrupt
-  *               request handler, otherwise use false.
+  *               request handler (or with interrupts disabled), otherwise
+  *               use false.
   */
 void circularBufferWrite(volatile CircularBuffer *buffer, uint8_t data, bool is_irq)
 {
-	uint32_t status;
-	uint32_t index;
+	uint32_t head;
 
 	while (isCircularBufferFull(buffer))
 	{
@@ -141,9 +165,115 @@ void circularBufferWrite(volatile CircularBuffer *buffer, uint8_t data, bool is_
 		enterIdleMode();
 	}
 
-	status = disableInterrupts();
-	index = (buffer->next + buffer->remaining) & (buffer->size - 1);
-	buffer->storage[index] = data;
-	buffer->remaining++;
-	restoreInterrupts(status);
+	head = buffer->head;
+	buffer->storage[head & (buffer->size - 1)] = data;
+	MEMORY_BARRIER();
+	buffer->head = head + 1;
+}
+
+/** Read up to a number of bytes from a circular buffer. This will block
+  * until at least one byte is read, but it won't wait for more bytes than
+  * are currently in the buffer.
+  * \param buffer The circular buffer to read from.
+  * \param data The bytes will be written here. This must have space for
+  *             length bytes.
+  * \param length The maximum number of bytes to read. This must be
+  *               non-zero.
+  * \return The number of bytes that were read from the buffer. This will
+  *         be between 1 and length inclusive.
+  * \warning This must only be called from an interrupt request handler if
+  *          the buffer is known to be non-empty.
+  */
+uint32_t circularBufferReadBytes(volatile CircularBuffer *buffer, uint8_t *data, uint32_t length)
+{
+	uint32_t tail;
+	uint32_t count;
+	uint32_t i;
+
+	while(isCircularBufferEmpty(buffer))
+	{
+		enterIdleMode();
+	}
+
+	tail = buffer->tail;
+	count = MIN(length, buffer->head - tail);
+	MEMORY_BARRIER();
+	for (i = 0; i < count; i++)
+	{
+		data[i] = buffer->storage[(tail + i) & (buffer->size - 1)];
+	}
+	MEMORY_BARRIER();
+	buffer->tail = tail + count;
+	return count;
+}
+
+/** Write up to a number of bytes to a circular buffer. If the buffer is
+  * full, this will block until it isn't, but it won't wait for more space
+  * than is needed to write one byte.
+  * \param buffer The circular buffer to write to.
+  * \param data The bytes to write to the buffer.
+  * \param length The maximum number of bytes to write. This must be
+  *               non-zero.
+  * \return The number of bytes that were written to the buffer. This will
+  *         be between 1 and length inclusive.
+  * \warning This must only be called from an interrupt request handler if
+  *          the buffer is known to be not full.
+  */
+uint32_t circularBufferWriteBytes(volatile CircularBuffer *buffer, const uint8_t *data, uint32_t length)
+{
+	uint32_t head;
+	uint32_t count;
+	uint32_t i;
+
+	while (isCircularBufferFull(buffer))
+	{
+		enterIdleMode();
+	}
+
+	head = buffer->head;
+	count = MIN(length, buffer->size - (head - buffer->tail));
+	for (i = 0; i < count; i++)
+	{
+		buffer->storage[(head + i) & (buffer->size - 1)] = data[i];
+	}
+	MEMORY_BARRIER();
+	buffer->head = head + count;
+	return count;
+}
+
+/** Borrow bytes straight out of a circular buffer's storage, without
+  * copying them. This will block until the buffer is non-empty. The bytes
+  * stay in the buffer until circularBufferRelease() is called.
+  * \param buffer The circular buffer to borrow from.
+  * \param length The number of contiguous bytes available at the returned
+  *               address will be written here. This will be at least 1.
+  * \return A pointer to the borrowed bytes.
+  * \warning This must not be called from an interrupt request handler.
+  */
+const uint8_t *circularBufferBorrow(volatile CircularBuffer *buffer, uint32_t *length)
+{
+	uint32_t index;
+
+	while(isCircularBufferEmpty(buffer))
+	{
+		enterIdleMode();
+	}
+	// The producer can only add bytes to the buffer, so the bytes won't go
+	// away before circularBufferRelease() is called. Only the bytes up
+	// to the end of the storage array are contiguous.
+	index = buffer->tail & (buffer->size - 1);
+	*length = MIN(circularBufferCount(buffer), buffer->size - index);
+	MEMORY_BARRIER();
+	return (const uint8_t *)&(buffer->storage[index]);
+}
+
+/** Remove bytes borrowed with circularBufferBorrow() from a circular buffer.
+  * \param buffer The circular buffer the bytes were borrowed from.
+  * \param length The number of bytes to remove. This must not be more than
+  *               the length returned by circularBufferBorrow().
+  */
+void circularBufferRelease(volatile CircularBuffer *buffer, uint32_t length)
+{
+	MEMORY_BARRIER();
+	buffer->tail += length;
 }
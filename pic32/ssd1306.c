@@ -14,6 +14,11 @@
   * to change the state of the display. Note that nothing will be displayed
   * until the display is turned on using displayOn().
   *
+  * If SSD1306_SPI_DMA is defined, frames are sent to the display using the
+  * PIC32's SPI3 module and DMA instead of by bit-banging GPIO. Then display
+  * updates proceed in the background, while the CPU gets on with other
+  * things (like entropy sampling and servicing USB).
+  *
   * A lot of the interface requirements were obtained from the SSD1306
   * datasheet, obtained from http://www.adafruit.com/datasheets/SSD1306.pdf
   * on 30-Apr-2012.
@@ -23,6 +28,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <p32xxxx.h>
 #include "pic32_system.h"
 
@@ -198,10 +204,40 @@ static uint32_t cursor_line;
   * writeStringToDisplay() will write to next.
   */
 static uint32_t cursor_pos;
+/** What the display is currently showing, in the same format
+  * as #text_buffer. renderDisplay() compares this with #text_buffer so that
+  * it only sends the parts of the display which have changed.
+  */
+static uint8_t displayed_buffer[CHARACTERS_PER_LINE * NUMBER_OF_LINES];
+
+#ifdef SSD1306_SPI_DMA
+
+/** Number of 9 bit frames which fit in one transmit buffer. This must be a
+  * multiple of 8, so that a full buffer ends on a byte boundary. */
+#define FRAMES_PER_BUFFER		256
+/** Size of one transmit buffer, in bytes. */
+#define TRANSMIT_BUFFER_SIZE	(FRAMES_PER_BUFFER * 9 / 8)
+
+/** Transmit buffers. Frames are packed into these, most significant bit
+  * first, with no gaps in between. While one buffer is being sent using
+  * DMA, the other one can be filled in. */
+static uint8_t transmit_buffer[2][TRANSMIT_BUFFER_SIZE];
+/** Index into #transmit_buffer of the buffer which is being filled in. */
+static unsigned int fill_buffer;
+/** Number of bits which have been written to the buffer which is being
+  * filled in. */
+static unsigned int fill_bits;
+/** Whether a DMA transfer (started by flushFrames()) may still be in
+  * progress. */
+static bool transfer_in_progress;
+
+#else
 
 /** See ssd1306_bitbang.S. */
 extern void ssd1306BitBangOneFrame(volatile uint32_t *port, uint32_t frame_data, uint32_t sclk_pin, uint32_t sdin_pin);
 
+#endif // #ifdef SSD1306_SPI_DMA
+
 /** Configures PIC32 ports to interface with SSD1306. The chip select (CS#)
   * line should be connected to the port specified by #OLED_CS. Likewise for
   * the reset (RES#) with #OLED_RES, serial data (SDIN) with #OLED_SDIN and
@@ -211,14 +247,167 @@ extern void ssd1306BitBangOneFrame(volatile uint32_t *port, uint32_t frame_data,
   * This selects "3-wire SPI" mode on the SSD1306. All other input pins should
   * be connected as directed on section 8.1 ("MCU Interface selection") of the
   * SSD1306 datasheet.
+  *
+  * If SSD1306_SPI_DMA is defined, SPI3 is used. This works because
+  * #OLED_SCLK and #OLED_SDIN are on the same pins as SCK3 (RD1) and SDO3
+  * (RD3). SDI3 (RD2) is sampled by the SPI module, but received data is
+  * discarded, so RD2 can still be used for other purposes.
   */
 static void configurePeripheralsForSSD1306(void)
 {
+#ifdef SSD1306_SPI_DMA
+	uint32_t status;
+	uint32_t junk;
+	int i;
+
+	// Chip select and reset are still controlled manually.
+	TRISDCLR = OLED_CS | OLED_RES;
+	PORTDSET = OLED_CS | OLED_RES;
+	// The SPI initialisation sequence is the same as the one in
+	// initSST25x().
+	status = disableInterrupts();
+	SPI3CONbits.ON = 0; // stop and reset SPI module
+	asm("nop"); // ensure at least one cycle follows clearing of ON bit
+	// Make sure receive buffer is clear.
+	for (i = 0; i < 16; i++)
+	{
+		junk = SPI3BUF;
+	}
+	SPI3CONbits.ENHBUF = 1; // enable enhanced buffer mode (i.e. enable FIFOs)
+	SPI3BRG = 8; // set baud rate for 4 MHz operation
+	SPI3STATbits.SPIROV = 0;
+	SPI3CONbits.MSTEN = 1; // PIC32 is SPI master
+	SPI3CONbits.CKP = 1; // idle high, active low
+	SPI3CONbits.CKE = 0; // output transition on idle -> active
+	SPI3CONbits.SMP = 0; // sample input in middle of data output time
+	SPI3CONbits.MODE16 = 0; // 8 bit mode
+	SPI3CONbits.MODE32 = 0; // 8 bit mode
+	SPI3CONbits.DISSDO = 0; // enable SDO
+	SPI3CONbits.SIDL = 0; // continue operation in idle mode
+	SPI3CONbits.FRMEN = 0; // disable framed mode
+	SPI3CONbits.MSSEN = 0; // disable slave select (that's controlled manually)
+	// This interrupt condition is used to trigger DMA transfers; see
+	// flushFrames().
+	SPI3CONbits.STXISEL = 3; // interrupt when transmit buffer is not full
+	IEC0bits.SPI3TXIE = 0; // disable SPI3 transmit interrupt
+	IEC0bits.SPI3RXIE = 0; // disable SPI3 receive interrupt
+	SPI3CONbits.ON = 1; // start SPI module
+	DMACONbits.ON = 1; // enable DMA controller
+	restoreInterrupts(status);
+	fill_buffer = 0;
+	fill_bits = 0;
+	transfer_in_progress = false;
+#else
 	// Set all OLED interface pins as normally high outputs.
 	TRISDCLR = OLED_CS | OLED_RES | OLED_SDIN | OLED_SCLK;
 	PORTDSET = OLED_CS | OLED_RES | OLED_SDIN | OLED_SCLK;
+#endif // #ifdef SSD1306_SPI_DMA
+}
+
+#ifdef SSD1306_SPI_DMA
+
+/** Wait until the DMA transfer started by flushFrames() (if there is one)
+  * has finished, and every bit has been shifted out. Then end the transfer
+  * by setting the SSD1306's chip select line high. */
+static void waitForTransfer(void)
+{
+	if (transfer_in_progress)
+	{
+		while (DCH3INTbits.CHBCIF == 0)
+		{
+			// do nothing
+		}
+		while ((SPI3STATbits.SPITBE == 0) || (SPI3STATbits.SRMT == 0))
+		{
+			// do nothing
+		}
+		DCH3CONbits.CHEN = 0;
+		PORTDSET = OLED_CS;
+		transfer_in_progress = false;
+	}
+}
+
+/** Start sending the frames which have been written to the transmit buffer
+  * which is being filled in. This doesn't wait for the transfer to finish;
+  * the next call to flushFrames() (or waitForTransfer()) does that.
+  *
+  * Because chip select goes high between transfers, the SSD1306 discards any
+  * incomplete frame at the end of a transfer. So there is no need to pad
+  * the transmit buffer to a whole number of frames.
+  */
+static void flushFrames(void)
+{
+	unsigned int length;
+
+	if (fill_bits == 0)
+	{
+		return;
+	}
+	length = (fill_bits + 7) >> 3;
+	waitForTransfer();
+	PORTDCLR = OLED_CS;
+	SPI3STATbits.SPIROV = 0; // received data is never read
+	// DMA channel 3 transmits. It is configured here (rather than in
+	// configurePeripheralsForSSD1306()) because initADC() resets the DMA
+	// controller.
+	DCH3CON = 0;
+	DCH3ECON = 0;
+	DCH3ECONbits.CHSIRQ = _SPI3_TX_IRQ; // start transfer when transmit buffer isn't full
+	DCH3ECONbits.SIRQEN = 1; // start cell transfer on IRQ
+	DCH3INTCLR = 0x00ff00ff; // clear existing events, disable all interrupts
+	DCH3SSA = VIRTUAL_TO_PHYSICAL(transmit_buffer[fill_buffer]); // transfer source physical address
+	DCH3DSA = VIRTUAL_TO_PHYSICAL(&SPI3BUF); // transfer destination physical address
+	DCH3SSIZ = length; // source size
+	DCH3DSIZ = 1; // destination size
+	DCH3CSIZ = 1; // cell size (bytes transferred per event)
+	DCH3CONbits.CHEN = 1;
+	transfer_in_progress = true;
+	fill_buffer ^= 1;
+	fill_bits = 0;
 }
 
+/** Write an 8 bit command or data to the SSD1306. The SPI module can't send
+  * 9 bit wide frames directly. But the SSD1306 only cares about the bit
+  * stream, so frames are packed end to end into a transmit buffer, and
+  * 8 frames become 9 bytes. The buffer is sent (using flushFrames()) when it
+  * is full, so call flushFrames() afterwards to send whatever remains.
+  * \param is_data This should be true if value is data, false if value
+  *                is a command.
+  * \param value The command or data to write.
+  */
+static void writeSPIByte(bool is_data, uint8_t value)
+{
+	uint32_t frame;
+	unsigned int index;
+	unsigned int offset;
+	uint8_t *buffer;
+
+	frame = value;
+	if (is_data)
+	{
+		frame |= 0x100;
+	}
+	buffer = transmit_buffer[fill_buffer];
+	index = fill_bits >> 3;
+	offset = fill_bits & 7;
+	// Since offset is at most 7, the 9 bit frame always fits in the two
+	// bytes starting at index.
+	frame <<= 7 - offset;
+	if (offset == 0)
+	{
+		buffer[index] = 0;
+	}
+	buffer[index] |= (uint8_t)(frame >> 8);
+	buffer[index + 1] = (uint8_t)frame;
+	fill_bits += 9;
+	if (fill_bits == (FRAMES_PER_BUFFER * 9))
+	{
+		flushFrames();
+	}
+}
+
+#else
+
 /** Write an 8 bit command or data to the SSD1306 by bit-banging GPIO.
   * The PIC32's SPI module isn't used because it can't send 9 bit wide frames.
   * \param is_data This should be true if value is data, false if value
@@ -239,11 +428,19 @@ static void writeSPIByte(bool is_data, uint8_t value)
 	PORTDSET = OLED_CS;
 }
 
+/** Bit-banged frames are sent immediately, so there's nothing to do. */
+static void flushFrames(void)
+{
+}
+
+#endif // #ifdef SSD1306_SPI_DMA
+
 /** Turn display on. This must be called in order to have anything appear
   * on the screen. */
 void displayOn(void)
 {
 	writeSPIByte(false, 0xaf); // display on
+	flushFrames();
 }
 
 /** Turn display off. This will cause the SSD1306 controller to enter a
@@ -251,6 +448,7 @@ void displayOn(void)
 void displayOff(void)
 {
 	writeSPIByte(false, 0xae); // display off
+	flushFrames();
 }
 
 /** Reset and initialise the SSD1306 display controller. This mostly follows
@@ -288,32 +486,46 @@ static void resetSSD1306(void)
 	writeSPIByte(false, 0x14); // charge pump = on
 	writeSPIByte(false, 0x20); // set memory addressing mode
 	writeSPIByte(false, 0x01); // memory addressing mode = vertical
+	flushFrames();
 }
 
-/** Clear the display and all associated buffers. */
-void clearDisplay(void)
+/** Restrict subsequent data writes to a rectangular window of the
+  * SSD1306's GDDRAM. Since the memory addressing mode is vertical (see
+  * resetSSD1306()), data bytes fill the window column by column, starting
+  * from the top-left corner of the window.
+  * \param first_column The leftmost column of the window (0 = leftmost).
+  * \param last_column The rightmost column of the window (inclusive).
+  * \param first_page The topmost page (8 pixel high row) of the window
+  *                   (0 = topmost).
+  * \param last_page The bottommost page of the window (inclusive).
+  */
+static void setAddressWindow(uint32_t first_column, uint32_t last_column, uint32_t first_page, uint32_t last_page)
+{
+	writeSPIByte(false, 0x21); // set column address
+	writeSPIByte(false, (uint8_t)first_column);
+	writeSPIByte(false, (uint8_t)last_column);
+	writeSPIByte(false, 0x22); // set page address
+	writeSPIByte(false, (uint8_t)first_page);
+	writeSPIByte(false, (uint8_t)last_page);
+}
+
+/** Clear the SSD1306's entire GDDRAM, regardless of what the display is
+  * supposed to be showing. This is needed after a reset, since GDDRAM
+  * contents are undefined then. */
+static void clearGDDRAM(void)
 {
 	uint32_t i;
 
-	for (i = 0; i < 1024; i++)
+	setAddressWindow(0, DISPLAY_WIDTH - 1, 0, (DISPLAY_HEIGHT / 8) - 1);
+	for (i = 0; i < (DISPLAY_WIDTH * DISPLAY_HEIGHT / 8); i++)
 	{
 		writeSPIByte(true, 0);
 	}
-	cursor_line = 0;
-	cursor_pos = 0;
-	memset(text_buffer, FONT_BLANK, sizeof(text_buffer));
-}
-
-/** Set up everything so that the display is ready to start having text
-  * rendered on it. By default, this will not turn on the display; use
-  * displayOn() to do that. */
-void initSSD1306(void)
-{
-	configurePeripheralsForSSD1306();
-	resetSSD1306();
-	clearDisplay();
+	flushFrames();
+	memset(displayed_buffer, FONT_BLANK, sizeof(displayed_buffer));
 }
 
+#if (CHARACTER_HEIGHT % 8) != 0
 /** Font table byte lookup function which has bit granularity. Alternatively,
   * this can be thought of as treating the font table as a giant little-endian
   * multi-precision integer, shifting it to the right bit_offset times and
@@ -335,6 +547,7 @@ static uint8_t lookupFontTable(uint32_t bit_offset)
 	data = font_table[index] | (font_table[index + 1] << 8);
 	return (uint8_t)(data >> (bit_offset & 7));
 }
+#endif // #if (CHARACTER_HEIGHT % 8) != 0
 
 /** Text buffer query function. As well as obtaining a character from
   * the text buffer, this also range checks its inputs and accounts
@@ -366,93 +579,161 @@ static uint8_t lookupTextBuffer(uint32_t char_x, uint32_t char_y)
 }
 
 /** Using the contents of the text buffer (#text_buffer) and the font
-  * in #font_table, this outputs a series of data bytes to the SSD1306
-  * display.
+  * in #font_table, this calculates one data byte (an 8 pixel high column)
+  * of the display.
   *
-  * Since the SSD1306 memory addressing mode is set to "vertical" by
-  * resetSSD1306(), this function renders in columns, 8 pixels at a time.
-  * The rendering loop starts at the top-left, moves downwards and when it
-  * hits the bottom of the current column, moves right to start at the top
-  * of the next column. Column-based rendering is done because the SSD1306's
-  * GDDRAM is column-based (each byte of data corresponds to an 8 pixel high
-  * column).
-  *
-  * In order for the renderer to work
-  * correctly, #DISPLAY_WIDTH, #DISPLAY_HEIGHT, #CHARACTER_WIDTH
-  * and #CHARACTER_HEIGHT must be set correctly.
-  * The renderer only supports monochrome, fixed-width fonts.
-  * However, the renderer can deal with fonts with a height which is not a
-  * multiple of 8.
-  *
-  * This renderer isn't very fast. But it doesn't need to be. With the SPI bus
-  * running at a bit rate of 1 Mhz, the renderer only needs to be able to
-  * write one byte every 384 cycles, which is a long time.
+  * Each data byte of the SSD1306's GDDRAM corresponds to an 8 pixel high
+  * column. If #CHARACTER_HEIGHT is a multiple of 8, every column of every
+  * glyph in #font_table starts on a byte boundary and every data byte lies
+  * within one character, so data bytes are copied straight out of the font
+  * table. Otherwise, a data byte may straddle two lines of text and has to
+  * be assembled from bits of two glyphs using lookupFontTable().
+  * \param x x location (0 = left edge) of the column.
+  * \param y y location (0 = top edge) of the top of the column. This must be
+  *          a multiple of 8.
+  * \return The data byte for that column.
   */
-static void renderDisplay(void)
+static uint8_t renderColumnByte(uint32_t x, uint32_t y)
 {
-	uint32_t x; // 0 = left edge, positive = right
-	uint32_t y; // 0 = top edge, positive = down
 	uint32_t char_x; // 0 = leftmost character, 1 = the one to the right of that etc.
 	uint32_t char_y; // 0 = topmost character, 1 = the one below that etc.
 	uint32_t char_x_offset; // x offset within character
 	uint32_t char_y_offset; // y offset within character
+#if (CHARACTER_HEIGHT % 8) == 0
+	uint32_t index;
+#else
 	uint32_t amount; // number of bits to use
-	uint8_t current_character;
-	uint8_t next_character;
 	uint8_t data;
 	uint8_t temp_data;
+#endif // #if (CHARACTER_HEIGHT % 8) == 0
+
+	char_x = x / CHARACTER_WIDTH;
+	char_x_offset = x % CHARACTER_WIDTH;
+	char_y = y / CHARACTER_HEIGHT;
+	char_y_offset = y % CHARACTER_HEIGHT;
+#if (CHARACTER_HEIGHT % 8) == 0
+	index = (lookupTextBuffer(char_x, char_y) * CHARACTER_BITS + char_y_offset + char_x_offset * CHARACTER_HEIGHT) >> 3;
+	if (index >= (sizeof(font_table) - 1))
+	{
+		return 0; // empty character
+	}
+	return font_table[index];
+#else
+	if ((char_y_offset + 8) > CHARACTER_HEIGHT)
+	{
+		// Byte goes across character height boundary.
+		amount = CHARACTER_HEIGHT - char_y_offset;
+	}
+	else
+	{
+		// Byte resides entirely within current character.
+		amount = 8;
+	}
+	data = lookupFontTable(lookupTextBuffer(char_x, char_y) * CHARACTER_BITS + char_y_offset + char_x_offset * CHARACTER_HEIGHT);
+	data &= (1 << amount) - 1;
+	if ((char_y_offset + 8) > CHARACTER_HEIGHT)
+	{
+		// Need to fetch partial character column from next character.
+		temp_data = lookupFontTable(lookupTextBuffer(char_x, char_y + 1) * CHARACTER_BITS + char_x_offset * CHARACTER_HEIGHT);
+		data |= temp_data << amount;
+	}
+	return data;
+#endif // #if (CHARACTER_HEIGHT % 8) == 0
+}
 
-	char_x = 0;
-	char_x_offset = 0;
-	for (x = 0; x < DISPLAY_WIDTH; x++)
+/** Using the contents of the text buffer (#text_buffer) and the font
+  * in #font_table, this updates the parts of the SSD1306 display which
+  * have changed since the last time this was called.
+  *
+  * For each line, the leftmost and rightmost characters which differ
+  * from #displayed_buffer are found. An address window (see
+  * setAddressWindow()) covering that span is set up, and only that window
+  * is rendered, in columns, 8 pixels at a time. Column-based rendering is
+  * done because the SSD1306 memory addressing mode is set to "vertical" by
+  * resetSSD1306(). So if a single character changes, only one character's
+  * worth of data is sent, instead of the whole display.
+  *
+  * In order for the renderer to work
+  * correctly, #DISPLAY_WIDTH, #DISPLAY_HEIGHT, #CHARACTER_WIDTH
+  * and #CHARACTER_HEIGHT must be set correctly.
+  * The renderer only supports monochrome, fixed-width fonts.
+  */
+static void renderDisplay(void)
+{
+	uint32_t line;
+	uint32_t first_char; // leftmost changed character on line
+	uint32_t last_char; // rightmost changed character on line
+	uint32_t x; // 0 = left edge, positive = right
+	uint32_t page; // 0 = top 8 pixels, positive = down
+	uint32_t first_page;
+	uint32_t last_page;
+	uint8_t *text_line;
+	uint8_t *displayed_line;
+
+	for (line = 0; line < NUMBER_OF_LINES; line++)
 	{
-		// Render a column.
-		char_y = 0;
-		char_y_offset = 0;
-		// The next (i.e. one below) character needs to be fetched in advance
-		// because the next 8 pixels may go across the current's character
-		// height boundary.
-		current_character = lookupTextBuffer(char_x, char_y);
-		next_character = lookupTextBuffer(char_x, char_y + 1);
-		for (y = 0; y < DISPLAY_HEIGHT; y += 8)
+		text_line = &(text_buffer[line * CHARACTERS_PER_LINE]);
+		displayed_line = &(displayed_buffer[line * CHARACTERS_PER_LINE]);
+		first_char = 0;
+		while ((first_char < CHARACTERS_PER_LINE) && (text_line[first_char] == displayed_line[first_char]))
 		{
-			if ((char_y_offset + 8) > CHARACTER_HEIGHT)
-			{
-				// Byte goes across character height boundary.
-				amount = CHARACTER_HEIGHT - char_y_offset;
-			}
-			else
-			{
-				// Next byte resides entirely within current character.
-				amount = 8;
-			}
-			data = lookupFontTable(current_character * CHARACTER_BITS + char_y_offset + char_x_offset * CHARACTER_HEIGHT);
-			data &= (1 << amount) - 1;
-			if ((char_y_offset + 8) > CHARACTER_HEIGHT)
-			{
-				// Need to fetch partial character column from next character.
-				temp_data = lookupFontTable(next_character * CHARACTER_BITS + char_x_offset * CHARACTER_HEIGHT);
-				data |= temp_data << amount;
-			}
-			writeSPIByte(true, data);
-			// Prepare for next byte.
-			char_y_offset += 8;
-			if (char_y_offset >= CHARACTER_HEIGHT)
+			first_char++;
+		}
+		if (first_char == CHARACTERS_PER_LINE)
+		{
+			continue; // nothing on this line has changed
+		}
+		last_char = CHARACTERS_PER_LINE - 1;
+		while (text_line[last_char] == displayed_line[last_char])
+		{
+			last_char--;
+		}
+		// If CHARACTER_HEIGHT is not a multiple of 8, the first and last
+		// pages are shared with adjacent lines. That's fine, since
+		// renderColumnByte() renders from the whole text buffer.
+		first_page = (line * CHARACTER_HEIGHT) / 8;
+		last_page = ((line + 1) * CHARACTER_HEIGHT - 1) / 8;
+		if (last_page >= (DISPLAY_HEIGHT / 8))
+		{
+			last_page = (DISPLAY_HEIGHT / 8) - 1;
+		}
+		setAddressWindow(first_char * CHARACTER_WIDTH, (last_char + 1) * CHARACTER_WIDTH - 1, first_page, last_page);
+		for (x = first_char * CHARACTER_WIDTH; x < ((last_char + 1) * CHARACTER_WIDTH); x++)
+		{
+			for (page = first_page; page <= last_page; page++)
 			{
-				char_y_offset -= CHARACTER_HEIGHT;
-				char_y++;
-				current_character = next_character;
-				next_character = lookupTextBuffer(char_x, char_y + 1);
+				writeSPIByte(true, renderColumnByte(x, page * 8));
 			}
-		} // end for (y = 0; y < DISPLAY_HEIGHT; y += 8)
-		// Prepare for next column.
-		char_x_offset++;
-		if (char_x_offset >= CHARACTER_WIDTH)
-		{
-			char_x_offset = 0;
-			char_x++;
 		}
-	} // end for (x = 0; x < DISPLAY_WIDTH; x++)
+		memcpy(&(displayed_line[first_char]), &(text_line[first_char]), last_char - first_char + 1);
+	} // end for (line = 0; line < NUMBER_OF_LINES; line++)
+	flushFrames();
+}
+
+/** Clear the display and all associated buffers. Only the parts of the
+  * display which actually had something on them are sent to the SSD1306. */
+void clearDisplay(void)
+{
+	cursor_line = 0;
+	cursor_pos = 0;
+	memset(text_buffer, FONT_BLANK, sizeof(text_buffer));
+	renderDisplay();
+}
+
+/** Set up everything so that the display is ready to start having text
+  * rendered on it. By default, this will not turn on the display; use
+  * displayOn() to do that. */
+void initSSD1306(void)
+{
+	configurePeripheralsForSSD1306();
+	resetSSD1306();
+	clearGDDRAM();
+	clearDisplay();
+#ifdef SSD1306_SPI_DMA
+	// initADC() resets the DMA controller, so don't leave a transfer in
+	// progress.
+	waitForTransfer();
+#endif // #ifdef SSD1306_SPI_DMA
 }
 
 /** Move cursor to the start of the next line, but only if the cursor is not
@@ -32,7 +32,10 @@
 
 #include <p32xxxx.h>
 #include <stdint.h>
+#include <string.h>
 #include "pic32_system.h"
+#include "../profile.h"
+#include "../trace.h"
 #include "sst25x.h"
 
 /** One byte command op codes, taken from Table 5 of the SST25VF080B
@@ -75,6 +78,14 @@ typedef enum SST25xOpCodesEnum
 	SST25X_DBSY					= 0x80
 } SST25xOpCodes;
 
+/** Reads of at least this many bytes are done using DMA. Shorter reads
+  * (eg. of the status register) are done by polling, since setting up the
+  * DMA channels would take longer than the transfer itself. */
+#define DMA_READ_THRESHOLD		16
+/** Maximum number of bytes to transfer in one DMA block transfer. This must
+  * be less than 65536, the largest block size the DMA controller supports. */
+#define DMA_MAX_BLOCK_SIZE		32768
+
 /** Initialise the PIC32's SPI4 module to interface with the SST25x serial
   * flash. SCK4, SDI4 and SDO4 are expected to be directly connected to the
   * serial flash. SS4 should be connected to the serial flash's chip enable
@@ -121,7 +132,16 @@ void initSST25x(void)
 	SPI4CONbits.SIDL = 0; // continue operation in idle mode
 	SPI4CONbits.FRMEN = 0; // disable framed mode
 	SPI4CONbits.MSSEN = 0; // disable slave select (that's controlled manually)
+	// These interrupt conditions are used to trigger DMA transfers; see
+	// dmaReadSPI().
+	SPI4CONbits.STXISEL = 3; // interrupt when transmit buffer is not full
+	SPI4CONbits.SRXISEL = 1; // interrupt when receive buffer is not empty
+	IEC1bits.SPI4TXIE = 0; // disable SPI4 transmit interrupt
+	IEC1bits.SPI4RXIE = 0; // disable SPI4 receive interrupt
 	SPI4CONbits.ON = 1; // start SPI module
+	// DMA channel 0 is used by the ADC, so the DMA controller must not be
+	// reset here.
+	DMACONbits.ON = 1; // enable DMA controller
 	restoreInterrupts(status);
 
 	// Disable block level write protection. See Table 3 of the SST25VF080B
@@ -163,6 +183,70 @@ static uint8_t readSPI(void)
 	return (uint8_t)SPI4BUF;
 }
 
+/** Receive many bytes of data from SPI4 using DMA. This is much faster than
+  * calling writeSPI() and readSPI() for every byte, since the CPU doesn't
+  * have to poll the SPI status register between bytes. The receive FIFO must
+  * be empty when this is called.
+  * \param read_buffer Received bytes will be written into this array.
+  * \param read_length Number of bytes to receive.
+  */
+static void dmaReadSPI(uint8_t *read_buffer, unsigned int read_length)
+{
+	unsigned int block_length;
+
+	// The dummy (zero) bytes which need to be transmitted are taken from
+	// the read buffer itself. This is safe because byte i is always
+	// transmitted before byte i is received.
+	memset(read_buffer, 0, read_length);
+	// DMA channel 1 transmits and DMA channel 2 receives. They are
+	// configured here (rather than in initSST25x()) because initADC() resets
+	// the DMA controller.
+	DCH1CON = 0;
+	DCH1CONbits.CHPRI = 1; // lower priority than receive channel
+	DCH1ECON = 0;
+	DCH1ECONbits.CHSIRQ = _SPI4_TX_IRQ; // start transfer when transmit buffer isn't full
+	DCH1ECONbits.SIRQEN = 1; // start cell transfer on IRQ
+	DCH2CON = 0;
+	DCH2CONbits.CHPRI = 2; // higher priority than transmit channel
+	DCH2ECON = 0;
+	DCH2ECONbits.CHSIRQ = _SPI4_RX_IRQ; // start transfer when receive buffer isn't empty
+	DCH2ECONbits.SIRQEN = 1; // start cell transfer on IRQ
+	while (read_length > 0)
+	{
+		block_length = read_length;
+		if (block_length > DMA_MAX_BLOCK_SIZE)
+		{
+			block_length = DMA_MAX_BLOCK_SIZE;
+		}
+		DCH2INTCLR = 0x00ff00ff; // clear existing events, disable all interrupts
+		DCH2SSA = VIRTUAL_TO_PHYSICAL(&SPI4BUF); // transfer source physical address
+		DCH2DSA = VIRTUAL_TO_PHYSICAL(read_buffer); // transfer destination physical address
+		DCH2SSIZ = 1; // source size
+		DCH2DSIZ = block_length; // destination size
+		DCH2CSIZ = 1; // cell size (bytes transferred per event)
+		DCH1INTCLR = 0x00ff00ff; // clear existing events, disable all interrupts
+		DCH1SSA = VIRTUAL_TO_PHYSICAL(read_buffer); // transfer source physical address
+		DCH1DSA = VIRTUAL_TO_PHYSICAL(&SPI4BUF); // transfer destination physical address
+		DCH1SSIZ = block_length; // source size
+		DCH1DSIZ = 1; // destination size
+		DCH1CSIZ = 1; // cell size (bytes transferred per event)
+		// Enable receive channel first, so that it is ready before the
+		// first byte is transmitted.
+		DCH2CONbits.CHEN = 1;
+		DCH1CONbits.CHEN = 1;
+		// Once every byte has been received, every byte must also have been
+		// transmitted.
+		while (DCH2INTbits.CHBCIF == 0)
+		{
+			// do nothing
+		}
+		DCH1CONbits.CHEN = 0;
+		DCH2CONbits.CHEN = 0;
+		read_buffer += block_length;
+		read_length -= block_length;
+	}
+}
+
 /** Issue a command via. SPI4. Commands are used to read, write and configure
   * the SST25x serial flash. A command consists of a bunch of bytes to transmit
   * followed by a bunch of bytes to receive.
@@ -196,10 +280,17 @@ static void spiCommand(const uint8_t *command_buffer, unsigned int command_lengt
 		dummy = readSPI();
 	}
 	// Read stage: write dummy values, reading values into the read buffer.
-	for (i = 0; i < read_length; i++)
+	if (read_length >= DMA_READ_THRESHOLD)
+	{
+		dmaReadSPI(read_buffer, read_length);
+	}
+	else
 	{
-		writeSPI(0);
-		read_buffer[i] = readSPI();
+		for (i = 0; i < read_length; i++)
+		{
+			writeSPI(0);
+			read_buffer[i] = readSPI();
+		}
 	}
 	asm("nop"); // delay just to be sure
 	PORTBbits.RB8 = 1; // set slave select high
@@ -287,11 +378,13 @@ void sst25xRead(uint8_t *data, uint32_t address, uint32_t length)
 {
 	uint8_t command_buffer[4];
 
+	PROFILE_ENTER(PROFILE_NV_IO);
 	command_buffer[0] = SST25X_READ;
 	command_buffer[1] = (uint8_t)(address >> 16);
 	command_buffer[2] = (uint8_t)(address >> 8);
 	command_buffer[3] = (uint8_t)(address);
 	spiCommand(command_buffer, 4, data, length);
+	PROFILE_EXIT();
 }
 
 /** Erase an entire sector (#SECTOR_SIZE bytes) of the SST25x serial flash.
@@ -305,7 +398,9 @@ void sst25xEraseSector(uint32_t address)
 	uint8_t command_buffer[4];
 	uint8_t read_buffer[1];
 
+	PROFILE_ENTER(PROFILE_NV_IO);
 	address &= (0xffffffff ^ (SECTOR_SIZE - 1)); // align to multiple of SECTOR_SIZE
+	TRACE(TRACE_NV_ERASE_BEGIN, address / SECTOR_SIZE);
 	sst25xWriteEnable();
 	command_buffer[0] = SST25X_SECTOR_ERASE_4K;
 	command_buffer[1] = (uint8_t)(address >> 16);
@@ -314,24 +409,30 @@ void sst25xEraseSector(uint32_t address)
 	spiCommand(command_buffer, 4, read_buffer, 0);
 	sst25xWaitUntilNotBusy();
 	sst25xWriteDisable(); // just to be safe
+	TRACE(TRACE_NV_ERASE_END, address / SECTOR_SIZE);
+	PROFILE_EXIT();
 }
 
-/** Program an entire sector (#SECTOR_SIZE bytes) of the SST25x serial flash.
-  * Programming allows the sector to be written with arbitrary data. Before
-  * calling this, the sector should be in an erased state (use
-  * sst25xEraseSector() to do that).
-  * \param data The data to program the sector with. This must be
-  *             exactly #SECTOR_SIZE bytes in size
-  * \param address The address of the sector to program. This must be aligned
-  *                to a multiple of #SECTOR_SIZE.
+/** Program a range of the SST25x serial flash, using auto-address increment
+  * word programming. This is the common part of sst25xProgramWords() and
+  * sst25xProgramPattern().
+  * \param data The data to program the range with.
+  * \param stride How far to advance data after each word. This is 2 to
+  *               program consecutive bytes from data, or 0 to program
+  *               every word with the same 2 bytes.
+  * \param address The address of the start of the range. This must be a
+  *                multiple of 2.
+  * \param length The number of bytes to program. This must be a non-zero
+  *               multiple of 2.
   */
-void sst25xProgramSector(uint8_t *data, uint32_t address)
+static void programWordsAAI(uint8_t *data, unsigned int stride, uint32_t address, uint32_t length)
 {
 	unsigned int i;
 	uint8_t command_buffer[6];
 	uint8_t read_buffer[1];
 
-	address &= (0xffffffff ^ (SECTOR_SIZE - 1)); // align to multiple of SECTOR_SIZE
+	PROFILE_ENTER(PROFILE_NV_IO);
+	address &= 0xfffffffe; // AAI word program requires A0 = 0
 	// Use auto-address increment mode with software end-of-write detection.
 	// This follows Figure 11 of the SST25VF080B datasheet.
 	sst25xWriteEnable();
@@ -343,14 +444,66 @@ void sst25xProgramSector(uint8_t *data, uint32_t address)
 	command_buffer[5] = data[1];
 	spiCommand(command_buffer, 6, read_buffer, 0);
 	sst25xWaitUntilNotBusy();
-	for (i = 2; i < SECTOR_SIZE; i += 2)
+	for (i = 2; i < length; i += 2)
 	{
+		data += stride;
 		command_buffer[0] = SST25X_AAI_WORD_PROGRAM;
-		command_buffer[1] = data[i];
-		command_buffer[2] = data[i + 1];
+		command_buffer[1] = data[0];
+		command_buffer[2] = data[1];
 		spiCommand(command_buffer, 3, read_buffer, 0);
 		sst25xWaitUntilNotBusy();
 	}
 	sst25xWriteDisable(); // exit AAI mode
 	sst25xWaitUntilNotBusy(); // just to be safe
+	PROFILE_EXIT();
+}
+
+/** Program a range of the SST25x serial flash, using auto-address increment
+  * word programming. Programming can only change bits from 1 to 0; bytes
+  * which should be left alone can be programmed with 0xff. Unlike
+  * sst25xProgramSector(), this does not require the range to be erased
+  * first, as long as no bit needs to go from 0 to 1.
+  * \param data The data to program the range with. This must be length
+  *             bytes in size.
+  * \param address The address of the start of the range. This must be a
+  *                multiple of 2.
+  * \param length The number of bytes to program. This must be a non-zero
+  *               multiple of 2.
+  */
+void sst25xProgramWords(uint8_t *data, uint32_t address, uint32_t length)
+{
+	programWordsAAI(data, 2, address, length);
+}
+
+/** Program every byte in a range of the SST25x serial flash with the same
+  * value. This is like sst25xProgramWords(), except that it doesn't need
+  * a buffer as big as the range.
+  * \param pattern The value to program every byte in the range with.
+  * \param address The address of the start of the range. This must be a
+  *                multiple of 2.
+  * \param length The number of bytes to program. This must be a non-zero
+  *               multiple of 2.
+  */
+void sst25xProgramPattern(uint8_t pattern, uint32_t address, uint32_t length)
+{
+	uint8_t word[2];
+
+	word[0] = pattern;
+	word[1] = pattern;
+	programWordsAAI(word, 0, address, length);
+}
+
+/** Program an entire sector (#SECTOR_SIZE bytes) of the SST25x serial flash.
+  * Programming allows the sector to be written with arbitrary data. Before
+  * calling this, the sector should be in an erased state (use
+  * sst25xEraseSector() to do that).
+  * \param data The data to program the sector with. This must be
+  *             exactly #SECTOR_SIZE bytes in size
+  * \param address The address of the sector to program. This must be aligned
+  *                to a multiple of #SECTOR_SIZE.
+  */
+void sst25xProgramSector(uint8_t *data, uint32_t address)
+{
+	address &= (0xffffffff ^ (SECTOR_SIZE - 1)); // align to multiple of SECTOR_SIZE
+	sst25xProgramWords(data, address, SECTOR_SIZE);
 }
@@ -2,6 +2,9 @@
   *
   * \brief Describes functions and constants exported by sst25x.c.
   *
+  * This file also describes how the serial flash is divided up into
+  * partitions; see nvmem_manager.c for how the partitions are used.
+  *
   * This file is licensed as described by the file LICENCE.
   */
 
@@ -16,21 +19,74 @@
   *          be invalid.
   */
 #define SECTOR_SIZE             4096
-/** Total number of bytes in non-volatile storage.
-  * This has been temporarily reduced to the size of the wallet storage area.
-  * It will be increased back to the real value when storage partitioning is
-  * implemented.
+#ifndef NV_MEMORY_SIZE
+/** Total number of bytes in non-volatile storage. The default is the size
+  * of the SST25VF080B (8 megabits).
   * \warning This must be much smaller than 2 ^ 32 or some overflow checks
-  *          in nvmem_manager.c won't work.
+  *          in nvmem_manager.c won't work. The SST25x series uses 24 bit
+  *          addresses anyway, so this can't be more than 16 megabytes.
   */
-#define NV_MEMORY_SIZE          4096
-/** Size of global partition, in bytes. This is large enough to reduce wear
-  * (due to DRBG state writes) by a factor of at least 10, but only reduces
-  * maximum number of simultaneous accounts by about 25%. */
-#define GLOBAL_PARTITION_SIZE   1024
-/** Size of accounts partition, in bytes. This is
-  * just #NV_MEMORY_SIZE - #GLOBAL_PARTITION_SIZE. */
-#define ACCOUNTS_PARTITION_SIZE 3072
+#define NV_MEMORY_SIZE          1048576
+#endif // #ifndef NV_MEMORY_SIZE
+#ifndef GLOBAL_PARTITION_SECTORS
+/** Number of sectors which the global partition rotates between. The global
+  * partition is rewritten much more often than anything else (every time
+  * the entropy pool is updated), so each time it needs an erase, it is
+  * written to the next of these sectors instead of being erased in place.
+  * This divides the wear on each sector by this number. */
+#define GLOBAL_PARTITION_SECTORS 8
+#endif // #ifndef GLOBAL_PARTITION_SECTORS
+/** Number of bytes at the end of each global partition sector which are
+  * used to store a sequence number. nvmem_manager.c uses the sequence
+  * number to find the most recently written copy of the global
+  * partition. */
+#define GLOBAL_SECTOR_HEADER_SIZE 8
+/** Size of global partition, in bytes. The global partition occupies one
+  * sector (less the sequence number), so that writes to it never disturb
+  * the accounts partition and vice versa. */
+#define GLOBAL_PARTITION_SIZE   (SECTOR_SIZE - GLOBAL_SECTOR_HEADER_SIZE)
+/** Address in non-volatile storage where the accounts partition starts.
+  * This is just after the sectors used by the global partition. */
+#define ACCOUNTS_PARTITION_START (GLOBAL_PARTITION_SECTORS * SECTOR_SIZE)
+#ifndef ACCOUNTS_PARTITION_SIZE
+/** Size of accounts partition, in bytes. This must be a multiple
+  * of #SECTOR_SIZE. 256 kilobytes is enough for more than 1000 wallets, yet
+  * keeps the time taken to sanitise the partition (which involves erasing
+  * every sector three times) down to several seconds. Space beyond the end
+  * of the accounts partition is left free for future partitions. */
+#define ACCOUNTS_PARTITION_SIZE (64 * SECTOR_SIZE)
+#endif // #ifndef ACCOUNTS_PARTITION_SIZE
+
+#ifdef NV_STATISTICS
+/** Number of sectors reserved for non-volatile storage statistics (see
+  * nvmem_manager.c). Statistics records are appended to one of these
+  * sectors until it is full; then the next one is erased and used. There
+  * must be at least 2, so that the most recent record survives if power is
+  * lost during that erase. */
+#define STATISTICS_SECTORS		2
+/** Address in non-volatile storage where the statistics sectors start. This
+  * is just after the accounts partition. */
+#define STATISTICS_START		(ACCOUNTS_PARTITION_START + ACCOUNTS_PARTITION_SIZE)
+/** Number of sectors which have an erase counter. This includes every sector
+  * which nvmem_manager.c ever erases, including the statistics sectors
+  * themselves. */
+#define ERASE_COUNTED_SECTORS	((STATISTICS_START / SECTOR_SIZE) + STATISTICS_SECTORS)
+#endif // #ifdef NV_STATISTICS
+
+#if (ACCOUNTS_PARTITION_SIZE % SECTOR_SIZE) != 0
+#error "ACCOUNTS_PARTITION_SIZE must be a multiple of SECTOR_SIZE"
+#endif
+#if GLOBAL_PARTITION_SECTORS < 1
+#error "GLOBAL_PARTITION_SECTORS must be at least 1"
+#endif
+#if (ACCOUNTS_PARTITION_START + ACCOUNTS_PARTITION_SIZE) > NV_MEMORY_SIZE
+#error "Partitions don't fit in non-volatile storage"
+#endif
+#ifdef NV_STATISTICS
+#if (STATISTICS_START + STATISTICS_SECTORS * SECTOR_SIZE) > NV_MEMORY_SIZE
+#error "Statistics sectors don't fit in non-volatile storage"
+#endif
+#endif // #ifdef NV_STATISTICS
 
 extern void initSST25x(void);
 extern uint8_t sst25xReadStatusRegister(void);
@@ -38,5 +94,7 @@ extern void sst25xWriteStatusRegister(uint8_t sst25x_status_register);
 extern void sst25xRead(uint8_t *data, uint32_t address, uint32_t length);
 extern void sst25xEraseSector(uint32_t address);
 extern void sst25xProgramSector(uint8_t *data, uint32_t address);
+extern void sst25xProgramWords(uint8_t *data, uint32_t address, uint32_t length);
+extern void sst25xProgramPattern(uint8_t pattern, uint32_t address, uint32_t length);
 
 #endif	// #ifndef PIC32_SST25X_H
@@ -59,6 +59,8 @@ static const char str_WALLET_INVALID_OPERATION[] = "Operation not allowed";
 static const char str_WALLET_ALREADY_EXISTS[] = "Wallet already exists";
 /** String for #WALLET_BAD_ADDRESS wallet error. */
 static const char str_WALLET_BAD_ADDRESS[] = "Bad non-volatile storage address or partition number";
+/** String for #WALLET_INVALID_CONTEXT wallet error. */
+static const char str_WALLET_INVALID_CONTEXT[] = "Invalid wallet context number";
 /** String for #TRANSACTION_INVALID_FORMAT transaction parser error. */
 static const char str_TRANSACTION_INVALID_FORMAT[] = "Format of transaction is unknown or invalid";
 /** String for #TRANSACTION_TOO_MANY_INPUTS transaction parser error. */
@@ -77,25 +79,22 @@ static const char str_TRANSACTION_INVALID_REFERENCE[] = "Invalid transaction ref
 static const char str_UNKNOWN[] = "Unknown error";
 /**@}*/
 
-/** Obtain one character from one of the device's strings.
+/** Find one of the device's strings, so that it can be copied or written
+  * out in one go.
   * \param set Specifies which set of strings to use; should be
   *            one of #StringSetEnum.
-  * \param spec Specifies which string to get the character from. The
-  *             interpretation of this depends on the value of set;
-  *             see #StringSetEnum for clarification.
-  * \param pos The position of the character within the string; 0 means first,
-  *            1 means second etc.
-  * \return The character from the specified string.
+  * \param spec Specifies which string to get. The interpretation of this
+  *             depends on the value of set; see #StringSetEnum for
+  *             clarification.
+  * \param out_length The length of the string, in number of characters, will
+  *                   be written here.
+  * \return A pointer to the first character of the string. The string
+  *         is not guaranteed to be null-terminated.
   */
-char getString(StringSet set, uint8_t spec, uint16_t pos)
+const char *getStringSpan(StringSet set, uint8_t spec, uint16_t *out_length)
 {
 	const char *str;
 
-	if (pos >= getStringLength(set, spec))
-	{
-		// Attempting to read beyond end of string.
-		return 0;
-	}
 	if (set == STRINGSET_MISC)
 	{
 		switch (spec)
@@ -172,6 +171,9 @@ char getString(StringSet set, uint8_t spec, uint16_t pos)
 		case WALLET_BAD_ADDRESS:
 			str = str_WALLET_BAD_ADDRESS;
 			break;
+		case WALLET_INVALID_CONTEXT:
+			str = str_WALLET_INVALID_CONTEXT;
+			break;
 		default:
 			str = str_UNKNOWN;
 			break;
@@ -211,6 +213,31 @@ char getString(StringSet set, uint8_t spec, uint16_t pos)
 	{
 		str = str_UNKNOWN;
 	}
+	*out_length = (uint16_t)strlen(str);
+	return str;
+}
+
+/** Obtain one character from one of the device's strings.
+  * \param set Specifies which set of strings to use; should be
+  *            one of #StringSetEnum.
+  * \param spec Specifies which string to get the character from. The
+  *             interpretation of this depends on the value of set;
+  *             see #StringSetEnum for clarification.
+  * \param pos The position of the character within the string; 0 means first,
+  *            1 means second etc.
+  * \return The character from the specified string.
+  */
+char getString(StringSet set, uint8_t spec, uint16_t pos)
+{
+	const char *str;
+	uint16_t length;
+
+	str = getStringSpan(set, spec, &length);
+	if (pos >= length)
+	{
+		// Attempting to read beyond end of string.
+		return 0;
+	}
 	return str[pos];
 }
 
@@ -224,120 +251,8 @@ char getString(StringSet set, uint8_t spec, uint16_t pos)
   */
 uint16_t getStringLength(StringSet set, uint8_t spec)
 {
-	if (set == STRINGSET_MISC)
-	{
-		switch (spec)
-		{
-		case MISCSTR_VENDOR:
-			return (uint16_t)(sizeof(str_MISCSTR_VENDOR) - 1);
-			break;
-		case MISCSTR_PERMISSION_DENIED_USER:
-			return (uint16_t)(sizeof(str_MISCSTR_PERMISSION_DENIED_USER) - 1);
-			break;
-		case MISCSTR_INVALID_PACKET:
-			return (uint16_t)(sizeof(str_MISCSTR_INVALID_PACKET) - 1);
-			break;
-		case MISCSTR_PARAM_TOO_LARGE:
-			return (uint16_t)(sizeof(str_MISCSTR_PARAM_TOO_LARGE) - 1);
-			break;
-		case MISCSTR_PERMISSION_DENIED_HOST:
-			return (uint16_t)(sizeof(str_MISCSTR_PERMISSION_DENIED_HOST) - 1);
-			break;
-		case MISCSTR_UNEXPECTED_PACKET:
-			return (uint16_t)(sizeof(str_MISCSTR_UNEXPECTED_PACKET) - 1);
-			break;
-		case MISCSTR_OTP_MISMATCH:
-			return (uint16_t)(sizeof(str_MISCSTR_OTP_MISMATCH) - 1);
-			break;
-        case MISCSTR_CONFIG:
-			return (uint16_t)(sizeof(str_MISCSTR_CONFIG) - 1);
-			break;
-		default:
-			return (uint16_t)(sizeof(str_UNKNOWN) - 1);
-			break;
-		}
-	}
-	else if (set == STRINGSET_WALLET)
-	{
-		switch (spec)
-		{
-		case WALLET_FULL:
-			return (uint16_t)(sizeof(str_WALLET_FULL) - 1);
-			break;
-		case WALLET_EMPTY:
-			return (uint16_t)(sizeof(str_WALLET_EMPTY) - 1);
-			break;
-		case WALLET_READ_ERROR:
-			return (uint16_t)(sizeof(str_WALLET_READ_ERROR) - 1);
-			break;
-		case WALLET_WRITE_ERROR:
-			return (uint16_t)(sizeof(str_WALLET_WRITE_ERROR) - 1);
-			break;
-		case WALLET_NOT_THERE:
-			return (uint16_t)(sizeof(str_WALLET_NOT_THERE) - 1);
-			break;
-		case WALLET_NOT_LOADED:
-			return (uint16_t)(sizeof(str_WALLET_NOT_LOADED) - 1);
-			break;
-		case WALLET_INVALID_HANDLE:
-			return (uint16_t)(sizeof(str_WALLET_INVALID_HANDLE) - 1);
-			break;
-		case WALLET_BACKUP_ERROR:
-			return (uint16_t)(sizeof(str_WALLET_BACKUP_ERROR) - 1);
-			break;
-		case WALLET_RNG_FAILURE:
-			return (uint16_t)(sizeof(str_WALLET_RNG_FAILURE) - 1);
-			break;
-		case WALLET_INVALID_WALLET_NUM:
-			return (uint16_t)(sizeof(str_WALLET_INVALID_WALLET_NUM) - 1);
-			break;
-		case WALLET_INVALID_OPERATION:
-			return (uint16_t)(sizeof(str_WALLET_INVALID_OPERATION) - 1);
-			break;
-        case WALLET_ALREADY_EXISTS:
-			return (uint16_t)(sizeof(str_WALLET_ALREADY_EXISTS) - 1);
-			break;
-		case WALLET_BAD_ADDRESS:
-			return (uint16_t)(sizeof(str_WALLET_BAD_ADDRESS) - 1);
-			break;
-		default:
-			return (uint16_t)(sizeof(str_UNKNOWN) - 1);
-			break;
-		}
-	}
-	else if (set == STRINGSET_TRANSACTION)
-	{
-		switch (spec)
-		{
-		case TRANSACTION_INVALID_FORMAT:
-			return (uint16_t)(sizeof(str_TRANSACTION_INVALID_FORMAT) - 1);
-			break;
-		case TRANSACTION_TOO_MANY_INPUTS:
-			return (uint16_t)(sizeof(str_TRANSACTION_TOO_MANY_INPUTS) - 1);
-			break;
-		case TRANSACTION_TOO_MANY_OUTPUTS:
-			return (uint16_t)(sizeof(str_TRANSACTION_TOO_MANY_OUTPUTS) - 1);
-			break;
-		case TRANSACTION_TOO_LARGE:
-			return (uint16_t)(sizeof(str_TRANSACTION_TOO_LARGE) - 1);
-			break;
-		case TRANSACTION_NON_STANDARD:
-			return (uint16_t)(sizeof(str_TRANSACTION_NON_STANDARD) - 1);
-			break;
-		case TRANSACTION_INVALID_AMOUNT:
-			return (uint16_t)(sizeof(str_TRANSACTION_INVALID_AMOUNT) - 1);
-			break;
-		case TRANSACTION_INVALID_REFERENCE:
-			return (uint16_t)(sizeof(str_TRANSACTION_INVALID_REFERENCE) - 1);
-			break;
-		default:
-			return (uint16_t)(sizeof(str_UNKNOWN) - 1);
-			break;
-		}
-	}
-	else
-	{
-		return (uint16_t)(sizeof(str_UNKNOWN) - 1);
-	}
-}
+	uint16_t length;
 
+	getStringSpan(set, spec, &length);
+	return length;
+}
@@ -0,0 +1,427 @@
+// ***********************************************************************
+// crypto_bench_tester.c
+// ***********************************************************************
+//
+// Collect on-device benchmark results from hardware Bitcoin wallet using a
+// CP2110-like USB HID wire protocol. This uses HIDAPI. The firmware should
+// be compiled with the "TEST_CRYPTO_BENCH" preprocessor definition set (see
+// ../../../crypto_bench.c).
+//
+// Results are displayed and also written, in comma-separated values format,
+// to a file, so that different builds (eg. with and without
+// BIGNUM_32BIT_LIMBS, ECDSA_NO_G_TABLE or AES_TTABLE) can be compared.
+//
+// This file is licensed as described by the file LICENCE.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "hidapi/hidapi.h"
+
+// Vendor ID of target device. This must match the vendor ID in the
+// device's device descriptor.
+#define TARGET_VID				0x04f3
+// Product ID of target device. This must match the product ID in the
+// device's device descriptor.
+#define TARGET_PID				0x0210
+
+// Handle to HID device, so that it doesn't have to be passed as a parameter
+// all the time.
+static hid_device *handle;
+
+// Most recently received report. This does include the report ID.
+static uint8_t received_report[64];
+// Size of most recently received report. This does include the report ID.
+static unsigned int received_report_length;
+// Next byte to grab from most recently received report.
+static unsigned int received_report_index;
+// Report to send, which is built up as bytes are sent using sendByte().
+// Does not include the report ID.
+static uint8_t report_to_send[63];
+// Current length of next report to send. Does not include the report ID.
+static unsigned int report_to_send_length;
+
+// Read a 32-bit unsigned integer from the byte array specified by in.
+// The bytes will be read in a little-endian format.
+static uint32_t readU32LittleEndian(uint8_t *in)
+{
+	return ((uint32_t)in[0])
+		| ((uint32_t)in[1] << 8)
+		| ((uint32_t)in[2] << 16)
+		| ((uint32_t)in[3] << 24);
+}
+
+// Get next byte from the current USB HID report.
+static uint8_t receiveByte(void)
+{
+	int r;
+	unsigned int data_size;
+
+	while (received_report_index >= received_report_length)
+	{
+		// Finished with current report; need to get another report.
+		r = hid_read(handle, received_report, sizeof(received_report));
+		if (r < 0)
+		{
+			printf("hid_read() failed, error: %ls\n", hid_error(handle));
+			exit(1);
+		}
+		else if (r == 0)
+		{
+			printf("Got 0 length report. That doesn't make sense.\n");
+			exit(1);
+		}
+		data_size = received_report[0]; // report ID
+		if ((data_size > 63) || (data_size > (unsigned int)(r - 1)))
+		{
+			printf("Got invalid report ID: %u\n", data_size);
+			exit(1);
+		}
+		received_report_length = data_size + 1;
+		received_report_index = 1;
+	}
+	return received_report[received_report_index++];
+}
+
+// Unconditionally send report_to_send over the USB HID link.
+// Calling this too often leads to poor throughput.
+static void flushReportToSend(void)
+{
+	uint8_t packet_buffer[64];
+
+	if (report_to_send_length > 0)
+	{
+		packet_buffer[0] = (uint8_t)report_to_send_length;
+		if (report_to_send_length > (sizeof(packet_buffer) - 1))
+		{
+			printf("Report too big in flushReportToSend()\n");
+			exit(1);
+		}
+		memcpy(&(packet_buffer[1]), report_to_send, report_to_send_length);
+		if (hid_write(handle, packet_buffer, report_to_send_length + 1) < 0)
+		{
+			printf("hid_write() failed, error: %ls\n", hid_error(handle));
+			exit(1);
+		}
+		report_to_send_length = 0;
+	}
+}
+
+// Queue byte for sending in the next USB HID report.
+// This won't necessarily send anything. To flush the queue and actually
+// send something, call flushReportToSend().
+static void sendByte(uint8_t data)
+{
+	while (report_to_send_length >= sizeof(report_to_send))
+	{
+		// Report to send is full; flush it.
+		flushReportToSend();
+	}
+	report_to_send[report_to_send_length++] = data;
+}
+
+// Receive a 32-bit unsigned integer (in little-endian format) from the
+// device.
+static uint32_t receiveU32(void)
+{
+	uint8_t buffer[4];
+	int i;
+
+	for (i = 0; i < 4; i++)
+	{
+		buffer[i] = receiveByte();
+	}
+	return readU32LittleEndian(buffer);
+}
+
+// Receive benchmark results from the device, display them and write them
+// (in the same comma-separated values format as the host benchmarks in
+// ../../../bench.c) to the file specified by f_results.
+static void receiveResults(FILE *f_results)
+{
+	char name[256];
+	uint32_t counts_per_second;
+	uint32_t cycles_per_count;
+	uint32_t iterations;
+	uint32_t bytes_per_op;
+	uint32_t counts;
+	double ns_per_op;
+	double cycles_per_op;
+	double bytes_per_second;
+	int name_length;
+	int i;
+
+	counts_per_second = receiveU32();
+	cycles_per_count = receiveU32();
+	printf("Cycle counter frequency: %u Hz, CPU cycles per count: %u\n", counts_per_second, cycles_per_count);
+	fprintf(f_results, "name,iterations,bytes_per_op,ns_per_op,cycles_per_op,bytes_per_second\n");
+	while (1)
+	{
+		name_length = receiveByte();
+		if (name_length == 0)
+		{
+			break; // end of results
+		}
+		for (i = 0; i < name_length; i++)
+		{
+			name[i] = (char)receiveByte();
+		}
+		name[name_length] = '\0';
+		iterations = receiveU32();
+		bytes_per_op = receiveU32();
+		counts = receiveU32();
+		if (iterations == 0)
+		{
+			iterations = 1; // avoid division by zero
+		}
+		ns_per_op = (double)counts * 1.0e9 / (double)counts_per_second / (double)iterations;
+		cycles_per_op = (double)counts * (double)cycles_per_count / (double)iterations;
+		if (bytes_per_op != 0)
+		{
+			bytes_per_second = (double)bytes_per_op * 1.0e9 / ns_per_op;
+		}
+		else
+		{
+			bytes_per_second = 0.0;
+		}
+		printf("%-20s %6u ops %16.1f ns/op %14.1f cycles/op", name, iterations, ns_per_op, cycles_per_op);
+		if (bytes_per_op != 0)
+		{
+			printf(" %10.3f kB/s", bytes_per_second / 1.0e3);
+		}
+		printf("\n");
+		fprintf(f_results, "%s,%u,%u,%.1f,%.1f,%.0f\n", name, iterations, bytes_per_op, ns_per_op, cycles_per_op, bytes_per_second);
+	}
+}
+
+// A |t| above this is considered evidence of timing leakage. This is the
+// threshold which dudect uses (see ../../../bench.c).
+#define LEAKAGE_T_THRESHOLD		4.5
+
+// Percentiles above which measurements are discarded, for each cropped
+// t-test in leakageMaxT().
+static const double leakage_crop_percentiles[] = {50.0, 75.0, 90.0, 95.0, 99.0};
+
+// Comparison function for qsort(), for sorting measurements in ascending
+// order.
+static int compareDoubles(const void *a, const void *b)
+{
+	double x;
+	double y;
+
+	x = *(const double *)a;
+	y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// Calculate Welch's t statistic for the measurements which are no larger
+// than threshold. classes[i] is the class (0 = fixed, 1 = random) of
+// measurement i.
+static double leakageT(double *measurements, uint8_t *classes, uint32_t count, double threshold)
+{
+	double n[2];
+	double sum[2];
+	double sum_sq[2];
+	double mean[2];
+	double var[2];
+	uint32_t i;
+	int c;
+
+	memset(n, 0, sizeof(n));
+	memset(sum, 0, sizeof(sum));
+	memset(sum_sq, 0, sizeof(sum_sq));
+	for (i = 0; i < count; i++)
+	{
+		if (measurements[i] <= threshold)
+		{
+			c = classes[i] & 1;
+			n[c] += 1.0;
+			sum[c] += measurements[i];
+		}
+	}
+	if ((n[0] < 2.0) || (n[1] < 2.0))
+	{
+		return 0.0;
+	}
+	mean[0] = sum[0] / n[0];
+	mean[1] = sum[1] / n[1];
+	for (i = 0; i < count; i++)
+	{
+		if (measurements[i] <= threshold)
+		{
+			c = classes[i] & 1;
+			sum_sq[c] += (measurements[i] - mean[c]) * (measurements[i] - mean[c]);
+		}
+	}
+	var[0] = sum_sq[0] / (n[0] - 1.0);
+	var[1] = sum_sq[1] / (n[1] - 1.0);
+	if ((var[0] + var[1]) == 0.0)
+	{
+		return 0.0;
+	}
+	return (mean[0] - mean[1]) / sqrt((var[0] / n[0]) + (var[1] / n[1]));
+}
+
+// Get the largest |t| over the uncropped measurements and the measurements
+// cropped at each of leakage_crop_percentiles.
+static double leakageMaxT(double *measurements, uint8_t *classes, uint32_t count)
+{
+	double *sorted;
+	double t;
+	double max_t;
+	unsigned int j;
+
+	sorted = malloc(count * sizeof(double));
+	if (sorted == NULL)
+	{
+		printf("Out of memory\n");
+		exit(1);
+	}
+	memcpy(sorted, measurements, count * sizeof(double));
+	qsort(sorted, count, sizeof(double), compareDoubles);
+	max_t = fabs(leakageT(measurements, classes, count, sorted[count - 1]));
+	for (j = 0; j < (sizeof(leakage_crop_percentiles) / sizeof(leakage_crop_percentiles[0])); j++)
+	{
+		t = fabs(leakageT(measurements, classes, count, sorted[(uint32_t)(leakage_crop_percentiles[j] * (count - 1) / 100.0)]));
+		if (t > max_t)
+		{
+			max_t = t;
+		}
+	}
+	free(sorted);
+	return max_t;
+}
+
+// Receive timing leakage measurements from the device, run Welch's t-test
+// on them, display the results and write them (in comma-separated values
+// format) to the file specified by f_results.
+static void receiveLeakageResults(FILE *f_results)
+{
+	char name[256];
+	double *measurements;
+	uint8_t *classes;
+	uint32_t count;
+	uint32_t i;
+	double max_t;
+	int name_length;
+	int j;
+
+	fprintf(f_results, "name,measurements,max_abs_t\n");
+	while (1)
+	{
+		name_length = receiveByte();
+		if (name_length == 0)
+		{
+			break; // end of results
+		}
+		for (j = 0; j < name_length; j++)
+		{
+			name[j] = (char)receiveByte();
+		}
+		name[name_length] = '\0';
+		count = receiveU32();
+		measurements = malloc(count * sizeof(double));
+		classes = malloc(count);
+		if ((count == 0) || (measurements == NULL) || (classes == NULL))
+		{
+			printf("Invalid number of measurements: %u\n", count);
+			exit(1);
+		}
+		for (i = 0; i < count; i++)
+		{
+			classes[i] = receiveByte();
+			measurements[i] = (double)receiveU32();
+		}
+		max_t = leakageMaxT(measurements, classes, count);
+		printf("%-20s %6u measurements, max |t| = %8.2f", name, count, max_t);
+		if (max_t > LEAKAGE_T_THRESHOLD)
+		{
+			printf("  <-- probable timing leakage");
+		}
+		printf("\n");
+		fprintf(f_results, "%s,%u,%.2f\n", name, count, max_t);
+		free(measurements);
+		free(classes);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *results_file_name;
+	FILE *f_results;
+	int leakage_test;
+	int arg;
+
+	leakage_test = 0;
+	arg = 1;
+	if ((argc > arg) && !strcmp(argv[arg], "-l"))
+	{
+		leakage_test = 1;
+		arg++;
+	}
+	if (argc > (arg + 1))
+	{
+		printf("Usage: %s [-l] [<results file>]\n", argv[0]);
+		printf("Use -l to test for timing leakage instead of benchmarking.\n");
+		exit(1);
+	}
+	if (argc == (arg + 1))
+	{
+		results_file_name = argv[arg];
+	}
+	else if (leakage_test)
+	{
+		results_file_name = "crypto_leakage_results.csv";
+	}
+	else
+	{
+		results_file_name = "crypto_bench_results.csv";
+	}
+
+	if (hid_init())
+	{
+		printf("hid_init() failed\n");
+		exit(1);
+	}
+
+	// Open the device using the VID, PID,
+	handle = hid_open(TARGET_VID, TARGET_PID, NULL);
+	if (!handle)
+	{
+		printf("Unable to open target device.\n");
+		printf("Are you running this as root?\n");
+		printf("Is the device plugged in?\n");
+ 		exit(1);
+	}
+
+	f_results = fopen(results_file_name, "w");
+	if (f_results == NULL)
+	{
+		printf("Could not open \"%s\" for writing\n", results_file_name);
+		exit(1);
+	}
+
+	if (leakage_test)
+	{
+		printf("Measuring timing leakage; this may take a while...\n");
+		sendByte('L'); // tell device to start
+		flushReportToSend();
+		receiveLeakageResults(f_results);
+	}
+	else
+	{
+		printf("Benchmarking; this may take a minute...\n");
+		sendByte(0); // tell device to start
+		flushReportToSend();
+		receiveResults(f_results);
+	}
+	printf("Results written to \"%s\"\n", results_file_name);
+
+	fclose(f_results);
+	hid_close(handle);
+	// Free static HIDAPI objects. 
+	hid_exit();
+	exit(0);
+}
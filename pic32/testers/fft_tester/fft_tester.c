@@ -12,8 +12,10 @@
 // results of forward and inverse FFTs done by GNU Octave with FFTs done by
 // the code in ../../../fft.c.
 //
-// This also shows how much time (in clock cycles) each FFT required; this
-// is useful for benchmarking.
+// This also shows how much time (in clock cycles) each FFT required, and
+// the average for each kind of FFT once all tests are done; this is useful
+// for benchmarking. For example, to compare the radix-2 and radix-4 kernels,
+// run this on firmware compiled with and without FFT_RADIX4 defined.
 //
 // This file is licensed as described by the file LICENCE.
 
@@ -450,6 +452,9 @@ int main(void)
 	char *newline_position;
 	char buffer[512];
 	uint8_t cycles_buffer[4];
+	uint32_t cycles;
+	double total_cycles[4]; // indexed by test type
+	int num_tests[4]; // indexed by test type
 	Complex input_normal[FFT_SIZE]; // input (normal-sized)
 	Complex expected_normal[FFT_SIZE]; // expected output (normal-sized)
 	Complex output_normal[FFT_SIZE]; // actual output (normal-sized)
@@ -484,6 +489,11 @@ int main(void)
 
 	succeeded = 0;
 	failed = 0;
+	for (i = 0; i < 4; i++)
+	{
+		total_cycles[i] = 0.0;
+		num_tests[i] = 0;
+	}
 	while (!feof(f_vectors))
 	{
 		for (i = 0; i < 4; i++)
@@ -549,7 +559,15 @@ int main(void)
 			{
 				cycles_buffer[j] = receiveByte();
 			}
-			printf("cycles = %u ", readU32LittleEndian(cycles_buffer));
+			cycles = readU32LittleEndian(cycles_buffer);
+			printf("cycles = %u ", cycles);
+			if (!is_overflow_detection)
+			{
+				// Overflow detection tests can bail out early, so they
+				// would skew the averages.
+				total_cycles[i] += (double)cycles;
+				num_tests[i]++;
+			}
 			if (matches)
 			{
 				printf("[pass]\n");
@@ -567,6 +585,19 @@ int main(void)
 		}
 	}
 
+	printf("Average cycles per FFT:\n");
+	for (i = 0; i < 4; i++)
+	{
+		printf("    %s, %s: ", (i & 1) ? "inverse" : "forward", (i < 2) ? "normal-sized" : "double-sized");
+		if (num_tests[i] > 0)
+		{
+			printf("%.0f\n", total_cycles[i] / num_tests[i]);
+		}
+		else
+		{
+			printf("no tests\n");
+		}
+	}
 	printf("Tests which succeeded: %d\n", succeeded);
 	printf("Tests which failed: %d\n", failed);
 
@@ -0,0 +1,605 @@
+// ***********************************************************************
+// hwb_load_tester.c
+// ***********************************************************************
+//
+// Load generator for the hardware bitcoin wallet. This opens many devices
+// at once and replays a scripted workload on all of them simultaneously
+// (one thread per device, since a device can only do one thing at a time).
+// When everything is finished, a latency histogram and throughput figures
+// are displayed for each operation in the script.
+//
+// Devices are either USB HID devices that use the stream-based protocol of
+// hwb_tester.c (this uses HIDAPI), or sockets of the host build
+// (see host/ in the top-level directory). Compile with -DNO_HIDAPI to leave
+// out USB HID support, so that HIDAPI isn't needed.
+//
+// The script is a text file. Each line is one of:
+// setup <packet file>
+//     Send the packet in <packet file> once per device, before timing
+//     starts (eg. to load a wallet).
+// op <name> <packet file>
+//     Send the packet in <packet file> and time how long it takes to get the
+//     final response. All the "op" lines are run in order, and the whole
+//     list is repeated (see the "-r" option).
+// Empty lines and lines beginning with '#' are ignored. Packet files are
+// in the same format as the ones used by hwb_tester.c. Paths to packet
+// files are relative to the current directory.
+//
+// Any ButtonRequest response is answered with ButtonAck, so the device
+// must be set up to accept actions without user interaction (eg. the host
+// build's "-y" option). PinRequest and OtpRequest are not answered; they
+// are counted as failures, as are Failure responses.
+//
+// This file is licensed as described by the file LICENCE.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "tester_transport.h"
+
+// Maximum number of devices which can be used at once.
+#define MAX_DEVICES				64
+// Maximum number of lines in a script.
+#define MAX_SCRIPT_LINES		256
+// Maximum length of an operation name.
+#define MAX_NAME_LENGTH			32
+// Number of latency histogram buckets. Bucket i counts latencies
+// from 2 ^ i to 2 ^ (i + 1) - 1 microseconds.
+#define NUM_BUCKETS				32
+// Upper limit (exclusive) of latency histogram bucket i, in microseconds.
+#define BUCKET_UPPER_LIMIT(i)	((uint64_t)2 << (i))
+
+// Packet types which need special treatment.
+#define PACKET_TYPE_FAILURE			0x35
+#define PACKET_TYPE_BUTTON_REQUEST	0x50
+#define PACKET_TYPE_BUTTON_ACK		0x51
+
+// One line of the script.
+typedef struct ScriptLineStruct
+{
+	// Non-zero for "setup" lines, zero for "op" lines.
+	int is_setup;
+	// Index into operations[] (only for "op" lines).
+	int op_index;
+	// Packet to send, including header.
+	uint8_t *packet;
+	uint32_t packet_length;
+} ScriptLine;
+
+// Statistics for one operation. Each thread has its own set, so that no
+// locking is needed while the workload is running.
+typedef struct OpStatsStruct
+{
+	uint64_t count;
+	uint64_t failures;
+	uint64_t total_us;
+	uint64_t min_us;
+	uint64_t max_us;
+	uint64_t buckets[NUM_BUCKETS];
+} OpStats;
+
+// Everything a worker thread needs.
+typedef struct WorkerStruct
+{
+	pthread_t thread;
+	Device device;
+	OpStats stats[MAX_SCRIPT_LINES];
+	// Non-zero if the device stopped responding properly.
+	int broken;
+} Worker;
+
+// The script.
+static ScriptLine script[MAX_SCRIPT_LINES];
+static int num_script_lines;
+// Names of the operations in the script.
+static char operations[MAX_SCRIPT_LINES][MAX_NAME_LENGTH];
+static int num_operations;
+// Number of times to repeat the "op" lines of the script.
+static unsigned int repeats = 100;
+// The devices, and the threads that drive them.
+static Worker workers[MAX_DEVICES];
+static int num_workers;
+// Workers wait on this so that they all start the timed part together.
+static pthread_barrier_t start_barrier;
+
+// Send a packet and wait for the final response, answering any
+// ButtonRequest along the way. Returns 0 if the response was anything but
+// Failure, PinRequest or OtpRequest, 1 if it was one of those, or -1 if the
+// device stopped responding properly.
+static int doTransaction(Device *device, uint8_t *packet, uint32_t packet_length)
+{
+	static uint8_t button_ack[8] = {'#', '#', 0x00, PACKET_TYPE_BUTTON_ACK, 0x00, 0x00, 0x00, 0x00};
+	uint8_t *response;
+	uint16_t type;
+
+	if (sendBytes(device, packet, packet_length))
+	{
+		return -1;
+	}
+	do
+	{
+		response = receivePacket(device, &type);
+		if (response == NULL)
+		{
+			return -1;
+		}
+		free(response);
+		if (type == PACKET_TYPE_BUTTON_REQUEST)
+		{
+			if (sendBytes(device, button_ack, sizeof(button_ack)))
+			{
+				return -1;
+			}
+		}
+	} while (type == PACKET_TYPE_BUTTON_REQUEST);
+	if ((type == PACKET_TYPE_FAILURE) || (type == 0x53) || (type == 0x56))
+	{
+		return 1;
+	}
+	return 0;
+}
+
+// Add one latency measurement to a set of statistics.
+static void recordLatency(OpStats *stats, uint64_t latency_us, int failed)
+{
+	int bucket;
+
+	if (failed)
+	{
+		stats->failures++;
+	}
+	if (stats->count == 0)
+	{
+		stats->min_us = latency_us;
+		stats->max_us = latency_us;
+	}
+	if (latency_us < stats->min_us)
+	{
+		stats->min_us = latency_us;
+	}
+	if (latency_us > stats->max_us)
+	{
+		stats->max_us = latency_us;
+	}
+	stats->count++;
+	stats->total_us += latency_us;
+	bucket = 0;
+	while ((bucket < (NUM_BUCKETS - 1)) && (latency_us >= BUCKET_UPPER_LIMIT(bucket)))
+	{
+		bucket++;
+	}
+	stats->buckets[bucket]++;
+}
+
+// Worker thread. This runs the whole script on one device.
+static void *workerThread(void *arg)
+{
+	Worker *worker;
+	unsigned int repeat;
+	int i;
+	int r;
+	uint64_t start;
+
+	worker = arg;
+	for (i = 0; i < num_script_lines; i++)
+	{
+		if (script[i].is_setup && !worker->broken)
+		{
+			r = doTransaction(&(worker->device), script[i].packet, script[i].packet_length);
+			if (r != 0)
+			{
+				printf("%s: setup packet on line %d failed\n", worker->device.name, i + 1);
+				worker->broken = 1;
+			}
+		}
+	}
+	pthread_barrier_wait(&start_barrier);
+	for (repeat = 0; (repeat < repeats) && !worker->broken; repeat++)
+	{
+		for (i = 0; (i < num_script_lines) && !worker->broken; i++)
+		{
+			if (!script[i].is_setup)
+			{
+				start = getMicroseconds();
+				r = doTransaction(&(worker->device), script[i].packet, script[i].packet_length);
+				if (r < 0)
+				{
+					worker->broken = 1;
+				}
+				else
+				{
+					recordLatency(&(worker->stats[script[i].op_index]), getMicroseconds() - start, r);
+				}
+			}
+		}
+	}
+	return NULL;
+}
+
+// Read a packet file. Returns the contents (which must be freed using
+// free()) on success, or NULL on error.
+static uint8_t *readPacketFile(const char *filename, uint32_t *out_length)
+{
+	FILE *f;
+	long int size;
+	uint8_t *buffer;
+
+	f = fopen(filename, "rb");
+	if (f == NULL)
+	{
+		printf("Couldn't open file \"%s\"\n", filename);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if ((size < 8) || (size > PACKET_LENGTH_LIMIT))
+	{
+		printf("\"%s\" doesn't contain a packet\n", filename);
+		fclose(f);
+		return NULL;
+	}
+	buffer = malloc((size_t)size);
+	if (fread(buffer, (size_t)size, 1, f) != 1)
+	{
+		printf("Couldn't read file \"%s\"\n", filename);
+		free(buffer);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	*out_length = (uint32_t)size;
+	return buffer;
+}
+
+// Read a script file. Returns 0 on success, non-zero on error.
+static int readScript(const char *filename)
+{
+	FILE *f;
+	char line[512];
+	char keyword[16];
+	char name[MAX_NAME_LENGTH];
+	char packet_filename[256];
+	int line_number;
+	int fields;
+	int i;
+	ScriptLine *s;
+
+	f = fopen(filename, "r");
+	if (f == NULL)
+	{
+		printf("Couldn't open script \"%s\"\n", filename);
+		return 1;
+	}
+	line_number = 0;
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		line_number++;
+		fields = sscanf(line, "%15s %31s %255s", keyword, name, packet_filename);
+		if ((fields <= 0) || (keyword[0] == '#'))
+		{
+			continue;
+		}
+		if (num_script_lines == MAX_SCRIPT_LINES)
+		{
+			printf("%s:%d: too many lines\n", filename, line_number);
+			fclose(f);
+			return 1;
+		}
+		s = &(script[num_script_lines]);
+		if (!strcmp(keyword, "setup") && (fields == 2))
+		{
+			s->is_setup = 1;
+			strcpy(packet_filename, name);
+		}
+		else if (!strcmp(keyword, "op") && (fields == 3))
+		{
+			s->is_setup = 0;
+			for (i = 0; i < num_operations; i++)
+			{
+				if (!strcmp(operations[i], name))
+				{
+					break;
+				}
+			}
+			if (i == num_operations)
+			{
+				strcpy(operations[num_operations], name);
+				num_operations++;
+			}
+			s->op_index = i;
+		}
+		else
+		{
+			printf("%s:%d: expected \"setup <file>\" or \"op <name> <file>\"\n", filename, line_number);
+			fclose(f);
+			return 1;
+		}
+		s->packet = readPacketFile(packet_filename, &(s->packet_length));
+		if (s->packet == NULL)
+		{
+			fclose(f);
+			return 1;
+		}
+		num_script_lines++;
+	}
+	fclose(f);
+	if (num_operations == 0)
+	{
+		printf("Script \"%s\" has no \"op\" lines\n", filename);
+		return 1;
+	}
+	return 0;
+}
+
+#ifndef NO_HIDAPI
+// Open up to max_devices USB HID devices. Returns the number of devices
+// opened.
+static int openHIDDevices(int max_devices)
+{
+	struct hid_device_info *devs;
+	struct hid_device_info *current;
+	Device *device;
+
+	if (hid_init())
+	{
+		printf("hid_init() failed\n");
+		return 0;
+	}
+	devs = hid_enumerate(TARGET_VID, TARGET_PID);
+	for (current = devs; (current != NULL) && (num_workers < max_devices); current = current->next)
+	{
+		device = &(workers[num_workers].device);
+		device->type = DEVICE_HID;
+		snprintf(device->name, sizeof(device->name), "%s", current->path);
+		device->hid = hid_open_path(current->path);
+		if (device->hid == NULL)
+		{
+			printf("Unable to open %s; are you running this as root?\n", current->path);
+			continue;
+		}
+		num_workers++;
+	}
+	hid_free_enumeration(devs);
+	return num_workers;
+}
+#endif // #ifndef NO_HIDAPI
+
+// Estimate a percentile of latency from a histogram. This returns the
+// upper limit of the bucket which contains the percentile.
+static uint64_t estimatePercentile(OpStats *stats, double percentile)
+{
+	uint64_t target;
+	uint64_t so_far;
+	int i;
+
+	target = (uint64_t)((double)stats->count * percentile / 100.0);
+	so_far = 0;
+	for (i = 0; i < NUM_BUCKETS; i++)
+	{
+		so_far += stats->buckets[i];
+		if (so_far > target)
+		{
+			break;
+		}
+	}
+	if (i == NUM_BUCKETS)
+	{
+		i--;
+	}
+	return BUCKET_UPPER_LIMIT(i);
+}
+
+// Display statistics for one operation.
+static void displayStats(const char *name, OpStats *stats, double elapsed_s)
+{
+	uint64_t largest;
+	int i;
+	int j;
+	int bar;
+
+	printf("\n%s: %llu operations, %llu failures, %.2f operations/s\n", name,
+		(unsigned long long)stats->count, (unsigned long long)stats->failures,
+		(double)stats->count / elapsed_s);
+	if (stats->count == 0)
+	{
+		return;
+	}
+	printf("latency (ms): min %.3f, mean %.3f, max %.3f\n",
+		(double)stats->min_us / 1000.0,
+		(double)stats->total_us / (double)stats->count / 1000.0,
+		(double)stats->max_us / 1000.0);
+	printf("latency (ms, upper bound): 50%% %.3f, 95%% %.3f, 99%% %.3f\n",
+		(double)estimatePercentile(stats, 50.0) / 1000.0,
+		(double)estimatePercentile(stats, 95.0) / 1000.0,
+		(double)estimatePercentile(stats, 99.0) / 1000.0);
+	largest = 0;
+	for (i = 0; i < NUM_BUCKETS; i++)
+	{
+		if (stats->buckets[i] > largest)
+		{
+			largest = stats->buckets[i];
+		}
+	}
+	for (i = 0; i < NUM_BUCKETS; i++)
+	{
+		if (stats->buckets[i] != 0)
+		{
+			bar = (int)((stats->buckets[i] * 50 + largest - 1) / largest);
+			printf("  < %10.3f ms %10llu ", (double)BUCKET_UPPER_LIMIT(i) / 1000.0,
+				(unsigned long long)stats->buckets[i]);
+			for (j = 0; j < bar; j++)
+			{
+				printf("#");
+			}
+			printf("\n");
+		}
+	}
+}
+
+static void printUsage(const char *program_name)
+{
+	printf("Usage: %s [-r repeats] [-n max_devices] [-s socket]... script\n", program_name);
+	printf("  -r repeats     Number of times to run the \"op\" lines (default: %u)\n", repeats);
+#ifndef NO_HIDAPI
+	printf("  -n max_devices Maximum number of USB HID devices to use (default: all)\n");
+#endif // #ifndef NO_HIDAPI
+	printf("  -s socket      Use the host build listening on this socket, instead of\n");
+	printf("                 USB HID devices. This is a Unix domain socket path\n");
+	printf("                 (beginning with '/' or '.'), <port> or <address>:<port>.\n");
+	printf("                 Give this more than once to use more than one.\n");
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	int max_devices;
+	int i;
+	int j;
+	int k;
+	int failed;
+	uint64_t start;
+	uint64_t all_operations;
+	double elapsed_s;
+	OpStats total;
+	OpStats *s;
+
+	max_devices = MAX_DEVICES;
+	failed = 0;
+	while ((opt = getopt(argc, argv, "r:n:s:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'r':
+			repeats = (unsigned int)atoi(optarg);
+			break;
+		case 'n':
+			max_devices = atoi(optarg);
+			if ((max_devices <= 0) || (max_devices > MAX_DEVICES))
+			{
+				max_devices = MAX_DEVICES;
+			}
+			break;
+		case 's':
+			if (num_workers == MAX_DEVICES)
+			{
+				printf("Too many devices\n");
+				exit(1);
+			}
+			if (openSocketDevice(&(workers[num_workers].device), optarg, 0))
+			{
+				exit(1);
+			}
+			num_workers++;
+			break;
+		default:
+			printUsage(argv[0]);
+			exit(1);
+		}
+	}
+	if (optind != (argc - 1))
+	{
+		printUsage(argv[0]);
+		exit(1);
+	}
+	if (readScript(argv[optind]))
+	{
+		exit(1);
+	}
+#ifndef NO_HIDAPI
+	if (num_workers == 0)
+	{
+		openHIDDevices(max_devices);
+	}
+#endif // #ifndef NO_HIDAPI
+	if (num_workers == 0)
+	{
+		printf("No devices to test\n");
+		exit(1);
+	}
+
+	printf("Running script on %d device(s), %u repeat(s)\n", num_workers, repeats);
+	// The main thread also waits on the barrier, so that it knows when
+	// timing starts.
+	pthread_barrier_init(&start_barrier, NULL, (unsigned int)num_workers + 1);
+	for (i = 0; i < num_workers; i++)
+	{
+		pthread_create(&(workers[i].thread), NULL, workerThread, &(workers[i]));
+	}
+	pthread_barrier_wait(&start_barrier);
+	start = getMicroseconds();
+	for (i = 0; i < num_workers; i++)
+	{
+		pthread_join(workers[i].thread, NULL);
+	}
+	elapsed_s = (double)(getMicroseconds() - start) / 1000000.0;
+	pthread_barrier_destroy(&start_barrier);
+
+	printf("Elapsed time: %.3f s\n", elapsed_s);
+	for (i = 0; i < num_workers; i++)
+	{
+		if (workers[i].broken)
+		{
+			printf("%s stopped responding properly; its results are incomplete\n", workers[i].device.name);
+			failed = 1;
+		}
+	}
+	// Merge the statistics from each thread.
+	all_operations = 0;
+	for (k = 0; k < num_operations; k++)
+	{
+		memset(&total, 0, sizeof(total));
+		for (i = 0; i < num_workers; i++)
+		{
+			s = &(workers[i].stats[k]);
+			if (s->count == 0)
+			{
+				continue;
+			}
+			if ((total.count == 0) || (s->min_us < total.min_us))
+			{
+				total.min_us = s->min_us;
+			}
+			if (s->max_us > total.max_us)
+			{
+				total.max_us = s->max_us;
+			}
+			total.count += s->count;
+			total.failures += s->failures;
+			total.total_us += s->total_us;
+			for (j = 0; j < NUM_BUCKETS; j++)
+			{
+				total.buckets[j] += s->buckets[j];
+			}
+		}
+		displayStats(operations[k], &total, elapsed_s);
+		all_operations += total.count;
+		if (total.failures != 0)
+		{
+			failed = 1;
+		}
+	}
+
+	printf("\nTotal: %llu operations, %.2f operations/s\n",
+		(unsigned long long)all_operations, (double)all_operations / elapsed_s);
+
+	for (i = 0; i < num_workers; i++)
+	{
+#ifndef NO_HIDAPI
+		if (workers[i].device.type == DEVICE_HID)
+		{
+			hid_close(workers[i].device.hid);
+			continue;
+		}
+#endif // #ifndef NO_HIDAPI
+		close(workers[i].device.fd);
+	}
+#ifndef NO_HIDAPI
+	// Free static HIDAPI objects.
+	hid_exit();
+#endif // #ifndef NO_HIDAPI
+	exit(failed);
+}
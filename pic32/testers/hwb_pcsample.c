@@ -0,0 +1,890 @@
+// ***********************************************************************
+// hwb_pcsample.c
+// ***********************************************************************
+//
+// Gets the histogram of program counter samples (see pc_sampling.h in the
+// top-level directory) from a hardware bitcoin wallet, and uses the
+// firmware's ELF file to display which functions the samples landed in.
+// The device must have been built with STREAM_COMM_PROFILE and PC_SAMPLING
+// defined.
+//
+// The device is either a USB HID device that uses the stream-based protocol
+// of hwb_tester.c (this uses HIDAPI), or a socket of the host build (see
+// host/ in the top-level directory). Compile with -DNO_HIDAPI to leave out
+// USB HID support, so that HIDAPI isn't needed.
+//
+// Each histogram bucket covers a range of addresses. When a bucket covers
+// more than one function, its samples are split between those functions in
+// proportion to how many of the bucket's bytes each one occupies, so the
+// per-function numbers are estimates unless buckets are small. Use the "-r"
+// option to narrow the sampled range down (to the hot functions from a
+// previous run, for example); this gives smaller buckets.
+//
+// Only little-endian ELF files (32 or 64 bit) are supported. That covers
+// PIC32, LPC11Uxx and x86 host builds.
+//
+// This file is licensed as described by the file LICENCE.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include "tester_transport.h"
+
+// Maximum number of buckets to accept before program suspects the
+// histogram is garbled.
+#define NUM_BUCKETS_LIMIT		1000000
+// Default number of functions to display.
+#define DEFAULT_TOP_COUNT		30
+
+// Packet types which need special treatment.
+#define PACKET_TYPE_GET_PC_SAMPLES	0x23
+#define PACKET_TYPE_FAILURE			0x35
+#define PACKET_TYPE_PC_SAMPLES		0x43
+
+// ELF constants which are needed here.
+#define ELFCLASS32				1
+#define ELFCLASS64				2
+#define ELFDATA2LSB				1
+#define EM_ARM					40
+#define SHT_SYMTAB				2
+#define STT_NOTYPE				0
+#define STT_FUNC				2
+
+// Header fields of a PCSamples message, plus the whole histogram.
+typedef struct HistogramStruct
+{
+	uint32_t sample_rate;
+	uint32_t range_start;
+	uint32_t range_end;
+	uint32_t bucket_shift;
+	uint32_t num_buckets;
+	uint32_t total_samples;
+	uint32_t out_of_range_samples;
+	// num_buckets counts.
+	uint16_t *counts;
+} Histogram;
+
+// One function (or other code symbol) from the ELF file.
+typedef struct SymbolStruct
+{
+	const char *name;
+	uint32_t start;
+	uint32_t end;
+	// Estimated number of samples which landed in this symbol.
+	double samples;
+} Symbol;
+
+// The device.
+static Device device;
+
+// Read a 64-bit unsigned integer from the byte array specified by in.
+// The bytes will be read in a little-endian format.
+static uint64_t readU64LittleEndian(uint8_t *in)
+{
+	return (uint64_t)readU32LittleEndian(in)
+		| ((uint64_t)readU32LittleEndian(&(in[4])) << 32);
+}
+
+// Write a protocol buffer varint to the byte array specified by buffer.
+// Returns the number of bytes written (at most 5).
+static uint32_t writeVarint(uint8_t *buffer, uint32_t value)
+{
+	uint32_t length;
+
+	length = 0;
+	do
+	{
+		buffer[length] = (uint8_t)(value & 0x7f);
+		value >>= 7;
+		if (value != 0)
+		{
+			buffer[length] |= 0x80;
+		}
+		length++;
+	} while (value != 0);
+	return length;
+}
+
+// Send a GetPCSamples request and receive the response. If set_range is
+// non-zero, the request also changes the sampled range to range_start
+// (inclusive) to range_end (exclusive). On success, the header fields of
+// the response are written to out, the counts in the response are copied
+// into out->counts (which must have space for out->num_buckets counts, or
+// be NULL) and the number of counts in the response is returned. Returns
+// -1 on error.
+static int getPCSamples(Histogram *out, uint32_t first_bucket, int clear, int set_range, uint32_t range_start, uint32_t range_end)
+{
+	uint8_t packet[32];
+	uint32_t length;
+	uint8_t *response;
+	uint8_t *payload;
+	uint32_t payload_length;
+	uint16_t type;
+	uint32_t index;
+	uint64_t key;
+	uint64_t value;
+	uint8_t *counts;
+	uint32_t counts_length;
+	uint32_t i;
+	int num_counts;
+
+	packet[0] = '#';
+	packet[1] = '#';
+	packet[2] = 0x00;
+	packet[3] = PACKET_TYPE_GET_PC_SAMPLES;
+	length = 8;
+	packet[length++] = 0x08; // first_bucket
+	length += writeVarint(&(packet[length]), first_bucket);
+	if (clear)
+	{
+		packet[length++] = 0x10; // clear
+		packet[length++] = 0x01;
+	}
+	if (set_range)
+	{
+		packet[length++] = 0x18; // range_start
+		length += writeVarint(&(packet[length]), range_start);
+		packet[length++] = 0x20; // range_end
+		length += writeVarint(&(packet[length]), range_end);
+	}
+	packet[4] = 0x00;
+	packet[5] = 0x00;
+	packet[6] = 0x00;
+	packet[7] = (uint8_t)(length - 8);
+	if (sendBytes(&device, packet, length))
+	{
+		return -1;
+	}
+	response = receivePacket(&device, &type);
+	if (response == NULL)
+	{
+		return -1;
+	}
+	if (type != PACKET_TYPE_PC_SAMPLES)
+	{
+		if (type == PACKET_TYPE_FAILURE)
+		{
+			printf("Got Failure response; was the device built with PC_SAMPLING?");
+			if (set_range)
+			{
+				printf(" Is the range valid?");
+			}
+			printf("\n");
+		}
+		else
+		{
+			printf("Got unexpected response (packet type 0x%04x)\n", (unsigned int)type);
+		}
+		free(response);
+		return -1;
+	}
+
+	payload = &(response[8]);
+	payload_length = readU32BigEndian(&(response[4]));
+	counts = NULL;
+	counts_length = 0;
+	index = 0;
+	while (index < payload_length)
+	{
+		if (readVarint(&key, payload, payload_length, &index))
+		{
+			goto malformed;
+		}
+		if ((key & 7) == 0)
+		{
+			// Varint.
+			if (readVarint(&value, payload, payload_length, &index))
+			{
+				goto malformed;
+			}
+			switch (key >> 3)
+			{
+			case 1:
+				out->sample_rate = (uint32_t)value;
+				break;
+			case 2:
+				out->range_start = (uint32_t)value;
+				break;
+			case 3:
+				out->range_end = (uint32_t)value;
+				break;
+			case 4:
+				out->bucket_shift = (uint32_t)value;
+				break;
+			case 5:
+				out->num_buckets = (uint32_t)value;
+				break;
+			case 6:
+				out->total_samples = (uint32_t)value;
+				break;
+			case 7:
+				out->out_of_range_samples = (uint32_t)value;
+				break;
+			default:
+				break;
+			}
+		}
+		else if ((key & 7) == 2)
+		{
+			// Length-delimited.
+			if (readVarint(&value, payload, payload_length, &index))
+			{
+				goto malformed;
+			}
+			if (value > (payload_length - index))
+			{
+				goto malformed;
+			}
+			if ((key >> 3) == 8)
+			{
+				counts = &(payload[index]);
+				counts_length = (uint32_t)value;
+			}
+			index += (uint32_t)value;
+		}
+		else
+		{
+			goto malformed; // no other wire types are used in PCSamples
+		}
+	}
+	num_counts = (int)(counts_length / 2);
+	if ((out->sample_rate == 0) || (out->bucket_shift > 31)
+		|| (out->num_buckets == 0) || (out->num_buckets > NUM_BUCKETS_LIMIT)
+		|| ((counts_length % 2) != 0)
+		|| ((uint64_t)first_bucket + (uint64_t)num_counts > out->num_buckets))
+	{
+		goto malformed;
+	}
+	if (out->counts != NULL)
+	{
+		for (i = 0; i < (uint32_t)num_counts; i++)
+		{
+			out->counts[first_bucket + i] = readU16LittleEndian(&(counts[i * 2]));
+		}
+	}
+	free(response);
+	return num_counts;
+
+malformed:
+	printf("Got malformed PCSamples message\n");
+	free(response);
+	return -1;
+}
+
+// Get the whole histogram, a page at a time. If clear is non-zero, the
+// histogram is cleared once it has been read. Returns 0 on success,
+// non-zero on error. On success, out->counts must be freed using free().
+static int getHistogram(Histogram *out, int clear)
+{
+	uint32_t num_buckets;
+	uint32_t first_bucket;
+	int num_counts;
+
+	out->counts = NULL;
+	num_counts = getPCSamples(out, 0, 0, 0, 0, 0);
+	if (num_counts < 0)
+	{
+		return 1;
+	}
+	num_buckets = out->num_buckets;
+	out->counts = calloc(num_buckets, sizeof(uint16_t));
+	first_bucket = 0;
+	while (first_bucket < num_buckets)
+	{
+		num_counts = getPCSamples(out, first_bucket, 0, 0, 0, 0);
+		if (num_counts < 0)
+		{
+			break;
+		}
+		if ((num_counts == 0) || (out->num_buckets != num_buckets))
+		{
+			// Someone else changed the range in the meantime.
+			printf("Histogram changed while it was being read\n");
+			break;
+		}
+		first_bucket += (uint32_t)num_counts;
+	}
+	if (first_bucket < num_buckets)
+	{
+		free(out->counts);
+		out->counts = NULL;
+		return 1;
+	}
+	if (clear)
+	{
+		// Asking for a page past the end returns no counts, so this is a
+		// cheap way of clearing the histogram.
+		if (getPCSamples(out, num_buckets, 1, 0, 0, 0) < 0)
+		{
+			free(out->counts);
+			out->counts = NULL;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Used by qsort() to sort symbols by address.
+static int compareSymbolAddresses(const void *a, const void *b)
+{
+	const Symbol *sa = (const Symbol *)a;
+	const Symbol *sb = (const Symbol *)b;
+
+	if (sa->start < sb->start)
+	{
+		return -1;
+	}
+	else if (sa->start > sb->start)
+	{
+		return 1;
+	}
+	return 0;
+}
+
+// Used by qsort() to sort symbols by number of samples (most first).
+static int compareSymbolSamples(const void *a, const void *b)
+{
+	const Symbol *sa = (const Symbol *)a;
+	const Symbol *sb = (const Symbol *)b;
+
+	if (sa->samples > sb->samples)
+	{
+		return -1;
+	}
+	else if (sa->samples < sb->samples)
+	{
+		return 1;
+	}
+	return 0;
+}
+
+// Load the code symbols from the ELF file specified by filename. The
+// symbols are sorted by address, and their ends are adjusted so that they
+// don't overlap. Returns the symbols (which must be freed using
+// freeSymbols()) on success, or NULL on error. The number of symbols is
+// written to out_num_symbols. The file contents are written to
+// out_file_data, since the symbol names point into it.
+static Symbol *loadSymbols(const char *filename, uint32_t *out_num_symbols, uint8_t **out_file_data)
+{
+	FILE *f;
+	long file_size;
+	uint8_t *data;
+	int is_64bit;
+	uint64_t shoff;
+	uint32_t shentsize;
+	uint32_t shnum;
+	uint8_t *sh;
+	uint8_t *strtab_sh;
+	uint64_t offset;
+	uint64_t size;
+	uint64_t entsize;
+	uint64_t str_offset;
+	uint64_t str_size;
+	uint64_t value;
+	uint64_t sym_size;
+	uint32_t name;
+	uint8_t info;
+	uint16_t shndx;
+	uint16_t machine;
+	uint8_t *sym;
+	Symbol *symbols;
+	uint32_t num_symbols;
+	uint32_t i;
+	uint64_t j;
+
+	f = fopen(filename, "rb");
+	if (f == NULL)
+	{
+		printf("Couldn't open \"%s\": %s\n", filename, strerror(errno));
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	file_size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (file_size < 64)
+	{
+		printf("\"%s\" is too small to be an ELF file\n", filename);
+		fclose(f);
+		return NULL;
+	}
+	data = malloc((size_t)file_size);
+	if (fread(data, 1, (size_t)file_size, f) != (size_t)file_size)
+	{
+		printf("Couldn't read \"%s\"\n", filename);
+		fclose(f);
+		free(data);
+		return NULL;
+	}
+	fclose(f);
+	if (memcmp(data, "\x7f" "ELF", 4) || (data[5] != ELFDATA2LSB)
+		|| ((data[4] != ELFCLASS32) && (data[4] != ELFCLASS64)))
+	{
+		printf("\"%s\" is not a little-endian ELF file\n", filename);
+		free(data);
+		return NULL;
+	}
+	is_64bit = (data[4] == ELFCLASS64);
+	machine = readU16LittleEndian(&(data[18]));
+	if (is_64bit)
+	{
+		shoff = readU64LittleEndian(&(data[40]));
+		shentsize = readU16LittleEndian(&(data[58]));
+		shnum = readU16LittleEndian(&(data[60]));
+	}
+	else
+	{
+		shoff = readU32LittleEndian(&(data[32]));
+		shentsize = readU16LittleEndian(&(data[46]));
+		shnum = readU16LittleEndian(&(data[48]));
+	}
+	if ((shentsize < (is_64bit ? 64u : 40u))
+		|| (shoff > (uint64_t)file_size)
+		|| (((uint64_t)file_size - shoff) / shentsize < shnum))
+	{
+		printf("\"%s\" has a malformed section header table\n", filename);
+		free(data);
+		return NULL;
+	}
+
+	symbols = NULL;
+	num_symbols = 0;
+	for (i = 0; i < shnum; i++)
+	{
+		sh = &(data[shoff + (uint64_t)i * shentsize]);
+		if (readU32LittleEndian(&(sh[4])) != SHT_SYMTAB)
+		{
+			continue;
+		}
+		if (is_64bit)
+		{
+			offset = readU64LittleEndian(&(sh[24]));
+			size = readU64LittleEndian(&(sh[32]));
+			entsize = readU64LittleEndian(&(sh[56]));
+		}
+		else
+		{
+			offset = readU32LittleEndian(&(sh[16]));
+			size = readU32LittleEndian(&(sh[20]));
+			entsize = readU32LittleEndian(&(sh[36]));
+		}
+		// sh_link is the section number of the string table.
+		name = readU32LittleEndian(&(sh[is_64bit ? 40 : 24]));
+		if ((name >= shnum) || (entsize < (is_64bit ? 24u : 16u))
+			|| (offset > (uint64_t)file_size) || (size > (uint64_t)file_size - offset))
+		{
+			continue;
+		}
+		strtab_sh = &(data[shoff + (uint64_t)name * shentsize]);
+		if (is_64bit)
+		{
+			str_offset = readU64LittleEndian(&(strtab_sh[24]));
+			str_size = readU64LittleEndian(&(strtab_sh[32]));
+		}
+		else
+		{
+			str_offset = readU32LittleEndian(&(strtab_sh[16]));
+			str_size = readU32LittleEndian(&(strtab_sh[20]));
+		}
+		if ((str_offset > (uint64_t)file_size) || (str_size > (uint64_t)file_size - str_offset)
+			|| (str_size == 0) || (data[str_offset + str_size - 1] != '\0'))
+		{
+			continue;
+		}
+		symbols = realloc(symbols, (size_t)(num_symbols + size / entsize) * sizeof(Symbol));
+		for (j = 0; j < size / entsize; j++)
+		{
+			sym = &(data[offset + j * entsize]);
+			name = readU32LittleEndian(&(sym[0]));
+			if (is_64bit)
+			{
+				info = sym[4];
+				shndx = readU16LittleEndian(&(sym[6]));
+				value = readU64LittleEndian(&(sym[8]));
+				sym_size = readU64LittleEndian(&(sym[16]));
+			}
+			else
+			{
+				value = readU32LittleEndian(&(sym[4]));
+				sym_size = readU32LittleEndian(&(sym[8]));
+				info = sym[12];
+				shndx = readU16LittleEndian(&(sym[14]));
+			}
+			// Only keep defined functions, and untyped symbols (which
+			// include labels in assembly language files) with a name.
+			if ((shndx == 0) || (shndx >= 0xff00) || (name >= str_size)
+				|| (data[str_offset + name] == '\0') || (data[str_offset + name] == '$')
+				|| (((info & 0xf) != STT_FUNC) && ((info & 0xf) != STT_NOTYPE)))
+			{
+				continue;
+			}
+			if (machine == EM_ARM)
+			{
+				value &= ~(uint64_t)1; // clear Thumb bit
+			}
+			if (value > 0xffffffff)
+			{
+				continue;
+			}
+			symbols[num_symbols].name = (const char *)&(data[str_offset + name]);
+			symbols[num_symbols].start = (uint32_t)value;
+			if ((value + sym_size) > 0xffffffff)
+			{
+				sym_size = 0xffffffff - value;
+			}
+			symbols[num_symbols].end = (uint32_t)(value + sym_size);
+			symbols[num_symbols].samples = 0.0;
+			num_symbols++;
+		}
+	}
+	if (num_symbols == 0)
+	{
+		printf("\"%s\" has no code symbols; was it stripped?\n", filename);
+		free(symbols);
+		free(data);
+		return NULL;
+	}
+	qsort(symbols, num_symbols, sizeof(Symbol), compareSymbolAddresses);
+	// Symbols without a size (eg. assembly language labels) extend to the
+	// next symbol, and no symbol overlaps the next one. When several
+	// symbols have the same address, they all end up empty except the last.
+	for (i = 0; i < num_symbols; i++)
+	{
+		if ((i + 1) < num_symbols)
+		{
+			if ((symbols[i].end == symbols[i].start) || (symbols[i].end > symbols[i + 1].start))
+			{
+				symbols[i].end = symbols[i + 1].start;
+			}
+		}
+	}
+	*out_num_symbols = num_symbols;
+	*out_file_data = data;
+	return symbols;
+}
+
+// Find the symbol which contains address. Returns the index of the symbol
+// in symbols (which must be sorted by address), or -1 if there isn't one.
+static long findSymbol(Symbol *symbols, uint32_t num_symbols, uint32_t address)
+{
+	uint32_t low;
+	uint32_t high;
+	uint32_t mid;
+
+	// Find the last symbol which starts at or before address.
+	low = 0;
+	high = num_symbols;
+	while (low < high)
+	{
+		mid = low + (high - low) / 2;
+		if (symbols[mid].start <= address)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+	if ((low == 0) || (address >= symbols[low - 1].end))
+	{
+		return -1;
+	}
+	return (long)(low - 1);
+}
+
+// Split the samples in each bucket of histogram between the symbols which
+// the bucket covers. Returns the number of samples which landed in
+// addresses not covered by any symbol.
+static double attributeSamples(Histogram *histogram, Symbol *symbols, uint32_t num_symbols)
+{
+	uint64_t bucket_start;
+	uint64_t bucket_end;
+	uint64_t overlap_start;
+	uint64_t overlap_end;
+	uint64_t bucket_size;
+	uint64_t covered;
+	double unknown;
+	uint32_t i;
+	uint32_t j;
+
+	unknown = 0.0;
+	bucket_size = (uint64_t)1 << histogram->bucket_shift;
+	j = 0;
+	for (i = 0; i < histogram->num_buckets; i++)
+	{
+		if (histogram->counts[i] == 0)
+		{
+			continue;
+		}
+		bucket_start = (uint64_t)histogram->range_start + ((uint64_t)i << histogram->bucket_shift);
+		bucket_end = bucket_start + bucket_size;
+		if (bucket_end > histogram->range_end)
+		{
+			bucket_end = histogram->range_end;
+		}
+		// Skip symbols which end before this bucket. Buckets are visited in
+		// address order, so this never needs to go backwards.
+		while ((j < num_symbols) && (symbols[j].end <= bucket_start))
+		{
+			j++;
+		}
+		covered = 0;
+		for (; (j < num_symbols) && (symbols[j].start < bucket_end); j++)
+		{
+			overlap_start = (symbols[j].start > bucket_start) ? symbols[j].start : bucket_start;
+			overlap_end = (symbols[j].end < bucket_end) ? symbols[j].end : bucket_end;
+			if (overlap_end > overlap_start)
+			{
+				symbols[j].samples += (double)histogram->counts[i] * (double)(overlap_end - overlap_start) / (double)(bucket_end - bucket_start);
+				covered += overlap_end - overlap_start;
+			}
+			if (symbols[j].end > bucket_end)
+			{
+				break; // this symbol carries on into the next bucket
+			}
+		}
+		unknown += (double)histogram->counts[i] * (double)(bucket_end - bucket_start - covered) / (double)(bucket_end - bucket_start);
+	}
+	return unknown;
+}
+
+// Display the non-zero buckets of a histogram, with the symbol (if any)
+// at the start of each one.
+static void displayBuckets(Histogram *histogram, Symbol *symbols, uint32_t num_symbols)
+{
+	uint32_t address;
+	uint32_t i;
+	long s;
+
+	printf("%10s %10s %8s  %s\n", "Bucket", "Address", "Samples", "Symbol");
+	for (i = 0; i < histogram->num_buckets; i++)
+	{
+		if (histogram->counts[i] == 0)
+		{
+			continue;
+		}
+		address = histogram->range_start + (i << histogram->bucket_shift);
+		printf("%10u 0x%08x %8u  ", i, address, (unsigned int)histogram->counts[i]);
+		s = -1;
+		if (symbols != NULL)
+		{
+			s = findSymbol(symbols, num_symbols, address);
+		}
+		if (s >= 0)
+		{
+			printf("%s+0x%x", symbols[s].name, address - symbols[s].start);
+		}
+		printf("\n");
+	}
+}
+
+// Display the symbols with the most samples. top_count is the maximum number
+// of symbols to display.
+static void displaySymbols(Histogram *histogram, Symbol *symbols, uint32_t num_symbols, double unknown, uint32_t top_count)
+{
+	uint32_t in_range;
+	uint32_t i;
+	double cumulative;
+
+	in_range = histogram->total_samples - histogram->out_of_range_samples;
+	qsort(symbols, num_symbols, sizeof(Symbol), compareSymbolSamples);
+	printf("%10s %7s %7s %12s  %s\n", "Samples", "%", "Cum. %", "Time (ms)", "Function");
+	cumulative = 0.0;
+	for (i = 0; (i < num_symbols) && (i < top_count); i++)
+	{
+		if (symbols[i].samples < 0.05)
+		{
+			break;
+		}
+		cumulative += symbols[i].samples;
+		printf("%10.1f %7.2f %7.2f %12.1f  %s\n",
+			symbols[i].samples,
+			100.0 * symbols[i].samples / (double)in_range,
+			100.0 * cumulative / (double)in_range,
+			1000.0 * symbols[i].samples / (double)histogram->sample_rate,
+			symbols[i].name);
+	}
+	if (unknown >= 0.05)
+	{
+		printf("%10.1f %7.2f %7s %12.1f  (no symbol)\n",
+			unknown,
+			100.0 * unknown / (double)in_range,
+			"",
+			1000.0 * unknown / (double)histogram->sample_rate);
+	}
+}
+
+// Parse a string of the form "<start>:<end>", where start and end are
+// numbers in any base strtoul() understands. Returns 0 on success, non-zero
+// if the string is malformed.
+static int parseRange(const char *s, uint32_t *out_start, uint32_t *out_end)
+{
+	char *end;
+	unsigned long value;
+
+	errno = 0;
+	value = strtoul(s, &end, 0);
+	if ((errno != 0) || (end == s) || (*end != ':') || (value > 0xffffffff))
+	{
+		return 1;
+	}
+	*out_start = (uint32_t)value;
+	s = end + 1;
+	value = strtoul(s, &end, 0);
+	if ((errno != 0) || (end == s) || (*end != '\0') || (value > 0xffffffff))
+	{
+		return 1;
+	}
+	*out_end = (uint32_t)value;
+	return 0;
+}
+
+static void printUsage(const char *program_name)
+{
+	printf("Usage: %s [-c] [-b] [-n count] [-r start:end] [-s socket] [elf_file]\n", program_name);
+	printf("  -b           Also display every non-zero bucket\n");
+	printf("  -c           Clear the histogram after getting it\n");
+	printf("  -n count     Display at most this many functions (default: %d)\n", DEFAULT_TOP_COUNT);
+	printf("  -r start:end Change the sampled range to start (inclusive) to end\n");
+	printf("               (exclusive), which also clears the histogram, and exit.\n");
+	printf("               Use \"-r 0:0\" to display the current range.\n");
+	printf("  -s socket    Use the host build listening on this socket, instead of a\n");
+	printf("               USB HID device. This is a Unix domain socket path\n");
+	printf("               (beginning with '/' or '.'), <port> or <address>:<port>.\n");
+	printf("Without elf_file, only the buckets are displayed.\n");
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	int clear;
+	int show_buckets;
+	int set_range;
+	int failed;
+	uint32_t top_count;
+	uint32_t range_start;
+	uint32_t range_end;
+	const char *elf_filename;
+	Histogram histogram;
+	Symbol *symbols;
+	uint32_t num_symbols;
+	uint8_t *elf_data;
+	double unknown;
+
+	clear = 0;
+	show_buckets = 0;
+	set_range = 0;
+	top_count = DEFAULT_TOP_COUNT;
+	range_start = 0;
+	range_end = 0;
+	while ((opt = getopt(argc, argv, "bcn:r:s:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'b':
+			show_buckets = 1;
+			break;
+		case 'c':
+			clear = 1;
+			break;
+		case 'n':
+			top_count = (uint32_t)strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			if (parseRange(optarg, &range_start, &range_end))
+			{
+				printUsage(argv[0]);
+				exit(1);
+			}
+			set_range = 1;
+			break;
+		case 's':
+			if (openSocketDevice(&device, optarg, 0))
+			{
+				exit(1);
+			}
+			break;
+		default:
+			printUsage(argv[0]);
+			exit(1);
+		}
+	}
+	elf_filename = NULL;
+	if (optind == (argc - 1))
+	{
+		elf_filename = argv[optind];
+	}
+	else if (optind != argc)
+	{
+		printUsage(argv[0]);
+		exit(1);
+	}
+
+	// Load symbols first, so that a bad ELF file doesn't cause the
+	// histogram to be cleared.
+	symbols = NULL;
+	num_symbols = 0;
+	elf_data = NULL;
+	if ((elf_filename != NULL) && !set_range)
+	{
+		symbols = loadSymbols(elf_filename, &num_symbols, &elf_data);
+		if (symbols == NULL)
+		{
+			exit(1);
+		}
+	}
+
+	if (device.type != DEVICE_SOCKET)
+	{
+#ifndef NO_HIDAPI
+		if (openHIDDevice(&device))
+		{
+			exit(1);
+		}
+#else
+		printUsage(argv[0]);
+		exit(1);
+#endif // #ifndef NO_HIDAPI
+	}
+
+	failed = 1;
+	memset(&histogram, 0, sizeof(histogram));
+	if (set_range)
+	{
+		// "-r 0:0" just gets the current range. Other empty ranges are sent
+		// as is, so that the device rejects them.
+		if (getPCSamples(&histogram, 0, 0, ((range_start != 0) || (range_end != 0)), range_start, range_end) >= 0)
+		{
+			printf("Sampling 0x%08x to 0x%08x in %u buckets of %u bytes, at %u Hz\n",
+				histogram.range_start, histogram.range_end, histogram.num_buckets,
+				1u << histogram.bucket_shift, histogram.sample_rate);
+			failed = 0;
+		}
+	}
+	else if (!getHistogram(&histogram, clear))
+	{
+		printf("%u samples at %u Hz, %u of them outside 0x%08x to 0x%08x\n",
+			histogram.total_samples, histogram.sample_rate, histogram.out_of_range_samples,
+			histogram.range_start, histogram.range_end);
+		printf("Bucket size is %u bytes\n", 1u << histogram.bucket_shift);
+		if (show_buckets || (symbols == NULL))
+		{
+			displayBuckets(&histogram, symbols, num_symbols);
+		}
+		if ((symbols != NULL) && (histogram.total_samples > histogram.out_of_range_samples))
+		{
+			unknown = attributeSamples(&histogram, symbols, num_symbols);
+			displaySymbols(&histogram, symbols, num_symbols, unknown, top_count);
+		}
+		free(histogram.counts);
+		failed = 0;
+	}
+	free(symbols);
+	free(elf_data);
+
+	closeDevice(&device);
+	exit(failed);
+}
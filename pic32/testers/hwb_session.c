@@ -0,0 +1,807 @@
+// ***********************************************************************
+// hwb_session.c
+// ***********************************************************************
+//
+// Records real client sessions with the hardware bitcoin wallet, replays
+// them and displays where the time went, so that a firmware build can be
+// compared against another using a realistic, repeatable workload.
+//
+// There are three modes:
+// hwb_session record [options] session_file
+//     Sit between a client and a device, forwarding packets in both
+//     directions. The client connects to the socket given by "-l" (as if
+//     it were the host build). When either side closes the connection,
+//     the session is written to session_file.
+// hwb_session replay [options] session_file
+//     Send the client packets from session_file to a device, one at a
+//     time, each time waiting for as many responses as were recorded.
+//     The per-message latencies are displayed and compared against the
+//     recording. Use "-w" to write what happened to a new session file,
+//     which can be used as a baseline later on.
+// hwb_session report [options] session_file [baseline_file]
+//     Display the per-message latencies of session_file. If baseline_file
+//     is given, compare against it.
+//
+// When comparing, a message type is flagged as a regression if its mean
+// latency grew by more than the threshold (see "-t"). The exit status is
+// non-zero if there were any regressions, or if the device's responses
+// didn't match the recording, so this can be used to catch regressions.
+//
+// Latency is measured from the time a client packet is sent to the time
+// the first and last response arrive. Time spent by the client between a
+// response and its next packet is not replayed. Sessions with PIN or
+// one-time password prompts won't replay properly, since the replies to
+// those prompts are not the same each time. ButtonAck packets are
+// replayed, so the device must be set up to accept actions without user
+// interaction (eg. the host build's "-y" option).
+//
+// Devices are either USB HID devices that use the stream-based protocol of
+// hwb_tester.c (this uses HIDAPI), or sockets of the host build
+// (see host/ in the top-level directory). Compile with -DNO_HIDAPI to leave
+// out USB HID support, so that HIDAPI isn't needed.
+//
+// Session files are binary. They begin with the 4 bytes "HWBS" and a
+// version byte (1). Then there is one record for each packet:
+// - 1 byte: direction, 'C' (client to device) or 'D' (device to client).
+// - 4 bytes: time since previous record, in microseconds.
+// - 2 bytes: packet type.
+// - 4 bytes: payload length.
+// - For 'C' records only: the payload.
+// Everything is big-endian, like the packet header.
+//
+// This file is licensed as described by the file LICENCE.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "tester_transport.h"
+
+// Number of packet types that statistics are kept for. Packet types are
+// 16 bits, but everything the firmware uses fits in 8 bits.
+#define NUM_TYPES				256
+// Latency increases smaller than this (in microseconds) are never flagged
+// as regressions, since they are probably just noise.
+#define MIN_REGRESSION_US		100
+
+// Magic bytes at the start of a session file.
+#define SESSION_MAGIC			"HWBS"
+// Version of the session file format.
+#define SESSION_VERSION			1
+// Direction of a recorded packet.
+#define FROM_CLIENT				'C'
+#define FROM_DEVICE				'D'
+
+// One packet of a session.
+typedef struct RecordStruct
+{
+	// FROM_CLIENT or FROM_DEVICE.
+	char direction;
+	// Time since the start of the session, in microseconds.
+	uint64_t time_us;
+	uint16_t type;
+	uint32_t length;
+	// The whole packet, including header. Only client packets are kept,
+	// since they are the only ones which are replayed; this is NULL for
+	// device packets.
+	uint8_t *packet;
+} Record;
+
+// A recorded (or replayed) session.
+typedef struct SessionStruct
+{
+	Record *records;
+	uint32_t num_records;
+	uint32_t allocated_records;
+	// Value of getMicroseconds() when the session started.
+	uint64_t start_us;
+} Session;
+
+// Latency statistics for one type of client packet.
+typedef struct TypeStatsStruct
+{
+	uint64_t count;
+	// Number of packets which didn't get any response.
+	uint64_t no_response;
+	uint64_t bytes_sent;
+	uint64_t bytes_received;
+	// Time until the first response.
+	uint64_t total_first_us;
+	// Time until the last response.
+	uint64_t total_us;
+	uint64_t min_us;
+	uint64_t max_us;
+} TypeStats;
+
+// Everything a forwarding thread (used for recording) needs.
+typedef struct ForwarderStruct
+{
+	pthread_t thread;
+	Device *from;
+	Device *to;
+	char direction;
+} Forwarder;
+
+// Device and client used for recording.
+static Device device;
+static Device client;
+// Session being recorded or replayed.
+static Session session;
+// Protects session while recording.
+static pthread_mutex_t session_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Set to non-zero to make the forwarding threads stop.
+static volatile int finished;
+// Mean latency increase, in percent, which counts as a regression.
+static double threshold_percent = 10.0;
+
+// Write the 32-bit unsigned integer specified by value to the byte array
+// specified by out. The bytes will be written in a big-endian format.
+static void writeU32BigEndian(uint8_t *out, uint32_t value)
+{
+	out[0] = (uint8_t)(value >> 24);
+	out[1] = (uint8_t)(value >> 16);
+	out[2] = (uint8_t)(value >> 8);
+	out[3] = (uint8_t)value;
+}
+
+// Convert packet type into text string.
+static const char *packetTypeToText(uint16_t type)
+{
+	switch (type)
+	{
+	case 0x00:
+		return "Ping";
+	case 0x04:
+		return "NewWallet";
+	case 0x05:
+		return "NewAddress";
+	case 0x06:
+		return "GetNumberOfAddresses";
+	case 0x09:
+		return "GetAddressAndPublicKey";
+	case 0x0a:
+		return "SignTransaction";
+	case 0x0b:
+		return "LoadWallet";
+	case 0x0d:
+		return "FormatWalletArea";
+	case 0x0e:
+		return "ChangeEncryptionKey";
+	case 0x0f:
+		return "ChangeWalletName";
+	case 0x10:
+		return "ListWallets";
+	case 0x11:
+		return "BackupWallet";
+	case 0x12:
+		return "RestoreWallet";
+	case 0x13:
+		return "GetDeviceUUID";
+	case 0x14:
+		return "GetEntropy";
+	case 0x15:
+		return "GetMasterPublicKey";
+	case 0x16:
+		return "DeleteWallet";
+	case 0x17:
+		return "Initialize";
+	case 0x18:
+		return "SignTransactionMultiple";
+	case 0x19:
+		return "SignWitnessTransaction";
+	case 0x1a:
+		return "GetAddressesAndPublicKeys";
+	case 0x1b:
+		return "GetPerformanceCounters";
+	case 0x1c:
+		return "SetLinkSpeed";
+	case 0x1d:
+		return "GetTrustedInput";
+	case 0x1e:
+		return "GetTrace";
+	case 0x1f:
+		return "SignTransactionChunked";
+	case 0x20:
+		return "SelectWalletContext";
+	case 0x21:
+		return "RestoreWalletMnemonic";
+	case 0x22:
+		return "GetStorageStatistics";
+	case 0x51:
+		return "ButtonAck";
+	case 0x52:
+		return "ButtonCancel";
+	case 0x54:
+		return "PinAck";
+	case 0x55:
+		return "PinCancel";
+	case 0x57:
+		return "OtpAck";
+	case 0x58:
+		return "OtpCancel";
+	case 0x5a:
+		return "TransactionChunk";
+	default:
+		return "unknown";
+	}
+}
+
+// Add a record to a session. packet (which should only be non-NULL for
+// client packets) becomes owned by the session. time_us is the time since
+// the start of the session.
+static void appendRecord(Session *s, char direction, uint64_t time_us, uint16_t type, uint32_t length, uint8_t *packet)
+{
+	Record *r;
+
+	pthread_mutex_lock(&session_mutex);
+	if (s->num_records == s->allocated_records)
+	{
+		s->allocated_records = (s->allocated_records == 0) ? 256 : (s->allocated_records * 2);
+		s->records = realloc(s->records, s->allocated_records * sizeof(Record));
+	}
+	r = &(s->records[s->num_records]);
+	r->direction = direction;
+	r->time_us = time_us;
+	r->type = type;
+	r->length = length;
+	r->packet = packet;
+	s->num_records++;
+	pthread_mutex_unlock(&session_mutex);
+}
+
+// Add a record with the current time to a session. See appendRecord().
+static void appendRecordNow(Session *s, char direction, uint16_t type, uint32_t length, uint8_t *packet)
+{
+	appendRecord(s, direction, getMicroseconds() - s->start_us, type, length, packet);
+}
+
+// Free everything in a session.
+static void freeSession(Session *s)
+{
+	uint32_t i;
+
+	for (i = 0; i < s->num_records; i++)
+	{
+		free(s->records[i].packet);
+	}
+	free(s->records);
+	memset(s, 0, sizeof(*s));
+}
+
+// Write a session to a file. Returns 0 on success, non-zero on error.
+static int writeSession(Session *s, const char *filename)
+{
+	FILE *f;
+	uint8_t header[11];
+	uint64_t previous_us;
+	uint64_t delta_us;
+	uint32_t i;
+	Record *r;
+
+	f = fopen(filename, "wb");
+	if (f == NULL)
+	{
+		printf("Couldn't open \"%s\" for writing\n", filename);
+		return 1;
+	}
+	fwrite(SESSION_MAGIC, 4, 1, f);
+	fputc(SESSION_VERSION, f);
+	previous_us = 0;
+	for (i = 0; i < s->num_records; i++)
+	{
+		r = &(s->records[i]);
+		delta_us = r->time_us - previous_us;
+		if (delta_us > 0xffffffff)
+		{
+			delta_us = 0xffffffff;
+		}
+		previous_us += delta_us;
+		header[0] = (uint8_t)r->direction;
+		writeU32BigEndian(&(header[1]), (uint32_t)delta_us);
+		header[5] = (uint8_t)(r->type >> 8);
+		header[6] = (uint8_t)r->type;
+		writeU32BigEndian(&(header[7]), r->length);
+		fwrite(header, sizeof(header), 1, f);
+		if (r->packet != NULL)
+		{
+			fwrite(&(r->packet[8]), r->length, 1, f);
+		}
+	}
+	if (fclose(f))
+	{
+		printf("Couldn't write \"%s\"\n", filename);
+		return 1;
+	}
+	return 0;
+}
+
+// Read a session from a file. Returns 0 on success, non-zero on error.
+static int readSession(Session *s, const char *filename)
+{
+	FILE *f;
+	uint8_t header[11];
+	uint8_t *packet;
+	uint64_t time_us;
+	uint32_t length;
+	uint16_t type;
+
+	memset(s, 0, sizeof(*s));
+	f = fopen(filename, "rb");
+	if (f == NULL)
+	{
+		printf("Couldn't open session \"%s\"\n", filename);
+		return 1;
+	}
+	if ((fread(header, 5, 1, f) != 1) || memcmp(header, SESSION_MAGIC, 4) || (header[4] != SESSION_VERSION))
+	{
+		printf("\"%s\" isn't a session file\n", filename);
+		fclose(f);
+		return 1;
+	}
+	time_us = 0;
+	while (fread(header, sizeof(header), 1, f) == 1)
+	{
+		time_us += readU32BigEndian(&(header[1]));
+		type = (uint16_t)(((uint16_t)header[5] << 8) | ((uint16_t)header[6]));
+		length = readU32BigEndian(&(header[7]));
+		packet = NULL;
+		if (header[0] == FROM_CLIENT)
+		{
+			if (length > PACKET_LENGTH_LIMIT)
+			{
+				break;
+			}
+			// Rebuild the packet header, so that the packet can be sent
+			// as is.
+			packet = malloc(length + 8);
+			packet[0] = '#';
+			packet[1] = '#';
+			packet[2] = header[5];
+			packet[3] = header[6];
+			writeU32BigEndian(&(packet[4]), length);
+			if ((length > 0) && (fread(&(packet[8]), length, 1, f) != 1))
+			{
+				free(packet);
+				break;
+			}
+		}
+		else if (header[0] != FROM_DEVICE)
+		{
+			break;
+		}
+		appendRecord(s, (char)header[0], time_us, type, length, packet);
+	}
+	if (!feof(f))
+	{
+		printf("\"%s\" is corrupt (stopped after %u records)\n", filename, s->num_records);
+		fclose(f);
+		freeSession(s);
+		return 1;
+	}
+	fclose(f);
+	return 0;
+}
+
+// Count the number of device packets which follow the client packet at
+// index in a session, up until the next client packet.
+static uint32_t countResponses(Session *s, uint32_t index)
+{
+	uint32_t i;
+
+	for (i = index + 1; (i < s->num_records) && (s->records[i].direction == FROM_DEVICE); i++)
+	{
+		// do nothing
+	}
+	return i - index - 1;
+}
+
+// Work out latency statistics (indexed by client packet type) for a
+// session.
+static void computeStats(Session *s, TypeStats *stats)
+{
+	uint32_t i;
+	uint32_t j;
+	uint32_t responses;
+	uint64_t first_us;
+	uint64_t last_us;
+	Record *r;
+	TypeStats *t;
+
+	memset(stats, 0, NUM_TYPES * sizeof(TypeStats));
+	for (i = 0; i < s->num_records; i++)
+	{
+		r = &(s->records[i]);
+		if ((r->direction != FROM_CLIENT) || (r->type >= NUM_TYPES))
+		{
+			continue;
+		}
+		t = &(stats[r->type]);
+		t->bytes_sent += r->length + 8;
+		responses = countResponses(s, i);
+		if (responses == 0)
+		{
+			t->no_response++;
+			continue;
+		}
+		for (j = 1; j <= responses; j++)
+		{
+			t->bytes_received += s->records[i + j].length + 8;
+		}
+		first_us = s->records[i + 1].time_us - r->time_us;
+		last_us = s->records[i + responses].time_us - r->time_us;
+		if ((t->count == 0) || (last_us < t->min_us))
+		{
+			t->min_us = last_us;
+		}
+		if (last_us > t->max_us)
+		{
+			t->max_us = last_us;
+		}
+		t->count++;
+		t->total_first_us += first_us;
+		t->total_us += last_us;
+	}
+}
+
+// Display per-message latency statistics.
+static void displayStats(const char *title, TypeStats *stats)
+{
+	int i;
+	TypeStats *t;
+
+	printf("\n%s\n", title);
+	printf("%-26s %7s %10s %10s %10s %10s %10s %10s\n", "message", "count",
+		"sent (B)", "rcvd (B)", "first(ms)", "mean (ms)", "min (ms)", "max (ms)");
+	for (i = 0; i < NUM_TYPES; i++)
+	{
+		t = &(stats[i]);
+		if ((t->count == 0) && (t->no_response == 0))
+		{
+			continue;
+		}
+		printf("%-26s %7llu %10llu %10llu", packetTypeToText((uint16_t)i),
+			(unsigned long long)t->count, (unsigned long long)t->bytes_sent,
+			(unsigned long long)t->bytes_received);
+		if (t->count != 0)
+		{
+			printf(" %10.3f %10.3f %10.3f %10.3f",
+				(double)t->total_first_us / (double)t->count / 1000.0,
+				(double)t->total_us / (double)t->count / 1000.0,
+				(double)t->min_us / 1000.0, (double)t->max_us / 1000.0);
+		}
+		if (t->no_response != 0)
+		{
+			printf(" (%llu without response)", (unsigned long long)t->no_response);
+		}
+		printf("\n");
+	}
+}
+
+// Compare the mean latency of each message type against a baseline.
+// Returns the number of regressions.
+static int compareStats(TypeStats *baseline, TypeStats *current)
+{
+	int i;
+	int regressions;
+	double baseline_mean;
+	double current_mean;
+	double change;
+
+	printf("\nComparison against baseline (regression threshold: %.1f%%)\n", threshold_percent);
+	printf("%-26s %14s %14s %9s\n", "message", "baseline (ms)", "current (ms)", "change");
+	regressions = 0;
+	for (i = 0; i < NUM_TYPES; i++)
+	{
+		if ((baseline[i].count == 0) || (current[i].count == 0))
+		{
+			continue;
+		}
+		baseline_mean = (double)baseline[i].total_us / (double)baseline[i].count;
+		current_mean = (double)current[i].total_us / (double)current[i].count;
+		change = 100.0 * (current_mean - baseline_mean) / baseline_mean;
+		printf("%-26s %14.3f %14.3f %+8.1f%%", packetTypeToText((uint16_t)i),
+			baseline_mean / 1000.0, current_mean / 1000.0, change);
+		if ((change > threshold_percent) && ((current_mean - baseline_mean) >= MIN_REGRESSION_US))
+		{
+			printf(" REGRESSION");
+			regressions++;
+		}
+		printf("\n");
+	}
+	if (regressions != 0)
+	{
+		printf("%d regression(s)\n", regressions);
+	}
+	return regressions;
+}
+
+// Open the device. target is the argument of the "-s" option, or NULL to
+// use a USB HID device. Returns 0 on success, non-zero on error.
+static int openDevice(const char *target)
+{
+	if (target != NULL)
+	{
+		return openSocketDevice(&device, target, 0);
+	}
+#ifndef NO_HIDAPI
+	return openHIDDevice(&device);
+#else
+	printf("No device specified (use \"-s\")\n");
+	return 1;
+#endif // #ifndef NO_HIDAPI
+}
+
+// Make both forwarding threads stop.
+static void stopForwarding(void)
+{
+	finished = 1;
+	shutdown(client.fd, SHUT_RDWR);
+	if (device.type == DEVICE_SOCKET)
+	{
+		shutdown(device.fd, SHUT_RDWR);
+	}
+}
+
+// Forwarding thread. This moves packets in one direction, recording each
+// one as it goes by.
+static void *forwarderThread(void *arg)
+{
+	Forwarder *f;
+	uint8_t *packet;
+	uint32_t length;
+	uint16_t type;
+	int r;
+
+	f = arg;
+	while (!finished)
+	{
+		packet = receivePacket(f->from, &type);
+		if (packet == NULL)
+		{
+			break;
+		}
+		length = readU32BigEndian(&(packet[4]));
+		// Record before forwarding, so that the time it takes to forward
+		// a client packet is counted as part of the latency.
+		appendRecordNow(&session, f->direction, type, length, (f->direction == FROM_CLIENT) ? packet : NULL);
+		r = sendBytes(f->to, packet, length + 8);
+		if (f->direction != FROM_CLIENT)
+		{
+			free(packet);
+		}
+		if (r)
+		{
+			break;
+		}
+	}
+	stopForwarding();
+	return NULL;
+}
+
+// Record a session. Returns 0 on success, non-zero on error.
+static int recordSession(const char *listen_target, const char *filename)
+{
+	Forwarder to_device;
+	Forwarder to_client;
+
+	if (openSocketDevice(&client, listen_target, 1))
+	{
+		return 1;
+	}
+	snprintf(client.name, sizeof(client.name), "client");
+	// The forwarding threads stop quietly once finished is set.
+	client.cancel = &finished;
+	device.cancel = &finished;
+	printf("Recording; close the client's connection to finish\n");
+	session.start_us = getMicroseconds();
+	to_device.from = &client;
+	to_device.to = &device;
+	to_device.direction = FROM_CLIENT;
+	to_client.from = &device;
+	to_client.to = &client;
+	to_client.direction = FROM_DEVICE;
+	pthread_create(&(to_device.thread), NULL, forwarderThread, &to_device);
+	pthread_create(&(to_client.thread), NULL, forwarderThread, &to_client);
+	pthread_join(to_device.thread, NULL);
+	pthread_join(to_client.thread, NULL);
+	close(client.fd);
+	printf("Recorded %u packets\n", session.num_records);
+	return writeSession(&session, filename);
+}
+
+// Replay the client packets of a recorded session, recording what happens
+// into session. Returns the number of responses which didn't match the
+// recording, or -1 if the device stopped responding properly.
+static int replaySession(Session *recorded)
+{
+	uint32_t i;
+	uint32_t j;
+	uint32_t responses;
+	uint32_t length;
+	uint8_t *response;
+	uint8_t *packet;
+	uint16_t type;
+	Record *r;
+	int mismatches;
+
+	mismatches = 0;
+	session.start_us = getMicroseconds();
+	for (i = 0; i < recorded->num_records; i++)
+	{
+		r = &(recorded->records[i]);
+		if (r->direction != FROM_CLIENT)
+		{
+			continue;
+		}
+		responses = countResponses(recorded, i);
+		packet = malloc(r->length + 8);
+		memcpy(packet, r->packet, r->length + 8);
+		appendRecordNow(&session, FROM_CLIENT, r->type, r->length, packet);
+		if (sendBytes(&device, packet, r->length + 8))
+		{
+			return -1;
+		}
+		for (j = 1; j <= responses; j++)
+		{
+			response = receivePacket(&device, &type);
+			if (response == NULL)
+			{
+				return -1;
+			}
+			length = readU32BigEndian(&(response[4]));
+			free(response);
+			appendRecordNow(&session, FROM_DEVICE, type, length, NULL);
+			if (type != recorded->records[i + j].type)
+			{
+				printf("Packet %u (%s): response %u has type 0x%02x, but 0x%02x was recorded\n",
+					i, packetTypeToText(r->type), j, (unsigned int)type,
+					(unsigned int)recorded->records[i + j].type);
+				mismatches++;
+			}
+		}
+	}
+	return mismatches;
+}
+
+static void printUsage(const char *program_name)
+{
+	printf("Usage: %s record [-s socket] [-l listen_socket] session_file\n", program_name);
+	printf("       %s replay [-s socket] [-w out_file] [-t threshold] session_file\n", program_name);
+	printf("       %s report [-t threshold] session_file [baseline_file]\n", program_name);
+	printf("  -s socket        Use the host build listening on this socket, instead of\n");
+	printf("                   a USB HID device. This is a Unix domain socket path\n");
+	printf("                   (beginning with '/' or '.'), <port> or <address>:<port>.\n");
+	printf("  -l listen_socket Where to wait for the client to connect, in the same\n");
+	printf("                   format as for \"-s\" (default: 7655).\n");
+	printf("  -w out_file      Write the replayed session to out_file.\n");
+	printf("  -t threshold     Mean latency increase, in percent, which counts as a\n");
+	printf("                   regression (default: %.1f).\n", threshold_percent);
+}
+
+int main(int argc, char **argv)
+{
+	const char *mode;
+	const char *device_target;
+	const char *listen_target;
+	const char *out_filename;
+	int opt;
+	int r;
+	int failed;
+	Session recorded;
+	Session baseline;
+	TypeStats stats[NUM_TYPES];
+	TypeStats baseline_stats[NUM_TYPES];
+
+	if (argc < 2)
+	{
+		printUsage(argv[0]);
+		exit(1);
+	}
+	mode = argv[1];
+	device_target = NULL;
+	listen_target = "7655";
+	out_filename = NULL;
+	failed = 0;
+	// Options come after the mode.
+	while ((opt = getopt(argc - 1, &(argv[1]), "s:l:w:t:")) != -1)
+	{
+		switch (opt)
+		{
+		case 's':
+			device_target = optarg;
+			break;
+		case 'l':
+			listen_target = optarg;
+			break;
+		case 'w':
+			out_filename = optarg;
+			break;
+		case 't':
+			threshold_percent = atof(optarg);
+			break;
+		default:
+			printUsage(argv[0]);
+			exit(1);
+		}
+	}
+	// optind is relative to &(argv[1]).
+	optind++;
+
+	if (!strcmp(mode, "record") && (optind == (argc - 1)))
+	{
+		if (openDevice(device_target))
+		{
+			exit(1);
+		}
+		failed = recordSession(listen_target, argv[optind]);
+		if (!failed)
+		{
+			computeStats(&session, stats);
+			displayStats("Recorded session", stats);
+		}
+		closeDevice(&device);
+	}
+	else if (!strcmp(mode, "replay") && (optind == (argc - 1)))
+	{
+		if (readSession(&recorded, argv[optind]) || openDevice(device_target))
+		{
+			exit(1);
+		}
+		r = replaySession(&recorded);
+		closeDevice(&device);
+		if (r < 0)
+		{
+			printf("Device stopped responding properly; replay is incomplete\n");
+			failed = 1;
+		}
+		else if (r > 0)
+		{
+			printf("%d response(s) didn't match the recording\n", r);
+			failed = 1;
+		}
+		computeStats(&recorded, baseline_stats);
+		computeStats(&session, stats);
+		displayStats("Replayed session", stats);
+		if (compareStats(baseline_stats, stats) != 0)
+		{
+			failed = 1;
+		}
+		if ((out_filename != NULL) && writeSession(&session, out_filename))
+		{
+			failed = 1;
+		}
+		freeSession(&recorded);
+	}
+	else if (!strcmp(mode, "report") && ((optind == (argc - 1)) || (optind == (argc - 2))))
+	{
+		if (readSession(&session, argv[optind]))
+		{
+			exit(1);
+		}
+		computeStats(&session, stats);
+		displayStats(argv[optind], stats);
+		if (optind == (argc - 2))
+		{
+			if (readSession(&baseline, argv[optind + 1]))
+			{
+				exit(1);
+			}
+			computeStats(&baseline, baseline_stats);
+			if (compareStats(baseline_stats, stats) != 0)
+			{
+				failed = 1;
+			}
+			freeSession(&baseline);
+		}
+	}
+	else
+	{
+		printUsage(argv[0]);
+		exit(1);
+	}
+	freeSession(&session);
+	exit(failed);
+}
@@ -0,0 +1,308 @@
+// ***********************************************************************
+// hwb_trace.c
+// ***********************************************************************
+//
+// Gets the event trace (see trace.h in the top-level directory) from a
+// hardware bitcoin wallet and displays it as a timeline. The device must
+// have been built with STREAM_COMM_PROFILE and STREAM_COMM_TRACE defined.
+//
+// The device is either a USB HID device that uses the stream-based protocol
+// of hwb_tester.c (this uses HIDAPI), or a socket of the host build (see
+// host/ in the top-level directory). Compile with -DNO_HIDAPI to leave out
+// USB HID support, so that HIDAPI isn't needed.
+//
+// Each line of the timeline has the event number, the time (in
+// microseconds) since the first displayed event, the time since the
+// previous event, the event type and its argument. For events which end
+// something (eg. TRACE_PACKET_END), the time since the matching beginning
+// (eg. TRACE_PACKET_BEGIN) is also displayed.
+//
+// This file is licensed as described by the file LICENCE.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "tester_transport.h"
+
+// Size of each event in the events field of a Trace message.
+#define TRACE_ENTRY_SIZE		8
+
+// Packet types which need special treatment.
+#define PACKET_TYPE_GET_TRACE	0x1e
+#define PACKET_TYPE_FAILURE		0x35
+#define PACKET_TYPE_TRACE		0x3f
+
+// Everything known about one type of event. This must be kept in sync with
+// TraceEventEnum in trace.h.
+typedef struct EventInfoStruct
+{
+	const char *name;
+	// For events which end something, the type of the event which begins
+	// it. 0 for everything else.
+	unsigned int begin_event;
+} EventInfo;
+
+static const EventInfo event_info[] = {
+	{"(unknown)", 0},
+	{"PACKET_BEGIN", 0},
+	{"PACKET_END", 1},
+	{"USB_RECEIVE", 0},
+	{"USB_RECEIVE_STALL", 0},
+	{"USB_RECEIVE_RESUME", 4},
+	{"USB_TRANSMIT", 0},
+	{"USB_TRANSMIT_WAIT", 0},
+	{"NV_FLUSH_BEGIN", 0},
+	{"NV_FLUSH_END", 8},
+	{"NV_ERASE_BEGIN", 0},
+	{"NV_ERASE_END", 10},
+	{"HWRNG_FILL_BEGIN", 0},
+	{"HWRNG_OVERRUN", 0},
+	{"HWRNG_FILL_END", 12},
+	{"ECDSA_SIGN_BEGIN", 0},
+	{"ECDSA_SIGN_END", 15}
+};
+
+#define NUM_EVENT_TYPES			(sizeof(event_info) / sizeof(event_info[0]))
+
+// The device.
+static Device device;
+
+// Display the events field of a Trace message as a timeline.
+static void displayEvents(uint8_t *events, uint32_t length, uint32_t total_events, uint32_t cycles_per_second)
+{
+	uint32_t num_events;
+	uint32_t first_event_number;
+	uint32_t i;
+	uint32_t timestamp;
+	uint32_t previous_timestamp;
+	uint16_t event;
+	uint16_t argument;
+	uint64_t now;
+	uint64_t begin_time[NUM_EVENT_TYPES];
+	int begin_seen[NUM_EVENT_TYPES];
+	double us_per_cycle;
+	const char *name;
+
+	num_events = length / TRACE_ENTRY_SIZE;
+	first_event_number = total_events - num_events;
+	us_per_cycle = 1000000.0 / (double)cycles_per_second;
+	printf("%u events recorded, showing the last %u", total_events, num_events);
+	printf(" (cycle counter runs at %u Hz)\n", cycles_per_second);
+	printf("%10s %14s %12s  %-20s %s\n", "Event", "Time (us)", "Delta (us)", "Type", "Argument");
+	memset(begin_seen, 0, sizeof(begin_seen));
+	now = 0;
+	previous_timestamp = 0;
+	for (i = 0; i < num_events; i++)
+	{
+		timestamp = readU32LittleEndian(&(events[i * TRACE_ENTRY_SIZE]));
+		event = readU16LittleEndian(&(events[i * TRACE_ENTRY_SIZE + 4]));
+		argument = readU16LittleEndian(&(events[i * TRACE_ENTRY_SIZE + 6]));
+		if (i > 0)
+		{
+			// The device's counter wraps around, so unwrap it by adding up
+			// the differences between consecutive timestamps. This is only
+			// wrong if two consecutive events are more than one wraparound
+			// apart.
+			now += (uint32_t)(timestamp - previous_timestamp);
+		}
+		if (event < NUM_EVENT_TYPES)
+		{
+			name = event_info[event].name;
+		}
+		else
+		{
+			name = event_info[0].name;
+		}
+		printf("%10u %14.1f %12.1f  %-20s 0x%04x",
+			first_event_number + i,
+			(double)now * us_per_cycle,
+			(i > 0) ? (double)(uint32_t)(timestamp - previous_timestamp) * us_per_cycle : 0.0,
+			name,
+			argument);
+		if (event < NUM_EVENT_TYPES)
+		{
+			begin_time[event] = now;
+			begin_seen[event] = 1;
+			if ((event_info[event].begin_event != 0) && begin_seen[event_info[event].begin_event])
+			{
+				printf("  (took %.1f us)", (double)(now - begin_time[event_info[event].begin_event]) * us_per_cycle);
+				begin_seen[event_info[event].begin_event] = 0;
+			}
+		}
+		printf("\n");
+		previous_timestamp = timestamp;
+	}
+}
+
+// Decode and display a Trace message. Returns 0 on success, non-zero if the
+// message is malformed.
+static int displayTrace(uint8_t *payload, uint32_t length)
+{
+	uint32_t index;
+	uint64_t key;
+	uint64_t value;
+	uint32_t cycles_per_second;
+	uint32_t total_events;
+	uint8_t *events;
+	uint32_t events_length;
+
+	cycles_per_second = 0;
+	total_events = 0;
+	events = NULL;
+	events_length = 0;
+	index = 0;
+	while (index < length)
+	{
+		if (readVarint(&key, payload, length, &index))
+		{
+			return 1;
+		}
+		if ((key & 7) == 0)
+		{
+			// Varint.
+			if (readVarint(&value, payload, length, &index))
+			{
+				return 1;
+			}
+			if ((key >> 3) == 1)
+			{
+				cycles_per_second = (uint32_t)value;
+			}
+			else if ((key >> 3) == 2)
+			{
+				total_events = (uint32_t)value;
+			}
+		}
+		else if ((key & 7) == 2)
+		{
+			// Length-delimited.
+			if (readVarint(&value, payload, length, &index))
+			{
+				return 1;
+			}
+			if (value > (length - index))
+			{
+				return 1;
+			}
+			if ((key >> 3) == 3)
+			{
+				events = &(payload[index]);
+				events_length = (uint32_t)value;
+			}
+			index += (uint32_t)value;
+		}
+		else
+		{
+			return 1; // no other wire types are used in Trace
+		}
+	}
+	if ((cycles_per_second == 0) || ((events_length % TRACE_ENTRY_SIZE) != 0)
+		|| ((events_length / TRACE_ENTRY_SIZE) > total_events))
+	{
+		return 1;
+	}
+	displayEvents(events, events_length, total_events, cycles_per_second);
+	return 0;
+}
+
+static void printUsage(const char *program_name)
+{
+	printf("Usage: %s [-c] [-s socket]\n", program_name);
+	printf("  -c         Clear the trace after getting it\n");
+	printf("  -s socket  Use the host build listening on this socket, instead of a\n");
+	printf("             USB HID device. This is a Unix domain socket path\n");
+	printf("             (beginning with '/' or '.'), <port> or <address>:<port>.\n");
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	int clear;
+	int failed;
+	uint8_t packet[10];
+	uint8_t *response;
+	uint16_t type;
+
+	clear = 0;
+	while ((opt = getopt(argc, argv, "cs:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c':
+			clear = 1;
+			break;
+		case 's':
+			if (openSocketDevice(&device, optarg, 0))
+			{
+				exit(1);
+			}
+			break;
+		default:
+			printUsage(argv[0]);
+			exit(1);
+		}
+	}
+	if (optind != argc)
+	{
+		printUsage(argv[0]);
+		exit(1);
+	}
+	if (device.type != DEVICE_SOCKET)
+	{
+#ifndef NO_HIDAPI
+		if (openHIDDevice(&device))
+		{
+			exit(1);
+		}
+#else
+		printUsage(argv[0]);
+		exit(1);
+#endif // #ifndef NO_HIDAPI
+	}
+
+	// Build GetTrace packet. If clear is set, the payload is field 1
+	// (clear) = true.
+	packet[0] = '#';
+	packet[1] = '#';
+	packet[2] = 0x00;
+	packet[3] = PACKET_TYPE_GET_TRACE;
+	packet[4] = 0x00;
+	packet[5] = 0x00;
+	packet[6] = 0x00;
+	packet[7] = (uint8_t)(clear ? 2 : 0);
+	packet[8] = 0x08;
+	packet[9] = 0x01;
+	failed = 1;
+	if (!sendBytes(&device, packet, clear ? 10 : 8))
+	{
+		response = receivePacket(&device, &type);
+		if (response != NULL)
+		{
+			if (type == PACKET_TYPE_TRACE)
+			{
+				if (displayTrace(&(response[8]), readU32BigEndian(&(response[4]))))
+				{
+					printf("Got malformed Trace message\n");
+				}
+				else
+				{
+					failed = 0;
+				}
+			}
+			else if (type == PACKET_TYPE_FAILURE)
+			{
+				printf("Got Failure response; was the device built with STREAM_COMM_TRACE?\n");
+			}
+			else
+			{
+				printf("Got unexpected response (packet type 0x%04x)\n", (unsigned int)type);
+			}
+			free(response);
+		}
+	}
+
+	closeDevice(&device);
+	exit(failed);
+}
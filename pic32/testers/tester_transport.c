@@ -0,0 +1,406 @@
+// ***********************************************************************
+// tester_transport.c
+// ***********************************************************************
+//
+// Sending and receiving packets for the tester programs which talk to a
+// hardware bitcoin wallet. See tester_transport.h for more information.
+//
+// This file is licensed as described by the file LICENCE.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "tester_transport.h"
+
+// Returns non-zero if receiving from device should give up.
+static int isCancelled(Device *device)
+{
+	return (device->cancel != NULL) && *(device->cancel);
+}
+
+// Read a 32-bit unsigned integer from the byte array specified by in.
+// The bytes will be read in a big-endian format.
+uint32_t readU32BigEndian(uint8_t *in)
+{
+	return ((uint32_t)in[0] << 24)
+		| ((uint32_t)in[1] << 16)
+		| ((uint32_t)in[2] << 8)
+		| ((uint32_t)in[3]);
+}
+
+// Read a 32-bit unsigned integer from the byte array specified by in.
+// The bytes will be read in a little-endian format.
+uint32_t readU32LittleEndian(uint8_t *in)
+{
+	return ((uint32_t)in[0])
+		| ((uint32_t)in[1] << 8)
+		| ((uint32_t)in[2] << 16)
+		| ((uint32_t)in[3] << 24);
+}
+
+// Read a 16-bit unsigned integer from the byte array specified by in.
+// The bytes will be read in a little-endian format.
+uint16_t readU16LittleEndian(uint8_t *in)
+{
+	return (uint16_t)(((uint16_t)in[0]) | ((uint16_t)in[1] << 8));
+}
+
+// Read a protocol buffer varint from the byte array specified by
+// buffer (of length bytes), starting at *index. *index will be advanced
+// past the varint. Returns 0 on success, non-zero if the varint runs past
+// the end of the buffer.
+int readVarint(uint64_t *out, uint8_t *buffer, uint32_t length, uint32_t *index)
+{
+	unsigned int shift;
+	uint8_t one_byte;
+
+	*out = 0;
+	shift = 0;
+	do
+	{
+		if ((*index >= length) || (shift >= 64))
+		{
+			return 1;
+		}
+		one_byte = buffer[*index];
+		(*index)++;
+		*out |= (uint64_t)(one_byte & 0x7f) << shift;
+		shift += 7;
+	} while ((one_byte & 0x80) != 0);
+	return 0;
+}
+
+// Get the current time, in microseconds.
+uint64_t getMicroseconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+// Send the byte array specified by buffer (which is length bytes long) to
+// a device. Returns 0 on success, non-zero on error.
+int sendBytes(Device *device, uint8_t *buffer, uint32_t length)
+{
+#ifndef NO_HIDAPI
+	uint8_t packet_buffer[64];
+	unsigned int data_size;
+#endif // #ifndef NO_HIDAPI
+	ssize_t r;
+
+	while (length > 0)
+	{
+#ifndef NO_HIDAPI
+		if (device->type == DEVICE_HID)
+		{
+			data_size = length;
+			if (data_size > 63)
+			{
+				data_size = 63;
+			}
+			packet_buffer[0] = (uint8_t)data_size; // report ID
+			memcpy(&(packet_buffer[1]), buffer, data_size);
+			if (hid_write(device->hid, packet_buffer, data_size + 1) < 0)
+			{
+				printf("%s: hid_write() failed, error: %ls\n", device->name, hid_error(device->hid));
+				return 1;
+			}
+			buffer += data_size;
+			length -= data_size;
+			continue;
+		}
+#endif // #ifndef NO_HIDAPI
+		r = write(device->fd, buffer, length);
+		if (r < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			printf("%s: write() failed, error: %s\n", device->name, strerror(errno));
+			return 1;
+		}
+		buffer += r;
+		length -= (uint32_t)r;
+	}
+	return 0;
+}
+
+// Receive up to length bytes from a device. Returns the number of bytes
+// received, or 0 on error (or if the device's cancel flag was set while
+// waiting).
+uint32_t receiveSomeBytes(Device *device, uint8_t *buffer, uint32_t length)
+{
+#ifndef NO_HIDAPI
+	uint8_t packet_buffer[64];
+	unsigned int data_size;
+	int hid_r;
+#endif // #ifndef NO_HIDAPI
+	ssize_t r;
+
+#ifndef NO_HIDAPI
+	if (device->type == DEVICE_HID)
+	{
+		// A HID report can't be partially read, so length must be at
+		// least 63 (see receivePacket()). A timeout is used so that the
+		// cancel flag is noticed.
+		do
+		{
+			hid_r = hid_read_timeout(device->hid, packet_buffer, sizeof(packet_buffer), 100);
+		} while ((hid_r == 0) && !isCancelled(device));
+		if (hid_r < 0)
+		{
+			printf("%s: hid_read() failed, error: %ls\n", device->name, hid_error(device->hid));
+			return 0;
+		}
+		if (hid_r == 0)
+		{
+			return 0;
+		}
+		data_size = packet_buffer[0]; // report ID
+		if ((data_size > 63) || (data_size > length))
+		{
+			printf("%s: got invalid report ID: %u\n", device->name, data_size);
+			return 0;
+		}
+		memcpy(buffer, &(packet_buffer[1]), data_size);
+		return data_size;
+	}
+#endif // #ifndef NO_HIDAPI
+	do
+	{
+		r = read(device->fd, buffer, length);
+	} while ((r < 0) && (errno == EINTR));
+	if (r <= 0)
+	{
+		if (!isCancelled(device))
+		{
+			printf("%s: connection closed\n", device->name);
+		}
+		return 0;
+	}
+	return (uint32_t)r;
+}
+
+// Receive a packet from a device. Returns the packet (which must be freed
+// using free()) on success, or NULL on error. The packet type will be
+// written to out_type.
+uint8_t *receivePacket(Device *device, uint16_t *out_type)
+{
+	uint8_t *buffer;
+	uint32_t buffer_size;
+	uint32_t received_bytes;
+	uint32_t target_length;
+	uint32_t count;
+
+	// Start with enough space for any HID report, so that
+	// receiveSomeBytes() never has to split one.
+	buffer_size = 128;
+	buffer = malloc(buffer_size);
+	received_bytes = 0;
+	target_length = 8;
+	while (received_bytes < target_length)
+	{
+		if ((buffer_size - received_bytes) < 64)
+		{
+			buffer_size *= 2;
+			buffer = realloc(buffer, buffer_size);
+		}
+		count = buffer_size - received_bytes;
+		if (device->type == DEVICE_SOCKET)
+		{
+			// Don't read past the end of this packet.
+			count = target_length - received_bytes;
+		}
+		count = receiveSomeBytes(device, &(buffer[received_bytes]), count);
+		if (count == 0)
+		{
+			free(buffer);
+			return NULL;
+		}
+		received_bytes += count;
+		if (received_bytes >= 8)
+		{
+			if ((buffer[0] != '#') || (buffer[1] != '#'))
+			{
+				printf("%s: got bad magic bytes: %02x%02x\n", device->name, buffer[0], buffer[1]);
+				free(buffer);
+				return NULL;
+			}
+			target_length = readU32BigEndian(&(buffer[4])) + 8;
+			if (target_length > PACKET_LENGTH_LIMIT)
+			{
+				printf("%s: got absurdly large packet length of %u\n", device->name, target_length);
+				free(buffer);
+				return NULL;
+			}
+			if (buffer_size < (target_length + 64))
+			{
+				buffer_size = target_length + 64;
+				buffer = realloc(buffer, buffer_size);
+			}
+		}
+	}
+	*out_type = (uint16_t)(((uint16_t)buffer[2] << 8) | ((uint16_t)buffer[3]));
+	return buffer;
+}
+
+// Connect to the host build. target is either a Unix domain socket path or
+// "<port>" or "<address>:<port>". If listen_for_client is non-zero, listen
+// on target and wait for a client to connect instead. Returns 0 on success,
+// non-zero on error.
+int openSocketDevice(Device *device, const char *target, int listen_for_client)
+{
+	struct sockaddr_un un_addr;
+	struct sockaddr_in in_addr;
+	struct sockaddr *addr;
+	socklen_t addr_length;
+	const char *colon;
+	char address[64];
+	int fd;
+	int one;
+
+	device->type = DEVICE_SOCKET;
+	snprintf(device->name, sizeof(device->name), "%s", target);
+	colon = strrchr(target, ':');
+	if ((target[0] == '/') || (target[0] == '.'))
+	{
+		if (strlen(target) >= sizeof(un_addr.sun_path))
+		{
+			printf("Socket path \"%s\" is too long\n", target);
+			return 1;
+		}
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		memset(&un_addr, 0, sizeof(un_addr));
+		un_addr.sun_family = AF_UNIX;
+		strcpy(un_addr.sun_path, target);
+		addr = (struct sockaddr *)&un_addr;
+		addr_length = sizeof(un_addr);
+		if (listen_for_client)
+		{
+			unlink(target);
+		}
+	}
+	else
+	{
+		memset(&in_addr, 0, sizeof(in_addr));
+		in_addr.sin_family = AF_INET;
+		if (colon != NULL)
+		{
+			snprintf(address, sizeof(address), "%.*s", (int)(colon - target), target);
+			in_addr.sin_port = htons((uint16_t)atoi(colon + 1));
+		}
+		else
+		{
+			strcpy(address, "127.0.0.1");
+			in_addr.sin_port = htons((uint16_t)atoi(target));
+		}
+		if (inet_pton(AF_INET, address, &(in_addr.sin_addr)) != 1)
+		{
+			printf("Invalid address \"%s\"\n", address);
+			return 1;
+		}
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		addr = (struct sockaddr *)&in_addr;
+		addr_length = sizeof(in_addr);
+		one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	}
+	if (fd < 0)
+	{
+		printf("Couldn't create socket: %s\n", strerror(errno));
+		return 1;
+	}
+	if (listen_for_client)
+	{
+		if (bind(fd, addr, addr_length) || listen(fd, 1))
+		{
+			printf("Couldn't listen on \"%s\": %s\n", target, strerror(errno));
+			close(fd);
+			return 1;
+		}
+		printf("Waiting for a client to connect to %s\n", target);
+		device->fd = accept(fd, NULL, NULL);
+		close(fd);
+		if (device->fd < 0)
+		{
+			printf("accept() failed: %s\n", strerror(errno));
+			return 1;
+		}
+	}
+	else
+	{
+		device->fd = fd;
+		if (connect(device->fd, addr, addr_length))
+		{
+			printf("Couldn't connect to \"%s\": %s\n", target, strerror(errno));
+			return 1;
+		}
+	}
+	if (addr == (struct sockaddr *)&in_addr)
+	{
+		one = 1;
+		setsockopt(device->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	return 0;
+}
+
+#ifndef NO_HIDAPI
+// Open the first USB HID device which can be opened. Returns 0 on success,
+// non-zero on error.
+int openHIDDevice(Device *device)
+{
+	struct hid_device_info *devs;
+	struct hid_device_info *current;
+
+	if (hid_init())
+	{
+		printf("hid_init() failed\n");
+		return 1;
+	}
+	device->type = DEVICE_HID;
+	device->hid = NULL;
+	devs = hid_enumerate(TARGET_VID, TARGET_PID);
+	for (current = devs; (current != NULL) && (device->hid == NULL); current = current->next)
+	{
+		snprintf(device->name, sizeof(device->name), "%s", current->path);
+		device->hid = hid_open_path(current->path);
+		if (device->hid == NULL)
+		{
+			printf("Unable to open %s; are you running this as root?\n", current->path);
+		}
+	}
+	hid_free_enumeration(devs);
+	if (device->hid == NULL)
+	{
+		printf("No devices found\n");
+		return 1;
+	}
+	return 0;
+}
+#endif // #ifndef NO_HIDAPI
+
+// Close a device opened by openSocketDevice() or openHIDDevice().
+void closeDevice(Device *device)
+{
+#ifndef NO_HIDAPI
+	if (device->type == DEVICE_HID)
+	{
+		hid_close(device->hid);
+		// Free static HIDAPI objects.
+		hid_exit();
+		return;
+	}
+#endif // #ifndef NO_HIDAPI
+	close(device->fd);
+}
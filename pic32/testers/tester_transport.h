@@ -0,0 +1,69 @@
+// ***********************************************************************
+// tester_transport.h
+// ***********************************************************************
+//
+// Sending and receiving packets for the tester programs which talk to a
+// hardware bitcoin wallet, plus the byte and varint helpers they share. A
+// device is either a USB HID device that uses the stream-based protocol of
+// hwb_tester.c (this uses HIDAPI), or a socket of the host build (see host/
+// in the top-level directory). Compile everything with -DNO_HIDAPI to leave
+// out USB HID support, so that HIDAPI isn't needed.
+//
+// This file is licensed as described by the file LICENCE.
+
+#ifndef TESTER_TRANSPORT_H_INCLUDED
+#define TESTER_TRANSPORT_H_INCLUDED
+
+#include <stdint.h>
+#ifndef NO_HIDAPI
+#include "hidapi/hidapi.h"
+#endif // #ifndef NO_HIDAPI
+
+// Vendor ID of target device. This must match the vendor ID in the
+// device's device descriptor.
+#define TARGET_VID				0x04f3
+// Product ID of target device. This must match the product ID in the
+// device's device descriptor.
+#define TARGET_PID				0x0210
+// Maximum packet length to accept before program suspects the packet is
+// garbled.
+#define PACKET_LENGTH_LIMIT		1000000
+
+// Types of device.
+typedef enum DeviceTypeEnum
+{
+	DEVICE_HID		= 1,
+	DEVICE_SOCKET	= 2
+} DeviceType;
+
+// Everything needed to talk to one device (or client).
+typedef struct DeviceStruct
+{
+	DeviceType type;
+	// Name to display in error messages.
+	char name[128];
+#ifndef NO_HIDAPI
+	hid_device *hid;
+#endif // #ifndef NO_HIDAPI
+	int fd;
+	// If this isn't NULL, receiving gives up (without displaying an error)
+	// once *cancel is non-zero. For sockets, the connection must also be
+	// shut down, to wake up a blocked read().
+	volatile int *cancel;
+} Device;
+
+extern uint32_t readU32BigEndian(uint8_t *in);
+extern uint32_t readU32LittleEndian(uint8_t *in);
+extern uint16_t readU16LittleEndian(uint8_t *in);
+extern int readVarint(uint64_t *out, uint8_t *buffer, uint32_t length, uint32_t *index);
+extern uint64_t getMicroseconds(void);
+extern int sendBytes(Device *device, uint8_t *buffer, uint32_t length);
+extern uint32_t receiveSomeBytes(Device *device, uint8_t *buffer, uint32_t length);
+extern uint8_t *receivePacket(Device *device, uint16_t *out_type);
+extern int openSocketDevice(Device *device, const char *target, int listen_for_client);
+#ifndef NO_HIDAPI
+extern int openHIDDevice(Device *device);
+#endif // #ifndef NO_HIDAPI
+extern void closeDevice(Device *device);
+
+#endif // #ifndef TESTER_TRANSPORT_H_INCLUDED
@@ -63,5 +63,10 @@ extern void usbClassSetConfiguration(uint8_t new_configuration_value);
 /** This will be called whenever a USB reset is seen. This callback gives
   * class drivers the opportunity to reset their state. */
 extern void usbClassResetSeen(void);
+/** This will be called once every 1 ms frame, but only while the start of
+  * frame interrupt is enabled (see usbEnableStartOfFrameInterrupt()). This
+  * gives class drivers a cheap timer which is synchronised to the host's
+  * polling. This is called from an interrupt context. */
+extern void usbClassStartOfFrame(void);
 
 #endif	// #ifndef USB_CALLBACKS_H
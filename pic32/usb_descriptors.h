@@ -84,12 +84,21 @@ static const uint8_t configuration_descriptor[] = {
 // Configuration descriptor:
 0x09, // length of this descriptor in bytes
 DESCRIPTOR_CONFIGURATION, // descriptor type
+#ifdef USB_BULK_STREAM
+#ifdef NO_INTERRUPT_OUT
+0x39, 0x00, // total length of all included descriptors in bytes (little-endian)
+#else
+0x40, 0x00, // total length of all included descriptors in bytes (little-endian)
+#endif // #ifdef NO_INTERRUPT_OUT
+0x02, // number of interfaces supported by this configuration
+#else
 #ifdef NO_INTERRUPT_OUT
 0x22, 0x00, // total length of all included descriptors in bytes (little-endian)
 #else
 0x29, 0x00, // total length of all included descriptors in bytes (little-endian)
 #endif // #ifdef NO_INTERRUPT_OUT
 0x01, // number of interfaces supported by this configuration
+#endif // #ifdef USB_BULK_STREAM
 0x01, // configuration value (must be 1, usb_standard_requests.c assumes this)
 0x00, // index of string descriptor describing configuration (0 = none)
 0x80, // attributes (0x80 = not self-powered, no remote wakeup)
@@ -122,7 +131,7 @@ DESCRIPTOR_ENDPOINT, // descriptor type
 0x81, // endpoint number; bit 7 set means IN, endpoint 1
 0x03, // attributes (3 = interrupt transfers)
 0x40, 0x00, // maximum packet size of this endpoint in bytes (little-endian)
-0x0a, // polling interval, in millisecond
+0x01, // polling interval, in millisecond
 #ifndef NO_INTERRUPT_OUT
 // Endpoint 2 descriptor:
 0x07, // length of this descriptor in bytes
@@ -130,8 +139,34 @@ DESCRIPTOR_ENDPOINT, // descriptor type
 0x02, // endpoint number; bit 7 clear means OUT, endpoint 2
 0x03, // attributes (3 = interrupt transfers)
 0x40, 0x00, // maximum packet size of this endpoint in bytes (little-endian)
-0x01 // polling interval, in millisecond
+0x01, // polling interval, in millisecond
 #endif // #ifndef NO_INTERRUPT_OUT
+#ifdef USB_BULK_STREAM
+// Interface descriptor for the (optional) bulk stream interface:
+0x09, // length of this descriptor in bytes
+DESCRIPTOR_INTERFACE, // descriptor type
+0x01, // number of this interface (1 = second)
+0x00, // alternate setting (0 = default)
+0x02, // number of endpoints used by this interface, not including control endpoint
+0xff, // interface class (0xff = vendor-specific)
+0x00, // interface subclass (0 = no subclass)
+0x00, // interface protocol (0 = none)
+0x00, // index of string descriptor describing interface (0 = none)
+// Endpoint 3 descriptor:
+0x07, // length of this descriptor in bytes
+DESCRIPTOR_ENDPOINT, // descriptor type
+0x83, // endpoint number; bit 7 set means IN, endpoint 3
+0x02, // attributes (2 = bulk transfers)
+0x40, 0x00, // maximum packet size of this endpoint in bytes (little-endian)
+0x00, // polling interval (ignored for bulk endpoints)
+// Endpoint 4 descriptor:
+0x07, // length of this descriptor in bytes
+DESCRIPTOR_ENDPOINT, // descriptor type
+0x04, // endpoint number; bit 7 clear means OUT, endpoint 4
+0x02, // attributes (2 = bulk transfers)
+0x40, 0x00, // maximum packet size of this endpoint in bytes (little-endian)
+0x00, // polling interval (ignored for bulk endpoints)
+#endif // #ifdef USB_BULK_STREAM
 };
 
 /** Section 9.6.7 of the USB specification states that if a device returns
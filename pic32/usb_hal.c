@@ -5,8 +5,14 @@
   * This file provides an abstract interface for USB operations on the PIC32
   * USB module. It is quite simple and doesn't support many features.
   * The PIC32 USB module supports "ping-pong buffering" (double buffering),
-  * but this implementation does not use this feature, as throughput is not
-  * expected to be a concern. Furthermore, this doesn't support USB suspend or
+  * but this implementation does not use this feature. All the non-control
+  * endpoints are Interrupt endpoints, which can do at most one transaction
+  * per 1 ms frame, and the interrupt service handler hands the (single)
+  * buffer descriptor back to the USB module within microseconds of each
+  * transaction. So a second buffer descriptor would not allow any more
+  * transactions per frame. Whether an endpoint keeps up with the host
+  * depends on the class driver having enough FIFO space to queue the next
+  * receive or transmit. Furthermore, this doesn't support USB suspend or
   * resume.
   *
   * From a device's perspective, USB transactions are asynchronous. That is
@@ -389,6 +395,14 @@ void __attribute__((vector(_USB_1_VECTOR), interrupt(ipl2), nomips16)) _USBHandl
 		IFS1bits.USBIF = 0; // clear interrupt flag in interrupt controller
 		usbFatalError();
 	}
+	else if (U1IRbits.SOFIF != 0)
+	{
+		// Start of frame; this only happens once every 1 ms frame, and only
+		// while the interrupt is enabled by usbEnableStartOfFrameInterrupt().
+		U1IR = 0x04; // clear SOFIF only (it's a write 1 to clear register)
+		IFS1bits.USBIF = 0; // clear interrupt flag in interrupt controller
+		usbClassStartOfFrame();
+	}
 	else
 	{
 		// This should never happen.
@@ -631,6 +645,30 @@ void usbQueueTransmitPacket(const uint8_t *packet_buffer, uint32_t length, unsig
 	bdt_table[index].CTRL.UOWN = 1;
 }
 
+/** Enable or disable the start of frame interrupt. While it is enabled,
+  * usbClassStartOfFrame() will be called once every 1 ms frame. It is
+  * disabled after usbInit().
+  * \param enable true to enable the interrupt, false to disable it.
+  */
+void usbEnableStartOfFrameInterrupt(bool enable)
+{
+	if (enable)
+	{
+		if (U1IEbits.SOFIE == 0)
+		{
+			// SOFIF is set every frame regardless of SOFIE, so clear it
+			// to avoid getting an interrupt for a frame which has already
+			// started.
+			U1IR = 0x04; // clear SOFIF only
+			U1IEbits.SOFIE = 1;
+		}
+	}
+	else
+	{
+		U1IEbits.SOFIE = 0;
+	}
+}
+
 /** Cancel a queued transmission.
   * \param endpoint The endpoint number of the transmission to cancel.
   * \warning It is almost always unsafe to call this, because the USB module
@@ -89,6 +89,7 @@ extern bool usbIsEndpointEnabled(unsigned int endpoint);
 extern void usbQueueReceivePacket(unsigned int endpoint);
 extern void usbQueueTransmitPacket(const uint8_t *packet_buffer, uint32_t length, unsigned int endpoint, bool is_extended);
 extern void usbCancelTransmit(unsigned int endpoint);
+extern void usbEnableStartOfFrameInterrupt(bool enable);
 extern void usbStallEndpoint(unsigned int endpoint);
 extern void usbUnstallEndpoint(unsigned int endpoint);
 extern bool usbIsEndpointStalled(unsigned int endpoint);
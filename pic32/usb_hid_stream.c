@@ -10,7 +10,8 @@
   * done this way to allow "driverless" operation on Windows systems.
   *
   * Here's a high-level overview of what's provided in this file. There is
-  * an implementation of streamGetOneByte() and streamPutOneByte(), which
+  * an implementation of streamGetOneByte() and streamPutOneByte() (and their
+  * bulk equivalents streamGetBytes() and streamPutBytes()), which
   * read from or write to FIFOs. The interface to USB happens mainly through
   * callbacks, because USB is fundamentally asynchronous from a device's point
   * of view. The nature of asynchronous I/O means that care must be taken to
@@ -31,6 +32,31 @@
   *   (see setReport()) because the hidraw driver on Linux kernels
   *   earlier than 2.6.35 use it, even if the device provides a perfectly
   *   working Interrupt OUT endpoint.
+  * - If USB_BULK_STREAM is defined, the device also has a vendor-specific
+  *   interface with a pair of Bulk endpoints, which can move data much
+  *   faster than one report per frame. Data sent to the Bulk OUT endpoint
+  *   is not split into reports; it is just the raw stream. The Bulk and HID
+  *   endpoints share the same FIFOs. The host selects the Bulk transport by
+  *   sending something to the Bulk OUT endpoint; from then on (until the
+  *   device is reconfigured), everything transmitted goes out the Bulk IN
+  *   endpoint. Like mixing Interrupt and control endpoint reports, sending
+  *   through both the HID and Bulk endpoints at the same time will result
+  *   in undefined ordering.
+  * - Transmitted bytes are coalesced: a packet is only queued straight away
+  *   if there's enough in the transmit FIFO to fill it. Anything less is
+  *   sent at the next start of frame (see usbClassStartOfFrame()), or as
+  *   soon as the device starts waiting for the host (see
+  *   flushTransmitFIFO()), whichever comes first. This way, responses
+  *   which are written in many small pieces, or which are smaller than a
+  *   packet and sent back-to-back, share packets instead of each using up
+  *   a whole frame.
+  * - Everything to do with control endpoint reports happens in interrupt
+  *   context. The main loop only ever moves bytes in and out of the FIFOs.
+  *   A "Get Report" report which can't be completed straight away is filled
+  *   from the transmit FIFO by usbClassStartOfFrame(), and a "Set Report"
+  *   Data stage is only held back if the receive FIFO really has no room for
+  *   the report. This keeps the host from being NAKed on the control
+  *   endpoint just because the main loop is busy with a long calculation.
   *
   * All references to the "USB specification" refer to revision 2.0, obtained
   * from http://www.usb.org/developers/docs/usb_20_110512.zip (see usb_20.pdf)
@@ -49,6 +75,9 @@
 #include "usb_defs.h"
 #include "usb_standard_requests.h"
 #include "../common.h"
+#include "../hwinterface.h"
+#include "../background.h"
+#include "../trace.h"
 #include "serial_fifo.h"
 #include "pic32_system.h"
 
@@ -64,26 +93,42 @@
   * from the host's perspective, data is flowing out of it. */
 #define RECEIVE_ENDPOINT_NUMBER		2
 
-/** Size of transmit FIFO buffer, in number of bytes. There isn't much to be
-  * gained from making this significantly larger.
+/** Size of transmit FIFO buffer, in number of bytes. This is enough for
+  * four full reports, so that the main loop can get a few frames ahead of
+  * the host.
   * \warning This must be a power of 2.
   */
-#define TRANSMIT_FIFO_SIZE			64
-/** Size of receive FIFO buffer, in number of bytes. There isn't much to be
-  * gained from making this significantly larger.
+#define TRANSMIT_FIFO_SIZE			256
+/** Size of receive FIFO buffer, in number of bytes. This is enough for
+  * sixteen full reports. Since the Interrupt OUT endpoint can receive one
+  * report every 1 ms frame, this lets the main loop spend up to 14 ms (the
+  * rest is #RECEIVE_HEADROOM) doing something other than draining the FIFO
+  * before the host gets NAKed. That matters when uploading large
+  * transactions, since the transaction parser does a lot of hashing.
   * \warning This must be a power of 2.
   * \warning This must be >= #RECEIVE_HEADROOM, to handle the (unlikely)
   *          cases where the host does simultaneous writes to the
   *          Interrupt OUT endpoint and control endpoint.
   */
-#define RECEIVE_FIFO_SIZE			256
+#define RECEIVE_FIFO_SIZE			1024
+
+#ifdef USB_BULK_STREAM
+/** The endpoint number for Bulk stream transmission (Bulk IN). */
+#define BULK_TRANSMIT_ENDPOINT_NUMBER	3
+/** The endpoint number for Bulk stream reception (Bulk OUT). */
+#define BULK_RECEIVE_ENDPOINT_NUMBER	4
+#endif // #ifdef USB_BULK_STREAM
 
 /** Minimum number of bytes which must be available (free) in the receive
   * FIFO before a receive will be queued. This is not just #MAX_PACKET_SIZE
   * because the host may do simultaneous writes to the Interrupt OUT endpoint
-  * and control endpoint, in which case two packets will be received in
-  * quick succession. */
+  * and control endpoint (and the Bulk OUT endpoint, if there is one), in
+  * which case multiple packets will be received in quick succession. */
+#ifdef USB_BULK_STREAM
+#define RECEIVE_HEADROOM			(3 * MAX_PACKET_SIZE)
+#else
 #define RECEIVE_HEADROOM			(2 * MAX_PACKET_SIZE)
+#endif // #ifdef USB_BULK_STREAM
 
 /** The transmit FIFO buffer. */
 volatile CircularBuffer transmit_fifo;
@@ -123,14 +168,34 @@ static EndpointState receive_endpoint_state;
   * something. */
 static const uint8_t null_packet[4];
 
+#ifdef USB_BULK_STREAM
+/** Flag which when true, indicates that a
+  * packet has been queued for transmission on the Bulk IN endpoint. */
+static volatile bool bulk_transmit_queued;
+/** Flag which when true, indicates that a
+  * packet has been queued for reception on the Bulk OUT endpoint. */
+static volatile bool bulk_receive_queued;
+/** Flag which when true, indicates that the host has selected the Bulk
+  * transport (by sending something to the Bulk OUT endpoint), so that
+  * transmitted bytes should go out the Bulk IN endpoint. */
+static volatile bool bulk_stream_selected;
+/** Persistent packet buffer for packets sent from the Bulk IN endpoint
+  * (see #BULK_TRANSMIT_ENDPOINT_NUMBER). */
+static uint8_t bulk_packet_buffer[MAX_PACKET_SIZE];
+/** Persistent endpoint state for the Bulk IN endpoint. */
+static EndpointState bulk_transmit_endpoint_state;
+/** Persistent endpoint state for the Bulk OUT endpoint. */
+static EndpointState bulk_receive_endpoint_state;
+#endif // #ifdef USB_BULK_STREAM
+
 /** Previous configuration value passed to usbClassSetConfiguration(). This
   * is used to detect configuration changes. */
 static uint8_t old_configuration_value;
 
 /** Flag which, when true, indicates that
-  * streamGetOneByte() should queue a receive for the control endpoint instead
-  * of the Interrupt OUT endpoint. This is used to handle the "Set Report"
-  * request. */
+  * queueReceiveIfSpace() should queue a receive for the control endpoint
+  * instead of the Interrupt OUT endpoint, once there is enough space in the
+  * receive FIFO. This is used to handle the "Set Report" request. */
 static volatile bool do_control_receive_queue;
 /** Flag which, when true, indicates that
   * the next control transfer Data stage will contain an output report. This
@@ -140,11 +205,10 @@ static volatile bool expect_control_report;
   * is only valid when #expect_control_report is true. */
 static uint8_t expected_control_report_id;
 
-/** Flag which, when true, indicates that
-  * streamPutOneByte() should redirect bytes into #get_report_packet_buffer,
-  * where they will be transmitted through the control endpoint (instead of
-  * the Interrupt IN endpoint). This is used to handle the "Get Report"
-  * request. */
+/** Flag which, when true, indicates that bytes from the transmit FIFO
+  * should go into #get_report_packet_buffer, where they will be transmitted
+  * through the control endpoint (instead of the Interrupt IN endpoint). This
+  * is used to handle the "Get Report" request. */
 static volatile bool do_build_transmit_report;
 /** Desired size (as given in the "Get Report" request), in bytes, of the
   * report to send through the control endpoint. This includes the report ID
@@ -162,20 +226,17 @@ static void fillTransmitPacketBufferAndTransmit(void)
 {
 	uint32_t status;
 	uint32_t count;
-	uint32_t i;
 
 	// Put everything in a critical section so that bytes are either in
-	// the transmit FIFO or in interrupt_packet_buffer.
+	// the transmit FIFO or in interrupt_packet_buffer. The critical section
+	// isn't needed for the transmit FIFO itself, but it is needed to keep
+	// interrupt_transmit_queued consistent with what's been queued.
 	status = disableInterrupts();
-	i = 1;
-	while ((i < sizeof(interrupt_packet_buffer)) && !isCircularBufferEmpty(&transmit_fifo))
+	count = 0;
+	if (!isCircularBufferEmpty(&transmit_fifo))
 	{
-		// Note that is_irq is set because interrupts are disabled; that's
-		// equivalent to an interrupt request handler context.
-		interrupt_packet_buffer[i] = circularBufferRead(&transmit_fifo, true);
-		i++;
+		count = circularBufferReadBytes(&transmit_fifo, &(interrupt_packet_buffer[1]), sizeof(interrupt_packet_buffer) - 1);
 	}
-	count = i - 1;
 	interrupt_packet_buffer[0] = (uint8_t)count;
 	if (count > 0)
 	{
@@ -184,6 +245,7 @@ static void fillTransmitPacketBufferAndTransmit(void)
 		// usbQueueTransmitPacket() call.
 		interrupt_transmit_queued = true;
 		usbQueueTransmitPacket(interrupt_packet_buffer, count + 1, TRANSMIT_ENDPOINT_NUMBER, false);
+		TRACE(TRACE_USB_TRANSMIT, count + 1);
 	}
 	else
 	{
@@ -192,6 +254,110 @@ static void fillTransmitPacketBufferAndTransmit(void)
 	restoreInterrupts(status);
 }
 
+#ifdef USB_BULK_STREAM
+/** Fill up the Bulk transmit packet buffer with bytes obtained from the
+  * transmit FIFO buffer, then queue the packet for transmission, if
+  * necessary. Unlike fillTransmitPacketBufferAndTransmit(), there is no
+  * report ID; the packet is just stream data.
+  */
+static void fillBulkPacketBufferAndTransmit(void)
+{
+	uint32_t status;
+	uint32_t count;
+
+	status = disableInterrupts();
+	count = 0;
+	if (!isCircularBufferEmpty(&transmit_fifo))
+	{
+		count = circularBufferReadBytes(&transmit_fifo, bulk_packet_buffer, sizeof(bulk_packet_buffer));
+	}
+	if (count > 0)
+	{
+		bulk_transmit_queued = true;
+		usbQueueTransmitPacket(bulk_packet_buffer, count, BULK_TRANSMIT_ENDPOINT_NUMBER, false);
+		TRACE(TRACE_USB_TRANSMIT, count);
+	}
+	else
+	{
+		bulk_transmit_queued = false;
+	}
+	restoreInterrupts(status);
+}
+#endif // #ifdef USB_BULK_STREAM
+
+/** If nothing is currently queued for transmission on the selected transmit
+  * endpoint, queue a packet from the transmit FIFO. While a "Get Report"
+  * report is being built, the transmit FIFO belongs to that report, so
+  * nothing is queued; instead, the start of frame interrupt is enabled so
+  * that usbClassStartOfFrame() can move bytes into the report. */
+static void transmitIfIdle(void)
+{
+	if (do_build_transmit_report)
+	{
+		usbEnableStartOfFrameInterrupt(true);
+		return;
+	}
+#ifdef USB_BULK_STREAM
+	if (bulk_stream_selected)
+	{
+		if (!bulk_transmit_queued)
+		{
+			fillBulkPacketBufferAndTransmit();
+		}
+		return;
+	}
+#endif // #ifdef USB_BULK_STREAM
+	if (!interrupt_transmit_queued)
+	{
+		fillTransmitPacketBufferAndTransmit();
+	}
+}
+
+/** Queue a packet from the transmit FIFO if there's enough in it to fill
+  * a whole packet on the selected transmit endpoint. Otherwise, arrange for
+  * whatever is in the transmit FIFO to be sent at the next start of frame,
+  * in the hope that more bytes will arrive before then.
+  * \warning This must be called with interrupts disabled.
+  */
+static void transmitIfFullPacket(void)
+{
+	uint32_t packet_data_size;
+
+	// Interrupt IN packets have a 1 byte report ID.
+	packet_data_size = sizeof(interrupt_packet_buffer) - 1;
+#ifdef USB_BULK_STREAM
+	if (bulk_stream_selected)
+	{
+		packet_data_size = sizeof(bulk_packet_buffer);
+	}
+#endif // #ifdef USB_BULK_STREAM
+	if ((TRANSMIT_FIFO_SIZE - circularBufferSpaceRemaining(&transmit_fifo)) >= packet_data_size)
+	{
+		transmitIfIdle();
+	}
+	else
+	{
+		usbEnableStartOfFrameInterrupt(true);
+	}
+}
+
+/** Send whatever is in the transmit FIFO as soon as possible. This should
+  * be called before waiting for something from the host, since the host
+  * might be waiting for the bytes in the transmit FIFO before it sends
+  * anything.
+  */
+static void flushTransmitFIFO(void)
+{
+	uint32_t status;
+
+	if (!isCircularBufferEmpty(&transmit_fifo))
+	{
+		status = disableInterrupts();
+		transmitIfIdle();
+		restoreInterrupts(status);
+	}
+}
+
 /** Transfer bytes from a receive buffer into receive FIFO.
   * \warning This assumes there is enough space (if not, usbFatalError() will
   *          be called). There should always be enough space, since a receive
@@ -199,16 +365,17 @@ static void fillTransmitPacketBufferAndTransmit(void)
   */
 static void transferIntoReceiveFIFO(uint8_t *buffer, uint32_t length)
 {
-	uint32_t i;
-
 	if (circularBufferSpaceRemaining(&receive_fifo) < length)
 	{
 		// This should never happen.
 		usbFatalError();
 	}
-	for (i = 0; i < length; i++)
+	TRACE(TRACE_USB_RECEIVE, length);
+	if (length > 0)
 	{
-		circularBufferWrite(&receive_fifo, buffer[i], true);
+		// There's enough space, so this won't block and will write all
+		// length bytes.
+		circularBufferWriteBytes(&receive_fifo, buffer, length);
 	}
 }
 
@@ -288,6 +455,54 @@ static void buildTransmitReport(uint8_t one_byte)
 	}
 }
 
+/** Move bytes from the transmit FIFO into the report being built for a
+  * "Get Report" request, until either the report is complete (and sent) or
+  * the transmit FIFO is empty.
+  * \warning This must only be called from an interrupt context (or with
+  *          interrupts disabled).
+  */
+static void fillTransmitReportFromFIFO(void)
+{
+	while (!isCircularBufferEmpty(&transmit_fifo) && do_build_transmit_report)
+	{
+		buildTransmitReport(circularBufferRead(&transmit_fifo, true));
+	}
+}
+
+/** Get the amount of receive FIFO space, in bytes, which has already been
+  * promised to receives queued on the Interrupt OUT and Bulk OUT endpoints.
+  * \return The number of bytes which those receives could write.
+  */
+static uint32_t queuedReceiveSpace(void)
+{
+	uint32_t space;
+
+	space = 0;
+	if (interrupt_receive_queued)
+	{
+		space += MAX_PACKET_SIZE - 1; // minus 1 for report ID
+	}
+#ifdef USB_BULK_STREAM
+	if (bulk_receive_queued)
+	{
+		space += MAX_PACKET_SIZE;
+	}
+#endif // #ifdef USB_BULK_STREAM
+	return space;
+}
+
+/** Check whether the Data stage of a "Set Report" request can go ahead
+  * without the receive FIFO possibly overflowing. Unlike the other receive
+  * endpoints, this doesn't need #RECEIVE_HEADROOM; the size of the report is
+  * already known, so only that much space (plus whatever the other queued
+  * receives might need) is required.
+  * \return true if there is enough space, false if not.
+  */
+static bool isSpaceForControlReport(void)
+{
+	return circularBufferSpaceRemaining(&receive_fifo) >= (queuedReceiveSpace() + expected_control_report_id);
+}
+
 /** Callback which is called whenever a packet is received on the Interrupt
   * IN endpoint (endpoint number #TRANSMIT_ENDPOINT_NUMBER).
   * \param packet_buffer The contents of the packet.
@@ -352,6 +567,7 @@ void ep2ReceiveCallback(uint8_t *packet_buffer, uint32_t length, bool is_setup)
 		else
 		{
 			interrupt_receive_queued = false;
+			TRACE(TRACE_USB_RECEIVE_STALL, RECEIVE_ENDPOINT_NUMBER);
 		}
 	}
 }
@@ -364,6 +580,69 @@ void ep2TransmitCallback(void)
 	usbFatalError();
 }
 
+#ifdef USB_BULK_STREAM
+/** Callback which is called whenever a packet is received on the Bulk
+  * IN endpoint (endpoint number #BULK_TRANSMIT_ENDPOINT_NUMBER).
+  * \param packet_buffer The contents of the packet.
+  * \param length The length (in bytes) of the received packet.
+  * \param is_setup Will be true if a SETUP token was received, will
+  *                 be false if a OUT or IN token was received.
+  */
+void ep3ReceiveCallback(uint8_t *packet_buffer, uint32_t length, bool is_setup)
+{
+	// Since this is an IN endpoint, this callback should never be called.
+	usbFatalError();
+}
+
+/** Callback which is called whenever a packet is transmitted on the Bulk
+  * IN endpoint (endpoint number #BULK_TRANSMIT_ENDPOINT_NUMBER). */
+void ep3TransmitCallback(void)
+{
+	fillBulkPacketBufferAndTransmit();
+}
+
+/** Callback which is called whenever a packet is received on the Bulk
+  * OUT endpoint (endpoint number #BULK_RECEIVE_ENDPOINT_NUMBER). Receiving
+  * anything here selects the Bulk transport for transmission.
+  * \param packet_buffer The contents of the packet.
+  * \param length The length (in bytes) of the received packet.
+  * \param is_setup Will be true if a SETUP token was received, will
+  *                 be false if a OUT or IN token was received.
+  * \warning This assumes that there is enough space in the receive FIFO for
+  *          the received packet. There should always be enough space, since
+  *          a receive is never queued unless there is enough space.
+  */
+void ep4ReceiveCallback(uint8_t *packet_buffer, uint32_t length, bool is_setup)
+{
+	if (is_setup)
+	{
+		// This should never happen.
+		usbFatalError();
+	}
+	transferIntoReceiveFIFO(packet_buffer, length);
+	bulk_stream_selected = true;
+	// See ep2ReceiveCallback() for what happens if there isn't enough space.
+	if (circularBufferSpaceRemaining(&receive_fifo) >= RECEIVE_HEADROOM)
+	{
+		bulk_receive_queued = true;
+		usbQueueReceivePacket(BULK_RECEIVE_ENDPOINT_NUMBER);
+	}
+	else
+	{
+		bulk_receive_queued = false;
+		TRACE(TRACE_USB_RECEIVE_STALL, BULK_RECEIVE_ENDPOINT_NUMBER);
+	}
+}
+
+/** Callback which is called whenever a packet is transmitted on the Bulk
+  * OUT endpoint (endpoint number #BULK_RECEIVE_ENDPOINT_NUMBER). */
+void ep4TransmitCallback(void)
+{
+	// Since this is the OUT endpoint, this callback should never be called.
+	usbFatalError();
+}
+#endif // #ifdef USB_BULK_STREAM
+
 /** HID class-specific "Get Descriptor" request, as defined in section 7.1.1
   * of the HID specification. This allows the host to retrieve HID
   * class-specific information about a USB device.
@@ -442,21 +721,16 @@ static void getReport(uint8_t report_id, uint16_t length)
 		//    report is sent and do_build_transmit_report is set to false.
 		// 2. The transmit FIFO is emptied before the report reaches the
 		//    desired size, so nothing is sent and do_build_transmit_report
-		//    remains set to true. streamPutOneByte() will handle the rest.
-		while (!isCircularBufferEmpty(&transmit_fifo) && do_build_transmit_report)
-		{
-			buildTransmitReport(circularBufferRead(&transmit_fifo, true));
-		}
+		//    remains set to true. usbClassStartOfFrame() will finish the
+		//    report as more bytes are written to the transmit FIFO.
+		fillTransmitReportFromFIFO();
 		// If the control request ate up the entire interrupt transmit
 		// report but left the transmit FIFO full, streamPutOneByte() will
 		// deadlock. This is because it waits for the transmit FIFO to become
 		// not full, yet there is no interrupt transmit queued to consume
 		// the transmit FIFO. Thus to avoid this deadlock, queue an interrupt
 		// transmit if there is anything in the transmit FIFO.
-		if (!interrupt_transmit_queued)
-		{
-			fillTransmitPacketBufferAndTransmit();
-		}
+		transmitIfIdle();
 	}
 }
 
@@ -487,13 +761,14 @@ static void setReport(uint8_t report_id, uint16_t length)
 		usbControlNextStage();
 		expected_control_report_id = report_id;
 		expect_control_report = true;
-		if (circularBufferSpaceRemaining(&receive_fifo) < RECEIVE_HEADROOM)
+		if (!isSpaceForControlReport())
 		{
 			// Not enough space in receive FIFO to handle request.
 			usbSuppressControlReceive(); // do not immediately proceed to Data stage
-			// Redirect streamGetOneByte() to queue receives on the control
+			// Redirect queueReceiveIfSpace() to queue receives on the control
 			// endpoint instead of the Interrupt OUT endpoint.
 			do_control_receive_queue = true;
+			TRACE(TRACE_USB_RECEIVE_STALL, CONTROL_ENDPOINT_NUMBER);
 		}
 	}
 }
@@ -611,6 +886,13 @@ void usbClassSetConfiguration(uint8_t new_configuration_value)
 		interrupt_receive_queued = true;
 		usbEnableEndpoint(TRANSMIT_ENDPOINT_NUMBER, IN_ENDPOINT, &transmit_endpoint_state);
 		usbEnableEndpoint(RECEIVE_ENDPOINT_NUMBER, OUT_ENDPOINT, &receive_endpoint_state);
+#ifdef USB_BULK_STREAM
+		bulk_transmit_queued = false;
+		bulk_receive_queued = true;
+		bulk_stream_selected = false;
+		usbEnableEndpoint(BULK_TRANSMIT_ENDPOINT_NUMBER, IN_ENDPOINT, &bulk_transmit_endpoint_state);
+		usbEnableEndpoint(BULK_RECEIVE_ENDPOINT_NUMBER, OUT_ENDPOINT, &bulk_receive_endpoint_state);
+#endif // #ifdef USB_BULK_STREAM
 	}
 	else if ((old_configuration_value != 0) && (new_configuration_value == 0))
 	{
@@ -619,6 +901,13 @@ void usbClassSetConfiguration(uint8_t new_configuration_value)
 		usbDisableEndpoint(RECEIVE_ENDPOINT_NUMBER);
 		interrupt_transmit_queued = false;
 		interrupt_receive_queued = false;
+#ifdef USB_BULK_STREAM
+		usbDisableEndpoint(BULK_TRANSMIT_ENDPOINT_NUMBER);
+		usbDisableEndpoint(BULK_RECEIVE_ENDPOINT_NUMBER);
+		bulk_transmit_queued = false;
+		bulk_receive_queued = false;
+		bulk_stream_selected = false;
+#endif // #ifdef USB_BULK_STREAM
 		usbClassAbortControlTransfer(); // will reset state
 	}
 	old_configuration_value = new_configuration_value;
@@ -631,6 +920,24 @@ void usbClassResetSeen(void)
 	usbClassSetConfiguration(0);
 }
 
+/** This will be called once every 1 ms frame while the start of frame
+  * interrupt is enabled. It moves bytes from the transmit FIFO into any
+  * unfinished "Get Report" report and sends any bytes which
+  * transmitIfFullPacket() held back, then disables the interrupt again so
+  * that it doesn't keep waking up the CPU. If a packet is already queued,
+  * the transmit callback will pick up the held back bytes, so there's nothing
+  * to do here. If the report is still unfinished, the next write to the
+  * transmit FIFO will enable the interrupt again. */
+void usbClassStartOfFrame(void)
+{
+	fillTransmitReportFromFIFO();
+	usbEnableStartOfFrameInterrupt(false);
+	if (!do_build_transmit_report)
+	{
+		transmitIfIdle();
+	}
+}
+
 /** Initialise HID stream driver. This must be called before connecting the
   * USB device (usbConnect()) or calling streamGetOneByte() and
   * streamPutOneByte(), otherwise race conditions with the FIFOs could
@@ -645,6 +952,57 @@ void usbHIDStreamInit(void)
 	transmit_endpoint_state.transmitCallback = &ep1TransmitCallback;
 	receive_endpoint_state.receiveCallback = &ep2ReceiveCallback;
 	receive_endpoint_state.transmitCallback = &ep2TransmitCallback;
+#ifdef USB_BULK_STREAM
+	bulk_transmit_endpoint_state.receiveCallback = &ep3ReceiveCallback;
+	bulk_transmit_endpoint_state.transmitCallback = &ep3TransmitCallback;
+	bulk_receive_endpoint_state.receiveCallback = &ep4ReceiveCallback;
+	bulk_receive_endpoint_state.transmitCallback = &ep4TransmitCallback;
+#endif // #ifdef USB_BULK_STREAM
+}
+
+/** Queue a receive on the appropriate endpoint, if there's enough space in
+  * the receive FIFO. This should be called whenever bytes are taken out of
+  * the receive FIFO. */
+static void queueReceiveIfSpace(void)
+{
+	uint32_t status;
+
+	// It's probably safe to leave interrupts enabled, but just to be sure,
+	// disable them so that no race conditions can occur.
+	status = disableInterrupts();
+	// Control transfers take precedence over interrupt transfers, because
+	// a control transfer will block all subsequent control transfers, which
+	// would make device reconfiguration difficult.
+	if (do_control_receive_queue)
+	{
+		if (isSpaceForControlReport())
+		{
+			do_control_receive_queue = false;
+			TRACE(TRACE_USB_RECEIVE_RESUME, CONTROL_ENDPOINT_NUMBER);
+			usbQueueReceivePacket(CONTROL_ENDPOINT_NUMBER);
+		}
+	}
+	else if (!interrupt_receive_queued)
+	{
+		if (circularBufferSpaceRemaining(&receive_fifo) >= RECEIVE_HEADROOM)
+		{
+			interrupt_receive_queued = true;
+			usbQueueReceivePacket(RECEIVE_ENDPOINT_NUMBER);
+			TRACE(TRACE_USB_RECEIVE_RESUME, RECEIVE_ENDPOINT_NUMBER);
+		}
+	}
+#ifdef USB_BULK_STREAM
+	if (!bulk_receive_queued && usbIsEndpointEnabled(BULK_RECEIVE_ENDPOINT_NUMBER))
+	{
+		if (circularBufferSpaceRemaining(&receive_fifo) >= RECEIVE_HEADROOM)
+		{
+			bulk_receive_queued = true;
+			usbQueueReceivePacket(BULK_RECEIVE_ENDPOINT_NUMBER);
+			TRACE(TRACE_USB_RECEIVE_RESUME, BULK_RECEIVE_ENDPOINT_NUMBER);
+		}
+	}
+#endif // #ifdef USB_BULK_STREAM
+	restoreInterrupts(status);
 }
 
 /** Grab one byte from the communication stream. There is no way for this
@@ -672,33 +1030,9 @@ void usbHIDStreamInit(void)
   */
 uint8_t streamGetOneByte(void)
 {
-	uint32_t status;
 	uint8_t one_byte;
 
-	one_byte = circularBufferRead(&receive_fifo, false);
-	// It's probably safe to leave interrupts enabled, but just to be sure,
-	// disable them so that no race conditions can occur.
-	status = disableInterrupts();
-	// Control transfers take precedence over interrupt transfers, because
-	// a control transfer will block all subsequent control transfers, which
-	// would make device reconfiguration difficult.
-	if (do_control_receive_queue)
-	{
-		if (circularBufferSpaceRemaining(&receive_fifo) >= RECEIVE_HEADROOM)
-		{
-			do_control_receive_queue = false;
-			usbQueueReceivePacket(CONTROL_ENDPOINT_NUMBER);
-		}
-	}
-	else if (!interrupt_receive_queued)
-	{
-		if (circularBufferSpaceRemaining(&receive_fifo) >= RECEIVE_HEADROOM)
-		{
-			interrupt_receive_queued = true;
-			usbQueueReceivePacket(RECEIVE_ENDPOINT_NUMBER);
-		}
-	}
-	restoreInterrupts(status);
+	streamGetBytes(&one_byte, 1);
 	return one_byte;
 }
 
@@ -714,39 +1048,103 @@ uint8_t streamGetOneByte(void)
   */
 void streamPutOneByte(uint8_t one_byte)
 {
-	uint32_t status;
+	streamPutBytes(&one_byte, 1);
+}
 
-	// Ensure that there is space in the transmit FIFO so that the call to
-	// circularBufferWrite() below cannot fail.
-	while (isCircularBufferFull(&transmit_fifo))
-	{
-		enterIdleMode();
-	}
-	// Everything below is in a critical section to avoid race conditions
-	// with the "Get Report" request.
-	status = disableInterrupts();
-	if (do_build_transmit_report)
+/** Grab a number of bytes from the communication stream. Bytes are moved
+  * out of the receive FIFO in chunks, with a receive being queued (if
+  * there's enough space) after each chunk.
+  * See streamGetOneByte() for why this can't indicate read errors.
+  * \param buffer The received bytes will be written here. This must have
+  *               space for length bytes.
+  * \param length The number of bytes to receive.
+  */
+void streamGetBytes(uint8_t *buffer, uint32_t length)
+{
+	uint32_t count;
+
+	while (length > 0)
 	{
-		// Keep adding bytes to the transmit report until it reaches the
-		// desired length.
-		buildTransmitReport(one_byte);
+		if (isCircularBufferEmpty(&receive_fifo))
+		{
+			flushTransmitFIFO();
+			// The wait could be long, so this is a good time to let
+			// background tasks get ahead.
+			BACKGROUND_YIELD();
+		}
+		count = circularBufferReadBytes(&receive_fifo, buffer, length);
+		buffer += count;
+		length -= count;
+		queueReceiveIfSpace();
 	}
-	else
+}
+
+/** Borrow bytes straight out of the receive FIFO, without copying them.
+  * See streamBorrowBytes() in hwinterface.h for more details.
+  * \param length The number of contiguous bytes available at the returned
+  *               address will be written here. This will be at least 1.
+  * \return A pointer to the borrowed bytes.
+  */
+const uint8_t *streamBorrowBytes(uint32_t *length)
+{
+	if (isCircularBufferEmpty(&receive_fifo))
 	{
-		// Since transmitted bytes are fed to this function one-at-a-time,
-		// there's no way to determine whether there are bytes after this one
-		// or not. So this function will just transmit the first byte in a
-		// packet all by itself (which isn't very efficient). If there are
-		// bytes immediately after this one, they will queue up in the transmit
-		// FIFO, where they will be efficiently grouped into a packet by
-		// ep1TransmitCallback().
-		// Note that is_irq is set because interrupts are disabled; that's
-		// equivalent to an interrupt request handler context.
-		circularBufferWrite(&transmit_fifo, one_byte, true);
+		flushTransmitFIFO();
 	}
-	if (!interrupt_transmit_queued)
+	return circularBufferBorrow(&receive_fifo, length);
+}
+
+/** Remove bytes previously borrowed by streamBorrowBytes() from the receive
+  * FIFO.
+  * \param length The number of bytes to remove.
+  */
+void streamReleaseBytes(uint32_t length)
+{
+	circularBufferRelease(&receive_fifo, length);
+	queueReceiveIfSpace();
+}
+
+/** Send a number of bytes to the communication stream. Bytes are moved into
+  * the transmit FIFO in chunks, so that they can be efficiently grouped into
+  * packets by ep1TransmitCallback(). Bytes which don't fill a packet are
+  * held back for a while; see transmitIfFullPacket().
+  * See streamGetOneByte() for why this can't indicate write errors.
+  * \param buffer The bytes to send.
+  * \param length The number of bytes to send.
+  */
+void streamPutBytes(const uint8_t *buffer, uint32_t length)
+{
+	uint32_t status;
+
+	while (length > 0)
 	{
-		fillTransmitPacketBufferAndTransmit();
+		// Ensure that there is space in the transmit FIFO so that the call to
+		// circularBufferWrite() below cannot fail.
+		if (isCircularBufferFull(&transmit_fifo))
+		{
+			TRACE(TRACE_USB_TRANSMIT_WAIT, length);
+		}
+		while (isCircularBufferFull(&transmit_fifo))
+		{
+			enterIdleMode();
+		}
+		// Everything below is in a critical section to avoid race conditions
+		// with the transmit callbacks.
+		status = disableInterrupts();
+		while ((length > 0) && !isCircularBufferFull(&transmit_fifo))
+		{
+			// Note that is_irq is set because interrupts are disabled;
+			// that's equivalent to an interrupt request handler context.
+			circularBufferWrite(&transmit_fifo, *buffer, true);
+			buffer++;
+			length--;
+		}
+		// Bytes queue up in the transmit FIFO until there's a packet's
+		// worth; while a packet is being transmitted, they will be grouped
+		// into packets by ep1TransmitCallback(). If there's an unfinished
+		// "Get Report" report, transmitIfIdle() leaves the bytes for
+		// usbClassStartOfFrame() to put into that report.
+		transmitIfFullPacket();
+		restoreInterrupts(status);
 	}
-	restoreInterrupts(status);
 }
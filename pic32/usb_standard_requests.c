@@ -21,8 +21,10 @@
   * - Clear Feature, Set Feature and Get Status are required to implement
   *   the "endpoint halt" feature, which is required for interrupt
   *   endpoints (see section 9.4.5 of the USB specification).
-  * - Only a single configuration (with configuration value = 1) and a single
-  *   interface is supported.
+  * - Only a single configuration (with configuration value = 1) is
+  *   supported. There is a single interface, or two if USB_BULK_STREAM is
+  *   defined (see usb_hid_stream.c). Neither interface has alternate
+  *   settings, so "Get Interface" and "Set Interface" aren't implemented.
   *
   * All references to the "USB specification" refer to revision 2.0, obtained
   * from http://www.usb.org/developers/docs/usb_20_110512.zip (see usb_20.pdf)
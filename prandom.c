@@ -8,6 +8,13 @@
   * The suggestion to use a persistent entropy pool, and much of the code
   * associated with the entropy pool, are attributed to Peter Todd (retep).
   *
+  * If PRANDOM_RAM_DRBG is defined, getRandom256() doesn't go to the HWRNG and
+  * the persistent entropy pool on every call. Instead, it generates output
+  * using a RAM-resident HMAC_DRBG (see hmac_drbg.c), which is reseeded from
+  * the HWRNG and the persistent entropy pool every #DRBG_RESEED_INTERVAL
+  * calls. The persistent entropy pool is only written at each reseed, which
+  * removes non-volatile memory writes (and their wear) from most calls.
+  *
   * This file is licensed as described by the file LICENCE.
   */
 
@@ -26,6 +33,7 @@
 #include "sha256.h"
 #include "ripemd160.h"
 #include "hmac_sha512.h"
+#include "hmac_drbg.h"
 #include "endian.h"
 #include "ecdsa.h"
 #include "bignum256.h"
@@ -33,6 +41,7 @@
 #include "prandom.h"
 #include "hwinterface.h"
 #include "storage_common.h"
+#include "background.h"
 
 #ifdef TEST_PRANDOM
 #include "test_helpers.h"
@@ -61,6 +70,23 @@ static PointAffine cached_parent_public_key;
 /** Specifies whether the contents of #parent_public_key are valid. */
 static bool cached_parent_public_key_valid;
 
+#ifdef PRANDOM_RAM_DRBG
+/** Number of getRandom256() calls which the RAM-resident DRBG can service
+  * before it must be reseeded from the HWRNG and persistent entropy pool.
+  * Smaller values mean fresher entropy, but more non-volatile memory writes.
+  * \warning This must be less than 256.
+  */
+#define DRBG_RESEED_INTERVAL	16
+/** State of the RAM-resident DRBG used by getRandom256(). This is only
+  * valid if #ram_drbg_valid is true. */
+static HMACDRBGState ram_drbg_state;
+/** Whether #ram_drbg_state has been instantiated. */
+static bool ram_drbg_valid;
+/** Number of outputs generated using #ram_drbg_state since it was last
+  * (re)seeded. */
+static uint8_t ram_drbg_outputs_since_reseed;
+#endif // #ifdef PRANDOM_RAM_DRBG
+
 #ifdef TEST_PRANDOM
 /** Hack to allow test to access derived chain code. This is needed for the
   * sipa test cases. */
@@ -77,8 +103,7 @@ static uint8_t test_chain_code[32];
   */
 static void setParentPublicKeyFromPrivateKey(BigNum256 parent_private_key)
 {
-	setToG(&cached_parent_public_key);
-	pointMultiply(&cached_parent_public_key, parent_private_key);
+	ecdsaMultiplyG(&cached_parent_public_key, parent_private_key);
 	cached_parent_public_key_valid = true;
 }
 
@@ -93,6 +118,85 @@ void clearParentPublicKeyCache(void)
 	cached_parent_public_key_valid = false;
 }
 
+#ifdef WALLET_CONTEXTS
+/** Copy the parent public key cache (see #cached_parent_public_key), so that
+  * it can be put back later using restoreParentPublicKeyCache(). This is for
+  * wallet.c, which keeps one cache per wallet context, so that switching
+  * between loaded wallets doesn't cost a point multiplication.
+  * \param out The cached parent public key will be written here. Its
+  *            contents are undefined if the cache is not valid.
+  * \return true if the cache was valid, false if it was not.
+  */
+bool saveParentPublicKeyCache(PointAffine *out)
+{
+	*out = cached_parent_public_key;
+	return cached_parent_public_key_valid;
+}
+
+/** Put back a parent public key cache which was saved using
+  * saveParentPublicKeyCache().
+  * \param in The cached parent public key to put back.
+  * \param valid The return value of saveParentPublicKeyCache(). If this is
+  *              false, the cache will be cleared instead.
+  */
+void restoreParentPublicKeyCache(const PointAffine *in, bool valid)
+{
+	if (valid)
+	{
+		cached_parent_public_key = *in;
+		cached_parent_public_key_valid = true;
+	}
+	else
+	{
+		clearParentPublicKeyCache();
+	}
+}
+#endif // #ifdef WALLET_CONTEXTS
+
+/** Get the parent public key for the deterministic key generator (see
+  * generateDeterministic256()). This is the public key which, together with
+  * the chain code, allows every generated public key to be derived without
+  * knowing any private keys. The result is cached, so after the first call
+  * (or the first call to generateDeterministic256()), no point
+  * multiplication is needed until clearParentPublicKeyCache() is called.
+  * \param out The parent public key will be written here upon success.
+  * \param seed See generateDeterministic256().
+  * \return false upon success, true if the specified seed is not valid.
+  */
+bool getParentPublicKey(PointAffine *out, const uint8_t *seed)
+{
+	BigNum256Storage k_par;
+
+	if (!cached_parent_public_key_valid)
+	{
+		memcpy(k_par, seed, 32);
+		swapEndian256(k_par); // since seed is big-endian
+		bigModuloInField(k_par, k_par, &secp256k1_n_field); // just in case
+		if (bigIsZero(k_par))
+		{
+			return true; // invalid seed
+		}
+		setParentPublicKeyFromPrivateKey(k_par);
+		memset(k_par, 0, sizeof(k_par));
+	}
+	memcpy(out, &cached_parent_public_key, sizeof(PointAffine));
+	return false; // success
+}
+
+#ifdef PRANDOM_RAM_DRBG
+/** Throw away the state of the RAM-resident DRBG, so that the next call to
+  * getRandom256() will re-instantiate it using the HWRNG and the persistent
+  * entropy pool. This should be called whenever the persistent entropy pool
+  * is re-initialised, so that the new pool state is picked up straight
+  * away. */
+static void invalidateRamDrbg(void)
+{
+	memset(&ram_drbg_state, 0, sizeof(ram_drbg_state));
+	ram_drbg_valid = false;
+	ram_drbg_outputs_since_reseed = 0;
+}
+#endif // #ifdef PRANDOM_RAM_DRBG
+
 /** Calculate the entropy pool checksum of an entropy pool state.
   * Without integrity checks, an attacker with access to the persistent
   * entropy pool area (in non-volatile memory) could reduce the amount of
@@ -199,6 +303,9 @@ bool initialiseEntropyPool(uint8_t *initial_pool_state)
 	uint8_t current_pool_state[ENTROPY_POOL_LENGTH];
 	uint8_t i;
 
+#ifdef PRANDOM_RAM_DRBG
+	invalidateRamDrbg();
+#endif // #ifdef PRANDOM_RAM_DRBG
 	if (getEntropyPool(current_pool_state))
 	{
 		// Current entropy pool is not valid; overwrite it.
@@ -224,6 +331,43 @@ bool initialiseEntropyPool(uint8_t *initial_pool_state)
   * overestimate its entropy by this factor without loss of security. */
 #define ENTROPY_SAFETY_FACTOR	2
 
+/** Hash bytes from the hardware random number generator (HWRNG) until the
+  * total entropy (as reported by the HWRNG) is at least
+  * 256 * #ENTROPY_SAFETY_FACTOR bits.
+  * \param hs The hash state to write HWRNG bytes into. This must have been
+  *           initialised using sha256Begin().
+  * \return false on success, true if the HWRNG failed.
+  */
+static bool accumulateHardwareEntropy(HashState *hs)
+{
+	int r;
+	uint16_t total_entropy;
+	uint8_t random_bytes[32];
+	uint8_t i;
+
+	total_entropy = 0;
+	while (total_entropy < (256 * ENTROPY_SAFETY_FACTOR))
+	{
+		r = hardwareRandom32Bytes(random_bytes);
+		if (r < 0)
+		{
+			return true; // HWRNG failure
+		}
+		// Sometimes hardwareRandom32Bytes() returns 0, which signifies that
+		// more samples are needed in order to do statistical testing.
+		// hardwareRandom32Bytes() assumes it will be repeatedly called until
+		// it returns a non-zero value. If anything in this while loop is
+		// changed, make sure the code still respects this assumption.
+		total_entropy = (uint16_t)(total_entropy + r);
+		for (i = 0; i < 32; i++)
+		{
+			sha256WriteByte(hs, random_bytes[i]);
+		}
+		BACKGROUND_YIELD();
+	}
+	return false; // success
+}
+
 /** Uses a hash function to accumulate entropy from a hardware random number
   * generator (HWRNG), along with the state of a persistent pool. The
   * operations used are: intermediate = H(HWRNG | pool),
@@ -264,8 +408,6 @@ bool initialiseEntropyPool(uint8_t *initial_pool_state)
   */
 static bool getRandom256Internal(BigNum256 n, uint8_t *pool_state, bool use_pool_state)
 {
-	int r;
-	uint16_t total_entropy;
 	uint8_t random_bytes[MAX(32, ENTROPY_POOL_LENGTH)];
 	uint8_t intermediate[32];
 	HashState hs;
@@ -274,25 +416,10 @@ static bool getRandom256Internal(BigNum256 n, uint8_t *pool_state, bool use_pool
 	// Hash in HWRNG randomness until we've reached the entropy required.
 	// This needs to happen before hashing the pool itself due to the
 	// possibility of length extension attacks; see below.
-	total_entropy = 0;
 	sha256Begin(&hs);
-	while (total_entropy < (256 * ENTROPY_SAFETY_FACTOR))
+	if (accumulateHardwareEntropy(&hs))
 	{
-		r = hardwareRandom32Bytes(random_bytes);
-		if (r < 0)
-		{
-			return true; // HWRNG failure
-		}
-		// Sometimes hardwareRandom32Bytes() returns 0, which signifies that
-		// more samples are needed in order to do statistical testing.
-		// hardwareRandom32Bytes() assumes it will be repeatedly called until
-		// it returns a non-zero value. If anything in this while loop is
-		// changed, make sure the code still respects this assumption.
-		total_entropy = (uint16_t)(total_entropy + r);
-		for (i = 0; i < 32; i++)
-		{
-			sha256WriteByte(&hs, random_bytes[i]);
-		}
+		return true; // HWRNG failure
 	}
 
 	// Now include the previous state of the pool.
@@ -362,14 +489,93 @@ static bool getRandom256Internal(BigNum256 n, uint8_t *pool_state, bool use_pool
 	return false; // success
 }
 
+#ifdef PRANDOM_RAM_DRBG
+/** (Re)seed the RAM-resident DRBG using entropy from the HWRNG and the
+  * persistent entropy pool, then replace the persistent entropy pool with
+  * output from the freshly seeded DRBG. The new pool state is written before
+  * any output is generated from the new DRBG state, so that (like with
+  * getRandom256Internal()) a reset can never cause a pool state to be
+  * reused. Since HMAC_DRBG has backtracking resistance, knowledge of the new
+  * pool state doesn't reveal anything about later outputs.
+  * \return false on success, true if an error (HWRNG failure, couldn't
+  *         access non-volatile memory, or invalid entropy pool checksum)
+  *         occurred.
+  */
+static bool reseedRamDrbg(void)
+{
+	HashState hs;
+	uint8_t pool_state[ENTROPY_POOL_LENGTH];
+	uint8_t seed_material[32];
+	uint8_t i;
+
+	// Like in getRandom256Internal(), HWRNG bytes are hashed before the
+	// pool state.
+	sha256Begin(&hs);
+	if (accumulateHardwareEntropy(&hs))
+	{
+		return true; // HWRNG failure
+	}
+	if (getEntropyPool(pool_state))
+	{
+		return true; // error reading from non-volatile memory, or invalid checksum
+	}
+	for (i = 0; i < ENTROPY_POOL_LENGTH; i++)
+	{
+		sha256WriteByte(&hs, pool_state[i]);
+	}
+	sha256Finish(&hs);
+	writeHashToByteArray(seed_material, &hs, true);
+
+	if (ram_drbg_valid)
+	{
+		// Reseeding (instead of instantiating) retains any entropy the DRBG
+		// already has, in case the HWRNG has failed in an undetected way.
+		drbgReseed(&ram_drbg_state, seed_material, sizeof(seed_material));
+	}
+	else
+	{
+		drbgInstantiate(&ram_drbg_state, seed_material, sizeof(seed_material));
+		ram_drbg_valid = true;
+	}
+	drbgGenerate(pool_state, &ram_drbg_state, ENTROPY_POOL_LENGTH, NULL, 0);
+	if (setEntropyPool(pool_state))
+	{
+		return true; // error writing to non-volatile memory
+	}
+	ram_drbg_outputs_since_reseed = 0;
+	return false; // success
+}
+#endif // #ifdef PRANDOM_RAM_DRBG
+
 /** Version of getRandom256Internal() which uses non-volatile memory to store
   * the persistent entropy pool. See getRandom256Internal() for more details.
+  *
+  * If PRANDOM_RAM_DRBG is defined, this instead generates output from a
+  * RAM-resident DRBG, which is reseeded (see reseedRamDrbg()) when
+  * necessary. In that case, most calls don't access the HWRNG or
+  * non-volatile memory at all.
   * \param n See getRandom256Internal()
   * \return See getRandom256Internal()
   */
 bool getRandom256(BigNum256 n)
 {
+#ifdef PRANDOM_RAM_DRBG
+#if DRBG_RESEED_INTERVAL >= 256
+#error "DRBG_RESEED_INTERVAL too big for ram_drbg_outputs_since_reseed"
+#endif // #if DRBG_RESEED_INTERVAL >= 256
+	if (!ram_drbg_valid || (ram_drbg_outputs_since_reseed >= DRBG_RESEED_INTERVAL))
+	{
+		if (reseedRamDrbg())
+		{
+			return true; // HWRNG or non-volatile memory failure
+		}
+	}
+	drbgGenerate(n, &ram_drbg_state, 32, NULL, 0);
+	ram_drbg_outputs_since_reseed++;
+	return false; // success
+#else
 	return getRandom256Internal(n, NULL, false);
+#endif // #ifdef PRANDOM_RAM_DRBG
 }
 
 /** Version of getRandom256Internal() which uses RAM to store
@@ -450,14 +656,13 @@ void generateInsecureOTP(char *otp)
 bool generateDeterministic256(BigNum256 out, const uint8_t *seed, const uint32_t num)
 {
 	BigNum256 i_l;
-	uint8_t k_par[32];
-	uint8_t hash[SHA512_HASH_LENGTH];
+	BigNum256Storage k_par;
+	uint8_t hash[SHA512_HASH_LENGTH] WORD_ALIGNED;
 	uint8_t hmac_message[69]; // 04 (1 byte) + x (32 bytes) + y (32 bytes) + num (4 bytes)
 
-	setFieldToN();
 	memcpy(k_par, seed, 32);
 	swapEndian256(k_par); // since seed is big-endian
-	bigModulo(k_par, k_par); // just in case
+	bigModuloInField(k_par, k_par, &secp256k1_n_field); // just in case
 	// k_par cannot be 0. If it is zero, then the output of this generator
 	// will always be 0.
 	if (bigIsZero(k_par))
@@ -483,11 +688,10 @@ bool generateDeterministic256(BigNum256 out, const uint8_t *seed, const uint32_t
 	writeU32BigEndian(&(hmac_message[65]), num);
 	hmacSha512(hash, &(seed[32]), 32, hmac_message, sizeof(hmac_message));
 
-	setFieldToN();
 	i_l = (BigNum256)hash;
 	swapEndian256(i_l); // since hash is big-endian
-	bigModulo(i_l, i_l); // just in case
-	bigMultiply(out, i_l, k_par);
+	bigModuloInField(i_l, i_l, &secp256k1_n_field); // just in case
+	bigMultiplyModN(out, i_l, k_par);
 
 #ifdef TEST_PRANDOM
 	memcpy(test_chain_code, &(hash[32]), sizeof(test_chain_code));
@@ -517,6 +721,11 @@ void corruptEntropyPool(void)
 	nonVolatileRead(&one_byte, PARTITION_GLOBAL, ADDRESS_POOL_CHECKSUM, 1);
 	one_byte = (uint8_t)(one_byte ^ 0xde);
 	nonVolatileWrite(&one_byte, PARTITION_GLOBAL, ADDRESS_POOL_CHECKSUM, 1);
+#ifdef PRANDOM_RAM_DRBG
+	// Otherwise getRandom256() could keep working, using the RAM-resident
+	// DRBG, until the next reseed.
+	invalidateRamDrbg();
+#endif // #ifdef PRANDOM_RAM_DRBG
 }
 
 /** Set this to true to simulate the HWRNG breaking. */
@@ -560,7 +769,7 @@ int hardwareRandom32Bytes(uint8_t *buffer)
   */
 void generateDeterministicPublicKey(PointAffine *out_public_key, PointAffine *in_parent_public_key, const uint8_t *chain_code, const uint32_t num)
 {
-	uint8_t hash[SHA512_HASH_LENGTH];
+	uint8_t hash[SHA512_HASH_LENGTH] WORD_ALIGNED;
 	uint8_t hmac_message[69]; // 04 (1 byte) + x (32 bytes) + y (32 bytes) + num (4 bytes)
 	BigNum256 i_l;
 
@@ -571,12 +780,11 @@ void generateDeterministicPublicKey(PointAffine *out_public_key, PointAffine *in
 	swapEndian256(&(hmac_message[33]));
 	writeU32BigEndian(&(hmac_message[65]), num);
 	hmacSha512(hash, chain_code, 32, hmac_message, sizeof(hmac_message));
-	setFieldToN();
 	i_l = (BigNum256)hash;
 	swapEndian256(i_l); // since hash is big-endian
-	bigModulo(i_l, i_l); // just in case
+	bigModuloInField(i_l, i_l, &secp256k1_n_field); // just in case
 	memcpy(out_public_key, in_parent_public_key, sizeof(PointAffine));
-	pointMultiply(out_public_key, i_l);
+	pointMultiplyGLV(out_public_key, i_l);
 }
 
 #endif // #if defined(TEST_PRANDOM) || defined(TEST_WALLET)
@@ -653,7 +861,7 @@ const uint8_t sipa_test_public_keys[SIPA_TEST_ADDRESSES][65] = {
   */
 static void type2DeterministicTest(uint8_t *seed, uint32_t num)
 {
-	uint8_t private_key[32];
+	BigNum256Storage private_key;
 	PointAffine compare_public_key;
 	PointAffine other_parent_public_key;
 	PointAffine public_key;
@@ -668,9 +876,25 @@ static void type2DeterministicTest(uint8_t *seed, uint32_t num)
 	swapEndian256(private_key);
 	setToG(&other_parent_public_key);
 	pointMultiply(&other_parent_public_key, private_key);
+	// The cached parent public key (which generateDeterministic256() just
+	// calculated) should be the same as x * G.
+	assert(!getParentPublicKey(&public_key, seed));
+	if ((bigCompare(other_parent_public_key.x, public_key.x) != BIGCMP_EQUAL)
+		|| (bigCompare(other_parent_public_key.y, public_key.y) != BIGCMP_EQUAL)
+		|| (other_parent_public_key.is_point_at_infinity != public_key.is_point_at_infinity))
+	{
+		printf("getParentPublicKey() mismatch, num = %u\n", num);
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
 	generateDeterministicPublicKey(&public_key, &other_parent_public_key, &(seed[32]), num);
 	// Compare them.
-	if (memcmp(&compare_public_key, &public_key, sizeof(PointAffine)))
+	if ((bigCompare(compare_public_key.x, public_key.x) != BIGCMP_EQUAL)
+		|| (bigCompare(compare_public_key.y, public_key.y) != BIGCMP_EQUAL)
+		|| (compare_public_key.is_point_at_infinity != public_key.is_point_at_infinity))
 	{
 		printf("Determinstic key generator is not type-2, num = %u\n", num);
 		printf("Parent private key: ");
@@ -692,7 +916,7 @@ static void type2DeterministicTest(uint8_t *seed, uint32_t num)
   */
 int main(int argc, char **argv)
 {
-	uint8_t r[32];
+	BigNum256Storage r;
 	int i, j;
 	int num_samples;
 	bool abort;
@@ -700,14 +924,16 @@ int main(int argc, char **argv)
 	unsigned int bytes_written;
 	FILE *f;
 	uint8_t seed[SEED_LENGTH];
-	uint8_t keys[SEED_LENGTH][32];
-	uint8_t key2[32];
+	BigNum256Storage keys[SEED_LENGTH];
+	BigNum256Storage key2;
 	uint8_t pool_state[ENTROPY_POOL_LENGTH];
 	uint8_t compare_pool_state[ENTROPY_POOL_LENGTH];
 	uint8_t one_byte;
 	uint8_t one_byte_corrupted;
 	uint8_t generated_using_nv[1024];
+#ifndef PRANDOM_RAM_DRBG
 	uint8_t generated_using_ram[1024];
+#endif // #ifndef PRANDOM_RAM_DRBG
 	uint8_t public_key_binary[65];
 	PointAffine public_key;
 	char otp[OTP_LENGTH];
@@ -922,6 +1148,57 @@ int main(int argc, char **argv)
 		reportSuccess();
 	}
 
+#ifdef PRANDOM_RAM_DRBG
+	// With the RAM-resident DRBG, the persistent entropy pool should only
+	// change when the DRBG is reseeded, and outputs should still all be
+	// different, even with a broken HWRNG.
+	broken_hwrng = true;
+	memset(pool_state, 42, ENTROPY_POOL_LENGTH);
+	initialiseEntropyPool(pool_state);
+	abort = false;
+	for (i = 0; i < sizeof(generated_using_nv); i += 32)
+	{
+		getEntropyPool(pool_state);
+		if (getRandom256(&(generated_using_nv[i])))
+		{
+			printf("Unexpected failure of getRandom256()\n");
+			exit(1);
+		}
+		getEntropyPool(compare_pool_state);
+		if (((i / 32) % DRBG_RESEED_INTERVAL) == 0)
+		{
+			if (!memcmp(pool_state, compare_pool_state, ENTROPY_POOL_LENGTH))
+			{
+				printf("Entropy pool not updated on reseed at i = %d\n", i);
+				abort = true;
+			}
+		}
+		else
+		{
+			if (memcmp(pool_state, compare_pool_state, ENTROPY_POOL_LENGTH))
+			{
+				printf("Entropy pool updated between reseeds at i = %d\n", i);
+				abort = true;
+			}
+		}
+		for (j = 0; j < i; j += 32)
+		{
+			if (!memcmp(&(generated_using_nv[i]), &(generated_using_nv[j]), 32))
+			{
+				printf("getRandom256() repeated an output at i = %d\n", i);
+				abort = true;
+			}
+		}
+	}
+	if (abort)
+	{
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+#else
 	// With a known initial pool state and with a broken HWRNG, the random
 	// number generator should produce the same output whether the pool is
 	// stored in non-volatile memory or RAM.
@@ -954,6 +1231,7 @@ int main(int argc, char **argv)
 	{
 		reportSuccess();
 	}
+#endif // #ifdef PRANDOM_RAM_DRBG
 
 	// initialiseEntropyPool() should directly set the entropy pool state if
 	// the current state is invalid.
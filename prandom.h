@@ -11,10 +11,7 @@
 #include "common.h"
 #include "bignum256.h"
 #include "storage_common.h"
-
-#ifdef TEST
 #include "ecdsa.h"
-#endif // #ifdef TEST
 
 /** Length, in bytes, of the seed that generateDeterministic256() requires.
   * \warning This must be a multiple of 16 in order for backupWallet() to work
@@ -46,6 +43,11 @@
 #endif
 
 extern void clearParentPublicKeyCache(void);
+extern bool getParentPublicKey(PointAffine *out, const uint8_t *seed);
+#ifdef WALLET_CONTEXTS
+extern bool saveParentPublicKeyCache(PointAffine *out);
+extern void restoreParentPublicKeyCache(const PointAffine *in, bool valid);
+#endif // #ifdef WALLET_CONTEXTS
 extern bool setEntropyPool(uint8_t *in_pool_state);
 extern bool getEntropyPool(uint8_t *out_pool_state);
 extern bool initialiseEntropyPool(uint8_t *initial_pool_state);
@@ -0,0 +1,64 @@
+/** \file profile.h
+  *
+  * \brief Describes the macros used to attribute time spent inside
+  *        processPacket() to categories.
+  *
+  * Profiling is only compiled in if STREAM_COMM_PROFILE is defined. If it
+  * isn't, all of the macros in this file expand to nothing. When profiling
+  * is enabled, the time spent processing each request is divided up between
+  * the categories in #ProfileCategoryEnum, and the totals can be obtained
+  * by the host using a GetPerformanceCounters message (see stream_comm.c).
+  *
+  * Categories are exclusive: time is only ever attributed to one category,
+  * which is the category of the innermost PROFILE_ENTER() that hasn't been
+  * matched by a PROFILE_EXIT(). For example, the non-volatile memory reads
+  * done by encryptedNonVolatileRead() count as non-volatile memory I/O, but
+  * the decryption in between counts as cryptography.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifndef PROFILE_H_INCLUDED
+#define PROFILE_H_INCLUDED
+
+#ifdef STREAM_COMM_PROFILE
+
+/** Categories which time spent inside processPacket() can be attributed
+  * to. */
+typedef enum ProfileCategoryEnum
+{
+	/** Anything not covered by the other categories, including time spent
+	  * waiting for the user. */
+	PROFILE_OTHER				= 0,
+	/** Transaction parsing and hashing. */
+	PROFILE_PARSE				= 1,
+	/** Elliptic curve operations, key derivation and encryption. */
+	PROFILE_CRYPTO				= 2,
+	/** Non-volatile memory reads and writes. */
+	PROFILE_NV_IO				= 3,
+	/** Stream (communication with host) reads and writes. */
+	PROFILE_STREAM_IO			= 4,
+	/** Number of categories. This must be last. */
+	PROFILE_CATEGORY_COUNT		= 5
+} ProfileCategory;
+
+extern void profileEnter(ProfileCategory category);
+extern void profileExit(void);
+
+/** Start attributing time to a category. Every PROFILE_ENTER() must be
+  * matched by a PROFILE_EXIT(), so don't return in between.
+  * \param category One of #ProfileCategoryEnum.
+  */
+#define PROFILE_ENTER(category)	profileEnter(category)
+/** Go back to attributing time to whatever category was active before the
+  * matching PROFILE_ENTER(). */
+#define PROFILE_EXIT()			profileExit()
+
+#else
+
+#define PROFILE_ENTER(category)
+#define PROFILE_EXIT()
+
+#endif // #ifdef STREAM_COMM_PROFILE
+
+#endif // #ifndef PROFILE_H_INCLUDED
@@ -22,6 +22,244 @@
 #include "common.h"
 #include "hash.h"
 #include "ripemd160.h"
+#include "sha256.h"
+#include "endian.h"
+
+#ifdef RIPEMD160_UNROLLED
+
+/** Cyclic shift left (rotate left).
+  * \param x The integer to rotate left.
+  * \param n Number of times to rotate left. This must be between 1 and 31
+  *          (inclusive).
+  */
+#define RIPEMD160_ROL(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+/** First non-linear (at bit level) function. */
+#define RIPEMD160_F0(x, y, z)	((x) ^ (y) ^ (z))
+/** Second non-linear (at bit level) function, rearranged to use one less
+  * operation. */
+#define RIPEMD160_F1(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+/** Third non-linear (at bit level) function. */
+#define RIPEMD160_F2(x, y, z)	(((x) | ~(y)) ^ (z))
+/** Fourth non-linear (at bit level) function, rearranged to use one less
+  * operation. */
+#define RIPEMD160_F3(x, y, z)	((y) ^ ((z) & ((x) ^ (y))))
+/** Fifth non-linear (at bit level) function. */
+#define RIPEMD160_F4(x, y, z)	((x) ^ ((y) | ~(z)))
+
+/** One step of RIPEMD-160 (see Appendix A of the paper), using message
+  * word x, rotate amount s, added constant k and non-linear function f.
+  * Instead of shifting the chaining variables along after every step, the
+  * caller rotates the order of the arguments, so only a and c are actually
+  * written to. */
+#define RIPEMD160_ROUND(a, b, c, d, e, f, x, s, k)					\
+	(a) = RIPEMD160_ROL((a) + f(b, c, d) + hs->m[x] + (k), s) + (e);	\
+	(c) = RIPEMD160_ROL(c, 10)
+
+/** Update hash value based on the contents of a full message buffer.
+  * This is an implementation of HashState#hashBlock().
+  * This is the same as the rolled version, but with all 160 steps unrolled
+  * and the message word selections, rotate amounts and constants embedded
+  * in the code, which is much faster on 32 bit targets. It is also much
+  * bigger, so it's not suitable for the AVR.
+  * \param hs The hash state to update.
+  */
+static void ripemd160Block(HashState *hs)
+{
+	// 1 = unprimed (main rounds), 2 = primed (parallel rounds).
+	uint32_t a1, b1, c1, d1, e1;
+	uint32_t a2, b2, c2, d2, e2;
+	uint32_t t;
+
+	a1 = hs->h[0];
+	a2 = a1;
+	b1 = hs->h[1];
+	b2 = b1;
+	c1 = hs->h[2];
+	c2 = c1;
+	d1 = hs->h[3];
+	d2 = d1;
+	e1 = hs->h[4];
+	e2 = e1;
+
+	RIPEMD160_ROUND(a1, b1, c1, d1, e1, RIPEMD160_F0, 0, 11, 0x00000000);
+	RIPEMD160_ROUND(e1, a1, b1, c1, d1, RIPEMD160_F0, 1, 14, 0x00000000);
+	RIPEMD160_ROUND(d1, e1, a1, b1, c1, RIPEMD160_F0, 2, 15, 0x00000000);
+	RIPEMD160_ROUND(c1, d1, e1, a1, b1, RIPEMD160_F0, 3, 12, 0x00000000);
+	RIPEMD160_ROUND(b1, c1, d1, e1, a1, RIPEMD160_F0, 4, 5, 0x00000000);
+	RIPEMD160_ROUND(a1, b1, c1, d1, e1, RIPEMD160_F0, 5, 8, 0x00000000);
+	RIPEMD160_ROUND(e1, a1, b1, c1, d1, RIPEMD160_F0, 6, 7, 0x00000000);
+	RIPEMD160_ROUND(d1, e1, a1, b1, c1, RIPEMD160_F0, 7, 9, 0x00000000);
+	RIPEMD160_ROUND(c1, d1, e1, a1, b1, RIPEMD160_F0, 8, 11, 0x00000000);
+	RIPEMD160_ROUND(b1, c1, d1, e1, a1, RIPEMD160_F0, 9, 13, 0x00000000);
+	RIPEMD160_ROUND(a1, b1, c1, d1, e1, RIPEMD160_F0, 10, 14, 0x00000000);
+	RIPEMD160_ROUND(e1, a1, b1, c1, d1, RIPEMD160_F0, 11, 15, 0x00000000);
+	RIPEMD160_ROUND(d1, e1, a1, b1, c1, RIPEMD160_F0, 12, 6, 0x00000000);
+	RIPEMD160_ROUND(c1, d1, e1, a1, b1, RIPEMD160_F0, 13, 7, 0x00000000);
+	RIPEMD160_ROUND(b1, c1, d1, e1, a1, RIPEMD160_F0, 14, 9, 0x00000000);
+	RIPEMD160_ROUND(a1, b1, c1, d1, e1, RIPEMD160_F0, 15, 8, 0x00000000);
+
+	RIPEMD160_ROUND(e1, a1, b1, c1, d1, RIPEMD160_F1, 7, 7, 0x5a827999);
+	RIPEMD160_ROUND(d1, e1, a1, b1, c1, RIPEMD160_F1, 4, 6, 0x5a827999);
+	RIPEMD160_ROUND(c1, d1, e1, a1, b1, RIPEMD160_F1, 13, 8, 0x5a827999);
+	RIPEMD160_ROUND(b1, c1, d1, e1, a1, RIPEMD160_F1, 1, 13, 0x5a827999);
+	RIPEMD160_ROUND(a1, b1, c1, d1, e1, RIPEMD160_F1, 10, 11, 0x5a827999);
+	RIPEMD160_ROUND(e1, a1, b1, c1, d1, RIPEMD160_F1, 6, 9, 0x5a827999);
+	RIPEMD160_ROUND(d1, e1, a1, b1, c1, RIPEMD160_F1, 15, 7, 0x5a827999);
+	RIPEMD160_ROUND(c1, d1, e1, a1, b1, RIPEMD160_F1, 3, 15, 0x5a827999);
+	RIPEMD160_ROUND(b1, c1, d1, e1, a1, RIPEMD160_F1, 12, 7, 0x5a827999);
+	RIPEMD160_ROUND(a1, b1, c1, d1, e1, RIPEMD160_F1, 0, 12, 0x5a827999);
+	RIPEMD160_ROUND(e1, a1, b1, c1, d1, RIPEMD160_F1, 9, 15, 0x5a827999);
+	RIPEMD160_ROUND(d1, e1, a1, b1, c1, RIPEMD160_F1, 5, 9, 0x5a827999);
+	RIPEMD160_ROUND(c1, d1, e1, a1, b1, RIPEMD160_F1, 2, 11, 0x5a827999);
+	RIPEMD160_ROUND(b1, c1, d1, e1, a1, RIPEMD160_F1, 14, 7, 0x5a827999);
+	RIPEMD160_ROUND(a1, b1, c1, d1, e1, RIPEMD160_F1, 11, 13, 0x5a827999);
+	RIPEMD160_ROUND(e1, a1, b1, c1, d1, RIPEMD160_F1, 8, 12, 0x5a827999);
+
+	RIPEMD160_ROUND(d1, e1, a1, b1, c1, RIPEMD160_F2, 3, 11, 0x6ed9eba1);
+	RIPEMD160_ROUND(c1, d1, e1, a1, b1, RIPEMD160_F2, 10, 13, 0x6ed9eba1);
+	RIPEMD160_ROUND(b1, c1, d1, e1, a1, RIPEMD160_F2, 14, 6, 0x6ed9eba1);
+	RIPEMD160_ROUND(a1, b1, c1, d1, e1, RIPEMD160_F2, 4, 7, 0x6ed9eba1);
+	RIPEMD160_ROUND(e1, a1, b1, c1, d1, RIPEMD160_F2, 9, 14, 0x6ed9eba1);
+	RIPEMD160_ROUND(d1, e1, a1, b1, c1, RIPEMD160_F2, 15, 9, 0x6ed9eba1);
+	RIPEMD160_ROUND(c1, d1, e1, a1, b1, RIPEMD160_F2, 8, 13, 0x6ed9eba1);
+	RIPEMD160_ROUND(b1, c1, d1, e1, a1, RIPEMD160_F2, 1, 15, 0x6ed9eba1);
+	RIPEMD160_ROUND(a1, b1, c1, d1, e1, RIPEMD160_F2, 2, 14, 0x6ed9eba1);
+	RIPEMD160_ROUND(e1, a1, b1, c1, d1, RIPEMD160_F2, 7, 8, 0x6ed9eba1);
+	RIPEMD160_ROUND(d1, e1, a1, b1, c1, RIPEMD160_F2, 0, 13, 0x6ed9eba1);
+	RIPEMD160_ROUND(c1, d1, e1, a1, b1, RIPEMD160_F2, 6, 6, 0x6ed9eba1);
+	RIPEMD160_ROUND(b1, c1, d1, e1, a1, RIPEMD160_F2, 13, 5, 0x6ed9eba1);
+	RIPEMD160_ROUND(a1, b1, c1, d1, e1, RIPEMD160_F2, 11, 12, 0x6ed9eba1);
+	RIPEMD160_ROUND(e1, a1, b1, c1, d1, RIPEMD160_F2, 5, 7, 0x6ed9eba1);
+	RIPEMD160_ROUND(d1, e1, a1, b1, c1, RIPEMD160_F2, 12, 5, 0x6ed9eba1);
+
+	RIPEMD160_ROUND(c1, d1, e1, a1, b1, RIPEMD160_F3, 1, 11, 0x8f1bbcdc);
+	RIPEMD160_ROUND(b1, c1, d1, e1, a1, RIPEMD160_F3, 9, 12, 0x8f1bbcdc);
+	RIPEMD160_ROUND(a1, b1, c1, d1, e1, RIPEMD160_F3, 11, 14, 0x8f1bbcdc);
+	RIPEMD160_ROUND(e1, a1, b1, c1, d1, RIPEMD160_F3, 10, 15, 0x8f1bbcdc);
+	RIPEMD160_ROUND(d1, e1, a1, b1, c1, RIPEMD160_F3, 0, 14, 0x8f1bbcdc);
+	RIPEMD160_ROUND(c1, d1, e1, a1, b1, RIPEMD160_F3, 8, 15, 0x8f1bbcdc);
+	RIPEMD160_ROUND(b1, c1, d1, e1, a1, RIPEMD160_F3, 12, 9, 0x8f1bbcdc);
+	RIPEMD160_ROUND(a1, b1, c1, d1, e1, RIPEMD160_F3, 4, 8, 0x8f1bbcdc);
+	RIPEMD160_ROUND(e1, a1, b1, c1, d1, RIPEMD160_F3, 13, 9, 0x8f1bbcdc);
+	RIPEMD160_ROUND(d1, e1, a1, b1, c1, RIPEMD160_F3, 3, 14, 0x8f1bbcdc);
+	RIPEMD160_ROUND(c1, d1, e1, a1, b1, RIPEMD160_F3, 7, 5, 0x8f1bbcdc);
+	RIPEMD160_ROUND(b1, c1, d1, e1, a1, RIPEMD160_F3, 15, 6, 0x8f1bbcdc);
+	RIPEMD160_ROUND(a1, b1, c1, d1, e1, RIPEMD160_F3, 14, 8, 0x8f1bbcdc);
+	RIPEMD160_ROUND(e1, a1, b1, c1, d1, RIPEMD160_F3, 5, 6, 0x8f1bbcdc);
+	RIPEMD160_ROUND(d1, e1, a1, b1, c1, RIPEMD160_F3, 6, 5, 0x8f1bbcdc);
+	RIPEMD160_ROUND(c1, d1, e1, a1, b1, RIPEMD160_F3, 2, 12, 0x8f1bbcdc);
+
+	RIPEMD160_ROUND(b1, c1, d1, e1, a1, RIPEMD160_F4, 4, 9, 0xa953fd4e);
+	RIPEMD160_ROUND(a1, b1, c1, d1, e1, RIPEMD160_F4, 0, 15, 0xa953fd4e);
+	RIPEMD160_ROUND(e1, a1, b1, c1, d1, RIPEMD160_F4, 5, 5, 0xa953fd4e);
+	RIPEMD160_ROUND(d1, e1, a1, b1, c1, RIPEMD160_F4, 9, 11, 0xa953fd4e);
+	RIPEMD160_ROUND(c1, d1, e1, a1, b1, RIPEMD160_F4, 7, 6, 0xa953fd4e);
+	RIPEMD160_ROUND(b1, c1, d1, e1, a1, RIPEMD160_F4, 12, 8, 0xa953fd4e);
+	RIPEMD160_ROUND(a1, b1, c1, d1, e1, RIPEMD160_F4, 2, 13, 0xa953fd4e);
+	RIPEMD160_ROUND(e1, a1, b1, c1, d1, RIPEMD160_F4, 10, 12, 0xa953fd4e);
+	RIPEMD160_ROUND(d1, e1, a1, b1, c1, RIPEMD160_F4, 14, 5, 0xa953fd4e);
+	RIPEMD160_ROUND(c1, d1, e1, a1, b1, RIPEMD160_F4, 1, 12, 0xa953fd4e);
+	RIPEMD160_ROUND(b1, c1, d1, e1, a1, RIPEMD160_F4, 3, 13, 0xa953fd4e);
+	RIPEMD160_ROUND(a1, b1, c1, d1, e1, RIPEMD160_F4, 8, 14, 0xa953fd4e);
+	RIPEMD160_ROUND(e1, a1, b1, c1, d1, RIPEMD160_F4, 11, 11, 0xa953fd4e);
+	RIPEMD160_ROUND(d1, e1, a1, b1, c1, RIPEMD160_F4, 6, 8, 0xa953fd4e);
+	RIPEMD160_ROUND(c1, d1, e1, a1, b1, RIPEMD160_F4, 15, 5, 0xa953fd4e);
+	RIPEMD160_ROUND(b1, c1, d1, e1, a1, RIPEMD160_F4, 13, 6, 0xa953fd4e);
+
+	RIPEMD160_ROUND(a2, b2, c2, d2, e2, RIPEMD160_F4, 5, 8, 0x50a28be6);
+	RIPEMD160_ROUND(e2, a2, b2, c2, d2, RIPEMD160_F4, 14, 9, 0x50a28be6);
+	RIPEMD160_ROUND(d2, e2, a2, b2, c2, RIPEMD160_F4, 7, 9, 0x50a28be6);
+	RIPEMD160_ROUND(c2, d2, e2, a2, b2, RIPEMD160_F4, 0, 11, 0x50a28be6);
+	RIPEMD160_ROUND(b2, c2, d2, e2, a2, RIPEMD160_F4, 9, 13, 0x50a28be6);
+	RIPEMD160_ROUND(a2, b2, c2, d2, e2, RIPEMD160_F4, 2, 15, 0x50a28be6);
+	RIPEMD160_ROUND(e2, a2, b2, c2, d2, RIPEMD160_F4, 11, 15, 0x50a28be6);
+	RIPEMD160_ROUND(d2, e2, a2, b2, c2, RIPEMD160_F4, 4, 5, 0x50a28be6);
+	RIPEMD160_ROUND(c2, d2, e2, a2, b2, RIPEMD160_F4, 13, 7, 0x50a28be6);
+	RIPEMD160_ROUND(b2, c2, d2, e2, a2, RIPEMD160_F4, 6, 7, 0x50a28be6);
+	RIPEMD160_ROUND(a2, b2, c2, d2, e2, RIPEMD160_F4, 15, 8, 0x50a28be6);
+	RIPEMD160_ROUND(e2, a2, b2, c2, d2, RIPEMD160_F4, 8, 11, 0x50a28be6);
+	RIPEMD160_ROUND(d2, e2, a2, b2, c2, RIPEMD160_F4, 1, 14, 0x50a28be6);
+	RIPEMD160_ROUND(c2, d2, e2, a2, b2, RIPEMD160_F4, 10, 14, 0x50a28be6);
+	RIPEMD160_ROUND(b2, c2, d2, e2, a2, RIPEMD160_F4, 3, 12, 0x50a28be6);
+	RIPEMD160_ROUND(a2, b2, c2, d2, e2, RIPEMD160_F4, 12, 6, 0x50a28be6);
+
+	RIPEMD160_ROUND(e2, a2, b2, c2, d2, RIPEMD160_F3, 6, 9, 0x5c4dd124);
+	RIPEMD160_ROUND(d2, e2, a2, b2, c2, RIPEMD160_F3, 11, 13, 0x5c4dd124);
+	RIPEMD160_ROUND(c2, d2, e2, a2, b2, RIPEMD160_F3, 3, 15, 0x5c4dd124);
+	RIPEMD160_ROUND(b2, c2, d2, e2, a2, RIPEMD160_F3, 7, 7, 0x5c4dd124);
+	RIPEMD160_ROUND(a2, b2, c2, d2, e2, RIPEMD160_F3, 0, 12, 0x5c4dd124);
+	RIPEMD160_ROUND(e2, a2, b2, c2, d2, RIPEMD160_F3, 13, 8, 0x5c4dd124);
+	RIPEMD160_ROUND(d2, e2, a2, b2, c2, RIPEMD160_F3, 5, 9, 0x5c4dd124);
+	RIPEMD160_ROUND(c2, d2, e2, a2, b2, RIPEMD160_F3, 10, 11, 0x5c4dd124);
+	RIPEMD160_ROUND(b2, c2, d2, e2, a2, RIPEMD160_F3, 14, 7, 0x5c4dd124);
+	RIPEMD160_ROUND(a2, b2, c2, d2, e2, RIPEMD160_F3, 15, 7, 0x5c4dd124);
+	RIPEMD160_ROUND(e2, a2, b2, c2, d2, RIPEMD160_F3, 8, 12, 0x5c4dd124);
+	RIPEMD160_ROUND(d2, e2, a2, b2, c2, RIPEMD160_F3, 12, 7, 0x5c4dd124);
+	RIPEMD160_ROUND(c2, d2, e2, a2, b2, RIPEMD160_F3, 4, 6, 0x5c4dd124);
+	RIPEMD160_ROUND(b2, c2, d2, e2, a2, RIPEMD160_F3, 9, 15, 0x5c4dd124);
+	RIPEMD160_ROUND(a2, b2, c2, d2, e2, RIPEMD160_F3, 1, 13, 0x5c4dd124);
+	RIPEMD160_ROUND(e2, a2, b2, c2, d2, RIPEMD160_F3, 2, 11, 0x5c4dd124);
+
+	RIPEMD160_ROUND(d2, e2, a2, b2, c2, RIPEMD160_F2, 15, 9, 0x6d703ef3);
+	RIPEMD160_ROUND(c2, d2, e2, a2, b2, RIPEMD160_F2, 5, 7, 0x6d703ef3);
+	RIPEMD160_ROUND(b2, c2, d2, e2, a2, RIPEMD160_F2, 1, 15, 0x6d703ef3);
+	RIPEMD160_ROUND(a2, b2, c2, d2, e2, RIPEMD160_F2, 3, 11, 0x6d703ef3);
+	RIPEMD160_ROUND(e2, a2, b2, c2, d2, RIPEMD160_F2, 7, 8, 0x6d703ef3);
+	RIPEMD160_ROUND(d2, e2, a2, b2, c2, RIPEMD160_F2, 14, 6, 0x6d703ef3);
+	RIPEMD160_ROUND(c2, d2, e2, a2, b2, RIPEMD160_F2, 6, 6, 0x6d703ef3);
+	RIPEMD160_ROUND(b2, c2, d2, e2, a2, RIPEMD160_F2, 9, 14, 0x6d703ef3);
+	RIPEMD160_ROUND(a2, b2, c2, d2, e2, RIPEMD160_F2, 11, 12, 0x6d703ef3);
+	RIPEMD160_ROUND(e2, a2, b2, c2, d2, RIPEMD160_F2, 8, 13, 0x6d703ef3);
+	RIPEMD160_ROUND(d2, e2, a2, b2, c2, RIPEMD160_F2, 12, 5, 0x6d703ef3);
+	RIPEMD160_ROUND(c2, d2, e2, a2, b2, RIPEMD160_F2, 2, 14, 0x6d703ef3);
+	RIPEMD160_ROUND(b2, c2, d2, e2, a2, RIPEMD160_F2, 10, 13, 0x6d703ef3);
+	RIPEMD160_ROUND(a2, b2, c2, d2, e2, RIPEMD160_F2, 0, 13, 0x6d703ef3);
+	RIPEMD160_ROUND(e2, a2, b2, c2, d2, RIPEMD160_F2, 4, 7, 0x6d703ef3);
+	RIPEMD160_ROUND(d2, e2, a2, b2, c2, RIPEMD160_F2, 13, 5, 0x6d703ef3);
+
+	RIPEMD160_ROUND(c2, d2, e2, a2, b2, RIPEMD160_F1, 8, 15, 0x7a6d76e9);
+	RIPEMD160_ROUND(b2, c2, d2, e2, a2, RIPEMD160_F1, 6, 5, 0x7a6d76e9);
+	RIPEMD160_ROUND(a2, b2, c2, d2, e2, RIPEMD160_F1, 4, 8, 0x7a6d76e9);
+	RIPEMD160_ROUND(e2, a2, b2, c2, d2, RIPEMD160_F1, 1, 11, 0x7a6d76e9);
+	RIPEMD160_ROUND(d2, e2, a2, b2, c2, RIPEMD160_F1, 3, 14, 0x7a6d76e9);
+	RIPEMD160_ROUND(c2, d2, e2, a2, b2, RIPEMD160_F1, 11, 14, 0x7a6d76e9);
+	RIPEMD160_ROUND(b2, c2, d2, e2, a2, RIPEMD160_F1, 15, 6, 0x7a6d76e9);
+	RIPEMD160_ROUND(a2, b2, c2, d2, e2, RIPEMD160_F1, 0, 14, 0x7a6d76e9);
+	RIPEMD160_ROUND(e2, a2, b2, c2, d2, RIPEMD160_F1, 5, 6, 0x7a6d76e9);
+	RIPEMD160_ROUND(d2, e2, a2, b2, c2, RIPEMD160_F1, 12, 9, 0x7a6d76e9);
+	RIPEMD160_ROUND(c2, d2, e2, a2, b2, RIPEMD160_F1, 2, 12, 0x7a6d76e9);
+	RIPEMD160_ROUND(b2, c2, d2, e2, a2, RIPEMD160_F1, 13, 9, 0x7a6d76e9);
+	RIPEMD160_ROUND(a2, b2, c2, d2, e2, RIPEMD160_F1, 9, 12, 0x7a6d76e9);
+	RIPEMD160_ROUND(e2, a2, b2, c2, d2, RIPEMD160_F1, 7, 5, 0x7a6d76e9);
+	RIPEMD160_ROUND(d2, e2, a2, b2, c2, RIPEMD160_F1, 10, 15, 0x7a6d76e9);
+	RIPEMD160_ROUND(c2, d2, e2, a2, b2, RIPEMD160_F1, 14, 8, 0x7a6d76e9);
+
+	RIPEMD160_ROUND(b2, c2, d2, e2, a2, RIPEMD160_F0, 12, 8, 0x00000000);
+	RIPEMD160_ROUND(a2, b2, c2, d2, e2, RIPEMD160_F0, 15, 5, 0x00000000);
+	RIPEMD160_ROUND(e2, a2, b2, c2, d2, RIPEMD160_F0, 10, 12, 0x00000000);
+	RIPEMD160_ROUND(d2, e2, a2, b2, c2, RIPEMD160_F0, 4, 9, 0x00000000);
+	RIPEMD160_ROUND(c2, d2, e2, a2, b2, RIPEMD160_F0, 1, 12, 0x00000000);
+	RIPEMD160_ROUND(b2, c2, d2, e2, a2, RIPEMD160_F0, 5, 5, 0x00000000);
+	RIPEMD160_ROUND(a2, b2, c2, d2, e2, RIPEMD160_F0, 8, 14, 0x00000000);
+	RIPEMD160_ROUND(e2, a2, b2, c2, d2, RIPEMD160_F0, 7, 6, 0x00000000);
+	RIPEMD160_ROUND(d2, e2, a2, b2, c2, RIPEMD160_F0, 6, 8, 0x00000000);
+	RIPEMD160_ROUND(c2, d2, e2, a2, b2, RIPEMD160_F0, 2, 13, 0x00000000);
+	RIPEMD160_ROUND(b2, c2, d2, e2, a2, RIPEMD160_F0, 13, 6, 0x00000000);
+	RIPEMD160_ROUND(a2, b2, c2, d2, e2, RIPEMD160_F0, 14, 5, 0x00000000);
+	RIPEMD160_ROUND(e2, a2, b2, c2, d2, RIPEMD160_F0, 0, 15, 0x00000000);
+	RIPEMD160_ROUND(d2, e2, a2, b2, c2, RIPEMD160_F0, 3, 13, 0x00000000);
+	RIPEMD160_ROUND(c2, d2, e2, a2, b2, RIPEMD160_F0, 9, 11, 0x00000000);
+	RIPEMD160_ROUND(b2, c2, d2, e2, a2, RIPEMD160_F0, 11, 11, 0x00000000);
+
+	t = hs->h[1] + c1 + d2;
+	hs->h[1] = hs->h[2] + d1 + e2;
+	hs->h[2] = hs->h[3] + e1 + a2;
+	hs->h[3] = hs->h[4] + a1 + b2;
+	hs->h[4] = hs->h[0] + b1 + c2;
+	hs->h[0] = t;
+}
+
+#else
 
 /** Selection of message word for main rounds. */
 static uint8_t r1[80] PROGMEM = {
@@ -206,6 +444,8 @@ static void ripemd160Block(HashState *hs)
 	hs->h[0] = T;
 }
 
+#endif // #ifdef RIPEMD160_UNROLLED
+
 /** Begin calculating hash for new message.
   * \param hs The hash state to initialise.
   */
@@ -234,6 +474,21 @@ void ripemd160WriteByte(HashState *hs, uint8_t byte)
 	hashWriteByte(hs, byte);
 }
 
+/** Add many bytes to the message buffer, calling ripemd160Block() whenever
+  * the message buffer is full. This is faster than calling
+  * ripemd160WriteByte() for each byte.
+  * \param hs The hash state to act on. The hash state must be one that has
+  *           been initialised using ripemd160Begin() at some time in the
+  *           past.
+  * \param buffer The bytes to add. This must be a byte array with space for
+  *               length bytes.
+  * \param length The number of bytes to add.
+  */
+void ripemd160WriteBytes(HashState *hs, uint8_t *buffer, uint32_t length)
+{
+	hashWriteBytes(hs, buffer, length);
+}
+
 /** Finalise the hashing of a message by writing appropriate padding and
   * length bytes.
   * \param hs The hash state to act on. The hash state must be one that has
@@ -245,6 +500,52 @@ void ripemd160Finish(HashState *hs)
 	hashFinish(hs);
 }
 
+/** Calculate RIPEMD-160(SHA-256(message)), which is how Bitcoin condenses
+  * a public key (or a script) into the 20 byte hash that an address
+  * encodes. This gives the same result as hashing the message with
+  * sha256Begin()/sha256WriteBytes()/sha256Finish(), writing the hash to a
+  * byte array and then hashing that with ripemd160Begin()/
+  * ripemd160WriteBytes()/ripemd160Finish(). It's faster because the
+  * SHA-256 hash is never serialised: a 32 byte message always fits in one
+  * RIPEMD-160 block, so the SHA-256 hash words are loaded directly into the
+  * message buffer and the padding and length (which are constant) are
+  * written as whole words.
+  * \param out The 20 byte hash will be written here. This must be a byte
+  *            array with space for 20 bytes.
+  * \param message The message to hash. This must be a byte array of the
+  *                size specified by length.
+  * \param length The length (in bytes) of the message.
+  */
+void hash160(uint8_t *out, uint8_t *message, uint32_t length)
+{
+	HashState hs;
+	uint32_t intermediate[8];
+	uint8_t i;
+
+	sha256Begin(&hs);
+	sha256WriteBytes(&hs, message, length);
+	sha256Finish(&hs);
+	memcpy(intermediate, hs.h, sizeof(intermediate));
+
+	ripemd160Begin(&hs);
+	// The SHA-256 hash words are big-endian, but RIPEMD-160 reads message
+	// words as little-endian.
+	for (i = 0; i < 8; i++)
+	{
+		hs.m[i] = intermediate[i];
+		swapEndian(&(hs.m[i]));
+	}
+	hs.m[8] = 0x00000080; // 1 bit of padding
+	hs.m[14] = 256; // length of message in bits
+	ripemd160Block(&hs);
+	for (i = 0; i < 5; i++)
+	{
+		writeU32LittleEndian(&(out[i * 4]), hs.h[i]);
+	}
+	memset(intermediate, 0, sizeof(intermediate));
+	memset(&hs, 0, sizeof(hs));
+}
+
 #ifdef TEST_RIPEMD160
 
 /** Where hash value will be stored after ripemd160() returns. */
@@ -295,11 +596,37 @@ static const uint32_t test_hashes[5 * NUMTESTS] = {
 0xb0e20b6e, 0x31166402, 0x86ed3a87, 0xa5713079, 0xb21f5189,
 0x9b752e45, 0x573d4b39, 0xf4dbd332, 0x3cab82bf, 0x63326bfb};
 
+/** Compressed and uncompressed public keys corresponding to the private
+  * key 1, for testing hash160(). */
+static const uint8_t hash160_test_messages[2][65] = {
+{0x02, 0x79, 0xbe, 0x66, 0x7e, 0xf9, 0xdc, 0xbb, 0xac, 0x55, 0xa0, 0x62,
+0x95, 0xce, 0x87, 0x0b, 0x07, 0x02, 0x9b, 0xfc, 0xdb, 0x2d, 0xce, 0x28,
+0xd9, 0x59, 0xf2, 0x81, 0x5b, 0x16, 0xf8, 0x17, 0x98},
+{0x04, 0x79, 0xbe, 0x66, 0x7e, 0xf9, 0xdc, 0xbb, 0xac, 0x55, 0xa0, 0x62,
+0x95, 0xce, 0x87, 0x0b, 0x07, 0x02, 0x9b, 0xfc, 0xdb, 0x2d, 0xce, 0x28,
+0xd9, 0x59, 0xf2, 0x81, 0x5b, 0x16, 0xf8, 0x17, 0x98, 0x48, 0x3a, 0xda,
+0x77, 0x26, 0xa3, 0xc4, 0x65, 0x5d, 0xa4, 0xfb, 0xfc, 0x0e, 0x11, 0x08,
+0xa8, 0xfd, 0x17, 0xb4, 0x48, 0xa6, 0x85, 0x54, 0x19, 0x9c, 0x47, 0xd0,
+0x8f, 0xfb, 0x10, 0xd4, 0xb8}};
+
+/** Expected hash160() of #hash160_test_messages. */
+static const uint8_t hash160_test_hashes[2][20] = {
+{0x75, 0x1e, 0x76, 0xe8, 0x19, 0x91, 0x96, 0xd4, 0x54, 0x94, 0x1c, 0x45,
+0xd1, 0xb3, 0xa3, 0x23, 0xf1, 0x43, 0x3b, 0xd6},
+{0x91, 0xb2, 0x4b, 0xf9, 0xf5, 0x28, 0x85, 0x32, 0x96, 0x0a, 0xc6, 0x87,
+0xab, 0xb0, 0x35, 0x12, 0x7b, 0x1d, 0x28, 0xa5}};
+
 int main(void)
 {
 	int i;
 	char *str;
 	uint32_t *compare_h;
+	uint32_t length;
+	uint32_t j;
+	uint8_t message[130];
+	uint8_t out[20];
+	uint8_t intermediate[32];
+	HashState hs;
 
 	initTests(__FILE__);
 
@@ -339,6 +666,50 @@ int main(void)
 		reportFailure();
 	}
 
+	// Check hash160() against known vectors (compressed and uncompressed
+	// public keys for the private key 1), then against the separate
+	// SHA-256 and RIPEMD-160 functions for random messages of various
+	// lengths.
+	for (i = 0; i < 2; i++)
+	{
+		hash160(out, (uint8_t *)hash160_test_messages[i], (uint32_t)(33 + i * 32));
+		if (!memcmp(out, hash160_test_hashes[i], 20))
+		{
+			reportSuccess();
+		}
+		else
+		{
+			printf("hash160() test vector %d failed\n", i);
+			reportFailure();
+		}
+	}
+	srand(42);
+	for (length = 0; length < 130; length++)
+	{
+		for (j = 0; j < length; j++)
+		{
+			message[j] = (uint8_t)rand();
+		}
+		hash160(out, message, length);
+		sha256Begin(&hs);
+		sha256WriteBytes(&hs, message, length);
+		sha256Finish(&hs);
+		writeHashToByteArray(intermediate, &hs, true);
+		ripemd160Begin(&hs);
+		ripemd160WriteBytes(&hs, intermediate, 32);
+		ripemd160Finish(&hs);
+		writeHashToByteArray(intermediate, &hs, true);
+		if (!memcmp(out, intermediate, 20))
+		{
+			reportSuccess();
+		}
+		else
+		{
+			printf("hash160() mismatch for length %u\n", length);
+			reportFailure();
+		}
+	}
+
 	finishTests();
 	exit(0);
 }
@@ -3,10 +3,13 @@
   * \brief Describes functions exported by ripemd160.c.
   *
   * To calculate a RIPEMD-160 hash, call ripemd160Begin(), then call
-  * ripemd160WriteByte() for each byte of the message, then call
+  * ripemd160WriteByte() for each byte of the message (or
+  * ripemd160WriteBytes() for many bytes at once), then call
   * ripemd160Finish(). The hash will be in HashState#h, but it can also be
   * extracted and placed into to a byte array using writeHashToByteArray().
   *
+  * hash160() is a shortcut for calculating RIPEMD-160(SHA-256(message)).
+  *
   * This file is licensed as described by the file LICENCE.
   */
 
@@ -18,6 +21,8 @@
 
 extern void ripemd160Begin(HashState *hs);
 extern void ripemd160WriteByte(HashState *hs, uint8_t byte);
+extern void ripemd160WriteBytes(HashState *hs, uint8_t *buffer, uint32_t length);
 extern void ripemd160Finish(HashState *hs);
+extern void hash160(uint8_t *out, uint8_t *message, uint32_t length);
 
 #endif // #ifndef RIPEMD160_H_INCLUDED
@@ -18,6 +18,160 @@
 #include "hash.h"
 #include "sha256.h"
 
+#ifdef SHA256_UNROLLED
+
+/** Rotate right.
+  * \param x The integer to rotate right.
+  * \param n Number of times to rotate right. This must be between 1 and 31
+  *          (inclusive).
+  */
+#define SHA256_ROTR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+/** Function defined as (4.2) in section 4.1.2 of FIPS PUB 180-3, rearranged
+  * to use one less operation. */
+#define SHA256_CH(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+/** Function defined as (4.3) in section 4.1.2 of FIPS PUB 180-3, rearranged
+  * to use one less operation. */
+#define SHA256_MAJ(x, y, z)	(((x) & (y)) | ((z) & ((x) | (y))))
+/** Function defined as (4.4) in section 4.1.2 of FIPS PUB 180-3. */
+#define SHA256_BIG_SIGMA0(x)	(SHA256_ROTR(x, 2) ^ SHA256_ROTR(x, 13) ^ SHA256_ROTR(x, 22))
+/** Function defined as (4.5) in section 4.1.2 of FIPS PUB 180-3. */
+#define SHA256_BIG_SIGMA1(x)	(SHA256_ROTR(x, 6) ^ SHA256_ROTR(x, 11) ^ SHA256_ROTR(x, 25))
+/** Function defined as (4.6) in section 4.1.2 of FIPS PUB 180-3. */
+#define SHA256_LITTLE_SIGMA0(x)	(SHA256_ROTR(x, 7) ^ SHA256_ROTR(x, 18) ^ ((x) >> 3))
+/** Function defined as (4.7) in section 4.1.2 of FIPS PUB 180-3. */
+#define SHA256_LITTLE_SIGMA1(x)	(SHA256_ROTR(x, 17) ^ SHA256_ROTR(x, 19) ^ ((x) >> 10))
+
+/** One round of SHA-256, using message schedule word t (which must already
+  * be in w[t & 15]) and the constant kt. Instead of shifting the working
+  * variables along after every round, the caller rotates the order of the
+  * arguments, so only d and h are actually written to. */
+#define SHA256_ROUND(a, b, c, d, e, f, g, h, t, kt)						\
+	t1 = (h) + SHA256_BIG_SIGMA1(e) + SHA256_CH(e, f, g) + (kt) + w[(t) & 15];	\
+	(d) += t1;														\
+	(h) = t1 + SHA256_BIG_SIGMA0(a) + SHA256_MAJ(a, b, c)
+
+/** Like #SHA256_ROUND, except message schedule word t (t >= 16) is
+  * calculated first. The message schedule is only 16 words long; word t
+  * replaces word t - 16, which is no longer needed. */
+#define SHA256_ROUND_SCHEDULE(a, b, c, d, e, f, g, h, t, kt)				\
+	w[(t) & 15] += SHA256_LITTLE_SIGMA1(w[((t) - 2) & 15]) + w[((t) - 7) & 15]	\
+		+ SHA256_LITTLE_SIGMA0(w[((t) - 15) & 15]);						\
+	SHA256_ROUND(a, b, c, d, e, f, g, h, t, kt)
+
+/** Update hash value based on the contents of a full message buffer.
+  * This is an implementation of HashState#hashBlock().
+  * This implements the pseudo-code in section 6.2.2 of FIPS PUB 180-3, but
+  * with all 64 rounds unrolled and the constants embedded in the code, which
+  * is much faster on 32 bit targets. It is also much bigger, so it's
+  * not suitable for the AVR.
+  * \param hs The hash state to update.
+  */
+static RAM_FUNCTION void sha256Block(HashState *hs)
+{
+	uint32_t a, b, c, d, e, f, g, h;
+	uint32_t t1;
+	uint32_t w[16];
+	uint8_t i;
+
+	// This is a loop instead of a call to memcpy(), so that sha256Block()
+	// can be run from RAM (see #RAM_FUNCTION).
+	for (i = 0; i < 16; i++)
+	{
+		w[i] = hs->m[i];
+	}
+	a = hs->h[0];
+	b = hs->h[1];
+	c = hs->h[2];
+	d = hs->h[3];
+	e = hs->h[4];
+	f = hs->h[5];
+	g = hs->h[6];
+	h = hs->h[7];
+
+	SHA256_ROUND(a, b, c, d, e, f, g, h, 0, 0x428a2f98);
+	SHA256_ROUND(h, a, b, c, d, e, f, g, 1, 0x71374491);
+	SHA256_ROUND(g, h, a, b, c, d, e, f, 2, 0xb5c0fbcf);
+	SHA256_ROUND(f, g, h, a, b, c, d, e, 3, 0xe9b5dba5);
+	SHA256_ROUND(e, f, g, h, a, b, c, d, 4, 0x3956c25b);
+	SHA256_ROUND(d, e, f, g, h, a, b, c, 5, 0x59f111f1);
+	SHA256_ROUND(c, d, e, f, g, h, a, b, 6, 0x923f82a4);
+	SHA256_ROUND(b, c, d, e, f, g, h, a, 7, 0xab1c5ed5);
+
+	SHA256_ROUND(a, b, c, d, e, f, g, h, 8, 0xd807aa98);
+	SHA256_ROUND(h, a, b, c, d, e, f, g, 9, 0x12835b01);
+	SHA256_ROUND(g, h, a, b, c, d, e, f, 10, 0x243185be);
+	SHA256_ROUND(f, g, h, a, b, c, d, e, 11, 0x550c7dc3);
+	SHA256_ROUND(e, f, g, h, a, b, c, d, 12, 0x72be5d74);
+	SHA256_ROUND(d, e, f, g, h, a, b, c, 13, 0x80deb1fe);
+	SHA256_ROUND(c, d, e, f, g, h, a, b, 14, 0x9bdc06a7);
+	SHA256_ROUND(b, c, d, e, f, g, h, a, 15, 0xc19bf174);
+
+	SHA256_ROUND_SCHEDULE(a, b, c, d, e, f, g, h, 16, 0xe49b69c1);
+	SHA256_ROUND_SCHEDULE(h, a, b, c, d, e, f, g, 17, 0xefbe4786);
+	SHA256_ROUND_SCHEDULE(g, h, a, b, c, d, e, f, 18, 0x0fc19dc6);
+	SHA256_ROUND_SCHEDULE(f, g, h, a, b, c, d, e, 19, 0x240ca1cc);
+	SHA256_ROUND_SCHEDULE(e, f, g, h, a, b, c, d, 20, 0x2de92c6f);
+	SHA256_ROUND_SCHEDULE(d, e, f, g, h, a, b, c, 21, 0x4a7484aa);
+	SHA256_ROUND_SCHEDULE(c, d, e, f, g, h, a, b, 22, 0x5cb0a9dc);
+	SHA256_ROUND_SCHEDULE(b, c, d, e, f, g, h, a, 23, 0x76f988da);
+
+	SHA256_ROUND_SCHEDULE(a, b, c, d, e, f, g, h, 24, 0x983e5152);
+	SHA256_ROUND_SCHEDULE(h, a, b, c, d, e, f, g, 25, 0xa831c66d);
+	SHA256_ROUND_SCHEDULE(g, h, a, b, c, d, e, f, 26, 0xb00327c8);
+	SHA256_ROUND_SCHEDULE(f, g, h, a, b, c, d, e, 27, 0xbf597fc7);
+	SHA256_ROUND_SCHEDULE(e, f, g, h, a, b, c, d, 28, 0xc6e00bf3);
+	SHA256_ROUND_SCHEDULE(d, e, f, g, h, a, b, c, 29, 0xd5a79147);
+	SHA256_ROUND_SCHEDULE(c, d, e, f, g, h, a, b, 30, 0x06ca6351);
+	SHA256_ROUND_SCHEDULE(b, c, d, e, f, g, h, a, 31, 0x14292967);
+
+	SHA256_ROUND_SCHEDULE(a, b, c, d, e, f, g, h, 32, 0x27b70a85);
+	SHA256_ROUND_SCHEDULE(h, a, b, c, d, e, f, g, 33, 0x2e1b2138);
+	SHA256_ROUND_SCHEDULE(g, h, a, b, c, d, e, f, 34, 0x4d2c6dfc);
+	SHA256_ROUND_SCHEDULE(f, g, h, a, b, c, d, e, 35, 0x53380d13);
+	SHA256_ROUND_SCHEDULE(e, f, g, h, a, b, c, d, 36, 0x650a7354);
+	SHA256_ROUND_SCHEDULE(d, e, f, g, h, a, b, c, 37, 0x766a0abb);
+	SHA256_ROUND_SCHEDULE(c, d, e, f, g, h, a, b, 38, 0x81c2c92e);
+	SHA256_ROUND_SCHEDULE(b, c, d, e, f, g, h, a, 39, 0x92722c85);
+
+	SHA256_ROUND_SCHEDULE(a, b, c, d, e, f, g, h, 40, 0xa2bfe8a1);
+	SHA256_ROUND_SCHEDULE(h, a, b, c, d, e, f, g, 41, 0xa81a664b);
+	SHA256_ROUND_SCHEDULE(g, h, a, b, c, d, e, f, 42, 0xc24b8b70);
+	SHA256_ROUND_SCHEDULE(f, g, h, a, b, c, d, e, 43, 0xc76c51a3);
+	SHA256_ROUND_SCHEDULE(e, f, g, h, a, b, c, d, 44, 0xd192e819);
+	SHA256_ROUND_SCHEDULE(d, e, f, g, h, a, b, c, 45, 0xd6990624);
+	SHA256_ROUND_SCHEDULE(c, d, e, f, g, h, a, b, 46, 0xf40e3585);
+	SHA256_ROUND_SCHEDULE(b, c, d, e, f, g, h, a, 47, 0x106aa070);
+
+	SHA256_ROUND_SCHEDULE(a, b, c, d, e, f, g, h, 48, 0x19a4c116);
+	SHA256_ROUND_SCHEDULE(h, a, b, c, d, e, f, g, 49, 0x1e376c08);
+	SHA256_ROUND_SCHEDULE(g, h, a, b, c, d, e, f, 50, 0x2748774c);
+	SHA256_ROUND_SCHEDULE(f, g, h, a, b, c, d, e, 51, 0x34b0bcb5);
+	SHA256_ROUND_SCHEDULE(e, f, g, h, a, b, c, d, 52, 0x391c0cb3);
+	SHA256_ROUND_SCHEDULE(d, e, f, g, h, a, b, c, 53, 0x4ed8aa4a);
+	SHA256_ROUND_SCHEDULE(c, d, e, f, g, h, a, b, 54, 0x5b9cca4f);
+	SHA256_ROUND_SCHEDULE(b, c, d, e, f, g, h, a, 55, 0x682e6ff3);
+
+	SHA256_ROUND_SCHEDULE(a, b, c, d, e, f, g, h, 56, 0x748f82ee);
+	SHA256_ROUND_SCHEDULE(h, a, b, c, d, e, f, g, 57, 0x78a5636f);
+	SHA256_ROUND_SCHEDULE(g, h, a, b, c, d, e, f, 58, 0x84c87814);
+	SHA256_ROUND_SCHEDULE(f, g, h, a, b, c, d, e, 59, 0x8cc70208);
+	SHA256_ROUND_SCHEDULE(e, f, g, h, a, b, c, d, 60, 0x90befffa);
+	SHA256_ROUND_SCHEDULE(d, e, f, g, h, a, b, c, 61, 0xa4506ceb);
+	SHA256_ROUND_SCHEDULE(c, d, e, f, g, h, a, b, 62, 0xbef9a3f7);
+	SHA256_ROUND_SCHEDULE(b, c, d, e, f, g, h, a, 63, 0xc67178f2);
+
+	hs->h[0] += a;
+	hs->h[1] += b;
+	hs->h[2] += c;
+	hs->h[3] += d;
+	hs->h[4] += e;
+	hs->h[5] += f;
+	hs->h[6] += g;
+	hs->h[7] += h;
+}
+
+#else
+
 /** Constants for SHA-256. See section 4.2.2 of FIPS PUB 180-3. */
 static const uint32_t k[64] PROGMEM = {
 0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
@@ -42,7 +196,7 @@ static const uint32_t k[64] PROGMEM = {
   * \param n Number of times to rotate right.
   * \return The rotated integer.
   */
-static uint32_t rotateRight(uint32_t x, uint8_t n)
+static RAM_FUNCTION_HELPER uint32_t rotateRight(uint32_t x, uint8_t n)
 {
 	return (x >> n) | (x << (32 - n));
 }
@@ -53,7 +207,7 @@ static uint32_t rotateRight(uint32_t x, uint8_t n)
   * \param z Third input integer.
   * \return Non-linear combination of x, y and z.
   */
-static uint32_t ch(uint32_t x, uint32_t y, uint32_t z)
+static RAM_FUNCTION_HELPER uint32_t ch(uint32_t x, uint32_t y, uint32_t z)
 {
 	return (x & y) ^ ((~x) & z);
 }
@@ -64,7 +218,7 @@ static uint32_t ch(uint32_t x, uint32_t y, uint32_t z)
   * \param z Third input integer.
   * \return Non-linear combination of x, y and z.
   */
-static uint32_t maj(uint32_t x, uint32_t y, uint32_t z)
+static RAM_FUNCTION_HELPER uint32_t maj(uint32_t x, uint32_t y, uint32_t z)
 {
 	return (x & y) ^ (x & z) ^ (y & z);
 }
@@ -73,7 +227,7 @@ static uint32_t maj(uint32_t x, uint32_t y, uint32_t z)
   * \param x Input integer.
   * \return Transformed integer.
   */
-static uint32_t bigSigma0(uint32_t x)
+static RAM_FUNCTION_HELPER uint32_t bigSigma0(uint32_t x)
 {
 	return rotateRight(x, 2) ^ rotateRight(x, 13) ^ rotateRight(x, 22);
 }
@@ -82,7 +236,7 @@ static uint32_t bigSigma0(uint32_t x)
   * \param x Input integer.
   * \return Transformed integer.
   */
-static uint32_t bigSigma1(uint32_t x)
+static RAM_FUNCTION_HELPER uint32_t bigSigma1(uint32_t x)
 {
 	return rotateRight(x, 6) ^ rotateRight(x, 11) ^ rotateRight(x, 25);
 }
@@ -91,7 +245,7 @@ static uint32_t bigSigma1(uint32_t x)
   * \param x Input integer.
   * \return Transformed integer.
   */
-static uint32_t littleSigma0(uint32_t x)
+static RAM_FUNCTION_HELPER uint32_t littleSigma0(uint32_t x)
 {
 	return rotateRight(x, 7) ^ rotateRight(x, 18) ^ (x >> 3);
 }
@@ -100,7 +254,7 @@ static uint32_t littleSigma0(uint32_t x)
   * \param x Input integer.
   * \return Transformed integer.
   */
-static uint32_t littleSigma1(uint32_t x)
+static RAM_FUNCTION_HELPER uint32_t littleSigma1(uint32_t x)
 {
 	return rotateRight(x, 17) ^ rotateRight(x, 19) ^ (x >> 10);
 }
@@ -110,7 +264,7 @@ static uint32_t littleSigma1(uint32_t x)
   * This implements the pseudo-code in section 6.2.2 of FIPS PUB 180-3.
   * \param hs The hash state to update.
   */
-static void sha256Block(HashState *hs)
+static RAM_FUNCTION void sha256Block(HashState *hs)
 {
 	uint32_t a, b, c, d, e, f, g, h;
 	uint32_t t1, t2;
@@ -156,15 +310,14 @@ static void sha256Block(HashState *hs)
 	hs->h[7] += h;
 }
 
-/** Begin calculating hash for new message.
-  * See section 5.3.3 of FIPS PUB 180-3.
-  * \param hs The hash state to initialise.
+#endif // #ifdef SHA256_UNROLLED
+
+/** Set the hash value to the initial hash value specified in section 5.3.3
+  * of FIPS PUB 180-3.
+  * \param hs The hash state to act on.
   */
-void sha256Begin(HashState *hs)
+static void setInitialHashValue(HashState *hs)
 {
-	hs->message_length = 0;
-	hs->hashBlock = sha256Block;
-	hs->is_big_endian = true;
 	hs->h[0] = 0x6a09e667;
 	hs->h[1] = 0xbb67ae85;
 	hs->h[2] = 0x3c6ef372;
@@ -173,6 +326,18 @@ void sha256Begin(HashState *hs)
 	hs->h[5] = 0x9b05688c;
 	hs->h[6] = 0x1f83d9ab;
 	hs->h[7] = 0x5be0cd19;
+}
+
+/** Begin calculating hash for new message.
+  * See section 5.3.3 of FIPS PUB 180-3.
+  * \param hs The hash state to initialise.
+  */
+void sha256Begin(HashState *hs)
+{
+	hs->message_length = 0;
+	hs->hashBlock = sha256Block;
+	hs->is_big_endian = true;
+	setInitialHashValue(hs);
 	clearM(hs);
 }
 
@@ -187,6 +352,20 @@ void sha256WriteByte(HashState *hs, uint8_t byte)
 	hashWriteByte(hs, byte);
 }
 
+/** Add many bytes to the message buffer, calling sha256Block() whenever
+  * the message buffer is full. This is faster than calling
+  * sha256WriteByte() for each byte.
+  * \param hs The hash state to act on. The hash state must be one that has
+  *           been initialised using sha256Begin() at some time in the past.
+  * \param buffer The bytes to add. This must be a byte array with space for
+  *               length bytes.
+  * \param length The number of bytes to add.
+  */
+void sha256WriteBytes(HashState *hs, const uint8_t *buffer, uint32_t length)
+{
+	hashWriteBytes(hs, buffer, length);
+}
+
 /** Finalise the hashing of a message by writing appropriate padding and
   * length bytes.
   * \param hs The hash state to act on. The hash state must be one that has
@@ -199,30 +378,42 @@ void sha256Finish(HashState *hs)
 
 /** Just like sha256Finish(), except this does a double SHA-256 hash. A
   * double SHA-256 hash is sometimes used in the Bitcoin protocol.
+  *
+  * The second hash is always of a 32 byte message, which fits in a single
+  * block along with its padding and length. So instead of going
+  * through sha256Begin()/sha256WriteBytes()/sha256Finish(), the first hash
+  * is placed directly into the message buffer (SHA-256 message words are
+  * big-endian, just like hash words), the constant padding and length words
+  * are filled in, and sha256Block() is called once.
   * \param hs The hash state to act on. The hash state must be one that has
   *           been initialised using sha256Begin() at some time in the past.
   */
 void sha256FinishDouble(HashState *hs)
 {
-	uint8_t temp[32];
-	uint8_t i;
-
-	sha256Finish(hs);
-	writeHashToByteArray(temp, hs, true);
-	sha256Begin(hs);
-	for (i = 0; i < 32; i++)
-	{
-		sha256WriteByte(hs, temp[i]);
-	}
 	sha256Finish(hs);
+	// sha256Finish() leaves the message buffer cleared, so only words
+	// which are non-zero need to be written.
+	memcpy(hs->m, hs->h, 32);
+	hs->m[8] = 0x80000000; // 1 bit of padding
+	hs->m[15] = 256; // length of message in bits
+	hs->message_length = 32;
+	setInitialHashValue(hs);
+	sha256Block(hs);
+	clearM(hs);
 }
 
 #ifdef TEST_SHA256
 
 /** Where hash value will be stored after sha256() returns. */
 static uint32_t h[8];
+/** Where hash value, calculated using sha256WriteBytes(), will be stored
+  * after sha256() returns. */
+static uint32_t h_bulk[8];
 
 /** Calculate SHA-256 hash of a message. The result is returned in #h.
+  * The hash is also calculated by passing the message to sha256WriteBytes()
+  * in pieces of varying size (to exercise unaligned writes); that result is
+  * returned in #h_bulk.
   * \param message The message to calculate the hash of. This must be a byte
   *                array of the size specified by length.
   * \param length The length (in bytes) of the message.
@@ -230,6 +421,7 @@ static uint32_t h[8];
 static void sha256(uint8_t *message, uint32_t length)
 {
 	uint32_t i;
+	uint32_t piece_length;
 	HashState hs;
 
 	sha256Begin(&hs);
@@ -239,6 +431,20 @@ static void sha256(uint8_t *message, uint32_t length)
 	}
 	sha256Finish(&hs);
 	memcpy(h, hs.h, 32);
+
+	sha256Begin(&hs);
+	piece_length = 1;
+	for (i = 0; i < length; i += piece_length)
+	{
+		piece_length = (piece_length * 7 + 3) % 71;
+		if (piece_length > (length - i))
+		{
+			piece_length = length - i;
+		}
+		sha256WriteBytes(&hs, &(message[i]), piece_length);
+	}
+	sha256Finish(&hs);
+	memcpy(h_bulk, hs.h, 32);
 }
 
 /** Run unit tests using test vectors from a file. The file is expected to be
@@ -319,7 +525,7 @@ http://csrc.nist.gov/groups/STM/cavp/index.html#03", filename);
 			compare_h[i] = (uint32_t)value;
 		}
 		skipWhiteSpace(f);
-		if (!memcmp(h, compare_h, 32))
+		if (!memcmp(h, compare_h, 32) && !memcmp(h_bulk, compare_h, 32))
 		{
 			//printf("%08x%08x%08x%08x%08x%08x%08x%08x\n", h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7]);
 			reportSuccess();
@@ -334,11 +540,79 @@ http://csrc.nist.gov/groups/STM/cavp/index.html#03", filename);
 	fclose(f);
 }
 
+/** Test sha256FinishDouble(), by comparing it against a known double
+  * SHA-256 hash and against a double SHA-256 hash done the long way for
+  * messages of various lengths. */
+static void testFinishDouble(void)
+{
+	HashState hs;
+	uint8_t message[130];
+	uint8_t first[32];
+	uint8_t out[32];
+	uint8_t expected[32];
+	uint32_t length;
+	uint32_t i;
+	// Double SHA-256 hash of "hello".
+	const uint8_t hello_hash[32] = {
+	0x95, 0x95, 0xc9, 0xdf, 0x90, 0x07, 0x51, 0x48,
+	0xeb, 0x06, 0x86, 0x03, 0x65, 0xdf, 0x33, 0x58,
+	0x4b, 0x75, 0xbf, 0xf7, 0x82, 0xa5, 0x10, 0xc6,
+	0xcd, 0x48, 0x83, 0xa4, 0x19, 0x83, 0x3d, 0x50};
+
+	sha256Begin(&hs);
+	sha256WriteBytes(&hs, (const uint8_t *)"hello", 5);
+	sha256FinishDouble(&hs);
+	writeHashToByteArray(out, &hs, true);
+	if (!memcmp(out, hello_hash, 32))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Double SHA-256 of \"hello\" failed\n");
+		reportFailure();
+	}
+
+	srand(42);
+	for (length = 0; length < 130; length++)
+	{
+		for (i = 0; i < length; i++)
+		{
+			message[i] = (uint8_t)rand();
+		}
+		sha256Begin(&hs);
+		sha256WriteBytes(&hs, message, length);
+		sha256FinishDouble(&hs);
+		writeHashToByteArray(out, &hs, true);
+		sha256Begin(&hs);
+		sha256WriteBytes(&hs, message, length);
+		sha256Finish(&hs);
+		writeHashToByteArray(first, &hs, true);
+		sha256Begin(&hs);
+		for (i = 0; i < 32; i++)
+		{
+			sha256WriteByte(&hs, first[i]);
+		}
+		sha256Finish(&hs);
+		writeHashToByteArray(expected, &hs, true);
+		if (!memcmp(out, expected, 32))
+		{
+			reportSuccess();
+		}
+		else
+		{
+			printf("Double SHA-256 mismatch for length %u\n", length);
+			reportFailure();
+		}
+	}
+}
+
 int main(void)
 {
 	initTests(__FILE__);
 	scanTestVectors("SHA256ShortMsg.rsp");
 	scanTestVectors("SHA256LongMsg.rsp");
+	testFinishDouble();
 	finishTests();
 	exit(0);
 }
@@ -16,6 +16,16 @@
   * - Some (RAM) space efficiency is achieved by storing samples in a
   *   histogram (see #packed_histogram_buffer), instead of storing them in a
   *   FIFO buffer.
+  * - On platforms with plenty of RAM, define HISTOGRAM_UNPACKED to store
+  *   each histogram bin in its own uint16_t instead (see #histogram_buffer).
+  *   That uses more RAM but makes incrementHistogram() much faster, since
+  *   it no longer has to do bit-packed read-modify-write operations.
+  * - Define PSD_INTEGER_ACCUMULATE to accumulate squared magnitudes in
+  *   accumulatePowerSpectralDensity() using plain integer arithmetic, with
+  *   one (block floating-point) scale factor per FFT. That avoids the
+  *   saturating fix16 operations and per-term overflow checks, at the cost
+  *   of slightly different rounding. Overflow is instead detected once per
+  *   FFT, using an upper bound on what was accumulated.
   *
   * This file is licensed as described by the file LICENCE.
   */
@@ -25,6 +35,24 @@
 #include "fft.h"
 #include "statistics.h"
 
+#ifdef HISTOGRAM_UNPACKED
+
+/** The maximum number of counts which can be held in one histogram bin. */
+#define MAX_HISTOGRAM_VALUE			0xffff
+
+/** The buffer where histogram counts are stored, one bin per entry. The
+  * buffer needs to be persistent, because counts are accumulated across many
+  * calls to hardwareRandom32Bytes(). This is the unpacked equivalent
+  * of #packed_histogram_buffer.
+  */
+#ifdef STATISTICS_BORROWED_BUFFERS
+#define histogram_buffer	(statistics_buffers->histogram)
+#else
+static uint16_t histogram_buffer[HISTOGRAM_NUM_BINS];
+#endif // #ifdef STATISTICS_BORROWED_BUFFERS
+
+#else
+
 /** The maximum number of counts which can be held in one histogram bin. */
 #define MAX_HISTOGRAM_VALUE			((1 << BITS_PER_HISTOGRAM_BIN) - 1)
 
@@ -39,13 +67,23 @@
   * value, and each bin has an associated count, which represents how many
   * times that value occurred.
   */
+#ifdef STATISTICS_BORROWED_BUFFERS
+#define packed_histogram_buffer	(statistics_buffers->packed_histogram)
+#else
 static uint32_t packed_histogram_buffer[((HISTOGRAM_NUM_BINS * BITS_PER_HISTOGRAM_BIN) / 32) + 1];
+#endif // #ifdef STATISTICS_BORROWED_BUFFERS
+
+#endif // #ifdef HISTOGRAM_UNPACKED
 
 /** An estimate of the power spectral density of the HWRNG. As more samples
   * are collected, FFT results will be accumulated here. The more samples,
   * the more accurate the estimate will be.
   */
+#ifdef STATISTICS_BORROWED_BUFFERS
+StatisticsBuffers *statistics_buffers;
+#else
 fix16_t psd_accumulator[FFT_SIZE + 1];
+#endif // #ifdef STATISTICS_BORROWED_BUFFERS
 
 /** This will be true if there was an arithmetic error in the calculation
   * of power spectral density (see #psd_accumulator). This will be false if
@@ -53,31 +91,92 @@ fix16_t psd_accumulator[FFT_SIZE + 1];
   */
 bool psd_accumulator_error_occurred;
 
+#ifdef PSD_INTEGER_ACCUMULATE
+/** Upper bound on the value of every entry in #psd_accumulator. This is used
+  * to detect overflow once per FFT, instead of once per entry.
+  */
+static uint32_t psd_accumulator_bound;
+#endif // #ifdef PSD_INTEGER_ACCUMULATE
+
+/** Longest run of identical consecutive samples seen by the repetition count
+  * test since the last call to clearHealthTests(). */
+uint32_t max_repetition_count;
+/** Highest number of times the first sample of a window occurred within that
+  * window, as seen by the adaptive proportion test since the last call to
+  * clearHealthTests(). */
+uint32_t max_proportion_count;
+/** The previous sample given to updateHealthTests(). */
+static uint32_t repetition_sample;
+/** Length of the current run of samples equal to #repetition_sample. This
+  * is 0 if there is no previous sample. */
+static uint32_t repetition_count;
+/** The sample at the start of the current adaptive proportion test
+  * window. */
+static uint32_t proportion_sample;
+/** Number of times #proportion_sample has occurred in the current
+  * window. */
+static uint32_t proportion_count;
+/** Number of samples in the current adaptive proportion test window. This
+  * is 0 if a new window needs to be started. */
+static uint32_t proportion_window_index;
+
 /** This will be set to true if one of the histogram bins overflows. */
 bool histogram_overflow_occurred;
 /** Number of samples that have been placed in the histogram. */
 uint32_t samples_in_histogram;
-/** The index (bin number) into the histogram buffer where the histogram
-  * iterator is currently at. */
-static uint32_t iterator_index;
-/** The count within a histogram bin where the histogram iterator is currently
-  * at. */
-static uint32_t iterator_count;
-/** Cached value of histogram counts in the bin specified by #iterator_index.
-  * This is used to speed up getTermFromIterator(). */
-static uint32_t cached_histogram_count;
-/** Cached value of scaled sample value for the bin specified
-  * by #iterator_index. This is used to speed up getTermFromIterator(). */
-static fix16_t cached_scaled_sample;
-
 /** Reset all histogram counts to 0. */
 void clearHistogram(void)
 {
+#ifdef HISTOGRAM_UNPACKED
+	memset(histogram_buffer, 0, sizeof(histogram_buffer));
+#else
 	memset(packed_histogram_buffer, 0, sizeof(packed_histogram_buffer));
+#endif // #ifdef HISTOGRAM_UNPACKED
 	samples_in_histogram = 0;
 	histogram_overflow_occurred = false;
 }
 
+#ifdef HISTOGRAM_UNPACKED
+
+/** Gets an entry from the histogram counts buffer.
+  * \param index The histogram bin to query.
+  * \return The number of counts in the specified bin.
+  */
+static uint32_t getHistogram(uint32_t index)
+{
+	if (index >= HISTOGRAM_NUM_BINS)
+	{
+		// This should never happen.
+		fix16_error_occurred = true;
+		return 0;
+	}
+	return histogram_buffer[index];
+}
+
+/** Increments the count of a histogram bin.
+  * \param index The histogram bin to modify.
+  */
+void incrementHistogram(uint32_t index)
+{
+	if (index >= HISTOGRAM_NUM_BINS)
+	{
+		// This should never happen.
+		fix16_error_occurred = true;
+	}
+	else if (histogram_buffer[index] == MAX_HISTOGRAM_VALUE)
+	{
+		// Overflow in one of the bins.
+		histogram_overflow_occurred = true;
+	}
+	else
+	{
+		histogram_buffer[index]++;
+	}
+	samples_in_histogram++;
+}
+
+#else
+
 /** Gets an entry from the histogram counts buffer.
   * \param index The histogram bin to query.
   * \return The number of counts in the specified bin.
@@ -160,6 +259,73 @@ void incrementHistogram(uint32_t index)
 	samples_in_histogram++;
 }
 
+#endif // #ifdef HISTOGRAM_UNPACKED
+
+/** Reset the state of the repetition count and adaptive proportion tests
+  * (see updateHealthTests()), including #max_repetition_count
+  * and #max_proportion_count. */
+void clearHealthTests(void)
+{
+	max_repetition_count = 0;
+	max_proportion_count = 0;
+	repetition_count = 0;
+	proportion_window_index = 0;
+}
+
+/** Feed one sample to the repetition count and adaptive proportion tests
+  * described in section 4.4 of NIST SP 800-90B. Unlike the histogram, these
+  * care about the order of samples, so this should be called for every
+  * sample, in the order the samples were taken.
+  *
+  * This function doesn't decide whether the tests have failed, since the
+  * cutoffs depend on the entropy per sample, which is platform-dependent.
+  * Instead, it keeps track of the worst case seen so far
+  * in #max_repetition_count and #max_proportion_count; the caller should
+  * compare those against the cutoffs.
+  * \param sample The sample value.
+  */
+void updateHealthTests(uint32_t sample)
+{
+	// Repetition count test: look for long runs of the same value, which
+	// occur if the HWRNG gets stuck.
+	if ((repetition_count != 0) && (sample == repetition_sample))
+	{
+		repetition_count++;
+	}
+	else
+	{
+		repetition_sample = sample;
+		repetition_count = 1;
+	}
+	if (repetition_count > max_repetition_count)
+	{
+		max_repetition_count = repetition_count;
+	}
+
+	// Adaptive proportion test: within each window
+	// of #PROPORTION_WINDOW_SIZE samples, count how often the first sample
+	// of the window occurs. Too many occurrences mean that the HWRNG has
+	// become biased towards a value.
+	if (proportion_window_index == 0)
+	{
+		proportion_sample = sample;
+		proportion_count = 1;
+	}
+	else if (sample == proportion_sample)
+	{
+		proportion_count++;
+	}
+	proportion_window_index++;
+	if (proportion_window_index >= PROPORTION_WINDOW_SIZE)
+	{
+		proportion_window_index = 0;
+	}
+	if (proportion_count > max_proportion_count)
+	{
+		max_proportion_count = proportion_count;
+	}
+}
+
 /** Apply scaling and an offset to ADC sample values so that overflow will
   * be less likely to occur in statistical calculations.
   * \param sample_int The ADC sample number.
@@ -175,101 +341,133 @@ fix16_t scaleSample(int sample_int)
 	return r;
 }
 
-/** This must be called whenever the iterator is active and #iterator_index
-  * changes. */
-static void updateIteratorCache(void)
-{
-	cached_histogram_count = getHistogram(iterator_index);
-	cached_scaled_sample = scaleSample((int)iterator_index);
-}
-
-/** Reset the histogram iterator back to the start. */
-static void resetIterator(void)
-{
-	iterator_index = 0;
-	iterator_count = 0;
-	updateIteratorCache();
-}
-
-/** Uses an iterator over the histogram to obtain one term in a central
-  * moment calculation. The iterator goes over each item (count) from each
-  * histogram bin (index).
-  * \param mean The mean to calculate the central moment about.
-  * \param power Which central moment to calculate (1 = first, 2 = second
-  *              etc.). This must be positive and non-zero.
-  * \return One term for the calculation of the specified central moment.
+/** Convert a sum of (sample - pivot) ^ power terms, where samples are in ADC
+  * output numbers, into the average of those terms, expressed in the same
+  * units as the result of scaleSample().
+  * \param sum The sum of terms.
+  * \param power The power each term was raised to. This must be positive and
+  *              non-zero.
+  * \return The average, in Q16.16 fixed-point representation. If the average
+  *         doesn't fit, #fix16_error_occurred will be set.
   */
-static fix16_t getTermFromIterator(fix16_t mean, uint32_t power)
+static fix16_t sumToScaledAverage(int64_t sum, uint32_t power)
 {
 	uint32_t i;
-	fix16_t scaled_sample;
-	fix16_t r;
-
-	// Search for the index (bin number) of the next count.
-	while (iterator_count >= cached_histogram_count)
+	int64_t divisor;
+	int64_t r;
+
+	// Since SAMPLE_COUNT and SAMPLE_SCALE_DOWN are both powers of 2, so
+	// is divisor. The ">> 16" converts to Q16.16 representation.
+#if (SAMPLE_COUNT * SAMPLE_SCALE_DOWN) < 65536
+#error "SAMPLE_COUNT * SAMPLE_SCALE_DOWN too small"
+#endif // #if (SAMPLE_COUNT * SAMPLE_SCALE_DOWN) < 65536
+	divisor = SAMPLE_COUNT;
+	for (i = 0; i < power; i++)
 	{
-		iterator_count = 0;
-		iterator_index++;
-		if (iterator_index >= HISTOGRAM_NUM_BINS)
-		{
-			// Iterator ran past end of samples. This should never happen.
-			fix16_error_occurred = true;
-			return fix16_zero;
-		}
-		updateIteratorCache();
+		divisor *= SAMPLE_SCALE_DOWN;
 	}
-
-	iterator_count++;
-	scaled_sample = fix16_sub(cached_scaled_sample, mean);
-	r = scaled_sample;
-	for (i = 1; i < power; i++)
+	r = sum / (divisor >> 16);
+	if ((r > (int64_t)fix16_maximum) || (r < (int64_t)fix16_minimum))
 	{
-		r = fix16_mul(r, scaled_sample);
+		fix16_error_occurred = true;
+		return fix16_zero;
 	}
-	return r;
+	return (fix16_t)r;
 }
 
-/** Recursive handler for calculateCentralMoment(). Recursion is used to do
-  * pairwise averaging. Pairwise averaging is just like pairwise summation,
-  * except there's a divide by 2 after each sum.
-  * Why do pairwise averaging? So that overflow is less likely to occur.
-  * \param mean The mean to calculate the central moment about.
-  * \param power Which central moment to calculate (1 = first, 2 = second
-  *              etc.).
-  * \param level The number of terms to use in the estimation of the central
-  *              moment.
-  * \return An estimate of the value of the specified central moment.
+/** Examines the histogram and calculates its mean and 2nd, 3rd and 4th
+  * central moments, all in one pass over the histogram.
+  *
+  * The pass accumulates raw power sums (of sample values measured from the
+  * centre of the ADC range) as exact 64 bit integers. These are shifted to
+  * be about an integer pivot close to the mean, which is also exact, and only
+  * then converted to fixed-point and adjusted to be about the mean itself.
+  * Doing it in that order avoids the catastrophic cancellation that would
+  * occur if the central moments were derived directly from raw moments in
+  * fixed-point.
+  *
+  * All results are in the same units as the result of scaleSample(). If an
+  * arithmetic error occurs, #fix16_error_occurred will be set.
+  * \param out_mean The mean will be written here.
+  * \param out_variance The variance (2nd central moment) will be
+  *                     written here.
+  * \param out_kappa3 The 3rd central moment (non-standardised skewness) will
+  *                   be written here.
+  * \param out_kappa4 The 4th central moment (non-standardised kurtosis) will
+  *                   be written here.
   */
-static fix16_t calculateCentralMomentRecursive(fix16_t mean, uint32_t power, uint32_t level)
+void calculateCentralMoments(fix16_t *out_mean, fix16_t *out_variance, fix16_t *out_kappa3, fix16_t *out_kappa4)
 {
-	fix16_t term1;
-	fix16_t term2;
+	uint32_t i;
+	uint32_t count;
+	int64_t d;
+	int64_t term;
+	int64_t pivot;
+	int64_t sum1;
+	int64_t sum2;
+	int64_t sum3;
+	int64_t sum4;
+	int64_t shifted_sum2;
+	int64_t shifted_sum3;
+	int64_t shifted_sum4;
+	fix16_t e; // mean - pivot
+	fix16_t e_squared;
+	fix16_t moment2;
+	fix16_t moment3;
+	fix16_t moment4;
+	fix16_t r;
 
-	if (level <= 2)
-	{
-		term1 = getTermFromIterator(mean, power);
-		term2 = getTermFromIterator(mean, power);
-	}
-	else
+	// Worst case: every sample is at the edge of the ADC range. Then
+	// sum4 = SAMPLE_COUNT * (HISTOGRAM_NUM_BINS / 2) ^ 4, which is about
+	// 2 ^ 48, so none of the sums below can overflow.
+	sum1 = 0;
+	sum2 = 0;
+	sum3 = 0;
+	sum4 = 0;
+	for (i = 0; i < HISTOGRAM_NUM_BINS; i++)
 	{
-		term1 = calculateCentralMomentRecursive(mean, power, level >> 1);
-		term2 = calculateCentralMomentRecursive(mean, power, level >> 1);
+		count = getHistogram(i);
+		if (count != 0)
+		{
+			d = (int64_t)i - (HISTOGRAM_NUM_BINS / 2); // centre ADC range on 0
+			term = (int64_t)count * d;
+			sum1 += term;
+			term *= d;
+			sum2 += term;
+			term *= d;
+			sum3 += term;
+			term *= d;
+			sum4 += term;
+		}
 	}
-	return fix16_mul(fix16_add(term1, term2), FIX16_RECIPROCAL_OF(2));
-}
 
-/** Examines the histogram and calculates a central moment from it. This does
-  * require the mean to be known. If the mean is not known, it can be
-  * calculated using this function by passing mean = 0.0 and power = 1.
-  * \param mean The mean to calculate the central moment about.
-  * \param power Which central moment to calculate (1 = first, 2 = second
-  *              etc.).
-  * \return The value of the specified central moment
-  */
-fix16_t calculateCentralMoment(fix16_t mean, uint32_t power)
-{
-	resetIterator();
-	return calculateCentralMomentRecursive(mean, power, SAMPLE_COUNT);
+	// Shift the sums so that they are about pivot instead of 0, using the
+	// binomial theorem. This is exact.
+	pivot = sum1 / SAMPLE_COUNT;
+	shifted_sum2 = sum2 - 2 * pivot * sum1 + pivot * pivot * SAMPLE_COUNT;
+	shifted_sum3 = sum3 - 3 * pivot * sum2 + 3 * pivot * pivot * sum1
+		- pivot * pivot * pivot * SAMPLE_COUNT;
+	shifted_sum4 = sum4 - 4 * pivot * sum3 + 6 * pivot * pivot * sum2
+		- 4 * pivot * pivot * pivot * sum1
+		+ pivot * pivot * pivot * pivot * SAMPLE_COUNT;
+
+	// The moments about pivot are now small enough to convert to
+	// fixed-point. Use them to get the moments about the mean.
+	e = sumToScaledAverage(sum1 - pivot * SAMPLE_COUNT, 1);
+	moment2 = sumToScaledAverage(shifted_sum2, 2);
+	moment3 = sumToScaledAverage(shifted_sum3, 3);
+	moment4 = sumToScaledAverage(shifted_sum4, 4);
+	e_squared = fix16_sq(e);
+	*out_mean = fix16_add(scaleSample((int)pivot + (HISTOGRAM_NUM_BINS / 2)), e);
+	// variance = moment2 - e ^ 2
+	*out_variance = fix16_sub(moment2, e_squared);
+	// kappa3 = moment3 - 3 * e * moment2 + 2 * e ^ 3
+	r = fix16_sub(moment3, fix16_mul(fix16_from_int(3), fix16_mul(e, moment2)));
+	*out_kappa3 = fix16_add(r, fix16_mul(fix16_from_int(2), fix16_mul(e_squared, e)));
+	// kappa4 = moment4 - 4 * e * moment3 + 6 * e ^ 2 * moment2 - 3 * e ^ 4
+	r = fix16_sub(moment4, fix16_mul(fix16_from_int(4), fix16_mul(e, moment3)));
+	r = fix16_add(r, fix16_mul(fix16_from_int(6), fix16_mul(e_squared, moment2)));
+	*out_kappa4 = fix16_sub(r, fix16_mul(fix16_from_int(3), fix16_sq(e_squared)));
 }
 
 /** Obtains an estimate of the (Shannon) entropy per sample, based on the
@@ -299,6 +497,63 @@ fix16_t estimateEntropy(void)
 	return sum;
 }
 
+/** Obtains an estimate of the min-entropy per sample, based on the
+  * histogram. Min-entropy only depends on the probability of the most
+  * common value, so it is never more than the (Shannon) entropy estimate
+  * returned by estimateEntropy(). It is the measure which matters for
+  * entropy extraction, since it bounds how well an attacker can guess
+  * samples.
+  * \return The value of the estimate, in bits per sample.
+  */
+fix16_t estimateMinEntropy(void)
+{
+	uint32_t i;
+	uint32_t count;
+	uint32_t max_count;
+	fix16_t term;
+
+	max_count = 0;
+	for (i = 0; i < HISTOGRAM_NUM_BINS; i++)
+	{
+		count = getHistogram(i);
+		if (count > max_count)
+		{
+			max_count = count;
+		}
+	}
+	if (max_count == 0)
+	{
+		return fix16_zero; // empty histogram
+	}
+	// Definition of min-entropy: H_min(X) = -log(max(p(x_i))).
+	term = fix16_mul(fix16_from_int((int)max_count), FIX16_RECIPROCAL_OF(SAMPLE_COUNT));
+	return fix16_sub(fix16_zero, fix16_log2(term));
+}
+
+/** Scale a per-sample entropy estimate by the fraction of the spectrum (up
+  * to the Nyquist frequency) which the HWRNG signal occupies. The histogram
+  * doesn't know anything about sample order, so histogram-based estimates
+  * assume that samples are independent. If the signal is narrower than the
+  * Nyquist frequency, consecutive samples are correlated and each one
+  * contributes proportionally less new information.
+  * \param entropy The per-sample entropy estimate, in bits.
+  * \param bandwidth The bandwidth of the HWRNG signal, in number of FFT bins
+  *                  (as used for #psd_accumulator).
+  * \return The scaled estimate, in bits per sample.
+  */
+fix16_t scaleEntropyByBandwidth(fix16_t entropy, int bandwidth)
+{
+	if (bandwidth < 0)
+	{
+		bandwidth = 0;
+	}
+	if (bandwidth > FFT_SIZE)
+	{
+		bandwidth = FFT_SIZE;
+	}
+	return fix16_mul(entropy, fix16_mul(fix16_from_int(bandwidth), FIX16_RECIPROCAL_OF(FFT_SIZE)));
+}
+
 /** Subtract the mean off every input value in a FFT buffer. Both real and
   * imaginary components are considered in the calculation of the mean, and
   * both real and imaginary components are affected by the subtraction. Thus
@@ -330,8 +585,99 @@ void clearPowerSpectralDensity(void)
 {
 	memset(psd_accumulator, 0, sizeof(psd_accumulator));
 	psd_accumulator_error_occurred = false;
+#ifdef PSD_INTEGER_ACCUMULATE
+	psd_accumulator_bound = 0;
+#endif // #ifdef PSD_INTEGER_ACCUMULATE
 }
 
+#ifdef PSD_INTEGER_ACCUMULATE
+
+/** Magnitude of a fix16_t value, as an unsigned integer. This works even
+  * for the most negative fix16_t value.
+  * \param x The value to get the magnitude of.
+  * \return |x| * 65536.
+  */
+static uint32_t fix16Magnitude(fix16_t x)
+{
+	if (x < 0)
+	{
+		return 0 - (uint32_t)x;
+	}
+	else
+	{
+		return (uint32_t)x;
+	}
+}
+
+/** Accumulate the squared magnitudes of FFT results into #psd_accumulator,
+  * using integer arithmetic. This does the same thing as the
+  * accumulation loop in accumulatePowerSpectralDensity(), but all FFT
+  * results share one scale factor (they are all shifted right by the same
+  * amount), chosen so that each squared magnitude fits in 32 bits. Thus
+  * the inner loop needs no saturation or overflow checks.
+  * \param fft_buffer The post-processed result of a double-size real FFT.
+  *                   This must have #FFT_SIZE + 1 entries.
+  */
+static void accumulateSquaredMagnitudes(ComplexFixed *fft_buffer)
+{
+	uint32_t i;
+	uint32_t all_magnitudes;
+	uint32_t real_magnitude;
+	uint32_t imag_magnitude;
+	uint32_t sum_of_squares;
+	uint32_t bound;
+	unsigned int block_shift;
+	unsigned int result_shift;
+
+	// The block exponent only needs to be right to within a bit, so OR-ing
+	// all magnitudes together is good enough to find it.
+	all_magnitudes = 0;
+	for (i = 0; i < (FFT_SIZE + 1); i++)
+	{
+		all_magnitudes |= fix16Magnitude(fft_buffer[i].real);
+		all_magnitudes |= fix16Magnitude(fft_buffer[i].imag);
+	}
+	// Shift everything right until magnitudes fit in 15 bits. Then the sum
+	// of two squared magnitudes always fits in 31 bits.
+	block_shift = 0;
+	while ((all_magnitudes >> block_shift) >= 0x8000)
+	{
+		block_shift++;
+	}
+	// The fix16 version scales each term by 1 / 8 before squaring (that's a
+	// factor of 2 ^ -6) and squares a Q16.16 number (that's another
+	// 2 ^ -16). Squaring also squares the block scale factor.
+	if ((2 * block_shift) > (6 + 16))
+	{
+		// The result would have overflowed anyway.
+		psd_accumulator_error_occurred = true;
+		return;
+	}
+	result_shift = (6 + 16) - (2 * block_shift);
+
+	// See accumulatePowerSpectralDensity() for why the result is scaled
+	// down by SAMPLE_COUNT / 512.
+	bound = (all_magnitudes >> block_shift) * (all_magnitudes >> block_shift);
+	bound = ((bound >> result_shift) * 2) / (SAMPLE_COUNT / 512);
+	if (bound > (0x7fffffff - psd_accumulator_bound))
+	{
+		psd_accumulator_error_occurred = true;
+		return;
+	}
+	psd_accumulator_bound += bound;
+
+	for (i = 0; i < (FFT_SIZE + 1); i++)
+	{
+		real_magnitude = fix16Magnitude(fft_buffer[i].real) >> block_shift;
+		imag_magnitude = fix16Magnitude(fft_buffer[i].imag) >> block_shift;
+		sum_of_squares = (real_magnitude * real_magnitude) + (imag_magnitude * imag_magnitude);
+		sum_of_squares = (sum_of_squares >> result_shift) / (SAMPLE_COUNT / 512);
+		psd_accumulator[i] += (fix16_t)sum_of_squares;
+	}
+}
+
+#endif // #ifdef PSD_INTEGER_ACCUMULATE
+
 /** Calculate (an estimate of) the power spectral density of a bunch of
   * time-domain samples. The result will be accumulated in #psd_accumulator.
   * \param source_buffer The array of time-domain samples to calculate the
@@ -343,9 +689,11 @@ void accumulatePowerSpectralDensity(volatile uint16_t *source_buffer)
 	uint32_t i;
 	uint32_t index;
 	fix16_t scaled_sample;
+#ifndef PSD_INTEGER_ACCUMULATE
 	fix16_t term1;
 	fix16_t term2;
 	fix16_t sum_of_squares;
+#endif // #ifndef PSD_INTEGER_ACCUMULATE
 	ComplexFixed fft_buffer[FFT_SIZE + 1];
 
 	// Fill FFT buffer with entire contents of ADC sample data.
@@ -380,23 +728,26 @@ void accumulatePowerSpectralDensity(volatile uint16_t *source_buffer)
 	{
 		psd_accumulator_error_occurred = true;
 	}
+#if SAMPLE_COUNT < 512
+#error "SAMPLE_COUNT too small (it's < 512)"
+#endif // #if SAMPLE_COUNT < 512
+#ifdef PSD_INTEGER_ACCUMULATE
+	accumulateSquaredMagnitudes(fft_buffer);
+#else
 	fix16_error_occurred = false;
 	for (i = 0; i < (FFT_SIZE + 1); i++)
 	{
 		// Rescale terms to make overflow less likely when squaring them.
 		term1 = fix16_mul(fft_buffer[i].real, FIX16_RECIPROCAL_OF(8));
-		term1 = fix16_mul(term1, term1);
+		term1 = fix16_sq(term1);
 		term2 = fix16_mul(fft_buffer[i].imag, FIX16_RECIPROCAL_OF(8));
-		term2 = fix16_mul(term2, term2);
+		term2 = fix16_sq(term2);
 		sum_of_squares = fix16_add(term1, term2);
 		// PSD is scaled down according to the number of samples. This
 		// will normalise the result, since total power scales as the
 		// number of samples.
 		// Since FIX16_RECIPROCAL_OF expects an integer, SAMPLE_COUNT must
 		// be >= 512.
-#if SAMPLE_COUNT < 512
-#error "SAMPLE_COUNT too small (it's < 512)"
-#endif // #if SAMPLE_COUNT < 512
 		sum_of_squares = fix16_mul(sum_of_squares, FIX16_RECIPROCAL_OF(SAMPLE_COUNT / 512));
 		psd_accumulator[i] = fix16_add(psd_accumulator[i], sum_of_squares);
 	}
@@ -404,6 +755,7 @@ void accumulatePowerSpectralDensity(volatile uint16_t *source_buffer)
 	{
 		psd_accumulator_error_occurred = true;
 	}
+#endif // #ifdef PSD_INTEGER_ACCUMULATE
 }
 
 /** Calculate the (cyclic) autocorrelation by using the power spectral density
@@ -19,7 +19,9 @@
 #define HISTOGRAM_NUM_BINS			1024
 /** Number of bits of storage space allocated to each histogram bin. The
   * maximum value of each bin is limited by this, so this should be
-  * large enough to store the maximum expected histogram count.
+  * large enough to store the maximum expected histogram count. This is
+  * ignored if HISTOGRAM_UNPACKED is defined, since each bin then gets
+  * 16 bits.
   */
 #define	BITS_PER_HISTOGRAM_BIN		11
 
@@ -37,17 +39,61 @@
   *          macro is used to replace division with multiplication.
   */
 #define SAMPLE_SCALE_DOWN			64
+/** Size (in number of samples) of the windows used by the adaptive
+  * proportion test (see updateHealthTests()). This is the window size that
+  * NIST SP 800-90B recommends for non-binary noise sources.
+  */
+#define PROPORTION_WINDOW_SIZE		512
+
+#ifdef STATISTICS_BORROWED_BUFFERS
+
+/** The large buffers used by the statistical tests. Normally these are
+  * statically allocated in statistics.c, but if STATISTICS_BORROWED_BUFFERS
+  * is defined, the caller provides them by setting #statistics_buffers
+  * before calling clearHistogram() and clearPowerSpectralDensity(). They
+  * only need to exist between then and the point where the last test
+  * result has been calculated, so the memory can be lent to something else
+  * in between batches of samples.
+  */
+typedef struct StatisticsBuffersStruct
+{
+#ifdef HISTOGRAM_UNPACKED
+	/** Histogram counts, one bin per entry. */
+	uint16_t histogram[HISTOGRAM_NUM_BINS];
+#else
+	/** Bit-packed histogram counts. */
+	uint32_t packed_histogram[((HISTOGRAM_NUM_BINS * BITS_PER_HISTOGRAM_BIN) / 32) + 1];
+#endif // #ifdef HISTOGRAM_UNPACKED
+	/** Power spectral density estimate. */
+	fix16_t psd[FFT_SIZE + 1];
+} StatisticsBuffers;
+
+extern StatisticsBuffers *statistics_buffers;
+
+/** The power spectral density estimate is used directly by the HWRNG code,
+  * so it keeps its usual name. */
+#define psd_accumulator		(statistics_buffers->psd)
+
+#endif // #ifdef STATISTICS_BORROWED_BUFFERS
 
 extern bool histogram_overflow_occurred;
+extern uint32_t max_repetition_count;
+extern uint32_t max_proportion_count;
 extern uint32_t samples_in_histogram;
+#ifndef STATISTICS_BORROWED_BUFFERS
 extern fix16_t psd_accumulator[FFT_SIZE + 1];
+#endif // #ifndef STATISTICS_BORROWED_BUFFERS
 extern bool psd_accumulator_error_occurred;
 
 extern void clearHistogram(void);
 extern void incrementHistogram(uint32_t index);
+extern void clearHealthTests(void);
+extern void updateHealthTests(uint32_t sample);
 extern fix16_t scaleSample(int sample_int);
-extern fix16_t calculateCentralMoment(fix16_t mean, uint32_t power);
+extern void calculateCentralMoments(fix16_t *out_mean, fix16_t *out_variance, fix16_t *out_kappa3, fix16_t *out_kappa4);
 extern fix16_t estimateEntropy(void);
+extern fix16_t estimateMinEntropy(void);
+extern fix16_t scaleEntropyByBandwidth(fix16_t entropy, int bandwidth);
 extern void subtractMeanFromFftBuffer(ComplexFixed *fft_buffer);
 extern void clearPowerSpectralDensity(void);
 extern void accumulatePowerSpectralDensity(volatile uint16_t *source_buffer);
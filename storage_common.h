@@ -26,5 +26,11 @@
 #define ADDRESS_POOL_CHECKSUM	96
 /** Address where device UUID is located. */
 #define ADDRESS_DEVICE_UUID		128
+/** Address of the marker which indicates that sanitiseEverything() was
+  * started but may not have finished.
+  * \warning This must be at least #UUID_LENGTH bytes beyond
+  *          #ADDRESS_DEVICE_UUID.
+  */
+#define ADDRESS_SANITISE_MARKER	144
 
 #endif // #ifndef STORAGE_COMMON_H_INCLUDED
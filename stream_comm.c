@@ -40,21 +40,48 @@
 #include "pb_encode.h"
 #include "messages.pb.h"
 #include "sha256.h"
+#include "bip32.h"
 #include "transaction.h"
+#include "profile.h"
+#include "trace.h"
+#include "pc_sampling.h"
 
 #ifdef TEST_STREAM_COMM
 #include "test_helpers.h"
 #endif // #ifdef TEST_STREAM_COMM
 
+#if defined(TEST) && (defined(STREAM_COMM_PROFILE) || defined(PBKDF2_CALIBRATE))
+#include <time.h>
+#endif // #if defined(TEST) && (defined(STREAM_COMM_PROFILE) || defined(PBKDF2_CALIBRATE))
+
 // Prototypes for forward-referenced functions.
 bool mainInputStreamCallback(pb_istream_t *stream, uint8_t *buf, size_t count);
 bool mainOutputStreamCallback(pb_ostream_t *stream, const uint8_t *buf, size_t count);
 static void writeFailureString(StringSet set, uint8_t spec);
+static void translateWalletError(WalletErrors r);
 bool hashFieldCallback(pb_istream_t *stream, const pb_field_t *field, void **arg);
 
 /** Maximum size (in bytes) of any protocol buffer message sent by functions
-  * in this file. */
-#define MAX_SEND_SIZE			255
+  * in this file. This must be large enough for an Addresses message
+  * containing #ECDSA_MAX_BATCH_SIZE addresses. */
+#define MAX_SEND_SIZE			1024
+
+/** Maximum number of bytes of entropy which can be requested in one
+  * GetEntropy message. This leaves room in a message of size
+  * #MAX_SEND_SIZE for the field tag and length prefix. */
+#define MAX_ENTROPY_BYTES		(MAX_SEND_SIZE - 8)
+
+/** Size (in bytes) of the RAM buffer which sendPacket() encodes bounded
+  * messages into. This is large enough for a PingResponse, which is the
+  * largest bounded response apart from Signatures; Signatures responses
+  * go through the two pass path, to keep this buffer's contribution to
+  * stack usage small. */
+#define SEND_BUFFER_SIZE		132
+
+/** Pass this as the max_size parameter of sendPacket() for messages which
+  * have no maximum encoded size, because they contain callback fields or
+  * unbounded repeated fields. */
+#define UNBOUNDED_MESSAGE_SIZE	0xffffffff
 
 /** Union of field buffers for all protocol buffer messages. They're placed
   * in a union to make memory access more efficient, since the functions in
@@ -71,6 +98,8 @@ union MessageBufferUnion
 	GetNumberOfAddresses get_number_of_addresses;
 	NumberOfAddresses number_of_addresses;
 	GetAddressAndPublicKey get_address_and_public_key;
+	GetAddressesAndPublicKeys get_addresses_and_public_keys;
+	Addresses addresses;
 	LoadWallet load_wallet;
 	FormatWalletArea format_wallet_area;
 	ChangeEncryptionKey change_encryption_key;
@@ -84,6 +113,35 @@ union MessageBufferUnion
 	GetEntropy get_entropy;
 	GetMasterPublicKey get_master_public_key;
 	MasterPublicKey master_public_key;
+	SignTransactionChunked sign_transaction_chunked;
+	Address address;
+	Signature signature;
+	Signatures signatures;
+	TrustedInput trusted_input;
+	Entropy entropy;
+	RestoreWalletMnemonic restore_wallet_mnemonic;
+#ifdef STREAM_COMM_PROFILE
+	GetPerformanceCounters get_performance_counters;
+	PerformanceCounters performance_counters;
+#endif // #ifdef STREAM_COMM_PROFILE
+#ifdef STREAM_COMM_LINK_SPEED
+	SetLinkSpeed set_link_speed;
+#endif // #ifdef STREAM_COMM_LINK_SPEED
+#ifdef STREAM_COMM_TRACE
+	GetTrace get_trace;
+	Trace trace;
+#endif // #ifdef STREAM_COMM_TRACE
+#ifdef NV_STATISTICS
+	GetStorageStatistics get_storage_statistics;
+	StorageStatistics storage_statistics;
+#endif // #ifdef NV_STATISTICS
+#ifdef PC_SAMPLING
+	GetPCSamples get_pc_samples;
+	PCSamples pc_samples;
+#endif // #ifdef PC_SAMPLING
+#ifdef WALLET_CONTEXTS
+	SelectWalletContext select_wallet_context;
+#endif // #ifdef WALLET_CONTEXTS
 };
 
 /** Determines the string that writeStringCallback() will write. */
@@ -95,14 +153,56 @@ struct StringSetAndSpec
 	uint8_t next_spec;
 };
 
-/** The transaction hash of the most recently approved transaction. This is
-  * stored so that if a transaction needs to be signed multiple times (eg.
-  * if it has more than one input), the user doesn't have to approve every
-  * one. */
-static uint8_t prev_transaction_hash[32];
-/** false means disregard #prev_transaction_hash, true means
-  * that #prev_transaction_hash is valid. */
-static bool prev_transaction_hash_valid;
+/** Number of approved transaction hashes which are remembered. */
+#define APPROVED_TRANSACTION_SLOTS	4
+
+/** The transaction hashes of the most recently approved transactions, most
+  * recently used first. These are stored so that if a transaction needs to
+  * be signed multiple times (eg. if it has more than one input), the user
+  * doesn't have to approve every one, even if the host interleaves the
+  * signing of several pending transactions. */
+static BigNum256Storage approved_transaction_hashes[APPROVED_TRANSACTION_SLOTS];
+/** Number of valid entries in #approved_transaction_hashes. This is reset
+  * at the start of every session (i.e. whenever an Initialize message is
+  * received), so approvals never outlive the session they were given in. */
+static uint8_t num_approved_transactions;
+
+#ifndef STREAM_COMM_NO_SIGNATURE_CACHE
+/** Number of signatures which are remembered (see #signature_cache). */
+#define SIGNATURE_CACHE_SLOTS		4
+
+#if SIGNATURE_CACHE_SLOTS < MAX_SIGN_INPUTS
+#error "SIGNATURE_CACHE_SLOTS too small for SignTransactionMultiple retries"
+#endif // #if SIGNATURE_CACHE_SLOTS < MAX_SIGN_INPUTS
+
+/** One remembered signature. */
+typedef struct SignatureCacheEntryStruct
+{
+	/** The signature hash which was signed. */
+	uint8_t sig_hash[32];
+	/** The address handle of the key which signed it. */
+	AddressHandle ah;
+	/** Length, in bytes, of #signature. */
+	uint8_t length;
+	/** The signature, as written by signTransaction(). */
+	uint8_t signature[MAX_SIGNATURE_LENGTH];
+} SignatureCacheEntry;
+
+/** The most recently generated signatures. Signatures are deterministic
+  * (see ecdsaSign()), so if the host retries a SignTransaction request
+  * because it didn't get the response (eg. after a USB timeout), the cached
+  * signature can be sent again, instead of deriving the private key and
+  * doing a point multiplication all over again. Signatures aren't secret, so
+  * there's no harm in keeping them around. Entries only make sense for the
+  * wallet which was loaded when they were generated, so this is cleared
+  * (see clearSignatureCache()) whenever the loaded wallet could change. */
+static SignatureCacheEntry signature_cache[SIGNATURE_CACHE_SLOTS];
+/** Number of valid entries in #signature_cache. */
+static uint8_t num_cached_signatures;
+/** Index into #signature_cache of the entry which will be overwritten next,
+  * once the cache is full. */
+static uint8_t next_signature_slot;
+#endif // #ifndef STREAM_COMM_NO_SIGNATURE_CACHE
 
 /** Length of current packet's payload. */
 static uint32_t payload_length;
@@ -114,23 +214,112 @@ static struct StringSetAndSpec string_arg;
 /** Alternate copy of #string_arg, for when more than one string needs to be
   * written. */
 static struct StringSetAndSpec string_arg_alt;
-/** Current number of wallets; used for the listWalletsCallback() callback
-  * function. */
-static uint32_t number_of_wallets;
-/** Pointer to bytes of entropy to send to the host; used for
-  * the getEntropyCallback() callback function. */
-static uint8_t *entropy_buffer;
-/** Number of bytes of entropy to send to the host; used for
-  * the getEntropyCallback() callback function. */
-static size_t num_entropy_bytes;
-/** Storage for fields of SignTransaction message. Needed for the
-  * signTransactionCallback() callback function. */
-static SignTransaction sign_transaction;
+/** Whether transaction data is being read from a chunked upload (see
+  * signTransactionChunked()), instead of straight from the stream. This
+  * isn't in #scratch, because transaction.c asks about it (through
+  * isUploadChunked()) while parsing any transaction. */
+static bool upload_chunked;
+
+/** Memory which is only needed while one packet is being processed. Almost
+  * everything that the functions in this file need while handling a packet
+  * is in here, rather than having a variable of its own (sized for the
+  * worst case) or being on the stack. Only one packet is processed at a time,
+  * so each packet's requirements can share the same memory. processPacket()
+  * clears this before every packet, so nothing (eg. transaction data or a
+  * mnemonic) from one packet is left lying around for the next. */
+typedef struct PacketScratchStruct
+{
+	/** The request message being handled by processPacket(), and then the
+	  * response to it. Functions which build a response after
+	  * processPacket() has finished with the request (eg.
+	  * getBytesOfEntropy()) also put it here, instead of on the stack. */
+	union MessageBufferUnion message;
+	/** State for callback functions, which is needed while #message (or
+	  * a transaction) is being decoded or encoded. Which member is valid
+	  * depends on the packet type. */
+	union PacketStateUnion
+	{
+		/** Storage for fields of SignTransaction message. Needed for the
+		  * signTransactionCallback() callback function. */
+		SignTransaction sign_transaction;
+		/** Storage for fields of SignTransactionMultiple message. Needed for
+		  * the signTransactionMultipleCallback() callback function. */
+		SignTransactionMultiple sign_transaction_multiple;
+		/** Storage for fields of GetTrustedInput message. Needed for the
+		  * getTrustedInputCallback() callback function. */
+		GetTrustedInput get_trusted_input;
+		/** Current number of wallets; used for the listWalletsCallback()
+		  * callback function. */
+		uint32_t number_of_wallets;
+		/** Range of addresses to send; used for the getAddressesCallback()
+		  * callback function and sendAddressRecords(). */
+		struct
+		{
+			/** First address handle of the range. */
+			AddressHandle start;
+			/** Number of addresses in the range. */
+			uint8_t count;
+		} address_range;
+		/** Entropy to send; used for the getEntropyCallback() callback
+		  * function. */
+		struct
+		{
+			/** The first 32 bytes of entropy to send to the host. */
+			uint8_t first_chunk[32];
+			/** Number of bytes of entropy to send to the host. */
+			uint32_t num_bytes;
+		} entropy;
+		/** State of the current chunked upload (see
+		  * signTransactionChunked()). */
+		struct
+		{
+			/** Whether the host abandoned the upload, by sending something
+			  * other than a valid TransactionChunk message. */
+			bool aborted;
+			/** Total length, in bytes, of the transaction data. */
+			uint32_t length;
+			/** Offset (from the start of the transaction data) of the next
+			  * byte. */
+			uint32_t offset;
+			/** Number of bytes of the current chunk which haven't been
+			  * read yet. These are still in the stream. */
+			uint32_t chunk_left;
+			/** Bytes borrowed by uploadBorrowBytes(), so that
+			  * uploadReleaseBytes() can hash them. */
+			const uint8_t *borrowed;
+			/** SHA-256 of the transaction data received so far. The host
+			  * uses this to check that the device received what it was
+			  * sent. */
+			HashState hs;
+		} upload;
+	} state;
+} PacketScratch;
+
+/** See #PacketScratch. */
+static PacketScratch scratch;
 /** Double SHA-256 of a field parsed by hashFieldCallback(). */
 static uint8_t field_hash[32];
 /** Whether #field_hash has been set. */
 static bool field_hash_set;
 
+/** Whether the host asked (in the most recent Initialize message) for
+  * Addresses and Signatures responses to be sent as fixed-layout binary
+  * records. See sendAddressRecords() and sendSignatureRecords(). */
+static bool compact_records;
+
+#if defined(BACKGROUND_TASKS) && !defined(WALLET_NO_ADDRESS_CACHE)
+/** Address handle which the host is expected to ask about next, or 0 if
+  * there's no prediction. Hosts nearly always go through address handles
+  * in order, so after an address is sent, the next one is precomputed
+  * by precomputeAddressTask() while waiting for the next packet. This is
+  * cleared at the start of every packet, so any new command cancels a
+  * precomputation which hasn't started yet. */
+static AddressHandle predicted_address_handle;
+/** Whether processPacket() is waiting for the header of the next packet.
+  * Only then is it safe for precomputeAddressTask() to use the wallet. */
+static bool waiting_for_packet;
+#endif // #if defined(BACKGROUND_TASKS) && !defined(WALLET_NO_ADDRESS_CACHE)
+
 /** Number of valid bytes in #session_id. */
 static size_t session_id_length;
 /** Arbitrary host-supplied bytes which are sent to the host to assure it that
@@ -150,6 +339,173 @@ pb_ostream_t main_output_stream = {&mainOutputStreamCallback, NULL, 0, 0, NULL};
 static char test_otp[OTP_LENGTH] = {'1', '2', '3', '4', '\0'};
 #endif // #ifdef TEST_STREAM_COMM
 
+#if defined(CHECK_STACK_USAGE) && !defined(STREAM_COMM_PROFILE)
+#error "CHECK_STACK_USAGE requires STREAM_COMM_PROFILE"
+#endif
+#if defined(NV_STATISTICS) && !defined(STREAM_COMM_PROFILE)
+#error "NV_STATISTICS requires STREAM_COMM_PROFILE"
+#endif
+#if defined(PC_SAMPLING) && !defined(STREAM_COMM_PROFILE)
+#error "PC_SAMPLING requires STREAM_COMM_PROFILE"
+#endif
+
+#ifdef STREAM_COMM_PROFILE
+/** Number of packet types which have performance counters. All request
+  * packet types are below this. */
+#define PROFILE_PACKET_TYPES	(PACKET_TYPE_GET_TRACE + 1)
+
+/** Performance counters for one request packet type. */
+typedef struct PacketProfileStruct
+{
+	/** Number of requests of this type which were processed. */
+	uint32_t count;
+	/** Cumulative cycles spent in each category, indexed
+	  * by #ProfileCategoryEnum. */
+	uint64_t category_cycles[PROFILE_CATEGORY_COUNT];
+	/** Longest time (in cycles) spent processing one request. */
+	uint32_t max_cycles;
+#ifdef CHECK_STACK_USAGE
+	/** Most stack space (in bytes) used while processing one request. */
+	uint32_t max_stack_bytes;
+#endif // #ifdef CHECK_STACK_USAGE
+} PacketProfile;
+
+/** Performance counters for each request packet type, indexed by packet
+  * type. */
+static PacketProfile packet_profiles[PROFILE_PACKET_TYPES];
+/** Cycles spent in each category during the current request, indexed
+  * by #ProfileCategoryEnum. */
+static uint64_t current_category_cycles[PROFILE_CATEGORY_COUNT];
+/** The category time is currently being attributed to. */
+static ProfileCategory current_profile_category;
+/** Value of getCycleCount() when #current_profile_category was last
+  * changed. */
+static uint32_t profile_last_count;
+/** Whether all performance counters should be cleared once the current
+  * request has been processed. */
+static bool profile_reset_pending;
+
+/** Maximum nesting depth of PROFILE_ENTER() which is tracked. */
+#define PROFILE_STACK_SIZE		8
+
+/** Categories which were active before each unmatched PROFILE_ENTER(),
+  * innermost last. */
+static ProfileCategory profile_stack[PROFILE_STACK_SIZE];
+/** Number of unmatched PROFILE_ENTER()s. This can be larger
+  * than #PROFILE_STACK_SIZE, in which case the innermost ones aren't
+  * attributed properly. */
+static uint8_t profile_depth;
+
+/** Attribute time since the last category change to the current category,
+  * then change the current category.
+  * \param category The new category (one of #ProfileCategoryEnum).
+  */
+static void profileSwitch(ProfileCategory category)
+{
+	uint32_t now;
+
+	now = getCycleCount();
+	current_category_cycles[current_profile_category] += (uint32_t)(now - profile_last_count);
+	profile_last_count = now;
+	current_profile_category = category;
+}
+
+/** Start attributing time to a category. Use the PROFILE_ENTER() macro in
+  * profile.h instead of calling this directly.
+  * \param category One of #ProfileCategoryEnum.
+  */
+void profileEnter(ProfileCategory category)
+{
+	if (profile_depth < PROFILE_STACK_SIZE)
+	{
+		profile_stack[profile_depth] = current_profile_category;
+		profileSwitch(category);
+	}
+	if (profile_depth < 0xff)
+	{
+		profile_depth++;
+	}
+}
+
+/** Go back to the category which was active before the matching
+  * profileEnter(). Use the PROFILE_EXIT() macro in profile.h instead of
+  * calling this directly. */
+void profileExit(void)
+{
+	if (profile_depth > 0)
+	{
+		profile_depth--;
+		if (profile_depth < PROFILE_STACK_SIZE)
+		{
+			profileSwitch(profile_stack[profile_depth]);
+		}
+	}
+}
+
+/** Start measuring the time spent processing a request. This should be
+  * called once the request's packet header has been received, so that time
+  * spent waiting for the host to send something isn't counted.
+  */
+static void profilePacketBegin(void)
+{
+	memset(current_category_cycles, 0, sizeof(current_category_cycles));
+	current_profile_category = PROFILE_OTHER;
+	profile_depth = 0;
+#ifdef CHECK_STACK_USAGE
+	paintStack();
+#endif // #ifdef CHECK_STACK_USAGE
+	profile_last_count = getCycleCount();
+}
+
+/** Finish measuring the time spent processing a request and add it to
+  * the performance counters for the request's packet type.
+  * \param message_id The packet type of the request.
+  */
+static void profilePacketEnd(uint16_t message_id)
+{
+	PacketProfile *profile;
+	uint64_t total;
+	uint8_t i;
+#ifdef CHECK_STACK_USAGE
+	uint32_t stack_bytes;
+
+	stack_bytes = getStackUsage();
+#endif // #ifdef CHECK_STACK_USAGE
+
+	profileSwitch(PROFILE_OTHER);
+	if (message_id < PROFILE_PACKET_TYPES)
+	{
+		profile = &(packet_profiles[message_id]);
+		total = 0;
+		for (i = 0; i < PROFILE_CATEGORY_COUNT; i++)
+		{
+			profile->category_cycles[i] += current_category_cycles[i];
+			total += current_category_cycles[i];
+		}
+		if (total > 0xffffffff)
+		{
+			total = 0xffffffff;
+		}
+		if ((uint32_t)total > profile->max_cycles)
+		{
+			profile->max_cycles = (uint32_t)total;
+		}
+#ifdef CHECK_STACK_USAGE
+		if (stack_bytes > profile->max_stack_bytes)
+		{
+			profile->max_stack_bytes = stack_bytes;
+		}
+#endif // #ifdef CHECK_STACK_USAGE
+		profile->count++;
+	}
+	if (profile_reset_pending)
+	{
+		memset(packet_profiles, 0, sizeof(packet_profiles));
+		profile_reset_pending = false;
+	}
+}
+#endif // #ifdef STREAM_COMM_PROFILE
+
 /** Read bytes from the stream.
   * \param buffer The byte array where the bytes will be placed. This must
   *               have enough space to store length bytes.
@@ -157,12 +513,9 @@ static char test_otp[OTP_LENGTH] = {'1', '2', '3', '4', '\0'};
   */
 static void getBytesFromStream(uint8_t *buffer, uint8_t length)
 {
-	uint8_t i;
-
-	for (i = 0; i < length; i++)
-	{
-		buffer[i] = streamGetOneByte();
-	}
+	PROFILE_ENTER(PROFILE_STREAM_IO);
+	streamGetBytes(buffer, length);
+	PROFILE_EXIT();
 	payload_length -= length;
 }
 
@@ -172,15 +525,12 @@ static void getBytesFromStream(uint8_t *buffer, uint8_t length)
   */
 static void writeBytesToStream(const uint8_t *buffer, size_t length)
 {
-	size_t i;
-
-	for (i = 0; i < length; i++)
-	{
-		streamPutOneByte(buffer[i]);
-	}
+	PROFILE_ENTER(PROFILE_STREAM_IO);
+	streamPutBytes(buffer, (uint32_t)length);
+	PROFILE_EXIT();
 }
 
-/** nanopb input stream callback which uses streamGetOneByte() to get the
+/** nanopb input stream callback which uses streamGetBytes() to get the
   * requested bytes.
   * \param stream Input stream object that issued the callback.
   * \param buf Buffer to fill with requested bytes.
@@ -189,27 +539,33 @@ static void writeBytesToStream(const uint8_t *buffer, size_t length)
   */
 bool mainInputStreamCallback(pb_istream_t *stream, uint8_t *buf, size_t count)
 {
-	size_t i;
+	bool r;
+	PROFILE_ENTER(PROFILE_STREAM_IO);
 
 	if (buf == NULL)
 	{
 		fatalError(); // this should never happen
 	}
-	for (i = 0; i < count; i++)
+	if (count > payload_length)
 	{
-		if (payload_length == 0)
-		{
-			// Attempting to read past end of payload.
-			stream->bytes_left = 0;
-			return false;
-		}
-		buf[i] = streamGetOneByte();
-		payload_length--;
+		// Attempting to read past end of payload. Everything up to the end
+		// of the payload is still consumed, so that the stream stays in sync.
+		streamGetBytes(buf, payload_length);
+		payload_length = 0;
+		stream->bytes_left = 0;
+		r = false;
 	}
-	return true;
+	else
+	{
+		streamGetBytes(buf, (uint32_t)count);
+		payload_length -= (uint32_t)count;
+		r = true;
+	}
+	PROFILE_EXIT();
+	return r;
 }
 
-/** nanopb output stream callback which uses streamPutOneByte() to send a byte
+/** nanopb output stream callback which uses streamPutBytes() to send a byte
   * buffer.
   * \param stream Output stream object that issued the callback.
   * \param buf Buffer with bytes to send.
@@ -229,13 +585,17 @@ bool mainOutputStreamCallback(pb_ostream_t *stream, const uint8_t *buf, size_t c
   */
 static void readAndIgnoreInput(void)
 {
-	if (payload_length > 0)
+	uint8_t buffer[32];
+	uint32_t chunk_length;
+	PROFILE_ENTER(PROFILE_STREAM_IO);
+
+	while (payload_length > 0)
 	{
-		for (; payload_length > 0; payload_length--)
-		{
-			streamGetOneByte();
-		}
+		chunk_length = MIN(payload_length, sizeof(buffer));
+		streamGetBytes(buffer, chunk_length);
+		payload_length -= chunk_length;
 	}
+	PROFILE_EXIT();
 }
 
 /** Receive a message from the stream #main_input_stream.
@@ -262,14 +622,89 @@ static bool receiveMessage(const pb_field_t fields[], void *dest_struct)
 	}
 }
 
-/** Send a packet.
+/** Write a protocol buffer varint. This is used by the specialised encoders
+  * below, which don't go through pb_encode().
+  * \param out The varint will be written here. This must have space for at
+  *            least 5 bytes.
+  * \param value The value to encode.
+  * \return The number of bytes written.
+  */
+static uint8_t encodeVarint(uint8_t *out, uint32_t value)
+{
+	uint8_t length;
+
+	length = 0;
+	while (value >= 0x80)
+	{
+		out[length++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	out[length++] = (uint8_t)value;
+	return length;
+}
+
+/** Write a protocol buffer bytes field (tag, length and contents).
+  * \param out The field will be written here. This must have space for
+  *            size + 2 bytes.
+  * \param tag The field number.
+  * \param bytes The contents of the field.
+  * \param size The length of the contents, in bytes. This must be less than
+  *             128, so that the length fits in one byte.
+  * \return The number of bytes written.
+  */
+static uint8_t encodeBytesField(uint8_t *out, uint8_t tag, const uint8_t *bytes, size_t size)
+{
+	if (size >= 128)
+	{
+		fatalError(); // this should never happen
+	}
+	out[0] = (uint8_t)((tag << 3) | PB_WT_STRING);
+	out[1] = (uint8_t)size;
+	memcpy(&(out[2]), bytes, size);
+	return (uint8_t)(size + 2);
+}
+
+/** Send a packet whose payload has already been encoded into RAM, either by
+  * sendPacket() or by one of the specialised encoders below. Those encoders
+  * are for fixed-shape responses which are sent often, where the payload
+  * can be written without going through pb_encode() at all.
+  * \param message_id The message ID of the packet.
+  * \param packet The packet. The payload must begin at packet[8]; the first
+  *               8 bytes will be overwritten with the packet header.
+  * \param length The length of the entire packet (including header), in
+  *               bytes.
+  */
+static void sendEncodedPacket(uint16_t message_id, uint8_t *packet, uint32_t length)
+{
+#ifdef TEST_STREAM_COMM
+	// From PROTOCOL, the current received packet must be fully consumed
+	// before any response can be sent.
+	assert(payload_length == 0);
+#endif
+	packet[0] = '#';
+	packet[1] = '#';
+	packet[2] = (uint8_t)(message_id >> 8);
+	packet[3] = (uint8_t)message_id;
+	writeU32BigEndian(&(packet[4]), length - 8);
+	writeBytesToStream(packet, length);
+}
+
+/** Send a packet. The packet header contains the length of the message, so
+  * the message must be encoded before the header can be sent. If the
+  * message is small enough to fit in a RAM buffer of #SEND_BUFFER_SIZE
+  * bytes, it is encoded once into that buffer and then sent in bulk.
+  * Otherwise, the message is encoded twice: once to find its length, and
+  * once more as it is sent.
   * \param message_id The message ID of the packet.
   * \param fields Field description array.
   * \param src_struct Field data which will be serialised and sent.
+  * \param max_size The maximum encoded size of the message, in bytes. This
+  *                 should be the message's *_size define from messages.pb.h,
+  *                 or #UNBOUNDED_MESSAGE_SIZE if there is no such define.
   */
-static void sendPacket(uint16_t message_id, const pb_field_t fields[], const void *src_struct)
+static void sendPacket(uint16_t message_id, const pb_field_t fields[], const void *src_struct, uint32_t max_size)
 {
-	uint8_t buffer[4];
+	uint8_t buffer[8 + SEND_BUFFER_SIZE];
 	pb_ostream_t substream;
 
 #ifdef TEST_STREAM_COMM
@@ -277,6 +712,17 @@ static void sendPacket(uint16_t message_id, const pb_field_t fields[], const voi
 	// before any response can be sent.
 	assert(payload_length == 0);
 #endif
+	if (max_size <= SEND_BUFFER_SIZE)
+	{
+		substream = pb_ostream_from_buffer(&(buffer[8]), SEND_BUFFER_SIZE);
+		if (!pb_encode(&substream, fields, src_struct))
+		{
+			fatalError();
+		}
+		sendEncodedPacket(message_id, buffer, 8 + (uint32_t)substream.bytes_written);
+		return;
+	}
+
 	// Use a non-writing substream to get the length of the message without
 	// storing it anywhere.
 	substream.callback = NULL;
@@ -289,12 +735,12 @@ static void sendPacket(uint16_t message_id, const pb_field_t fields[], const voi
 	}
 
 	// Send packet header.
-	streamPutOneByte('#');
-	streamPutOneByte('#');
-	streamPutOneByte((uint8_t)(message_id >> 8));
-	streamPutOneByte((uint8_t)message_id);
-	writeU32BigEndian(buffer, substream.bytes_written);
-	writeBytesToStream(buffer, 4);
+	buffer[0] = '#';
+	buffer[1] = '#';
+	buffer[2] = (uint8_t)(message_id >> 8);
+	buffer[3] = (uint8_t)message_id;
+	writeU32BigEndian(&(buffer[4]), substream.bytes_written);
+	writeBytesToStream(buffer, 8);
 	// Send actual message.
 	main_output_stream.bytes_written = 0;
 	main_output_stream.max_size = substream.bytes_written;
@@ -304,6 +750,141 @@ static void sendPacket(uint16_t message_id, const pb_field_t fields[], const voi
 	}
 }
 
+/** Send an Address message. This is equivalent to
+  * sendPacket(PACKET_TYPE_ADDRESS_PUBKEY, Address_fields, message,
+  * Address_size), but faster; see sendEncodedPacket().
+  * \param message The message to send.
+  */
+static void sendAddressPacket(const Address *message)
+{
+	uint8_t packet[8 + 6 + sizeof(message->public_key.bytes) + 2 + sizeof(message->address.bytes) + 2];
+	uint32_t ptr;
+
+	ptr = 8;
+	packet[ptr++] = (uint8_t)((Address_address_handle_tag << 3) | PB_WT_VARINT);
+	ptr += encodeVarint(&(packet[ptr]), message->address_handle);
+	ptr += encodeBytesField(&(packet[ptr]), Address_public_key_tag, message->public_key.bytes, message->public_key.size);
+	ptr += encodeBytesField(&(packet[ptr]), Address_address_tag, message->address.bytes, message->address.size);
+	sendEncodedPacket(PACKET_TYPE_ADDRESS_PUBKEY, packet, ptr);
+}
+
+/** Send a Signature message. This is equivalent to
+  * sendPacket(PACKET_TYPE_SIGNATURE, Signature_fields, message,
+  * Signature_size), but faster; see sendEncodedPacket().
+  * \param message The message to send.
+  */
+static void sendSignaturePacket(const Signature *message)
+{
+	uint8_t packet[8 + sizeof(message->signature_data.bytes) + 2];
+	uint32_t ptr;
+
+	ptr = 8;
+	ptr += encodeBytesField(&(packet[ptr]), Signature_signature_data_tag, message->signature_data.bytes, message->signature_data.size);
+	sendEncodedPacket(PACKET_TYPE_SIGNATURE, packet, ptr);
+}
+
+/** Send a NumberOfAddresses message. This is equivalent to
+  * sendPacket(PACKET_TYPE_NUM_ADDRESSES, NumberOfAddresses_fields, message,
+  * NumberOfAddresses_size), but faster; see sendEncodedPacket().
+  * \param message The message to send.
+  */
+static void sendNumberOfAddressesPacket(const NumberOfAddresses *message)
+{
+	uint8_t packet[8 + 6];
+	uint32_t ptr;
+
+	ptr = 8;
+	packet[ptr++] = (uint8_t)((NumberOfAddresses_number_of_addresses_tag << 3) | PB_WT_VARINT);
+	ptr += encodeVarint(&(packet[ptr]), message->number_of_addresses);
+	sendEncodedPacket(PACKET_TYPE_NUM_ADDRESSES, packet, ptr);
+}
+
+/** Send the header of a packet whose payload consists of fixed-layout
+  * binary records, so that the records can then be sent one at a time with
+  * writeBytesToStream(). These are the compact alternatives (see
+  * #compact_records) to the specialised encoders above; the host can copy
+  * each record straight out of the stream, without any varint or field tag
+  * processing.
+  * \param message_id The message ID of the packet.
+  * \param length The length of the payload, in bytes.
+  */
+static void sendRecordsHeader(uint16_t message_id, uint32_t length)
+{
+	uint8_t header[8];
+
+#ifdef TEST_STREAM_COMM
+	// From PROTOCOL, the current received packet must be fully consumed
+	// before any response can be sent.
+	assert(payload_length == 0);
+#endif
+	header[0] = '#';
+	header[1] = '#';
+	header[2] = (uint8_t)(message_id >> 8);
+	header[3] = (uint8_t)message_id;
+	writeU32BigEndian(&(header[4]), length);
+	writeBytesToStream(header, 8);
+}
+
+/** Send an AddressRecords packet, containing the addresses and public keys
+  * of every address handle in the range specified by the address_range
+  * member of PacketScratch#state. This is the compact alternative to an
+  * Addresses message (see getAddressesCallback()). The layout of each record
+  * is described by #ADDRESS_RECORD_LENGTH. Since everything is calculated
+  * before the packet is started, this can still send a Failure message if
+  * something goes wrong.
+  */
+static NOINLINE void sendAddressRecords(void)
+{
+	uint8_t addresses[ECDSA_MAX_BATCH_SIZE * 20];
+	PointAffine public_keys[ECDSA_MAX_BATCH_SIZE];
+	uint8_t record[ADDRESS_RECORD_LENGTH];
+	WalletErrors wallet_return;
+	uint8_t i;
+
+	if (scratch.state.address_range.count > ECDSA_MAX_BATCH_SIZE)
+	{
+		fatalError(); // this should never happen
+	}
+	wallet_return = getAddressesAndPublicKeys(addresses, public_keys, scratch.state.address_range.start, scratch.state.address_range.count);
+	if (wallet_return != WALLET_NO_ERROR)
+	{
+		translateWalletError(wallet_return);
+		return;
+	}
+	sendRecordsHeader(PACKET_TYPE_ADDRESS_RECORDS, (uint32_t)scratch.state.address_range.count * ADDRESS_RECORD_LENGTH);
+	for (i = 0; i < scratch.state.address_range.count; i++)
+	{
+		writeU32BigEndian(record, scratch.state.address_range.start + i);
+		if (ecdsaSerialise(&(record[4]), &(public_keys[i]), true) != 33)
+		{
+			fatalError(); // this should never happen
+		}
+		memcpy(&(record[37]), &(addresses[i * 20]), 20);
+		writeBytesToStream(record, sizeof(record));
+	}
+}
+
+/** Send a SignatureRecords packet. This is the compact alternative to a
+  * Signatures message. The layout of each record is described by
+  * #SIGNATURE_RECORD_LENGTH.
+  * \param signatures The signatures, as written by
+  *                   signTransactionMultiple(). Any bytes beyond the length
+  *                   of each signature must be zero.
+  * \param signature_lengths The length of each signature, in bytes.
+  * \param count The number of signatures.
+  */
+static void sendSignatureRecords(const uint8_t *signatures, const uint8_t *signature_lengths, uint8_t count)
+{
+	uint8_t i;
+
+	sendRecordsHeader(PACKET_TYPE_SIGNATURE_RECORDS, (uint32_t)count * SIGNATURE_RECORD_LENGTH);
+	for (i = 0; i < count; i++)
+	{
+		writeBytesToStream(&(signature_lengths[i]), 1);
+		writeBytesToStream(&(signatures[i * MAX_SIGNATURE_LENGTH]), MAX_SIGNATURE_LENGTH);
+	}
+}
+
 /** nanopb field callback which will write the string specified by arg.
   * \param stream Output stream to write to.
   * \param field Field which contains the string.
@@ -313,9 +894,8 @@ static void sendPacket(uint16_t message_id, const pb_field_t fields[], const voi
   */
 bool writeStringCallback(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
 {
-	uint16_t i;
+	const char *str;
 	uint16_t length;
-	char c;
 	struct StringSetAndSpec **ptr_arg_s;
 	struct StringSetAndSpec *arg_s;
 
@@ -329,27 +909,12 @@ bool writeStringCallback(pb_ostream_t *stream, const pb_field_t *field, void * c
 	{
 		fatalError(); // this should never happen
 	}
-	length = getStringLength(arg_s->next_set, arg_s->next_spec);
+	str = getStringSpan(arg_s->next_set, arg_s->next_spec, &length);
 	if (!pb_encode_tag_for_field(stream, field))
 	{
 		return false;
 	}
-	// Cannot use pb_encode_string() because it expects a pointer to the
-	// contents of an entire string; getString() does not return such a
-	// pointer.
-	if (!pb_encode_varint(stream, (uint64_t)length))
-	{
-		return false;
-	}
-	for (i = 0; i < length; i++)
-	{
-		c = getString(arg_s->next_set, arg_s->next_spec, i);
-		if (!pb_write(stream, (uint8_t *)&c, 1))
-		{
-			return false;
-		}
-	}
-	return true;
+	return pb_encode_string(stream, (const uint8_t *)str, length);
 }
 
 /** Sends a Failure message with the specified error message.
@@ -368,7 +933,7 @@ static void writeFailureString(StringSet set, uint8_t spec)
 	message_buffer.error_code = code;
 	message_buffer.error_message.funcs.encode = &writeStringCallback;
 	message_buffer.error_message.arg = &string_arg;
-	sendPacket(PACKET_TYPE_FAILURE, Failure_fields, &message_buffer);
+	sendPacket(PACKET_TYPE_FAILURE, Failure_fields, &message_buffer, UNBOUNDED_MESSAGE_SIZE);
 }
 
 /** Translates a return value from one of the wallet functions into a Success
@@ -381,7 +946,7 @@ static void translateWalletError(WalletErrors r)
 
 	if (r == WALLET_NO_ERROR)
 	{
-		sendPacket(PACKET_TYPE_SUCCESS, Success_fields, &message_buffer);
+		sendPacket(PACKET_TYPE_SUCCESS, Success_fields, &message_buffer, Success_size);
 	}
 	else
 	{
@@ -425,7 +990,7 @@ static bool buttonInterjection(AskUserCommand command)
 	bool receive_failure;
 
 	memset(&button_request, 0, sizeof(button_request));
-	sendPacket(PACKET_TYPE_BUTTON_REQUEST, ButtonRequest_fields, &button_request);
+	sendPacket(PACKET_TYPE_BUTTON_REQUEST, ButtonRequest_fields, &button_request, ButtonRequest_size);
 	message_id = receivePacketHeader();
 	if (message_id == PACKET_TYPE_BUTTON_ACK)
 	{
@@ -483,7 +1048,7 @@ static bool pinInterjection(void)
 	bool receive_failure;
 
 	memset(&pin_request, 0, sizeof(pin_request));
-	sendPacket(PACKET_TYPE_PIN_REQUEST, PinRequest_fields, &pin_request);
+	sendPacket(PACKET_TYPE_PIN_REQUEST, PinRequest_fields, &pin_request, PinRequest_size);
 	message_id = receivePacketHeader();
 	if (message_id == PACKET_TYPE_PIN_ACK)
 	{
@@ -544,7 +1109,7 @@ static bool otpInterjection(AskUserCommand command)
 #endif // #ifdef TEST_STREAM_COMM
 	displayOTP(command, otp);
 	memset(&otp_request, 0, sizeof(otp_request));
-	sendPacket(PACKET_TYPE_OTP_REQUEST, OtpRequest_fields, &otp_request);
+	sendPacket(PACKET_TYPE_OTP_REQUEST, OtpRequest_fields, &otp_request, OtpRequest_size);
 	message_id = receivePacketHeader();
 	clearOTP();
 	if (message_id == PACKET_TYPE_OTP_ACK)
@@ -588,136 +1153,729 @@ static bool otpInterjection(AskUserCommand command)
 	}
 }
 
-/** nanopb field callback for signature data of SignTransaction message. This
-  * does (or more accurately, delegates) all the "work" of transaction
-  * signing: parsing the transaction, asking the user for approval, generating
-  * the signature and sending the signature.
-  * \param stream Input stream to read from.
-  * \param field Field which contains the signature data.
-  * \param arg Unused.
-  * \return true on success, false on failure (nanopb convention).
+/** Move an entry of #approved_transaction_hashes to the front, shifting
+  * more recently used entries back by one. If the entry is beyond the end
+  * of the valid entries, the least recently used entry will be evicted to
+  * make room.
+  * \param index The index of the entry to move to the front.
+  * \param transaction_hash The transaction hash to write into the front
+  *                         entry.
   */
-bool signTransactionCallback(pb_istream_t *stream, const pb_field_t *field, void **arg)
+static void makeMostRecentApproval(uint8_t index, BigNum256 transaction_hash)
 {
-	AddressHandle ah;
-	bool approved;
-	bool permission_denied;
-	TransactionErrors r;
-	WalletErrors wallet_return;
-	uint8_t transaction_hash[32];
-	uint8_t sig_hash[32];
-	uint8_t private_key[32];
-	uint8_t signature_length;
-	Signature message_buffer;
-
-	// Validate transaction and calculate hashes of it.
-	clearOutputsSeen();
-	r = parseTransaction(sig_hash, transaction_hash, stream->bytes_left);
-	// parseTransaction() always reads transaction_length bytes, even if parse
-	// errors occurs. These next two lines are a bit of a hack to account for
-	// differences between streamGetOneByte() and pb_read(stream, buf, 1).
-	// The intention is that transaction.c doesn't have to know anything about
-	// protocol buffers.
-	payload_length -= stream->bytes_left;
-	stream->bytes_left = 0;
-	if (r != TRANSACTION_NO_ERROR)
+	if (index >= APPROVED_TRANSACTION_SLOTS)
 	{
-		// Transaction parse error.
-		writeFailureString(STRINGSET_TRANSACTION, (uint8_t)r);
-		return true;
+		index = APPROVED_TRANSACTION_SLOTS - 1;
 	}
+	memmove(approved_transaction_hashes[1], approved_transaction_hashes[0], (size_t)index * 32);
+	memcpy(approved_transaction_hashes[0], transaction_hash, 32);
+}
+
+/** Get permission from the user to sign a transaction. If the transaction
+  * is one the user recently approved in this session (as is the case when
+  * signing each input of a multi-input transaction separately), the user
+  * won't be asked again.
+  * \param transaction_hash The transaction hash of the transaction, as
+  *                         calculated by parseTransaction().
+  * \return true if the user approved the transaction, false otherwise.
+  */
+static bool getTransactionApproval(BigNum256 transaction_hash)
+{
+	bool permission_denied;
+	uint8_t i;
 
-	// Get permission from user.
-	approved = false;
-	// Does transaction_hash match previous approved transaction?
-	if (prev_transaction_hash_valid)
+	// Does transaction_hash match a previously approved transaction?
+	for (i = 0; i < num_approved_transactions; i++)
 	{
-		if (bigCompare(transaction_hash, prev_transaction_hash) == BIGCMP_EQUAL)
+		if (bigCompare(transaction_hash, approved_transaction_hashes[i]) == BIGCMP_EQUAL)
 		{
-			approved = true;
+			makeMostRecentApproval(i, transaction_hash);
+			return true;
 		}
 	}
-	if (!approved)
+	// Need to explicitly get permission from user.
+	// The call to parseTransaction() should have logged all the outputs
+	// to the user interface.
+	permission_denied = buttonInterjection(ASKUSER_SIGN_TRANSACTION);
+	if (!permission_denied)
 	{
-		// Need to explicitly get permission from user.
-		// The call to parseTransaction() should have logged all the outputs
-		// to the user interface.
-		permission_denied = buttonInterjection(ASKUSER_SIGN_TRANSACTION);
-		if (!permission_denied)
-		{
-			// User approved transaction.
-			approved = true;
-			memcpy(prev_transaction_hash, transaction_hash, 32);
-			prev_transaction_hash_valid = true;
-		}
-	} // if (!approved)
-	if (approved)
-	{
-		// Okay to sign transaction.
-		signature_length = 0;
-		ah = sign_transaction.address_handle;
-		if (getPrivateKey(private_key, ah) == WALLET_NO_ERROR)
-		{
-			if (sizeof(message_buffer.signature_data.bytes) < MAX_SIGNATURE_LENGTH)
-			{
-				// This should never happen.
-				fatalError();
-			}
-			signTransaction(message_buffer.signature_data.bytes, &signature_length, sig_hash, private_key);
-			message_buffer.signature_data.size = signature_length;
-			sendPacket(PACKET_TYPE_SIGNATURE, Signature_fields, &message_buffer);
-		}
-		else
+		// User approved transaction.
+		makeMostRecentApproval(num_approved_transactions, transaction_hash);
+		if (num_approved_transactions < APPROVED_TRANSACTION_SLOTS)
 		{
-			wallet_return = walletGetLastError();
-			translateWalletError(wallet_return);
+			num_approved_transactions++;
 		}
+		return true;
 	}
-	return true;
+	return false;
 }
 
-/** Send a packet containing an address and its corresponding public key.
-  * This can generate new addresses as well as obtain old addresses. Both
-  * use cases were combined into one function because they involve similar
-  * processes.
-  * \param generate_new If this is true, a new address will be generated
-  *                     and the address handle of the generated address will
-  *                     be prepended to the output packet.
-  *                     If this is false, the address handle specified by ah
-  *                     will be used.
-  * \param ah Address handle to use (if generate_new is false).
-  */
-static NOINLINE void getAndSendAddressAndPublicKey(bool generate_new, AddressHandle ah)
+#ifndef STREAM_COMM_NO_SIGNATURE_CACHE
+/** Forget all signatures in #signature_cache. This must be called whenever
+  * a different wallet (or none) could be loaded, since address handles
+  * are only meaningful within one wallet. */
+static void clearSignatureCache(void)
 {
-	Address message_buffer;
-	PointAffine public_key;
-	WalletErrors r;
+	memset(signature_cache, 0, sizeof(signature_cache));
+	num_cached_signatures = 0;
+	next_signature_slot = 0;
+}
 
-	message_buffer.address.size = 20;
-	if (generate_new)
-	{
-		r = WALLET_NO_ERROR;
-		ah = makeNewAddress(message_buffer.address.bytes, &public_key);
-		if (ah == BAD_ADDRESS_HANDLE)
-		{
-			r = walletGetLastError();
-		}
-	}
-	else
+/** Check whether a packet could change which wallet is loaded (or whether
+  * one is loaded at all), so that #signature_cache must be cleared before
+  * it is handled. This errs on the side of clearing the cache: a
+  * packet which fails still counts.
+  * \param message_id The type of the packet.
+  * \return true if the packet could change the loaded wallet, false
+  *         otherwise.
+  */
+static bool packetMayChangeWallet(uint16_t message_id)
+{
+	switch (message_id)
 	{
-		r = getAddressAndPublicKey(message_buffer.address.bytes, &public_key, ah);
-	}
+	case PACKET_TYPE_INITIALIZE:
+	case PACKET_TYPE_NEW_WALLET:
+	case PACKET_TYPE_LOAD_WALLET:
+	case PACKET_TYPE_FORMAT:
+	case PACKET_TYPE_DELETE_WALLET:
+	case PACKET_TYPE_RESTORE_WALLET:
+	case PACKET_TYPE_RESTORE_WALLET_MNEMONIC:
+	case PACKET_TYPE_SELECT_WALLET_CONTEXT:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/** Look for a previously generated signature in #signature_cache.
+  * \param out_signature If a matching signature is found, it will be
+  *                      written here. This must have space for
+  *                      #MAX_SIGNATURE_LENGTH bytes.
+  * \param out_length If a matching signature is found, its length (in
+  *                   bytes) will be written here.
+  * \param sig_hash The signature hash to look for.
+  * \param ah The address handle to look for.
+  * \return true if a matching signature was found, false otherwise.
+  */
+static bool lookupSignatureCache(uint8_t *out_signature, uint8_t *out_length, BigNum256 sig_hash, AddressHandle ah)
+{
+	uint8_t i;
+
+	for (i = 0; i < num_cached_signatures; i++)
+	{
+		if ((signature_cache[i].ah == ah)
+			&& (memcmp(signature_cache[i].sig_hash, sig_hash, 32) == 0))
+		{
+			memcpy(out_signature, signature_cache[i].signature, signature_cache[i].length);
+			*out_length = signature_cache[i].length;
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Remember a signature in #signature_cache, evicting the oldest entry if
+  * the cache is full.
+  * \param signature The signature, as written by signTransaction().
+  * \param length The length, in bytes, of the signature.
+  * \param sig_hash The signature hash which was signed.
+  * \param ah The address handle of the key which signed it.
+  */
+static void rememberSignature(uint8_t *signature, uint8_t length, BigNum256 sig_hash, AddressHandle ah)
+{
+	SignatureCacheEntry *entry;
+
+	if (length > MAX_SIGNATURE_LENGTH)
+	{
+		// This should never happen.
+		fatalError();
+	}
+	entry = &(signature_cache[next_signature_slot]);
+	memcpy(entry->sig_hash, sig_hash, 32);
+	entry->ah = ah;
+	entry->length = length;
+	memcpy(entry->signature, signature, length);
+	next_signature_slot++;
+	if (next_signature_slot >= SIGNATURE_CACHE_SLOTS)
+	{
+		next_signature_slot = 0;
+	}
+	if (num_cached_signatures < SIGNATURE_CACHE_SLOTS)
+	{
+		num_cached_signatures++;
+	}
+}
+#endif // #ifndef STREAM_COMM_NO_SIGNATURE_CACHE
+
+/** nanopb field callback for data of TransactionChunk message. This doesn't
+  * read the data; it leaves it in the stream for uploadGetBytes() and
+  * uploadBorrowBytes() to read as the transaction parser needs it. This is
+  * the same trick that signTransactionCallback() uses, and it relies on
+  * data being the last field.
+  * \param stream Input stream to read from.
+  * \param field Field which contains the chunk data.
+  * \param arg Unused.
+  * \return true on success, false on failure (nanopb convention).
+  */
+static bool transactionChunkCallback(pb_istream_t *stream, const pb_field_t *field, void **arg)
+{
+	(void)field;
+	(void)arg;
+	scratch.state.upload.chunk_left = (uint32_t)stream->bytes_left;
+	stream->bytes_left = 0;
+	return true;
+}
+
+/** Read and ignore some of the payload of the current packet.
+  * \param length The number of bytes to ignore. This must not be more
+  *               than #payload_length.
+  */
+static void ignoreInput(uint32_t length)
+{
+	uint8_t buffer[32];
+	uint32_t chunk_length;
+
+	while (length > 0)
+	{
+		chunk_length = MIN(length, sizeof(buffer));
+		getBytesFromStream(buffer, (uint8_t)chunk_length);
+		length -= chunk_length;
+	}
+}
+
+/** Get the next chunk of a chunked upload from the host. This asks for it
+  * using a ChunkRequest interjection, which also acknowledges everything
+  * received so far. Chunks which are resent (or which overlap what was
+  * already received) are trimmed, and chunks which leave a gap are ignored;
+  * either way, the host is asked again until some new data arrives.
+  * \return false on success (the chunk_left field of the upload state is
+  *         non-zero), true if the host abandoned the upload.
+  */
+static bool receiveNextChunk(void)
+{
+	uint16_t message_id;
+	uint32_t overlap;
+	HashState hs_copy;
+	ChunkRequest chunk_request;
+	TransactionChunk transaction_chunk;
+
+	while (!scratch.state.upload.aborted && (scratch.state.upload.chunk_left == 0))
+	{
+		memset(&chunk_request, 0, sizeof(chunk_request));
+		chunk_request.next_offset = scratch.state.upload.offset;
+		hs_copy = scratch.state.upload.hs;
+		sha256Finish(&hs_copy);
+		writeHashToByteArray(chunk_request.running_hash.bytes, &hs_copy, true);
+		chunk_request.running_hash.size = 32;
+		sendPacket(PACKET_TYPE_CHUNK_REQUEST, ChunkRequest_fields, &chunk_request, ChunkRequest_size);
+
+		message_id = receivePacketHeader();
+		if (message_id != PACKET_TYPE_TRANSACTION_CHUNK)
+		{
+			readAndIgnoreInput();
+			scratch.state.upload.aborted = true;
+			break;
+		}
+		memset(&transaction_chunk, 0, sizeof(transaction_chunk));
+		transaction_chunk.data.funcs.decode = &transactionChunkCallback;
+		scratch.state.upload.chunk_left = 0;
+		if (!pb_decode(&main_input_stream, TransactionChunk_fields, &transaction_chunk)
+			|| (payload_length != scratch.state.upload.chunk_left))
+		{
+			readAndIgnoreInput();
+			scratch.state.upload.chunk_left = 0;
+			scratch.state.upload.aborted = true;
+			break;
+		}
+		if ((transaction_chunk.offset > scratch.state.upload.offset)
+			|| (scratch.state.upload.chunk_left > scratch.state.upload.length)
+			|| (transaction_chunk.offset > (scratch.state.upload.length - scratch.state.upload.chunk_left)))
+		{
+			// Chunk leaves a gap or goes beyond the end of the transaction
+			// data.
+			readAndIgnoreInput();
+			scratch.state.upload.chunk_left = 0;
+		}
+		else
+		{
+			// Skip whatever was already received.
+			overlap = MIN(scratch.state.upload.offset - transaction_chunk.offset, scratch.state.upload.chunk_left);
+			ignoreInput(overlap);
+			scratch.state.upload.chunk_left -= overlap;
+		}
+	}
+	return scratch.state.upload.aborted;
+}
+
+/** Read transaction data for the transaction parser. Normally, this just
+  * calls streamGetBytes(), but during a chunked upload (see
+  * signTransactionChunked()), the data is taken from TransactionChunk
+  * messages, asking the host for more whenever a chunk runs out.
+  * \param buffer The transaction data will be written here. This must have
+  *               space for length bytes.
+  * \param length The number of bytes to read.
+  * \return false on success, true if the host abandoned a chunked upload.
+  */
+bool uploadGetBytes(uint8_t *buffer, uint32_t length)
+{
+	uint32_t chunk_length;
+
+	if (!upload_chunked)
+	{
+		streamGetBytes(buffer, length);
+		return false;
+	}
+	while (length > 0)
+	{
+		if (receiveNextChunk())
+		{
+			return true;
+		}
+		chunk_length = MIN(length, scratch.state.upload.chunk_left);
+		streamGetBytes(buffer, chunk_length);
+		sha256WriteBytes(&scratch.state.upload.hs, buffer, chunk_length);
+		payload_length -= chunk_length;
+		scratch.state.upload.chunk_left -= chunk_length;
+		scratch.state.upload.offset += chunk_length;
+		buffer += chunk_length;
+		length -= chunk_length;
+	}
+	return false;
+}
+
+/** Borrow transaction data for the transaction parser. This is like
+  * streamBorrowBytes(), except that during a chunked upload, the bytes come
+  * from the current chunk (see uploadGetBytes()).
+  * \param length The number of contiguous bytes available at the returned
+  *               address will be written here. This will be at least 1.
+  * \return A pointer to the borrowed bytes, or NULL if the host abandoned
+  *         a chunked upload.
+  * \warning No other upload or stream function may be called between this
+  *          and the matching call to uploadReleaseBytes().
+  */
+const uint8_t *uploadBorrowBytes(uint32_t *length)
+{
+	if (!upload_chunked)
+	{
+		return streamBorrowBytes(length);
+	}
+	if (receiveNextChunk())
+	{
+		return NULL;
+	}
+	scratch.state.upload.borrowed = streamBorrowBytes(length);
+	*length = MIN(*length, scratch.state.upload.chunk_left);
+	return scratch.state.upload.borrowed;
+}
+
+/** Remove transaction data previously borrowed using uploadBorrowBytes().
+  * \param length The number of bytes to remove. This must not be more than
+  *               the length returned by the most recent call to
+  *               uploadBorrowBytes().
+  */
+void uploadReleaseBytes(uint32_t length)
+{
+	if (upload_chunked)
+	{
+		sha256WriteBytes(&scratch.state.upload.hs, scratch.state.upload.borrowed, length);
+		payload_length -= length;
+		scratch.state.upload.chunk_left -= length;
+		scratch.state.upload.offset += length;
+	}
+	streamReleaseBytes(length);
+}
+
+/** Check whether transaction data is coming from a chunked upload. The
+  * transaction parser uses this to decide whether it needs to read the rest
+  * of the transaction data after a parse error; a chunked upload doesn't, since
+  * the host sends no more than the device asks for.
+  * \return true if a chunked upload is in progress, false otherwise.
+  */
+bool isUploadChunked(void)
+{
+	return upload_chunked;
+}
+
+/** Parse a transaction, ask for approval if it is a new one, sign it and
+  * send the signature. This does all the work of signTransactionCallback()
+  * and signTransactionChunked() after the transaction data has been read.
+  * \param r The return value of parseTransaction().
+  * \param sig_hash The signature hash calculated by parseTransaction().
+  * \param transaction_hash The transaction hash calculated by
+  *                         parseTransaction().
+  * \param ah The address handle of the address to sign with.
+  */
+static void approveAndSignTransaction(TransactionErrors r, BigNum256 sig_hash, BigNum256 transaction_hash, AddressHandle ah)
+{
+	WalletErrors wallet_return;
+	BigNum256Storage private_key;
+	uint8_t signature_length;
+	Signature *message_buffer;
+
+	message_buffer = &(scratch.message.signature);
+
+	if (r != TRANSACTION_NO_ERROR)
+	{
+		// Transaction parse error.
+		writeFailureString(STRINGSET_TRANSACTION, (uint8_t)r);
+		return;
+	}
+
+	if (getTransactionApproval(transaction_hash))
+	{
+		// Okay to sign transaction.
+		signature_length = 0;
+		if (sizeof(message_buffer->signature_data.bytes) < MAX_SIGNATURE_LENGTH)
+		{
+			// This should never happen.
+			fatalError();
+		}
+#ifndef STREAM_COMM_NO_SIGNATURE_CACHE
+		if (lookupSignatureCache(message_buffer->signature_data.bytes, &signature_length, sig_hash, ah))
+		{
+			// The host is retrying; the signature would come out the same
+			// anyway.
+			message_buffer->signature_data.size = signature_length;
+			sendSignaturePacket(message_buffer);
+			return;
+		}
+#endif // #ifndef STREAM_COMM_NO_SIGNATURE_CACHE
+		if (getPrivateKey(private_key, ah) == WALLET_NO_ERROR)
+		{
+			signTransaction(message_buffer->signature_data.bytes, &signature_length, sig_hash, private_key);
+#ifndef STREAM_COMM_NO_SIGNATURE_CACHE
+			rememberSignature(message_buffer->signature_data.bytes, signature_length, sig_hash, ah);
+#endif // #ifndef STREAM_COMM_NO_SIGNATURE_CACHE
+			message_buffer->signature_data.size = signature_length;
+			sendSignaturePacket(message_buffer);
+		}
+		else
+		{
+			wallet_return = walletGetLastError();
+			translateWalletError(wallet_return);
+		}
+	}
+}
+
+/** nanopb field callback for signature data of SignTransaction message. This
+  * does (or more accurately, delegates) all the "work" of transaction
+  * signing: parsing the transaction, asking the user for approval, generating
+  * the signature and sending the signature.
+  * \param stream Input stream to read from.
+  * \param field Field which contains the signature data.
+  * \param arg Unused.
+  * \return true on success, false on failure (nanopb convention).
+  */
+bool signTransactionCallback(pb_istream_t *stream, const pb_field_t *field, void **arg)
+{
+	TransactionErrors r;
+	BigNum256Storage transaction_hash;
+	BigNum256Storage sig_hash;
+
+	// Validate transaction and calculate hashes of it.
+	clearOutputsSeen();
+	r = parseTransaction(sig_hash, transaction_hash, stream->bytes_left);
+	// parseTransaction() always reads transaction_length bytes, even if parse
+	// errors occurs. These next two lines are a bit of a hack to account for
+	// differences between streamGetBytes() and pb_read(stream, buf, 1).
+	// The intention is that transaction.c doesn't have to know anything about
+	// protocol buffers.
+	payload_length -= stream->bytes_left;
+	stream->bytes_left = 0;
+	approveAndSignTransaction(r, sig_hash, transaction_hash, scratch.state.sign_transaction.address_handle);
+	return true;
+}
+
+/** Handle a SignTransactionChunked message. This is like
+  * signTransactionCallback(), except that the transaction data is uploaded
+  * in chunks (see uploadGetBytes()) after the message. The transaction is
+  * still parsed as it arrives, so chunks are never stored.
+  * \param address_handle The address handle of the address to sign with.
+  * \param transaction_length The total length of the transaction data.
+  */
+static NOINLINE void signTransactionChunked(AddressHandle address_handle, uint32_t transaction_length)
+{
+	TransactionErrors r;
+	BigNum256Storage transaction_hash;
+	BigNum256Storage sig_hash;
+
+	upload_chunked = true;
+	scratch.state.upload.aborted = false;
+	scratch.state.upload.length = transaction_length;
+	scratch.state.upload.offset = 0;
+	scratch.state.upload.chunk_left = 0;
+	sha256Begin(&scratch.state.upload.hs);
+	clearOutputsSeen();
+	r = parseTransaction(sig_hash, transaction_hash, transaction_length);
+	if (!scratch.state.upload.aborted)
+	{
+		// If the parse stopped early, the rest of the current chunk still
+		// has to be read.
+		readAndIgnoreInput();
+	}
+	scratch.state.upload.chunk_left = 0;
+	upload_chunked = false;
+	if (scratch.state.upload.aborted)
+	{
+		writeFailureString(STRINGSET_MISC, MISCSTR_UNEXPECTED_PACKET);
+		return;
+	}
+	approveAndSignTransaction(r, sig_hash, transaction_hash, address_handle);
+}
+
+/** Parse and approve the transaction data of a SignTransactionMultiple
+  * message, then sign every input listed in the message. This does
+  * all the work of signTransactionMultipleCallback() and
+  * signWitnessTransactionCallback().
+  * \param stream Input stream to read from.
+  * \param is_witness If this is true, witness (BIP 143) signature hashes
+  *                   will be signed. If this is false, legacy signature
+  *                   hashes will be signed.
+  * \return true on success, false on failure (nanopb convention).
+  */
+static bool signTransactionMultipleInternal(pb_istream_t *stream, bool is_witness)
+{
+	TransactionErrors r;
+	WalletErrors wallet_return;
+	BigNum256Storage transaction_hash;
+	uint8_t sig_hashes[MAX_SIGN_INPUTS * 32] WORD_ALIGNED;
+	uint8_t private_keys[MAX_SIGN_INPUTS * 32] WORD_ALIGNED;
+	uint8_t signatures[MAX_SIGN_INPUTS * MAX_SIGNATURE_LENGTH];
+	uint8_t signature_lengths[MAX_SIGN_INPUTS];
+	uint8_t num_inputs;
+	uint8_t i;
+	bool all_cached;
+	Signatures *message_buffer;
+
+	message_buffer = &(scratch.message.signatures);
+
+	num_inputs = (uint8_t)scratch.state.sign_transaction_multiple.input_index_count;
+	if ((num_inputs == 0)
+		|| (num_inputs > MAX_SIGN_INPUTS)
+		|| (scratch.state.sign_transaction_multiple.address_handle_count != num_inputs))
+	{
+		// Need to consume the transaction data before a response can be
+		// sent.
+		readAndIgnoreInput();
+		stream->bytes_left = 0;
+		writeFailureString(STRINGSET_MISC, MISCSTR_INVALID_PACKET);
+		return true;
+	}
+
+	// Validate transaction and calculate hashes of it. stream->bytes_left
+	// started off as payload_length and only goes down, so it fits in a
+	// uint32_t.
+	clearOutputsSeen();
+	if (is_witness)
+	{
+		r = parseTransactionWitness(sig_hashes, transaction_hash, (uint32_t)stream->bytes_left, scratch.state.sign_transaction_multiple.input_index, num_inputs);
+	}
+	else
+	{
+		r = parseTransactionMultiple(sig_hashes, transaction_hash, (uint32_t)stream->bytes_left, scratch.state.sign_transaction_multiple.input_index, num_inputs);
+	}
+	// See signTransactionCallback() for why this is done.
+	payload_length -= (uint32_t)stream->bytes_left;
+	stream->bytes_left = 0;
+	if (r != TRANSACTION_NO_ERROR)
+	{
+		// Transaction parse error.
+		writeFailureString(STRINGSET_TRANSACTION, (uint8_t)r);
+		return true;
+	}
+
+	if (getTransactionApproval(transaction_hash))
+	{
+		// Okay to sign transaction.
+		if (sizeof(message_buffer->signature_data[0].bytes) < MAX_SIGNATURE_LENGTH)
+		{
+			// This should never happen.
+			fatalError();
+		}
+		memset(signatures, 0, sizeof(signatures));
+		all_cached = false;
+#ifndef STREAM_COMM_NO_SIGNATURE_CACHE
+		// If the host is retrying, every signature will already be in the
+		// cache. Otherwise, they're all regenerated, since that's the only way
+		// the point multiplications can be batched.
+		all_cached = true;
+		for (i = 0; i < num_inputs; i++)
+		{
+			if (!lookupSignatureCache(&(signatures[i * MAX_SIGNATURE_LENGTH]), &(signature_lengths[i]), &(sig_hashes[i * 32]), scratch.state.sign_transaction_multiple.address_handle[i]))
+			{
+				all_cached = false;
+				break;
+			}
+		}
+#endif // #ifndef STREAM_COMM_NO_SIGNATURE_CACHE
+		if (!all_cached)
+		{
+			for (i = 0; i < num_inputs; i++)
+			{
+				if (getPrivateKey(&(private_keys[i * 32]), scratch.state.sign_transaction_multiple.address_handle[i]) != WALLET_NO_ERROR)
+				{
+					wallet_return = walletGetLastError();
+					translateWalletError(wallet_return);
+					return true;
+				}
+			}
+			// All the inputs are signed at once, so that the point
+			// multiplications can be batched.
+			memset(signatures, 0, sizeof(signatures));
+			signTransactionMultiple(signatures, signature_lengths, sig_hashes, private_keys, num_inputs);
+#ifndef STREAM_COMM_NO_SIGNATURE_CACHE
+			for (i = 0; i < num_inputs; i++)
+			{
+				rememberSignature(&(signatures[i * MAX_SIGNATURE_LENGTH]), signature_lengths[i], &(sig_hashes[i * 32]), scratch.state.sign_transaction_multiple.address_handle[i]);
+			}
+#endif // #ifndef STREAM_COMM_NO_SIGNATURE_CACHE
+		}
+		if (compact_records)
+		{
+			sendSignatureRecords(signatures, signature_lengths, num_inputs);
+			return true;
+		}
+		for (i = 0; i < num_inputs; i++)
+		{
+			memcpy(message_buffer->signature_data[i].bytes, &(signatures[i * MAX_SIGNATURE_LENGTH]), signature_lengths[i]);
+			message_buffer->signature_data[i].size = signature_lengths[i];
+		}
+		message_buffer->signature_data_count = num_inputs;
+		sendPacket(PACKET_TYPE_SIGNATURES, Signatures_fields, message_buffer, Signatures_size);
+	}
+	return true;
+}
+
+/** nanopb field callback for transaction data of SignTransactionMultiple
+  * message. This is like signTransactionCallback(), except that the
+  * transaction is only parsed (and approved) once, and then every input
+  * listed in the message is signed. All the signatures are sent back in one
+  * Signatures message.
+  * \param stream Input stream to read from.
+  * \param field Field which contains the transaction data.
+  * \param arg Unused.
+  * \return true on success, false on failure (nanopb convention).
+  */
+bool signTransactionMultipleCallback(pb_istream_t *stream, const pb_field_t *field, void **arg)
+{
+	(void)field;
+	(void)arg;
+	return signTransactionMultipleInternal(stream, false);
+}
+
+/** nanopb field callback for transaction data of SignTransactionMultiple
+  * message, when it is sent as a #PACKET_TYPE_SIGN_WITNESS_TRANSACTION
+  * packet. This is like signTransactionMultipleCallback(), except that
+  * witness (BIP 143) signature hashes are signed. See
+  * parseTransactionWitness() for what the transaction data should look like.
+  * \param stream Input stream to read from.
+  * \param field Field which contains the transaction data.
+  * \param arg Unused.
+  * \return true on success, false on failure (nanopb convention).
+  */
+bool signWitnessTransactionCallback(pb_istream_t *stream, const pb_field_t *field, void **arg)
+{
+	(void)field;
+	(void)arg;
+	return signTransactionMultipleInternal(stream, true);
+}
+
+/** nanopb field callback for transaction data of GetTrustedInput message.
+  * This parses the input transaction and sends back a trusted input token
+  * for it (see getTrustedInput()). No user approval is needed, since a token
+  * only vouches for something which is already public.
+  * \param stream Input stream to read from.
+  * \param field Field which contains the transaction data.
+  * \param arg Unused.
+  * \return true on success, false on failure (nanopb convention).
+  */
+bool getTrustedInputCallback(pb_istream_t *stream, const pb_field_t *field, void **arg)
+{
+	TransactionErrors r;
+	TrustedInput *message_buffer;
+
+	(void)field;
+	(void)arg;
+	message_buffer = &(scratch.message.trusted_input);
+
+	if (prepareTrustedInputKey())
+	{
+		// Need to consume the transaction data before a response can be
+		// sent.
+		readAndIgnoreInput();
+		stream->bytes_left = 0;
+		translateWalletError(WALLET_RNG_FAILURE);
+		return true;
+	}
+	if (sizeof(message_buffer->token.bytes) < TRUSTED_INPUT_TOKEN_LENGTH)
+	{
+		// This should never happen.
+		fatalError();
+	}
+	// stream->bytes_left started off as payload_length and only goes down,
+	// so it fits in a uint32_t.
+	r = getTrustedInput(message_buffer->token.bytes, (uint32_t)stream->bytes_left);
+	// See signTransactionCallback() for why this is done.
+	payload_length -= (uint32_t)stream->bytes_left;
+	stream->bytes_left = 0;
+	if (r != TRANSACTION_NO_ERROR)
+	{
+		// Transaction parse error.
+		writeFailureString(STRINGSET_TRANSACTION, (uint8_t)r);
+		return true;
+	}
+	message_buffer->token.size = TRUSTED_INPUT_TOKEN_LENGTH;
+	sendPacket(PACKET_TYPE_TRUSTED_INPUT, TrustedInput_fields, message_buffer, TrustedInput_size);
+	return true;
+}
+
+/** Send a packet containing an address and its corresponding public key.
+  * This can generate new addresses as well as obtain old addresses. Both
+  * use cases were combined into one function because they involve similar
+  * processes.
+  * \param generate_new If this is true, a new address will be generated
+  *                     and the address handle of the generated address will
+  *                     be prepended to the output packet.
+  *                     If this is false, the address handle specified by ah
+  *                     will be used.
+  * \param ah Address handle to use (if generate_new is false).
+  */
+static NOINLINE void getAndSendAddressAndPublicKey(bool generate_new, AddressHandle ah)
+{
+	Address *message_buffer;
+	PointAffine public_key;
+	WalletErrors r;
+
+	message_buffer = &(scratch.message.address);
+
+	message_buffer->address.size = 20;
+	if (generate_new)
+	{
+		r = WALLET_NO_ERROR;
+		ah = makeNewAddress(message_buffer->address.bytes, &public_key);
+		if (ah == BAD_ADDRESS_HANDLE)
+		{
+			r = walletGetLastError();
+		}
+	}
+	else
+	{
+		r = getAddressAndPublicKey(message_buffer->address.bytes, &public_key, ah);
+	}
 
 	if (r == WALLET_NO_ERROR)
 	{
-		message_buffer.address_handle = ah;
-		if (sizeof(message_buffer.public_key.bytes) < ECDSA_MAX_SERIALISE_SIZE) // sanity check
+		message_buffer->address_handle = ah;
+		if (sizeof(message_buffer->public_key.bytes) < ECDSA_MAX_SERIALISE_SIZE) // sanity check
 		{
 			fatalError();
 			return;
 		}
-		message_buffer.public_key.size = ecdsaSerialise(message_buffer.public_key.bytes, &public_key, true);
-		sendPacket(PACKET_TYPE_ADDRESS_PUBKEY, Address_fields, &message_buffer);
+		message_buffer->public_key.size = ecdsaSerialise(message_buffer->public_key.bytes, &public_key, true);
+		sendAddressPacket(message_buffer);
+#if defined(BACKGROUND_TASKS) && !defined(WALLET_NO_ADDRESS_CACHE)
+		predicted_address_handle = ah + 1;
+#endif // #if defined(BACKGROUND_TASKS) && !defined(WALLET_NO_ADDRESS_CACHE)
 	}
 	else
 	{
@@ -738,7 +1896,7 @@ bool listWalletsCallback(pb_ostream_t *stream, const pb_field_t *field, void * c
 	uint32_t i;
 	WalletInfo message_buffer;
 
-	for (i = 0; i < number_of_wallets; i++)
+	for (i = 0; i < scratch.state.number_of_wallets; i++)
 	{
 		message_buffer.wallet_number = i;
 		message_buffer.wallet_name.size = NAME_LENGTH;
@@ -768,8 +1926,71 @@ bool listWalletsCallback(pb_ostream_t *stream, const pb_field_t *field, void * c
 	return true;
 }
 
-/** nanopb field callback which will write out the contents
-  * of #entropy_buffer.
+/** nanopb field callback which will write repeated Address messages; one
+  * for each address handle in the range specified by the address_range
+  * member of PacketScratch#state. The addresses and public keys are
+  * calculated in one batch, using getAddressesAndPublicKeys().
+  * \param stream Output stream to write to.
+  * \param field Field which contains the Address submessage.
+  * \param arg Unused.
+  * \return true on success, false on failure (nanopb convention).
+  */
+bool getAddressesCallback(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
+{
+	uint8_t addresses[ECDSA_MAX_BATCH_SIZE * 20];
+	PointAffine public_keys[ECDSA_MAX_BATCH_SIZE];
+	Address message_buffer;
+	uint8_t i;
+
+	(void)arg;
+	if (scratch.state.address_range.count > ECDSA_MAX_BATCH_SIZE)
+	{
+		return false;
+	}
+	if (stream->callback == NULL)
+	{
+		// This is the pass which only calculates the size of the message
+		// (see sendPacket()). Every field of Address has the same size
+		// regardless of its contents, so dummy values can be used, avoiding
+		// calculating everything twice.
+		memset(addresses, 0, sizeof(addresses));
+		memset(public_keys, 0, sizeof(public_keys));
+	}
+	else
+	{
+		if (getAddressesAndPublicKeys(addresses, public_keys, scratch.state.address_range.start, scratch.state.address_range.count) != WALLET_NO_ERROR)
+		{
+			return false;
+		}
+	}
+	for (i = 0; i < scratch.state.address_range.count; i++)
+	{
+		message_buffer.address_handle = scratch.state.address_range.start + i;
+		message_buffer.address.size = 20;
+		memcpy(message_buffer.address.bytes, &(addresses[i * 20]), 20);
+		if (sizeof(message_buffer.public_key.bytes) < ECDSA_MAX_SERIALISE_SIZE) // sanity check
+		{
+			return false;
+		}
+		message_buffer.public_key.size = ecdsaSerialise(message_buffer.public_key.bytes, &(public_keys[i]), true);
+		if (!pb_encode_tag_for_field(stream, field))
+		{
+			return false;
+		}
+		if (!pb_encode_submessage(stream, Address_fields, &message_buffer))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/** nanopb field callback which will write out the number of bytes of
+  * entropy given by the entropy member of PacketScratch#state. The entropy
+  * is generated and sent 32 bytes at a time, so that large requests don't
+  * have to be collected in a buffer before anything can be sent. The first
+  * 32 bytes are taken from the first_chunk field of that same member, which
+  * getBytesOfEntropy() fills in before the packet is started.
   * \param stream Output stream to write to.
   * \param field Field which contains the the entropy bytes.
   * \param arg Unused.
@@ -777,18 +1998,51 @@ bool listWalletsCallback(pb_ostream_t *stream, const pb_field_t *field, void * c
   */
 bool getEntropyCallback(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
 {
-	if (entropy_buffer == NULL)
+	uint8_t random_bytes[32];
+	uint32_t remaining;
+	uint32_t chunk_length;
+
+	if (!pb_encode_tag_for_field(stream, field))
 	{
 		return false;
 	}
-	if (!pb_encode_tag_for_field(stream, field))
+	if (!pb_encode_varint(stream, scratch.state.entropy.num_bytes))
 	{
 		return false;
 	}
-	if (!pb_encode_string(stream, entropy_buffer, num_entropy_bytes))
+	if (stream->callback == NULL)
+	{
+		// This is the pass which only calculates the size of the message
+		// (see sendPacket()). pb_write() doesn't look at the buffer in this
+		// case, so there's no need to generate any entropy.
+		return pb_write(stream, scratch.state.entropy.first_chunk, scratch.state.entropy.num_bytes);
+	}
+
+	remaining = scratch.state.entropy.num_bytes;
+	chunk_length = MIN(remaining, sizeof(scratch.state.entropy.first_chunk));
+	if (!pb_write(stream, scratch.state.entropy.first_chunk, chunk_length))
 	{
 		return false;
 	}
+	remaining -= chunk_length;
+	while (remaining > 0)
+	{
+		// It's too late to send a Failure message, so an RNG failure here
+		// causes the packet to be aborted and the device to halt (see
+		// sendPacket() and PROTOCOL). That's better than sending bytes which
+		// might not be random.
+		if (getRandom256(random_bytes))
+		{
+			return false;
+		}
+		chunk_length = MIN(remaining, sizeof(random_bytes));
+		if (!pb_write(stream, random_bytes, chunk_length))
+		{
+			return false;
+		}
+		remaining -= chunk_length;
+	}
+	memset(random_bytes, 0, sizeof(random_bytes));
 	return true;
 }
 
@@ -797,70 +2051,498 @@ bool getEntropyCallback(pb_ostream_t *stream, const pb_field_t *field, void * co
   */
 static NOINLINE void getBytesOfEntropy(uint32_t num_bytes)
 {
-	Entropy message_buffer;
-	unsigned int random_bytes_index;
-	uint8_t random_bytes[1024]; // must be multiple of 32 bytes large
+	Entropy *message_buffer;
 
-	if (num_bytes > sizeof(random_bytes))
+	message_buffer = &(scratch.message.entropy);
+
+	if (num_bytes > MAX_ENTROPY_BYTES)
 	{
 		writeFailureString(STRINGSET_MISC, MISCSTR_PARAM_TOO_LARGE);
 		return;
 	}
 
-	// All bytes of entropy must be collected before anything can be sent.
-	// This is because it is only safe to send those bytes if every call
-	// to getRandom256() succeeded.
-	random_bytes_index = 0;
-	num_entropy_bytes = 0;
-	while (num_bytes--)
+	// Get the first 32 bytes of entropy before starting the packet, so that
+	// the usual cause of RNG failure (insufficient entropy from the hardware)
+	// can still be reported with a Failure message. The rest is generated
+	// while the packet is being sent.
+	if (num_bytes > 0)
+	{
+		if (getRandom256(scratch.state.entropy.first_chunk))
+		{
+			translateWalletError(WALLET_RNG_FAILURE);
+			return;
+		}
+	}
+	scratch.state.entropy.num_bytes = num_bytes;
+	message_buffer->entropy.funcs.encode = &getEntropyCallback;
+	sendPacket(PACKET_TYPE_ENTROPY, Entropy_fields, message_buffer, UNBOUNDED_MESSAGE_SIZE);
+	scratch.state.entropy.num_bytes = 0;
+	memset(scratch.state.entropy.first_chunk, 0, sizeof(scratch.state.entropy.first_chunk));
+}
+
+/** Restore a wallet from a BIP39 mnemonic sentence. The mnemonic and
+  * passphrase are received into #scratch, and are cleared from it once the
+  * wallet has been created.
+  */
+static NOINLINE void restoreWalletMnemonic(void)
+{
+	RestoreWalletMnemonic *message_buffer;
+	uint8_t seed[BIP39_SEED_LENGTH];
+	uint8_t master_node[NODE_LENGTH];
+	unsigned int password_length;
+	WalletErrors wallet_return;
+
+	message_buffer = &(scratch.message.restore_wallet_mnemonic);
+
+	field_hash_set = false;
+	memset(field_hash, 0, sizeof(field_hash));
+	message_buffer->new_wallet.password.funcs.decode = &hashFieldCallback;
+	message_buffer->new_wallet.password.arg = NULL;
+	if (receiveMessage(RestoreWalletMnemonic_fields, message_buffer))
+	{
+		return;
+	}
+	if (!message_buffer->has_passphrase)
+	{
+		message_buffer->passphrase.size = 0;
+	}
+	if (message_buffer->mnemonic.size == 0)
+	{
+		writeFailureString(STRINGSET_MISC, MISCSTR_INVALID_PACKET);
+		return;
+	}
+	if (!buttonInterjection(ASKUSER_RESTORE_WALLET))
+	{
+		if (bip39MnemonicToSeed(
+			seed,
+			message_buffer->mnemonic.bytes,
+			(unsigned int)message_buffer->mnemonic.size,
+			message_buffer->passphrase.bytes,
+			(unsigned int)message_buffer->passphrase.size))
+		{
+			writeFailureString(STRINGSET_MISC, MISCSTR_INVALID_PACKET);
+		}
+		else
+		{
+			// The wallet's seed is a BIP32 node (see
+			// generateDeterministic256()).
+			bip32SeedToNode(master_node, seed, sizeof(seed));
+			if (field_hash_set)
+			{
+				password_length = sizeof(field_hash);
+			}
+			else
+			{
+				password_length = 0; // no password
+			}
+			wallet_return = newWallet(
+				message_buffer->new_wallet.wallet_number,
+				message_buffer->new_wallet.wallet_name.bytes,
+				true,
+				master_node,
+				message_buffer->new_wallet.is_hidden,
+				field_hash,
+				password_length);
+			translateWalletError(wallet_return);
+		}
+	}
+	memset(message_buffer, 0, sizeof(*message_buffer));
+	memset(seed, 0, sizeof(seed));
+	memset(master_node, 0, sizeof(master_node));
+}
+
+#ifdef STREAM_COMM_TRACE
+/** Maximum number of events which are sent in one Trace message. This
+  * leaves room in a message of size #MAX_SEND_SIZE for the other fields. */
+#define MAX_TRACE_EVENTS_SENT	((MAX_SEND_SIZE - 32) / TRACE_ENTRY_SIZE)
+
+/** Event number (see trace.c) of the first event which traceEventsCallback()
+  * will write. */
+static uint32_t trace_first_event;
+/** Number of events which traceEventsCallback() will write. */
+static uint32_t trace_num_events;
+
+/** nanopb field callback which will write events from the event trace, in
+  * the format described in messages.proto. The events written are the ones
+  * specified by #trace_first_event and #trace_num_events. The trace must be
+  * frozen (see traceFreeze()), so that the same events are written in both
+  * passes of sendPacket().
+  * \param stream Output stream to write to.
+  * \param field Field which contains the events.
+  * \param arg Unused.
+  * \return true on success, false on failure (nanopb convention).
+  */
+bool traceEventsCallback(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
+{
+	uint8_t buffer[TRACE_ENTRY_SIZE];
+	TraceEntry entry;
+	uint32_t i;
+
+	(void)arg;
+	if (!pb_encode_tag_for_field(stream, field))
+	{
+		return false;
+	}
+	if (!pb_encode_varint(stream, trace_num_events * TRACE_ENTRY_SIZE))
+	{
+		return false;
+	}
+	for (i = 0; i < trace_num_events; i++)
+	{
+		if (traceGetEntry(&entry, trace_first_event + i))
+		{
+			return false;
+		}
+		writeU32LittleEndian(buffer, entry.timestamp);
+		buffer[4] = (uint8_t)entry.event;
+		buffer[5] = (uint8_t)(entry.event >> 8);
+		buffer[6] = (uint8_t)entry.argument;
+		buffer[7] = (uint8_t)(entry.argument >> 8);
+		if (!pb_write(stream, buffer, sizeof(buffer)))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Send the most recent events in the event trace to the host. Recording
+  * is stopped while this is happening, so events (for example, USB
+  * transfers) which occur while the trace is being sent aren't recorded.
+  * \param clear Whether to throw away all events once they have been sent.
+  */
+static NOINLINE void sendTrace(bool clear)
+{
+	Trace *message_buffer;
+	uint32_t total_events;
+
+	message_buffer = &(scratch.message.trace);
+
+	traceFreeze(true);
+	total_events = traceGetTotalEvents();
+	trace_num_events = MIN(total_events, TRACE_BUFFER_ENTRIES);
+	trace_num_events = MIN(trace_num_events, MAX_TRACE_EVENTS_SENT);
+	trace_first_event = total_events - trace_num_events;
+	message_buffer->cycles_per_second = getCycleCountFrequency();
+	message_buffer->total_events = total_events;
+	message_buffer->events.funcs.encode = &traceEventsCallback;
+	sendPacket(PACKET_TYPE_TRACE, Trace_fields, message_buffer, UNBOUNDED_MESSAGE_SIZE);
+	if (clear)
+	{
+		traceClear();
+	}
+	traceFreeze(false);
+}
+#endif // #ifdef STREAM_COMM_TRACE
+
+#ifdef NV_STATISTICS
+/** Maximum number of erase counters which are sent in one StorageStatistics
+  * message. This leaves room in a message of size #MAX_SEND_SIZE for the
+  * other fields. */
+#define MAX_ERASE_COUNTERS_SENT	((MAX_SEND_SIZE - 48) / 4)
+
+/** Number of erase counters which eraseCountsCallback() will write. */
+static uint32_t erase_counters_sent;
+
+/** nanopb field callback which will write the erase counters of the first
+  * #erase_counters_sent erasable units of non-volatile storage, in the
+  * format described in messages.proto.
+  * \param stream Output stream to write to.
+  * \param field Field which contains the erase counters.
+  * \param arg Unused.
+  * \return true on success, false on failure (nanopb convention).
+  */
+bool eraseCountsCallback(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
+{
+	uint8_t buffer[4];
+	uint32_t count;
+	uint32_t i;
+
+	(void)arg;
+	if (!pb_encode_tag_for_field(stream, field))
+	{
+		return false;
+	}
+	if (!pb_encode_varint(stream, erase_counters_sent * sizeof(buffer)))
+	{
+		return false;
+	}
+	for (i = 0; i < erase_counters_sent; i++)
+	{
+		if (nonVolatileGetEraseCount(&count, i) != NV_NO_ERROR)
+		{
+			return false;
+		}
+		writeU32LittleEndian(buffer, count);
+		if (!pb_write(stream, buffer, sizeof(buffer)))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Send non-volatile storage wear and latency statistics to the host.
+  * \param reset Whether to reset the flush statistics once they have
+  *              been sent.
+  */
+static NOINLINE void sendStorageStatistics(bool reset)
+{
+	StorageStatistics *message_buffer;
+	NVStatistics statistics;
+
+	if (nonVolatileGetStatistics(&statistics) != NV_NO_ERROR)
+	{
+		translateWalletError(WALLET_READ_ERROR);
+		return;
+	}
+	message_buffer = &(scratch.message.storage_statistics);
+	erase_counters_sent = MIN(statistics.num_erase_counters, MAX_ERASE_COUNTERS_SENT);
+	message_buffer->cycles_per_second = getCycleCountFrequency();
+	message_buffer->flush_count = statistics.flush_count;
+	message_buffer->flush_total_cycles = statistics.flush_total_cycles;
+	message_buffer->flush_max_cycles = statistics.flush_max_cycles;
+	message_buffer->erase_counts.funcs.encode = &eraseCountsCallback;
+	sendPacket(PACKET_TYPE_STORAGE_STATISTICS, StorageStatistics_fields, message_buffer, UNBOUNDED_MESSAGE_SIZE);
+	if (reset)
+	{
+		nonVolatileResetFlushStatistics();
+	}
+}
+#endif // #ifdef NV_STATISTICS
+
+#ifdef PC_SAMPLING
+/** Maximum number of histogram buckets which are sent in one PCSamples
+  * message. This leaves room in a message of size #MAX_SEND_SIZE for the
+  * other fields. */
+#define MAX_PC_SAMPLE_BUCKETS_SENT	((MAX_SEND_SIZE - 48) / 2)
+
+/** Index of the first histogram bucket which pcSampleCountsCallback() will
+  * write. */
+static uint32_t pc_samples_first_bucket;
+/** Number of histogram buckets which pcSampleCountsCallback() will write. */
+static uint32_t pc_samples_num_buckets;
+
+/** nanopb field callback which will write the counts of
+  * the #pc_samples_num_buckets histogram buckets starting
+  * at #pc_samples_first_bucket, in the format described in messages.proto.
+  * \param stream Output stream to write to.
+  * \param field Field which contains the counts.
+  * \param arg Unused.
+  * \return true on success, false on failure (nanopb convention).
+  */
+bool pcSampleCountsCallback(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
+{
+	const PCSamplingState *state;
+	uint8_t buffer[2];
+	uint32_t i;
+
+	(void)arg;
+	state = pcSamplingGetState();
+	if (!pb_encode_tag_for_field(stream, field))
+	{
+		return false;
+	}
+	if (!pb_encode_varint(stream, pc_samples_num_buckets * sizeof(buffer)))
+	{
+		return false;
+	}
+	for (i = 0; i < pc_samples_num_buckets; i++)
+	{
+		buffer[0] = (uint8_t)state->counts[pc_samples_first_bucket + i];
+		buffer[1] = (uint8_t)(state->counts[pc_samples_first_bucket + i] >> 8);
+		if (!pb_write(stream, buffer, sizeof(buffer)))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Send one page of the histogram of program counter samples to the host.
+  * Sampling is stopped while this is happening, so that the counts are
+  * consistent with the totals.
+  * \param request The GetPCSamples message which asked for the histogram.
+  *                This may change the range which the histogram covers.
+  */
+static NOINLINE void sendPCSamples(GetPCSamples *request)
+{
+	PCSamples *message_buffer;
+	const PCSamplingState *state;
+	bool clear;
+	uint32_t first_bucket;
+	uint32_t num_buckets;
+
+	if (request->has_range_start && request->has_range_end)
 	{
-		if (random_bytes_index == 0)
+		if (pcSamplingSetRange(request->range_start, request->range_end))
 		{
-			if (getRandom256(&(random_bytes[num_entropy_bytes])))
+			writeFailureString(STRINGSET_MISC, MISCSTR_INVALID_PACKET);
+			return;
+		}
+	}
+	// request is in the same union as message_buffer, so everything needed
+	// from it has to be copied out first.
+	clear = request->clear;
+	first_bucket = request->first_bucket;
+	message_buffer = &(scratch.message.pc_samples);
+
+	pcSamplingFreeze(true);
+	state = pcSamplingGetState();
+	num_buckets = ((state->range_end - state->range_start - 1) >> state->bucket_shift) + 1;
+	pc_samples_first_bucket = first_bucket;
+	pc_samples_num_buckets = 0;
+	if (first_bucket < num_buckets)
+	{
+		pc_samples_num_buckets = MIN(num_buckets - first_bucket, MAX_PC_SAMPLE_BUCKETS_SENT);
+	}
+	message_buffer->sample_rate = pcSamplingGetRate();
+	message_buffer->range_start = state->range_start;
+	message_buffer->range_end = state->range_end;
+	message_buffer->bucket_shift = state->bucket_shift;
+	message_buffer->num_buckets = num_buckets;
+	message_buffer->total_samples = state->total_samples;
+	message_buffer->out_of_range_samples = state->out_of_range_samples;
+	message_buffer->counts.funcs.encode = &pcSampleCountsCallback;
+	sendPacket(PACKET_TYPE_PC_SAMPLES, PCSamples_fields, message_buffer, UNBOUNDED_MESSAGE_SIZE);
+	if (clear)
+	{
+		pcSamplingClear();
+	}
+	pcSamplingFreeze(false);
+}
+#endif // #ifdef PC_SAMPLING
+
+#ifdef STREAM_COMM_PROFILE
+/** nanopb field callback which will write repeated PacketCounters messages;
+  * one for each request packet type which has been processed at least once.
+  * If there are too many to fit in one message, the rest are left out.
+  * \param stream Output stream to write to.
+  * \param field Field which contains the PacketCounters submessage.
+  * \param arg Unused.
+  * \return true on success, false on failure (nanopb convention).
+  */
+bool packetCountersCallback(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
+{
+	PacketCounters message_buffer;
+	PacketProfile *profile;
+	uint64_t total;
+	uint16_t i;
+	uint8_t j;
+
+	(void)arg;
+	for (i = 0; i < PROFILE_PACKET_TYPES; i++)
+	{
+		profile = &(packet_profiles[i]);
+		if (profile->count != 0)
+		{
+			// The tag and length prefix of each submessage take up at most
+			// 2 bytes.
+			if ((stream->bytes_written + PacketCounters_size + 2) > MAX_SEND_SIZE)
+			{
+				return true;
+			}
+			total = 0;
+			for (j = 0; j < PROFILE_CATEGORY_COUNT; j++)
+			{
+				total += profile->category_cycles[j];
+			}
+			message_buffer.packet_type = i;
+			message_buffer.count = profile->count;
+			message_buffer.parse_cycles = profile->category_cycles[PROFILE_PARSE];
+			message_buffer.crypto_cycles = profile->category_cycles[PROFILE_CRYPTO];
+			message_buffer.nv_cycles = profile->category_cycles[PROFILE_NV_IO];
+			message_buffer.stream_cycles = profile->category_cycles[PROFILE_STREAM_IO];
+			message_buffer.total_cycles = total;
+			message_buffer.max_cycles = profile->max_cycles;
+#ifdef CHECK_STACK_USAGE
+			message_buffer.has_max_stack_bytes = true;
+			message_buffer.max_stack_bytes = profile->max_stack_bytes;
+#else
+			message_buffer.has_max_stack_bytes = false;
+#endif // #ifdef CHECK_STACK_USAGE
+			if (!pb_encode_tag_for_field(stream, field))
+			{
+				return false;
+			}
+			if (!pb_encode_submessage(stream, PacketCounters_fields, &message_buffer))
 			{
-				translateWalletError(WALLET_RNG_FAILURE);
-				return;
+				return false;
 			}
 		}
-		num_entropy_bytes++;
-		random_bytes_index++;
-		random_bytes_index &= 31;
 	}
-	message_buffer.entropy.funcs.encode = &getEntropyCallback;
-	entropy_buffer = random_bytes;
-	sendPacket(PACKET_TYPE_ENTROPY, Entropy_fields, &message_buffer);
-	num_entropy_bytes = 0;
-	entropy_buffer = NULL;
+	return true;
 }
+#endif // #ifdef STREAM_COMM_PROFILE
 
 /** nanopb field callback which calculates the double SHA-256 of an arbitrary
   * number of bytes. This is useful if we don't care about the contents of a
   * field but want to compress an arbitrarily-sized field into a fixed-length
-  * variable.
-  * \param stream Input stream to read from.
+  * variable. The field is borrowed straight out of the stream device's
+  * receive buffer (see streamBorrowBytes()) and hashed in place, instead of
+  * being read through pb_read() one byte at a time.
+  * \param stream Input stream to read from. This must be (a substream of)
+  *               #main_input_stream.
   * \param field Field which contains an arbitrary number of bytes.
   * \param arg Unused.
   * \return true on success, false on failure (nanopb convention).
   */
 bool hashFieldCallback(pb_istream_t *stream, const pb_field_t *field, void **arg)
 {
-	uint8_t one_byte;
+	const uint8_t *span;
+	uint32_t span_length;
 	HashState hs;
 
+	if ((stream->callback != &mainInputStreamCallback)
+		|| (stream->bytes_left > payload_length))
+	{
+		return false; // this should never happen
+	}
 	sha256Begin(&hs);
 	while (stream->bytes_left > 0)
-    {
-		if (!pb_read(stream, &one_byte, 1))
-		{
-			return false;
-		}
-        sha256WriteByte(&hs, one_byte);
-    }
+	{
+		PROFILE_ENTER(PROFILE_STREAM_IO);
+		span = streamBorrowBytes(&span_length);
+		PROFILE_EXIT();
+		span_length = MIN(span_length, (uint32_t)stream->bytes_left);
+		sha256WriteBytes(&hs, span, span_length);
+		streamReleaseBytes(span_length);
+		// Keep the nanopb stream and the packet payload in sync, as
+		// mainInputStreamCallback() would have done.
+		stream->bytes_left -= span_length;
+		payload_length -= span_length;
+	}
 	sha256FinishDouble(&hs);
 	writeHashToByteArray(field_hash, &hs, true);
 	field_hash_set = true;
-    return true;
+	return true;
+}
+
+#if defined(BACKGROUND_TASKS) && !defined(WALLET_NO_ADDRESS_CACHE)
+/** Background task (see backgroundYield() in hwinterface.h) which
+  * precomputes the address and public key of #predicted_address_handle, so
+  * that the next NewAddress or GetAddressAndPublicKey request can be
+  * answered straight from the wallet's address cache.
+  *
+  * Unlike most background tasks, this uses the wallet (and therefore
+  * bignum256.c), so it only does anything while processPacket() is waiting
+  * for the next packet, when nothing else can be using them. A point
+  * multiplication can't be interrupted, so a packet which arrives in the
+  * meantime has to wait for it to finish; the result is simply left in the
+  * cache (which is cleared when the wallet is unloaded) if it isn't needed.
+  */
+void precomputeAddressTask(void)
+{
+	AddressHandle ah;
+
+	if (waiting_for_packet && (predicted_address_handle != 0))
+	{
+		ah = predicted_address_handle;
+		predicted_address_handle = 0; // only try once
+		precomputeAddress(ah);
+	}
 }
+#endif // #if defined(BACKGROUND_TASKS) && !defined(WALLET_NO_ADDRESS_CACHE)
 
 /** Get packet from stream and deal with it. This basically implements the
   * protocol described in the file PROTOCOL.
@@ -875,17 +2557,29 @@ bool hashFieldCallback(pb_istream_t *stream, const pb_field_t *field, void **arg
 void processPacket(void)
 {
 	uint16_t message_id;
-	union MessageBufferUnion message_buffer;
+	union MessageBufferUnion *message_buffer;
 	PointAffine master_public_key;
 	bool receive_failure;
 	bool permission_denied;
 	bool invalid_otp;
 	unsigned int password_length;
 	WalletErrors wallet_return;
-	char ping_greeting[sizeof(message_buffer.ping.greeting)];
+	uint32_t num_addresses;
+	char ping_greeting[sizeof(scratch.message.ping.greeting)];
 	bool has_ping_greeting;
 
+#if defined(BACKGROUND_TASKS) && !defined(WALLET_NO_ADDRESS_CACHE)
+	waiting_for_packet = true;
+#endif // #if defined(BACKGROUND_TASKS) && !defined(WALLET_NO_ADDRESS_CACHE)
 	message_id = receivePacketHeader();
+#if defined(BACKGROUND_TASKS) && !defined(WALLET_NO_ADDRESS_CACHE)
+	waiting_for_packet = false;
+	predicted_address_handle = 0;
+#endif // #if defined(BACKGROUND_TASKS) && !defined(WALLET_NO_ADDRESS_CACHE)
+#ifdef STREAM_COMM_PROFILE
+	profilePacketBegin();
+#endif // #ifdef STREAM_COMM_PROFILE
+	TRACE(TRACE_PACKET_BEGIN, message_id);
 
 	// Checklist for each case:
 	// 1. Have you checked or dealt with length?
@@ -896,7 +2590,14 @@ void processPacket(void)
 	// 4. Have you checked for errors from wallet functions?
 	// 5. Have you used the right check for the wallet functions?
 
-	memset(&message_buffer, 0, sizeof(message_buffer));
+	memset(&scratch, 0, sizeof(scratch));
+	message_buffer = &(scratch.message);
+#ifndef STREAM_COMM_NO_SIGNATURE_CACHE
+	if (packetMayChangeWallet(message_id))
+	{
+		clearSignatureCache();
+	}
+#endif // #ifndef STREAM_COMM_NO_SIGNATURE_CACHE
 
 	switch (message_id)
 	{
@@ -904,50 +2605,62 @@ void processPacket(void)
 	case PACKET_TYPE_INITIALIZE:
 		// Reset state and report features.
 		session_id_length = 0; // just in case receiveMessage() fails
-		receive_failure = receiveMessage(Initialize_fields, &(message_buffer.initialize));
+		receive_failure = receiveMessage(Initialize_fields, &(message_buffer->initialize));
 		if (!receive_failure)
 		{
-			session_id_length = message_buffer.initialize.session_id.size;
+			session_id_length = message_buffer->initialize.session_id.size;
 			if (session_id_length >= sizeof(session_id))
 			{
 				fatalError(); // sanity check failed
 			}
-			memcpy(session_id, message_buffer.initialize.session_id.bytes, session_id_length);
-			prev_transaction_hash_valid = false;
+			memcpy(session_id, message_buffer->initialize.session_id.bytes, session_id_length);
+			compact_records = message_buffer->initialize.has_compact_records && message_buffer->initialize.compact_records;
+			num_approved_transactions = 0;
+			clearTrustedInputKey();
 			sanitiseRam();
+#ifdef WALLET_CONTEXTS
+			wallet_return = uninitAllWallets();
+#else
 			wallet_return = uninitWallet();
+#endif // #ifdef WALLET_CONTEXTS
 			if (wallet_return == WALLET_NO_ERROR)
 			{
-				memset(&message_buffer, 0, sizeof(message_buffer));
-				message_buffer.features.echoed_session_id.size = session_id_length;
-				if (session_id_length >= sizeof(message_buffer.features.echoed_session_id.bytes))
+				memset(message_buffer, 0, sizeof(*message_buffer));
+				message_buffer->features.echoed_session_id.size = session_id_length;
+				if (session_id_length >= sizeof(message_buffer->features.echoed_session_id.bytes))
 				{
 					fatalError(); // sanity check failed
 				}
-				memcpy(message_buffer.features.echoed_session_id.bytes, session_id, session_id_length);
+				memcpy(message_buffer->features.echoed_session_id.bytes, session_id, session_id_length);
 				string_arg.next_set = STRINGSET_MISC;
 				string_arg.next_spec = MISCSTR_VENDOR;
-				message_buffer.features.vendor.funcs.encode = &writeStringCallback;
-				message_buffer.features.vendor.arg = &string_arg;
-				message_buffer.features.has_major_version = true;
-				message_buffer.features.major_version = VERSION_MAJOR;
-				message_buffer.features.has_minor_version = true;
-				message_buffer.features.minor_version = VERSION_MINOR;
+				message_buffer->features.vendor.funcs.encode = &writeStringCallback;
+				message_buffer->features.vendor.arg = &string_arg;
+				message_buffer->features.has_major_version = true;
+				message_buffer->features.major_version = VERSION_MAJOR;
+				message_buffer->features.has_minor_version = true;
+				message_buffer->features.minor_version = VERSION_MINOR;
 				string_arg_alt.next_set = STRINGSET_MISC;
 				string_arg_alt.next_spec = MISCSTR_CONFIG;
-				message_buffer.features.config.funcs.encode = &writeStringCallback;
-				message_buffer.features.config.arg = &string_arg_alt;
-				message_buffer.features.has_otp = true;
-				message_buffer.features.otp = true;
-				message_buffer.features.has_pin = true;
-				message_buffer.features.pin = true;
-				message_buffer.features.has_spv = true;
-				message_buffer.features.spv = true;
-				message_buffer.features.algo_count = 1;
-				message_buffer.features.algo[0] = Algorithm_BIP32;
-				message_buffer.features.has_debug_link = true;
-				message_buffer.features.debug_link = false;
-				sendPacket(PACKET_TYPE_FEATURES, Features_fields, &(message_buffer.features));
+				message_buffer->features.config.funcs.encode = &writeStringCallback;
+				message_buffer->features.config.arg = &string_arg_alt;
+				message_buffer->features.has_otp = true;
+				message_buffer->features.otp = true;
+				message_buffer->features.has_pin = true;
+				message_buffer->features.pin = true;
+				message_buffer->features.has_spv = true;
+				message_buffer->features.spv = true;
+				message_buffer->features.algo_count = 1;
+				message_buffer->features.algo[0] = Algorithm_BIP32;
+				message_buffer->features.has_debug_link = true;
+#ifdef STREAM_COMM_PROFILE
+				message_buffer->features.debug_link = true;
+#else
+				message_buffer->features.debug_link = false;
+#endif // #ifdef STREAM_COMM_PROFILE
+				message_buffer->features.has_compact_records = true;
+				message_buffer->features.compact_records = compact_records;
+				sendPacket(PACKET_TYPE_FEATURES, Features_fields, &(message_buffer->features), UNBOUNDED_MESSAGE_SIZE);
 			}
 			else
 			{
@@ -958,43 +2671,43 @@ void processPacket(void)
 
 	case PACKET_TYPE_PING:
 		// Ping request.
-		receive_failure = receiveMessage(Ping_fields, &(message_buffer.ping));
+		receive_failure = receiveMessage(Ping_fields, &(message_buffer->ping));
 		if (!receive_failure)
 		{
-			has_ping_greeting = message_buffer.ping.has_greeting;
-			if (sizeof(message_buffer.ping.greeting) != sizeof(ping_greeting))
+			has_ping_greeting = message_buffer->ping.has_greeting;
+			if (sizeof(message_buffer->ping.greeting) != sizeof(ping_greeting))
 			{
 				fatalError(); // sanity check failed
 			}
 			if (has_ping_greeting)
 			{
-				memcpy(ping_greeting, message_buffer.ping.greeting, sizeof(ping_greeting));
+				memcpy(ping_greeting, message_buffer->ping.greeting, sizeof(ping_greeting));
 			}
 			ping_greeting[sizeof(ping_greeting) - 1] = '\0'; // ensure that string is terminated
 			// Generate ping response message.
-			memset(&message_buffer, 0, sizeof(message_buffer));
-			message_buffer.ping_response.has_echoed_greeting = has_ping_greeting;
-			if (sizeof(ping_greeting) != sizeof(message_buffer.ping_response.echoed_greeting))
+			memset(message_buffer, 0, sizeof(*message_buffer));
+			message_buffer->ping_response.has_echoed_greeting = has_ping_greeting;
+			if (sizeof(ping_greeting) != sizeof(message_buffer->ping_response.echoed_greeting))
 			{
 				fatalError(); // sanity check failed
 			}
 			if (has_ping_greeting)
 			{
-				memcpy(message_buffer.ping_response.echoed_greeting, ping_greeting, sizeof(message_buffer.ping_response.echoed_greeting));
+				memcpy(message_buffer->ping_response.echoed_greeting, ping_greeting, sizeof(message_buffer->ping_response.echoed_greeting));
 			}
-			message_buffer.ping_response.echoed_session_id.size = session_id_length;
-			if (session_id_length >= sizeof(message_buffer.ping_response.echoed_session_id.bytes))
+			message_buffer->ping_response.echoed_session_id.size = session_id_length;
+			if (session_id_length >= sizeof(message_buffer->ping_response.echoed_session_id.bytes))
 			{
 				fatalError(); // sanity check failed
 			}
-			memcpy(message_buffer.ping_response.echoed_session_id.bytes, session_id, session_id_length);
-			sendPacket(PACKET_TYPE_PING_RESPONSE, PingResponse_fields, &(message_buffer.ping_response));
+			memcpy(message_buffer->ping_response.echoed_session_id.bytes, session_id, session_id_length);
+			sendPacket(PACKET_TYPE_PING_RESPONSE, PingResponse_fields, &(message_buffer->ping_response), PingResponse_size);
 		}
 		break;
 
 	case PACKET_TYPE_DELETE_WALLET:
 		// Delete existing wallet.
-		receive_failure = receiveMessage(DeleteWallet_fields, &(message_buffer.delete_wallet));
+		receive_failure = receiveMessage(DeleteWallet_fields, &(message_buffer->delete_wallet));
 		if (!receive_failure)
 		{
 			permission_denied = buttonInterjection(ASKUSER_DELETE_WALLET);
@@ -1003,7 +2716,7 @@ void processPacket(void)
 				invalid_otp = otpInterjection(ASKUSER_DELETE_WALLET);
 				if (!invalid_otp)
 				{
-					wallet_return = deleteWallet(message_buffer.delete_wallet.wallet_handle);
+					wallet_return = deleteWallet(message_buffer->delete_wallet.wallet_handle);
 					translateWalletError(wallet_return);
 				}
 			}
@@ -1014,9 +2727,9 @@ void processPacket(void)
 		// Create new wallet.
 		field_hash_set = false;
 		memset(field_hash, 0, sizeof(field_hash));
-		message_buffer.new_wallet.password.funcs.decode = &hashFieldCallback;
-		message_buffer.new_wallet.password.arg = NULL;
-		receive_failure = receiveMessage(NewWallet_fields, &(message_buffer.new_wallet));
+		message_buffer->new_wallet.password.funcs.decode = &hashFieldCallback;
+		message_buffer->new_wallet.password.arg = NULL;
+		receive_failure = receiveMessage(NewWallet_fields, &(message_buffer->new_wallet));
 		if (!receive_failure)
 		{
 			permission_denied = buttonInterjection(ASKUSER_NEW_WALLET);
@@ -1031,11 +2744,11 @@ void processPacket(void)
 					password_length = 0; // no password
 				}
 				wallet_return = newWallet(
-					message_buffer.new_wallet.wallet_number,
-					message_buffer.new_wallet.wallet_name.bytes,
+					message_buffer->new_wallet.wallet_number,
+					message_buffer->new_wallet.wallet_name.bytes,
 					false,
 					NULL,
-					message_buffer.new_wallet.is_hidden,
+					message_buffer->new_wallet.is_hidden,
 					field_hash,
 					password_length);
 				translateWalletError(wallet_return);
@@ -1045,7 +2758,7 @@ void processPacket(void)
 
 	case PACKET_TYPE_NEW_ADDRESS:
 		// Create new address in wallet.
-		receive_failure = receiveMessage(NewAddress_fields, &(message_buffer.new_address));
+		receive_failure = receiveMessage(NewAddress_fields, &(message_buffer->new_address));
 		if (!receive_failure)
 		{
 			permission_denied = buttonInterjection(ASKUSER_NEW_ADDRESS);
@@ -1058,14 +2771,14 @@ void processPacket(void)
 
 	case PACKET_TYPE_GET_NUM_ADDRESSES:
 		// Get number of addresses in wallet.
-		receive_failure = receiveMessage(GetNumberOfAddresses_fields, &(message_buffer.get_number_of_addresses));
+		receive_failure = receiveMessage(GetNumberOfAddresses_fields, &(message_buffer->get_number_of_addresses));
 		if (!receive_failure)
 		{
-			message_buffer.number_of_addresses.number_of_addresses = getNumAddresses();
+			message_buffer->number_of_addresses.number_of_addresses = getNumAddresses();
 			wallet_return = walletGetLastError();
 			if (wallet_return == WALLET_NO_ERROR)
 			{
-				sendPacket(PACKET_TYPE_NUM_ADDRESSES, NumberOfAddresses_fields, &(message_buffer.number_of_addresses));
+				sendNumberOfAddressesPacket(&(message_buffer->number_of_addresses));
 			}
 			else
 			{
@@ -1076,27 +2789,106 @@ void processPacket(void)
 
 	case PACKET_TYPE_GET_ADDRESS_PUBKEY:
 		// Get address and public key corresponding to an address handle.
-		receive_failure = receiveMessage(GetAddressAndPublicKey_fields, &(message_buffer.get_address_and_public_key));
+		receive_failure = receiveMessage(GetAddressAndPublicKey_fields, &(message_buffer->get_address_and_public_key));
 		if (!receive_failure)
 		{
-			getAndSendAddressAndPublicKey(false, message_buffer.get_address_and_public_key.address_handle);
+			getAndSendAddressAndPublicKey(false, message_buffer->get_address_and_public_key.address_handle);
+		}
+		break;
+
+	case PACKET_TYPE_GET_ADDRESSES_PUBKEYS:
+		// Get addresses and public keys corresponding to a range of address
+		// handles.
+		receive_failure = receiveMessage(GetAddressesAndPublicKeys_fields, &(message_buffer->get_addresses_and_public_keys));
+		if (!receive_failure)
+		{
+			scratch.state.address_range.start = message_buffer->get_addresses_and_public_keys.start_address_handle;
+			if ((message_buffer->get_addresses_and_public_keys.count == 0)
+				|| (message_buffer->get_addresses_and_public_keys.count > ECDSA_MAX_BATCH_SIZE))
+			{
+				writeFailureString(STRINGSET_MISC, MISCSTR_INVALID_PACKET);
+			}
+			else
+			{
+				scratch.state.address_range.count = (uint8_t)message_buffer->get_addresses_and_public_keys.count;
+				// Check the range now, since it's too late to send a Failure
+				// message once the Addresses message has been started.
+				num_addresses = getNumAddresses();
+				if (num_addresses == 0)
+				{
+					wallet_return = walletGetLastError();
+				}
+				else if ((scratch.state.address_range.start == 0) || (scratch.state.address_range.start > num_addresses)
+					|| (scratch.state.address_range.count > (num_addresses - scratch.state.address_range.start + 1)))
+				{
+					wallet_return = WALLET_INVALID_HANDLE;
+				}
+				else
+				{
+					wallet_return = WALLET_NO_ERROR;
+				}
+				if ((wallet_return == WALLET_NO_ERROR) && compact_records)
+				{
+					sendAddressRecords();
+				}
+				else if (wallet_return == WALLET_NO_ERROR)
+				{
+					message_buffer->addresses.address.funcs.encode = &getAddressesCallback;
+					sendPacket(PACKET_TYPE_ADDRESSES_PUBKEYS, Addresses_fields, &(message_buffer->addresses), UNBOUNDED_MESSAGE_SIZE);
+				}
+				else
+				{
+					translateWalletError(wallet_return);
+				}
+			}
 		}
 		break;
 
 	case PACKET_TYPE_SIGN_TRANSACTION:
 		// Sign a transaction.
-		sign_transaction.transaction_data.funcs.decode = &signTransactionCallback;
+		scratch.state.sign_transaction.transaction_data.funcs.decode = &signTransactionCallback;
 		// Everything else is handled in signTransactionCallback().
-		receiveMessage(SignTransaction_fields, &sign_transaction);
+		receiveMessage(SignTransaction_fields, &scratch.state.sign_transaction);
+		break;
+
+	case PACKET_TYPE_SIGN_TRANSACTION_CHUNKED:
+		// Sign a transaction which is uploaded in chunks.
+		receive_failure = receiveMessage(SignTransactionChunked_fields, &(message_buffer->sign_transaction_chunked));
+		if (!receive_failure)
+		{
+			signTransactionChunked(message_buffer->sign_transaction_chunked.address_handle, message_buffer->sign_transaction_chunked.transaction_length);
+		}
+		break;
+
+	case PACKET_TYPE_SIGN_TRANSACTION_MULTIPLE:
+		// Sign many inputs of a transaction.
+		scratch.state.sign_transaction_multiple.transaction_data.funcs.decode = &signTransactionMultipleCallback;
+		// Everything else is handled in signTransactionMultipleCallback().
+		receiveMessage(SignTransactionMultiple_fields, &scratch.state.sign_transaction_multiple);
+		break;
+
+	case PACKET_TYPE_SIGN_WITNESS_TRANSACTION:
+		// Sign many witness inputs of a transaction.
+		scratch.state.sign_transaction_multiple.transaction_data.funcs.decode = &signWitnessTransactionCallback;
+		// Everything else is handled in signWitnessTransactionCallback().
+		receiveMessage(SignTransactionMultiple_fields, &scratch.state.sign_transaction_multiple);
+		break;
+
+	case PACKET_TYPE_GET_TRUSTED_INPUT:
+		// Issue a trusted input token for an output of a previous
+		// transaction.
+		scratch.state.get_trusted_input.transaction_data.funcs.decode = &getTrustedInputCallback;
+		// Everything else is handled in getTrustedInputCallback().
+		receiveMessage(GetTrustedInput_fields, &scratch.state.get_trusted_input);
 		break;
 
 	case PACKET_TYPE_LOAD_WALLET:
 		// Load wallet.
-		receive_failure = receiveMessage(LoadWallet_fields, &(message_buffer.load_wallet));
+		receive_failure = receiveMessage(LoadWallet_fields, &(message_buffer->load_wallet));
 		if (!receive_failure)
 		{
 			// Attempt load with no password.
-			wallet_return = initWallet(message_buffer.load_wallet.wallet_number, field_hash, 0);
+			wallet_return = initWallet(message_buffer->load_wallet.wallet_number, field_hash, 0);
 			if (wallet_return == WALLET_NOT_THERE)
 			{
 				// Attempt load with password.
@@ -1107,7 +2899,7 @@ void processPacket(void)
 					{
 						fatalError(); // this should never happen
 					}
-					wallet_return = initWallet(message_buffer.load_wallet.wallet_number, field_hash, sizeof(field_hash));
+					wallet_return = initWallet(message_buffer->load_wallet.wallet_number, field_hash, sizeof(field_hash));
 					translateWalletError(wallet_return);
 				}
 			}
@@ -1120,7 +2912,7 @@ void processPacket(void)
 
 	case PACKET_TYPE_FORMAT:
 		// Format storage.
-		receive_failure = receiveMessage(FormatWalletArea_fields, &(message_buffer.format_wallet_area));
+		receive_failure = receiveMessage(FormatWalletArea_fields, &(message_buffer->format_wallet_area));
 		if (!receive_failure)
 		{
 			permission_denied = buttonInterjection(ASKUSER_FORMAT);
@@ -1129,7 +2921,7 @@ void processPacket(void)
 				invalid_otp = otpInterjection(ASKUSER_FORMAT);
 				if (!invalid_otp)
 				{
-					if (initialiseEntropyPool(message_buffer.format_wallet_area.initial_entropy_pool.bytes))
+					if (initialiseEntropyPool(message_buffer->format_wallet_area.initial_entropy_pool.bytes))
 					{
 						translateWalletError(WALLET_RNG_FAILURE);
 					}
@@ -1148,9 +2940,9 @@ void processPacket(void)
 		// Change wallet encryption key.
 		field_hash_set = false;
 		memset(field_hash, 0, sizeof(field_hash));
-		message_buffer.change_encryption_key.password.funcs.decode = &hashFieldCallback;
-		message_buffer.change_encryption_key.password.arg = NULL;
-		receive_failure = receiveMessage(ChangeEncryptionKey_fields, &(message_buffer.change_encryption_key));
+		message_buffer->change_encryption_key.password.funcs.decode = &hashFieldCallback;
+		message_buffer->change_encryption_key.password.arg = NULL;
+		receive_failure = receiveMessage(ChangeEncryptionKey_fields, &(message_buffer->change_encryption_key));
 		if (!receive_failure)
 		{
 			permission_denied = buttonInterjection(ASKUSER_CHANGE_KEY);
@@ -1176,13 +2968,13 @@ void processPacket(void)
 
 	case PACKET_TYPE_CHANGE_NAME:
 		// Change wallet name.
-		receive_failure = receiveMessage(ChangeWalletName_fields, &(message_buffer.change_wallet_name));
+		receive_failure = receiveMessage(ChangeWalletName_fields, &(message_buffer->change_wallet_name));
 		if (!receive_failure)
 		{
 			permission_denied = buttonInterjection(ASKUSER_CHANGE_NAME);
 			if (!permission_denied)
 			{
-				wallet_return = changeWalletName(message_buffer.change_wallet_name.wallet_name.bytes);
+				wallet_return = changeWalletName(message_buffer->change_wallet_name.wallet_name.bytes);
 				translateWalletError(wallet_return);
 			}
 		}
@@ -1190,32 +2982,32 @@ void processPacket(void)
 
 	case PACKET_TYPE_LIST_WALLETS:
 		// List wallets.
-		receive_failure = receiveMessage(ListWallets_fields, &(message_buffer.list_wallets));
+		receive_failure = receiveMessage(ListWallets_fields, &(message_buffer->list_wallets));
 		if (!receive_failure)
 		{
-			number_of_wallets = getNumberOfWallets();
-			if (number_of_wallets == 0)
+			scratch.state.number_of_wallets = getNumberOfWallets();
+			if (scratch.state.number_of_wallets == 0)
 			{
 				wallet_return = walletGetLastError();
 				translateWalletError(wallet_return);
 			}
 			else
 			{
-				message_buffer.wallets.wallet_info.funcs.encode = &listWalletsCallback;
-				sendPacket(PACKET_TYPE_WALLETS, Wallets_fields, &(message_buffer.wallets));
+				message_buffer->wallets.wallet_info.funcs.encode = &listWalletsCallback;
+				sendPacket(PACKET_TYPE_WALLETS, Wallets_fields, &(message_buffer->wallets), UNBOUNDED_MESSAGE_SIZE);
 			}
 		}
 		break;
 
 	case PACKET_TYPE_BACKUP_WALLET:
 		// Backup wallet.
-		receive_failure = receiveMessage(BackupWallet_fields, &(message_buffer.backup_wallet));
+		receive_failure = receiveMessage(BackupWallet_fields, &(message_buffer->backup_wallet));
 		if (!receive_failure)
 		{
 			permission_denied = buttonInterjection(ASKUSER_BACKUP_WALLET);
 			if (!permission_denied)
 			{
-				wallet_return = backupWallet(message_buffer.backup_wallet.is_encrypted, message_buffer.backup_wallet.device);
+				wallet_return = backupWallet(message_buffer->backup_wallet.is_encrypted, message_buffer->backup_wallet.device);
 				translateWalletError(wallet_return);
 			}
 		}
@@ -1225,12 +3017,12 @@ void processPacket(void)
 		// Restore wallet.
 		field_hash_set = false;
 		memset(field_hash, 0, sizeof(field_hash));
-		message_buffer.restore_wallet.new_wallet.password.funcs.decode = &hashFieldCallback;
-		message_buffer.restore_wallet.new_wallet.password.arg = NULL;
-		receive_failure = receiveMessage(RestoreWallet_fields, &(message_buffer.restore_wallet));
+		message_buffer->restore_wallet.new_wallet.password.funcs.decode = &hashFieldCallback;
+		message_buffer->restore_wallet.new_wallet.password.arg = NULL;
+		receive_failure = receiveMessage(RestoreWallet_fields, &(message_buffer->restore_wallet));
 		if (!receive_failure)
 		{
-			if (message_buffer.restore_wallet.seed.size != SEED_LENGTH)
+			if (message_buffer->restore_wallet.seed.size != SEED_LENGTH)
 			{
 				writeFailureString(STRINGSET_MISC, MISCSTR_INVALID_PACKET);
 			}
@@ -1248,11 +3040,11 @@ void processPacket(void)
 						password_length = 0; // no password
 					}
 					wallet_return = newWallet(
-						message_buffer.restore_wallet.new_wallet.wallet_number,
-						message_buffer.restore_wallet.new_wallet.wallet_name.bytes,
+						message_buffer->restore_wallet.new_wallet.wallet_number,
+						message_buffer->restore_wallet.new_wallet.wallet_name.bytes,
 						true,
-						message_buffer.restore_wallet.seed.bytes,
-						message_buffer.restore_wallet.new_wallet.is_hidden,
+						message_buffer->restore_wallet.seed.bytes,
+						message_buffer->restore_wallet.new_wallet.is_hidden,
 						field_hash,
 						password_length);
 					translateWalletError(wallet_return);
@@ -1261,15 +3053,20 @@ void processPacket(void)
 		}
 		break;
 
+	case PACKET_TYPE_RESTORE_WALLET_MNEMONIC:
+		// Restore wallet from a BIP39 mnemonic sentence.
+		restoreWalletMnemonic();
+		break;
+
 	case PACKET_TYPE_GET_DEVICE_UUID:
 		// Get device UUID.
-		receive_failure = receiveMessage(GetDeviceUUID_fields, &(message_buffer.get_device_uuid));
+		receive_failure = receiveMessage(GetDeviceUUID_fields, &(message_buffer->get_device_uuid));
 		if (!receive_failure)
 		{
-			message_buffer.device_uuid.device_uuid.size = UUID_LENGTH;
-			if (nonVolatileRead(message_buffer.device_uuid.device_uuid.bytes, PARTITION_GLOBAL, ADDRESS_DEVICE_UUID, UUID_LENGTH) == NV_NO_ERROR)
+			message_buffer->device_uuid.device_uuid.size = UUID_LENGTH;
+			if (nonVolatileRead(message_buffer->device_uuid.device_uuid.bytes, PARTITION_GLOBAL, ADDRESS_DEVICE_UUID, UUID_LENGTH) == NV_NO_ERROR)
 			{
-				sendPacket(PACKET_TYPE_DEVICE_UUID, DeviceUUID_fields, &(message_buffer.device_uuid));
+				sendPacket(PACKET_TYPE_DEVICE_UUID, DeviceUUID_fields, &(message_buffer->device_uuid), DeviceUUID_size);
 			}
 			else
 			{
@@ -1280,16 +3077,16 @@ void processPacket(void)
 
 	case PACKET_TYPE_GET_ENTROPY:
 		// Get an arbitrary number of bytes of entropy.
-		receive_failure = receiveMessage(GetEntropy_fields, &(message_buffer.get_entropy));
+		receive_failure = receiveMessage(GetEntropy_fields, &(message_buffer->get_entropy));
 		if (!receive_failure)
 		{
-			getBytesOfEntropy(message_buffer.get_entropy.number_of_bytes);
+			getBytesOfEntropy(message_buffer->get_entropy.number_of_bytes);
 		}
 		break;
 
 	case PACKET_TYPE_GET_MASTER_KEY:
 		// Get master public key and chain code.
-		receive_failure = receiveMessage(GetMasterPublicKey_fields, &(message_buffer.get_master_public_key));
+		receive_failure = receiveMessage(GetMasterPublicKey_fields, &(message_buffer->get_master_public_key));
 		if (!receive_failure)
 		{
 			permission_denied = buttonInterjection(ASKUSER_GET_MASTER_KEY);
@@ -1298,17 +3095,17 @@ void processPacket(void)
 				invalid_otp = otpInterjection(ASKUSER_GET_MASTER_KEY);
 				if (!invalid_otp)
 				{
-					wallet_return = getMasterPublicKey(&master_public_key, message_buffer.master_public_key.chain_code.bytes);
+					wallet_return = getMasterPublicKey(&master_public_key, message_buffer->master_public_key.chain_code.bytes);
 					if (wallet_return == WALLET_NO_ERROR)
 					{
-						message_buffer.master_public_key.chain_code.size = 32;
-						if (sizeof(message_buffer.master_public_key.public_key.bytes) < ECDSA_MAX_SERIALISE_SIZE) // sanity check
+						message_buffer->master_public_key.chain_code.size = 32;
+						if (sizeof(message_buffer->master_public_key.public_key.bytes) < ECDSA_MAX_SERIALISE_SIZE) // sanity check
 						{
 							fatalError();
 							return;
 						}
-						message_buffer.master_public_key.public_key.size = ecdsaSerialise(message_buffer.master_public_key.public_key.bytes, &master_public_key, true);
-						sendPacket(PACKET_TYPE_MASTER_KEY, MasterPublicKey_fields, &(message_buffer.master_public_key));
+						message_buffer->master_public_key.public_key.size = ecdsaSerialise(message_buffer->master_public_key.public_key.bytes, &master_public_key, true);
+						sendPacket(PACKET_TYPE_MASTER_KEY, MasterPublicKey_fields, &(message_buffer->master_public_key), MasterPublicKey_size);
 					}
 					else
 					{
@@ -1319,6 +3116,92 @@ void processPacket(void)
 		}
 		break;
 
+#ifdef STREAM_COMM_PROFILE
+	case PACKET_TYPE_GET_PERFORMANCE_COUNTERS:
+		// Get performance counters (debug link request).
+		receive_failure = receiveMessage(GetPerformanceCounters_fields, &(message_buffer->get_performance_counters));
+		if (!receive_failure)
+		{
+			if (message_buffer->get_performance_counters.reset)
+			{
+				// The reset is done by profilePacketEnd(), after the counters
+				// have been sent.
+				profile_reset_pending = true;
+			}
+			memset(message_buffer, 0, sizeof(*message_buffer));
+			message_buffer->performance_counters.cycles_per_second = getCycleCountFrequency();
+			message_buffer->performance_counters.packet_counters.funcs.encode = &packetCountersCallback;
+			sendPacket(PACKET_TYPE_PERFORMANCE_COUNTERS, PerformanceCounters_fields, &(message_buffer->performance_counters), UNBOUNDED_MESSAGE_SIZE);
+		}
+		break;
+#endif // #ifdef STREAM_COMM_PROFILE
+
+#ifdef STREAM_COMM_TRACE
+	case PACKET_TYPE_GET_TRACE:
+		// Get event trace (debug link request).
+		receive_failure = receiveMessage(GetTrace_fields, &(message_buffer->get_trace));
+		if (!receive_failure)
+		{
+			sendTrace(message_buffer->get_trace.clear);
+		}
+		break;
+#endif // #ifdef STREAM_COMM_TRACE
+
+#ifdef NV_STATISTICS
+	case PACKET_TYPE_GET_STORAGE_STATISTICS:
+		// Get non-volatile storage statistics (debug link request).
+		receive_failure = receiveMessage(GetStorageStatistics_fields, &(message_buffer->get_storage_statistics));
+		if (!receive_failure)
+		{
+			sendStorageStatistics(message_buffer->get_storage_statistics.reset);
+		}
+		break;
+#endif // #ifdef NV_STATISTICS
+
+#ifdef PC_SAMPLING
+	case PACKET_TYPE_GET_PC_SAMPLES:
+		// Get histogram of program counter samples (debug link request).
+		receive_failure = receiveMessage(GetPCSamples_fields, &(message_buffer->get_pc_samples));
+		if (!receive_failure)
+		{
+			sendPCSamples(&(message_buffer->get_pc_samples));
+		}
+		break;
+#endif // #ifdef PC_SAMPLING
+
+#ifdef STREAM_COMM_LINK_SPEED
+	case PACKET_TYPE_SET_LINK_SPEED:
+		// Change speed of link to host.
+		receive_failure = receiveMessage(SetLinkSpeed_fields, &(message_buffer->set_link_speed));
+		if (!receive_failure)
+		{
+			if (isLinkSpeedSupported(message_buffer->set_link_speed.baud_rate))
+			{
+				// The response has to go out at the old speed, since the
+				// host won't switch until it has seen it.
+				translateWalletError(WALLET_NO_ERROR);
+				setLinkSpeed(message_buffer->set_link_speed.baud_rate);
+			}
+			else
+			{
+				writeFailureString(STRINGSET_MISC, MISCSTR_INVALID_PACKET);
+			}
+		}
+		break;
+#endif // #ifdef STREAM_COMM_LINK_SPEED
+
+#ifdef WALLET_CONTEXTS
+	case PACKET_TYPE_SELECT_WALLET_CONTEXT:
+		// Switch to another wallet context.
+		receive_failure = receiveMessage(SelectWalletContext_fields, &(message_buffer->select_wallet_context));
+		if (!receive_failure)
+		{
+			wallet_return = selectWalletContext(message_buffer->select_wallet_context.context);
+			translateWalletError(wallet_return);
+		}
+		break;
+#endif // #ifdef WALLET_CONTEXTS
+
 	default:
 		// Unknown message ID.
 		readAndIgnoreInput();
@@ -1326,6 +3209,10 @@ void processPacket(void)
 		break;
 
 	}
+	TRACE(TRACE_PACKET_END, message_id);
+#ifdef STREAM_COMM_PROFILE
+	profilePacketEnd(message_id);
+#endif // #ifdef STREAM_COMM_PROFILE
 }
 
 #ifdef TEST
@@ -1390,12 +3277,87 @@ uint8_t streamGetOneByte(void)
 	}
 }
 
-/** Simulate the sending of a byte by displaying its value.
+/** Simulate the sending of a byte by displaying its value. When
+  * benchmarking, the byte is discarded, so that the time spent printing
+  * doesn't swamp the results.
   * \param one_byte The byte to send.
   */
 void streamPutOneByte(uint8_t one_byte)
 {
+#ifdef TEST_BENCH
+	(void)one_byte;
+#else
 	printf(" %02x", (int)one_byte);
+#endif // #ifdef TEST_BENCH
+}
+
+/** Get bytes from the contents of the buffer set by setTestInputStream().
+  * \param buffer The bytes will be written here.
+  * \param length The number of bytes to get.
+  */
+void streamGetBytes(uint8_t *buffer, uint32_t length)
+{
+	uint32_t i;
+
+	for (i = 0; i < length; i++)
+	{
+		buffer[i] = streamGetOneByte();
+	}
+}
+
+/** Borrow bytes from the contents of the buffer set by
+  * setTestInputStream(). To exercise callers, this deliberately returns
+  * spans of varying length instead of everything that's left.
+  * \param length The number of contiguous bytes available will be written
+  *               here.
+  * \return A pointer to the borrowed bytes.
+  */
+const uint8_t *streamBorrowBytes(uint32_t *length)
+{
+	static const uint8_t zeroes[16];
+
+	if (is_infinite_zero_stream)
+	{
+		*length = sizeof(zeroes);
+		return zeroes;
+	}
+	if (stream == NULL)
+	{
+		printf("ERROR: Tried to read a stream whose contents weren't set.\n");
+		exit(1);
+	}
+	if (stream_ptr >= stream_length)
+	{
+		printf("ERROR: Tried to read past end of stream\n");
+		exit(1);
+	}
+	*length = MIN(stream_length - stream_ptr, 1 + (stream_ptr % 61));
+	return &(stream[stream_ptr]);
+}
+
+/** Release bytes borrowed by streamBorrowBytes().
+  * \param length The number of bytes to release.
+  */
+void streamReleaseBytes(uint32_t length)
+{
+	if (!is_infinite_zero_stream)
+	{
+		stream_ptr += length;
+	}
+}
+
+/** Simulate the sending of bytes by displaying their values.
+  * \param buffer The bytes to send.
+  * \param length The number of bytes to send.
+  */
+void streamPutBytes(const uint8_t *buffer, uint32_t length)
+{
+	uint32_t i;
+
+	for (i = 0; i < length; i++)
+	{
+		streamPutOneByte(buffer[i]);
+	}
 }
 
 /** Helper for getString().
@@ -1480,6 +3442,9 @@ static const char *getStringInternal(StringSet set, uint8_t spec)
 		case WALLET_BAD_ADDRESS:
 			return "Bad non-volatile address or partition number";
 			break;
+		case WALLET_INVALID_CONTEXT:
+			return "Invalid wallet context number";
+			break;
 		default:
 			assert(0);
 		}
@@ -1538,6 +3503,22 @@ uint16_t getStringLength(StringSet set, uint8_t spec)
 	return (uint16_t)strlen(getStringInternal(set, spec));
 }
 
+/** Find one of the device's strings.
+  * \param set See getString().
+  * \param spec See getString().
+  * \param out_length The length of the string, in number of characters, will
+  *                   be written here.
+  * \return A pointer to the first character of the string.
+  */
+const char *getStringSpan(StringSet set, uint8_t spec, uint16_t *out_length)
+{
+	const char *str;
+
+	str = getStringInternal(set, spec);
+	*out_length = (uint16_t)strlen(str);
+	return str;
+}
+
 /** Obtain one character from one of the device's strings.
   * \param set Specifies which set of strings to use; should be
   *            one of #StringSetEnum.
@@ -1597,12 +3578,17 @@ static void printAction(AskUserCommand command)
 	}
 }
 
-/** Ask user if they want to allow some action.
+/** Ask user if they want to allow some action. When benchmarking, every
+  * action is accepted without asking.
   * \param command The action to ask the user about. See #AskUserCommandEnum.
   * \return false if the user accepted, true if the user denied.
   */
 bool userDenied(AskUserCommand command)
 {
+#ifdef TEST_BENCH
+	(void)command;
+	return false;
+#else
 	int c;
 
 	printAction(command);
@@ -1619,6 +3605,7 @@ bool userDenied(AskUserCommand command)
 	{
 		return true;
 	}
+#endif // #ifdef TEST_BENCH
 }
 
 /** Display a short (maximum 8 characters) one-time password for the user to
@@ -1649,6 +3636,98 @@ void fatalError(void)
 	exit(1);
 }
 
+#if defined(STREAM_COMM_PROFILE) || defined(PBKDF2_CALIBRATE)
+/** Get the current value of a free-running cycle counter. For testing,
+  * processor time is used.
+  * \return The current value of the cycle counter.
+  */
+uint32_t getCycleCount(void)
+{
+	return (uint32_t)clock();
+}
+
+/** Get the rate at which the counter returned by getCycleCount() increments.
+  * \return The number of counts per second.
+  */
+uint32_t getCycleCountFrequency(void)
+{
+	return (uint32_t)CLOCKS_PER_SEC;
+}
+#endif // #if defined(STREAM_COMM_PROFILE) || defined(PBKDF2_CALIBRATE)
+
+#ifdef STREAM_COMM_TRACE
+/** For testing, there are no interrupts to disable.
+  * \return Ignored by traceRestoreInterrupts().
+  */
+uint32_t traceDisableInterrupts(void)
+{
+	return 0;
+}
+
+/** For testing, this does nothing.
+  * \param status Ignored.
+  */
+void traceRestoreInterrupts(uint32_t status)
+{
+	(void)status;
+}
+#endif // #ifdef STREAM_COMM_TRACE
+
+#ifdef PC_SAMPLING
+/** State of the PC sampler. For testing, samples are made up by the test
+  * code instead of being taken from a timer interrupt. */
+static PCSamplingState test_pc_sampling_state;
+
+/** Get the range of addresses which contains all of the firmware's code.
+  * For testing, this is an arbitrary 64 kilobyte range.
+  * \param out_start The lowest code address will be written here.
+  * \param out_end One past the highest code address will be written here.
+  */
+void pcSamplingGetCodeRange(uint32_t *out_start, uint32_t *out_end)
+{
+	*out_start = 0x1000;
+	*out_end = 0x11000;
+}
+
+/** Get the rate at which samples are taken. For testing, samples aren't
+  * taken at any particular rate, so this just returns the nominal rate.
+  * \return The number of samples per second.
+  */
+uint32_t pcSamplingGetRate(void)
+{
+	return PC_SAMPLE_RATE;
+}
+#endif // #ifdef PC_SAMPLING
+
+#ifdef STREAM_COMM_LINK_SPEED
+/** Check whether a link speed can be used. For testing, only the speeds
+  * that the LPC11Uxx port supports are accepted.
+  * \param baud_rate The link speed to check, in baud.
+  * \return true if the link speed is supported, false if it isn't.
+  */
+bool isLinkSpeedSupported(uint32_t baud_rate)
+{
+	if ((baud_rate == 57600) || (baud_rate == 115200) || (baud_rate == 230400)
+		|| (baud_rate == 460800) || (baud_rate == 921600))
+	{
+		return true;
+	}
+	else
+	{
+		return false;
+	}
+}
+
+/** Change the link speed. For testing, this doesn't do anything except
+  * report the new speed.
+  * \param baud_rate The new link speed, in baud.
+  */
+void setLinkSpeed(uint32_t baud_rate)
+{
+	printf("Link speed changed to %u baud\n", (unsigned int)baud_rate);
+}
+#endif // #ifdef STREAM_COMM_LINK_SPEED
+
 #endif // #ifdef TEST
 
 #ifdef TEST_STREAM_COMM
@@ -1691,6 +3770,31 @@ static const uint8_t test_stream_get_address0[] = {
 0x23, 0x23, 0x00, 0x09, 0x00, 0x00, 0x00, 0x02,
 0x08, 0x00};
 
+/** Test stream data for: get addresses 2 to 4. */
+static const uint8_t test_stream_get_addresses2to4[] = {
+0x23, 0x23, 0x00, 0x1a, 0x00, 0x00, 0x00, 0x04,
+0x08, 0x02, 0x10, 0x03};
+
+/** Test stream data for: get addresses 3 to 5 (which goes beyond the
+  * number of addresses in the wallet). */
+static const uint8_t test_stream_get_addresses3to5[] = {
+0x23, 0x23, 0x00, 0x1a, 0x00, 0x00, 0x00, 0x04,
+0x08, 0x03, 0x10, 0x03};
+
+/** Test stream data for: several pipelined requests sent back to back,
+  * including one which fails (get address 0). */
+static const uint8_t test_stream_pipelined[] = {
+0x23, 0x23, 0x00, 0x09, 0x00, 0x00, 0x00, 0x02,
+0x08, 0x01,
+
+0x23, 0x23, 0x00, 0x09, 0x00, 0x00, 0x00, 0x02,
+0x08, 0x00,
+
+0x23, 0x23, 0x00, 0x06, 0x00, 0x00, 0x00, 0x00,
+
+0x23, 0x23, 0x00, 0x09, 0x00, 0x00, 0x00, 0x02,
+0x08, 0x02};
+
 /** Test stream data for: sign something and allow button press. */
 static uint8_t test_stream_sign_tx[] = {
 0x23, 0x23, 0x00, 0x0a, 0x00, 0x00, 0x01, 0xa0,
@@ -1787,6 +3891,149 @@ static uint8_t test_stream_sign_tx[] = {
 0x23, 0x23, 0x00, 0x51, 0x00, 0x00, 0x00, 0x00
 };
 
+/** Test stream data for: sign input 0 of the transaction in
+  * #test_stream_sign_tx using a SignTransactionMultiple message. This is
+  * filled in by buildSignTransactionMultipleTestStream(). */
+static uint8_t test_stream_sign_tx_multiple[sizeof(test_stream_sign_tx) + 2];
+
+/** Test stream data for: sign input 0 of the transaction in
+  * #test_stream_sign_tx with two different keys, as if it were a
+  * multi-signature input, using a SignTransactionMultiple message. This is
+  * filled in by buildSignMultisigInputTestStream(). */
+static uint8_t test_stream_sign_multisig_input[sizeof(test_stream_sign_tx) + 6];
+
+/** Test stream data for: sign a transaction which differs from the one in
+  * #test_stream_sign_tx, and allow button press. This is filled in by
+  * buildSignOtherTransactionTestStream(). */
+static uint8_t test_stream_sign_other_tx[sizeof(test_stream_sign_tx)];
+
+/** Fill in #test_stream_sign_other_tx, by copying #test_stream_sign_tx and
+  * then changing the amount of the second output of the main transaction
+  * from 0.01234567 BTC to 0.01234568 BTC. */
+static void buildSignOtherTransactionTestStream(void)
+{
+	memcpy(test_stream_sign_other_tx, test_stream_sign_tx, sizeof(test_stream_sign_tx));
+	// The amount is followed by a 26 byte script, locktime, hashtype and an
+	// 8 byte ButtonAck packet.
+	test_stream_sign_other_tx[sizeof(test_stream_sign_tx) - 50] = 0x88;
+}
+
+/** Fill in #test_stream_sign_tx_multiple, using the transaction data and
+  * button acknowledgement in #test_stream_sign_tx. */
+static void buildSignTransactionMultipleTestStream(void)
+{
+	static const uint8_t header[] = {
+	0x23, 0x23, 0x00, 0x18, 0x00, 0x00, 0x01, 0xa2,
+	0x08, 0x00, // input_index = 0
+	0x10, 0x01, // address_handle = 1
+	0x1a, 0x9b, 0x03};
+
+	memcpy(test_stream_sign_tx_multiple, header, sizeof(header));
+	// The SignTransaction header is 13 bytes long.
+	memcpy(&(test_stream_sign_tx_multiple[sizeof(header)]), &(test_stream_sign_tx[13]), sizeof(test_stream_sign_tx) - 13);
+}
+
+/** Fill in #test_stream_sign_multisig_input, using the transaction data and
+  * button acknowledgement in #test_stream_sign_tx. */
+static void buildSignMultisigInputTestStream(void)
+{
+	static const uint8_t header[] = {
+	0x23, 0x23, 0x00, 0x18, 0x00, 0x00, 0x01, 0xa6,
+	0x08, 0x00, // input_index = 0
+	0x10, 0x01, // address_handle = 1
+	0x08, 0x00, // input_index = 0
+	0x10, 0x02, // address_handle = 2
+	0x1a, 0x9b, 0x03};
+
+	memcpy(test_stream_sign_multisig_input, header, sizeof(header));
+	// The SignTransaction header is 13 bytes long.
+	memcpy(&(test_stream_sign_multisig_input[sizeof(header)]), &(test_stream_sign_tx[13]), sizeof(test_stream_sign_tx) - 13);
+}
+
+/** Test stream data for: sign the transaction in #test_stream_sign_tx using
+  * a chunked upload. This is filled in by
+  * buildSignTransactionChunkedTestStream(). */
+static uint8_t test_stream_sign_tx_chunked[1024];
+
+/** Number of bytes of #test_stream_sign_tx_chunked which have been filled
+  * in. */
+static uint32_t test_stream_sign_tx_chunked_length;
+
+/** Append a TransactionChunk packet to #test_stream_sign_tx_chunked.
+  * \param offset The offset to claim in the TransactionChunk message.
+  * \param length The number of bytes of transaction data to include, which
+  *               will be taken from #test_stream_sign_tx, starting at
+  *               offset.
+  */
+static void appendTransactionChunk(uint32_t offset, uint32_t length)
+{
+	uint8_t payload[16];
+	uint32_t payload_header_length;
+	uint8_t *out;
+
+	payload[0] = 0x08; // offset
+	payload_header_length = 1;
+	payload_header_length += encodeVarint(&(payload[payload_header_length]), offset);
+	payload[payload_header_length++] = 0x12; // data
+	payload_header_length += encodeVarint(&(payload[payload_header_length]), length);
+	out = &(test_stream_sign_tx_chunked[test_stream_sign_tx_chunked_length]);
+	out[0] = 0x23;
+	out[1] = 0x23;
+	out[2] = 0x00;
+	out[3] = PACKET_TYPE_TRANSACTION_CHUNK;
+	writeU32BigEndian(&(out[4]), payload_header_length + length);
+	memcpy(&(out[8]), payload, payload_header_length);
+	// The SignTransaction header is 13 bytes long.
+	memcpy(&(out[8 + payload_header_length]), &(test_stream_sign_tx[13 + offset]), length);
+	test_stream_sign_tx_chunked_length += 8 + payload_header_length + length;
+}
+
+/** Fill in #test_stream_sign_tx_chunked, using the transaction data in
+  * #test_stream_sign_tx, followed by its button acknowledgement. The chunks
+  * include a resent chunk, one
+  * which leaves a gap and one which overlaps what was already sent; the
+  * device should ignore or trim these. */
+static void buildSignTransactionChunkedTestStream(void)
+{
+	static const uint8_t header[] = {
+	0x23, 0x23, 0x00, PACKET_TYPE_SIGN_TRANSACTION_CHUNKED, 0x00, 0x00, 0x00, 0x05,
+	0x08, 0x01, // address_handle = 1
+	0x10, 0x9b, 0x03}; // transaction_length = 411
+
+	memcpy(test_stream_sign_tx_chunked, header, sizeof(header));
+	test_stream_sign_tx_chunked_length = sizeof(header);
+	appendTransactionChunk(0, 150);
+	appendTransactionChunk(0, 150); // resent
+	appendTransactionChunk(300, 111); // gap
+	appendTransactionChunk(100, 200); // overlap
+	appendTransactionChunk(300, 111);
+	memcpy(&(test_stream_sign_tx_chunked[test_stream_sign_tx_chunked_length]), &(test_stream_sign_tx[sizeof(test_stream_sign_tx) - 8]), 8);
+	test_stream_sign_tx_chunked_length += 8;
+}
+
+/** Length, in bytes, of the input transaction (including the is_ref byte and
+  * output number) at the start of the transaction data in
+  * #test_stream_sign_tx. */
+#define TEST_INPUT_RECORD_LENGTH	262
+
+/** Test stream data for: get a trusted input token for the input
+  * transaction in #test_stream_sign_tx. This is filled in by
+  * buildGetTrustedInputTestStream(). */
+static uint8_t test_stream_get_trusted_input[11 + TEST_INPUT_RECORD_LENGTH];
+
+/** Fill in #test_stream_get_trusted_input, using the input transaction in
+  * #test_stream_sign_tx. */
+static void buildGetTrustedInputTestStream(void)
+{
+	static const uint8_t header[] = {
+	0x23, 0x23, 0x00, 0x1d, 0x00, 0x00, 0x01, 0x09,
+	0x0a, 0x86, 0x02};
+
+	memcpy(test_stream_get_trusted_input, header, sizeof(header));
+	// The SignTransaction header is 13 bytes long.
+	memcpy(&(test_stream_get_trusted_input[sizeof(header)]), &(test_stream_sign_tx[13]), TEST_INPUT_RECORD_LENGTH);
+}
+
 /** Test stream data for: format storage and allow button press. */
 static const uint8_t test_stream_format[] = {
 0x23, 0x23, 0x00, 0x0d, 0x00, 0x00, 0x00, 0x22,
@@ -1833,6 +4080,11 @@ static const uint8_t test_stream_load_incorrect[] = {
 static const uint8_t test_stream_init[] = {
 0x23, 0x23, 0x00, 0x17, 0x00, 0x00, 0x00, 0x04, 0x0a, 0x02, 0x61, 0x62};
 
+/** Test stream data for: initialise and ask for compact records. */
+static const uint8_t test_stream_init_compact[] = {
+0x23, 0x23, 0x00, 0x17, 0x00, 0x00, 0x00, 0x06, 0x0a, 0x02, 0x61, 0x62,
+0x10, 0x01};
+
 /** Test stream data for: change encryption key and allow button press. */
 static const uint8_t test_stream_change_key[] = {
 0x23, 0x23, 0x00, 0x0e, 0x00, 0x00, 0x00, 0x22,
@@ -1914,6 +4166,35 @@ static const uint8_t test_stream_restore_wallet[] = {
 
 0x23, 0x23, 0x00, 0x51, 0x00, 0x00, 0x00, 0x00};
 
+/** Test stream data for: restore wallet from a BIP39 mnemonic and allow
+  * button press. The mnemonic and passphrase are those of the first BIP39
+  * test vector. */
+static const uint8_t test_stream_restore_wallet_mnemonic[] = {
+0x23, 0x23, 0x00, 0x21, 0x00, 0x00, 0x00, 0x7d,
+0x0a, 0x14,
+0x08, 0x00, // wallet number
+0x1a, 0x0e,
+0x65, 0x65, 0x65, 0x65, 0x65, 0x65, 0x65, 0x20, // name
+0x66, 0x66, 0x20, 0x20, 0x20, 0x6f,
+0x20, 0x00, // make hidden?
+0x12, 0x5d,
+0x61, 0x62, 0x61, 0x6e, 0x64, 0x6f, 0x6e, 0x20, // mnemonic ("abandon abandon ... about")
+0x61, 0x62, 0x61, 0x6e, 0x64, 0x6f, 0x6e, 0x20,
+0x61, 0x62, 0x61, 0x6e, 0x64, 0x6f, 0x6e, 0x20,
+0x61, 0x62, 0x61, 0x6e, 0x64, 0x6f, 0x6e, 0x20,
+0x61, 0x62, 0x61, 0x6e, 0x64, 0x6f, 0x6e, 0x20,
+0x61, 0x62, 0x61, 0x6e, 0x64, 0x6f, 0x6e, 0x20,
+0x61, 0x62, 0x61, 0x6e, 0x64, 0x6f, 0x6e, 0x20,
+0x61, 0x62, 0x61, 0x6e, 0x64, 0x6f, 0x6e, 0x20,
+0x61, 0x62, 0x61, 0x6e, 0x64, 0x6f, 0x6e, 0x20,
+0x61, 0x62, 0x61, 0x6e, 0x64, 0x6f, 0x6e, 0x20,
+0x61, 0x62, 0x61, 0x6e, 0x64, 0x6f, 0x6e, 0x20,
+0x61, 0x62, 0x6f, 0x75, 0x74,
+0x1a, 0x06,
+0x54, 0x52, 0x45, 0x5a, 0x4f, 0x52, // passphrase
+
+0x23, 0x23, 0x00, 0x51, 0x00, 0x00, 0x00, 0x00};
+
 /** Test stream data for: get device UUID. */
 static const uint8_t test_stream_get_device_uuid[] = {
 0x23, 0x23, 0x00, 0x13, 0x00, 0x00, 0x00, 0x00};
@@ -1934,6 +4215,87 @@ static const uint8_t test_stream_get_entropy32[] = {
 static const uint8_t test_stream_get_entropy100[] = {
 0x23, 0x23, 0x00, 0x14, 0x00, 0x00, 0x00, 0x02, 0x08, 0x64};
 
+/** Test stream data for: get 1016 bytes of entropy (the maximum). */
+static const uint8_t test_stream_get_entropy1016[] = {
+0x23, 0x23, 0x00, 0x14, 0x00, 0x00, 0x00, 0x03, 0x08, 0xf8, 0x07};
+
+/** Test stream data for: get 1017 bytes of entropy (which is too many). */
+static const uint8_t test_stream_get_entropy1017[] = {
+0x23, 0x23, 0x00, 0x14, 0x00, 0x00, 0x00, 0x03, 0x08, 0xf9, 0x07};
+
+#ifdef STREAM_COMM_PROFILE
+/** Test stream data for: get performance counters, then reset them. */
+static const uint8_t test_stream_get_performance_counters_reset[] = {
+0x23, 0x23, 0x00, 0x1b, 0x00, 0x00, 0x00, 0x02, 0x08, 0x01};
+
+/** Test stream data for: get performance counters. */
+static const uint8_t test_stream_get_performance_counters[] = {
+0x23, 0x23, 0x00, 0x1b, 0x00, 0x00, 0x00, 0x00};
+#endif // #ifdef STREAM_COMM_PROFILE
+
+#ifdef NV_STATISTICS
+/** Test stream data for: get storage statistics, then reset them. */
+static const uint8_t test_stream_get_storage_statistics_reset[] = {
+0x23, 0x23, 0x00, 0x22, 0x00, 0x00, 0x00, 0x02, 0x08, 0x01};
+
+/** Test stream data for: get storage statistics. */
+static const uint8_t test_stream_get_storage_statistics[] = {
+0x23, 0x23, 0x00, 0x22, 0x00, 0x00, 0x00, 0x00};
+#endif // #ifdef NV_STATISTICS
+
+#ifdef PC_SAMPLING
+/** Test stream data for: get the first page of the PC sample histogram. */
+static const uint8_t test_stream_get_pc_samples[] = {
+0x23, 0x23, 0x00, 0x23, 0x00, 0x00, 0x00, 0x00};
+
+/** Test stream data for: get the second page of the PC sample histogram,
+  * then clear it. */
+static const uint8_t test_stream_get_pc_samples_page2_clear[] = {
+0x23, 0x23, 0x00, 0x23, 0x00, 0x00, 0x00, 0x05,
+0x08, 0xe8, 0x03, // first_bucket = 488
+0x10, 0x01}; // clear = true
+
+/** Test stream data for: narrow the PC sample histogram down to the
+  * range 0x1000 to 0x1100. */
+static const uint8_t test_stream_set_pc_sample_range[] = {
+0x23, 0x23, 0x00, 0x23, 0x00, 0x00, 0x00, 0x06,
+0x18, 0x80, 0x20, // range_start = 0x1000
+0x20, 0x80, 0x22}; // range_end = 0x1100
+
+/** Test stream data for: set an empty PC sample histogram range (should
+  * fail). */
+static const uint8_t test_stream_set_bad_pc_sample_range[] = {
+0x23, 0x23, 0x00, 0x23, 0x00, 0x00, 0x00, 0x06,
+0x18, 0x80, 0x22, // range_start = 0x1100
+0x20, 0x80, 0x20}; // range_end = 0x1000
+#endif // #ifdef PC_SAMPLING
+
+#ifdef STREAM_COMM_LINK_SPEED
+/** Test stream data for: change link speed to 921600 baud. */
+static const uint8_t test_stream_set_link_speed[] = {
+0x23, 0x23, 0x00, 0x1c, 0x00, 0x00, 0x00, 0x04, 0x08, 0x80, 0xa0, 0x38};
+
+/** Test stream data for: change link speed to 1000000 baud (which isn't
+  * supported). */
+static const uint8_t test_stream_set_link_speed_unsupported[] = {
+0x23, 0x23, 0x00, 0x1c, 0x00, 0x00, 0x00, 0x04, 0x08, 0xc0, 0x84, 0x3d};
+#endif // #ifdef STREAM_COMM_LINK_SPEED
+
+#ifdef WALLET_CONTEXTS
+/** Test stream data for: select wallet context 1. */
+static const uint8_t test_stream_select_wallet_context1[] = {
+0x23, 0x23, 0x00, 0x20, 0x00, 0x00, 0x00, 0x02, 0x08, 0x01};
+
+/** Test stream data for: select wallet context 0. */
+static const uint8_t test_stream_select_wallet_context0[] = {
+0x23, 0x23, 0x00, 0x20, 0x00, 0x00, 0x00, 0x02, 0x08, 0x00};
+
+/** Test stream data for: select wallet context 200 (which shouldn't
+  * exist). */
+static const uint8_t test_stream_select_wallet_context200[] = {
+0x23, 0x23, 0x00, 0x20, 0x00, 0x00, 0x00, 0x03, 0x08, 0xc8, 0x01};
+#endif // #ifdef WALLET_CONTEXTS
+
 /** Ping (get version). */
 static const uint8_t test_stream_ping[] = {
 0x23, 0x23, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x0a, 0x03, 0x4d, 0x6f, 0x6f};
@@ -1971,6 +4333,34 @@ static void sendOneTestStream(const uint8_t *test_stream, uint32_t size)
 	printf("\n");
 }
 
+/** Test response of processPacket() for a test stream containing several
+  * pipelined requests. processPacket() is called once per request, and
+  * afterwards the entire test stream should have been consumed.
+  * \param test_stream The test stream data to use.
+  * \param size The length of the test stream, in bytes.
+  * \param num_packets The number of request packets in the test stream.
+  */
+static void sendPipelinedTestStream(const uint8_t *test_stream, uint32_t size, unsigned int num_packets)
+{
+	unsigned int i;
+
+	setTestInputStream(test_stream, size);
+	for (i = 0; i < num_packets; i++)
+	{
+		processPacket();
+		printf("\n");
+	}
+	if (stream_ptr != stream_length)
+	{
+		printf("Pipelined requests weren't all consumed\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+}
+
 /** Wrapper around sendOneTestStream() that covers its most common use
   * case (use of a constant byte array). */
 #define SEND_ONE_TEST_STREAM(x)	sendOneTestStream(x, (uint32_t)sizeof(x));
@@ -2005,16 +4395,73 @@ int main(void)
 	SEND_ONE_TEST_STREAM(test_stream_get_address1);
 	printf("Getting address 0...\n");
 	SEND_ONE_TEST_STREAM(test_stream_get_address0);
+	printf("Getting addresses 2 to 4...\n");
+	SEND_ONE_TEST_STREAM(test_stream_get_addresses2to4);
+	printf("Getting addresses 3 to 5...\n");
+	SEND_ONE_TEST_STREAM(test_stream_get_addresses3to5);
+	printf("Getting address 1, address 0, number of addresses and address 2, pipelined...\n");
+	sendPipelinedTestStream(test_stream_pipelined, (uint32_t)sizeof(test_stream_pipelined), 4);
 	printf("Signing transaction...\n");
 	SEND_ONE_TEST_STREAM(test_stream_sign_tx);
-	printf("Signing transaction again...\n");
+	printf("Signing transaction again (signature should come from cache)...\n");
+	SEND_ONE_TEST_STREAM(test_stream_sign_tx);
+	printf("Signing transaction using SignTransactionMultiple...\n");
+	buildSignTransactionMultipleTestStream();
+	SEND_ONE_TEST_STREAM(test_stream_sign_tx_multiple);
+	printf("Signing one input with two keys using SignTransactionMultiple...\n");
+	buildSignMultisigInputTestStream();
+	SEND_ONE_TEST_STREAM(test_stream_sign_multisig_input);
+	printf("Signing transaction using chunked upload...\n");
+	buildSignTransactionChunkedTestStream();
+	sendOneTestStream(test_stream_sign_tx_chunked, test_stream_sign_tx_chunked_length);
+	// All the chunks should have been consumed. The button acknowledgement
+	// is only consumed if the transaction hadn't already been approved.
+	if ((stream_ptr != stream_length) && (stream_ptr != stream_length - 8))
+	{
+		printf("Transaction chunks weren't all consumed\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	printf("Signing transaction as witness transaction...\n");
+	// Same message as SignTransactionMultiple, just a different packet type.
+	test_stream_sign_tx_multiple[3] = PACKET_TYPE_SIGN_WITNESS_TRANSACTION;
+	SEND_ONE_TEST_STREAM(test_stream_sign_tx_multiple);
+	printf("Getting a trusted input token...\n");
+	buildGetTrustedInputTestStream();
+	SEND_ONE_TEST_STREAM(test_stream_get_trusted_input);
+	printf("Getting a trusted input token for a truncated spending transaction (should fail)...\n");
+	// Turn the first 100 bytes of the input transaction into the whole
+	// message, and change the is_ref byte so that it claims to be a spending
+	// transaction.
+	test_stream_get_trusted_input[6] = 0x00;
+	test_stream_get_trusted_input[7] = 0x66;
+	test_stream_get_trusted_input[9] = 0x64;
+	test_stream_get_trusted_input[10] = 0x00; // is_ref = 0 (main)
+	sendOneTestStream(test_stream_get_trusted_input, 8 + 0x66);
+	printf("Signing a different transaction...\n");
+	buildSignOtherTransactionTestStream();
+	SEND_ONE_TEST_STREAM(test_stream_sign_other_tx);
+	printf("Signing first transaction again (shouldn't ask for approval)...\n");
 	SEND_ONE_TEST_STREAM(test_stream_sign_tx);
+	printf("Signing different transaction again (shouldn't ask for approval)...\n");
+	SEND_ONE_TEST_STREAM(test_stream_sign_other_tx);
 	printf("Loading wallet using incorrect key...\n");
 	SEND_ONE_TEST_STREAM(test_stream_load_incorrect);
 	printf("Loading wallet using correct key...\n");
 	SEND_ONE_TEST_STREAM(test_stream_load_correct);
 	printf("Changing wallet key...\n");
 	SEND_ONE_TEST_STREAM(test_stream_change_key);
+	printf("Initialising with compact records...\n");
+	SEND_ONE_TEST_STREAM(test_stream_init_compact);
+	printf("Loading wallet using changed key...\n");
+	SEND_ONE_TEST_STREAM(test_stream_load_with_changed_key);
+	printf("Getting addresses 2 to 4 as compact records...\n");
+	SEND_ONE_TEST_STREAM(test_stream_get_addresses2to4);
+	printf("Getting addresses 3 to 5 as compact records (should fail)...\n");
+	SEND_ONE_TEST_STREAM(test_stream_get_addresses3to5);
 	printf("Initialising again...\n");
 	SEND_ONE_TEST_STREAM(test_stream_init);
 	printf("Loading wallet using changed key...\n");
@@ -2029,6 +4476,10 @@ int main(void)
 	SEND_ONE_TEST_STREAM(test_stream_delete);
 	printf("Restoring a wallet...\n");
 	SEND_ONE_TEST_STREAM(test_stream_restore_wallet);
+	printf("Deleting restored wallet...\n");
+	SEND_ONE_TEST_STREAM(test_stream_delete);
+	printf("Restoring a wallet from a BIP39 mnemonic...\n");
+	SEND_ONE_TEST_STREAM(test_stream_restore_wallet_mnemonic);
 	printf("Getting device UUID...\n");
 	SEND_ONE_TEST_STREAM(test_stream_get_device_uuid);
 	printf("Getting 0 bytes of entropy...\n");
@@ -2039,6 +4490,10 @@ int main(void)
 	SEND_ONE_TEST_STREAM(test_stream_get_entropy32);
 	printf("Getting 100 bytes of entropy...\n");
 	SEND_ONE_TEST_STREAM(test_stream_get_entropy100);
+	printf("Getting 1016 bytes of entropy...\n");
+	SEND_ONE_TEST_STREAM(test_stream_get_entropy1016);
+	printf("Getting 1017 bytes of entropy...\n");
+	SEND_ONE_TEST_STREAM(test_stream_get_entropy1017);
 	printf("Pinging...\n");
 	SEND_ONE_TEST_STREAM(test_stream_ping);
 	printf("Getting master public key...\n");
@@ -2047,6 +4502,52 @@ int main(void)
 	SEND_ONE_TEST_STREAM(test_get_master_public_key_no_press);
 	printf("Loading wallet but not allowing password to be sent...\n");
 	SEND_ONE_TEST_STREAM(test_stream_load_no_key);
+#ifdef STREAM_COMM_PROFILE
+	printf("Getting performance counters, then resetting them...\n");
+	SEND_ONE_TEST_STREAM(test_stream_get_performance_counters_reset);
+	printf("Getting performance counters (should have no entries)...\n");
+	SEND_ONE_TEST_STREAM(test_stream_get_performance_counters);
+#endif // #ifdef STREAM_COMM_PROFILE
+#ifdef NV_STATISTICS
+	printf("Getting storage statistics, then resetting them...\n");
+	SEND_ONE_TEST_STREAM(test_stream_get_storage_statistics_reset);
+	printf("Getting storage statistics (flush count should be 0)...\n");
+	SEND_ONE_TEST_STREAM(test_stream_get_storage_statistics);
+#endif // #ifdef NV_STATISTICS
+#ifdef PC_SAMPLING
+	pcSamplingInit(&test_pc_sampling_state);
+	pcSamplingRecord(0x1000); // bucket 0
+	pcSamplingRecord(0x107f); // bucket 0
+	pcSamplingRecord(0x1080); // bucket 1
+	pcSamplingRecord(0x10fff); // bucket 511, on the second page
+	pcSamplingRecord(0x11000); // out of range
+	printf("Getting PC samples (total 5, 1 out of range, bucket 0 = 2, bucket 1 = 1)...\n");
+	SEND_ONE_TEST_STREAM(test_stream_get_pc_samples);
+	printf("Getting second page of PC samples, then clearing them (bucket 511 = 1)...\n");
+	SEND_ONE_TEST_STREAM(test_stream_get_pc_samples_page2_clear);
+	printf("Getting PC samples (should be empty)...\n");
+	SEND_ONE_TEST_STREAM(test_stream_get_pc_samples);
+	printf("Narrowing PC sample range (bucket shift should be 0)...\n");
+	SEND_ONE_TEST_STREAM(test_stream_set_pc_sample_range);
+	printf("Setting empty PC sample range (should fail)...\n");
+	SEND_ONE_TEST_STREAM(test_stream_set_bad_pc_sample_range);
+#endif // #ifdef PC_SAMPLING
+#ifdef STREAM_COMM_LINK_SPEED
+	printf("Changing link speed to 921600 baud...\n");
+	SEND_ONE_TEST_STREAM(test_stream_set_link_speed);
+	printf("Changing link speed to unsupported speed...\n");
+	SEND_ONE_TEST_STREAM(test_stream_set_link_speed_unsupported);
+#endif // #ifdef STREAM_COMM_LINK_SPEED
+#ifdef WALLET_CONTEXTS
+	printf("Selecting wallet context 1...\n");
+	SEND_ONE_TEST_STREAM(test_stream_select_wallet_context1);
+	printf("Getting number of addresses in wallet context 1 (should fail)...\n");
+	SEND_ONE_TEST_STREAM(test_stream_get_num_addresses);
+	printf("Selecting wallet context 200 (should fail)...\n");
+	SEND_ONE_TEST_STREAM(test_stream_select_wallet_context200);
+	printf("Selecting wallet context 0...\n");
+	SEND_ONE_TEST_STREAM(test_stream_select_wallet_context0);
+#endif // #ifdef WALLET_CONTEXTS
 
 	finishTests();
 	exit(0);
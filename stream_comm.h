@@ -60,6 +60,40 @@
 #define PACKET_TYPE_DELETE_WALLET		0x16
 /** Initialise device's state. */
 #define PACKET_TYPE_INITIALIZE			0x17
+/** Sign many inputs of a transaction at once. */
+#define PACKET_TYPE_SIGN_TRANSACTION_MULTIPLE	0x18
+/** Sign many witness (BIP 143) inputs of a transaction at once. This uses
+  * the same message as #PACKET_TYPE_SIGN_TRANSACTION_MULTIPLE. */
+#define PACKET_TYPE_SIGN_WITNESS_TRANSACTION	0x19
+/** Request for the addresses and public keys of a range of address
+  * handles. */
+#define PACKET_TYPE_GET_ADDRESSES_PUBKEYS	0x1a
+/** Get performance counters (debug link request; only available if
+  * STREAM_COMM_PROFILE is defined). */
+#define PACKET_TYPE_GET_PERFORMANCE_COUNTERS	0x1b
+/** Change the speed of the link to the host (only available if
+  * STREAM_COMM_LINK_SPEED is defined). */
+#define PACKET_TYPE_SET_LINK_SPEED		0x1c
+/** Request for a trusted input token for an output of a previous
+  * transaction. */
+#define PACKET_TYPE_GET_TRUSTED_INPUT	0x1d
+/** Get the event trace (debug link request; only available if
+  * STREAM_COMM_TRACE is defined). */
+#define PACKET_TYPE_GET_TRACE			0x1e
+/** Sign a transaction whose data is uploaded in chunks (see
+  * #PACKET_TYPE_CHUNK_REQUEST). */
+#define PACKET_TYPE_SIGN_TRANSACTION_CHUNKED	0x1f
+/** Select which wallet context subsequent requests operate on (only
+  * available if WALLET_CONTEXTS is defined). */
+#define PACKET_TYPE_SELECT_WALLET_CONTEXT	0x20
+/** Restore wallet from a BIP39 mnemonic sentence. */
+#define PACKET_TYPE_RESTORE_WALLET_MNEMONIC	0x21
+/** Get non-volatile storage wear and latency statistics (debug link
+  * request; only available if NV_STATISTICS is defined). */
+#define PACKET_TYPE_GET_STORAGE_STATISTICS	0x22
+/** Get the histogram of program counter samples (debug link request; only
+  * available if PC_SAMPLING is defined). */
+#define PACKET_TYPE_GET_PC_SAMPLES		0x23
 /** An address from a wallet (response to #PACKET_TYPE_GET_ADDRESS_PUBKEY
   * or #PACKET_TYPE_NEW_ADDRESS). */
 #define PACKET_TYPE_ADDRESS_PUBKEY		0x30
@@ -85,6 +119,34 @@
 #define PACKET_TYPE_SIGNATURE			0x39
 /** Version information and list of features. */
 #define PACKET_TYPE_FEATURES			0x3a
+/** Signatures (response to #PACKET_TYPE_SIGN_TRANSACTION_MULTIPLE or
+  * #PACKET_TYPE_SIGN_WITNESS_TRANSACTION). */
+#define PACKET_TYPE_SIGNATURES			0x3b
+/** Many addresses from a wallet (response
+  * to #PACKET_TYPE_GET_ADDRESSES_PUBKEYS). */
+#define PACKET_TYPE_ADDRESSES_PUBKEYS	0x3c
+/** Performance counters (response
+  * to #PACKET_TYPE_GET_PERFORMANCE_COUNTERS). */
+#define PACKET_TYPE_PERFORMANCE_COUNTERS	0x3d
+/** Trusted input token (response to #PACKET_TYPE_GET_TRUSTED_INPUT). */
+#define PACKET_TYPE_TRUSTED_INPUT		0x3e
+/** Event trace (response to #PACKET_TYPE_GET_TRACE). */
+#define PACKET_TYPE_TRACE				0x3f
+/** Many addresses from a wallet, as fixed-layout binary records (response
+  * to #PACKET_TYPE_GET_ADDRESSES_PUBKEYS, if compact records were asked for
+  * in the Initialize message). */
+#define PACKET_TYPE_ADDRESS_RECORDS		0x40
+/** Signatures, as fixed-layout binary records (response
+  * to #PACKET_TYPE_SIGN_TRANSACTION_MULTIPLE or
+  * #PACKET_TYPE_SIGN_WITNESS_TRANSACTION, if compact records were asked for
+  * in the Initialize message). */
+#define PACKET_TYPE_SIGNATURE_RECORDS	0x41
+/** Non-volatile storage statistics (response
+  * to #PACKET_TYPE_GET_STORAGE_STATISTICS). */
+#define PACKET_TYPE_STORAGE_STATISTICS	0x42
+/** Histogram of program counter samples (response
+  * to #PACKET_TYPE_GET_PC_SAMPLES). */
+#define PACKET_TYPE_PC_SAMPLES			0x43
 /** Device wants to wait for button press (beginning of ButtonRequest
   * interjection). */
 #define PACKET_TYPE_BUTTON_REQUEST		0x50
@@ -109,9 +171,36 @@
 /** Host does not want to send one-time password (response
   * to #PACKET_TYPE_OTP_REQUEST). */
 #define PACKET_TYPE_OTP_CANCEL			0x58
+/** Device wants host to send the next chunk of transaction data, and
+  * acknowledges what it has so far (interjection during
+  * #PACKET_TYPE_SIGN_TRANSACTION_CHUNKED). */
+#define PACKET_TYPE_CHUNK_REQUEST		0x59
+/** Host sends a chunk of transaction data (response
+  * to #PACKET_TYPE_CHUNK_REQUEST). */
+#define PACKET_TYPE_TRANSACTION_CHUNK	0x5a
 /**@}*/
 
+/** Length, in bytes, of each record in a #PACKET_TYPE_ADDRESS_RECORDS
+  * packet. Each record consists of:
+  * - the address handle (4 bytes, big-endian), at offset 0;
+  * - the compressed public key (33 bytes), at offset 4;
+  * - the address, i.e. HASH160 of the public key (20 bytes), at offset 37.
+  */
+#define ADDRESS_RECORD_LENGTH		57
+/** Length, in bytes, of each record in a #PACKET_TYPE_SIGNATURE_RECORDS
+  * packet. Each record consists of the length of the signature (1 byte),
+  * followed by the signature itself, padded with zeroes to 73 bytes
+  * (the maximum length of a DER signature plus hash type). */
+#define SIGNATURE_RECORD_LENGTH		74
+
 extern void processPacket(void);
+extern bool uploadGetBytes(uint8_t *buffer, uint32_t length);
+extern const uint8_t *uploadBorrowBytes(uint32_t *length);
+extern void uploadReleaseBytes(uint32_t length);
+extern bool isUploadChunked(void);
+#if defined(BACKGROUND_TASKS) && !defined(WALLET_NO_ADDRESS_CACHE)
+extern void precomputeAddressTask(void);
+#endif // #if defined(BACKGROUND_TASKS) && !defined(WALLET_NO_ADDRESS_CACHE)
 #ifdef TEST
 extern void setTestInputStream(const uint8_t *buffer, uint32_t length);
 extern void setInfiniteZeroInputStream(void);
@@ -0,0 +1,123 @@
+/** \file trace.c
+  *
+  * \brief Records timestamped events in a ring buffer.
+  *
+  * See trace.h for what the event trace is for. Events are recorded in
+  * #trace_buffer, overwriting the oldest event once the buffer is full.
+  * Every event ever recorded (since the last traceClear()) has an event
+  * number, counting up from 0; the event number of the next event to be
+  * recorded is #trace_total_events. That way, the host can tell how many
+  * events were lost to overwriting.
+  *
+  * traceEvent() can be called from interrupt handlers, so it does
+  * everything with interrupts disabled (see traceDisableInterrupts()).
+  * Reading is done from the main loop while the trace is frozen (see
+  * traceFreeze()), so that the trace can't change in the middle of being
+  * sent to the host.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifdef STREAM_COMM_TRACE
+
+#ifndef STREAM_COMM_PROFILE
+#error "STREAM_COMM_TRACE requires STREAM_COMM_PROFILE"
+#endif // #ifndef STREAM_COMM_PROFILE
+
+#include <string.h>
+#include "common.h"
+#include "hwinterface.h"
+#include "trace.h"
+
+#if ((TRACE_BUFFER_ENTRIES & (TRACE_BUFFER_ENTRIES - 1)) != 0)
+#error "TRACE_BUFFER_ENTRIES must be a power of 2"
+#endif // #if ((TRACE_BUFFER_ENTRIES & (TRACE_BUFFER_ENTRIES - 1)) != 0)
+
+/** The event trace. Event number n is stored in
+  * entry (n & (#TRACE_BUFFER_ENTRIES - 1)). */
+static TraceEntry trace_buffer[TRACE_BUFFER_ENTRIES];
+/** Total number of events recorded since the last traceClear(). This is
+  * also the event number of the next event to be recorded. */
+static volatile uint32_t trace_total_events;
+/** While this is true, events are not recorded. */
+static volatile bool trace_frozen;
+
+/** Record an event in the event trace. Use the TRACE() macro in trace.h
+  * instead of calling this directly. If the trace is frozen (see
+  * traceFreeze()), the event is thrown away.
+  * \param event One of #TraceEventEnum.
+  * \param argument Event-specific argument; see #TraceEventEnum.
+  */
+void traceEvent(TraceEvent event, uint16_t argument)
+{
+	uint32_t status;
+	TraceEntry *entry;
+
+	status = traceDisableInterrupts();
+	if (!trace_frozen)
+	{
+		entry = &(trace_buffer[trace_total_events & (TRACE_BUFFER_ENTRIES - 1)]);
+		entry->timestamp = getCycleCount();
+		entry->event = (uint16_t)event;
+		entry->argument = argument;
+		trace_total_events++;
+	}
+	traceRestoreInterrupts(status);
+}
+
+/** Get the total number of events recorded since the last traceClear(),
+  * including ones which have since been overwritten.
+  * \return The total number of events.
+  */
+uint32_t traceGetTotalEvents(void)
+{
+	return trace_total_events;
+}
+
+/** Get one event from the event trace. This should only be called while
+  * the trace is frozen (see traceFreeze()).
+  * \param out The event will be written here.
+  * \param event_number The event number (see the comments at the top of
+  *                     this file) of the event to get.
+  * \return false on success, true if the event hasn't been recorded yet or
+  *         has been overwritten.
+  */
+bool traceGetEntry(TraceEntry *out, uint32_t event_number)
+{
+	uint32_t age;
+
+	// The subtraction makes this work even if the event counter has
+	// wrapped around.
+	age = trace_total_events - event_number;
+	if ((age == 0) || (age > TRACE_BUFFER_ENTRIES))
+	{
+		return true;
+	}
+	memcpy(out, &(trace_buffer[event_number & (TRACE_BUFFER_ENTRIES - 1)]), sizeof(TraceEntry));
+	return false;
+}
+
+/** Stop or start recording events. The trace should be frozen while it is
+  * being read, so that nothing (in particular, an interrupt handler) can
+  * overwrite events which are about to be read.
+  * \param freeze Use true to stop recording events, false to start
+  *               recording events again.
+  */
+void traceFreeze(bool freeze)
+{
+	trace_frozen = freeze;
+}
+
+/** Throw away every event in the event trace and reset the event
+  * counter. */
+void traceClear(void)
+{
+	uint32_t status;
+
+	status = traceDisableInterrupts();
+	trace_total_events = 0;
+	memset(trace_buffer, 0, sizeof(trace_buffer));
+	traceRestoreInterrupts(status);
+}
+
+#endif // #ifdef STREAM_COMM_TRACE
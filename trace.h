@@ -0,0 +1,117 @@
+/** \file trace.h
+  *
+  * \brief Describes the event trace, a timeline of what the device was doing.
+  *
+  * The performance counters in profile.h only give totals. When something
+  * occasionally takes much longer than it should (for example, the host's
+  * USB packets being NAKed while a point multiplication is in progress, or
+  * a flash sector erase stalling a request), it's more useful to know the
+  * order in which things happened. The event trace is a ring buffer in RAM
+  * which records short, timestamped events. Events can be recorded from
+  * both the main loop and interrupt handlers. The host can read the trace
+  * using a GetTrace message (see stream_comm.c); pic32/testers/hwb_trace.c
+  * does that and displays the result as a timeline.
+  *
+  * Tracing is only compiled in if STREAM_COMM_TRACE is defined. If it isn't,
+  * TRACE() expands to nothing. Since timestamps come from getCycleCount(),
+  * STREAM_COMM_TRACE requires STREAM_COMM_PROFILE.
+  *
+  * This file is licensed as described by the file LICENCE.
+  */
+
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#ifdef STREAM_COMM_TRACE
+
+#include "common.h"
+
+/** Events which can be recorded in the event trace. The meaning of the
+  * argument of each event is given in brackets. This list must be kept in
+  * sync with the one in pic32/testers/hwb_trace.c. */
+typedef enum TraceEventEnum
+{
+	/** processPacket() has received a packet header (packet type). */
+	TRACE_PACKET_BEGIN			= 1,
+	/** processPacket() has finished processing a packet (packet type). */
+	TRACE_PACKET_END			= 2,
+	/** A packet was received from the host (packet length). */
+	TRACE_USB_RECEIVE			= 3,
+	/** A receive wasn't queued because the receive FIFO is nearly full, so
+	  * the host is being NAKed from now on (endpoint number). */
+	TRACE_USB_RECEIVE_STALL		= 4,
+	/** A receive was queued after a stall (endpoint number). */
+	TRACE_USB_RECEIVE_RESUME	= 5,
+	/** A packet was queued for transmission to the host (packet length). */
+	TRACE_USB_TRANSMIT			= 6,
+	/** Waiting for space in the transmit FIFO (bytes left to write). */
+	TRACE_USB_TRANSMIT_WAIT		= 7,
+	/** Started writing back a non-volatile memory sector (sector number). */
+	TRACE_NV_FLUSH_BEGIN		= 8,
+	/** Finished writing back a non-volatile memory sector (one
+	  * of #NonVolatileReturnEnum). */
+	TRACE_NV_FLUSH_END			= 9,
+	/** Started erasing a flash sector (physical sector number). */
+	TRACE_NV_ERASE_BEGIN		= 10,
+	/** Finished erasing a flash sector (physical sector number). */
+	TRACE_NV_ERASE_END			= 11,
+	/** Started collecting and testing HWRNG samples (0). */
+	TRACE_HWRNG_FILL_BEGIN		= 12,
+	/** ADC sampling had to be restarted because the filter fell behind
+	  * (number of samples collected so far). */
+	TRACE_HWRNG_OVERRUN			= 13,
+	/** Finished collecting and testing HWRNG samples (0 if all tests
+	  * passed, non-zero if any failed). */
+	TRACE_HWRNG_FILL_END		= 14,
+	/** Started an ECDSA signing operation (0, or the number of signatures
+	  * for ecdsaSignBatch()). */
+	TRACE_ECDSA_SIGN_BEGIN		= 15,
+	/** Finished an ECDSA signing operation (same as for
+	  * #TRACE_ECDSA_SIGN_BEGIN). */
+	TRACE_ECDSA_SIGN_END		= 16
+} TraceEvent;
+
+/** One entry in the event trace. This is also the format of each entry in
+  * the events field of a Trace message, except that there, everything is
+  * little-endian. */
+typedef struct TraceEntryStruct
+{
+	/** Value of getCycleCount() when the event was recorded. */
+	uint32_t timestamp;
+	/** What happened (one of #TraceEventEnum). */
+	uint16_t event;
+	/** Event-specific argument. */
+	uint16_t argument;
+} TraceEntry;
+
+#ifndef TRACE_BUFFER_ENTRIES
+/** Number of entries in the event trace. Once this many events have been
+  * recorded, each new event overwrites the oldest one. This must be a power
+  * of 2. */
+#define TRACE_BUFFER_ENTRIES	128
+#endif // #ifndef TRACE_BUFFER_ENTRIES
+
+/** Size, in bytes, of each entry when it is sent to the host. */
+#define TRACE_ENTRY_SIZE		8
+
+extern void traceEvent(TraceEvent event, uint16_t argument);
+extern bool traceGetEntry(TraceEntry *out, uint32_t event_number);
+extern uint32_t traceGetTotalEvents(void);
+extern void traceFreeze(bool freeze);
+extern void traceClear(void);
+
+/** Record an event in the event trace. This is cheap enough to use in
+  * interrupt handlers.
+  * \param event One of #TraceEventEnum.
+  * \param argument Event-specific argument; see #TraceEventEnum. This will
+  *                 be truncated to 16 bits.
+  */
+#define TRACE(event, argument)	traceEvent(event, (uint16_t)(argument))
+
+#else
+
+#define TRACE(event, argument)
+
+#endif // #ifdef STREAM_COMM_TRACE
+
+#endif // #ifndef TRACE_H_INCLUDED
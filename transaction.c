@@ -22,37 +22,21 @@
 
 #ifdef TEST_TRANSACTION
 #include "test_helpers.h"
-#include "stream_comm.h"
 #include "wallet.h"
 #endif // #ifdef TEST_TRANSACTION
 
 #include "common.h"
 #include "endian.h"
+#include "stream_comm.h"
 #include "ecdsa.h"
 #include "baseconv.h"
 #include "sha256.h"
 #include "bignum256.h"
 #include "prandom.h"
 #include "hwinterface.h"
+#include "hmac_sha512.h"
 #include "transaction.h"
-
-/** The maximum size of a transaction (in bytes) which parseTransaction()
-  * is prepared to handle. */
-#define MAX_TRANSACTION_SIZE	2000000
-/** The maximum number of inputs that the transaction parser is prepared
-  * to handle. This should be small enough that a transaction with the
-  * maximum number of inputs is still less than #MAX_TRANSACTION_SIZE bytes in
-  * size.
-  * \warning This must be < 65536, otherwise an integer overflow may occur.
-  */
-#define MAX_INPUTS				5000
-/** The maximum number of outputs that the transaction parser is prepared
-  * to handle. This should be small enough that a transaction with the
-  * maximum number of outputs is still less than #MAX_TRANSACTION_SIZE bytes
-  * in size.
-  * \warning This must be < 65536, otherwise an integer overflow may occur.
-  */
-#define MAX_OUTPUTS				2000
+#include "profile.h"
 
 /** The maximum amount that can appear in an output, stored as a little-endian
   * multi-precision integer. This represents 21 million BTC. */
@@ -61,7 +45,7 @@ static const uint8_t max_money[] = {
 
 /** The transaction fee amount, calculated as output amounts subtracted from
   * input amounts. */
-static uint8_t transaction_fee_amount[8];
+static uint8_t transaction_fee_amount[8] WORD_ALIGNED;
 
 /** Where the transaction parser is within a transaction. 0 = first byte,
   * 1 = second byte etc. */
@@ -80,13 +64,45 @@ static bool suppress_transaction_hash;
   * and #transaction_hash_hs_ptr from being written to if they don't point
   * to a valid hash state. */
 static bool hs_ptr_valid;
-/** Pointer to hash state used to calculate the signature
-  * hash (see parseTransaction() for what this is all about).
-  * \warning If this does not point to a valid hash state structure, ensure
-  *          that #hs_ptr_valid is false to
+/** Pointer to an array of hash states used to calculate the signature
+  * hashes (see parseTransaction() and parseTransactionMultiple() for what
+  * this is all about). The array has #num_sig_hash_hs entries.
+  * \warning If this does not point to a valid array of hash state
+  *          structures, ensure that #hs_ptr_valid is false to
   *          stop getTransactionBytes() from attempting to dereference this.
   */
 static HashState *sig_hash_hs_ptr;
+/** Number of entries in the array that #sig_hash_hs_ptr points to. */
+static uint8_t num_sig_hash_hs;
+/** If this is NULL, then input scripts are included in every signature hash
+  * as they appear in the transaction data. Otherwise, this points to an
+  * array (with #num_sig_hash_hs entries) of input numbers. Signature hash i
+  * will only include the script of input sig_hash_input_numbers[i]; all
+  * other input scripts are replaced with empty scripts.
+  *
+  * In that case, the array that #sig_hash_hs_ptr points to also has an
+  * extra entry (at index #num_sig_hash_hs), which is the "prefix" hash
+  * state. The prefix hash state is calculated as if every input script
+  * was empty. The other hash states aren't written to until the parser
+  * reaches their input; at that point, the prefix hash state is copied
+  * into them (see #sig_hash_forked). This means the part of the
+  * transaction before an input is only hashed once, no matter how many
+  * signature hashes are being calculated. */
+static uint32_t *sig_hash_input_numbers;
+/** Bit i of this is set if signature hash i has been copied from the
+  * prefix hash state (see #sig_hash_input_numbers) and is being written to.
+  * This is only used if #sig_hash_input_numbers is not NULL. */
+static uint8_t sig_hash_forked;
+/** Bit i of this is set if signature hash i is for the same input as an
+  * earlier signature hash (which happens when one input is signed with
+  * several keys, as in a multi-signature input). Such signature hashes are
+  * never forked from the prefix hash state; they are copied from the
+  * earlier one when parsing finishes, so that each input is only hashed
+  * once. This is only used if #sig_hash_input_numbers is not NULL. */
+static uint8_t sig_hash_duplicate;
+/** The number of the input (0 = first input) whose script is currently
+  * being read. */
+static uint32_t current_input_number;
 /** Pointer to hash state used to calculate the transaction
   * hash (see parseTransaction() for what this is all about).
   * \warning If this does not point to a valid hash state structure, ensure
@@ -95,11 +111,181 @@ static HashState *sig_hash_hs_ptr;
   */
 static HashState *transaction_hash_hs_ptr;
 
+/** The parts of an input which go into its witness (BIP 143) signature
+  * hash, but which can't be obtained from the transaction-wide digests in
+  * #WitnessStateStruct. */
+typedef struct WitnessInputStruct
+{
+	/** Outpoint (input transaction reference hash, followed by
+	  * input transaction reference number), exactly as it appears in the
+	  * spending transaction. */
+	uint8_t outpoint[36];
+	/** Script code (the input's script), not including the length byte. */
+	uint8_t script_code[25];
+	/** Amount of the output that the input references, as an 8 byte
+	  * little-endian number. */
+	uint8_t amount[8];
+	/** Sequence number, exactly as it appears in the spending transaction. */
+	uint8_t sequence[4];
+} WitnessInput;
+
+/** Everything needed to calculate witness (BIP 143) signature hashes.
+  * BIP 143 signature hashes consist mostly of three digests (of all
+  * outpoints, all sequence numbers and all outputs), which are the same for
+  * every input. Those are calculated once, while the transaction is parsed,
+  * so that each input's signature hash can be calculated in constant time
+  * afterwards. */
+typedef struct WitnessStateStruct
+{
+	/** Calculates hashPrevouts (double SHA-256 of all outpoints). */
+	HashState prevouts_hs;
+	/** Calculates hashSequence (double SHA-256 of all sequence numbers). */
+	HashState sequence_hs;
+	/** Calculates hashOutputs (double SHA-256 of all outputs). */
+	HashState outputs_hs;
+	/** Per-input data for each of the requested inputs. */
+	WitnessInput inputs[MAX_SIGN_INPUTS];
+} WitnessState;
+
+/** If this is NULL, then legacy signature hashes are calculated. Otherwise,
+  * this points to the state used to calculate witness (BIP 143) signature
+  * hashes. See parseTransactionWitness() for more details. */
+static WitnessState *witness_state_ptr;
+/** If this is true, then as the transaction contents are read from the
+  * stream device, they will be included in the calculation of hashOutputs.
+  * This is only true while the outputs of the spending transaction are being
+  * parsed, and only if #witness_state_ptr is not NULL. */
+static bool witness_hash_outputs;
+/** The number of input transactions (0 = first one) that have been parsed so
+  * far. Since input transactions must be in the same order as the inputs of
+  * the spending transaction (this is enforced by the reference compare hash
+  * in parseTransactionInternal()), this identifies which input an input
+  * transaction belongs to. */
+static uint32_t ref_transaction_number;
+/** The output number (0 = first output) of the output which the most
+  * recently parsed input transaction (or trusted input token) refers to. */
+static uint32_t ref_output_number;
+
+/** Offset, within a trusted input token, of the 4 byte little-endian output
+  * number. The token starts with the 32 byte transaction ID, in the same
+  * byte order as it appears in the outpoint of a spending transaction. */
+#define TRUSTED_INPUT_OUTPUT_NUMBER_OFFSET	32
+/** Offset, within a trusted input token, of the 8 byte little-endian
+  * amount. */
+#define TRUSTED_INPUT_AMOUNT_OFFSET			36
+/** Offset, within a trusted input token, of the message authentication code,
+  * which covers everything before it. */
+#define TRUSTED_INPUT_MAC_OFFSET			44
+
+/** Key used to calculate the message authentication code of trusted input
+  * tokens. This only lives in RAM, and is replaced for each session (see
+  * clearTrustedInputKey()), so tokens from one session can't be used in
+  * another. */
+static uint8_t trusted_input_key[32];
+/** Whether #trusted_input_key has been generated (see
+  * prepareTrustedInputKey()). */
+static bool trusted_input_key_valid;
+
+/** Include some transaction data in the calculation of the signature,
+  * transaction and witness hashes, as appropriate.
+  * \param buffer The transaction data to hash.
+  * \param length The number of bytes in buffer.
+  */
+static void hashTransactionBytes(const uint8_t *buffer, uint32_t length)
+{
+	uint8_t j;
+
+	// Which hashes the bytes go into can't change during this call,
+	// so they can all be written at once.
+	if (hs_ptr_valid)
+	{
+		if (sig_hash_input_numbers == NULL)
+		{
+			for (j = 0; j < num_sig_hash_hs; j++)
+			{
+				sha256WriteBytes(&(sig_hash_hs_ptr[j]), buffer, length);
+			}
+		}
+		else
+		{
+			// suppress_transaction_hash is only true while an input
+			// script is being read. The prefix hash state never
+			// sees input scripts.
+			if (!suppress_transaction_hash)
+			{
+				sha256WriteBytes(&(sig_hash_hs_ptr[num_sig_hash_hs]), buffer, length);
+			}
+			for (j = 0; j < num_sig_hash_hs; j++)
+			{
+				if (((sig_hash_forked & (1 << j)) != 0)
+					&& (!suppress_transaction_hash
+					|| (sig_hash_input_numbers[j] == current_input_number)))
+				{
+					sha256WriteBytes(&(sig_hash_hs_ptr[j]), buffer, length);
+				}
+			}
+		}
+		if (!suppress_transaction_hash)
+		{
+			sha256WriteBytes(transaction_hash_hs_ptr, buffer, length);
+		}
+		if (witness_hash_outputs)
+		{
+			sha256WriteBytes(&(witness_state_ptr->outputs_hs), buffer, length);
+		}
+	}
+}
+
+/** Find the first signature hash which is for a given input. This is used
+  * to detect inputs which are listed more than once in
+  * #sig_hash_input_numbers (see #sig_hash_duplicate).
+  * \param input_number The input number (0 = first input) to look for.
+  * \return The index into #sig_hash_input_numbers of the first entry which
+  *         is equal to input_number, or #num_sig_hash_hs if there is no
+  *         such entry.
+  */
+static uint8_t findSigHashForInput(uint32_t input_number)
+{
+	uint8_t j;
+
+	for (j = 0; j < num_sig_hash_hs; j++)
+	{
+		if (sig_hash_input_numbers[j] == input_number)
+		{
+			break;
+		}
+	}
+	return j;
+}
+
+/** Check whether reading some transaction data would go beyond the end of
+  * the transaction data.
+  * \param length The number of bytes that are about to be read.
+  * \return false if the read is okay, true if it would go beyond the end of
+  *         the transaction data.
+  */
+static bool isReadPastEnd(uint32_t length)
+{
+	if (transaction_data_index > (0xffffffff - length))
+	{
+		// transaction_data_index + length will overflow.
+		// Since transaction_length <= 0xffffffff, this implies that the read
+		// will go past the end of the transaction.
+		return true; // trying to read past end of transaction
+	}
+	if (transaction_data_index + length > transaction_length)
+	{
+		return true; // trying to read past end of transaction
+	}
+	return false;
+}
+
 /** Get transaction data by reading from the stream device, checking that
   * the read operation won't go beyond the end of the transaction data.
   * 
-  * Since all transaction data is read using this function, the updating
-  * of #sig_hash_hs_ptr and #transaction_hash_hs_ptr is also done.
+  * Since all transaction data is read using this function or
+  * skipTransactionBytes(), the updating of #sig_hash_hs_ptr and
+  * #transaction_hash_hs_ptr is also done.
   * \param buffer An array of bytes which will be filled with the transaction
   *               data (if everything goes well). It must have space for
   *               length bytes.
@@ -109,38 +295,59 @@ static HashState *transaction_hash_hs_ptr;
   */
 static bool getTransactionBytes(uint8_t *buffer, uint8_t length)
 {
-	uint8_t i;
-	uint8_t one_byte;
-
-	if (transaction_data_index > (0xffffffff - (uint32_t)length))
+	if (isReadPastEnd(length))
 	{
-		// transaction_data_index + (uint32_t)length will overflow.
-		// Since transaction_length <= 0xffffffff, this implies that the read
-		// will go past the end of the transaction.
 		return true; // trying to read past end of transaction
 	}
-	if (transaction_data_index + (uint32_t)length > transaction_length)
+	else
+	{
+		PROFILE_ENTER(PROFILE_STREAM_IO);
+		if (uploadGetBytes(buffer, length))
+		{
+			PROFILE_EXIT();
+			return true; // host abandoned chunked upload
+		}
+		PROFILE_EXIT();
+		hashTransactionBytes(buffer, length);
+		transaction_data_index += length;
+		return false;
+	}
+}
+
+/** Skip over transaction data whose contents are only needed for hashing
+  * (for example, scripts which aren't parsed). This borrows the data
+  * straight out of the stream device's receive buffer (see
+  * uploadBorrowBytes()) and hashes it in place, instead of copying it into a
+  * temporary buffer first as getTransactionBytes() does.
+  * \param length The number of bytes to skip.
+  * \return false on success, true if a stream read error occurred or if the
+  *         skip would go beyond the end of the transaction data.
+  */
+static bool skipTransactionBytes(uint32_t length)
+{
+	const uint8_t *span;
+	uint32_t span_length;
+
+	if (isReadPastEnd(length))
 	{
 		return true; // trying to read past end of transaction
 	}
-	else
+	transaction_data_index += length;
+	while (length > 0)
 	{
-		for (i = 0; i < length; i++)
+		PROFILE_ENTER(PROFILE_STREAM_IO);
+		span = uploadBorrowBytes(&span_length);
+		PROFILE_EXIT();
+		if (span == NULL)
 		{
-			one_byte = streamGetOneByte();
-			buffer[i] = one_byte;
-			if (hs_ptr_valid)
-			{
-				sha256WriteByte(sig_hash_hs_ptr, one_byte);
-				if (!suppress_transaction_hash)
-				{
-					sha256WriteByte(transaction_hash_hs_ptr, one_byte);
-				}
-			}
-			transaction_data_index++;
+			return true; // host abandoned chunked upload
 		}
-		return false;
+		span_length = MIN(span_length, length);
+		hashTransactionBytes(span, span_length);
+		uploadReleaseBytes(span_length);
+		length -= span_length;
 	}
+	return false;
 }
 
 /** Checks whether the transaction parser is at the end of the transaction
@@ -204,13 +411,180 @@ static bool getVarInt(uint32_t *out)
 	return false; // success
 }
 
+/** Calculate the witness (BIP 143) signature hashes of the requested inputs.
+  * This should only be called after the entire spending transaction has
+  * been successfully parsed, since it relies on the transaction-wide digests
+  * and per-input data in #witness_state_ptr being complete.
+  *
+  * The amount of work done by this function for each input does not depend
+  * on the size of the transaction.
+  * \param sig_hash See parseTransactionWitness().
+  * \param hs A hash state which will be used to calculate each signature
+  *           hash. Its contents will be overwritten.
+  * \param num_sig_hashes See parseTransactionWitness().
+  */
+static void calculateWitnessSigHashes(uint8_t *sig_hash, HashState *hs, uint8_t num_sig_hashes)
+{
+	uint8_t hash_prevouts[32];
+	uint8_t hash_sequence[32];
+	uint8_t hash_outputs[32];
+	uint8_t temp[4];
+	WitnessInput *input;
+	uint8_t i;
+
+	// The digests are included in the signature hash in the order that
+	// the bytes come out of SHA-256, which is big-endian.
+	sha256FinishDouble(&(witness_state_ptr->prevouts_hs));
+	writeHashToByteArray(hash_prevouts, &(witness_state_ptr->prevouts_hs), true);
+	sha256FinishDouble(&(witness_state_ptr->sequence_hs));
+	writeHashToByteArray(hash_sequence, &(witness_state_ptr->sequence_hs), true);
+	sha256FinishDouble(&(witness_state_ptr->outputs_hs));
+	writeHashToByteArray(hash_outputs, &(witness_state_ptr->outputs_hs), true);
+
+	for (i = 0; i < num_sig_hashes; i++)
+	{
+		input = &(witness_state_ptr->inputs[i]);
+		sha256Begin(hs);
+		writeU32LittleEndian(temp, 0x00000001); // version
+		sha256WriteBytes(hs, temp, 4);
+		sha256WriteBytes(hs, hash_prevouts, 32);
+		sha256WriteBytes(hs, hash_sequence, 32);
+		sha256WriteBytes(hs, input->outpoint, sizeof(input->outpoint));
+		sha256WriteByte(hs, (uint8_t)sizeof(input->script_code));
+		sha256WriteBytes(hs, input->script_code, sizeof(input->script_code));
+		sha256WriteBytes(hs, input->amount, sizeof(input->amount));
+		sha256WriteBytes(hs, input->sequence, sizeof(input->sequence));
+		sha256WriteBytes(hs, hash_outputs, 32);
+		writeU32LittleEndian(temp, 0x00000000); // locktime
+		sha256WriteBytes(hs, temp, 4);
+		writeU32LittleEndian(temp, 0x00000001); // hashtype
+		sha256WriteBytes(hs, temp, 4);
+		sha256FinishDouble(hs);
+		// See parseTransactionInternal() for why this is little-endian.
+		writeHashToByteArray(&(sig_hash[i * 32]), hs, false);
+	}
+}
+
+/** Make sure that there is a key with which to issue and check trusted
+  * input tokens. If there isn't one yet, a new one is generated.
+  * \return false on success, true if the random number generator failed.
+  */
+bool prepareTrustedInputKey(void)
+{
+	if (!trusted_input_key_valid)
+	{
+		if (getRandom256(trusted_input_key))
+		{
+			return true;
+		}
+		trusted_input_key_valid = true;
+	}
+	return false;
+}
+
+/** Discard the key used to issue and check trusted input tokens. This
+  * invalidates all tokens issued so far. It should be called whenever a new
+  * session begins.
+  */
+void clearTrustedInputKey(void)
+{
+	memset(trusted_input_key, 0, sizeof(trusted_input_key));
+	trusted_input_key_valid = false;
+}
+
+/** Calculate the message authentication code of a trusted input token.
+  * This is HMAC-SHA512, truncated to #TRUSTED_INPUT_MAC_LENGTH bytes,
+  * under #trusted_input_key.
+  * \param mac The message authentication code will be written here. This
+  *            must have space for 64 bytes, even though only the first
+  *            #TRUSTED_INPUT_MAC_LENGTH bytes are used.
+  * \param token The token to calculate the message authentication code of.
+  *              Only the first #TRUSTED_INPUT_MAC_OFFSET bytes are used.
+  */
+static void calculateTrustedInputMac(uint8_t *mac, const uint8_t *token)
+{
+	hmacSha512(mac, trusted_input_key, sizeof(trusted_input_key), token, TRUSTED_INPUT_MAC_OFFSET);
+}
+
+/** Parse a trusted input token (see getTrustedInput()) in place of an input
+  * transaction. Once the token is verified, the amount and outpoint in it
+  * are used in exactly the same way as the amount and outpoint of a parsed
+  * input transaction would have been.
+  * \param sig_hash The transaction ID from the token will be written here,
+  *                 as a 32 byte little-endian number, just like the
+  *                 transaction hash of a parsed input transaction.
+  * \param ref_compare_hs See parseTransactionInternal().
+  * \param input_numbers See parseTransactionInternal().
+  * \param num_sig_hashes See parseTransactionInternal().
+  * \return One of the values in #TransactionErrorsEnum.
+  *         #TRANSACTION_INVALID_REFERENCE will be returned if the token was
+  *         not issued by this device in this session, or was modified.
+  */
+static TransactionErrors parseTrustedInputToken(uint8_t *sig_hash, HashState *ref_compare_hs, uint32_t *input_numbers, uint8_t num_sig_hashes)
+{
+	uint8_t token[TRUSTED_INPUT_TOKEN_LENGTH];
+	uint8_t mac[64];
+	uint8_t difference;
+	uint8_t j;
+
+	if (getTransactionBytes(token, TRUSTED_INPUT_TOKEN_LENGTH))
+	{
+		return TRANSACTION_INVALID_FORMAT; // token truncated
+	}
+	if (!trusted_input_key_valid)
+	{
+		return TRANSACTION_INVALID_REFERENCE; // no tokens issued in this session
+	}
+	calculateTrustedInputMac(mac, token);
+	// The comparison is done without an early exit, so that the time it
+	// takes doesn't reveal how much of the message authentication code was
+	// right.
+	difference = 0;
+	for (j = 0; j < TRUSTED_INPUT_MAC_LENGTH; j++)
+	{
+		difference |= (uint8_t)(mac[j] ^ token[TRUSTED_INPUT_MAC_OFFSET + j]);
+	}
+	if (difference != 0)
+	{
+		return TRANSACTION_INVALID_REFERENCE; // token is not authentic
+	}
+
+	if (bigAddVariableSizeNoModulo(transaction_fee_amount, transaction_fee_amount, &(token[TRUSTED_INPUT_AMOUNT_OFFSET]), 8))
+	{
+		return TRANSACTION_INVALID_AMOUNT; // overflow occurred (carry occurred)
+	}
+	if (witness_state_ptr != NULL)
+	{
+		for (j = 0; j < num_sig_hashes; j++)
+		{
+			if (input_numbers[j] == ref_transaction_number)
+			{
+				memcpy(witness_state_ptr->inputs[j].amount, &(token[TRUSTED_INPUT_AMOUNT_OFFSET]), 8);
+			}
+		}
+	}
+	// This writes the same thing to the reference compare hash as parsing
+	// the input transaction would have.
+	sha256WriteBytes(ref_compare_hs, &(token[TRUSTED_INPUT_OUTPUT_NUMBER_OFFSET]), 4);
+	sha256WriteBytes(ref_compare_hs, token, 32);
+	for (j = 0; j < 32; j++)
+	{
+		sig_hash[j] = token[31 - j];
+	}
+	ref_output_number = readU32LittleEndian(&(token[TRUSTED_INPUT_OUTPUT_NUMBER_OFFSET]));
+	ref_transaction_number++;
+	return TRANSACTION_NO_ERROR;
+}
+
 /** See comments for parseTransaction() for description of what this does
   * and return values. However, the guts of the transaction parser are in
   * the code to this function.
   * 
   * This is called once for each input transaction and once for the spending
   * transaction.
-  * \param sig_hash See parseTransaction().
+  * \param sig_hash See parseTransactionMultiple(). If the parser parsed an
+  *                 input transaction, only the first 32 bytes of this will
+  *                 be written to.
   * \param transaction_hash See parseTransaction().
   * \param is_ref_out On success, this will be written with true
   *                   if the transaction parser parsed an input (i.e.
@@ -220,23 +594,30 @@ static bool getVarInt(uint32_t *out)
   * \param ref_compare_hs Reference compare hash. This is used to check that
   *                       the input transactions match the references in the
   *                       main transaction.
+  * \param input_numbers See parseTransactionMultiple(). This may be NULL, in
+  *                      which case num_sig_hashes must be 1 and input
+  *                      scripts are hashed as they appear in the transaction
+  *                      data. This must not be NULL if #witness_state_ptr is
+  *                      not NULL.
+  * \param num_sig_hashes The number of signature hashes to calculate. This
+  *                       must be at least 1.
   * \return See parseTransaction().
   */
-static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256 transaction_hash, bool *is_ref_out, HashState *ref_compare_hs)
+static TransactionErrors parseTransactionInternal(uint8_t *sig_hash, BigNum256 transaction_hash, bool *is_ref_out, HashState *ref_compare_hs, uint32_t *input_numbers, uint8_t num_sig_hashes)
 {
-	uint8_t temp[32];
+	uint8_t temp[32] WORD_ALIGNED;
 	uint8_t ref_compare_hash[32];
 	uint32_t num_inputs;
 	uint32_t num_outputs;
 	uint32_t script_length;
 	uint8_t input_reference_num_buffer[4];
-	uint16_t i;
+	uint32_t i;
 	uint8_t j;
 	uint32_t k;
+	uint8_t chunk_length;
 	uint32_t output_num_select;
 	bool is_ref;
-	char text_amount[TEXT_AMOUNT_LENGTH];
-	char text_address[TEXT_ADDRESS_LENGTH];
+	OutputDescriptor output;
 
 	if (transaction_length > MAX_TRANSACTION_SIZE)
 	{
@@ -261,6 +642,10 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 		is_ref = false;
 	}
 	*is_ref_out = is_ref;
+	if (temp[0] == TRUSTED_INPUT_RECORD)
+	{
+		return parseTrustedInputToken(sig_hash, ref_compare_hs, input_numbers, num_sig_hashes);
+	}
 
 	output_num_select = 0;
 	if (is_ref)
@@ -270,11 +655,9 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 		{
 			return TRANSACTION_INVALID_FORMAT; // transaction truncated
 		}
-		for (j = 0; j < 4; j++)
-		{
-			sha256WriteByte(ref_compare_hs, temp[j]);
-		}
+		sha256WriteBytes(ref_compare_hs, temp, 4);
 		output_num_select = readU32LittleEndian(temp);
+		ref_output_number = output_num_select;
 	}
 	else
 	{
@@ -284,7 +667,49 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 		sha256Begin(ref_compare_hs);
 	}
 
-	sha256Begin(sig_hash_hs_ptr);
+	if (is_ref)
+	{
+		// Input transactions are hashed to obtain their transaction IDs, so
+		// only one hash is needed, and it must include every input script.
+		num_sig_hash_hs = 1;
+		sig_hash_input_numbers = NULL;
+	}
+	else if (witness_state_ptr != NULL)
+	{
+		// Witness signature hashes are calculated (at the end) from the
+		// digests in witness_state_ptr, so no legacy signature hashes are
+		// needed.
+		num_sig_hash_hs = 0;
+		sig_hash_input_numbers = NULL;
+		sha256Begin(&(witness_state_ptr->prevouts_hs));
+		sha256Begin(&(witness_state_ptr->sequence_hs));
+		sha256Begin(&(witness_state_ptr->outputs_hs));
+	}
+	else
+	{
+		num_sig_hash_hs = num_sig_hashes;
+		sig_hash_input_numbers = input_numbers;
+	}
+	if (sig_hash_input_numbers == NULL)
+	{
+		for (j = 0; j < num_sig_hash_hs; j++)
+		{
+			sha256Begin(&(sig_hash_hs_ptr[j]));
+		}
+	}
+	else
+	{
+		sha256Begin(&(sig_hash_hs_ptr[num_sig_hash_hs]));
+		sig_hash_forked = 0;
+		sig_hash_duplicate = 0;
+		for (j = 1; j < num_sig_hash_hs; j++)
+		{
+			if (findSigHashForInput(sig_hash_input_numbers[j]) != j)
+			{
+				sig_hash_duplicate = (uint8_t)(sig_hash_duplicate | (1 << j));
+			}
+		}
+	}
 	sha256Begin(transaction_hash_hs_ptr);
 	hs_ptr_valid = true;
 	suppress_transaction_hash = false;
@@ -312,6 +737,16 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 	{
 		return TRANSACTION_TOO_MANY_INPUTS; // too many inputs
 	}
+	if (!is_ref && (input_numbers != NULL))
+	{
+		for (j = 0; j < num_sig_hashes; j++)
+		{
+			if (input_numbers[j] >= num_inputs)
+			{
+				return TRANSACTION_INVALID_REFERENCE; // no such input
+			}
+		}
+	}
 
 	// Process each input.
 	for (i = 0; i < num_inputs; i++)
@@ -328,13 +763,20 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 		}
 		if (!is_ref)
 		{
-			for (j = 0; j < 4; j++)
-			{
-				sha256WriteByte(ref_compare_hs, input_reference_num_buffer[j]);
-			}
-			for (j = 0; j < 32; j++)
+			sha256WriteBytes(ref_compare_hs, input_reference_num_buffer, 4);
+			sha256WriteBytes(ref_compare_hs, temp, 32);
+			if (witness_state_ptr != NULL)
 			{
-				sha256WriteByte(ref_compare_hs, temp[j]);
+				sha256WriteBytes(&(witness_state_ptr->prevouts_hs), temp, 32);
+				sha256WriteBytes(&(witness_state_ptr->prevouts_hs), input_reference_num_buffer, 4);
+				for (j = 0; j < num_sig_hashes; j++)
+				{
+					if (input_numbers[j] == i)
+					{
+						memcpy(witness_state_ptr->inputs[j].outpoint, temp, 32);
+						memcpy(&(witness_state_ptr->inputs[j].outpoint[32]), input_reference_num_buffer, 4);
+					}
+				}
 			}
 		}
 		// The Bitcoin protocol for signing a transaction involves replacing
@@ -345,20 +787,88 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 		// which input is being signed for, so the calculation of the
 		// transaction hash ignores input scripts.
 		suppress_transaction_hash = true;
+		current_input_number = i;
+		if (sig_hash_input_numbers != NULL)
+		{
+			// Signature hashes for this input start from the prefix hash
+			// state, which has seen everything in the transaction up to
+			// this input's script.
+			for (j = 0; j < num_sig_hash_hs; j++)
+			{
+				if ((sig_hash_input_numbers[j] == i)
+					&& ((sig_hash_duplicate & (1 << j)) == 0))
+				{
+					memcpy(&(sig_hash_hs_ptr[j]), &(sig_hash_hs_ptr[num_sig_hash_hs]), sizeof(HashState));
+					sig_hash_forked = (uint8_t)(sig_hash_forked | (1 << j));
+				}
+			}
+		}
 		// Get input script length.
 		if (getVarInt(&script_length))
 		{
 			return TRANSACTION_INVALID_FORMAT; // transaction truncated or varint too big
 		}
-		// Skip the script because it's useless here.
-		for (k = 0; k < script_length; k++)
+		if (!is_ref && (witness_state_ptr != NULL))
+		{
+			for (j = 0; j < num_sig_hashes; j++)
+			{
+				if ((input_numbers[j] == i)
+					&& (script_length != sizeof(witness_state_ptr->inputs[j].script_code)))
+				{
+					// Only pay to witness public key hash script codes
+					// are supported.
+					return TRANSACTION_NON_STANDARD; // nonstandard script code
+				}
+			}
+		}
+		// Skip the script because it's useless here (except as the script
+		// code of a witness signature hash).
+		if (!is_ref && (witness_state_ptr != NULL))
+		{
+			for (k = 0; k < script_length; k += chunk_length)
+			{
+				chunk_length = (uint8_t)sizeof(temp);
+				if ((script_length - k) < chunk_length)
+				{
+					chunk_length = (uint8_t)(script_length - k);
+				}
+				if (getTransactionBytes(temp, chunk_length))
+				{
+					return TRANSACTION_INVALID_FORMAT; // transaction truncated
+				}
+				// The check above (of script_length) ensures that this
+				// won't overflow script_code.
+				for (j = 0; j < num_sig_hashes; j++)
+				{
+					if (input_numbers[j] == i)
+					{
+						memcpy(&(witness_state_ptr->inputs[j].script_code[k]), temp, chunk_length);
+					}
+				}
+			}
+		}
+		else
 		{
-			if (getTransactionBytes(temp, 1))
+			if (skipTransactionBytes(script_length))
 			{
 				return TRANSACTION_INVALID_FORMAT; // transaction truncated
 			}
 		}
 		suppress_transaction_hash = false;
+		if (sig_hash_input_numbers != NULL)
+		{
+			// Signature hashes which were not for this input need to see an
+			// empty script (a script length of 0) instead.
+			sha256WriteByte(&(sig_hash_hs_ptr[num_sig_hash_hs]), 0x00);
+			for (j = 0; j < num_sig_hash_hs; j++)
+			{
+				if (((sig_hash_forked & (1 << j)) != 0)
+					&& (sig_hash_input_numbers[j] != i))
+				{
+					sha256WriteByte(&(sig_hash_hs_ptr[j]), 0x00);
+				}
+			}
+		}
 		// Check sequence. Since locktime is checked below, this check
 		// is probably superfluous. But it's better to be safe than sorry.
 		if (getTransactionBytes(temp, 4))
@@ -369,6 +879,17 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 		{
 			return TRANSACTION_NON_STANDARD; // replacement not supported
 		}
+		if (!is_ref && (witness_state_ptr != NULL))
+		{
+			sha256WriteBytes(&(witness_state_ptr->sequence_hs), temp, 4);
+			for (j = 0; j < num_sig_hashes; j++)
+			{
+				if (input_numbers[j] == i)
+				{
+					memcpy(witness_state_ptr->inputs[j].sequence, temp, 4);
+				}
+			}
+		}
 	} // end for (i = 0; i < num_inputs; i++)
 
 	if (!is_ref)
@@ -402,6 +923,10 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 			return TRANSACTION_INVALID_REFERENCE; // bad reference number
 		}
 	}
+	else if (witness_state_ptr != NULL)
+	{
+		witness_hash_outputs = true;
+	}
 
 	// Process each output.
 	for (i = 0; i < num_outputs; i++)
@@ -423,6 +948,18 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 				{
 					return TRANSACTION_INVALID_AMOUNT; // overflow occurred (carry occurred)
 				}
+				if (witness_state_ptr != NULL)
+				{
+					// Witness signature hashes commit to the amount of the
+					// output being spent.
+					for (j = 0; j < num_sig_hashes; j++)
+					{
+						if (input_numbers[j] == ref_transaction_number)
+						{
+							memcpy(witness_state_ptr->inputs[j].amount, temp, 8);
+						}
+					}
+				}
 			}
 		}
 		else
@@ -431,7 +968,9 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 			{
 				return TRANSACTION_INVALID_AMOUNT; // overflow occurred (borrow occurred)
 			}
-			amountToText(text_amount, temp);
+			// Conversion to text is left to the user interface, which only
+			// does it for outputs it is about to display.
+			memcpy(output.amount, temp, 8);
 		}
 		// Get output script length.
 		if (getVarInt(&script_length))
@@ -442,12 +981,9 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 		{
 			// The actual output scripts of input transactions don't need to
 			// be parsed (only the amount matters), so skip the script.
-			for (k = 0; k < script_length; k++)
+			if (skipTransactionBytes(script_length))
 			{
-				if (getTransactionBytes(temp, 1))
-				{
-					return TRANSACTION_INVALID_FORMAT; // transaction truncated
-				}
+				return TRANSACTION_INVALID_FORMAT; // transaction truncated
 			}
 		}
 		else
@@ -470,7 +1006,8 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 				{
 					return TRANSACTION_INVALID_FORMAT; // transaction truncated
 				}
-				hashToAddr(text_address, temp, ADDRESS_VERSION_PUBKEY);
+				memcpy(output.hash, temp, 20);
+				output.address_version = ADDRESS_VERSION_PUBKEY;
 				// Look for: OP_EQUALVERIFY OP_CHECKSIG.
 				if (getTransactionBytes(temp, 2))
 				{
@@ -497,7 +1034,8 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 				{
 					return TRANSACTION_INVALID_FORMAT; // transaction truncated
 				}
-				hashToAddr(text_address, temp, ADDRESS_VERSION_P2SH);
+				memcpy(output.hash, temp, 20);
+				output.address_version = ADDRESS_VERSION_P2SH;
 				// Look for: OP_EQUAL.
 				if (getTransactionBytes(temp, 1))
 				{
@@ -512,12 +1050,13 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 			{
 				return TRANSACTION_NON_STANDARD; // nonstandard transaction
 			}
-			if (newOutputSeen(text_amount, text_address))
+			if (newOutputSeen(&output))
 			{
 				return TRANSACTION_TOO_MANY_OUTPUTS; // too many outputs
 			}
 		} // end if (is_ref)
 	} // end for (i = 0; i < num_outputs; i++)
+	witness_hash_outputs = false;
 
 	// Check locktime.
 	if (getTransactionBytes(temp, 4))
@@ -549,16 +1088,35 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 
 		if (!bigIsZeroVariableSize(transaction_fee_amount, sizeof(transaction_fee_amount)))
 		{
-			amountToText(text_amount, transaction_fee_amount);
-			setTransactionFee(text_amount);
+			// Like outputs, the fee is only converted to text if it is
+			// displayed, which it won't be if the transaction has already
+			// been approved.
+			setTransactionFee(transaction_fee_amount);
 		}
 	}
 
-	sha256FinishDouble(sig_hash_hs_ptr);
-	// The signature hash is written in a little-endian format because it
-	// is used as a little-endian multi-precision integer in
-	// signTransaction().
-	writeHashToByteArray(sig_hash, sig_hash_hs_ptr, false);
+	for (j = 0; j < num_sig_hash_hs; j++)
+	{
+		if ((sig_hash_input_numbers != NULL)
+			&& ((sig_hash_duplicate & (1 << j)) != 0))
+		{
+			// Same input as an earlier signature hash, which has already
+			// been written.
+			memcpy(&(sig_hash[j * 32]), &(sig_hash[findSigHashForInput(sig_hash_input_numbers[j]) * 32]), 32);
+		}
+		else
+		{
+			sha256FinishDouble(&(sig_hash_hs_ptr[j]));
+			// The signature hash is written in a little-endian format because
+			// it is used as a little-endian multi-precision integer in
+			// signTransaction().
+			writeHashToByteArray(&(sig_hash[j * 32]), &(sig_hash_hs_ptr[j]), false);
+		}
+	}
+	if (!is_ref && (witness_state_ptr != NULL))
+	{
+		calculateWitnessSigHashes(sig_hash, sig_hash_hs_ptr, num_sig_hashes);
+	}
 	sha256FinishDouble(transaction_hash_hs_ptr);
 	writeHashToByteArray(transaction_hash, transaction_hash_hs_ptr, false);
 
@@ -570,11 +1128,95 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
 		{
 			sha256WriteByte(ref_compare_hs, sig_hash[j]);
 		}
+		ref_transaction_number++;
 	}
 
 	return TRANSACTION_NO_ERROR;
 }
 
+/** Set up the transaction parser's state so that it is ready to call
+  * parseTransactionInternal() on the first transaction in the input stream.
+  * \param sig_hash_hs See parseTransactionWithHashStates().
+  * \param transaction_hash_hs Space for the hash state of the transaction
+  *                            hash.
+  * \param ref_compare_hs Space for the reference compare hash state (see
+  *                       parseTransactionInternal()).
+  * \param length See parseTransaction().
+  * \param witness_state See parseTransactionWithHashStates().
+  */
+static void beginParse(HashState *sig_hash_hs, HashState *transaction_hash_hs, HashState *ref_compare_hs, uint32_t length, WitnessState *witness_state)
+{
+	hs_ptr_valid = false;
+	transaction_data_index = 0;
+	transaction_length = length;
+	memset(transaction_fee_amount, 0, sizeof(transaction_fee_amount));
+	sig_hash_hs_ptr = sig_hash_hs;
+	num_sig_hash_hs = 1;
+	sig_hash_input_numbers = NULL;
+	transaction_hash_hs_ptr = transaction_hash_hs;
+	witness_state_ptr = witness_state;
+	witness_hash_outputs = false;
+	ref_transaction_number = 0;
+	sha256Begin(ref_compare_hs);
+	hs_ptr_valid = true;
+}
+
+/** Finish parsing, by consuming whatever is left of the input stream. This
+  * is needed because the parser stops at the first error. */
+static void endParse(void)
+{
+	hs_ptr_valid = false;
+	witness_hash_outputs = false;
+
+	// Always try to consume the entire stream. A chunked upload is the
+	// exception: the host only sends what the device asks for.
+	if (!isUploadChunked() && !isEndOfTransactionData())
+	{
+		skipTransactionBytes(transaction_length - transaction_data_index);
+	}
+}
+
+/** Parse a Bitcoin transaction, using caller-provided space for the hash
+  * states of the signature hashes. This does all the work of
+  * parseTransaction() and parseTransactionMultiple(); the only reason
+  * these are separate is so that parseTransaction() doesn't need space for
+  * #MAX_SIGN_INPUTS hash states on the stack.
+  * \param sig_hash_hs An array of hash states. The contents of these will
+  *                    be overwritten. If input_numbers is NULL, this must
+  *                    have num_sig_hashes entries. Otherwise, this must
+  *                    have num_sig_hashes + 1 entries, since an extra one
+  *                    is needed for the prefix hash state (see
+  *                    #sig_hash_input_numbers).
+  * \param sig_hash See parseTransactionMultiple().
+  * \param transaction_hash See parseTransaction().
+  * \param length See parseTransaction().
+  * \param input_numbers See parseTransactionInternal().
+  * \param num_sig_hashes See parseTransactionInternal().
+  * \param witness_state If this is NULL, legacy signature hashes will be
+  *                      calculated. Otherwise, witness (BIP 143) signature
+  *                      hashes will be calculated, using this as space for
+  *                      the transaction-wide digests and per-input data. In
+  *                      that case, sig_hash_hs only needs one entry.
+  * \return One of the values in #TransactionErrorsEnum.
+  */
+static TransactionErrors parseTransactionWithHashStates(HashState *sig_hash_hs, uint8_t *sig_hash, BigNum256 transaction_hash, uint32_t length, uint32_t *input_numbers, uint8_t num_sig_hashes, WitnessState *witness_state)
+{
+	TransactionErrors r;
+	bool is_ref;
+	HashState transaction_hash_hs;
+	HashState ref_compare_hs;
+	PROFILE_ENTER(PROFILE_PARSE);
+
+	beginParse(sig_hash_hs, &transaction_hash_hs, &ref_compare_hs, length, witness_state);
+	do
+	{
+		r = parseTransactionInternal(sig_hash, transaction_hash, &is_ref, &ref_compare_hs, input_numbers, num_sig_hashes);
+	} while ((r == TRANSACTION_NO_ERROR) && is_ref);
+	endParse();
+	PROFILE_EXIT();
+	return r;
+}
+
 /** Parse a Bitcoin transaction, extracting the output amounts/addresses,
   * validating the transaction (ensuring that it is "standard") and computing
   * a double SHA-256 hash of the transaction. This double SHA-256 hash is the
@@ -598,7 +1240,9 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
   * to calculate the transaction fee. A transaction does directly contain the
   * output amounts, but not the input amounts. The only way to get input
   * amounts is to look at the output amounts of the transactions the inputs
-  * refer to.
+  * refer to. Any input transaction can be replaced by a trusted input token
+  * issued earlier by getTrustedInput(), preceded by a #TRUSTED_INPUT_RECORD
+  * byte.
   *
   * \param sig_hash The signature hash will be written here (if everything
   *                 goes well), as a 32 byte little-endian multi-precision
@@ -609,41 +1253,183 @@ static TransactionErrors parseTransactionInternal(BigNum256 sig_hash, BigNum256
   * \param length The total length of the transaction. If no stream read
   *               errors occured, then exactly length bytes will be read from
   *               the stream, even if the transaction was not parsed
-  *               correctly.
+  *               correctly. The exception is a chunked upload (see
+  *               isUploadChunked()), where parsing stops at the first error.
   * \return One of the values in #TransactionErrorsEnum.
   */
 TransactionErrors parseTransaction(BigNum256 sig_hash, BigNum256 transaction_hash, uint32_t length)
+{
+	HashState sig_hash_hs;
+
+	return parseTransactionWithHashStates(&sig_hash_hs, sig_hash, transaction_hash, length, NULL, 1, NULL);
+}
+
+/** Parse a Bitcoin transaction, like parseTransaction(), but calculate the
+  * signature hashes of many inputs at once. This means that a transaction
+  * with many inputs only needs to be sent (and parsed) once to sign all of
+  * them.
+  *
+  * For this to work, every input which is to be signed must have its
+  * script replaced by the output script that the input references (in
+  * the same way parseTransaction() expects one input's script to be
+  * replaced). When calculating the signature hash of one input, the scripts
+  * of all the other inputs are treated as if they were empty, so it doesn't
+  * matter what the scripts of inputs which are not being signed are.
+  *
+  * The part of the transaction before each input is shared by all the
+  * signature hashes, so it is only hashed once. But everything after an
+  * input's script still has to be hashed separately for each signature
+  * hash.
+  * \param sig_hashes The signature hashes will be written here (if
+  *                   everything goes well), one after another, as 32 byte
+  *                   little-endian multi-precision numbers. This must have
+  *                   space for 32 x num_sig_hashes bytes.
+  * \param transaction_hash See parseTransaction().
+  * \param length See parseTransaction().
+  * \param input_numbers An array of input numbers (0 = first input), with
+  *                      num_sig_hashes entries. The signature hash
+  *                      corresponding to each input will be calculated.
+  *                      An input number may appear more than once (eg. to
+  *                      sign a multi-signature input with several keys);
+  *                      its signature hash is only calculated once and
+  *                      then copied.
+  * \param num_sig_hashes The number of signature hashes to calculate. This
+  *                       must be between 1 and #MAX_SIGN_INPUTS (inclusive).
+  * \return One of the values in #TransactionErrorsEnum.
+  *         #TRANSACTION_INVALID_REFERENCE will be returned if one of the
+  *         input numbers is not less than the number of inputs in the
+  *         transaction.
+  */
+TransactionErrors parseTransactionMultiple(uint8_t *sig_hashes, BigNum256 transaction_hash, uint32_t length, uint32_t *input_numbers, uint8_t num_sig_hashes)
+{
+	HashState sig_hash_hs[MAX_SIGN_INPUTS + 1];
+
+	if ((num_sig_hashes == 0) || (num_sig_hashes > MAX_SIGN_INPUTS))
+	{
+		// This should never happen; callers are supposed to check this.
+		fatalError();
+	}
+	return parseTransactionWithHashStates(sig_hash_hs, sig_hashes, transaction_hash, length, input_numbers, num_sig_hashes, NULL);
+}
+
+/** Parse a Bitcoin transaction, like parseTransactionMultiple(), but
+  * calculate witness (version 0) signature hashes, as described in BIP 143.
+  *
+  * Legacy signature hashes cover the entire transaction, so signing every
+  * input of a transaction takes time proportional to the square of the
+  * number of inputs. Witness signature hashes instead contain three digests
+  * (of all outpoints, all sequence numbers and all outputs) which are the
+  * same for every input. These are calculated once, as the transaction is
+  * parsed, and then each input's signature hash is built from them and
+  * a small amount of per-input data.
+  *
+  * The input stream is the same as for parseTransaction(). Each input
+  * transaction must be sent in the legacy (non-witness) serialisation, so that
+  * its hash is the transaction ID which the spending transaction refers to.
+  * Each input which is to be signed must have its script replaced by its
+  * script code. Only pay to witness public key hash inputs are supported,
+  * so the script code must be the 25 byte pay to public key hash script
+  * described in BIP 143. Since input amounts are committed to in witness
+  * signature hashes, they are taken from the input transactions.
+  * \param sig_hashes See parseTransactionMultiple().
+  * \param transaction_hash See parseTransaction().
+  * \param length See parseTransaction().
+  * \param input_numbers See parseTransactionMultiple().
+  * \param num_sig_hashes See parseTransactionMultiple().
+  * \return One of the values in #TransactionErrorsEnum.
+  *         #TRANSACTION_INVALID_REFERENCE will be returned if one of the
+  *         input numbers is not less than the number of inputs in the
+  *         transaction. #TRANSACTION_NON_STANDARD will be returned if the
+  *         script code of one of the requested inputs is not 25 bytes long.
+  */
+TransactionErrors parseTransactionWitness(uint8_t *sig_hashes, BigNum256 transaction_hash, uint32_t length, uint32_t *input_numbers, uint8_t num_sig_hashes)
+{
+	HashState sig_hash_hs;
+	WitnessState witness_state;
+	TransactionErrors r;
+
+	if ((num_sig_hashes == 0) || (num_sig_hashes > MAX_SIGN_INPUTS))
+	{
+		// This should never happen; callers are supposed to check this.
+		fatalError();
+	}
+	r = parseTransactionWithHashStates(&sig_hash_hs, sig_hashes, transaction_hash, length, input_numbers, num_sig_hashes, &witness_state);
+	witness_state_ptr = NULL;
+	return r;
+}
+
+/** Parse an input transaction (a previous transaction, one of whose outputs
+  * is about to be spent) and issue a trusted input token for the output it
+  * refers to. The token contains the outpoint (transaction ID and output
+  * number) and amount of that output, and a message authentication code
+  * which only this device can calculate. During signing, the token can be
+  * sent (preceded by a #TRUSTED_INPUT_RECORD byte) instead of the input
+  * transaction. This saves a lot of time when input transactions are much
+  * larger than the spending transaction, or when the same inputs are used to
+  * sign several times, since each input transaction only has to be sent and
+  * parsed once.
+  *
+  * Only the device can check tokens, so they don't need to be kept secret
+  * from the host. But the host can't forge them; if it could, it could lie
+  * about input amounts and so hide the transaction fee from the user.
+  *
+  * The key used to authenticate tokens must be set up with
+  * prepareTrustedInputKey() beforehand. Tokens are only valid until
+  * clearTrustedInputKey() is called.
+  * \param token The token will be written here (if everything goes well).
+  *              This must have space for #TRUSTED_INPUT_TOKEN_LENGTH bytes.
+  * \param length The total length of the data. The data must consist of
+  *               exactly one input transaction, in the same format as the
+  *               input transactions which precede a spending transaction
+  *               (see parseTransaction()). If no stream read errors
+  *               occured, then exactly length bytes will be read from the
+  *               stream, even if the transaction was not parsed correctly.
+  * \return One of the values in #TransactionErrorsEnum.
+  *         #TRANSACTION_INVALID_FORMAT will be returned if the data contains
+  *         a spending transaction, or anything after the input transaction.
+  */
+TransactionErrors getTrustedInput(uint8_t *token, uint32_t length)
 {
 	TransactionErrors r;
-	uint8_t junk;
 	bool is_ref;
 	HashState sig_hash_hs;
 	HashState transaction_hash_hs;
 	HashState ref_compare_hs;
+	uint8_t txid[32];
+	uint8_t transaction_hash[32];
+	uint8_t mac[64];
+	uint8_t i;
+	PROFILE_ENTER(PROFILE_PARSE);
 
-	hs_ptr_valid = false;
-	transaction_data_index = 0;
-	transaction_length = length;
-	memset(transaction_fee_amount, 0, sizeof(transaction_fee_amount));
-	sig_hash_hs_ptr = &sig_hash_hs;
-	transaction_hash_hs_ptr = &transaction_hash_hs;
-	sha256Begin(&ref_compare_hs);
-
-	hs_ptr_valid = true;
-	do
+	beginParse(&sig_hash_hs, &transaction_hash_hs, &ref_compare_hs, length, NULL);
+	r = parseTransactionInternal(txid, transaction_hash, &is_ref, &ref_compare_hs, NULL, 1);
+	if ((r == TRANSACTION_NO_ERROR) && (!is_ref || !isEndOfTransactionData()))
 	{
-		r = parseTransactionInternal(sig_hash, transaction_hash, &is_ref, &ref_compare_hs);
-	} while ((r == TRANSACTION_NO_ERROR) && is_ref);
-	hs_ptr_valid = false;
-
-	// Always try to consume the entire stream.
-	while (!isEndOfTransactionData())
+		r = TRANSACTION_INVALID_FORMAT; // not exactly one input transaction
+	}
+	endParse();
+	if ((r == TRANSACTION_NO_ERROR) && !trusted_input_key_valid)
 	{
-		if (getTransactionBytes(&junk, 1))
+		// This should never happen; callers are supposed to call
+		// prepareTrustedInputKey() first.
+		fatalError();
+	}
+	if (r == TRANSACTION_NO_ERROR)
+	{
+		// Why backwards? Because Bitcoin serialises the input reference
+		// hashes that way.
+		for (i = 0; i < 32; i++)
 		{
-			break;
+			token[i] = txid[31 - i];
 		}
+		writeU32LittleEndian(&(token[TRUSTED_INPUT_OUTPUT_NUMBER_OFFSET]), ref_output_number);
+		// Only one input transaction was parsed, so the "fee" is the amount
+		// of the output it refers to.
+		memcpy(&(token[TRUSTED_INPUT_AMOUNT_OFFSET]), transaction_fee_amount, 8);
+		calculateTrustedInputMac(mac, token);
+		memcpy(&(token[TRUSTED_INPUT_MAC_OFFSET]), mac, TRUSTED_INPUT_MAC_LENGTH);
 	}
+	PROFILE_EXIT();
 	return r;
 }
 
@@ -746,6 +1532,11 @@ static uint8_t encapsulateSignature(uint8_t *signature, BigNum256 r, BigNum256 s
   * and a signature hash has been computed. The primary purpose of this
   * function is to call ecdsaSign() and encapsulate the ECDSA signature in
   * the DER format which OpenSSL uses.
+  *
+  * The signature is verified before it is released. A fault (eg. a glitch
+  * induced by an attacker) during signing could produce a bad signature
+  * which leaks the private key, so if verification fails, fatalError() is
+  * called.
   * \param signature The encapsulated signature will be written here. This
   *                  must be a byte array with space for
   *                  at least #MAX_SIGNATURE_LENGTH bytes.
@@ -761,12 +1552,73 @@ static uint8_t encapsulateSignature(uint8_t *signature, BigNum256 r, BigNum256 s
   */
 void signTransaction(uint8_t *signature, uint8_t *out_length, BigNum256 sig_hash, BigNum256 private_key)
 {
-	uint8_t r[32];
-	uint8_t s[32];
+	BigNum256Storage r;
+	BigNum256Storage s;
+	PointAffine public_key;
 
+	PROFILE_ENTER(PROFILE_CRYPTO);
 	*out_length = 0;
 	ecdsaSign(r, s, sig_hash, private_key);
+	ecdsaMultiplyG(&public_key, private_key);
+	if (ecdsaVerify(r, s, sig_hash, &public_key))
+	{
+		fatalError(); // signature is bad, so don't release it
+	}
 	*out_length = encapsulateSignature(signature, r, s);
+	PROFILE_EXIT();
+}
+
+#if MAX_SIGN_INPUTS > ECDSA_MAX_BATCH_SIZE
+#error "MAX_SIGN_INPUTS too big for ecdsaSignBatch()"
+#endif
+
+/** Sign several inputs of a transaction. This gives the same results as
+  * calling signTransaction() for each input, but is faster, since the
+  * expensive point multiplications are batched. The ephemeral public keys
+  * are calculated by ecdsaSignBatch() and the public keys used for
+  * verification are calculated by one call to ecdsaMultiplyGBatch(), so
+  * the conversions to affine coordinates share one inversion each.
+  * \param signatures The encapsulated signatures will be written here, as
+  *                   count consecutive #MAX_SIGNATURE_LENGTH byte buffers.
+  * \param out_lengths The length of each signature, in number of bytes, will
+  *                    be written here. This must be an array with space for
+  *                    count lengths.
+  * \param sig_hashes The signature hashes for each input (see
+  *                   parseTransactionMultiple()), as count consecutive 32 byte
+  *                   multi-precision numbers.
+  * \param private_keys The private key to sign each input with, as count
+  *                     consecutive 32 byte little-endian multi-precision
+  *                     integers.
+  * \param count The number of inputs to sign. This must be between 1 and
+  *              #MAX_SIGN_INPUTS (inclusive).
+  */
+void signTransactionMultiple(uint8_t *signatures, uint8_t *out_lengths, uint8_t *sig_hashes, uint8_t *private_keys, uint8_t count)
+{
+	uint8_t r[MAX_SIGN_INPUTS * 32];
+	uint8_t s[MAX_SIGN_INPUTS * 32];
+	PointAffine public_keys[MAX_SIGN_INPUTS];
+	uint8_t i;
+
+	if ((count == 0) || (count > MAX_SIGN_INPUTS))
+	{
+		fatalError(); // this should never happen
+	}
+	PROFILE_ENTER(PROFILE_CRYPTO);
+	memset(out_lengths, 0, count);
+	ecdsaSignBatch(r, s, sig_hashes, private_keys, count);
+	ecdsaMultiplyGBatch(public_keys, private_keys, count);
+	for (i = 0; i < count; i++)
+	{
+		if (ecdsaVerify(&(r[i * 32]), &(s[i * 32]), &(sig_hashes[i * 32]), &(public_keys[i])))
+		{
+			fatalError(); // signature is bad, so don't release it
+		}
+	}
+	for (i = 0; i < count; i++)
+	{
+		out_lengths[i] = encapsulateSignature(&(signatures[i * MAX_SIGNATURE_LENGTH]), &(r[i * 32]), &(s[i * 32]));
+	}
+	PROFILE_EXIT();
 }
 
 #ifdef TEST
@@ -774,17 +1626,30 @@ void signTransaction(uint8_t *signature, uint8_t *out_length, BigNum256 sig_hash
 /** Number of outputs seen. */
 static int num_outputs_seen;
 
-bool newOutputSeen(char *text_amount, char *text_address)
+bool newOutputSeen(OutputDescriptor *output)
 {
+	char text_amount[TEXT_AMOUNT_LENGTH];
+	char text_address[TEXT_ADDRESS_LENGTH];
+
+	outputToText(text_amount, text_address, output);
+#ifndef TEST_BENCH
 	printf("Amount: %s\n", text_amount);
 	printf("Address: %s\n", text_address);
+#endif // #ifndef TEST_BENCH
 	num_outputs_seen++;
 	return false; // success
 }
 
-void setTransactionFee(char *text_amount)
+void setTransactionFee(uint8_t *amount)
 {
+#ifndef TEST_BENCH
+	char text_amount[TEXT_AMOUNT_LENGTH];
+
+	amountToText(text_amount, amount);
 	printf("Transaction fee: %s\n", text_amount);
+#else
+	(void)amount;
+#endif // #ifndef TEST_BENCH
 }
 
 void clearOutputsSeen(void)
@@ -892,6 +1757,10 @@ static const uint8_t good_full_transaction[] = {
 0x01, 0x00, 0x00, 0x00 // hashtype
 };
 
+#endif // #ifdef TEST_TRANSACTION
+
+#if defined(TEST_TRANSACTION) || defined(TEST_BENCH)
+
 /** The input transaction from #good_full_transaction. */
 static const uint8_t good_input_transaction[] = {
 0x01, 0x00, 0x00, 0x00, // output number to examine
@@ -986,36 +1855,6 @@ static const uint8_t good_main_transaction[] = {
 0x01, 0x00, 0x00, 0x00 // hashtype
 };
 
-/** The main transaction from #good_full_transaction, with the inputs
-  * removed. */
-static const uint8_t inputs_removed_transaction[] = {
-0x01, 0x00, 0x00, 0x00, // version
-0x01, // number of inputs
-0x02, // number of outputs
-0x00, 0x46, 0xc3, 0x23, 0x00, 0x00, 0x00, 0x00, // 6 BTC
-0x19, // script length
-0x76, // OP_DUP
-0xA9, // OP_HASH160
-0x14, // 20 bytes of data follows
-// 11MXTrefsj1ZS3Q5e9D6DxGzZKHWALyo9
-0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99,
-0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x11, 0x22, 0x33,
-0x88, // OP_EQUALVERIFY
-0xAC, // OP_CHECKSIG
-0x87, 0xd6, 0x12, 0x00, 0x00, 0x00, 0x00, 0x00, // 0.01234567 BTC
-0x19, // script length
-0x76, // OP_DUP
-0xA9, // OP_HASH160
-0x14, // 20 bytes of data follows
-// 16eCeyy63xi5yde9VrX4XCcRrCKZwtUZK
-0x01, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99,
-0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x11, 0x22, 0x33,
-0x88, // OP_EQUALVERIFY
-0xAC, // OP_CHECKSIG
-0x00, 0x00, 0x00, 0x00, // locktime
-0x01, 0x00, 0x00, 0x00 // hashtype
-};
-
 /** One input for a transaction. This was extracted
   * from the main transaction in #good_full_transaction. */
 static const uint8_t one_input[] = {
@@ -1071,7 +1910,41 @@ static const uint8_t output_address1[] = {
 static const uint8_t output_address2[] = {
 // 16eCeyy63xi5yde9VrX4XCcRrCKZwtUZK
 0x01, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99,
-0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x11, 0x22, 0x33
+0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x11, 0x22, 0x33
+};
+
+#endif // #if defined(TEST_TRANSACTION) || defined(TEST_BENCH)
+
+#ifdef TEST_TRANSACTION
+
+/** The main transaction from #good_full_transaction, with the inputs
+  * removed. */
+static const uint8_t inputs_removed_transaction[] = {
+0x01, 0x00, 0x00, 0x00, // version
+0x01, // number of inputs
+0x02, // number of outputs
+0x00, 0x46, 0xc3, 0x23, 0x00, 0x00, 0x00, 0x00, // 6 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 11MXTrefsj1ZS3Q5e9D6DxGzZKHWALyo9
+0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99,
+0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x11, 0x22, 0x33,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x87, 0xd6, 0x12, 0x00, 0x00, 0x00, 0x00, 0x00, // 0.01234567 BTC
+0x19, // script length
+0x76, // OP_DUP
+0xA9, // OP_HASH160
+0x14, // 20 bytes of data follows
+// 16eCeyy63xi5yde9VrX4XCcRrCKZwtUZK
+0x01, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99,
+0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x11, 0x22, 0x33,
+0x88, // OP_EQUALVERIFY
+0xAC, // OP_CHECKSIG
+0x00, 0x00, 0x00, 0x00, // locktime
+0x01, 0x00, 0x00, 0x00 // hashtype
 };
 
 /** The main transaction from #good_full_transaction, with the input
@@ -2423,6 +3296,10 @@ const struct EncapsulateSignatureTestStruct encapsulate_tests[] = {
 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01}}
 };
 
+#endif // #ifdef TEST_TRANSACTION
+
+#if defined(TEST_TRANSACTION) || defined(TEST_BENCH)
+
 /** After each call to generateTestTransaction(), this will contain the offset
   * within the "full" transaction where the main transaction begins. */
 static uint32_t main_offset;
@@ -2439,7 +3316,7 @@ static uint32_t main_offset;
   * \return A pointer to a byte array containing the transaction data. This
   *         array must eventually be freed by the caller.
   */
-static uint8_t *generateTestTransaction(uint32_t *out_length, uint32_t num_inputs, uint32_t num_outputs)
+uint8_t *generateTestTransaction(uint32_t *out_length, uint32_t num_inputs, uint32_t num_outputs)
 {
 	uint8_t *buffer;
 	uint32_t ptr;
@@ -2567,6 +3444,175 @@ static uint8_t *generateTestTransaction(uint32_t *out_length, uint32_t num_input
 	return buffer;
 }
 
+#endif // #if defined(TEST_TRANSACTION) || defined(TEST_BENCH)
+
+#ifdef TEST_TRANSACTION
+
+/** Calculate the signature hash that one input of a transaction generated
+  * by generateTestTransaction() should have. This is a double SHA-256 hash
+  * of the main transaction, with the scripts of every input except the one
+  * being signed replaced with empty scripts.
+  * \param out The signature hash will be written here, as a 32 byte
+  *            little-endian multi-precision number.
+  * \param buffer The transaction data returned by generateTestTransaction().
+  *               #main_offset must be valid for this transaction.
+  * \param length The length of the transaction, in number of bytes.
+  * \param num_inputs The number of inputs in the transaction. This must be
+  *                   less than 0xfd.
+  * \param input_number The input (0 = first input) to calculate the
+  *                     signature hash of.
+  */
+static void calculateInputSigHash(uint8_t *out, const uint8_t *buffer, uint32_t length, uint32_t num_inputs, uint32_t input_number)
+{
+	HashState hs;
+	uint32_t ptr;
+	uint32_t end;
+	uint32_t i;
+
+	sha256Begin(&hs);
+	ptr = main_offset;
+	// Version and number of inputs.
+	for (end = ptr + 5; ptr < end; ptr++)
+	{
+		sha256WriteByte(&hs, buffer[ptr]);
+	}
+	for (i = 0; i < num_inputs; i++)
+	{
+		// Previous output reference.
+		for (end = ptr + 36; ptr < end; ptr++)
+		{
+			sha256WriteByte(&hs, buffer[ptr]);
+		}
+		// Script length and script.
+		if (i == input_number)
+		{
+			for (end = ptr + 26; ptr < end; ptr++)
+			{
+				sha256WriteByte(&hs, buffer[ptr]);
+			}
+		}
+		else
+		{
+			sha256WriteByte(&hs, 0x00);
+			ptr += 26;
+		}
+		// Sequence.
+		for (end = ptr + 4; ptr < end; ptr++)
+		{
+			sha256WriteByte(&hs, buffer[ptr]);
+		}
+	}
+	// Outputs, locktime and hashtype.
+	for (; ptr < length; ptr++)
+	{
+		sha256WriteByte(&hs, buffer[ptr]);
+	}
+	sha256FinishDouble(&hs);
+	writeHashToByteArray(out, &hs, false);
+}
+
+/** Write the double SHA-256 hash of some bytes, in the order that the bytes
+  * come out of SHA-256.
+  * \param out The hash will be written here. This must have space for 32
+  *            bytes.
+  * \param buffer The bytes to hash.
+  * \param length The number of bytes to hash.
+  * \param stride Every stride bytes, length bytes will be hashed, num times.
+  * \param num The number of sets of bytes to hash.
+  */
+static void doubleHashStrided(uint8_t *out, const uint8_t *buffer, uint32_t length, uint32_t stride, uint32_t num)
+{
+	HashState hs;
+	uint32_t i;
+	uint32_t j;
+
+	sha256Begin(&hs);
+	for (i = 0; i < num; i++)
+	{
+		for (j = 0; j < length; j++)
+		{
+			sha256WriteByte(&hs, buffer[i * stride + j]);
+		}
+	}
+	sha256FinishDouble(&hs);
+	writeHashToByteArray(out, &hs, true);
+}
+
+/** Calculate the witness (BIP 143) signature hash that one input of a
+  * transaction generated by generateTestTransaction() should have. This
+  * follows BIP 143 directly, hashing the entire transaction for each input.
+  * \param out The signature hash will be written here, as a 32 byte
+  *            little-endian multi-precision number.
+  * \param buffer The transaction data returned by generateTestTransaction().
+  *               #main_offset must be valid for this transaction.
+  * \param length The length of the transaction, in number of bytes.
+  * \param num_inputs The number of inputs in the transaction. This must be
+  *                   less than 0xfd.
+  * \param input_number The input (0 = first input) to calculate the
+  *                     signature hash of.
+  */
+static void calculateInputWitnessSigHash(uint8_t *out, const uint8_t *buffer, uint32_t length, uint32_t num_inputs, uint32_t input_number)
+{
+	HashState hs;
+	uint8_t digest[32];
+	const uint8_t *inputs;
+	const uint8_t *input;
+	uint32_t outputs_start;
+	uint32_t i;
+
+	inputs = &(buffer[main_offset + 5]);
+	input = &(inputs[input_number * sizeof(one_input)]);
+	// Skip the number of outputs.
+	outputs_start = main_offset + 5 + num_inputs * (uint32_t)sizeof(one_input) + 1;
+
+	sha256Begin(&hs);
+	// Version.
+	for (i = 0; i < 4; i++)
+	{
+		sha256WriteByte(&hs, buffer[main_offset + i]);
+	}
+	// hashPrevouts.
+	doubleHashStrided(digest, inputs, 36, sizeof(one_input), num_inputs);
+	for (i = 0; i < 32; i++)
+	{
+		sha256WriteByte(&hs, digest[i]);
+	}
+	// hashSequence.
+	doubleHashStrided(digest, &(inputs[sizeof(one_input) - 4]), 4, sizeof(one_input), num_inputs);
+	for (i = 0; i < 32; i++)
+	{
+		sha256WriteByte(&hs, digest[i]);
+	}
+	// Outpoint, then script code (including its length).
+	for (i = 0; i < 36 + 26; i++)
+	{
+		sha256WriteByte(&hs, input[i]);
+	}
+	// Amount, which is output 1 of #good_input_transaction.
+	for (i = 0; i < 8; i++)
+	{
+		sha256WriteByte(&hs, good_input_transaction[sizeof(good_input_transaction) - 38 + i]);
+	}
+	// Sequence.
+	for (i = 0; i < 4; i++)
+	{
+		sha256WriteByte(&hs, input[sizeof(one_input) - 4 + i]);
+	}
+	// hashOutputs.
+	doubleHashStrided(digest, &(buffer[outputs_start]), length - 8 - outputs_start, 0, 1);
+	for (i = 0; i < 32; i++)
+	{
+		sha256WriteByte(&hs, digest[i]);
+	}
+	// Locktime and hashtype.
+	for (i = length - 8; i < length; i++)
+	{
+		sha256WriteByte(&hs, buffer[i]);
+	}
+	sha256FinishDouble(&hs);
+	writeHashToByteArray(out, &hs, false);
+}
+
 /** Check that the number of outputs seen is as expected.
   * \param target The expected number of outputs.
   */
@@ -2594,8 +3640,8 @@ static void checkOutputsSeen(int target)
   */
 static void testTransaction(const uint8_t *buffer, uint32_t length, const char *name, TransactionErrors expected_return)
 {
-	uint8_t sig_hash[32];
-	uint8_t transaction_hash[32];
+	BigNum256Storage sig_hash;
+	BigNum256Storage transaction_hash;
 	TransactionErrors r;
 
 	clearOutputsSeen();
@@ -2694,6 +3740,29 @@ static void prependGoodP2SHInputsTestTransaction(const uint8_t *buffer, uint32_t
 	free(new_buffer);
 }
 
+/** Build test transaction data which uses a trusted input token instead of
+  * the input transaction of #good_full_transaction.
+  * \param out_length The length of the test transaction data will be
+  *                   written here.
+  * \param token The trusted input token to use.
+  * \return A pointer to the test transaction data. This must be freed by the
+  *         caller.
+  */
+static uint8_t *buildTrustedInputTestTransaction(uint32_t *out_length, const uint8_t *token)
+{
+	uint8_t *buffer;
+	uint32_t length;
+
+	length = TRUSTED_INPUT_TOKEN_LENGTH + sizeof(good_main_transaction) + 2;
+	buffer = malloc(length);
+	buffer[0] = TRUSTED_INPUT_RECORD;
+	memcpy(&(buffer[1]), token, TRUSTED_INPUT_TOKEN_LENGTH);
+	buffer[TRUSTED_INPUT_TOKEN_LENGTH + 1] = 0x00; // is_ref = 0 (main)
+	memcpy(&(buffer[TRUSTED_INPUT_TOKEN_LENGTH + 2]), good_main_transaction, sizeof(good_main_transaction));
+	*out_length = length;
+	return buffer;
+}
+
 int main(void)
 {
 	int i;
@@ -2704,17 +3773,27 @@ int main(void)
 	uint8_t big_amount_buffer[sizeof(big_amount_full_transaction)];
 	uint8_t *generated_transaction;
 	uint32_t length;
-	uint8_t sig_hash[32];
-	uint8_t transaction_hash[32];
-	uint8_t calculated_sig_hash[32];
-	uint8_t calculated_transaction_hash[32];
-	uint8_t sig_hash_input_changed[32];
-	uint8_t transaction_hash_input_changed[32];
-	uint8_t sig_hash_output_changed[32];
-	uint8_t transaction_hash_output_changed[32];
+	uint32_t ptr;
+	BigNum256Storage sig_hash;
+	BigNum256Storage transaction_hash;
+	BigNum256Storage calculated_sig_hash;
+	BigNum256Storage calculated_transaction_hash;
+	uint8_t multiple_sig_hashes[MAX_SIGN_INPUTS * 32];
+	uint32_t input_numbers[MAX_SIGN_INPUTS];
+	TransactionErrors r;
+	bool abort;
+	BigNum256Storage sig_hash_input_changed;
+	BigNum256Storage transaction_hash_input_changed;
+	BigNum256Storage sig_hash_output_changed;
+	BigNum256Storage transaction_hash_output_changed;
 	uint8_t signature[MAX_SIGNATURE_LENGTH];
 	uint8_t signature_length;
+	uint8_t multiple_signatures[MAX_SIGN_INPUTS * MAX_SIGNATURE_LENGTH];
+	uint8_t multiple_signature_lengths[MAX_SIGN_INPUTS];
+	uint8_t multiple_private_keys[MAX_SIGN_INPUTS * 32];
 	HashState test_hs;
+	uint8_t token[TRUSTED_INPUT_TOKEN_LENGTH];
+	uint8_t token_amount[8] = {0x40, 0x54, 0x92, 0x3d, 0x00, 0x00, 0x00, 0x00}; // 10.33 BTC
 
 	initTests(__FILE__);
 
@@ -2735,6 +3814,92 @@ int main(void)
 	// results to the test immediately above.
 	prependGoodInputTestTransaction(good_main_transaction, sizeof(good_main_transaction), "good2", TRANSACTION_NO_ERROR);
 
+	// Issue a trusted input token for the input transaction of
+	// good_full_transaction. The token should contain the outpoint which
+	// the main transaction refers to, and the amount of that output.
+	clearTrustedInputKey();
+	if (prepareTrustedInputKey())
+	{
+		printf("prepareTrustedInputKey() failed\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	// Issuing a token for something which isn't exactly one input
+	// transaction should fail.
+	setTestInputStream(good_full_transaction, sizeof(good_full_transaction));
+	r = getTrustedInput(token, sizeof(good_full_transaction));
+	if ((r != TRANSACTION_INVALID_FORMAT) || !isEndOfTransactionData())
+	{
+		printf("getTrustedInput() accepted a spending transaction\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	length = sizeof(good_input_transaction) + 1;
+	generated_transaction = malloc(length);
+	generated_transaction[0] = 0x01; // is_ref = 1 (input)
+	memcpy(&(generated_transaction[1]), good_input_transaction, sizeof(good_input_transaction));
+	setTestInputStream(generated_transaction, length);
+	r = getTrustedInput(token, length);
+	free(generated_transaction);
+	if ((r != TRANSACTION_NO_ERROR)
+		|| !isEndOfTransactionData()
+		|| memcmp(token, &(good_main_transaction[5]), 36)
+		|| memcmp(&(token[36]), token_amount, 8))
+	{
+		printf("getTrustedInput() didn't issue the expected token\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// Using the token instead of the input transaction should give the same
+	// signature and transaction hashes.
+	setTestInputStream(good_full_transaction, sizeof(good_full_transaction));
+	parseTransaction(calculated_sig_hash, calculated_transaction_hash, sizeof(good_full_transaction));
+	generated_transaction = buildTrustedInputTestTransaction(&length, token);
+	clearOutputsSeen();
+	setTestInputStream(generated_transaction, length);
+	r = parseTransaction(sig_hash, transaction_hash, length);
+	if ((r != TRANSACTION_NO_ERROR)
+		|| (bigCompare(sig_hash, calculated_sig_hash) != BIGCMP_EQUAL)
+		|| (bigCompare(transaction_hash, calculated_transaction_hash) != BIGCMP_EQUAL))
+	{
+		printf("Trusted input token doesn't substitute for input transaction\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	free(generated_transaction);
+	generated_transaction = buildTrustedInputTestTransaction(&length, token);
+	testTransaction(generated_transaction, TRUSTED_INPUT_TOKEN_LENGTH, "trustedinputtruncated", TRANSACTION_INVALID_FORMAT);
+	// Tampering with any part of the token should be detected.
+	generated_transaction[1 + 36] ^= 0x01; // amount
+	testTransaction(generated_transaction, length, "trustedinputbadamount", TRANSACTION_INVALID_REFERENCE);
+	generated_transaction[1 + 36] ^= 0x01;
+	generated_transaction[1 + 32] ^= 0x01; // output number
+	testTransaction(generated_transaction, length, "trustedinputbadoutput", TRANSACTION_INVALID_REFERENCE);
+	generated_transaction[1 + 32] ^= 0x01;
+	generated_transaction[TRUSTED_INPUT_TOKEN_LENGTH] ^= 0x80; // MAC
+	testTransaction(generated_transaction, length, "trustedinputbadmac", TRANSACTION_INVALID_REFERENCE);
+	generated_transaction[TRUSTED_INPUT_TOKEN_LENGTH] ^= 0x80;
+	testTransaction(generated_transaction, length, "trustedinputgood", TRANSACTION_NO_ERROR);
+	// Tokens shouldn't outlive the session they were issued in.
+	clearTrustedInputKey();
+	testTransaction(generated_transaction, length, "trustedinputnokey", TRANSACTION_INVALID_REFERENCE);
+	prepareTrustedInputKey();
+	testTransaction(generated_transaction, length, "trustedinputnewkey", TRANSACTION_INVALID_REFERENCE);
+	free(generated_transaction);
+
 	// Truncate the good transaction and check that the transaction parser
 	// doesn't choke.
 	for (i = 0; i < sizeof(good_full_transaction); i++)
@@ -3119,6 +4284,210 @@ int main(void)
 		reportSuccess();
 	}
 
+	// For a transaction with one input, parseTransactionMultiple() should
+	// calculate the same hashes as parseTransaction().
+	input_numbers[0] = 0;
+	setTestInputStream(good_full_transaction, sizeof(good_full_transaction));
+	r = parseTransactionMultiple(multiple_sig_hashes, calculated_transaction_hash, sizeof(good_full_transaction), input_numbers, 1);
+	if ((r != TRANSACTION_NO_ERROR)
+		|| memcmp(multiple_sig_hashes, sig_hash, 32)
+		|| memcmp(calculated_transaction_hash, transaction_hash, 32))
+	{
+		printf("parseTransactionMultiple() doesn't match parseTransaction() for single input transaction\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// Check that parseTransactionMultiple() calculates the signature hash of
+	// each requested input, with all the other input scripts blanked out.
+	generated_transaction = generateTestTransaction(&length, 5, 2);
+	setTestInputStream(generated_transaction, length);
+	parseTransaction(sig_hash, transaction_hash, length);
+	input_numbers[0] = 4;
+	input_numbers[1] = 0;
+	input_numbers[2] = 2;
+	clearOutputsSeen();
+	setTestInputStream(generated_transaction, length);
+	r = parseTransactionMultiple(multiple_sig_hashes, calculated_transaction_hash, length, input_numbers, MAX_SIGN_INPUTS);
+	if ((r != TRANSACTION_NO_ERROR) || !isEndOfTransactionData())
+	{
+		printf("parseTransactionMultiple() failed to parse a good transaction\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	checkOutputsSeen(2);
+	if (memcmp(calculated_transaction_hash, transaction_hash, 32))
+	{
+		printf("parseTransactionMultiple() isn't calculating transaction hash properly\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	for (i = 0; i < MAX_SIGN_INPUTS; i++)
+	{
+		calculateInputSigHash(calculated_sig_hash, generated_transaction, length, 5, input_numbers[i]);
+		if (memcmp(&(multiple_sig_hashes[i * 32]), calculated_sig_hash, 32))
+		{
+			printf("parseTransactionMultiple() isn't calculating signature hash %d properly\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+	}
+
+	// The same input can be asked for more than once.
+	for (i = 0; i < MAX_SIGN_INPUTS; i++)
+	{
+		input_numbers[i] = 3;
+	}
+	setTestInputStream(generated_transaction, length);
+	r = parseTransactionMultiple(multiple_sig_hashes, calculated_transaction_hash, length, input_numbers, MAX_SIGN_INPUTS);
+	calculateInputSigHash(calculated_sig_hash, generated_transaction, length, 5, 3);
+	abort = false;
+	for (i = 0; i < MAX_SIGN_INPUTS; i++)
+	{
+		if (memcmp(&(multiple_sig_hashes[i * 32]), calculated_sig_hash, 32))
+		{
+			abort = true;
+		}
+	}
+	if ((r != TRANSACTION_NO_ERROR) || abort)
+	{
+		printf("parseTransactionMultiple() doesn't handle repeated input numbers\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// Asking for the signature hash of an input which doesn't exist should
+	// fail, but the entire transaction should still be consumed.
+	input_numbers[0] = 1;
+	input_numbers[1] = 5;
+	setTestInputStream(generated_transaction, length);
+	r = parseTransactionMultiple(multiple_sig_hashes, calculated_transaction_hash, length, input_numbers, 2);
+	if ((r != TRANSACTION_INVALID_REFERENCE) || !isEndOfTransactionData())
+	{
+		printf("parseTransactionMultiple() accepts non-existent input number\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// Check that parseTransactionWitness() calculates BIP 143 signature
+	// hashes. The transaction hash shouldn't depend on the signing mode.
+	input_numbers[0] = 4;
+	input_numbers[1] = 0;
+	input_numbers[2] = 2;
+	clearOutputsSeen();
+	setTestInputStream(generated_transaction, length);
+	r = parseTransactionWitness(multiple_sig_hashes, calculated_transaction_hash, length, input_numbers, MAX_SIGN_INPUTS);
+	if ((r != TRANSACTION_NO_ERROR) || !isEndOfTransactionData())
+	{
+		printf("parseTransactionWitness() failed to parse a good transaction\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	checkOutputsSeen(2);
+	if (memcmp(calculated_transaction_hash, transaction_hash, 32))
+	{
+		printf("parseTransactionWitness() isn't calculating transaction hash properly\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	for (i = 0; i < MAX_SIGN_INPUTS; i++)
+	{
+		calculateInputWitnessSigHash(calculated_sig_hash, generated_transaction, length, 5, input_numbers[i]);
+		if (memcmp(&(multiple_sig_hashes[i * 32]), calculated_sig_hash, 32))
+		{
+			printf("parseTransactionWitness() isn't calculating signature hash %d properly\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+	}
+	// Witness signature hashes must not be the same as legacy ones.
+	calculateInputSigHash(calculated_sig_hash, generated_transaction, length, 5, input_numbers[0]);
+	if (!memcmp(multiple_sig_hashes, calculated_sig_hash, 32))
+	{
+		printf("parseTransactionWitness() is calculating legacy signature hashes\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// Non-existent input numbers should be rejected in witness mode too.
+	input_numbers[0] = 1;
+	input_numbers[1] = 5;
+	setTestInputStream(generated_transaction, length);
+	r = parseTransactionWitness(multiple_sig_hashes, calculated_transaction_hash, length, input_numbers, 2);
+	if ((r != TRANSACTION_INVALID_REFERENCE) || !isEndOfTransactionData())
+	{
+		printf("parseTransactionWitness() accepts non-existent input number\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	free(generated_transaction);
+
+	// Only inputs which are being signed need a 25 byte script code.
+	// Input 2 is mangled (below) so that its script is 1 byte long.
+	generated_transaction = generateTestTransaction(&length, 3, 2);
+	ptr = main_offset + 5 + 2 * sizeof(one_input) + 36;
+	generated_transaction[ptr] = 0x01;
+	memmove(&(generated_transaction[ptr + 2]), &(generated_transaction[ptr + 26]), length - (ptr + 26));
+	length -= 24;
+	input_numbers[0] = 0;
+	setTestInputStream(generated_transaction, length);
+	r = parseTransactionWitness(multiple_sig_hashes, calculated_transaction_hash, length, input_numbers, 1);
+	if (r != TRANSACTION_NO_ERROR)
+	{
+		printf("parseTransactionWitness() doesn't accept odd script which isn't being signed\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	input_numbers[0] = 2;
+	setTestInputStream(generated_transaction, length);
+	r = parseTransactionWitness(multiple_sig_hashes, calculated_transaction_hash, length, input_numbers, 1);
+	if ((r != TRANSACTION_NON_STANDARD) || !isEndOfTransactionData())
+	{
+		printf("parseTransactionWitness() accepts non-standard script code\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	free(generated_transaction);
+
 	// Check that the transaction parser doesn't choke on a transaction
 	// with the maximum possible size. This test takes a while.
 	testTransaction(NULL, 0xffffffff, "max_size", TRANSACTION_TOO_LARGE);
@@ -3164,6 +4533,39 @@ int main(void)
 		reportSuccess();
 	}
 
+	// Check that signTransactionMultiple() gives the same signatures as
+	// signTransaction(), for every number of inputs.
+	for (i = 1; i <= MAX_SIGN_INPUTS; i++)
+	{
+		fillWithRandom(multiple_sig_hashes, sizeof(multiple_sig_hashes));
+		fillWithRandom(multiple_private_keys, sizeof(multiple_private_keys));
+		for (ptr = 0; ptr < MAX_SIGN_INPUTS; ptr++)
+		{
+			multiple_private_keys[ptr * 32 + 31] = (uint8_t)(multiple_private_keys[ptr * 32 + 31] & 0x7f); // ensure private key < n
+		}
+		memset(multiple_signatures, 0, sizeof(multiple_signatures));
+		signTransactionMultiple(multiple_signatures, multiple_signature_lengths, multiple_sig_hashes, multiple_private_keys, (uint8_t)i);
+		abort = false;
+		for (ptr = 0; ptr < (uint32_t)i; ptr++)
+		{
+			signTransaction(signature, &signature_length, &(multiple_sig_hashes[ptr * 32]), &(multiple_private_keys[ptr * 32]));
+			if ((multiple_signature_lengths[ptr] != signature_length)
+				|| memcmp(&(multiple_signatures[ptr * MAX_SIGNATURE_LENGTH]), signature, signature_length))
+			{
+				abort = true;
+			}
+		}
+		if (abort)
+		{
+			printf("signTransactionMultiple() doesn't match signTransaction(), inputs = %d\n", i);
+			reportFailure();
+		}
+		else
+		{
+			reportSuccess();
+		}
+	}
+
 	finishTests();
 	exit(0);
 }
@@ -15,6 +15,54 @@
   * signTransaction() generates. */
 #define MAX_SIGNATURE_LENGTH		73
 
+/** Maximum number of inputs which parseTransactionMultiple() or
+  * parseTransactionWitness() can calculate signature hashes for at once.
+  * Each one needs its own hash state, so this is limited by the amount of
+  * RAM available. It is also limited by the
+  * size of the Signatures message, which holds one signature for each
+  * input.
+  * \warning This must match the max_count of the repeated fields in the
+  *          SignTransactionMultiple message (see messages.proto).
+  * \warning This must be <= 8, since parseTransactionMultiple() keeps track
+  *          of the signature hashes using an 8 bit mask.
+  */
+#define MAX_SIGN_INPUTS				3
+
+/** The maximum size of a transaction (in bytes) which parseTransaction()
+  * is prepared to handle. Transactions are parsed as they are streamed in,
+  * using a constant amount of RAM, so this (and #MAX_INPUTS and
+  * #MAX_OUTPUTS) is only a sanity limit and can be overridden. */
+#ifndef MAX_TRANSACTION_SIZE
+#define MAX_TRANSACTION_SIZE	2000000
+#endif // #ifndef MAX_TRANSACTION_SIZE
+/** The maximum number of inputs that the transaction parser is prepared
+  * to handle. This should be small enough that a transaction with the
+  * maximum number of inputs is still less than #MAX_TRANSACTION_SIZE bytes in
+  * size.
+  */
+#ifndef MAX_INPUTS
+#define MAX_INPUTS				5000
+#endif // #ifndef MAX_INPUTS
+/** The maximum number of outputs that the transaction parser is prepared
+  * to handle. This should be small enough that a transaction with the
+  * maximum number of outputs is still less than #MAX_TRANSACTION_SIZE bytes
+  * in size. The user interface may impose a lower limit (see
+  * newOutputSeen()).
+  */
+#ifndef MAX_OUTPUTS
+#define MAX_OUTPUTS				2000
+#endif // #ifndef MAX_OUTPUTS
+
+/** The size, in bytes, of a trusted input token (see getTrustedInput()). */
+#define TRUSTED_INPUT_TOKEN_LENGTH	76
+/** The size, in bytes, of the message authentication code at the end of
+  * a trusted input token. */
+#define TRUSTED_INPUT_MAC_LENGTH	32
+/** If an input transaction in the data passed to parseTransaction() starts
+  * with this byte (instead of the usual non-zero is_ref byte), it is not an
+  * input transaction but a trusted input token (see getTrustedInput()). */
+#define TRUSTED_INPUT_RECORD		0x02
+
 /** Return values for parseTransaction(). */
 typedef enum TransactionErrorsEnum
 {
@@ -38,6 +86,15 @@ typedef enum TransactionErrorsEnum
 } TransactionErrors;
 
 extern TransactionErrors parseTransaction(BigNum256 sig_hash, BigNum256 transaction_hash, uint32_t length);
+extern TransactionErrors parseTransactionMultiple(uint8_t *sig_hashes, BigNum256 transaction_hash, uint32_t length, uint32_t *input_numbers, uint8_t num_sig_hashes);
+extern TransactionErrors parseTransactionWitness(uint8_t *sig_hashes, BigNum256 transaction_hash, uint32_t length, uint32_t *input_numbers, uint8_t num_sig_hashes);
+extern TransactionErrors getTrustedInput(uint8_t *token, uint32_t length);
+extern bool prepareTrustedInputKey(void);
+extern void clearTrustedInputKey(void);
 extern void signTransaction(uint8_t *signature, uint8_t *out_length, BigNum256 sig_hash, BigNum256 private_key);
+extern void signTransactionMultiple(uint8_t *signatures, uint8_t *out_lengths, uint8_t *sig_hashes, uint8_t *private_keys, uint8_t count);
+#if defined(TEST_TRANSACTION) || defined(TEST_BENCH)
+extern uint8_t *generateTestTransaction(uint32_t *out_length, uint32_t num_inputs, uint32_t num_outputs);
+#endif // #if defined(TEST_TRANSACTION) || defined(TEST_BENCH)
 
 #endif // #ifndef TRANSACTION_H_INCLUDED
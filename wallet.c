@@ -46,6 +46,18 @@
 #include "storage_common.h"
 #include "hmac_sha512.h"
 #include "pbkdf2.h"
+#include "bip32.h"
+#include "profile.h"
+#include "background.h"
+
+/** Length of the marker which is written to #ADDRESS_SANITISE_MARKER while
+  * sanitiseEverything() is in progress. This is long enough that random
+  * data will (with overwhelming probability) never look like the marker. */
+#define SANITISE_MARKER_LENGTH	16
+/** Value of every byte of the marker which is written to
+  * #ADDRESS_SANITISE_MARKER. This must not be 0x00 or 0xff, since those
+  * are what the first two passes of sanitisation write. */
+#define SANITISE_MARKER_BYTE	0xa5
 
 /** Length of the checksum field of a wallet record. This is 32 since SHA-256
   * is used to calculate the checksum and the output of SHA-256 is 32 bytes
@@ -57,8 +69,15 @@ struct WalletRecordUnencryptedStruct
 {
 	/** Wallet version. Should be one of #WalletVersion. */
 	uint32_t version;
+	/** Base 2 logarithm of the number of PBKDF2 iterations used to derive
+	  * the wallet encryption key, or 0 to use getPBKDF2Iterations(). This
+	  * has to be unencrypted, since it's needed to derive the key. It's
+	  * covered by the checksum, so tampering with it just makes the wallet
+	  * fail to load. It's ignored for hidden wallets (see
+	  * getWalletPBKDF2Iterations()). */
+	uint8_t pbkdf2_exponent;
 	/** Reserved for future use. Set to all zeroes. */
-	uint8_t reserved[4];
+	uint8_t reserved[3];
 	/** Name of the wallet. This is purely for the sake of the host; the
 	  * name isn't ever used or parsed by the functions in this file. */
 	uint8_t name[NAME_LENGTH];
@@ -119,6 +138,190 @@ static uint32_t wallet_nv_address;
   * getNumberOfWallets(). */
 static uint32_t num_wallets;
 
+#ifndef WALLET_NO_ADDRESS_CACHE
+/** Number of entries in the address cache. Address handle ah is always
+  * stored in entry (ah % #ADDRESS_CACHE_ENTRIES), so consecutive address
+  * handles never evict each other. */
+#define ADDRESS_CACHE_ENTRIES	4
+
+/** One entry in the address cache. */
+typedef struct AddressCacheEntryStruct
+{
+	/** Address handle that this entry is for. This is 0 (which is never a
+	  * valid address handle) if the entry is empty. */
+	AddressHandle ah;
+	/** Address (hash of the compressed public key) of ah. */
+	uint8_t address[20];
+	/** Public key of ah. */
+	PointAffine public_key;
+} AddressCacheEntry;
+
+/** Cache of recently calculated addresses and public keys of the currently
+  * loaded wallet. Calculating those requires a point multiplication, which
+  * is very slow, yet hosts tend to ask for the same addresses again and
+  * again. The cache is cleared whenever a wallet is unloaded. */
+static AddressCacheEntry address_cache[ADDRESS_CACHE_ENTRIES];
+#endif // #ifndef WALLET_NO_ADDRESS_CACHE
+
+#ifndef WALLET_NO_PRIVATE_KEY_CACHE
+/** Number of entries in the private key cache. Address handle ah is always
+  * stored in entry (ah % #PRIVATE_KEY_CACHE_ENTRIES). */
+#define PRIVATE_KEY_CACHE_ENTRIES	4
+
+/** One entry in the private key cache. */
+typedef struct PrivateKeyCacheEntryStruct
+{
+	/** Address handle that this entry is for. This is 0 (which is never a
+	  * valid address handle) if the entry is empty. */
+	AddressHandle ah;
+	/** Private key of ah. */
+	uint8_t private_key[32];
+} PrivateKeyCacheEntry;
+
+/** Cache of recently generated private keys of the currently loaded wallet.
+  * Signing a transaction with many inputs usually means asking for the
+  * private keys of the same few addresses over and over again, and each one
+  * costs a run of the deterministic private key generator. Since the
+  * wallet's seed is in RAM anyway while a wallet is loaded, caching private
+  * keys doesn't expose anything that wasn't already there. The cache is
+  * cleared whenever a wallet is unloaded. The corresponding public keys are
+  * already cached in #address_cache. */
+static PrivateKeyCacheEntry private_key_cache[PRIVATE_KEY_CACHE_ENTRIES];
+#endif // #ifndef WALLET_NO_PRIVATE_KEY_CACHE
+
+#ifdef WALLET_CACHE_DERIVED_KEY
+/** Whether #derived_key_cache_password_hash and #derived_key_cache_key are
+  * valid. */
+static bool derived_key_cache_valid;
+/** SHA-256 hash of the UUID and password which were used to derive
+  * #derived_key_cache_key. See calculatePasswordHash(). This is only
+  * well-defined if #derived_key_cache_valid is true. */
+static uint8_t derived_key_cache_password_hash[32];
+/** The most recently derived wallet encryption key. Deriving a key (using
+  * pbkdf2()) is deliberately very slow, so caching it means that switching
+  * back and forth between wallets doesn't pay that cost every time. This is
+  * only well-defined if #derived_key_cache_valid is true.
+  * \warning Caching the key means that uninitWallet() no longer really
+  *          "locks" a wallet, since anyone with access to RAM can recover
+  *          the key. That's why this is only done if
+  *          WALLET_CACHE_DERIVED_KEY is defined.
+  */
+static uint8_t derived_key_cache_key[WALLET_ENCRYPTION_KEY_LENGTH];
+#endif // #ifdef WALLET_CACHE_DERIVED_KEY
+
+#ifdef WALLET_DIRECTORY
+#ifndef WALLET_DIRECTORY_ENTRIES
+/** Number of wallet slots whose unencrypted headers can be held in
+  * #wallet_directory. Slots beyond this are still queried from non-volatile
+  * memory every time. Each entry costs about 64 bytes of RAM. */
+#define WALLET_DIRECTORY_ENTRIES	32
+#endif // #ifndef WALLET_DIRECTORY_ENTRIES
+
+/** RAM copy of the unencrypted portion of the first
+  * #WALLET_DIRECTORY_ENTRIES wallet records. Hosts list wallets often, and
+  * every listing used to read every wallet slot from non-volatile memory
+  * (twice, since the response is sized before it is sent). With the
+  * directory, each slot is read once and getWalletInfo() is then a memory
+  * copy. Entries are only well-defined if the corresponding entry of
+  * #wallet_directory_valid is true. */
+static struct WalletRecordUnencryptedStruct wallet_directory[WALLET_DIRECTORY_ENTRIES];
+/** Whether each entry of #wallet_directory matches what is in non-volatile
+  * memory. Every function in this file which writes to the unencrypted
+  * portion of a wallet record must call invalidateWalletDirectory()
+  * first. */
+static bool wallet_directory_valid[WALLET_DIRECTORY_ENTRIES];
+
+/** Mark every entry of #wallet_directory whose wallet record overlaps an
+  * area of the accounts partition as invalid.
+  * \param start The first address of the area.
+  * \param length The number of bytes in the area. This may be 0.
+  */
+static void invalidateWalletDirectory(uint32_t start, uint32_t length)
+{
+	uint32_t i;
+
+	for (i = 0; i < WALLET_DIRECTORY_ENTRIES; i++)
+	{
+		if ((length > 0)
+			&& (start < ((i + 1) * sizeof(WalletRecord)))
+			&& ((start + length) > (i * sizeof(WalletRecord))))
+		{
+			wallet_directory_valid[i] = false;
+		}
+	}
+}
+#endif // #ifdef WALLET_DIRECTORY
+
+#ifdef WALLET_CONTEXTS
+/** Everything about a loaded wallet which has to be put aside while another
+  * wallet context is selected (see selectWalletContext()). The members are
+  * copies of the variables of the same name. WALLET_CONTEXTS should be
+  * defined as the number of contexts (eg. "WALLET_CONTEXTS=4"); each one
+  * costs about 800 bytes of RAM. */
+typedef struct WalletContextStruct
+{
+	/** See #wallet_loaded. */
+	bool wallet_loaded;
+	/** See #is_hidden_wallet. */
+	bool is_hidden_wallet;
+	/** See #current_wallet. */
+	WalletRecord current_wallet;
+	/** See #wallet_nv_address. */
+	uint32_t wallet_nv_address;
+	/** The wallet encryption key (see getEncryptionKey()). */
+	uint8_t encryption_key[WALLET_ENCRYPTION_KEY_LENGTH];
+	/** The parent public key cache (see saveParentPublicKeyCache()). */
+	PointAffine parent_public_key;
+	/** Whether #parent_public_key is valid. */
+	bool parent_public_key_valid;
+#ifndef WALLET_NO_ADDRESS_CACHE
+	/** See #address_cache. */
+	AddressCacheEntry address_cache[ADDRESS_CACHE_ENTRIES];
+#endif // #ifndef WALLET_NO_ADDRESS_CACHE
+#ifndef WALLET_NO_PRIVATE_KEY_CACHE
+	/** See #private_key_cache. */
+	PrivateKeyCacheEntry private_key_cache[PRIVATE_KEY_CACHE_ENTRIES];
+#endif // #ifndef WALLET_NO_PRIVATE_KEY_CACHE
+} WalletContext;
+
+/** Wallet contexts which aren't currently selected. Entry
+  * #active_context is unused (and kept cleared), since that context lives
+  * in the usual variables (#current_wallet etc.). Every entry contains
+  * secrets, so entries are cleared whenever a context is unloaded. */
+static WalletContext saved_contexts[WALLET_CONTEXTS];
+/** Index of the currently selected wallet context. */
+static uint8_t active_context;
+
+/** Clear a saved wallet context, so that it has no wallet loaded.
+  * \param context The saved wallet context to clear.
+  */
+static void clearSavedContext(WalletContext *context)
+{
+	memset(context, 0xff, sizeof(WalletContext));
+	memset(context, 0, sizeof(WalletContext));
+}
+
+/** Unload every saved wallet context which has the wallet at a particular
+  * address loaded. A wallet must only be loaded in one context at a time;
+  * otherwise, changes made through one context (eg. a new encryption key or
+  * a new address) would make the others stale.
+  * \param address The address (in the accounts partition) of the wallet
+  *                record.
+  */
+static void unloadSavedContexts(uint32_t address)
+{
+	uint8_t i;
+
+	for (i = 0; i < WALLET_CONTEXTS; i++)
+	{
+		if (saved_contexts[i].wallet_loaded && (saved_contexts[i].wallet_nv_address == address))
+		{
+			clearSavedContext(&(saved_contexts[i]));
+		}
+	}
+}
+#endif // #ifdef WALLET_CONTEXTS
+
 #ifdef TEST
 /** The file to perform test non-volatile I/O on. */
 FILE *wallet_test_file;
@@ -144,6 +347,10 @@ void initWalletTest(void)
 		printf("Could not open \"wallet_test.bin\" for writing\n");
 		exit(1);
 	}
+#ifdef WALLET_DIRECTORY
+	// The file was just truncated, so nothing in the directory is valid.
+	invalidateWalletDirectory(0, 0xffffffff);
+#endif // #ifdef WALLET_DIRECTORY
 }
 
 #endif // #ifdef TEST
@@ -170,23 +377,15 @@ static bool suppress_set_entropy_pool;
 static void calculateWalletChecksum(uint8_t *hash)
 {
 	uint8_t *ptr;
-	unsigned int i;
+	uint32_t after_checksum;
 	HashState hs;
 
 	sha256Begin(&hs);
 	ptr = (uint8_t *)&current_wallet;
-	for (i = 0; i < sizeof(WalletRecord); i++)
-	{
-		// Skip checksum when calculating the checksum.
-		if (i == offsetof(WalletRecord, encrypted.checksum))
-		{
-			i += sizeof(current_wallet.encrypted.checksum);
-		}
-		if (i < sizeof(WalletRecord))
-		{
-			sha256WriteByte(&hs, ptr[i]);
-		}
-	}
+	// Skip checksum when calculating the checksum.
+	sha256WriteBytes(&hs, ptr, offsetof(WalletRecord, encrypted.checksum));
+	after_checksum = offsetof(WalletRecord, encrypted.checksum) + sizeof(current_wallet.encrypted.checksum);
+	sha256WriteBytes(&hs, &(ptr[after_checksum]), sizeof(WalletRecord) - after_checksum);
 	sha256Finish(&hs);
 	writeHashToByteArray(hash, &hs, true);
 }
@@ -239,6 +438,9 @@ static WalletErrors readWalletRecord(WalletRecord *wallet_record, uint32_t addre
   */
 static WalletErrors writeCurrentWalletRecord(uint32_t address)
 {
+#ifdef WALLET_DIRECTORY
+	invalidateWalletDirectory(address, sizeof(WalletRecord));
+#endif // #ifdef WALLET_DIRECTORY
 	if (nonVolatileWrite(
 		(uint8_t *)&(current_wallet.unencrypted),
 		PARTITION_ACCOUNTS,
@@ -262,6 +464,128 @@ static WalletErrors writeCurrentWalletRecord(uint32_t address)
 	return WALLET_NO_ERROR;
 }
 
+/** Store only the fields of #current_wallet which change when a new address
+  * is made: the number of addresses and the checksum. This is much cheaper
+  * than writeCurrentWalletRecord(), since it writes 48 bytes instead of the
+  * whole record. It only works because num_addresses and checksum are both
+  * aligned to the start of an AES block within the encrypted portion, so
+  * that rewriting the blocks containing them doesn't disturb anything else.
+  * This will also call nonVolatileFlush().
+  * \param address The address in non-volatile memory of the wallet record.
+  * \return See #WalletErrors.
+  */
+static WalletErrors writeCurrentWalletAddressCount(uint32_t address)
+{
+	// The block containing num_addresses also contains padding and reserved,
+	// which haven't changed. Writing the whole block means that it can be
+	// encrypted directly, without reading and decrypting it first.
+	if (encryptedNonVolatileWrite(
+		(uint8_t *)&(current_wallet.encrypted.num_addresses),
+		PARTITION_ACCOUNTS,
+		address + offsetof(WalletRecord, encrypted.num_addresses),
+		offsetof(WalletRecord, encrypted.seed) - offsetof(WalletRecord, encrypted.num_addresses)) != NV_NO_ERROR)
+	{
+		return WALLET_WRITE_ERROR;
+	}
+	if (encryptedNonVolatileWrite(
+		current_wallet.encrypted.checksum,
+		PARTITION_ACCOUNTS,
+		address + offsetof(WalletRecord, encrypted.checksum),
+		sizeof(current_wallet.encrypted.checksum)) != NV_NO_ERROR)
+	{
+		return WALLET_WRITE_ERROR;
+	}
+	if (nonVolatileFlush() != NV_NO_ERROR)
+	{
+		return WALLET_WRITE_ERROR;
+	}
+	return WALLET_NO_ERROR;
+}
+
+#ifdef WALLET_CACHE_DERIVED_KEY
+/** Calculate the hash which identifies a (UUID, password, number of
+  * iterations) triple in the derived key cache. The UUID is included so that
+  * the same password used for two different wallets (which results in two
+  * different keys) doesn't match. The number of iterations is included for
+  * the same reason.
+  * \param out The SHA-256 hash will be written here. This must be a byte
+  *            array with space for 32 bytes.
+  * \param uuid Byte array containing the wallet UUID. This must be
+  *             exactly #UUID_LENGTH bytes long.
+  * \param password Password to hash.
+  * \param password_length Length of password, in bytes.
+  * \param num_iterations Number of PBKDF2 iterations the key is derived with.
+  */
+static void calculatePasswordHash(uint8_t *out, const uint8_t *uuid, const uint8_t *password, const unsigned int password_length, const uint32_t num_iterations)
+{
+	HashState hs;
+	uint8_t buffer[4];
+
+	sha256Begin(&hs);
+	sha256WriteBytes(&hs, (uint8_t *)uuid, UUID_LENGTH);
+	writeU32LittleEndian(buffer, num_iterations);
+	sha256WriteBytes(&hs, buffer, sizeof(buffer));
+	sha256WriteBytes(&hs, (uint8_t *)password, password_length);
+	sha256Finish(&hs);
+	writeHashToByteArray(out, &hs, true);
+}
+
+/** Forget any cached derived key. This should be called whenever wallets
+  * are deleted, so that a deleted wallet's key doesn't linger in RAM. */
+static void clearDerivedKeyCache(void)
+{
+	memset(derived_key_cache_password_hash, 0xff, sizeof(derived_key_cache_password_hash));
+	memset(derived_key_cache_key, 0xff, sizeof(derived_key_cache_key));
+	memset(derived_key_cache_password_hash, 0, sizeof(derived_key_cache_password_hash));
+	memset(derived_key_cache_key, 0, sizeof(derived_key_cache_key));
+	derived_key_cache_valid = false;
+}
+#endif // #ifdef WALLET_CACHE_DERIVED_KEY
+
+/** Get the number of PBKDF2 iterations to derive a wallet's encryption key
+  * with.
+  * \param unencrypted The unencrypted portion of the wallet record.
+  * \return The number of iterations. This is getPBKDF2Iterations() for
+  *         legacy wallets (which have 0 in the pbkdf2_exponent field) and
+  *         for anything which might be a hidden wallet, since the
+  *         unencrypted portion of a hidden wallet is just whatever was left
+  *         by sanitisation.
+  */
+static uint32_t getWalletPBKDF2Iterations(const struct WalletRecordUnencryptedStruct *unencrypted)
+{
+	if (((unencrypted->version == VERSION_UNENCRYPTED)
+		|| (unencrypted->version == VERSION_IS_ENCRYPTED))
+		&& (unencrypted->pbkdf2_exponent != 0)
+		&& (unencrypted->pbkdf2_exponent < 32))
+	{
+		return (uint32_t)1 << unencrypted->pbkdf2_exponent;
+	}
+	else
+	{
+		return getPBKDF2Iterations();
+	}
+}
+
+/** Choose the value of the pbkdf2_exponent field for a (non-hidden) wallet
+  * whose encryption key is about to be derived from a new password.
+  * \param password_length Length of the new password, in bytes. 0 means that
+  *                        the wallet will be unencrypted.
+  * \return The value to put in the pbkdf2_exponent field.
+  */
+static uint8_t chooseWalletPBKDF2Exponent(const unsigned int password_length)
+{
+#ifdef PBKDF2_CALIBRATE
+	if (password_length > 0)
+	{
+		return calibratePBKDF2Exponent();
+	}
+#endif // #ifdef PBKDF2_CALIBRATE
+	// Without calibration (or a password), there's no reason not to keep
+	// tracking getPBKDF2Iterations().
+	(void)password_length;
+	return 0;
+}
+
 /** Using the specified password and UUID (as the salt), derive an encryption
   * key and begin using it.
   *
@@ -273,10 +597,15 @@ static WalletErrors writeCurrentWalletRecord(uint32_t address)
   * \param password Password to use in key derivation.
   * \param password_length Length of password, in bytes. Use 0 to specify no
   *                        password (i.e. wallet is unencrypted).
+  * \param num_iterations Number of PBKDF2 iterations to use. See
+  *                       getWalletPBKDF2Iterations().
   */
-static void deriveAndSetEncryptionKey(const uint8_t *uuid, const uint8_t *password, const unsigned int password_length)
+static void deriveAndSetEncryptionKey(const uint8_t *uuid, const uint8_t *password, const unsigned int password_length, const uint32_t num_iterations)
 {
 	uint8_t derived_key[SHA512_HASH_LENGTH];
+#ifdef WALLET_CACHE_DERIVED_KEY
+	uint8_t password_hash[32];
+#endif // #ifdef WALLET_CACHE_DERIVED_KEY
 
 	if (sizeof(derived_key) < WALLET_ENCRYPTION_KEY_LENGTH)
 	{
@@ -284,8 +613,26 @@ static void deriveAndSetEncryptionKey(const uint8_t *uuid, const uint8_t *passwo
 	}
 	if (password_length > 0)
 	{
-		pbkdf2(derived_key, password, password_length, uuid, UUID_LENGTH);
+#ifdef WALLET_CACHE_DERIVED_KEY
+		calculatePasswordHash(password_hash, uuid, password, password_length, num_iterations);
+		if (derived_key_cache_valid
+			&& (bigCompareVariableSize(derived_key_cache_password_hash, password_hash, sizeof(password_hash)) == BIGCMP_EQUAL))
+		{
+			setEncryptionKey(derived_key_cache_key);
+			memset(password_hash, 0, sizeof(password_hash));
+			return;
+		}
+#endif // #ifdef WALLET_CACHE_DERIVED_KEY
+		PROFILE_ENTER(PROFILE_CRYPTO);
+		pbkdf2(derived_key, password, password_length, uuid, UUID_LENGTH, num_iterations);
+		PROFILE_EXIT();
 		setEncryptionKey(derived_key);
+#ifdef WALLET_CACHE_DERIVED_KEY
+		memcpy(derived_key_cache_password_hash, password_hash, sizeof(password_hash));
+		memcpy(derived_key_cache_key, derived_key, sizeof(derived_key_cache_key));
+		derived_key_cache_valid = true;
+		memset(password_hash, 0, sizeof(password_hash));
+#endif // #ifdef WALLET_CACHE_DERIVED_KEY
 	}
 	else
 	{
@@ -307,7 +654,7 @@ WalletErrors initWallet(uint32_t wallet_spec, const uint8_t *password, const uns
 {
 	WalletErrors r;
 	uint8_t hash[CHECKSUM_LENGTH];
-	uint8_t uuid[UUID_LENGTH];
+	struct WalletRecordUnencryptedStruct unencrypted;
 
 	if (uninitWallet() != WALLET_NO_ERROR)
 	{
@@ -324,13 +671,18 @@ WalletErrors initWallet(uint32_t wallet_spec, const uint8_t *password, const uns
 		return last_error;
 	}
 	wallet_nv_address = wallet_spec * sizeof(WalletRecord);
+#ifdef WALLET_CONTEXTS
+	unloadSavedContexts(wallet_nv_address);
+#endif // #ifdef WALLET_CONTEXTS
 
-	if (nonVolatileRead(uuid, PARTITION_ACCOUNTS, wallet_nv_address + offsetof(WalletRecord, unencrypted.uuid), UUID_LENGTH) != NV_NO_ERROR)
+	// The UUID (the salt) and the number of iterations are both needed to
+	// derive the key, before the rest of the record can be read.
+	if (nonVolatileRead((uint8_t *)&unencrypted, PARTITION_ACCOUNTS, wallet_nv_address + offsetof(WalletRecord, unencrypted), sizeof(unencrypted)) != NV_NO_ERROR)
 	{
 		last_error = WALLET_READ_ERROR;
 		return last_error;
 	}
-	deriveAndSetEncryptionKey(uuid, password, password_length);
+	deriveAndSetEncryptionKey(unencrypted.uuid, password, password_length, getWalletPBKDF2Iterations(&unencrypted));
 
 	r = readWalletRecord(&current_wallet, wallet_nv_address);
 	if (r != WALLET_NO_ERROR)
@@ -374,6 +726,16 @@ WalletErrors initWallet(uint32_t wallet_spec, const uint8_t *password, const uns
 WalletErrors uninitWallet(void)
 {
 	clearParentPublicKeyCache();
+#ifndef BIP32_NO_CACHE
+	bip32ClearCache();
+#endif // #ifndef BIP32_NO_CACHE
+#ifndef WALLET_NO_ADDRESS_CACHE
+	memset(address_cache, 0, sizeof(address_cache));
+#endif // #ifndef WALLET_NO_ADDRESS_CACHE
+#ifndef WALLET_NO_PRIVATE_KEY_CACHE
+	memset(private_key_cache, 0xff, sizeof(private_key_cache));
+	memset(private_key_cache, 0, sizeof(private_key_cache));
+#endif // #ifndef WALLET_NO_PRIVATE_KEY_CACHE
 	wallet_loaded = false;
 	is_hidden_wallet = false;
 	wallet_nv_address = 0;
@@ -382,6 +744,88 @@ WalletErrors uninitWallet(void)
 	return last_error;
 }
 
+#ifdef WALLET_CONTEXTS
+/** Select which wallet context subsequent wallet functions operate on. Each
+  * context can have its own wallet loaded (using initWallet() or
+  * newWallet()), and keeps its own encryption key and caches, so switching
+  * between loaded wallets doesn't cost a key derivation or any point
+  * multiplications. The only work done is copying the context and
+  * re-expanding its AES keys, which is negligible next to either.
+  * \param context The wallet context to select. This must be less than
+  *                #WALLET_CONTEXTS.
+  * \return #WALLET_NO_ERROR on success, or one of #WalletErrorsEnum if an
+  *         error occurred.
+  */
+WalletErrors selectWalletContext(uint32_t context)
+{
+	WalletContext *save;
+	WalletContext *restore;
+
+	if (context >= WALLET_CONTEXTS)
+	{
+		last_error = WALLET_INVALID_CONTEXT;
+		return last_error;
+	}
+	if (context != active_context)
+	{
+		save = &(saved_contexts[active_context]);
+		save->wallet_loaded = wallet_loaded;
+		save->is_hidden_wallet = is_hidden_wallet;
+		save->current_wallet = current_wallet;
+		save->wallet_nv_address = wallet_nv_address;
+		getEncryptionKey(save->encryption_key);
+		save->parent_public_key_valid = saveParentPublicKeyCache(&(save->parent_public_key));
+#ifndef WALLET_NO_ADDRESS_CACHE
+		memcpy(save->address_cache, address_cache, sizeof(address_cache));
+#endif // #ifndef WALLET_NO_ADDRESS_CACHE
+#ifndef WALLET_NO_PRIVATE_KEY_CACHE
+		memcpy(save->private_key_cache, private_key_cache, sizeof(private_key_cache));
+#endif // #ifndef WALLET_NO_PRIVATE_KEY_CACHE
+
+		restore = &(saved_contexts[context]);
+		wallet_loaded = restore->wallet_loaded;
+		is_hidden_wallet = restore->is_hidden_wallet;
+		current_wallet = restore->current_wallet;
+		wallet_nv_address = restore->wallet_nv_address;
+		setEncryptionKey(restore->encryption_key);
+		restoreParentPublicKeyCache(&(restore->parent_public_key), restore->parent_public_key_valid);
+#ifndef WALLET_NO_ADDRESS_CACHE
+		memcpy(address_cache, restore->address_cache, sizeof(address_cache));
+#endif // #ifndef WALLET_NO_ADDRESS_CACHE
+#ifndef WALLET_NO_PRIVATE_KEY_CACHE
+		memcpy(private_key_cache, restore->private_key_cache, sizeof(private_key_cache));
+#endif // #ifndef WALLET_NO_PRIVATE_KEY_CACHE
+		clearSavedContext(restore);
+#ifndef BIP32_NO_CACHE
+		// The BIP32 derivation cache notices the change of master node by
+		// itself, but there's no point leaving the other wallet's private
+		// keys lying around in it.
+		bip32ClearCache();
+#endif // #ifndef BIP32_NO_CACHE
+		active_context = (uint8_t)context;
+	}
+	last_error = WALLET_NO_ERROR;
+	return last_error;
+}
+
+/** Unload the wallets in every wallet context (not just the selected one, as
+  * uninitWallet() does), and select context 0.
+  * \return #WALLET_NO_ERROR on success, or one of #WalletErrorsEnum if an
+  *         error occurred.
+  */
+WalletErrors uninitAllWallets(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < WALLET_CONTEXTS; i++)
+	{
+		clearSavedContext(&(saved_contexts[i]));
+	}
+	active_context = 0;
+	return uninitWallet();
+}
+#endif // #ifdef WALLET_CONTEXTS
+
 #ifdef TEST_WALLET
 void logVersionFieldWrite(uint32_t address);
 #endif // #ifdef TEST_WALLET
@@ -430,6 +874,13 @@ static WalletErrors sanitiseNonVolatileStorage(NVPartitions partition, uint32_t
 		return last_error;
 	}
 
+#ifdef WALLET_DIRECTORY
+	if (partition == PARTITION_ACCOUNTS)
+	{
+		invalidateWalletDirectory(start, length);
+	}
+#endif // #ifdef WALLET_DIRECTORY
+
 	// 4 pass format: all 0s, all 1s, random, random. This ensures that
 	// every bit is cleared at least once, set at least once and ends up
 	// in an unpredictable state.
@@ -440,6 +891,20 @@ static WalletErrors sanitiseNonVolatileStorage(NVPartitions partition, uint32_t
 	{
 		address = start;
 		bytes_written = 0;
+#ifdef NATIVE_NV_FILL
+		if (pass < 2)
+		{
+			// The fixed patterns can be written by the platform in bulk,
+			// which is much quicker than writing them 32 bytes at a time.
+			r = nonVolatileFill((uint8_t)((pass == 0) ? 0x00 : 0xff), partition, start, length);
+			if (r != NV_NO_ERROR)
+			{
+				last_error = WALLET_WRITE_ERROR;
+				return last_error;
+			}
+			bytes_written = length;
+		}
+#endif // #ifdef NATIVE_NV_FILL
 		while (bytes_written < length)
 		{
 			if (pass == 0)
@@ -485,6 +950,7 @@ static WalletErrors sanitiseNonVolatileStorage(NVPartitions partition, uint32_t
 			}
 			address += bytes_to_write;
 			bytes_written += bytes_to_write;
+			BACKGROUND_YIELD();
 		} // end while (bytes_written < length)
 
 		// After each pass, flush write buffers to ensure that
@@ -581,19 +1047,82 @@ static WalletErrors sanitisePartition(NVPartitions partition)
 }
 
 /** Sanitise (clear) all partitions.
+  *
+  * This can take a long time, so it is quite possible for power to be lost
+  * part of the way through. To deal with that, a marker is written to
+  * #ADDRESS_SANITISE_MARKER before anything is cleared, and
+  * finishInterruptedSanitisation() (which should be called at startup) will
+  * restart sanitisation if it finds the marker. The accounts partition is
+  * cleared first, so that the marker survives until every wallet is gone.
+  * The marker is then overwritten as part of clearing the global partition.
   * \return #WALLET_NO_ERROR on success, or one of #WalletErrorsEnum if an
   *         error occurred.
   */
 WalletErrors sanitiseEverything(void)
 {
-	last_error = sanitisePartition(PARTITION_GLOBAL);
+	uint8_t marker[SANITISE_MARKER_LENGTH];
+#ifdef WALLET_CONTEXTS
+	uint8_t i;
+#endif // #ifdef WALLET_CONTEXTS
+
+#ifdef WALLET_CACHE_DERIVED_KEY
+	clearDerivedKeyCache();
+#endif // #ifdef WALLET_CACHE_DERIVED_KEY
+#ifdef WALLET_CONTEXTS
+	// None of the wallets in the other contexts will survive this.
+	for (i = 0; i < WALLET_CONTEXTS; i++)
+	{
+		clearSavedContext(&(saved_contexts[i]));
+	}
+#endif // #ifdef WALLET_CONTEXTS
+	memset(marker, SANITISE_MARKER_BYTE, sizeof(marker));
+	if (nonVolatileWrite(marker, PARTITION_GLOBAL, ADDRESS_SANITISE_MARKER, sizeof(marker)) != NV_NO_ERROR)
+	{
+		last_error = WALLET_WRITE_ERROR;
+		return last_error;
+	}
+	if (nonVolatileFlush() != NV_NO_ERROR)
+	{
+		last_error = WALLET_WRITE_ERROR;
+		return last_error;
+	}
+	last_error = sanitisePartition(PARTITION_ACCOUNTS);
 	if (last_error == WALLET_NO_ERROR)
 	{
-		last_error = sanitisePartition(PARTITION_ACCOUNTS);
+		last_error = sanitisePartition(PARTITION_GLOBAL);
 	}
 	return last_error;
 }
 
+/** Check whether a previous call to sanitiseEverything() was interrupted
+  * (for example, by a loss of power) and if so, run it again. This should
+  * be called once at startup, before any packets are processed. Otherwise,
+  * an interrupted format could leave a device with some of its wallets still
+  * intact.
+  * \return #WALLET_NO_ERROR on success (including if there was nothing to
+  *         do), or one of #WalletErrorsEnum if an error occurred.
+  */
+WalletErrors finishInterruptedSanitisation(void)
+{
+	uint8_t marker[SANITISE_MARKER_LENGTH];
+	unsigned int i;
+
+	if (nonVolatileRead(marker, PARTITION_GLOBAL, ADDRESS_SANITISE_MARKER, sizeof(marker)) != NV_NO_ERROR)
+	{
+		last_error = WALLET_READ_ERROR;
+		return last_error;
+	}
+	for (i = 0; i < sizeof(marker); i++)
+	{
+		if (marker[i] != SANITISE_MARKER_BYTE)
+		{
+			last_error = WALLET_NO_ERROR;
+			return last_error; // no marker, so nothing to do
+		}
+	}
+	return sanitiseEverything();
+}
+
 /** Computes wallet version of current wallet. This is in its own function
   * because it's used by both newWallet() and changeEncryptionKey().
   * \return See #WalletErrors.
@@ -646,7 +1175,13 @@ WalletErrors deleteWallet(uint32_t wallet_spec)
 	{
 		return last_error; // propagate error code
 	}
+#ifdef WALLET_CACHE_DERIVED_KEY
+	clearDerivedKeyCache();
+#endif // #ifdef WALLET_CACHE_DERIVED_KEY
 	address = wallet_spec * sizeof(WalletRecord);
+#ifdef WALLET_CONTEXTS
+	unloadSavedContexts(address);
+#endif // #ifdef WALLET_CONTEXTS
 	last_error = sanitiseNonVolatileStorage(PARTITION_ACCOUNTS, address, sizeof(WalletRecord));
 	return last_error;
 }
@@ -676,6 +1211,7 @@ WalletErrors newWallet(uint32_t wallet_spec, uint8_t *name, bool use_seed, uint8
 {
 	uint8_t random_buffer[32];
 	uint8_t uuid[UUID_LENGTH];
+	uint8_t pbkdf2_exponent;
 	WalletErrors r;
 
 	if (uninitWallet() != WALLET_NO_ERROR)
@@ -706,6 +1242,11 @@ WalletErrors newWallet(uint32_t wallet_spec, uint8_t *name, bool use_seed, uint8
 		last_error = WALLET_ALREADY_EXISTS;
 		return last_error;
 	}
+#ifdef WALLET_CONTEXTS
+	// There could be a hidden wallet loaded at this address in another
+	// context, which is about to be overwritten.
+	unloadSavedContexts(wallet_nv_address);
+#endif // #ifdef WALLET_CONTEXTS
 
 	if (make_hidden)
 	{
@@ -713,6 +1254,7 @@ WalletErrors newWallet(uint32_t wallet_spec, uint8_t *name, bool use_seed, uint8
 		// all unencrypted fields should be left untouched. This forces us to
 		// use the existing UUID.
 		memcpy(uuid, current_wallet.unencrypted.uuid, UUID_LENGTH);
+		pbkdf2_exponent = 0;
 	}
 	else
 	{
@@ -724,8 +1266,18 @@ WalletErrors newWallet(uint32_t wallet_spec, uint8_t *name, bool use_seed, uint8
 			return last_error;
 		}
 		memcpy(uuid, random_buffer, UUID_LENGTH);
+		pbkdf2_exponent = chooseWalletPBKDF2Exponent(password_length);
+	}
+	// An exponent of 0 means getPBKDF2Iterations(), as in
+	// getWalletPBKDF2Iterations().
+	if (pbkdf2_exponent == 0)
+	{
+		deriveAndSetEncryptionKey(uuid, password, password_length, getPBKDF2Iterations());
+	}
+	else
+	{
+		deriveAndSetEncryptionKey(uuid, password, password_length, (uint32_t)1 << pbkdf2_exponent);
 	}
-	deriveAndSetEncryptionKey(uuid, password, password_length);
 
 	// Update unencrypted fields of current_wallet.
 	if (!make_hidden)
@@ -736,6 +1288,7 @@ WalletErrors newWallet(uint32_t wallet_spec, uint8_t *name, bool use_seed, uint8
 			last_error = r;
 			return last_error;
 		}
+		current_wallet.unencrypted.pbkdf2_exponent = pbkdf2_exponent;
 		memset(current_wallet.unencrypted.reserved, 0, sizeof(current_wallet.unencrypted.reserved));
 		memcpy(current_wallet.unencrypted.name, name, NAME_LENGTH);
 		memcpy(current_wallet.unencrypted.uuid, uuid, UUID_LENGTH);
@@ -812,7 +1365,7 @@ AddressHandle makeNewAddress(uint8_t *out_address, PointAffine *out_public_key)
 	}
 	(current_wallet.encrypted.num_addresses)++;
 	calculateWalletChecksum(current_wallet.encrypted.checksum);
-	r = writeCurrentWalletRecord(wallet_nv_address);
+	r = writeCurrentWalletAddressCount(wallet_nv_address);
 	if (r != WALLET_NO_ERROR)
 	{
 		last_error = r;
@@ -829,6 +1382,30 @@ AddressHandle makeNewAddress(uint8_t *out_address, PointAffine *out_public_key)
 	}
 }
 
+/** Calculate the address (hash of the compressed public key) which
+  * corresponds to a public key.
+  * \param out_address The address will be written here (if everything
+  *                    goes well). This must be a byte array with space for
+  *                    20 bytes.
+  * \param public_key The public key to calculate the address of.
+  * \return #WALLET_NO_ERROR on success, or #WALLET_INVALID_HANDLE if the
+  *         public key is the point at infinity.
+  */
+static WalletErrors publicKeyToAddress(uint8_t *out_address, PointAffine *public_key)
+{
+	uint8_t serialised[ECDSA_MAX_SERIALISE_SIZE];
+	uint8_t serialised_size;
+
+	serialised_size = ecdsaSerialise(serialised, public_key, true);
+	if (serialised_size < 2)
+	{
+		// Somehow, the public ended up as the point at infinity.
+		return WALLET_INVALID_HANDLE;
+	}
+	hash160(out_address, serialised, serialised_size);
+	return WALLET_NO_ERROR;
+}
+
 /** Given an address handle, use the deterministic private key
   * generator to generate the address and public key associated
   * with that address handle.
@@ -843,12 +1420,11 @@ AddressHandle makeNewAddress(uint8_t *out_address, PointAffine *out_public_key)
   */
 WalletErrors getAddressAndPublicKey(uint8_t *out_address, PointAffine *out_public_key, AddressHandle ah)
 {
-	uint8_t buffer[32];
-	uint8_t serialised[ECDSA_MAX_SERIALISE_SIZE];
-	uint8_t serialised_size;
-	HashState hs;
+	BigNum256Storage buffer;
 	WalletErrors r;
-	uint8_t i;
+#ifndef WALLET_NO_ADDRESS_CACHE
+	AddressCacheEntry *entry;
+#endif // #ifndef WALLET_NO_ADDRESS_CACHE
 
 	if (!wallet_loaded)
 	{
@@ -866,6 +1442,17 @@ WalletErrors getAddressAndPublicKey(uint8_t *out_address, PointAffine *out_publi
 		return last_error;
 	}
 
+#ifndef WALLET_NO_ADDRESS_CACHE
+	entry = &(address_cache[ah % ADDRESS_CACHE_ENTRIES]);
+	if (entry->ah == ah)
+	{
+		memcpy(out_address, entry->address, sizeof(entry->address));
+		memcpy(out_public_key, &(entry->public_key), sizeof(PointAffine));
+		last_error = WALLET_NO_ERROR;
+		return last_error;
+	}
+#endif // #ifndef WALLET_NO_ADDRESS_CACHE
+
 	// Calculate private key.
 	r = getPrivateKey(buffer, ah);
 	if (r != WALLET_NO_ERROR)
@@ -874,32 +1461,167 @@ WalletErrors getAddressAndPublicKey(uint8_t *out_address, PointAffine *out_publi
 		return r;
 	}
 	// Calculate public key.
-	setToG(out_public_key);
-	pointMultiply(out_public_key, buffer);
+	PROFILE_ENTER(PROFILE_CRYPTO);
+	ecdsaMultiplyG(out_public_key, buffer);
+	PROFILE_EXIT();
+	memset(buffer, 0, sizeof(buffer));
 	// Calculate address.
-	serialised_size = ecdsaSerialise(serialised, out_public_key, true);
-	if (serialised_size < 2)
+	last_error = publicKeyToAddress(out_address, out_public_key);
+#ifndef WALLET_NO_ADDRESS_CACHE
+	if (last_error == WALLET_NO_ERROR)
+	{
+		entry->ah = ah;
+		memcpy(entry->address, out_address, sizeof(entry->address));
+		memcpy(&(entry->public_key), out_public_key, sizeof(PointAffine));
+	}
+#endif // #ifndef WALLET_NO_ADDRESS_CACHE
+	return last_error;
+}
+
+#ifndef WALLET_NO_ADDRESS_CACHE
+/** Calculate the address and public key of an address handle ahead of time,
+  * placing them in #address_cache, so that a later call
+  * to getAddressAndPublicKey() for that address handle is quick. Unlike
+  * getAddressAndPublicKey(), this also accepts the address handle which the
+  * next call to makeNewAddress() will return, since hosts often create
+  * addresses one after another. Nothing is done if the address handle is
+  * already in the cache.
+  * \param ah The address handle to precompute the address/public key of.
+  * \return #WALLET_NO_ERROR on success, or one of #WalletErrorsEnum if an
+  *         error occurred.
+  */
+WalletErrors precomputeAddress(AddressHandle ah)
+{
+	uint8_t private_key[32];
+	AddressCacheEntry *entry;
+	PointAffine public_key;
+	uint8_t address[20];
+	bool invalid_seed;
+
+	if (!wallet_loaded)
+	{
+		last_error = WALLET_NOT_LOADED;
+		return last_error;
+	}
+#ifdef TEST_WALLET
+	if ((ah == 0) || (ah > (current_wallet.encrypted.num_addresses + 1)) || (ah > MAX_TESTING_ADDRESSES))
+#else
+	if ((ah == 0) || (ah > (current_wallet.encrypted.num_addresses + 1)) || (ah > MAX_ADDRESSES))
+#endif // #ifdef TEST_WALLET
 	{
-		// Somehow, the public ended up as the point at infinity.
 		last_error = WALLET_INVALID_HANDLE;
 		return last_error;
 	}
-	sha256Begin(&hs);
-	for (i = 0; i < serialised_size; i++)
+	entry = &(address_cache[ah % ADDRESS_CACHE_ENTRIES]);
+	if (entry->ah == ah)
 	{
-		sha256WriteByte(&hs, serialised[i]);
+		last_error = WALLET_NO_ERROR;
+		return last_error; // already done
 	}
-	sha256Finish(&hs);
-	writeHashToByteArray(buffer, &hs, true);
-	ripemd160Begin(&hs);
-	for (i = 0; i < 32; i++)
+
+	// getPrivateKey() can't be used here, since ah might not have been
+	// allocated yet.
+	PROFILE_ENTER(PROFILE_CRYPTO);
+	invalid_seed = generateDeterministic256(private_key, current_wallet.encrypted.seed, ah);
+	PROFILE_EXIT();
+	if (invalid_seed)
+	{
+		// This should never happen.
+		memset(private_key, 0, sizeof(private_key));
+		last_error = WALLET_RNG_FAILURE;
+		return last_error;
+	}
+	PROFILE_ENTER(PROFILE_CRYPTO);
+	ecdsaMultiplyG(&public_key, private_key);
+	PROFILE_EXIT();
+	memset(private_key, 0, sizeof(private_key));
+	last_error = publicKeyToAddress(address, &public_key);
+	if (last_error == WALLET_NO_ERROR)
+	{
+		entry->ah = ah;
+		memcpy(entry->address, address, sizeof(entry->address));
+		memcpy(&(entry->public_key), &public_key, sizeof(PointAffine));
+	}
+	return last_error;
+}
+#endif // #ifndef WALLET_NO_ADDRESS_CACHE
+
+/** Generate the addresses and public keys associated with a range of
+  * consecutive address handles. This gives the same results as calling
+  * getAddressAndPublicKey() for each address handle, but is faster, since
+  * the public keys are calculated in batches (see ecdsaMultiplyGBatch()).
+  * \param out_addresses The addresses will be written here (if everything
+  *                      goes well), one after another. This must be a byte
+  *                      array with space for 20 x count bytes.
+  * \param out_public_keys The public keys corresponding to the addresses
+  *                        will be written here (if everything goes well).
+  *                        This must be an array with space for count
+  *                        points.
+  * \param first_ah The address handle of the first address to obtain the
+  *                 address/public key of.
+  * \param count The number of consecutive address handles (starting at
+  *              first_ah) to obtain the addresses/public keys of.
+  * \return #WALLET_NO_ERROR on success, or one of #WalletErrorsEnum if an
+  *         error occurred.
+  */
+WalletErrors getAddressesAndPublicKeys(uint8_t *out_addresses, PointAffine *out_public_keys, AddressHandle first_ah, uint8_t count)
+{
+	uint8_t private_keys[ECDSA_MAX_BATCH_SIZE * 32] WORD_ALIGNED;
+	uint32_t done;
+	uint8_t batch_size;
+	uint8_t i;
+	WalletErrors r;
+
+	if (!wallet_loaded)
+	{
+		last_error = WALLET_NOT_LOADED;
+		return last_error;
+	}
+	if (current_wallet.encrypted.num_addresses == 0)
+	{
+		last_error = WALLET_EMPTY;
+		return last_error;
+	}
+	if ((first_ah == 0) || (first_ah > current_wallet.encrypted.num_addresses)
+		|| (count > (current_wallet.encrypted.num_addresses - first_ah + 1)))
 	{
-		ripemd160WriteByte(&hs, buffer[i]);
+		last_error = WALLET_INVALID_HANDLE;
+		return last_error;
 	}
-	ripemd160Finish(&hs);
-	writeHashToByteArray(buffer, &hs, true);
-	memcpy(out_address, buffer, 20);
 
+	for (done = 0; done < count; done += batch_size)
+	{
+		batch_size = (uint8_t)(count - done);
+		if (batch_size > ECDSA_MAX_BATCH_SIZE)
+		{
+			batch_size = ECDSA_MAX_BATCH_SIZE;
+		}
+		// Calculate private keys.
+		for (i = 0; i < batch_size; i++)
+		{
+			r = getPrivateKey(&(private_keys[i * 32]), first_ah + done + i);
+			if (r != WALLET_NO_ERROR)
+			{
+				last_error = r;
+				return r;
+			}
+		}
+		// Calculate public keys.
+		PROFILE_ENTER(PROFILE_CRYPTO);
+		ecdsaMultiplyGBatch(&(out_public_keys[done]), private_keys, batch_size);
+		PROFILE_EXIT();
+		memset(private_keys, 0, sizeof(private_keys));
+		// Calculate addresses.
+		for (i = 0; i < batch_size; i++)
+		{
+			r = publicKeyToAddress(&(out_addresses[(done + i) * 20]), &(out_public_keys[done + i]));
+			if (r != WALLET_NO_ERROR)
+			{
+				last_error = r;
+				return r;
+			}
+		}
+	}
 	last_error = WALLET_NO_ERROR;
 	return last_error;
 }
@@ -916,22 +1638,25 @@ WalletErrors getAddressAndPublicKey(uint8_t *out_address, PointAffine *out_publi
   */
 WalletErrors getMasterPublicKey(PointAffine *out_public_key, uint8_t *out_chain_code)
 {
-	uint8_t local_seed[SEED_LENGTH]; // need a local copy to modify
-	BigNum256 k_par;
+	bool invalid_seed;
 
 	if (!wallet_loaded)
 	{
 		last_error = WALLET_NOT_LOADED;
 		return last_error;
 	}
-	memcpy(local_seed, current_wallet.encrypted.seed, SEED_LENGTH);
-	memcpy(out_chain_code, &(local_seed[32]), 32);
-	k_par = (BigNum256)local_seed;
-	swapEndian256(k_par); // since seed is big-endian
-	setFieldToN();
-	bigModulo(k_par, k_par); // just in case
-	setToG(out_public_key);
-	pointMultiply(out_public_key, k_par);
+	memcpy(out_chain_code, &(current_wallet.encrypted.seed[32]), 32);
+	// The master public key is the same as the deterministic key generator's
+	// parent public key, which is cached while the wallet is loaded.
+	PROFILE_ENTER(PROFILE_CRYPTO);
+	invalid_seed = getParentPublicKey(out_public_key, current_wallet.encrypted.seed);
+	PROFILE_EXIT();
+	if (invalid_seed)
+	{
+		// This should never happen.
+		last_error = WALLET_RNG_FAILURE;
+		return last_error;
+	}
 	last_error = WALLET_NO_ERROR;
 	return last_error;
 }
@@ -970,6 +1695,11 @@ uint32_t getNumAddresses(void)
   */
 WalletErrors getPrivateKey(uint8_t *out, AddressHandle ah)
 {
+	bool invalid_seed;
+#ifndef WALLET_NO_PRIVATE_KEY_CACHE
+	PrivateKeyCacheEntry *entry;
+#endif // #ifndef WALLET_NO_PRIVATE_KEY_CACHE
+
 	if (!wallet_loaded)
 	{
 		last_error = WALLET_NOT_LOADED;
@@ -985,12 +1715,28 @@ WalletErrors getPrivateKey(uint8_t *out, AddressHandle ah)
 		last_error = WALLET_INVALID_HANDLE;
 		return last_error;
 	}
-	if (generateDeterministic256(out, current_wallet.encrypted.seed, ah))
+#ifndef WALLET_NO_PRIVATE_KEY_CACHE
+	entry = &(private_key_cache[ah % PRIVATE_KEY_CACHE_ENTRIES]);
+	if (entry->ah == ah)
+	{
+		memcpy(out, entry->private_key, sizeof(entry->private_key));
+		last_error = WALLET_NO_ERROR;
+		return last_error;
+	}
+#endif // #ifndef WALLET_NO_PRIVATE_KEY_CACHE
+	PROFILE_ENTER(PROFILE_CRYPTO);
+	invalid_seed = generateDeterministic256(out, current_wallet.encrypted.seed, ah);
+	PROFILE_EXIT();
+	if (invalid_seed)
 	{
 		// This should never happen.
 		last_error = WALLET_RNG_FAILURE;
 		return last_error;
 	}
+#ifndef WALLET_NO_PRIVATE_KEY_CACHE
+	entry->ah = ah;
+	memcpy(entry->private_key, out, sizeof(entry->private_key));
+#endif // #ifndef WALLET_NO_PRIVATE_KEY_CACHE
 	last_error = WALLET_NO_ERROR;
 	return last_error;
 }
@@ -1012,7 +1758,13 @@ WalletErrors changeEncryptionKey(const uint8_t *password, const unsigned int pas
 		return last_error;
 	}
 
-	deriveAndSetEncryptionKey(current_wallet.unencrypted.uuid, password, password_length);
+	// A new password is a good time to recalibrate, but a hidden wallet's
+	// unencrypted fields must stay put (see below).
+	if (!is_hidden_wallet)
+	{
+		current_wallet.unencrypted.pbkdf2_exponent = chooseWalletPBKDF2Exponent(password_length);
+	}
+	deriveAndSetEncryptionKey(current_wallet.unencrypted.uuid, password, password_length, getWalletPBKDF2Iterations(&(current_wallet.unencrypted)));
 	// Updating the version field for a hidden wallet would reveal
 	// where it is, so don't do it.
 	if (!is_hidden_wallet)
@@ -1081,8 +1833,7 @@ WalletErrors changeWalletName(uint8_t *new_name)
   */
 WalletErrors getWalletInfo(uint32_t *out_version, uint8_t *out_name, uint8_t *out_uuid, uint32_t wallet_spec)
 {
-	WalletErrors r;
-	WalletRecord local_wallet_record;
+	struct WalletRecordUnencryptedStruct unencrypted;
 	uint32_t local_wallet_nv_address;
 
 	if (getNumberOfWallets() == 0)
@@ -1094,16 +1845,37 @@ WalletErrors getWalletInfo(uint32_t *out_version, uint8_t *out_name, uint8_t *ou
 		last_error = WALLET_INVALID_WALLET_NUM;
 		return last_error;
 	}
-	local_wallet_nv_address = wallet_spec * sizeof(WalletRecord);
-	r = readWalletRecord(&local_wallet_record, local_wallet_nv_address);
-	if (r != WALLET_NO_ERROR)
+#ifdef WALLET_DIRECTORY
+	if ((wallet_spec < WALLET_DIRECTORY_ENTRIES) && wallet_directory_valid[wallet_spec])
 	{
-		last_error = r;
-		return last_error;
+		memcpy(&unencrypted, &(wallet_directory[wallet_spec]), sizeof(unencrypted));
+	}
+	else
+#endif // #ifdef WALLET_DIRECTORY
+	{
+		local_wallet_nv_address = wallet_spec * sizeof(WalletRecord);
+		// Everything needed is in the unencrypted portion, so there's no
+		// point reading (and decrypting) the encrypted portion.
+		if (nonVolatileRead(
+			(uint8_t *)&unencrypted,
+			PARTITION_ACCOUNTS,
+			local_wallet_nv_address + offsetof(WalletRecord, unencrypted),
+			sizeof(unencrypted)) != NV_NO_ERROR)
+		{
+			last_error = WALLET_READ_ERROR;
+			return last_error;
+		}
+#ifdef WALLET_DIRECTORY
+		if (wallet_spec < WALLET_DIRECTORY_ENTRIES)
+		{
+			memcpy(&(wallet_directory[wallet_spec]), &unencrypted, sizeof(unencrypted));
+			wallet_directory_valid[wallet_spec] = true;
+		}
+#endif // #ifdef WALLET_DIRECTORY
 	}
-	*out_version = local_wallet_record.unencrypted.version;
-	memcpy(out_name, local_wallet_record.unencrypted.name, NAME_LENGTH);
-	memcpy(out_uuid, local_wallet_record.unencrypted.uuid, UUID_LENGTH);
+	*out_version = unencrypted.version;
+	memcpy(out_name, unencrypted.name, NAME_LENGTH);
+	memcpy(out_uuid, unencrypted.uuid, UUID_LENGTH);
 
 	last_error = WALLET_NO_ERROR;
 	return last_error;
@@ -1192,14 +1964,21 @@ uint32_t getNumberOfWallets(void)
 /** Size of accounts partition, in bytes. */
 #define TEST_ACCOUNTS_PARTITION_SIZE	1024
 
+#if !defined(TEST_XEX) && !defined(TEST_PRANDOM) && !defined(TEST_BENCH)
 /** Use this to stop nonVolatileWrite() from logging
   * all non-volatile writes to stdout. */
 static bool suppress_write_debug_info;
+#endif // #if !defined(TEST_XEX) && !defined(TEST_PRANDOM) && !defined(TEST_BENCH)
 
 /** Size of accounts partition. This can be modified to test the behaviour of
   * getNumberOfWallets(). */
 static uint32_t accounts_partition_size = TEST_ACCOUNTS_PARTITION_SIZE;
 
+#ifdef NV_STATISTICS
+/** Flush statistics returned by nonVolatileGetStatistics(). */
+static NVStatistics test_nv_statistics;
+#endif // #ifdef NV_STATISTICS
+
 #ifdef TEST_WALLET
 /** Highest non-volatile address that nonVolatileWrite() has written to.
   * Index to this array = partition number. */
@@ -1251,9 +2030,9 @@ NonVolatileReturn nonVolatileWrite(uint8_t *data, NVPartitions partition, uint32
 	uint32_t partition_offset;
 	uint32_t size;
 	NonVolatileReturn r;
-#if !defined(TEST_XEX) && !defined(TEST_PRANDOM)
+#if !defined(TEST_XEX) && !defined(TEST_PRANDOM) && !defined(TEST_BENCH)
 	uint32_t i;
-#endif // #if !defined(TEST_XEX) && !defined(TEST_PRANDOM)
+#endif // #if !defined(TEST_XEX) && !defined(TEST_PRANDOM) && !defined(TEST_BENCH)
 
 	if ((address > 0x10000000) || (length > 0x10000000))
 	{
@@ -1286,7 +2065,8 @@ NonVolatileReturn nonVolatileWrite(uint8_t *data, NVPartitions partition, uint32
 
 	// Don't output write debugging info when testing xex.c or prandom.c,
 	// otherwise the console will go crazy (since they do a lot of writing).
-#if !defined(TEST_XEX) && !defined(TEST_PRANDOM)
+	// It would also get in the way of benchmark results.
+#if !defined(TEST_XEX) && !defined(TEST_PRANDOM) && !defined(TEST_BENCH)
 	if (!suppress_write_debug_info)
 	{
 		printf("nv write, part = %d, addr = 0x%08x, length = 0x%04x, data =", (int)partition, (int)address, (int)length);
@@ -1296,20 +2076,62 @@ NonVolatileReturn nonVolatileWrite(uint8_t *data, NVPartitions partition, uint32
 		}
 		printf("\n");
 	}
-#endif // #if !defined(TEST_XEX) && !defined(TEST_PRANDOM)
+#endif // #if !defined(TEST_XEX) && !defined(TEST_PRANDOM) && !defined(TEST_BENCH)
 	if (partition == PARTITION_GLOBAL)
 	{
 		partition_offset = 0;
 	}
 	else
 	{
-		assert(nonVolatileGetSize(&partition_offset, PARTITION_GLOBAL) == NV_NO_ERROR);
+		// This can't be inside assert(), since that compiles to nothing
+		// when NDEBUG is defined.
+		r = nonVolatileGetSize(&partition_offset, PARTITION_GLOBAL);
+		assert(r == NV_NO_ERROR);
 	}
+	PROFILE_ENTER(PROFILE_NV_IO);
 	fseek(wallet_test_file, (long)(partition_offset + address), SEEK_SET);
 	fwrite(data, (size_t)length, 1, wallet_test_file);
+	PROFILE_EXIT();
 	return NV_NO_ERROR;
 }
 
+#ifdef NATIVE_NV_FILL
+/** Fill a range of non-volatile storage with one byte value. This just
+  * calls nonVolatileWrite() repeatedly, so that tests see (and check) the
+  * same writes as they would without NATIVE_NV_FILL.
+  * \param pattern The byte value to fill the range with.
+  * \param partition The partition to write to. Must be one of #NVPartitions.
+  * \param address Byte offset specifying where in the partition to
+  *                start writing to.
+  * \param length The number of bytes to write.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+NonVolatileReturn nonVolatileFill(uint8_t pattern, NVPartitions partition, uint32_t address, uint32_t length)
+{
+	uint8_t buffer[32];
+	uint32_t chunk_length;
+	NonVolatileReturn r;
+
+	memset(buffer, pattern, sizeof(buffer));
+	while (length > 0)
+	{
+		chunk_length = length;
+		if (chunk_length > sizeof(buffer))
+		{
+			chunk_length = sizeof(buffer);
+		}
+		r = nonVolatileWrite(buffer, partition, address, chunk_length);
+		if (r != NV_NO_ERROR)
+		{
+			return r;
+		}
+		address += chunk_length;
+		length -= chunk_length;
+	}
+	return NV_NO_ERROR;
+}
+#endif // #ifdef NATIVE_NV_FILL
+
 /** Read from non-volatile storage.
   * \param data A pointer to the buffer which will receive the data.
   * \param partition The partition to read from. Must be one of #NVPartitions.
@@ -1345,10 +2167,15 @@ extern NonVolatileReturn nonVolatileRead(uint8_t *data, NVPartitions partition,
 	}
 	else
 	{
-		assert(nonVolatileGetSize(&partition_offset, PARTITION_GLOBAL) == NV_NO_ERROR);
+		// This can't be inside assert(), since that compiles to nothing
+		// when NDEBUG is defined.
+		r = nonVolatileGetSize(&partition_offset, PARTITION_GLOBAL);
+		assert(r == NV_NO_ERROR);
 	}
+	PROFILE_ENTER(PROFILE_NV_IO);
 	fseek(wallet_test_file, (long)(partition_offset + address), SEEK_SET);
 	fread(data, (size_t)length, 1, wallet_test_file);
+	PROFILE_EXIT();
 	return NV_NO_ERROR;
 }
 
@@ -1359,10 +2186,61 @@ extern NonVolatileReturn nonVolatileRead(uint8_t *data, NVPartitions partition,
   */
 NonVolatileReturn nonVolatileFlush(void)
 {
+#ifdef NV_STATISTICS
+	uint32_t start_cycles;
+	uint32_t cycles;
+
+	start_cycles = getCycleCount();
+#endif // #ifdef NV_STATISTICS
+	PROFILE_ENTER(PROFILE_NV_IO);
 	fflush(wallet_test_file);
+	PROFILE_EXIT();
+#ifdef NV_STATISTICS
+	cycles = getCycleCount() - start_cycles;
+	test_nv_statistics.flush_count++;
+	test_nv_statistics.flush_total_cycles += cycles;
+	if (cycles > test_nv_statistics.flush_max_cycles)
+	{
+		test_nv_statistics.flush_max_cycles = cycles;
+	}
+#endif // #ifdef NV_STATISTICS
 	return NV_NO_ERROR;
 }
 
+#ifdef NV_STATISTICS
+/** Get wear and latency statistics for non-volatile storage. For testing,
+  * the storage is a file, which has no erasable units, so there are no
+  * erase counters.
+  * \param out_statistics The statistics will be written here.
+  * \return See #NonVolatileReturnEnum for return values.
+  */
+NonVolatileReturn nonVolatileGetStatistics(NVStatistics *out_statistics)
+{
+	memcpy(out_statistics, &test_nv_statistics, sizeof(NVStatistics));
+	out_statistics->num_erase_counters = 0;
+	return NV_NO_ERROR;
+}
+
+/** Get the number of times one erasable unit of non-volatile storage has
+  * been erased. For testing, there are no erasable units.
+  * \param out_count Unused.
+  * \param unit Unused.
+  * \return Always #NV_INVALID_ADDRESS.
+  */
+NonVolatileReturn nonVolatileGetEraseCount(uint32_t *out_count, uint32_t unit)
+{
+	(void)out_count;
+	(void)unit;
+	return NV_INVALID_ADDRESS;
+}
+
+/** Reset the flush latency statistics. */
+void nonVolatileResetFlushStatistics(void)
+{
+	memset(&test_nv_statistics, 0, sizeof(test_nv_statistics));
+}
+#endif // #ifdef NV_STATISTICS
+
 /** Pretend to overwrite anything in RAM which could contain sensitive
   * data. */
 void sanitiseRam(void)
@@ -1647,6 +2525,8 @@ int main(void)
 	PointAffine public_key;
 	PointAffine compare_public_key;
 	PointAffine *public_key_buffer;
+	uint8_t batch_addresses[MAX_TESTING_ADDRESSES * 20];
+	PointAffine batch_public_keys[MAX_TESTING_ADDRESSES];
 	bool abort;
 	bool is_zero;
 	bool abort_duplicate;
@@ -2328,6 +3208,125 @@ int main(void)
 		reportSuccess();
 	}
 
+	// Reloading the wallet clears the address cache, so this checks that
+	// getAddressAndPublicKey() gives the same results when it has to
+	// calculate everything from scratch.
+	uninitWallet();
+	initWallet(0, NULL, 0);
+	abort = false;
+	for (i = 0; i < MAX_TESTING_ADDRESSES; i++)
+	{
+		ah = handles_buffer[i];
+		if ((getAddressAndPublicKey(address1, &public_key, ah) != WALLET_NO_ERROR)
+			|| (memcmp(address1, &(address_buffer[i * 20]), 20))
+			|| (bigCompare(public_key.x, public_key_buffer[i].x) != BIGCMP_EQUAL)
+			|| (bigCompare(public_key.y, public_key_buffer[i].y) != BIGCMP_EQUAL))
+		{
+			printf("getAddressAndPublicKey() mismatch after reload, ah = %d\n", i);
+			abort = true;
+			reportFailure();
+			break;
+		}
+	}
+	if (!abort)
+	{
+		reportSuccess();
+	}
+
+#ifndef WALLET_NO_ADDRESS_CACHE
+	// Addresses which were precomputed using precomputeAddress() should be
+	// the same as the ones which were generated by makeNewAddress().
+	uninitWallet();
+	initWallet(0, NULL, 0);
+	abort = false;
+	for (i = 0; i < MAX_TESTING_ADDRESSES; i++)
+	{
+		ah = handles_buffer[i];
+		if ((precomputeAddress(ah) != WALLET_NO_ERROR)
+			|| (getAddressAndPublicKey(address1, &public_key, ah) != WALLET_NO_ERROR)
+			|| (memcmp(address1, &(address_buffer[i * 20]), 20))
+			|| (bigCompare(public_key.x, public_key_buffer[i].x) != BIGCMP_EQUAL)
+			|| (bigCompare(public_key.y, public_key_buffer[i].y) != BIGCMP_EQUAL))
+		{
+			printf("precomputeAddress() mismatch, ah = %d\n", i);
+			abort = true;
+			reportFailure();
+			break;
+		}
+	}
+	if (!abort)
+	{
+		reportSuccess();
+	}
+	// The wallet is full, so there is no next address to precompute.
+	if ((precomputeAddress(0) == WALLET_INVALID_HANDLE)
+		&& (precomputeAddress(MAX_TESTING_ADDRESSES + 1) == WALLET_INVALID_HANDLE))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("precomputeAddress() doesn't recognise invalid address handles\n");
+		reportFailure();
+	}
+#endif // #ifndef WALLET_NO_ADDRESS_CACHE
+
+	// getAddressesAndPublicKeys() should obtain the same addresses and public
+	// keys as makeNewAddress(), for every range of address handles.
+	abort_error = false;
+	abort = false;
+	for (i = 1; i <= MAX_TESTING_ADDRESSES; i++)
+	{
+		for (j = 0; j <= (MAX_TESTING_ADDRESSES - i + 1); j++)
+		{
+			if (getAddressesAndPublicKeys(batch_addresses, batch_public_keys, (AddressHandle)i, (uint8_t)j) != WALLET_NO_ERROR)
+			{
+				printf("Couldn't obtain addresses in wallet, first = %d, count = %d\n", i, j);
+				abort_error = true;
+				break;
+			}
+			if ((j > 0)
+				&& ((memcmp(batch_addresses, &(address_buffer[(i - 1) * 20]), (size_t)(j * 20)))
+				|| (bigCompare(batch_public_keys[0].x, public_key_buffer[i - 1].x) != BIGCMP_EQUAL)
+				|| (bigCompare(batch_public_keys[0].y, public_key_buffer[i - 1].y) != BIGCMP_EQUAL)
+				|| (bigCompare(batch_public_keys[j - 1].x, public_key_buffer[i + j - 2].x) != BIGCMP_EQUAL)
+				|| (bigCompare(batch_public_keys[j - 1].y, public_key_buffer[i + j - 2].y) != BIGCMP_EQUAL)))
+			{
+				printf("getAddressesAndPublicKeys() returned mismatching addresses or public keys, first = %d, count = %d\n", i, j);
+				abort = true;
+				break;
+			}
+		}
+		if (abort || abort_error)
+		{
+			break;
+		}
+	}
+	if (abort || abort_error)
+	{
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// getAddressesAndPublicKeys() should reject ranges which aren't entirely
+	// within the wallet.
+	if ((getAddressesAndPublicKeys(batch_addresses, batch_public_keys, 0, 1) == WALLET_INVALID_HANDLE)
+		&& (getAddressesAndPublicKeys(batch_addresses, batch_public_keys, MAX_TESTING_ADDRESSES + 1, 0) == WALLET_INVALID_HANDLE)
+		&& (getAddressesAndPublicKeys(batch_addresses, batch_public_keys, 1, MAX_TESTING_ADDRESSES + 1) == WALLET_INVALID_HANDLE)
+		&& (getAddressesAndPublicKeys(batch_addresses, batch_public_keys, MAX_TESTING_ADDRESSES, 2) == WALLET_INVALID_HANDLE)
+		&& (getAddressesAndPublicKeys(batch_addresses, batch_public_keys, BAD_ADDRESS_HANDLE, 1) == WALLET_INVALID_HANDLE))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("getAddressesAndPublicKeys() doesn't recognise invalid address handle ranges\n");
+		reportFailure();
+	}
+
 	// Test getAddressAndPublicKey() and getPrivateKey() functions using
 	// invalid and then valid address handles.
 	if (getAddressAndPublicKey(temp, &public_key, 0) == WALLET_INVALID_HANDLE)
@@ -2385,6 +3384,24 @@ int main(void)
 		reportFailure();
 	}
 
+	// The private key of an address must be the same whether or not it came
+	// from the private key cache, and whether or not the wallet has been
+	// reloaded since.
+	getPrivateKey(temp, handles_buffer[0]);
+	getPrivateKey(&(temp[32]), handles_buffer[0]);
+	uninitWallet();
+	initWallet(0, NULL, 0);
+	getPrivateKey(&(temp[64]), handles_buffer[0]);
+	if ((memcmp(temp, &(temp[32]), 32)) || (memcmp(temp, &(temp[64]), 32)))
+	{
+		printf("getPrivateKey() gives inconsistent results\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
 	free(address_buffer);
 	free(public_key_buffer);
 	free(handles_buffer);
@@ -2547,6 +3564,48 @@ int main(void)
 		reportFailure();
 	}
 
+	// Check that the PBKDF2 exponent was recorded. Without calibration, the
+	// wallet should just follow getPBKDF2Iterations().
+	uninitWallet();
+	nonVolatileRead(&one_byte, PARTITION_ACCOUNTS, offsetof(WalletRecord, unencrypted.pbkdf2_exponent), 1);
+#ifdef PBKDF2_CALIBRATE
+	if ((one_byte < 32) && (((uint32_t)1 << one_byte) >= getPBKDF2Iterations()))
+#else
+	if (one_byte == 0)
+#endif // #ifdef PBKDF2_CALIBRATE
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Unexpected PBKDF2 exponent %u\n", (unsigned int)one_byte);
+		reportFailure();
+	}
+
+	// Changing the exponent changes the key, and is caught by the checksum.
+	one_byte ^= 1;
+	nonVolatileWrite(&one_byte, PARTITION_ACCOUNTS, offsetof(WalletRecord, unencrypted.pbkdf2_exponent), 1);
+	if (initWallet(0, new_test_password, sizeof(new_test_password)) == WALLET_NOT_THERE)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Wallet with tampered PBKDF2 exponent can be loaded\n");
+		reportFailure();
+	}
+	one_byte ^= 1;
+	nonVolatileWrite(&one_byte, PARTITION_ACCOUNTS, offsetof(WalletRecord, unencrypted.pbkdf2_exponent), 1);
+	if (initWallet(0, new_test_password, sizeof(new_test_password)) == WALLET_NO_ERROR)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Wallet can't be loaded after restoring PBKDF2 exponent\n");
+		reportFailure();
+	}
+
 	// Test the getAddressAndPublicKey() and getPrivateKey() functions on an
 	// empty wallet.
 	deleteWallet(0);
@@ -3403,7 +4462,9 @@ int main(void)
 	// chain code that getMasterPublicKey() returned.
 	generateDeterministicPublicKey(&public_key, &master_public_key, chain_code, 1);
 	makeNewAddress(address1, &compare_public_key);
-	if (memcmp(&public_key, &compare_public_key, sizeof(PointAffine)))
+	if ((bigCompare(public_key.x, compare_public_key.x) != BIGCMP_EQUAL)
+		|| (bigCompare(public_key.y, compare_public_key.y) != BIGCMP_EQUAL)
+		|| (public_key.is_point_at_infinity != compare_public_key.is_point_at_infinity))
 	{
 		printf("Address 1 can't be derived from master public key\n");
 		reportFailure();
@@ -3414,7 +4475,9 @@ int main(void)
 	}
 	generateDeterministicPublicKey(&public_key, &master_public_key, chain_code, 2);
 	makeNewAddress(address1, &compare_public_key);
-	if (memcmp(&public_key, &compare_public_key, sizeof(PointAffine)))
+	if ((bigCompare(public_key.x, compare_public_key.x) != BIGCMP_EQUAL)
+		|| (bigCompare(public_key.y, compare_public_key.y) != BIGCMP_EQUAL)
+		|| (public_key.is_point_at_infinity != compare_public_key.is_point_at_infinity))
 	{
 		printf("Address 2 can't be derived from master public key\n");
 		reportFailure();
@@ -3469,6 +4532,159 @@ int main(void)
 		reportSuccess();
 	}
 
+#ifdef WALLET_CONTEXTS
+	// Load different wallets, with different encryption keys, in two wallet
+	// contexts. After switching back and forth, each context should still
+	// be using its own wallet and key.
+	uninitAllWallets();
+	deleteWallet(0);
+	deleteWallet(1);
+	abort = false;
+	if ((selectWalletContext(0) != WALLET_NO_ERROR)
+		|| (newWallet(0, name, false, NULL, false, (const uint8_t *)"password", 8) != WALLET_NO_ERROR)
+		|| (makeNewAddress(address1, &public_key) == BAD_ADDRESS_HANDLE)
+		|| (selectWalletContext(1) != WALLET_NO_ERROR)
+		|| (getNumAddresses() != 0)
+		|| (newWallet(1, name, false, NULL, false, NULL, 0) != WALLET_NO_ERROR)
+		|| (makeNewAddress(address2, &public_key) == BAD_ADDRESS_HANDLE)
+		|| (selectWalletContext(0) != WALLET_NO_ERROR)
+		|| (getAddressAndPublicKey(compare_address, &compare_public_key, 1) != WALLET_NO_ERROR)
+		|| memcmp(compare_address, address1, 20)
+		|| (makeNewAddress(compare_address, &compare_public_key) == BAD_ADDRESS_HANDLE)
+		|| (selectWalletContext(1) != WALLET_NO_ERROR)
+		|| (getNumAddresses() != 1)
+		|| (getAddressAndPublicKey(compare_address, &compare_public_key, 1) != WALLET_NO_ERROR)
+		|| memcmp(compare_address, address2, 20)
+		|| !memcmp(address1, address2, 20))
+	{
+		abort = true;
+	}
+	// The new address made in context 0 must have been written using
+	// wallet 0's key.
+	selectWalletContext(0);
+	uninitWallet();
+	if ((initWallet(0, (const uint8_t *)"password", 8) != WALLET_NO_ERROR)
+		|| (getNumAddresses() != 2))
+	{
+		abort = true;
+	}
+	if (!abort)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Wallet contexts interfere with each other\n");
+		reportFailure();
+	}
+
+	// A wallet can only be loaded in one context at a time. Loading it in
+	// another context should unload it from the original one.
+	selectWalletContext(1);
+	if ((initWallet(0, (const uint8_t *)"password", 8) == WALLET_NO_ERROR)
+		&& (selectWalletContext(0) == WALLET_NO_ERROR)
+		&& (getNumAddresses() == 0)
+		&& (walletGetLastError() == WALLET_NOT_LOADED))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Wallet can be loaded in two contexts at once\n");
+		reportFailure();
+	}
+
+	// Contexts which don't exist can't be selected, and uninitAllWallets()
+	// should unload every context.
+	if ((selectWalletContext(WALLET_CONTEXTS) == WALLET_INVALID_CONTEXT)
+		&& (uninitAllWallets() == WALLET_NO_ERROR)
+		&& (selectWalletContext(1) == WALLET_NO_ERROR)
+		&& (getNumAddresses() == 0)
+		&& (walletGetLastError() == WALLET_NOT_LOADED))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Invalid context selected, or uninitAllWallets() doesn't unload everything\n");
+		reportFailure();
+	}
+	uninitAllWallets();
+	deleteWallet(0);
+	deleteWallet(1);
+#endif // #ifdef WALLET_CONTEXTS
+
+	// Loading a wallet repeatedly with the right password should work, and
+	// a wrong password should still be rejected, even if the key derived
+	// from the right password is cached.
+	deleteWallet(0);
+	newWallet(0, name, false, NULL, false, (const uint8_t *)"password", 8);
+	uninitWallet();
+	if ((initWallet(0, (const uint8_t *)"password", 8) == WALLET_NO_ERROR)
+		&& (uninitWallet() == WALLET_NO_ERROR)
+		&& (initWallet(0, (const uint8_t *)"passworc", 8) == WALLET_NOT_THERE)
+		&& (initWallet(0, (const uint8_t *)"password", 7) == WALLET_NOT_THERE)
+		&& (initWallet(0, (const uint8_t *)"password", 8) == WALLET_NO_ERROR))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Reloading a wallet with right or wrong passwords behaves incorrectly\n");
+		reportFailure();
+	}
+	deleteWallet(0);
+
+	// finishInterruptedSanitisation() shouldn't do anything if
+	// sanitiseEverything() wasn't interrupted.
+	newWallet(0, name, false, NULL, false, NULL, 0);
+	uninitWallet();
+	if ((finishInterruptedSanitisation() == WALLET_NO_ERROR)
+		&& (initWallet(0, NULL, 0) == WALLET_NO_ERROR))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("finishInterruptedSanitisation() deletes wallet when it shouldn't\n");
+		reportFailure();
+	}
+
+	// Simulate an interrupted sanitiseEverything() by writing the marker;
+	// finishInterruptedSanitisation() should then delete everything and
+	// clear the marker.
+	uninitWallet();
+	memset(temp, SANITISE_MARKER_BYTE, SANITISE_MARKER_LENGTH);
+	nonVolatileWrite(temp, PARTITION_GLOBAL, ADDRESS_SANITISE_MARKER, SANITISE_MARKER_LENGTH);
+	nonVolatileFlush();
+	if ((finishInterruptedSanitisation() == WALLET_NO_ERROR)
+		&& (initWallet(0, NULL, 0) == WALLET_NOT_THERE))
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("finishInterruptedSanitisation() doesn't resume sanitisation\n");
+		reportFailure();
+	}
+	nonVolatileRead(temp, PARTITION_GLOBAL, ADDRESS_SANITISE_MARKER, SANITISE_MARKER_LENGTH);
+	for (i = 0; i < SANITISE_MARKER_LENGTH; i++)
+	{
+		if (temp[i] != SANITISE_MARKER_BYTE)
+		{
+			break;
+		}
+	}
+	if (i != SANITISE_MARKER_LENGTH)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("Sanitisation marker wasn't cleared\n");
+		reportFailure();
+	}
+
 	fclose(wallet_test_file);
 
 	finishTests();
@@ -79,17 +79,25 @@ typedef enum WalletErrorsEnum
 	/** A wallet already exists at the specified location. */
 	WALLET_ALREADY_EXISTS		=	13,
 	/** Bad non-volatile storage address or partition number. */
-	WALLET_BAD_ADDRESS			=	14
+	WALLET_BAD_ADDRESS			=	14,
+	/** Invalid wallet context number specified (see
+	  * selectWalletContext()). */
+	WALLET_INVALID_CONTEXT		=	15
 } WalletErrors;
 
 extern WalletErrors walletGetLastError(void);
 extern WalletErrors initWallet(uint32_t wallet_spec, const uint8_t *password, const unsigned int password_length);
 extern WalletErrors uninitWallet(void);
 extern WalletErrors sanitiseEverything(void);
+extern WalletErrors finishInterruptedSanitisation(void);
 extern WalletErrors deleteWallet(uint32_t wallet_spec);
 extern WalletErrors newWallet(uint32_t wallet_spec, uint8_t *name, bool use_seed, uint8_t *seed, bool make_hidden, const uint8_t *password, const unsigned int password_length);
 extern AddressHandle makeNewAddress(uint8_t *out_address, PointAffine *out_public_key);
 extern WalletErrors getAddressAndPublicKey(uint8_t *out_address, PointAffine *out_public_key, AddressHandle ah);
+#ifndef WALLET_NO_ADDRESS_CACHE
+extern WalletErrors precomputeAddress(AddressHandle ah);
+#endif // #ifndef WALLET_NO_ADDRESS_CACHE
+extern WalletErrors getAddressesAndPublicKeys(uint8_t *out_addresses, PointAffine *out_public_keys, AddressHandle first_ah, uint8_t count);
 extern WalletErrors getMasterPublicKey(PointAffine *out_public_key, uint8_t *out_chain_code);
 extern uint32_t getNumAddresses(void);
 extern WalletErrors getPrivateKey(uint8_t *out, AddressHandle ah);
@@ -98,6 +106,10 @@ extern WalletErrors changeWalletName(uint8_t *new_name);
 extern WalletErrors getWalletInfo(uint32_t *out_version, uint8_t *out_name, uint8_t *out_uuid, uint32_t wallet_spec);
 extern WalletErrors backupWallet(bool do_encrypt, uint32_t destination_device);
 extern uint32_t getNumberOfWallets(void);
+#ifdef WALLET_CONTEXTS
+extern WalletErrors selectWalletContext(uint32_t context);
+extern WalletErrors uninitAllWallets(void);
+#endif // #ifdef WALLET_CONTEXTS
 
 #ifdef TEST
 extern void initWalletTest(void);
@@ -37,6 +37,7 @@
 #include "prandom.h"
 #include "hwinterface.h"
 #include "endian.h"
+#include "profile.h"
 
 /** Primary encryption key. */
 static uint8_t nv_storage_encrypt_key[16];
@@ -44,6 +45,23 @@ static uint8_t nv_storage_encrypt_key[16];
   * key. */
 static uint8_t nv_storage_tweak_key[16];
 
+#ifndef XEX_NO_KEY_CACHE
+/** Expanded version of #nv_storage_encrypt_key, so that the key doesn't
+  * have to be expanded for every block. This is only valid if
+  * #expanded_keys_valid is true. */
+static uint8_t expanded_encrypt_key[EXPANDED_KEY_SIZE];
+/** Version of #nv_storage_encrypt_key expanded for decryption (see
+  * aesExpandKeyDecrypt()). This is only valid if #expanded_keys_valid is
+  * true. */
+static uint8_t expanded_decrypt_key[EXPANDED_KEY_SIZE];
+/** Expanded version of #nv_storage_tweak_key. This is only valid if
+  * #expanded_keys_valid is true. */
+static uint8_t expanded_tweak_key[EXPANDED_KEY_SIZE];
+/** Whether #expanded_encrypt_key, #expanded_decrypt_key and
+  * #expanded_tweak_key are the expanded versions of the current keys. */
+static bool expanded_keys_valid;
+#endif // #ifndef XEX_NO_KEY_CACHE
+
 /** Double a 128 bit integer under GF(2 ^ 128) with
   * reducing polynomial x ^ 128 + x ^ 7 + x ^ 2 + x + 1.
   * \param op1 The 128 bit integer to double. This should be an array of
@@ -70,44 +88,125 @@ static void doubleInGF(uint8_t *op1)
 	op1[0] = (uint8_t)(op1[0] ^ (0x87 & last_bit));
 }
 
+/** Calculate the XEX mode offset for a block.
+  * \param delta The offset will be written here. This must be a byte array
+  *              with space for 16 bytes.
+  * \param n See xexEncryptInternal().
+  * \param seq See xexEncryptInternal().
+  * \param expanded_tweak_key The tweak key, expanded using aesExpandKey().
+  */
+static void xexCalculateDelta(uint8_t *delta, uint8_t *n, uint8_t seq, uint8_t *expanded_tweak_key)
+{
+	uint8_t i;
+
+	aesEncrypt(delta, n, expanded_tweak_key);
+	for (i = 0; i < seq; i++)
+	{
+		doubleInGF(delta);
+	}
+}
+
 /** Combined XEX mode encrypt/decrypt, since they're almost the same.
   * See xexEncryptInternal() and xexDecryptInternal() for a description of
-  * what this does and what each parameter is.
+  * what this does.
   * \param out For encryption, this will be the resulting ciphertext. For
   *            decryption, this will be the resulting plaintext.
   * \param in For encryption, this will be the source plaintext. For
   *           decryption, this will be the source ciphertext.
+  * \param delta The offset for the block, as calculated by
+  *              xexCalculateDelta().
+  * \param expanded_encrypt_key The encryption key, expanded using
+  *                             aesExpandKey() (for encryption) or
+  *                             aesExpandKeyDecrypt() (for decryption).
+  * \param is_decrypt To decrypt, use true. To encrypt, use false.
+  */
+static void xexEnDecrypt(uint8_t *out, uint8_t *in, uint8_t *delta, uint8_t *expanded_encrypt_key, bool is_decrypt)
+{
+	uint8_t buffer[16];
+
+	memcpy(buffer, in, 16);
+	xor16Bytes(buffer, delta);
+	if (is_decrypt)
+	{
+		aesDecrypt(out, buffer, expanded_encrypt_key);
+	}
+	else
+	{
+		aesEncrypt(out, buffer, expanded_encrypt_key);
+	}
+	xor16Bytes(out, delta);
+}
+
+#ifndef XEX_NO_KEY_CACHE
+/** Make sure #expanded_encrypt_key, #expanded_decrypt_key and
+  * #expanded_tweak_key contain the expanded versions of the current keys.
+  */
+static void updateExpandedKeys(void)
+{
+	if (!expanded_keys_valid)
+	{
+		aesExpandKey(expanded_encrypt_key, nv_storage_encrypt_key);
+		aesExpandKeyDecrypt(expanded_decrypt_key, nv_storage_encrypt_key);
+		aesExpandKey(expanded_tweak_key, nv_storage_tweak_key);
+		expanded_keys_valid = true;
+	}
+}
+
+/** XEX mode encrypt/decrypt using the keys set by setEncryptionKey(). The
+  * expanded keys are cached, so the only AES work done is encrypting the
+  * tweak and encrypting/decrypting the block.
+  * \param out See xexEnDecrypt().
+  * \param in See xexEnDecrypt().
+  * \param n See xexEncryptInternal().
+  * \param seq See xexEncryptInternal().
+  * \param is_decrypt See xexEnDecrypt().
+  */
+static void xexEnDecryptCached(uint8_t *out, uint8_t *in, uint8_t *n, uint8_t seq, bool is_decrypt)
+{
+	uint8_t delta[16];
+
+	updateExpandedKeys();
+	xexCalculateDelta(delta, n, seq, expanded_tweak_key);
+	if (is_decrypt)
+	{
+		xexEnDecrypt(out, in, delta, expanded_decrypt_key, true);
+	}
+	else
+	{
+		xexEnDecrypt(out, in, delta, expanded_encrypt_key, false);
+	}
+}
+#endif // #ifndef XEX_NO_KEY_CACHE
+
+#if defined(XEX_NO_KEY_CACHE) || defined(TEST_XEX)
+
+/** XEX mode encrypt/decrypt using arbitrary (unexpanded) keys. The keys are
+  * expanded one after the other, so that only one expanded key needs to be
+  * on the stack at once.
+  * \param out See xexEnDecrypt().
+  * \param in See xexEnDecrypt().
   * \param n See xexEncryptInternal().
   * \param seq See xexEncryptInternal().
   * \param tweak_key See xexEncryptInternal().
   * \param encrypt_key See xexEncryptInternal().
-  * \param is_decrypt To decrypt, use true. To encrypt, use false.
+  * \param is_decrypt See xexEnDecrypt().
   */
-static void xexEnDecrypt(uint8_t *out, uint8_t *in, uint8_t *n, uint8_t seq, uint8_t *tweak_key, uint8_t *encrypt_key, bool is_decrypt)
+static void xexEnDecryptWithKeys(uint8_t *out, uint8_t *in, uint8_t *n, uint8_t seq, uint8_t *tweak_key, uint8_t *encrypt_key, bool is_decrypt)
 {
 	uint8_t expanded_key[EXPANDED_KEY_SIZE];
 	uint8_t delta[16];
-	uint8_t buffer[16];
-	uint8_t i;
 
 	aesExpandKey(expanded_key, tweak_key);
-	aesEncrypt(delta, n, expanded_key);
-	for (i = 0; i < seq; i++)
-	{
-		doubleInGF(delta);
-	}
-	memcpy(buffer, in, 16);
-	xor16Bytes(buffer, delta);
-	aesExpandKey(expanded_key, encrypt_key);
+	xexCalculateDelta(delta, n, seq, expanded_key);
 	if (is_decrypt)
 	{
-		aesDecrypt(out, buffer, expanded_key);
+		aesExpandKeyDecrypt(expanded_key, encrypt_key);
 	}
 	else
 	{
-		aesEncrypt(out, buffer, expanded_key);
+		aesExpandKey(expanded_key, encrypt_key);
 	}
-	xor16Bytes(out, delta);
+	xexEnDecrypt(out, in, delta, expanded_key, is_decrypt);
 }
 
 /** Encrypt one 16 byte block using AES in XEX mode. This uses an arbitrary
@@ -133,7 +232,7 @@ static void xexEnDecrypt(uint8_t *out, uint8_t *in, uint8_t *n, uint8_t seq, uin
   */
 static void xexEncryptInternal(uint8_t *out, uint8_t *in, uint8_t *n, uint8_t seq, uint8_t *tweak_key, uint8_t *encrypt_key)
 {
-	xexEnDecrypt(out, in, n, seq, tweak_key, encrypt_key, false);
+	xexEnDecryptWithKeys(out, in, n, seq, tweak_key, encrypt_key, false);
 }
 
 /** Decrypt the 16 byte block using AES in XEX mode. This uses an arbitrary
@@ -149,9 +248,11 @@ static void xexEncryptInternal(uint8_t *out, uint8_t *in, uint8_t *n, uint8_t se
   */
 static void xexDecryptInternal(uint8_t *out, uint8_t *in, uint8_t *n, uint8_t seq, uint8_t *tweak_key, uint8_t *encrypt_key)
 {
-	xexEnDecrypt(out, in, n, seq, tweak_key, encrypt_key, true);
+	xexEnDecryptWithKeys(out, in, n, seq, tweak_key, encrypt_key, true);
 }
 
+#endif // #if defined(XEX_NO_KEY_CACHE) || defined(TEST_XEX)
+
 /** Encrypt one 16 byte block using AES in XEX mode. This uses the encryption
   * key set by setEncryptionKey().
   * \param out The resulting ciphertext will be written to here. This must be
@@ -163,7 +264,13 @@ static void xexDecryptInternal(uint8_t *out, uint8_t *in, uint8_t *n, uint8_t se
   */
 void xexEncrypt(uint8_t *out, uint8_t *in, uint8_t *n, uint8_t seq)
 {
+	PROFILE_ENTER(PROFILE_CRYPTO);
+#ifdef XEX_NO_KEY_CACHE
 	xexEncryptInternal(out, in, n, seq, nv_storage_tweak_key, nv_storage_encrypt_key);
+#else
+	xexEnDecryptCached(out, in, n, seq, false);
+#endif // #ifdef XEX_NO_KEY_CACHE
+	PROFILE_EXIT();
 }
 
 /** Decrypt the 16 byte block using AES in XEX mode. This uses the encryption
@@ -177,7 +284,107 @@ void xexEncrypt(uint8_t *out, uint8_t *in, uint8_t *n, uint8_t seq)
   */
 void xexDecrypt(uint8_t *out, uint8_t *in, uint8_t *n, uint8_t seq)
 {
+	PROFILE_ENTER(PROFILE_CRYPTO);
+#ifdef XEX_NO_KEY_CACHE
 	xexDecryptInternal(out, in, n, seq, nv_storage_tweak_key, nv_storage_encrypt_key);
+#else
+	xexEnDecryptCached(out, in, n, seq, true);
+#endif // #ifdef XEX_NO_KEY_CACHE
+	PROFILE_EXIT();
+}
+
+/** Encrypt or decrypt many consecutive blocks of a data unit, using the
+  * encryption key set by setEncryptionKey(). The tweak is only encrypted
+  * once; the offset for each subsequent block is obtained from the previous
+  * one by a doubling in GF(2 ^ 128).
+  * \param out See xexEncryptBlocks().
+  * \param in See xexEncryptBlocks().
+  * \param n See xexEncryptBlocks().
+  * \param seq See xexEncryptBlocks().
+  * \param num_blocks See xexEncryptBlocks().
+  * \param is_decrypt See xexEnDecrypt().
+  */
+static void xexEnDecryptBlocks(uint8_t *out, uint8_t *in, uint8_t *n, uint8_t seq, uint8_t num_blocks, bool is_decrypt)
+{
+	uint8_t delta[16];
+	uint8_t *encrypt_key;
+	uint8_t i;
+#ifdef XEX_NO_KEY_CACHE
+	uint8_t expanded_key[EXPANDED_KEY_SIZE];
+
+	aesExpandKey(expanded_key, nv_storage_tweak_key);
+	xexCalculateDelta(delta, n, seq, expanded_key);
+	if (is_decrypt)
+	{
+		aesExpandKeyDecrypt(expanded_key, nv_storage_encrypt_key);
+	}
+	else
+	{
+		aesExpandKey(expanded_key, nv_storage_encrypt_key);
+	}
+	encrypt_key = expanded_key;
+#else
+	updateExpandedKeys();
+	xexCalculateDelta(delta, n, seq, expanded_tweak_key);
+	if (is_decrypt)
+	{
+		encrypt_key = expanded_decrypt_key;
+	}
+	else
+	{
+		encrypt_key = expanded_encrypt_key;
+	}
+#endif // #ifdef XEX_NO_KEY_CACHE
+	for (i = 0; i < num_blocks; i++)
+	{
+		if (i != 0)
+		{
+			doubleInGF(delta);
+		}
+		xexEnDecrypt(&(out[i * 16]), &(in[i * 16]), delta, encrypt_key, is_decrypt);
+	}
+}
+
+/** Encrypt many consecutive 16 byte blocks of one data unit using AES in
+  * XEX mode. This uses the encryption key set by setEncryptionKey().
+  * The result is the same as calling xexEncrypt() for each block (with
+  * seq, seq + 1, seq + 2 etc.), but the tweak only needs to be encrypted
+  * once, so this is almost twice as fast.
+  * \param out The resulting ciphertext will be written to here. This must be
+  *            a byte array with space for 16 x num_blocks bytes. This may
+  *            be the same as in.
+  * \param in The source plaintext. This must be a byte array containing
+  *           16 x num_blocks bytes of plaintext.
+  * \param n See xexEncryptInternal().
+  * \param seq The block within the data unit of the first block. Block i
+  *            (0 = first block) will use seq + i. See xexEncryptInternal()
+  *            for why this shouldn't be 0.
+  * \param num_blocks The number of blocks to encrypt.
+  */
+void xexEncryptBlocks(uint8_t *out, uint8_t *in, uint8_t *n, uint8_t seq, uint8_t num_blocks)
+{
+	PROFILE_ENTER(PROFILE_CRYPTO);
+	xexEnDecryptBlocks(out, in, n, seq, num_blocks, false);
+	PROFILE_EXIT();
+}
+
+/** Decrypt many consecutive 16 byte blocks of one data unit using AES in
+  * XEX mode. This uses the encryption key set by setEncryptionKey(). This
+  * is the inverse of xexEncryptBlocks().
+  * \param out The resulting plaintext will be written to here. This must be
+  *            a byte array with space for 16 x num_blocks bytes. This may
+  *            be the same as in.
+  * \param in The source ciphertext. This must be a byte array containing
+  *           16 x num_blocks bytes of ciphertext.
+  * \param n See xexEncryptBlocks().
+  * \param seq See xexEncryptBlocks().
+  * \param num_blocks The number of blocks to decrypt.
+  */
+void xexDecryptBlocks(uint8_t *out, uint8_t *in, uint8_t *n, uint8_t seq, uint8_t num_blocks)
+{
+	PROFILE_ENTER(PROFILE_CRYPTO);
+	xexEnDecryptBlocks(out, in, n, seq, num_blocks, true);
+	PROFILE_EXIT();
 }
 
 /** Set the combined encryption key.
@@ -190,6 +397,10 @@ void setEncryptionKey(const uint8_t *in)
 {
 	memcpy(nv_storage_encrypt_key, in, 16);
 	memcpy(nv_storage_tweak_key, &(in[16]), 16);
+#ifndef XEX_NO_KEY_CACHE
+	expanded_keys_valid = false;
+	updateExpandedKeys();
+#endif // #ifndef XEX_NO_KEY_CACHE
 }
 
 /** Get the combined encryption key.
@@ -241,6 +452,17 @@ void clearEncryptionKey(void)
 	memset(nv_storage_encrypt_key, 0xff, 16);
 	memset(nv_storage_tweak_key, 0, 16);
 	memset(nv_storage_encrypt_key, 0, 16);
+#ifndef XEX_NO_KEY_CACHE
+	// The expanded keys are as sensitive as the keys themselves. They will
+	// be re-calculated (from the now all zero keys) when next needed.
+	memset(expanded_tweak_key, 0xff, sizeof(expanded_tweak_key));
+	memset(expanded_encrypt_key, 0xff, sizeof(expanded_encrypt_key));
+	memset(expanded_decrypt_key, 0xff, sizeof(expanded_decrypt_key));
+	memset(expanded_tweak_key, 0, sizeof(expanded_tweak_key));
+	memset(expanded_encrypt_key, 0, sizeof(expanded_encrypt_key));
+	memset(expanded_decrypt_key, 0, sizeof(expanded_decrypt_key));
+	expanded_keys_valid = false;
+#endif // #ifndef XEX_NO_KEY_CACHE
 }
 
 /** Wrapper around nonVolatileWrite() which also encrypts data
@@ -278,20 +500,32 @@ NonVolatileReturn encryptedNonVolatileWrite(uint8_t *data, NVPartitions partitio
 	memset(n, 0, 16);
 	for (; block_start <= block_end; block_start += 16)
 	{
-		r = nonVolatileRead(ciphertext, partition, block_start, 16);
-		if (r != NV_NO_ERROR)
+		writeU32LittleEndian(n, block_start);
+		if ((block_offset == 0) && (length >= 16))
 		{
-			return r;
+			// The write completely covers this block, so there's no need
+			// to read and decrypt the old contents; the block can be
+			// encrypted directly from the source buffer.
+			xexEncrypt(ciphertext, data, n, 1);
+			data += 16;
+			length -= 16;
 		}
-		writeU32LittleEndian(n, block_start);
-		xexDecrypt(plaintext, ciphertext, n, 1);
-		while (length && block_offset < 16)
+		else
 		{
-			plaintext[block_offset++] = *data++;
-			length--;
+			r = nonVolatileRead(ciphertext, partition, block_start, 16);
+			if (r != NV_NO_ERROR)
+			{
+				return r;
+			}
+			xexDecrypt(plaintext, ciphertext, n, 1);
+			while (length && block_offset < 16)
+			{
+				plaintext[block_offset++] = *data++;
+				length--;
+			}
+			block_offset = 0;
+			xexEncrypt(ciphertext, plaintext, n, 1);
 		}
-		block_offset = 0;
-		xexEncrypt(ciphertext, plaintext, n, 1);
 		r = nonVolatileWrite(ciphertext, partition, block_start, 16);
 		if (r != NV_NO_ERROR)
 		{
@@ -353,6 +587,70 @@ NonVolatileReturn encryptedNonVolatileRead(uint8_t *data, NVPartitions partition
 	return NV_NO_ERROR;
 }
 
+/** Re-encrypt an area of non-volatile storage, changing it from being
+  * encrypted with the current encryption key to being encrypted with a new
+  * one. This works in place, a few blocks at a time, so the cost is
+  * proportional to the size of the area and no buffer the size of the area
+  * is needed. When this returns, the new key will be the current encryption
+  * key (even if an error occurred).
+  * \param new_key The new combined encryption key. This must be an array of
+  *                32 bytes; see setEncryptionKey().
+  * \param partition The partition to re-encrypt. Must be one of
+  *                  #NVPartitions.
+  * \param address Byte offset specifying where in the partition the area
+  *                starts. This must be a multiple of 16.
+  * \param length The size of the area in bytes. This must be a multiple
+  *               of 16.
+  * \return See #NonVolatileReturnEnum for return values.
+  * \warning If this fails (or power is lost) part of the way through, the
+  *          area will be encrypted partly with the old key and partly with
+  *          the new key. Like encryptedNonVolatileWrite(), this doesn't call
+  *          nonVolatileFlush(); the caller should do that.
+  */
+NonVolatileReturn encryptedNonVolatileReencrypt(const uint8_t *new_key, NVPartitions partition, uint32_t address, uint32_t length)
+{
+	uint8_t old_key[32];
+	uint8_t buffer[32];
+	uint32_t chunk_length;
+	NonVolatileReturn r;
+
+	// Blocks must never be split between chunks, otherwise a block would be
+	// decrypted with the wrong key when its second part is re-encrypted.
+	if (((address & 0x0000000f) != 0) || ((length & 0x0000000f) != 0))
+	{
+		return NV_INVALID_ADDRESS;
+	}
+
+	getEncryptionKey(old_key);
+	r = NV_NO_ERROR;
+	while (length > 0)
+	{
+		chunk_length = length;
+		if (chunk_length > sizeof(buffer))
+		{
+			chunk_length = sizeof(buffer);
+		}
+		setEncryptionKey(old_key);
+		r = encryptedNonVolatileRead(buffer, partition, address, chunk_length);
+		if (r != NV_NO_ERROR)
+		{
+			break;
+		}
+		setEncryptionKey(new_key);
+		r = encryptedNonVolatileWrite(buffer, partition, address, chunk_length);
+		if (r != NV_NO_ERROR)
+		{
+			break;
+		}
+		address += chunk_length;
+		length -= chunk_length;
+	}
+	setEncryptionKey(new_key);
+	memset(old_key, 0, sizeof(old_key));
+	memset(buffer, 0, sizeof(buffer));
+	return r;
+}
+
 #ifdef TEST_XEX
 
 /** Run unit tests using test vectors from a file. The file is expected to be
@@ -703,6 +1001,74 @@ int main(void)
 		}
 	}
 
+	// Re-encrypt part of the storage with a different key. That part should
+	// then only be readable with the new key, and everything else should
+	// still be readable with the old key.
+	if (encryptedNonVolatileReencrypt(one_key, PARTITION_ACCOUNTS, 8, 32) == NV_INVALID_ADDRESS)
+	{
+		reportSuccess();
+	}
+	else
+	{
+		printf("encryptedNonVolatileReencrypt() accepts misaligned area\n");
+		reportFailure();
+	}
+	getEncryptionKey(&(buffer[480]));
+	for (i = 0; i < 32; i++)
+	{
+		one_key[i] = (uint8_t)rand();
+	}
+	if (encryptedNonVolatileReencrypt(one_key, PARTITION_ACCOUNTS, 160, 336) != NV_NO_ERROR)
+	{
+		printf("encryptedNonVolatileReencrypt() failed\n");
+		reportFailure();
+	}
+	encryptedNonVolatileRead(buffer, PARTITION_ACCOUNTS, 160, 336);
+	if (memcmp(buffer, &(what_storage_should_be[160]), 336))
+	{
+		printf("Re-encrypted area doesn't match with new key\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	setEncryptionKey(&(buffer[480]));
+	encryptedNonVolatileRead(buffer, PARTITION_ACCOUNTS, 0, 160);
+	if (memcmp(buffer, what_storage_should_be, 160))
+	{
+		printf("Area before re-encrypted area was disturbed\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	encryptedNonVolatileRead(buffer, PARTITION_ACCOUNTS, 496, 16);
+	if (memcmp(buffer, &(what_storage_should_be[496]), 16))
+	{
+		printf("Area after re-encrypted area was disturbed\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	encryptedNonVolatileRead(buffer, PARTITION_ACCOUNTS, 160, 16);
+	if (!memcmp(buffer, &(what_storage_should_be[160]), 16))
+	{
+		printf("Re-encrypted area can be read with old key\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	// Change back to the old key, so that the tests below still work.
+	getEncryptionKey(&(buffer[480]));
+	setEncryptionKey(one_key);
+	encryptedNonVolatileReencrypt(&(buffer[480]), PARTITION_ACCOUNTS, 160, 336);
+
 	// Now change the encryption keys and try to obtain the contents of the
 	// non-volatile storage. The result should be mismatches everywhere.
 
@@ -761,6 +1127,68 @@ int main(void)
 		}
 	}
 
+	// xexEncrypt() and xexDecrypt() (which may use cached, expanded keys)
+	// should agree with the versions which take the keys as parameters.
+	for (i = 0; i < 32; i++)
+	{
+		one_key[i] = (uint8_t)rand();
+	}
+	setEncryptionKey(one_key);
+	for (i = 0; i < 16; i++)
+	{
+		buffer[i] = (uint8_t)rand();
+		buffer[16 + i] = (uint8_t)rand();
+	}
+	xexEncrypt(&(buffer[32]), buffer, &(buffer[16]), 3);
+	xexEncryptInternal(&(buffer[48]), buffer, &(buffer[16]), 3, &(one_key[16]), one_key);
+	xexDecrypt(&(buffer[64]), &(buffer[32]), &(buffer[16]), 3);
+	if (memcmp(&(buffer[32]), &(buffer[48]), 16) || memcmp(&(buffer[64]), buffer, 16))
+	{
+		printf("xexEncrypt()/xexDecrypt() don't match xexEncryptInternal()\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+
+	// xexEncryptBlocks() should be the same as calling xexEncrypt() for
+	// each block, with consecutive values of seq.
+	for (i = 0; i < 128; i++)
+	{
+		buffer[i] = (uint8_t)rand();
+	}
+	for (i = 0; i < 16; i++)
+	{
+		one_key[i] = (uint8_t)rand(); // used as n
+	}
+	xexEncryptBlocks(&(buffer[128]), buffer, one_key, 250, 6);
+	for (i = 0; i < 6; i++)
+	{
+		xexEncrypt(&(buffer[256 + i * 16]), &(buffer[i * 16]), one_key, (uint8_t)(250 + i));
+	}
+	if (memcmp(&(buffer[128]), &(buffer[256]), 6 * 16))
+	{
+		printf("xexEncryptBlocks() doesn't match xexEncrypt()\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	// Decrypt in place.
+	xexDecryptBlocks(&(buffer[128]), &(buffer[128]), one_key, 250, 6);
+	if (memcmp(&(buffer[128]), buffer, 6 * 16))
+	{
+		printf("xexDecryptBlocks() doesn't invert xexEncryptBlocks()\n");
+		reportFailure();
+	}
+	else
+	{
+		reportSuccess();
+	}
+	clearEncryptionKey();
+
 	finishTests();
 	exit(0);
 }
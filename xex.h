@@ -23,11 +23,14 @@
 
 extern void xexEncrypt(uint8_t *out, uint8_t *in, uint8_t *n, uint8_t seq);
 extern void xexDecrypt(uint8_t *out, uint8_t *in, uint8_t *n, uint8_t seq);
+extern void xexEncryptBlocks(uint8_t *out, uint8_t *in, uint8_t *n, uint8_t seq, uint8_t num_blocks);
+extern void xexDecryptBlocks(uint8_t *out, uint8_t *in, uint8_t *n, uint8_t seq, uint8_t num_blocks);
 extern void setEncryptionKey(const uint8_t *in);
 extern void getEncryptionKey(uint8_t *out);
 extern bool isEncryptionKeyNonZero(void);
 extern void clearEncryptionKey(void);
 extern NonVolatileReturn encryptedNonVolatileWrite(uint8_t *data, NVPartitions partition, uint32_t address, uint32_t length);
 extern NonVolatileReturn encryptedNonVolatileRead(uint8_t *data, NVPartitions partition, uint32_t address, uint32_t length);
+extern NonVolatileReturn encryptedNonVolatileReencrypt(const uint8_t *new_key, NVPartitions partition, uint32_t address, uint32_t length);
 
 #endif // #ifndef XEX_H_INCLUDED